@@ -75,6 +75,8 @@
         'page_protection_helpers.cc',
         'page_protection_helpers.h',
         'quarantine.h',
+        'quarantines/mpsc_sharded_quarantine.h',
+        'quarantines/mpsc_sharded_quarantine_impl.h',
         'quarantines/sharded_quarantine.h',
         'quarantines/sharded_quarantine_impl.h',
         'quarantines/size_limited_quarantine.h',
@@ -100,6 +102,8 @@
         'shadow.cc',
         'shadow.h',
         'shadow_impl.h',
+        'shadow_kernels.cc',
+        'shadow_kernels.h',
         'shadow_marker.cc',
         'shadow_marker.h',
         'stack_capture_cache.cc',
@@ -188,6 +192,7 @@
         'rtl_utils_unittest.cc',
         'runtime_unittest.cc',
         'scoped_page_protections_unittest.cc',
+        'shadow_kernels_unittest.cc',
         'shadow_marker_unittest.cc',
         'shadow_unittest.cc',
         'stack_capture_cache_unittest.cc',
@@ -202,6 +207,7 @@
         'heap_managers/block_heap_manager_unittest.cc',
         'heap_managers/deferred_free_thread_unittest.cc',
         'memory_notifiers/shadow_memory_notifier_unittest.cc',
+        'quarantines/mpsc_sharded_quarantine_unittest.cc',
         'quarantines/sharded_quarantine_unittest.cc',
         'quarantines/size_limited_quarantine_unittest.cc',
         'reporters/breakpad_reporter_unittest.cc',
@@ -255,6 +261,27 @@
         'SYZYGY_UNITTESTS_USE_LONG_TIMEOUT=1',
       ],
     },
+    {
+      'target_name': 'syzyasan_rtl_perftests',
+      'type': 'executable',
+      'sources': [
+        'heap_managers/block_heap_manager_perftest.cc',
+        'shadow_perftest.cc',
+        '<(src)/syzygy/testing/run_all_unittests.cc',
+        '<(src)/testing/perf/perf_test.cc',
+        '<(src)/testing/perf/perf_test.h',
+      ],
+      'dependencies': [
+        'syzyasan_rtl_lib',
+        'syzyasan_rtl_unittest_utils',
+        '<(src)/base/base.gyp:base',
+        '<(src)/base/base.gyp:test_support_base',
+        '<(src)/syzygy/agent/common/common.gyp:agent_common_lib',
+        '<(src)/syzygy/common/common.gyp:common_lib',
+        '<(src)/syzygy/testing/testing.gyp:testing_lib',
+        '<(src)/testing/gtest.gyp:gtest',
+      ],
+    },
     {
       'target_name': 'syzyasan_rtl_unittests_4g',
       'type': 'none',
@@ -661,7 +661,7 @@ void PopulateAsanParameters(const AsanErrorInfo& error_info,
 
   // Any new parameter added to the parameters structure should also be added
   // here.
-  static_assert(15 == ::common::kAsanParametersVersion,
+  static_assert(18 == ::common::kAsanParametersVersion,
                 "Pointers in the params must be linked up here.");
   crashdata::Dictionary* param_dict = crashdata::DictAddDict("asan-parameters",
                                                              dict);
@@ -701,6 +701,15 @@ void PopulateAsanParameters(const AsanErrorInfo& error_info,
   crashdata::LeafSetReal(
       error_info.asan_parameters.quarantine_flood_fill_rate,
       crashdata::DictAddLeaf("quarantine-flood-fill-rate", param_dict));
+  crashdata::LeafSetUInt(error_info.asan_parameters.enable_block_magazines,
+                         crashdata::DictAddLeaf("enable-block-magazines",
+                                                param_dict));
+  crashdata::LeafSetUInt(
+      error_info.asan_parameters.enable_lock_free_quarantine,
+      crashdata::DictAddLeaf("enable-lock-free-quarantine", param_dict));
+  crashdata::LeafSetUInt(error_info.asan_parameters.enable_stack_walk_cache,
+                         crashdata::DictAddLeaf("enable-stack-walk-cache",
+                                                param_dict));
 }
 
 }  // namespace
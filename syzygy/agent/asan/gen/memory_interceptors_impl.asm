@@ -35,9 +35,11 @@ EXTERN C asan_redirect_clang_stub_entry:PROC
 
 ; Declare the error handling funtion.
 EXTERN C asan_report_bad_memory_access:PROC
+EXTERN C asan_report_bad_range_access:PROC
 
 ; Declares the symbols that this compiland exports.
 PUBLIC asan_no_check
+PUBLIC asan_no_range_check
 PUBLIC asan_string_no_check
 PUBLIC asan_redirect_tail
 PUBLIC asan_redirect_tail_clang
@@ -122,6 +124,14 @@ PUBLIC asan_check_repz_1_byte_stos_access  ; Probe #76.
 PUBLIC asan_check_4_byte_stos_access  ; Probe #77.
 PUBLIC asan_check_2_byte_stos_access  ; Probe #78.
 PUBLIC asan_check_1_byte_stos_access  ; Probe #79.
+PUBLIC asan_check_range_read_access_2gb  ; Probe #80.
+PUBLIC asan_check_range_write_access_2gb  ; Probe #81.
+PUBLIC asan_check_range_read_access_no_flags_2gb  ; Probe #82.
+PUBLIC asan_check_range_write_access_no_flags_2gb  ; Probe #83.
+PUBLIC asan_check_range_read_access_4gb  ; Probe #84.
+PUBLIC asan_check_range_write_access_4gb  ; Probe #85.
+PUBLIC asan_check_range_read_access_no_flags_4gb  ; Probe #86.
+PUBLIC asan_check_range_write_access_no_flags_4gb  ; Probe #87.
 
 ; Create a new text segment to house the memory interceptors.
 .probes SEGMENT PAGE PUBLIC READ EXECUTE 'CODE'
@@ -138,6 +148,18 @@ asan_no_check PROC
   ret 4
 asan_no_check ENDP
 
+; On entry, the address to check is in EDX and the stack has the size of the
+; range and the previous contents of EDX. On exit the previous contents of EDX
+; have been restored and both values popped off the stack. This function
+; modifies no other registers, in particular it saves and restores EFLAGS.
+ALIGN 16
+asan_no_range_check PROC
+  ; Restore EDX.
+  mov edx, DWORD PTR[esp + 8]
+  ; And return.
+  ret 8
+asan_no_range_check ENDP
+
 ; No state is saved for string instructions.
 ALIGN 16
 asan_string_no_check PROC
@@ -5102,6 +5124,682 @@ skip_neg_direction_79 LABEL NEAR
   ret
 asan_check_1_byte_stos_access ENDP
 
+; On entry, the address of the first byte of the range is in EDX, the size of
+; the range is on top of the stack and the previous contents of EDX are below
+; it. On exit the previous contents of EDX have been restored and both values
+; popped off the stack. This function modifies no other registers, in
+; particular it saves and restores EFLAGS.
+ALIGN 16
+asan_check_range_read_access_2gb PROC  ; Probe #80.
+  ; Save the EFLAGS.
+  push eax
+  lahf
+  seto al
+  push ebx
+  push ecx
+  push edx
+  mov ecx, DWORD PTR[esp + 20]
+  lea ecx, DWORD PTR[edx + ecx - 1]
+  ; Fail if the range wraps around the address space, or if its last byte is
+  ; above the 2GB threshold. The first byte is then below it too.
+  cmp ecx, edx
+  jb report_failure_80
+  test ecx, ecx
+  js report_failure_80
+  ; Divide by 8 to convert the addresses to shadow indices.
+  shr edx, 3
+  shr ecx, 3
+check_range_loop_80 LABEL NEAR
+  cmp edx, ecx
+  jae check_range_last_80
+  movzx ebx, BYTE PTR[edx + asan_memory_interceptors_shadow_memory]
+shadow_reference_56 LABEL NEAR
+  test ebx, ebx
+  jnz report_failure_80
+  inc edx
+  jmp check_range_loop_80
+check_range_last_80 LABEL NEAR
+  movzx ebx, BYTE PTR[ecx + asan_memory_interceptors_shadow_memory]
+shadow_reference_57 LABEL NEAR
+  cmp bl, 0
+  jz check_range_done_80
+  js report_failure_80
+  mov ecx, DWORD PTR[esp]
+  add ecx, DWORD PTR[esp + 20]
+  dec ecx
+  and ecx, 7
+  cmp cl, bl
+  jae report_failure_80
+check_range_done_80 LABEL NEAR
+  add esp, 4
+  pop ecx
+  pop ebx
+  ; Restore the EFLAGS.
+  add al, 7Fh
+  sahf
+  pop eax
+  ; Restore original EDX.
+  mov edx, DWORD PTR[esp + 8]
+  ret 8
+report_failure_80 LABEL NEAR
+  ; Restore memory location in EDX.
+  pop edx
+  pop ecx
+  pop ebx
+  ; Restore the EFLAGS.
+  add al, 7Fh
+  sahf
+  pop eax
+  ; Restore original value of EDX, and put memory location on stack.
+  xchg edx, DWORD PTR[esp + 8]
+  ; Create an Asan registers context on the stack.
+  pushfd
+  pushad
+  ; Fix the original value of ESP in the Asan registers context.
+  ; Removing 16 bytes (e.g. EFLAGS / EIP / range size / Original EDX).
+  add DWORD PTR[esp + 12], 16
+  ; Push ARG4: the address of Asan context on stack.
+  push esp
+  ; Push ARG3: the size of the range.
+  push DWORD PTR[esp + 44]
+  ; Push ARG2: the access type.
+  push 0
+  ; Push ARG1: the memory location.
+  push DWORD PTR[esp + 56]
+  call asan_report_bad_range_access
+  ; Remove 4 x ARG on stack.
+  add esp, 16
+  ; Restore original registers.
+  popad
+  popfd
+  ; Return and remove range size and memory location on stack.
+  ret 8
+asan_check_range_read_access_2gb ENDP
+
+; On entry, the address of the first byte of the range is in EDX, the size of
+; the range is on top of the stack and the previous contents of EDX are below
+; it. On exit the previous contents of EDX have been restored and both values
+; popped off the stack. This function modifies no other registers, in
+; particular it saves and restores EFLAGS.
+ALIGN 16
+asan_check_range_write_access_2gb PROC  ; Probe #81.
+  ; Save the EFLAGS.
+  push eax
+  lahf
+  seto al
+  push ebx
+  push ecx
+  push edx
+  mov ecx, DWORD PTR[esp + 20]
+  lea ecx, DWORD PTR[edx + ecx - 1]
+  ; Fail if the range wraps around the address space, or if its last byte is
+  ; above the 2GB threshold. The first byte is then below it too.
+  cmp ecx, edx
+  jb report_failure_81
+  test ecx, ecx
+  js report_failure_81
+  ; Divide by 8 to convert the addresses to shadow indices.
+  shr edx, 3
+  shr ecx, 3
+check_range_loop_81 LABEL NEAR
+  cmp edx, ecx
+  jae check_range_last_81
+  movzx ebx, BYTE PTR[edx + asan_memory_interceptors_shadow_memory]
+shadow_reference_58 LABEL NEAR
+  test ebx, ebx
+  jnz report_failure_81
+  inc edx
+  jmp check_range_loop_81
+check_range_last_81 LABEL NEAR
+  movzx ebx, BYTE PTR[ecx + asan_memory_interceptors_shadow_memory]
+shadow_reference_59 LABEL NEAR
+  cmp bl, 0
+  jz check_range_done_81
+  js report_failure_81
+  mov ecx, DWORD PTR[esp]
+  add ecx, DWORD PTR[esp + 20]
+  dec ecx
+  and ecx, 7
+  cmp cl, bl
+  jae report_failure_81
+check_range_done_81 LABEL NEAR
+  add esp, 4
+  pop ecx
+  pop ebx
+  ; Restore the EFLAGS.
+  add al, 7Fh
+  sahf
+  pop eax
+  ; Restore original EDX.
+  mov edx, DWORD PTR[esp + 8]
+  ret 8
+report_failure_81 LABEL NEAR
+  ; Restore memory location in EDX.
+  pop edx
+  pop ecx
+  pop ebx
+  ; Restore the EFLAGS.
+  add al, 7Fh
+  sahf
+  pop eax
+  ; Restore original value of EDX, and put memory location on stack.
+  xchg edx, DWORD PTR[esp + 8]
+  ; Create an Asan registers context on the stack.
+  pushfd
+  pushad
+  ; Fix the original value of ESP in the Asan registers context.
+  ; Removing 16 bytes (e.g. EFLAGS / EIP / range size / Original EDX).
+  add DWORD PTR[esp + 12], 16
+  ; Push ARG4: the address of Asan context on stack.
+  push esp
+  ; Push ARG3: the size of the range.
+  push DWORD PTR[esp + 44]
+  ; Push ARG2: the access type.
+  push 1
+  ; Push ARG1: the memory location.
+  push DWORD PTR[esp + 56]
+  call asan_report_bad_range_access
+  ; Remove 4 x ARG on stack.
+  add esp, 16
+  ; Restore original registers.
+  popad
+  popfd
+  ; Return and remove range size and memory location on stack.
+  ret 8
+asan_check_range_write_access_2gb ENDP
+
+; On entry, the address of the first byte of the range is in EDX, the size of
+; the range is on top of the stack and the previous contents of EDX are below
+; it. On exit the previous contents of EDX have been restored and both values
+; popped off the stack. This function may modify EFLAGS, but preserves all
+; other registers.
+ALIGN 16
+asan_check_range_read_access_no_flags_2gb PROC  ; Probe #82.
+  push ebx
+  push ecx
+  push edx
+  mov ecx, DWORD PTR[esp + 16]
+  lea ecx, DWORD PTR[edx + ecx - 1]
+  ; Fail if the range wraps around the address space, or if its last byte is
+  ; above the 2GB threshold. The first byte is then below it too.
+  cmp ecx, edx
+  jb report_failure_82
+  test ecx, ecx
+  js report_failure_82
+  ; Divide by 8 to convert the addresses to shadow indices.
+  shr edx, 3
+  shr ecx, 3
+check_range_loop_82 LABEL NEAR
+  cmp edx, ecx
+  jae check_range_last_82
+  movzx ebx, BYTE PTR[edx + asan_memory_interceptors_shadow_memory]
+shadow_reference_60 LABEL NEAR
+  test ebx, ebx
+  jnz report_failure_82
+  inc edx
+  jmp check_range_loop_82
+check_range_last_82 LABEL NEAR
+  movzx ebx, BYTE PTR[ecx + asan_memory_interceptors_shadow_memory]
+shadow_reference_61 LABEL NEAR
+  cmp bl, 0
+  jz check_range_done_82
+  js report_failure_82
+  mov ecx, DWORD PTR[esp]
+  add ecx, DWORD PTR[esp + 16]
+  dec ecx
+  and ecx, 7
+  cmp cl, bl
+  jae report_failure_82
+check_range_done_82 LABEL NEAR
+  add esp, 4
+  pop ecx
+  pop ebx
+  ; Restore original EDX.
+  mov edx, DWORD PTR[esp + 8]
+  ret 8
+report_failure_82 LABEL NEAR
+  ; Restore memory location in EDX.
+  pop edx
+  pop ecx
+  pop ebx
+  ; Restore original value of EDX, and put memory location on stack.
+  xchg edx, DWORD PTR[esp + 8]
+  ; Create an Asan registers context on the stack.
+  pushfd
+  pushad
+  ; Fix the original value of ESP in the Asan registers context.
+  ; Removing 16 bytes (e.g. EFLAGS / EIP / range size / Original EDX).
+  add DWORD PTR[esp + 12], 16
+  ; Push ARG4: the address of Asan context on stack.
+  push esp
+  ; Push ARG3: the size of the range.
+  push DWORD PTR[esp + 44]
+  ; Push ARG2: the access type.
+  push 0
+  ; Push ARG1: the memory location.
+  push DWORD PTR[esp + 56]
+  call asan_report_bad_range_access
+  ; Remove 4 x ARG on stack.
+  add esp, 16
+  ; Restore original registers.
+  popad
+  popfd
+  ; Return and remove range size and memory location on stack.
+  ret 8
+asan_check_range_read_access_no_flags_2gb ENDP
+
+; On entry, the address of the first byte of the range is in EDX, the size of
+; the range is on top of the stack and the previous contents of EDX are below
+; it. On exit the previous contents of EDX have been restored and both values
+; popped off the stack. This function may modify EFLAGS, but preserves all
+; other registers.
+ALIGN 16
+asan_check_range_write_access_no_flags_2gb PROC  ; Probe #83.
+  push ebx
+  push ecx
+  push edx
+  mov ecx, DWORD PTR[esp + 16]
+  lea ecx, DWORD PTR[edx + ecx - 1]
+  ; Fail if the range wraps around the address space, or if its last byte is
+  ; above the 2GB threshold. The first byte is then below it too.
+  cmp ecx, edx
+  jb report_failure_83
+  test ecx, ecx
+  js report_failure_83
+  ; Divide by 8 to convert the addresses to shadow indices.
+  shr edx, 3
+  shr ecx, 3
+check_range_loop_83 LABEL NEAR
+  cmp edx, ecx
+  jae check_range_last_83
+  movzx ebx, BYTE PTR[edx + asan_memory_interceptors_shadow_memory]
+shadow_reference_62 LABEL NEAR
+  test ebx, ebx
+  jnz report_failure_83
+  inc edx
+  jmp check_range_loop_83
+check_range_last_83 LABEL NEAR
+  movzx ebx, BYTE PTR[ecx + asan_memory_interceptors_shadow_memory]
+shadow_reference_63 LABEL NEAR
+  cmp bl, 0
+  jz check_range_done_83
+  js report_failure_83
+  mov ecx, DWORD PTR[esp]
+  add ecx, DWORD PTR[esp + 16]
+  dec ecx
+  and ecx, 7
+  cmp cl, bl
+  jae report_failure_83
+check_range_done_83 LABEL NEAR
+  add esp, 4
+  pop ecx
+  pop ebx
+  ; Restore original EDX.
+  mov edx, DWORD PTR[esp + 8]
+  ret 8
+report_failure_83 LABEL NEAR
+  ; Restore memory location in EDX.
+  pop edx
+  pop ecx
+  pop ebx
+  ; Restore original value of EDX, and put memory location on stack.
+  xchg edx, DWORD PTR[esp + 8]
+  ; Create an Asan registers context on the stack.
+  pushfd
+  pushad
+  ; Fix the original value of ESP in the Asan registers context.
+  ; Removing 16 bytes (e.g. EFLAGS / EIP / range size / Original EDX).
+  add DWORD PTR[esp + 12], 16
+  ; Push ARG4: the address of Asan context on stack.
+  push esp
+  ; Push ARG3: the size of the range.
+  push DWORD PTR[esp + 44]
+  ; Push ARG2: the access type.
+  push 1
+  ; Push ARG1: the memory location.
+  push DWORD PTR[esp + 56]
+  call asan_report_bad_range_access
+  ; Remove 4 x ARG on stack.
+  add esp, 16
+  ; Restore original registers.
+  popad
+  popfd
+  ; Return and remove range size and memory location on stack.
+  ret 8
+asan_check_range_write_access_no_flags_2gb ENDP
+
+; On entry, the address of the first byte of the range is in EDX, the size of
+; the range is on top of the stack and the previous contents of EDX are below
+; it. On exit the previous contents of EDX have been restored and both values
+; popped off the stack. This function modifies no other registers, in
+; particular it saves and restores EFLAGS.
+ALIGN 16
+asan_check_range_read_access_4gb PROC  ; Probe #84.
+  ; Save the EFLAGS.
+  push eax
+  lahf
+  seto al
+  push ebx
+  push ecx
+  push edx
+  mov ecx, DWORD PTR[esp + 20]
+  lea ecx, DWORD PTR[edx + ecx - 1]
+  ; Fail if the range wraps around the address space.
+  cmp ecx, edx
+  jb report_failure_84
+  ; Divide by 8 to convert the addresses to shadow indices.
+  shr edx, 3
+  shr ecx, 3
+check_range_loop_84 LABEL NEAR
+  cmp edx, ecx
+  jae check_range_last_84
+  movzx ebx, BYTE PTR[edx + asan_memory_interceptors_shadow_memory]
+shadow_reference_64 LABEL NEAR
+  test ebx, ebx
+  jnz report_failure_84
+  inc edx
+  jmp check_range_loop_84
+check_range_last_84 LABEL NEAR
+  movzx ebx, BYTE PTR[ecx + asan_memory_interceptors_shadow_memory]
+shadow_reference_65 LABEL NEAR
+  cmp bl, 0
+  jz check_range_done_84
+  js report_failure_84
+  mov ecx, DWORD PTR[esp]
+  add ecx, DWORD PTR[esp + 20]
+  dec ecx
+  and ecx, 7
+  cmp cl, bl
+  jae report_failure_84
+check_range_done_84 LABEL NEAR
+  add esp, 4
+  pop ecx
+  pop ebx
+  ; Restore the EFLAGS.
+  add al, 7Fh
+  sahf
+  pop eax
+  ; Restore original EDX.
+  mov edx, DWORD PTR[esp + 8]
+  ret 8
+report_failure_84 LABEL NEAR
+  ; Restore memory location in EDX.
+  pop edx
+  pop ecx
+  pop ebx
+  ; Restore the EFLAGS.
+  add al, 7Fh
+  sahf
+  pop eax
+  ; Restore original value of EDX, and put memory location on stack.
+  xchg edx, DWORD PTR[esp + 8]
+  ; Create an Asan registers context on the stack.
+  pushfd
+  pushad
+  ; Fix the original value of ESP in the Asan registers context.
+  ; Removing 16 bytes (e.g. EFLAGS / EIP / range size / Original EDX).
+  add DWORD PTR[esp + 12], 16
+  ; Push ARG4: the address of Asan context on stack.
+  push esp
+  ; Push ARG3: the size of the range.
+  push DWORD PTR[esp + 44]
+  ; Push ARG2: the access type.
+  push 0
+  ; Push ARG1: the memory location.
+  push DWORD PTR[esp + 56]
+  call asan_report_bad_range_access
+  ; Remove 4 x ARG on stack.
+  add esp, 16
+  ; Restore original registers.
+  popad
+  popfd
+  ; Return and remove range size and memory location on stack.
+  ret 8
+asan_check_range_read_access_4gb ENDP
+
+; On entry, the address of the first byte of the range is in EDX, the size of
+; the range is on top of the stack and the previous contents of EDX are below
+; it. On exit the previous contents of EDX have been restored and both values
+; popped off the stack. This function modifies no other registers, in
+; particular it saves and restores EFLAGS.
+ALIGN 16
+asan_check_range_write_access_4gb PROC  ; Probe #85.
+  ; Save the EFLAGS.
+  push eax
+  lahf
+  seto al
+  push ebx
+  push ecx
+  push edx
+  mov ecx, DWORD PTR[esp + 20]
+  lea ecx, DWORD PTR[edx + ecx - 1]
+  ; Fail if the range wraps around the address space.
+  cmp ecx, edx
+  jb report_failure_85
+  ; Divide by 8 to convert the addresses to shadow indices.
+  shr edx, 3
+  shr ecx, 3
+check_range_loop_85 LABEL NEAR
+  cmp edx, ecx
+  jae check_range_last_85
+  movzx ebx, BYTE PTR[edx + asan_memory_interceptors_shadow_memory]
+shadow_reference_66 LABEL NEAR
+  test ebx, ebx
+  jnz report_failure_85
+  inc edx
+  jmp check_range_loop_85
+check_range_last_85 LABEL NEAR
+  movzx ebx, BYTE PTR[ecx + asan_memory_interceptors_shadow_memory]
+shadow_reference_67 LABEL NEAR
+  cmp bl, 0
+  jz check_range_done_85
+  js report_failure_85
+  mov ecx, DWORD PTR[esp]
+  add ecx, DWORD PTR[esp + 20]
+  dec ecx
+  and ecx, 7
+  cmp cl, bl
+  jae report_failure_85
+check_range_done_85 LABEL NEAR
+  add esp, 4
+  pop ecx
+  pop ebx
+  ; Restore the EFLAGS.
+  add al, 7Fh
+  sahf
+  pop eax
+  ; Restore original EDX.
+  mov edx, DWORD PTR[esp + 8]
+  ret 8
+report_failure_85 LABEL NEAR
+  ; Restore memory location in EDX.
+  pop edx
+  pop ecx
+  pop ebx
+  ; Restore the EFLAGS.
+  add al, 7Fh
+  sahf
+  pop eax
+  ; Restore original value of EDX, and put memory location on stack.
+  xchg edx, DWORD PTR[esp + 8]
+  ; Create an Asan registers context on the stack.
+  pushfd
+  pushad
+  ; Fix the original value of ESP in the Asan registers context.
+  ; Removing 16 bytes (e.g. EFLAGS / EIP / range size / Original EDX).
+  add DWORD PTR[esp + 12], 16
+  ; Push ARG4: the address of Asan context on stack.
+  push esp
+  ; Push ARG3: the size of the range.
+  push DWORD PTR[esp + 44]
+  ; Push ARG2: the access type.
+  push 1
+  ; Push ARG1: the memory location.
+  push DWORD PTR[esp + 56]
+  call asan_report_bad_range_access
+  ; Remove 4 x ARG on stack.
+  add esp, 16
+  ; Restore original registers.
+  popad
+  popfd
+  ; Return and remove range size and memory location on stack.
+  ret 8
+asan_check_range_write_access_4gb ENDP
+
+; On entry, the address of the first byte of the range is in EDX, the size of
+; the range is on top of the stack and the previous contents of EDX are below
+; it. On exit the previous contents of EDX have been restored and both values
+; popped off the stack. This function may modify EFLAGS, but preserves all
+; other registers.
+ALIGN 16
+asan_check_range_read_access_no_flags_4gb PROC  ; Probe #86.
+  push ebx
+  push ecx
+  push edx
+  mov ecx, DWORD PTR[esp + 16]
+  lea ecx, DWORD PTR[edx + ecx - 1]
+  ; Fail if the range wraps around the address space.
+  cmp ecx, edx
+  jb report_failure_86
+  ; Divide by 8 to convert the addresses to shadow indices.
+  shr edx, 3
+  shr ecx, 3
+check_range_loop_86 LABEL NEAR
+  cmp edx, ecx
+  jae check_range_last_86
+  movzx ebx, BYTE PTR[edx + asan_memory_interceptors_shadow_memory]
+shadow_reference_68 LABEL NEAR
+  test ebx, ebx
+  jnz report_failure_86
+  inc edx
+  jmp check_range_loop_86
+check_range_last_86 LABEL NEAR
+  movzx ebx, BYTE PTR[ecx + asan_memory_interceptors_shadow_memory]
+shadow_reference_69 LABEL NEAR
+  cmp bl, 0
+  jz check_range_done_86
+  js report_failure_86
+  mov ecx, DWORD PTR[esp]
+  add ecx, DWORD PTR[esp + 16]
+  dec ecx
+  and ecx, 7
+  cmp cl, bl
+  jae report_failure_86
+check_range_done_86 LABEL NEAR
+  add esp, 4
+  pop ecx
+  pop ebx
+  ; Restore original EDX.
+  mov edx, DWORD PTR[esp + 8]
+  ret 8
+report_failure_86 LABEL NEAR
+  ; Restore memory location in EDX.
+  pop edx
+  pop ecx
+  pop ebx
+  ; Restore original value of EDX, and put memory location on stack.
+  xchg edx, DWORD PTR[esp + 8]
+  ; Create an Asan registers context on the stack.
+  pushfd
+  pushad
+  ; Fix the original value of ESP in the Asan registers context.
+  ; Removing 16 bytes (e.g. EFLAGS / EIP / range size / Original EDX).
+  add DWORD PTR[esp + 12], 16
+  ; Push ARG4: the address of Asan context on stack.
+  push esp
+  ; Push ARG3: the size of the range.
+  push DWORD PTR[esp + 44]
+  ; Push ARG2: the access type.
+  push 0
+  ; Push ARG1: the memory location.
+  push DWORD PTR[esp + 56]
+  call asan_report_bad_range_access
+  ; Remove 4 x ARG on stack.
+  add esp, 16
+  ; Restore original registers.
+  popad
+  popfd
+  ; Return and remove range size and memory location on stack.
+  ret 8
+asan_check_range_read_access_no_flags_4gb ENDP
+
+; On entry, the address of the first byte of the range is in EDX, the size of
+; the range is on top of the stack and the previous contents of EDX are below
+; it. On exit the previous contents of EDX have been restored and both values
+; popped off the stack. This function may modify EFLAGS, but preserves all
+; other registers.
+ALIGN 16
+asan_check_range_write_access_no_flags_4gb PROC  ; Probe #87.
+  push ebx
+  push ecx
+  push edx
+  mov ecx, DWORD PTR[esp + 16]
+  lea ecx, DWORD PTR[edx + ecx - 1]
+  ; Fail if the range wraps around the address space.
+  cmp ecx, edx
+  jb report_failure_87
+  ; Divide by 8 to convert the addresses to shadow indices.
+  shr edx, 3
+  shr ecx, 3
+check_range_loop_87 LABEL NEAR
+  cmp edx, ecx
+  jae check_range_last_87
+  movzx ebx, BYTE PTR[edx + asan_memory_interceptors_shadow_memory]
+shadow_reference_70 LABEL NEAR
+  test ebx, ebx
+  jnz report_failure_87
+  inc edx
+  jmp check_range_loop_87
+check_range_last_87 LABEL NEAR
+  movzx ebx, BYTE PTR[ecx + asan_memory_interceptors_shadow_memory]
+shadow_reference_71 LABEL NEAR
+  cmp bl, 0
+  jz check_range_done_87
+  js report_failure_87
+  mov ecx, DWORD PTR[esp]
+  add ecx, DWORD PTR[esp + 16]
+  dec ecx
+  and ecx, 7
+  cmp cl, bl
+  jae report_failure_87
+check_range_done_87 LABEL NEAR
+  add esp, 4
+  pop ecx
+  pop ebx
+  ; Restore original EDX.
+  mov edx, DWORD PTR[esp + 8]
+  ret 8
+report_failure_87 LABEL NEAR
+  ; Restore memory location in EDX.
+  pop edx
+  pop ecx
+  pop ebx
+  ; Restore original value of EDX, and put memory location on stack.
+  xchg edx, DWORD PTR[esp + 8]
+  ; Create an Asan registers context on the stack.
+  pushfd
+  pushad
+  ; Fix the original value of ESP in the Asan registers context.
+  ; Removing 16 bytes (e.g. EFLAGS / EIP / range size / Original EDX).
+  add DWORD PTR[esp + 12], 16
+  ; Push ARG4: the address of Asan context on stack.
+  push esp
+  ; Push ARG3: the size of the range.
+  push DWORD PTR[esp + 44]
+  ; Push ARG2: the access type.
+  push 1
+  ; Push ARG1: the memory location.
+  push DWORD PTR[esp + 56]
+  call asan_report_bad_range_access
+  ; Remove 4 x ARG on stack.
+  add esp, 16
+  ; Restore original registers.
+  popad
+  popfd
+  ; Return and remove range size and memory location on stack.
+  ret 8
+asan_check_range_write_access_no_flags_4gb ENDP
+
 .probes ENDS
 
 ; Start writing to the read-only .rdata segment.
@@ -5168,6 +5866,22 @@ asan_shadow_references LABEL FAR
   DWORD shadow_reference_53 - 4
   DWORD shadow_reference_54 - 4
   DWORD shadow_reference_55 - 4
+  DWORD shadow_reference_56 - 4
+  DWORD shadow_reference_57 - 4
+  DWORD shadow_reference_58 - 4
+  DWORD shadow_reference_59 - 4
+  DWORD shadow_reference_60 - 4
+  DWORD shadow_reference_61 - 4
+  DWORD shadow_reference_62 - 4
+  DWORD shadow_reference_63 - 4
+  DWORD shadow_reference_64 - 4
+  DWORD shadow_reference_65 - 4
+  DWORD shadow_reference_66 - 4
+  DWORD shadow_reference_67 - 4
+  DWORD shadow_reference_68 - 4
+  DWORD shadow_reference_69 - 4
+  DWORD shadow_reference_70 - 4
+  DWORD shadow_reference_71 - 4
   DWORD 0
 
 .rdata ENDS
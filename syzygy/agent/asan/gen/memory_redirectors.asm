@@ -55,6 +55,10 @@ PUBLIC asan_redirect_16_byte_read_access_no_flags
 PUBLIC asan_redirect_16_byte_write_access_no_flags
 PUBLIC asan_redirect_32_byte_read_access_no_flags
 PUBLIC asan_redirect_32_byte_write_access_no_flags
+PUBLIC asan_redirect_range_read_access
+PUBLIC asan_redirect_range_write_access
+PUBLIC asan_redirect_range_read_access_no_flags
+PUBLIC asan_redirect_range_write_access_no_flags
 PUBLIC asan_redirect_repz_4_byte_cmps_access
 PUBLIC asan_redirect_repz_2_byte_cmps_access
 PUBLIC asan_redirect_repz_1_byte_cmps_access
@@ -161,6 +165,14 @@ asan_redirect_32_byte_read_access_no_flags LABEL PROC
   call asan_redirect_tail
 asan_redirect_32_byte_write_access_no_flags LABEL PROC
   call asan_redirect_tail
+asan_redirect_range_read_access LABEL PROC
+  call asan_redirect_tail
+asan_redirect_range_write_access LABEL PROC
+  call asan_redirect_tail
+asan_redirect_range_read_access_no_flags LABEL PROC
+  call asan_redirect_tail
+asan_redirect_range_write_access_no_flags LABEL PROC
+  call asan_redirect_tail
 asan_redirect_repz_4_byte_cmps_access LABEL PROC
   call asan_redirect_tail
 asan_redirect_repz_2_byte_cmps_access LABEL PROC
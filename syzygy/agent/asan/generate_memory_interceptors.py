@@ -105,9 +105,11 @@ EXTERN C asan_redirect_clang_stub_entry:PROC
 
 ; Declare the error handling funtion.
 EXTERN C asan_report_bad_memory_access:PROC
+EXTERN C asan_report_bad_range_access:PROC
 
 ; Declares the symbols that this compiland exports.
 PUBLIC asan_no_check
+PUBLIC asan_no_range_check
 PUBLIC asan_string_no_check
 PUBLIC asan_redirect_tail
 PUBLIC asan_redirect_tail_clang
@@ -164,6 +166,18 @@ asan_no_check PROC
   ret 4
 asan_no_check ENDP
 
+; On entry, the address to check is in EDX and the stack has the size of the
+; range and the previous contents of EDX. On exit the previous contents of EDX
+; have been restored and both values popped off the stack. This function
+; modifies no other registers, in particular it saves and restores EFLAGS.
+ALIGN 16
+asan_no_range_check PROC
+  ; Restore EDX.
+  mov edx, DWORD PTR[esp + 8]
+  ; And return.
+  ret 8
+asan_no_range_check ENDP
+
 ; No state is saved for string instructions.
 ALIGN 16
 asan_string_no_check PROC
@@ -286,6 +300,21 @@ _4GB_CHECK = """\
   shr edx, 3"""
 
 
+_2GB_RANGE_CHECK = """\
+  ; Fail if the range wraps around the address space, or if its last byte is
+  ; above the 2GB threshold. The first byte is then below it too.
+  cmp ecx, edx
+  jb report_failure_{probe_index}
+  test ecx, ecx
+  js report_failure_{probe_index}"""
+
+
+_4GB_RANGE_CHECK = """\
+  ; Fail if the range wraps around the address space.
+  cmp ecx, edx
+  jb report_failure_{probe_index}"""
+
+
 # The common part of the fast path shared between the different
 # implementations of the hooks.
 #
@@ -364,6 +393,89 @@ _ERROR_PATH ="""\
   ret 4"""
 
 
+# The fast path of the range checking hooks.
+#
+# This does the following:
+#   - Saves EBX, ECX and the memory location in EDX for the error path.
+#   - Computes the address of the last byte of the range in ECX, and does an
+#       address check on the range.
+#   - Checks that the shadow bytes of the range are all zero, except the last
+#       one which may also describe a partially accessible group of bytes. In
+#       that case the offset of the last byte in the group must be below the
+#       shadow value. We inline the Shadow::IsAccessible function for it.
+#   - Restores EBX and ECX, and removes the memory location from the stack.
+#
+# The size of the range is expected at [ESP + size_offset] once EBX, ECX and
+# EDX have been pushed.
+_RANGE_FAST_PATH = """\
+  push ebx
+  push ecx
+  push edx
+  mov ecx, DWORD PTR[esp + {size_offset}]
+  lea ecx, DWORD PTR[edx + ecx - 1]
+  {range_check}
+  ; Divide by 8 to convert the addresses to shadow indices.
+  shr edx, 3
+  shr ecx, 3
+check_range_loop_{probe_index} LABEL NEAR
+  cmp edx, ecx
+  jae check_range_last_{probe_index}
+  movzx ebx, BYTE PTR[edx + {shadow}]
+shadow_reference_{shadow_index!s} LABEL NEAR
+  test ebx, ebx
+  jnz report_failure_{probe_index}
+  inc edx
+  jmp check_range_loop_{probe_index}
+check_range_last_{probe_index} LABEL NEAR
+  movzx ebx, BYTE PTR[ecx + {shadow}]
+shadow_reference_{shadow_index!s} LABEL NEAR
+  cmp bl, 0
+  jz check_range_done_{probe_index}
+  js report_failure_{probe_index}
+  mov ecx, DWORD PTR[esp]
+  add ecx, DWORD PTR[esp + {size_offset}]
+  dec ecx
+  and ecx, 7
+  cmp cl, bl
+  jae report_failure_{probe_index}
+check_range_done_{probe_index} LABEL NEAR
+  add esp, 4
+  pop ecx
+  pop ebx"""
+
+
+# The error path of the range checking hooks.
+#
+# It expects to have the memory location in EDX, the previous value of EDX at
+# [ESP + 8], the size of the range at [ESP + 4] and the address of the faulty
+# instruction at [ESP].
+_RANGE_ERROR_PATH ="""\
+  ; Restore original value of EDX, and put memory location on stack.
+  xchg edx, DWORD PTR[esp + 8]
+  ; Create an Asan registers context on the stack.
+  pushfd
+  pushad
+  ; Fix the original value of ESP in the Asan registers context.
+  ; Removing 16 bytes (e.g. EFLAGS / EIP / range size / Original EDX).
+  add DWORD PTR[esp + 12], 16
+  ; Push ARG4: the address of Asan context on stack.
+  push esp
+  ; Push ARG3: the size of the range.
+  push DWORD PTR[esp + 44]
+  ; Push ARG2: the access type.
+  push {access_mode_value}
+  ; Push ARG1: the memory location.
+  push DWORD PTR[esp + 56]
+  call asan_report_bad_range_access
+  ; Remove 4 x ARG on stack.
+  add esp, 16
+  ; Restore original registers.
+  popad
+  popfd
+  ; Return and remove range size and memory location on stack.
+  ret 8"""
+
+
 # Collects the above macros and bundles them up in a dictionary so they can be
 # easily expanded by the string format functions.
 _MACROS = {
@@ -372,6 +484,8 @@ _MACROS = {
   "AsanFastPath": _FAST_PATH,
   "AsanSlowPath": _SLOW_PATH,
   "AsanErrorPath": _ERROR_PATH,
+  "AsanRangeFastPath": _RANGE_FAST_PATH,
+  "AsanRangeErrorPath": _RANGE_ERROR_PATH,
 }
 
 
@@ -468,6 +582,92 @@ PUBLIC asan_check_{access_size}_byte_{access_mode_str}_no_flags_{mem_model}  \
 ; Probe #{probe_index}."""
 
 
+# Generates the Asan range check functions. These check a range of bytes
+# whose size is only known at runtime, and are used to check several adjacent
+# accesses at once.
+#
+# The name of the generated method will be
+# asan_check_range_(@p access_mode_str)_(@p mem_model)().
+#
+# Args:
+#   access_mode_str: The string representing the access mode (read_access
+#       or write_access).
+#   access_mode_value: The internal value representing this kind of
+#       access.
+#   probe_index: The index of the probe function. Used to mangle internal labels
+#       so that they are unique to this probes implementation.
+_CHECK_RANGE_FUNCTION = """\
+; On entry, the address of the first byte of the range is in EDX, the size of
+; the range is on top of the stack and the previous contents of EDX are below
+; it. On exit the previous contents of EDX have been restored and both values
+; popped off the stack. This function modifies no other registers, in
+; particular it saves and restores EFLAGS.
+ALIGN 16
+asan_check_range_{access_mode_str}_{mem_model} PROC  ; Probe #{probe_index}.
+  {AsanSaveEflags}
+  {AsanRangeFastPath}
+  {AsanRestoreEflags}
+  ; Restore original EDX.
+  mov edx, DWORD PTR[esp + 8]
+  ret 8
+report_failure_{probe_index} LABEL NEAR
+  ; Restore memory location in EDX.
+  pop edx
+  pop ecx
+  pop ebx
+  {AsanRestoreEflags}
+  {AsanRangeErrorPath}
+asan_check_range_{access_mode_str}_{mem_model} ENDP
+"""
+
+
+# Declare the range check function public label.
+_CHECK_RANGE_FUNCTION_DECL = """\
+PUBLIC asan_check_range_{access_mode_str}_{mem_model}  ; Probe #{probe_index}."""
+
+
+# Generates a variant of the Asan range check functions that don't save the
+# flags.
+#
+# The name of the generated method will be
+# asan_check_range_(@p access_mode_str)_no_flags_(@p mem_model)().
+#
+# Args:
+#   access_mode_str: The string representing the access mode (read_access
+#       or write_access).
+#   access_mode_value: The internal value representing this kind of access.
+#   probe_index: The index of the probe function. Used to mangle internal labels
+#       so that they are unique to this probes implementation.
+# Note: Calling this function may alter the EFLAGS register only.
+_CHECK_RANGE_FUNCTION_NO_FLAGS = """\
+; On entry, the address of the first byte of the range is in EDX, the size of
+; the range is on top of the stack and the previous contents of EDX are below
+; it. On exit the previous contents of EDX have been restored and both values
+; popped off the stack. This function may modify EFLAGS, but preserves all
+; other registers.
+ALIGN 16
+asan_check_range_{access_mode_str}_no_flags_{mem_model} PROC  \
+; Probe #{probe_index}.
+  {AsanRangeFastPath}
+  ; Restore original EDX.
+  mov edx, DWORD PTR[esp + 8]
+  ret 8
+report_failure_{probe_index} LABEL NEAR
+  ; Restore memory location in EDX.
+  pop edx
+  pop ecx
+  pop ebx
+  {AsanRangeErrorPath}
+asan_check_range_{access_mode_str}_no_flags_{mem_model} ENDP
+"""
+
+
+# Declare the range check function public label.
+_CHECK_RANGE_FUNCTION_NO_FLAGS_DECL = """\
+PUBLIC asan_check_range_{access_mode_str}_no_flags_{mem_model}  \
+; Probe #{probe_index}."""
+
+
 # Generates the Asan memory accessor redirector stubs.
 #
 # The name of the generated method will be
@@ -486,6 +686,25 @@ asan_redirect_{access_size}_byte_{access_mode_str}{suffix} LABEL PROC
 _REDIRECT_FUNCTION_DECL = """\
 PUBLIC asan_redirect_{access_size}_byte_{access_mode_str}{suffix}"""
 
+# Generates the Asan range check redirector stubs. These share the tail
+# function of the memory accessor redirectors, which leaves the range size
+# untouched on the stack.
+#
+# The name of the generated method will be
+# asan_redirect_range_(@p access_mode_str)(@p suffix)().
+#
+# Args:
+#   access_mode_str: The string representing the access mode (read_access
+#       or write_access).
+#   suffix: The suffix - if any - for this function name
+_RANGE_REDIRECT_FUNCTION = """\
+asan_redirect_range_{access_mode_str}{suffix} LABEL PROC
+  call asan_redirect_tail"""
+
+# Declare the public label.
+_RANGE_REDIRECT_FUNCTION_DECL = """\
+PUBLIC asan_redirect_range_{access_mode_str}{suffix}"""
+
 # Generates the Clang-Asan memory accessor redirector stubs.
 #
 # The name of the generated method will be
@@ -649,6 +868,14 @@ _MEMORY_MODELS = [
 ]
 
 
+# Memory models for the generated range checks, and the associated address
+# range checks to insert.
+_RANGE_MEMORY_MODELS = [
+    ('2gb', _2GB_RANGE_CHECK.lstrip()),
+    ('4gb', _4GB_RANGE_CHECK.lstrip()),
+]
+
+
 # The string accessors generated.
 _STRING_ACCESSORS = [
     ("cmps", "_repz_", "ecx", _ASAN_READ_ACCESS, _ASAN_READ_ACCESS, 4, 1),
@@ -746,6 +973,38 @@ def _IterateOverInterceptors(parts,
   return (probe_index, shadow_index.count())
 
 
+def _IterateOverRangeInterceptors(parts,
+                                  formatter,
+                                  format,
+                                  format_no_flags,
+                                  probe_index=0,
+                                  shadow_index=0):
+  """Helper for _GenerateInterceptorsAsmFile."""
+  f = formatter
+
+  # See _IterateOverInterceptors.
+  shadow_index = ToStringCounter(shadow_index)
+
+  for mem_model, range_check in _RANGE_MEMORY_MODELS:
+    # The probes that save the flags have EAX on the stack as well.
+    for fmt, size_offset in ((format, 20), (format_no_flags, 16)):
+      for access, access_name in _ACCESS_MODES:
+        formatted_range_check = f.format(range_check, probe_index=probe_index)
+        parts.append(f.format(fmt,
+                              access_mode_str=access,
+                              access_mode_value=access_name,
+                              mem_model=mem_model,
+                              probe_index=probe_index,
+                              range_check=formatted_range_check,
+                              shadow=_SHADOW,
+                              shadow_index=shadow_index,
+                              size_offset=size_offset))
+        probe_index += 1
+
+  # Return the probe and shadow memory reference counts.
+  return (probe_index, shadow_index.count())
+
+
 def _IterateOverStringInterceptors(parts, formatter, format, probe_index=0):
   """Helper for _GenerateInterceptorsAsmFile."""
   for (fn, p, c, dst_mode, src_mode, size, compare) in _STRING_ACCESSORS:
@@ -781,6 +1040,9 @@ def _GenerateInterceptorsAsmFile():
       probe_index=probe_index, shadow_index=shadow_index)
   probe_index = _IterateOverStringInterceptors(parts, f, _CHECK_STRINGS_DECL,
       probe_index=probe_index)
+  (probe_index, shadow_index) = _IterateOverRangeInterceptors(parts, f,
+      _CHECK_RANGE_FUNCTION_DECL, _CHECK_RANGE_FUNCTION_NO_FLAGS_DECL,
+      probe_index=probe_index, shadow_index=shadow_index)
   parts.append('')
 
   # Place all of the probe functions in a custom segment.
@@ -810,6 +1072,11 @@ def _GenerateInterceptorsAsmFile():
   probe_index = _IterateOverStringInterceptors(parts, f, _CHECK_STRINGS,
       probe_index=probe_index)
 
+  # Generate the range checks.
+  (probe_index, shadow_index) = _IterateOverRangeInterceptors(parts, f,
+      _CHECK_RANGE_FUNCTION, _CHECK_RANGE_FUNCTION_NO_FLAGS,
+      probe_index=probe_index, shadow_index=shadow_index)
+
   # Close the custom segment housing the probges.
   parts.append(f.format(_INTERCEPTORS_SEGMENT_FOOTER))
 
@@ -852,6 +1119,13 @@ def _GenerateRedirectorsAsmFile(target_cpu):
                                 access_mode_value=access_name,
                                 suffix=suffix))
 
+    # Declare the range check redirectors.
+    for suffix in ("", "_no_flags"):
+      for access, access_name in _ACCESS_MODES:
+        parts.append(f.format(_RANGE_REDIRECT_FUNCTION_DECL,
+                              access_mode_str=access,
+                              suffix=suffix))
+
     # Declare string operation redirectors.
     for (fn, p, c, dst_mode, src_mode, size, compare) in _STRING_ACCESSORS:
       parts.append(f.format(_STRING_REDIRECT_FUNCTION_DECL,
@@ -883,6 +1157,13 @@ def _GenerateRedirectorsAsmFile(target_cpu):
                                 access_mode_value=access_name,
                                 suffix=suffix))
 
+    # Generate the range check redirectors.
+    for suffix in ("", "_no_flags"):
+      for access, access_name in _ACCESS_MODES:
+        parts.append(f.format(_RANGE_REDIRECT_FUNCTION,
+                              access_mode_str=access,
+                              suffix=suffix))
+
     # Generate string operation redirectors.
     for (fn, p, c, dst_mode, src_mode, size, compare) in _STRING_ACCESSORS:
       parts.append(f.format(_STRING_REDIRECT_FUNCTION,
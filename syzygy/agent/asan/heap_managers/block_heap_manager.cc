@@ -28,6 +28,7 @@
 #include "syzygy/agent/asan/heaps/simple_block_heap.h"
 #include "syzygy/agent/asan/heaps/win_heap.h"
 #include "syzygy/agent/asan/heaps/zebra_block_heap.h"
+#include "syzygy/common/align.h"
 #include "syzygy/common/asan_parameters.h"
 
 namespace agent {
@@ -45,6 +46,12 @@ using heaps::ZebraBlockHeap;
 // TODO(georgesak): allow this to be changed through the parameters.
 enum : uint32_t { kOverbudgetSizePercentage = 20 };
 
+// The maximum number of blocks freed by the deferred free thread each time it
+// wakes up. If this doesn't bring the quarantine back to GREEN then the thread
+// signals itself to keep going, but never holds on to the quarantine for too
+// long at a time.
+enum : size_t { kDeferredFreeTrimBudget = 256 };
+
 // Return the position of the most significant bit in a 32 bit unsigned value.
 size_t GetMSBIndex(size_t n) {
   // Algorithm taken from
@@ -97,6 +104,8 @@ BlockHeapManager::BlockHeapManager(Shadow* shadow,
       zebra_block_heap_(nullptr),
       zebra_block_heap_id_(0),
       large_block_heap_id_(0),
+      block_magazines_enabled_(false),
+      thread_magazines_(nullptr),
       locked_heaps_(nullptr),
       enable_page_protections_(true) {
   DCHECK_NE(static_cast<Shadow*>(nullptr), shadow);
@@ -109,6 +118,12 @@ BlockHeapManager::BlockHeapManager(Shadow* shadow,
   CHECK_NE(TLS_OUT_OF_INDEXES, allocation_filter_flag_tls_);
   // And disable it by default.
   set_allocation_filter_flag(false);
+
+  // Initialize the per-thread magazines slot. TlsAlloc zeroes the slot for
+  // every thread, so threads start out without magazines.
+  magazines_tls_ = ::TlsAlloc();
+  CHECK_NE(TLS_OUT_OF_INDEXES, magazines_tls_);
+  ::memset(&magazine_depot_, 0, sizeof(magazine_depot_));
 }
 
 BlockHeapManager::~BlockHeapManager() {
@@ -129,6 +144,14 @@ void BlockHeapManager::Init() {
           new RegistryCache(L"SyzyAsanCorruptBlocks"));
       corrupt_block_registry_cache_->Init();
     }
+
+    // The type of the shared quarantine can't change once heaps refer to it.
+    if (parameters_.enable_lock_free_quarantine)
+      lock_free_quarantine_.reset(new MpscBlockQuarantine());
+
+    // Likewise, the blocks parked by other threads can't be taken back if the
+    // magazines get disabled.
+    block_magazines_enabled_ = parameters_.enable_block_magazines;
   }
 
   // This takes care of its own locking, as its reentrant.
@@ -153,7 +176,7 @@ HeapId BlockHeapManager::CreateHeap() {
 
   base::AutoLock lock(lock_);
   underlying_heaps_map_.insert(std::make_pair(heap, underlying_heap));
-  HeapMetadata metadata = { &shared_quarantine_, false };
+  HeapMetadata metadata = { GetSharedQuarantine(), false };
   auto result = heaps_.insert(std::make_pair(heap, metadata));
   return GetHeapId(result);
 }
@@ -203,51 +226,69 @@ void* BlockHeapManager::Allocate(HeapId heap_id, uint32_t bytes) {
   common::StackCapture stack;
   stack.InitFromStack();
 
-  // Build the set of heaps that will be used to satisfy the allocation. This
-  // is a stack of heaps, and they will be tried in the reverse order they are
-  // inserted.
+  bool may_use_large_block_heap = MayUseLargeBlockHeap(bytes);
+  bool may_use_zebra_block_heap = MayUseZebraBlockHeap(bytes);
 
-  // We can always use the heap that was passed in.
-  HeapId heaps[3] = { heap_id, 0, 0 };
-  size_t heap_count = 1;
-  if (MayUseLargeBlockHeap(bytes)) {
-    DCHECK_LT(heap_count, arraysize(heaps));
-    heaps[heap_count++] = large_block_heap_id_;
+  // Small allocations from the process heap are served by the magazines of
+  // the calling thread when possible. These hand out blocks that are already
+  // formatted and poisoned.
+  BlockInfo block = {};
+  bool from_magazine = false;
+  if (block_magazines_enabled_ && heap_id == process_heap_id_ &&
+      !may_use_large_block_heap && !may_use_zebra_block_heap) {
+    BlockLayout block_layout = {};
+    from_magazine = BlockPlanLayout(
+        kShadowRatio, kShadowRatio, bytes, 0,
+        parameters_.trailer_padding_size + sizeof(BlockTrailer),
+        &block_layout) && AllocateFromMagazine(block_layout, &block);
   }
 
-  if (MayUseZebraBlockHeap(bytes)) {
-    DCHECK_LT(heap_count, arraysize(heaps));
-    heaps[heap_count++] = zebra_block_heap_id_;
-  }
+  if (!from_magazine) {
+    // Build the set of heaps that will be used to satisfy the allocation.
+    // This is a stack of heaps, and they will be tried in the reverse order
+    // they are inserted.
+
+    // We can always use the heap that was passed in.
+    HeapId heaps[3] = { heap_id, 0, 0 };
+    size_t heap_count = 1;
+    if (may_use_large_block_heap) {
+      DCHECK_LT(heap_count, arraysize(heaps));
+      heaps[heap_count++] = large_block_heap_id_;
+    }
 
-  // Use the selected heaps to try to satisfy the allocation.
-  void* alloc = nullptr;
-  BlockLayout block_layout = {};
-  for (int i = static_cast<int>(heap_count) - 1; i >= 0; --i) {
-    BlockHeapInterface* heap = GetHeapFromId(heaps[i]);
-    alloc = heap->AllocateBlock(
-        bytes,
-        0,
-        parameters_.trailer_padding_size + sizeof(BlockTrailer),
-        &block_layout);
-    if (alloc != nullptr) {
-      heap_id = heaps[i];
-      break;
+    if (may_use_zebra_block_heap) {
+      DCHECK_LT(heap_count, arraysize(heaps));
+      heaps[heap_count++] = zebra_block_heap_id_;
     }
-  }
 
-  // The allocation can fail if we're out of memory or if the size exceed the
-  // maximum allocation size.
-  if (alloc == nullptr)
-    return nullptr;
+    // Use the selected heaps to try to satisfy the allocation.
+    void* alloc = nullptr;
+    BlockLayout block_layout = {};
+    for (int i = static_cast<int>(heap_count) - 1; i >= 0; --i) {
+      BlockHeapInterface* heap = GetHeapFromId(heaps[i]);
+      alloc = heap->AllocateBlock(
+          bytes,
+          0,
+          parameters_.trailer_padding_size + sizeof(BlockTrailer),
+          &block_layout);
+      if (alloc != nullptr) {
+        heap_id = heaps[i];
+        break;
+      }
+    }
 
-  DCHECK_NE(static_cast<void*>(nullptr), alloc);
-  DCHECK_EQ(0u, reinterpret_cast<size_t>(alloc) % kShadowRatio);
-  BlockInfo block = {};
-  BlockInitialize(block_layout, alloc, &block);
+    // The allocation can fail if we're out of memory or if the size exceed
+    // the maximum allocation size.
+    if (alloc == nullptr)
+      return nullptr;
+
+    DCHECK_NE(static_cast<void*>(nullptr), alloc);
+    DCHECK_EQ(0u, reinterpret_cast<size_t>(alloc) % kShadowRatio);
+    BlockInitialize(block_layout, alloc, &block);
 
-  // Poison the redzones in the shadow memory as early as possible.
-  shadow_->PoisonAllocatedBlock(block);
+    // Poison the redzones in the shadow memory as early as possible.
+    shadow_->PoisonAllocatedBlock(block);
+  }
 
   block.header->alloc_stack = stack_cache_->SaveStackTrace(stack);
   block.header->free_stack = nullptr;
@@ -297,6 +338,14 @@ bool BlockHeapManager::Free(HeapId heap_id, void* alloc) {
     return false;
   }
 
+  // Blocks parked in a magazine keep their formatting and a valid checksum,
+  // so this can only be a block that has already been freed and has left the
+  // quarantine. It must be left alone as it is still owned by a magazine.
+  if (block_magazines_enabled_ && block_info.header->state == FREED_BLOCK) {
+    ReportHeapError(alloc, DOUBLE_FREE);
+    return false;
+  }
+
   // heap_id is just a hint, the block trailer contains the heap used for the
   // allocation.
   heap_id = block_info.trailer->heap_id;
@@ -449,6 +498,11 @@ void BlockHeapManager::TearDownHeapManager() {
   // under |lock_|.
   DCHECK_EQ(static_cast<HeapInterface**>(nullptr), locked_heaps_);
 
+  // Stop parking blocks and hand the parked ones back to the process heap
+  // while it's still around.
+  block_magazines_enabled_ = false;
+  ReleaseAllMagazines();
+
   // Delete all the heaps. This must be done manually to ensure that
   // all references to internal_heap_ have been cleaned up.
   HeapQuarantineMap::iterator iter_heaps = heaps_.begin();
@@ -475,6 +529,12 @@ void BlockHeapManager::TearDownHeapManager() {
     ::TlsFree(allocation_filter_flag_tls_);
     allocation_filter_flag_tls_ = TLS_OUT_OF_INDEXES;
   }
+
+  // Free the magazines slot (TLS).
+  if (magazines_tls_ != TLS_OUT_OF_INDEXES) {
+    ::TlsFree(magazines_tls_);
+    magazines_tls_ = TLS_OUT_OF_INDEXES;
+  }
 }
 
 HeapId BlockHeapManager::GetHeapId(
@@ -588,13 +648,14 @@ void BlockHeapManager::PropagateParameters() {
   // The internal heap should already be setup.
   DCHECK_NE(static_cast<HeapInterface*>(nullptr), internal_heap_.get());
 
-  size_t quarantine_size = shared_quarantine_.max_quarantine_size();
-  shared_quarantine_.set_max_quarantine_size(parameters_.quarantine_size);
-  shared_quarantine_.set_max_object_size(parameters_.quarantine_block_size);
+  SizeLimitedBlockQuarantine* shared_quarantine = GetSharedQuarantine();
+  size_t quarantine_size = shared_quarantine->max_quarantine_size();
+  shared_quarantine->set_max_quarantine_size(parameters_.quarantine_size);
+  shared_quarantine->set_max_object_size(parameters_.quarantine_block_size);
 
   // Trim the quarantine if its maximum size has decreased.
   if (initialized_ && quarantine_size > parameters_.quarantine_size)
-    TrimQuarantine(TrimColor::YELLOW, &shared_quarantine_);
+    TrimQuarantine(TrimColor::YELLOW, shared_quarantine);
 
   if (parameters_.enable_zebra_block_heap && zebra_block_heap_ == nullptr) {
     // Initialize the zebra heap only if it isn't already initialized.
@@ -622,7 +683,7 @@ void BlockHeapManager::PropagateParameters() {
     base::AutoLock lock(lock_);
     BlockHeapInterface* heap = new LargeBlockHeap(
         memory_notifier_, internal_heap_.get());
-    HeapMetadata metadata = { &shared_quarantine_, false };
+    HeapMetadata metadata = { GetSharedQuarantine(), false };
     auto result = heaps_.insert(std::make_pair(heap, metadata));
     large_block_heap_id_ = GetHeapId(result);
   }
@@ -666,7 +727,7 @@ void BlockHeapManager::DisableDeferredFreeThread() {
     deferred_free_thread_old->Stop();
 
   // Set the overbudget size to 0 to remove the hysteresis.
-  shared_quarantine_.SetOverbudgetSize(0);
+  GetSharedQuarantine()->SetOverbudgetSize(0);
 }
 
 bool BlockHeapManager::IsDeferredFreeThreadRunning() {
@@ -674,6 +735,17 @@ bool BlockHeapManager::IsDeferredFreeThreadRunning() {
   return deferred_free_thread_ != nullptr;
 }
 
+void BlockHeapManager::FlushThreadMagazines() {
+  if (magazines_tls_ == TLS_OUT_OF_INDEXES)
+    return;
+  ThreadMagazines* thread_magazines =
+      reinterpret_cast<ThreadMagazines*>(::TlsGetValue(magazines_tls_));
+  if (thread_magazines == nullptr)
+    return;
+  ::TlsSetValue(magazines_tls_, nullptr);
+  ReleaseThreadMagazines(thread_magazines, true);
+}
+
 HeapType BlockHeapManager::GetHeapTypeUnlocked(HeapId heap_id) {
   DCHECK(initialized_);
   DCHECK(IsValidHeapIdUnlocked(heap_id, true));
@@ -756,6 +828,13 @@ void BlockHeapManager::DestroyHeapResourcesUnlocked(
 
 void BlockHeapManager::TrimQuarantine(TrimColor stop_color,
                                       BlockQuarantineInterface* quarantine) {
+  TrimQuarantineWithBudget(stop_color, SIZE_MAX, quarantine);
+}
+
+bool BlockHeapManager::TrimQuarantineWithBudget(
+    TrimColor stop_color,
+    size_t max_block_count,
+    BlockQuarantineInterface* quarantine) {
   DCHECK(initialized_);
   DCHECK_NE(static_cast<BlockQuarantineInterface*>(nullptr), quarantine);
 
@@ -765,17 +844,26 @@ void BlockHeapManager::TrimQuarantine(TrimColor stop_color,
     quarantine->Empty(&blocks_to_free);
     for (const auto& block : blocks_to_free)
       FreeBlock(block);
-  } else {
-    CompactBlockInfo compact = {};
-    while (true) {
-      PopResult result = quarantine->Pop(&compact);
-      if (!result.pop_successful)
-        break;
-      FreeBlock(compact);
-      if (result.trim_color <= stop_color)
-        break;
-    }
+    return false;
+  }
+
+  CompactBlockInfo compact = {};
+  for (size_t i = 0; i < max_block_count; ++i) {
+    PopResult result = quarantine->Pop(&compact);
+    if (!result.pop_successful)
+      return false;
+    FreeBlock(compact);
+    if (result.trim_color <= stop_color)
+      return false;
   }
+  return true;
+}
+
+BlockHeapManager::SizeLimitedBlockQuarantine*
+BlockHeapManager::GetSharedQuarantine() {
+  if (lock_free_quarantine_)
+    return lock_free_quarantine_.get();
+  return &shared_quarantine_;
 }
 
 void BlockHeapManager::FreeBlock(const BlockQuarantineInterface::Object& obj) {
@@ -858,6 +946,12 @@ bool BlockHeapManager::FreePristineBlock(BlockInfo* block_info) {
 
   block_info->header->state = FREED_BLOCK;
 
+  // Small blocks of the process heap are recycled through the magazines.
+  if (heap == process_heap_ && block_magazines_enabled_ &&
+      ParkBlock(*block_info)) {
+    return true;
+  }
+
   if ((heap->GetHeapFeatures() &
        HeapInterface::kHeapReportsReservations) != 0) {
     shadow_->Poison(block_info->header,
@@ -947,7 +1041,7 @@ void BlockHeapManager::InitProcessHeap() {
   process_heap_ = new heaps::SimpleBlockHeap(process_heap_underlying_heap_);
   underlying_heaps_map_.insert(std::make_pair(process_heap_,
                                               process_heap_underlying_heap_));
-  HeapMetadata heap_metadata = { &shared_quarantine_, false };
+  HeapMetadata heap_metadata = { GetSharedQuarantine(), false };
   auto result = heaps_.insert(std::make_pair(process_heap_, heap_metadata));
   process_heap_id_ = GetHeapId(result);
 }
@@ -1041,9 +1135,17 @@ void BlockHeapManager::DeferredFreeThreadSignalWork() {
 void BlockHeapManager::DeferredFreeDoWork() {
   DCHECK_EQ(GetDeferredFreeThreadId(), base::PlatformThread::CurrentId());
   // As of now, only the shared quarantine gets trimmed asynchronously. This
-  // will bring it back in the GREEN color.
-  BlockQuarantineInterface* shared_quarantine = &shared_quarantine_;
-  TrimQuarantine(TrimColor::GREEN, shared_quarantine);
+  // will bring it back in the GREEN color, one batch of blocks at a time.
+  BlockQuarantineInterface* shared_quarantine = GetSharedQuarantine();
+  if (!TrimQuarantineWithBudget(TrimColor::GREEN, kDeferredFreeTrimBudget,
+                                shared_quarantine)) {
+    return;
+  }
+
+  // Schedule another batch, unless the thread is being stopped.
+  base::AutoLock lock(deferred_free_thread_lock_);
+  if (deferred_free_thread_ != nullptr)
+    deferred_free_thread_->SignalWork();
 }
 
 base::PlatformThreadId BlockHeapManager::GetDeferredFreeThreadId() {
@@ -1056,8 +1158,9 @@ void BlockHeapManager::EnableDeferredFreeThreadWithCallback(
     DeferredFreeThread::Callback deferred_free_callback) {
   DCHECK(!IsDeferredFreeThreadRunning());
 
-  shared_quarantine_.SetOverbudgetSize(
-      shared_quarantine_.max_quarantine_size() * kOverbudgetSizePercentage /
+  SizeLimitedBlockQuarantine* shared_quarantine = GetSharedQuarantine();
+  shared_quarantine->SetOverbudgetSize(
+      shared_quarantine->max_quarantine_size() * kOverbudgetSizePercentage /
       100);
 
   // Create the thread and wait for it to start.
@@ -1066,6 +1169,299 @@ void BlockHeapManager::EnableDeferredFreeThreadWithCallback(
   deferred_free_thread_->Start();
 }
 
+// static
+size_t BlockHeapManager::GetMagazineSizeClass(uint32_t block_size) {
+  DCHECK(::common::IsAligned(block_size, kShadowRatio));
+  if (block_size == 0 || block_size > kMagazineMaxBlockSize)
+    return kMagazineSizeClassCount;
+  return block_size / kShadowRatio - 1;
+}
+
+bool BlockHeapManager::AllocateFromMagazine(const BlockLayout& layout,
+                                            BlockInfo* block_info) {
+  DCHECK_NE(static_cast<BlockInfo*>(nullptr), block_info);
+  size_t size_class = GetMagazineSizeClass(layout.block_size);
+  if (size_class == kMagazineSizeClassCount)
+    return false;
+  ThreadMagazines* thread_magazines = GetThreadMagazines();
+  if (thread_magazines == nullptr)
+    return false;
+
+  Magazine*& loaded = thread_magazines->loaded[size_class];
+  Magazine*& previous = thread_magazines->previous[size_class];
+  if (loaded == nullptr || loaded->count == 0) {
+    if (previous != nullptr && previous->count != 0) {
+      std::swap(loaded, previous);
+    } else {
+      // Trade the empty magazine for a full one from the depot. If there is
+      // none then go to the heap for a new batch of blocks.
+      Magazine* full = PopFullMagazine(size_class);
+      if (full != nullptr) {
+        if (previous == nullptr) {
+          previous = loaded;
+        } else if (loaded != nullptr) {
+          internal_heap_->Free(loaded);
+        }
+        loaded = full;
+      } else {
+        if (loaded == nullptr)
+          loaded = AllocateMagazine();
+        if (loaded == nullptr)
+          return false;
+        RefillMagazine(layout, loaded);
+        if (loaded->count == 0)
+          return false;
+      }
+    }
+  }
+
+  DCHECK_LT(0u, loaded->count);
+  const ParkedBlock& parked = loaded->blocks[--loaded->count];
+  bool same_layout = parked.body_size == layout.body_size &&
+      parked.header_padding_size == layout.header_padding_size;
+  BlockInitialize(layout, parked.header, block_info);
+
+  // A block parked with the requested layout only needs its body to be made
+  // accessible. Otherwise the whole block is reformatted in the shadow, which
+  // is safe as all the blocks of a size class have the same size.
+  if (same_layout) {
+    shadow_->Unpoison(block_info->body, block_info->body_size);
+  } else {
+    shadow_->PoisonAllocatedBlock(*block_info);
+  }
+
+  return true;
+}
+
+bool BlockHeapManager::ParkBlock(const BlockInfo& block_info) {
+  DCHECK_EQ(FREED_BLOCK, static_cast<BlockState>(block_info.header->state));
+  size_t size_class = GetMagazineSizeClass(block_info.block_size);
+  if (size_class == kMagazineSizeClassCount)
+    return false;
+  ThreadMagazines* thread_magazines = GetThreadMagazines();
+  if (thread_magazines == nullptr)
+    return false;
+
+  Magazine*& loaded = thread_magazines->loaded[size_class];
+  Magazine*& previous = thread_magazines->previous[size_class];
+  if (loaded != nullptr && loaded->count == kMagazineCapacity) {
+    if (previous == nullptr || previous->count == 0) {
+      std::swap(loaded, previous);
+    } else {
+      // Both magazines are full, hand the older one over to the depot.
+      PushFullMagazine(size_class, previous);
+      previous = loaded;
+      loaded = nullptr;
+    }
+  }
+  if (loaded == nullptr)
+    loaded = AllocateMagazine();
+  if (loaded == nullptr)
+    return false;
+
+  // Keep the block poisoned as it was in the quarantine. The body is marked
+  // again as blocks found to be corrupt at free time skip that step.
+  shadow_->MarkAsFreed(block_info.body, block_info.body_size);
+  BlockSetChecksum(block_info);
+
+  ParkedBlock& parked = loaded->blocks[loaded->count++];
+  parked.header = block_info.header;
+  parked.body_size = block_info.body_size;
+  parked.header_padding_size = block_info.header_padding_size;
+  return true;
+}
+
+BlockHeapManager::ThreadMagazines* BlockHeapManager::GetThreadMagazines() {
+  ThreadMagazines* thread_magazines =
+      reinterpret_cast<ThreadMagazines*>(::TlsGetValue(magazines_tls_));
+  if (thread_magazines != nullptr)
+    return thread_magazines;
+
+  thread_magazines = reinterpret_cast<ThreadMagazines*>(
+      internal_heap_->Allocate(sizeof(ThreadMagazines)));
+  if (thread_magazines == nullptr)
+    return nullptr;
+  ::memset(thread_magazines, 0, sizeof(ThreadMagazines));
+
+  // Register the magazines so that they can be released at tear down even if
+  // the thread never flushes them.
+  {
+    base::AutoLock lock(magazine_depot_lock_);
+    thread_magazines->next = thread_magazines_;
+    if (thread_magazines_ != nullptr)
+      thread_magazines_->prev = thread_magazines;
+    thread_magazines_ = thread_magazines;
+  }
+
+  ::TlsSetValue(magazines_tls_, thread_magazines);
+  return thread_magazines;
+}
+
+BlockHeapManager::Magazine* BlockHeapManager::AllocateMagazine() {
+  Magazine* magazine = reinterpret_cast<Magazine*>(
+      internal_heap_->Allocate(sizeof(Magazine)));
+  if (magazine == nullptr)
+    return nullptr;
+  magazine->next = nullptr;
+  magazine->count = 0;
+  return magazine;
+}
+
+void BlockHeapManager::RefillMagazine(const BlockLayout& layout,
+                                      Magazine* magazine) {
+  DCHECK_NE(static_cast<Magazine*>(nullptr), magazine);
+  DCHECK_EQ(0u, magazine->count);
+
+  process_heap_->Lock();
+  while (magazine->count < kMagazineCapacity) {
+    BlockLayout block_layout = {};
+    void* alloc = process_heap_->AllocateBlock(
+        layout.body_size,
+        0,
+        parameters_.trailer_padding_size + sizeof(BlockTrailer),
+        &block_layout);
+    if (alloc == nullptr)
+      break;
+    DCHECK_EQ(layout.block_size, block_layout.block_size);
+
+    // Format the block and poison it as if it had been allocated and
+    // quarantined.
+    BlockInfo block = {};
+    BlockInitialize(block_layout, alloc, &block);
+    shadow_->PoisonAllocatedBlock(block);
+    shadow_->MarkAsFreed(block.body, block.body_size);
+    block.header->state = FREED_BLOCK;
+    BlockSetChecksum(block);
+
+    ParkedBlock& parked = magazine->blocks[magazine->count++];
+    parked.header = block.header;
+    parked.body_size = block.body_size;
+    parked.header_padding_size = block.header_padding_size;
+  }
+  process_heap_->Unlock();
+}
+
+void BlockHeapManager::ReleaseMagazineBlocks(size_t size_class,
+                                             Magazine* magazine) {
+  DCHECK_GT(kMagazineSizeClassCount, size_class);
+  DCHECK_NE(static_cast<Magazine*>(nullptr), magazine);
+  uint32_t block_size = static_cast<uint32_t>((size_class + 1) * kShadowRatio);
+  bool reports_reservations = (process_heap_->GetHeapFeatures() &
+      HeapInterface::kHeapReportsReservations) != 0;
+
+  process_heap_->Lock();
+  for (uint32_t i = 0; i < magazine->count; ++i) {
+    const ParkedBlock& parked = magazine->blocks[i];
+    CompactBlockInfo compact = {};
+    compact.header = parked.header;
+    compact.block_size = block_size;
+    compact.header_size = sizeof(BlockHeader) + parked.header_padding_size;
+    compact.trailer_size =
+        block_size - compact.header_size - parked.body_size;
+    BlockInfo block_info = {};
+    ConvertBlockInfo(compact, &block_info);
+
+    if (reports_reservations) {
+      shadow_->Poison(block_info.header, block_info.block_size,
+                      kAsanReservedMarker);
+    } else {
+      shadow_->Unpoison(block_info.header, block_info.block_size);
+    }
+    process_heap_->FreeBlock(block_info);
+  }
+  process_heap_->Unlock();
+  magazine->count = 0;
+}
+
+BlockHeapManager::Magazine* BlockHeapManager::PopFullMagazine(
+    size_t size_class) {
+  DCHECK_GT(kMagazineSizeClassCount, size_class);
+  base::AutoLock lock(magazine_depot_lock_);
+  Magazine* magazine = magazine_depot_.full[size_class];
+  if (magazine == nullptr)
+    return nullptr;
+  magazine_depot_.full[size_class] = magazine->next;
+  --magazine_depot_.full_count[size_class];
+  magazine->next = nullptr;
+  return magazine;
+}
+
+void BlockHeapManager::PushFullMagazine(size_t size_class,
+                                        Magazine* magazine) {
+  DCHECK_GT(kMagazineSizeClassCount, size_class);
+  DCHECK_NE(static_cast<Magazine*>(nullptr), magazine);
+  DCHECK_EQ(static_cast<uint32_t>(kMagazineCapacity), magazine->count);
+  {
+    base::AutoLock lock(magazine_depot_lock_);
+    if (magazine_depot_.full_count[size_class] < kMagazineDepotCapacity) {
+      magazine->next = magazine_depot_.full[size_class];
+      magazine_depot_.full[size_class] = magazine;
+      ++magazine_depot_.full_count[size_class];
+      return;
+    }
+  }
+
+  // The depot is full, the blocks go back to the heap in one batch.
+  ReleaseMagazineBlocks(size_class, magazine);
+  internal_heap_->Free(magazine);
+}
+
+void BlockHeapManager::ReleaseThreadMagazines(
+    ThreadMagazines* thread_magazines, bool to_depot) {
+  DCHECK_NE(static_cast<ThreadMagazines*>(nullptr), thread_magazines);
+
+  {
+    base::AutoLock lock(magazine_depot_lock_);
+    if (thread_magazines->prev != nullptr)
+      thread_magazines->prev->next = thread_magazines->next;
+    else
+      thread_magazines_ = thread_magazines->next;
+    if (thread_magazines->next != nullptr)
+      thread_magazines->next->prev = thread_magazines->prev;
+  }
+
+  for (size_t i = 0; i < kMagazineSizeClassCount; ++i) {
+    Magazine* magazines[] = { thread_magazines->loaded[i],
+                              thread_magazines->previous[i] };
+    for (Magazine* magazine : magazines) {
+      if (magazine == nullptr)
+        continue;
+      // Only full magazines are accepted by the depot.
+      if (to_depot && magazine->count == kMagazineCapacity) {
+        PushFullMagazine(i, magazine);
+        continue;
+      }
+      ReleaseMagazineBlocks(i, magazine);
+      internal_heap_->Free(magazine);
+    }
+  }
+
+  internal_heap_->Free(thread_magazines);
+}
+
+void BlockHeapManager::ReleaseAllMagazines() {
+  if (magazines_tls_ != TLS_OUT_OF_INDEXES)
+    ::TlsSetValue(magazines_tls_, nullptr);
+
+  while (true) {
+    ThreadMagazines* thread_magazines = nullptr;
+    {
+      base::AutoLock lock(magazine_depot_lock_);
+      thread_magazines = thread_magazines_;
+    }
+    if (thread_magazines == nullptr)
+      break;
+    ReleaseThreadMagazines(thread_magazines, false);
+  }
+
+  for (size_t i = 0; i < kMagazineSizeClassCount; ++i) {
+    while (Magazine* magazine = PopFullMagazine(i)) {
+      ReleaseMagazineBlocks(i, magazine);
+      internal_heap_->Free(magazine);
+    }
+  }
+}
+
 HeapId BlockHeapManager::GetCorruptBlockHeapId(const BlockInfo* block_info) {
   base::AutoLock lock(lock_);
 
@@ -33,6 +33,7 @@
 #include "syzygy/agent/asan/stack_capture_cache.h"
 #include "syzygy/agent/asan/heap_managers/deferred_free_thread.h"
 #include "syzygy/agent/asan/memory_notifiers/shadow_memory_notifier.h"
+#include "syzygy/agent/asan/quarantines/mpsc_sharded_quarantine.h"
 #include "syzygy/agent/asan/quarantines/sharded_quarantine.h"
 #include "syzygy/agent/common/stack_capture.h"
 #include "syzygy/common/asan_parameters.h"
@@ -140,6 +141,11 @@ class BlockHeapManager : public HeapManagerInterface {
   // @returns true if the deferred thread is currently running.
   bool IsDeferredFreeThreadRunning();
 
+  // Returns the blocks cached in the calling thread's magazines to the shared
+  // depot and releases the magazines themselves. This is meant to be called
+  // when a thread exits, and is a noop if the thread has no magazines.
+  void FlushThreadMagazines();
+
  protected:
   // This allows the runtime access to our internals, necessary for crash
   // processing.
@@ -158,6 +164,18 @@ class BlockHeapManager : public HeapManagerInterface {
                                      GetBlockHashFunctor,
                                      kQuarantineDefaultShardingFactor>;
 
+  // The type of the lock-free quarantine, used instead of the sharded one
+  // when parameters_.enable_lock_free_quarantine is set.
+  using MpscBlockQuarantine =
+      quarantines::MpscShardedQuarantine<CompactBlockInfo,
+                                         GetTotalBlockSizeFunctor,
+                                         kQuarantineDefaultShardingFactor>;
+
+  // The interface shared by both types of quarantine.
+  using SizeLimitedBlockQuarantine =
+      quarantines::SizeLimitedQuarantineImpl<CompactBlockInfo,
+                                             GetTotalBlockSizeFunctor>;
+
   // A map associating a block heap with its underlying heap.
   using UnderlyingHeapMap =
       std::unordered_map<BlockHeapInterface*, HeapInterface*>;
@@ -175,6 +193,67 @@ class BlockHeapManager : public HeapManagerInterface {
 
   using StackId = agent::common::StackCapture::StackId;
 
+  // @name Per-thread block magazines.
+  //
+  // When block_magazines_enabled_ is set, small blocks from the process heap
+  // that leave the quarantine are not handed back to the heap.
+  // They are instead parked in a magazine of the thread that evicted them,
+  // still formatted as a block and with their shadow poisoned as for a
+  // quarantined block. Allocations of the same size class are then served
+  // from the calling thread's magazines without taking any lock, and only
+  // the body needs to be unpoisoned when the parked block has the requested
+  // layout. Full and empty magazines are exchanged with a shared depot, and
+  // refilled from or returned to the heap, a whole magazine at a time. The
+  // quarantine is untouched by this, so blocks freed from any thread go
+  // through it as usual.
+  // @{
+  enum : uint32_t {
+    // The largest block size, in bytes, that is served by the magazines.
+    kMagazineMaxBlockSize = 512,
+    // The number of size classes. There is one per multiple of kShadowRatio.
+    kMagazineSizeClassCount = kMagazineMaxBlockSize / kShadowRatio,
+    // The number of blocks held by a magazine. This is also the batch size
+    // used when moving blocks between the heap and the magazines.
+    kMagazineCapacity = 16,
+    // The number of full magazines the depot keeps per size class before
+    // returning blocks to the heap.
+    kMagazineDepotCapacity = 8,
+  };
+
+  // A block parked in a magazine. The layout it was formatted with is kept
+  // here rather than read back from the block header, which may have been
+  // overwritten by a use-after-free while the block sat in the quarantine.
+  struct ParkedBlock {
+    BlockHeader* header;
+    uint32_t body_size;
+    uint32_t header_padding_size;
+  };
+
+  // A fixed size stack of parked blocks of the same size class.
+  struct Magazine {
+    Magazine* next;
+    uint32_t count;
+    ParkedBlock blocks[kMagazineCapacity];
+  };
+
+  // The magazines owned by a thread. Following the classic magazine design
+  // each size class has a loaded magazine and a previous one, which lets a
+  // thread alternate between allocations and frees without going to the
+  // depot.
+  struct ThreadMagazines {
+    ThreadMagazines* next;
+    ThreadMagazines* prev;
+    Magazine* loaded[kMagazineSizeClassCount];
+    Magazine* previous[kMagazineSizeClassCount];
+  };
+
+  // The shared depot of full magazines, one list per size class.
+  struct MagazineDepot {
+    Magazine* full[kMagazineSizeClassCount];
+    uint32_t full_count[kMagazineSizeClassCount];
+  };
+  // @}
+
   // Causes the heap manager to tear itself down. If the heap manager
   // encounters corrupt blocks while tearing itself dow it will report an
   // error. This will in turn cause the asan runtime to call back into itself
@@ -261,6 +340,20 @@ class BlockHeapManager : public HeapManagerInterface {
   void TrimQuarantine(TrimColor stop_color,
                       BlockQuarantineInterface* quarantine);
 
+  // Trim the specified quarantine until its color is |stop_color| or lower, or
+  // until |max_block_count| blocks have been freed.
+  // @param stop_color The target color at which the trimming ends.
+  // @param max_block_count The maximum number of blocks to free.
+  // @param quarantine The quarantine to trim.
+  // @returns true if the trimming stopped because it ran out of budget, false
+  //     otherwise.
+  bool TrimQuarantineWithBudget(TrimColor stop_color,
+                                size_t max_block_count,
+                                BlockQuarantineInterface* quarantine);
+
+  // @returns the quarantine shared by the heaps created by this manager.
+  SizeLimitedBlockQuarantine* GetSharedQuarantine();
+
   // Free a block.
   // @param obj The object to be freed.
   void FreeBlock(const BlockQuarantineInterface::Object& obj);
@@ -362,6 +455,66 @@ class BlockHeapManager : public HeapManagerInterface {
   // @returns the thread ID.
   base::PlatformThreadId GetDeferredFreeThreadId();
 
+  // @name Per-thread block magazine helpers.
+  // @{
+  // Returns the size class of a block of the given size.
+  // @param block_size The size of the block, in bytes.
+  // @returns the size class, or kMagazineSizeClassCount if blocks of this
+  //     size aren't cached.
+  static size_t GetMagazineSizeClass(uint32_t block_size);
+
+  // Tries to serve an allocation from the calling thread's magazines.
+  // @param layout The layout of the block to allocate.
+  // @param block_info Receives information about the allocated block.
+  // @returns true on success, false if no block could be found or refilled.
+  bool AllocateFromMagazine(const BlockLayout& layout, BlockInfo* block_info);
+
+  // Parks a block that is leaving the quarantine in the calling thread's
+  // magazines. The block must belong to the process heap, and must have been
+  // stripped of its stack traces.
+  // @param block_info The block to park.
+  // @returns true if the block was parked, false if it should be returned to
+  //     the heap instead.
+  bool ParkBlock(const BlockInfo& block_info);
+
+  // Returns the magazines of the calling thread, creating them if necessary.
+  // @returns the magazines, or nullptr if they couldn't be allocated.
+  ThreadMagazines* GetThreadMagazines();
+
+  // Allocates an empty magazine from the internal heap.
+  // @returns the magazine, or nullptr on failure.
+  Magazine* AllocateMagazine();
+
+  // Fills an empty magazine with new blocks of the given layout, allocated
+  // from the process heap under a single acquisition of its lock.
+  // @param layout The layout to format the blocks with.
+  // @param magazine The magazine to fill.
+  void RefillMagazine(const BlockLayout& layout, Magazine* magazine);
+
+  // Hands the blocks of a magazine back to the process heap under a single
+  // acquisition of its lock, and empties the magazine.
+  // @param size_class The size class of the blocks in the magazine.
+  // @param magazine The magazine to release.
+  void ReleaseMagazineBlocks(size_t size_class, Magazine* magazine);
+
+  // @name Depot accessors. These take magazine_depot_lock_.
+  // @{
+  Magazine* PopFullMagazine(size_t size_class);
+  void PushFullMagazine(size_t size_class, Magazine* magazine);
+  // @}
+
+  // Empties and frees all the magazines of a thread, and unregisters them.
+  // @param thread_magazines The magazines to release.
+  // @param to_depot If true then full magazines are handed to the depot
+  //     rather than being returned to the heap.
+  void ReleaseThreadMagazines(ThreadMagazines* thread_magazines,
+                              bool to_depot);
+
+  // Returns every block held by the magazines and the depot to the heap. Used
+  // at tear down, before the process heap goes away.
+  void ReleaseAllMagazines();
+  // @}
+
   // Helper function for finding the heap ID associated with a corrupt block.
   // This is best effort, and can return 0 when no heap can be found with
   // certainty.
@@ -389,6 +542,11 @@ class BlockHeapManager : public HeapManagerInterface {
   // used by the LargeBlockHeap.
   ShardedBlockQuarantine shared_quarantine_;
 
+  // The lock-free quarantine replacing |shared_quarantine_| when the
+  // enable_lock_free_quarantine parameter is set. This is decided once and
+  // for all in Init. Use GetSharedQuarantine to access the quarantine in use.
+  std::unique_ptr<MpscBlockQuarantine> lock_free_quarantine_;
+
   // Map the block heaps to their underlying heap.
   UnderlyingHeapMap underlying_heaps_map_;  // Under lock_.
 
@@ -426,6 +584,21 @@ class BlockHeapManager : public HeapManagerInterface {
   // Stores the AllocationFilterFlag TLS slot.
   DWORD allocation_filter_flag_tls_;
 
+  // Indicates if the block magazines are in use. This is latched from the
+  // enable_block_magazines parameter in Init, as blocks can't be taken back
+  // from the magazines of the other threads while they run. It is only
+  // cleared at tear down, once the magazines are no longer used.
+  bool block_magazines_enabled_;
+
+  // Stores the TLS slot holding the per-thread block magazines.
+  DWORD magazines_tls_;
+
+  // Protects the magazine depot and the list of thread magazines. This is
+  // only taken when a whole magazine changes hands.
+  base::Lock magazine_depot_lock_;
+  MagazineDepot magazine_depot_;  // Under magazine_depot_lock_.
+  ThreadMagazines* thread_magazines_;  // Under magazine_depot_lock_.
+
   // A list of all heaps whose locks were acquired by the last call to
   // BestEffortLockAll. This uses the internal heap, otherwise the default
   // allocator makes use of the process heap. The process heap may itself
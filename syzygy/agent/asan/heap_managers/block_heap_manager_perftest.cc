@@ -0,0 +1,248 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Measures the throughput of the BlockHeapManager when it is used concurrently
+// by several threads, with the various quarantine and caching features.
+
+#include "syzygy/agent/asan/heap_managers/block_heap_manager.h"
+
+#include <windows.h>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "base/bind.h"
+#include "base/strings/string_number_conversions.h"
+#include "base/threading/simple_thread.h"
+#include "base/time/time.h"
+#include "gtest/gtest.h"
+#include "syzygy/agent/asan/runtime.h"
+#include "syzygy/agent/asan/unittest_util.h"
+#include "syzygy/common/asan_parameters.h"
+#include "testing/perf/perf_test.h"
+
+namespace agent {
+namespace asan {
+namespace heap_managers {
+
+namespace {
+
+// Allocates and frees a given number of blocks with sizes in [1, 200] from
+// the process heap of a heap manager.
+class AllocationRunner : public base::DelegateSimpleThread::Delegate {
+ public:
+  AllocationRunner(BlockHeapManager* heap_manager, size_t alloc_count)
+      : heap_manager_(heap_manager), alloc_count_(alloc_count) {
+    DCHECK_NE(static_cast<BlockHeapManager*>(nullptr), heap_manager);
+  }
+
+  void Run() override {
+    HeapManagerInterface::HeapId heap_id = heap_manager_->process_heap();
+    for (size_t i = 0; i < alloc_count_; ++i) {
+      uint32_t size = 1 + static_cast<uint32_t>((i * 7) % 200);
+      void* alloc = heap_manager_->Allocate(heap_id, size);
+      CHECK_NE(static_cast<void*>(nullptr), alloc);
+      CHECK(heap_manager_->Free(heap_id, alloc));
+    }
+    heap_manager_->FlushThreadMagazines();
+  }
+
+ private:
+  BlockHeapManager* heap_manager_;
+  size_t alloc_count_;
+
+  DISALLOW_COPY_AND_ASSIGN(AllocationRunner);
+};
+
+class BlockHeapManagerPerfTest : public testing::TestWithAsanRuntime {
+ public:
+  BlockHeapManagerPerfTest() : error_count_(0) {}
+
+  void OnHeapError(AsanErrorInfo* error) { ++error_count_; }
+
+  // @returns the default parameters.
+  static ::common::AsanParameters DefaultParameters() {
+    ::common::AsanParameters parameters = {};
+    ::common::SetDefaultAsanParameters(&parameters);
+    return parameters;
+  }
+
+  // Creates and initializes a heap manager using the given @p parameters.
+  std::unique_ptr<BlockHeapManager> CreateHeapManager(
+      const ::common::AsanParameters& parameters) {
+    std::unique_ptr<BlockHeapManager> heap_manager(new BlockHeapManager(
+        runtime_->shadow(), runtime_->stack_cache(),
+        runtime_->memory_notifier()));
+    heap_manager->SetHeapErrorCallback(
+        base::Bind(&BlockHeapManagerPerfTest::OnHeapError,
+                   base::Unretained(this)));
+    heap_manager->set_parameters(parameters);
+    heap_manager->Init();
+    return heap_manager;
+  }
+
+  size_t error_count_;
+};
+
+// Runs |thread_count| threads doing |alloc_count| allocations each, and
+// returns the number of allocations per second.
+double MeasureAllocationRate(BlockHeapManager* heap_manager,
+                             size_t thread_count,
+                             size_t alloc_count) {
+  std::vector<std::unique_ptr<AllocationRunner>> runners;
+  for (size_t i = 0; i < thread_count; ++i) {
+    runners.push_back(std::unique_ptr<AllocationRunner>(
+        new AllocationRunner(heap_manager, alloc_count)));
+  }
+
+  base::TimeTicks start = base::TimeTicks::Now();
+  testing::RunDelegatesConcurrently(runners, "AllocationRunner");
+  base::TimeDelta elapsed = base::TimeTicks::Now() - start;
+
+  return thread_count * alloc_count / std::max(elapsed.InSecondsF(), 1e-6);
+}
+
+// Allocates and frees blocks from the process heap of a heap manager, and
+// records the latency of each free in performance counter ticks.
+class FreeLatencyRunner : public base::DelegateSimpleThread::Delegate {
+ public:
+  FreeLatencyRunner(BlockHeapManager* heap_manager, size_t free_count)
+      : heap_manager_(heap_manager), free_count_(free_count) {
+    DCHECK_NE(static_cast<BlockHeapManager*>(nullptr), heap_manager);
+  }
+
+  void Run() override {
+    HeapManagerInterface::HeapId heap_id = heap_manager_->process_heap();
+    latencies_.reserve(free_count_);
+    for (size_t i = 0; i < free_count_; ++i) {
+      uint32_t size = 16 + static_cast<uint32_t>((i * 7) % 256);
+      void* alloc = heap_manager_->Allocate(heap_id, size);
+      CHECK_NE(static_cast<void*>(nullptr), alloc);
+      LARGE_INTEGER start = {};
+      LARGE_INTEGER end = {};
+      ::QueryPerformanceCounter(&start);
+      CHECK(heap_manager_->Free(heap_id, alloc));
+      ::QueryPerformanceCounter(&end);
+      latencies_.push_back(end.QuadPart - start.QuadPart);
+    }
+  }
+
+  const std::vector<int64_t>& latencies() const { return latencies_; }
+
+ private:
+  BlockHeapManager* heap_manager_;
+  size_t free_count_;
+  std::vector<int64_t> latencies_;
+
+  DISALLOW_COPY_AND_ASSIGN(FreeLatencyRunner);
+};
+
+// Runs |thread_count| threads doing |free_count| frees each, with the deferred
+// free thread trimming the quarantine, and returns the latencies of all the
+// frees in microseconds, sorted.
+std::vector<double> MeasureFreeLatencies(BlockHeapManager* heap_manager,
+                                         size_t thread_count,
+                                         size_t free_count) {
+  std::vector<std::unique_ptr<FreeLatencyRunner>> runners;
+  for (size_t i = 0; i < thread_count; ++i) {
+    runners.push_back(std::unique_ptr<FreeLatencyRunner>(
+        new FreeLatencyRunner(heap_manager, free_count)));
+  }
+
+  heap_manager->EnableDeferredFreeThread();
+  testing::RunDelegatesConcurrently(runners, "FreeLatencyRunner");
+  heap_manager->DisableDeferredFreeThread();
+
+  LARGE_INTEGER frequency = {};
+  CHECK(::QueryPerformanceFrequency(&frequency));
+  std::vector<double> latencies;
+  for (const auto& runner : runners) {
+    for (int64_t ticks : runner->latencies())
+      latencies.push_back(ticks * 1e6 / frequency.QuadPart);
+  }
+  std::sort(latencies.begin(), latencies.end());
+  return latencies;
+}
+
+// Returns the |percentile|th value of a sorted, non-empty vector.
+double GetPercentile(const std::vector<double>& sorted_values,
+                     double percentile) {
+  DCHECK(!sorted_values.empty());
+  size_t index = static_cast<size_t>(
+      percentile / 100.0 * (sorted_values.size() - 1));
+  return sorted_values[index];
+}
+
+}  // namespace
+
+TEST_F(BlockHeapManagerPerfTest, MagazinesAllocationScalability) {
+  const size_t kAllocCount = 20000;
+  const size_t kMaxThreadCount = 8;
+  for (bool enable_block_magazines : { false, true }) {
+    // Keep the quarantine small so that blocks get recycled during the run.
+    ::common::AsanParameters parameters = DefaultParameters();
+    parameters.quarantine_size = 64 * 1024;
+    parameters.enable_block_magazines = enable_block_magazines;
+    std::unique_ptr<BlockHeapManager> heap_manager =
+        CreateHeapManager(parameters);
+    for (size_t thread_count = 1; thread_count <= kMaxThreadCount;
+         thread_count *= 2) {
+      double rate = MeasureAllocationRate(heap_manager.get(), thread_count,
+                                          kAllocCount);
+      perf_test::PrintResult(
+          "BlockHeapManagerAllocationRate",
+          enable_block_magazines ? "magazines" : "no_magazines",
+          base::SizeTToString(thread_count) + "_threads", rate,
+          "allocs/sec", true);
+    }
+  }
+
+  EXPECT_EQ(0u, error_count_);
+}
+
+TEST_F(BlockHeapManagerPerfTest, LockFreeQuarantineFreeLatency) {
+  const size_t kThreadCount = 4;
+  const size_t kFreeCount = 20000;
+  for (bool enable_lock_free_quarantine : { false, true }) {
+    // Keep the quarantine small so that it is constantly being trimmed.
+    ::common::AsanParameters parameters = DefaultParameters();
+    parameters.quarantine_size = 256 * 1024;
+    parameters.enable_lock_free_quarantine = enable_lock_free_quarantine;
+    std::unique_ptr<BlockHeapManager> heap_manager =
+        CreateHeapManager(parameters);
+
+    std::vector<double> latencies =
+        MeasureFreeLatencies(heap_manager.get(), kThreadCount, kFreeCount);
+    ASSERT_EQ(kThreadCount * kFreeCount, latencies.size());
+
+    const char* quarantine_name =
+        enable_lock_free_quarantine ? "lock_free" : "sharded";
+    perf_test::PrintResult("BlockHeapManagerFreeLatency", quarantine_name,
+                           "p50", GetPercentile(latencies, 50), "us", true);
+    perf_test::PrintResult("BlockHeapManagerFreeLatency", quarantine_name,
+                           "p99", GetPercentile(latencies, 99), "us", true);
+    perf_test::PrintResult("BlockHeapManagerFreeLatency", quarantine_name,
+                           "p99.9", GetPercentile(latencies, 99.9), "us",
+                           true);
+    perf_test::PrintResult("BlockHeapManagerFreeLatency", quarantine_name,
+                           "max", latencies.back(), "us", true);
+  }
+
+  EXPECT_EQ(0u, error_count_);
+}
+
+}  // namespace heap_managers
+}  // namespace asan
+}  // namespace agent
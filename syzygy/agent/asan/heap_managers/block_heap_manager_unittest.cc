@@ -14,6 +14,8 @@
 
 #include "syzygy/agent/asan/heap_managers/block_heap_manager.h"
 
+#include <memory>
+#include <set>
 #include <vector>
 
 #include "base/bind.h"
@@ -213,25 +215,31 @@ class TestZebraBlockHeap : public heaps::ZebraBlockHeap {
 class TestBlockHeapManager : public BlockHeapManager {
  public:
   using BlockHeapManager::HeapQuarantinePair;
+  using BlockHeapManager::kMagazineCapacity;
+  using BlockHeapManager::kMagazineMaxBlockSize;
 
   using BlockHeapManager::FreePotentiallyCorruptBlock;
   using BlockHeapManager::GetCorruptBlockHeapId;
   using BlockHeapManager::GetHeapId;
   using BlockHeapManager::GetHeapFromId;
   using BlockHeapManager::GetHeapTypeUnlocked;
+  using BlockHeapManager::GetSharedQuarantine;
   using BlockHeapManager::GetQuarantineFromId;
   using BlockHeapManager::HeapMetadata;
   using BlockHeapManager::HeapQuarantineMap;
   using BlockHeapManager::IsValidHeapIdUnlocked;
+  using BlockHeapManager::MpscBlockQuarantine;
   using BlockHeapManager::SetHeapErrorCallback;
   using BlockHeapManager::ShardedBlockQuarantine;
   using BlockHeapManager::TrimQuarantine;
+  using BlockHeapManager::TrimQuarantineWithBudget;
 
   using BlockHeapManager::allocation_filter_flag_tls_;
   using BlockHeapManager::corrupt_block_registry_cache_;
   using BlockHeapManager::enable_page_protections_;
   using BlockHeapManager::heaps_;
   using BlockHeapManager::large_block_heap_id_;
+  using BlockHeapManager::lock_free_quarantine_;
   using BlockHeapManager::locked_heaps_;
   using BlockHeapManager::parameters_;
   using BlockHeapManager::shadow_;
@@ -484,6 +492,25 @@ class BlockHeapManagerTest : public testing::TestWithAsanRuntime {
     heap_manager_->set_parameters(params);
   }
 
+  // Creates a heap manager with the block magazines enabled, whose quarantine
+  // refuses blocks of more than @p quarantine_block_size bytes. The magazines
+  // can only be enabled before the heap manager is initialized.
+  std::unique_ptr<TestBlockHeapManager> CreateHeapManagerWithMagazines(
+      uint32_t quarantine_block_size) {
+    std::unique_ptr<TestBlockHeapManager> heap_manager(
+        new TestBlockHeapManager(runtime_->shadow(), runtime_->stack_cache(),
+                                 runtime_->memory_notifier()));
+    heap_manager->SetHeapErrorCallback(
+        base::Bind(&BlockHeapManagerTest::OnHeapError,
+                   base::Unretained(this)));
+    ::common::AsanParameters parameters = heap_manager_->parameters();
+    parameters.enable_block_magazines = true;
+    parameters.quarantine_block_size = quarantine_block_size;
+    heap_manager->set_parameters(parameters);
+    heap_manager->Init();
+    return heap_manager;
+  }
+
   void EnableLargeBlockHeap(uint32_t large_allocation_threshold) {
     ::common::AsanParameters params = heap_manager_->parameters();
     params.enable_large_block_heap = true;
@@ -1924,6 +1951,273 @@ TEST_F(BlockHeapManagerTest, FreeCorruptedBlockWorks) {
   EXPECT_TRUE(heap_manager_->Free(wh, alloc));
 }
 
+namespace {
+
+// A helper thread runner that allocates a given number of blocks with sizes
+// in [min_size, max_size] from the process heap, and optionally frees them.
+class MagazineAllocationRunner : public base::DelegateSimpleThread::Delegate {
+ public:
+  MagazineAllocationRunner(BlockHeapManager* heap_manager,
+                           size_t alloc_count,
+                           uint32_t min_size,
+                           uint32_t max_size,
+                           bool free_blocks)
+      : heap_manager_(heap_manager),
+        alloc_count_(alloc_count),
+        min_size_(min_size),
+        max_size_(max_size),
+        free_blocks_(free_blocks) {
+    DCHECK_NE(static_cast<BlockHeapManager*>(nullptr), heap_manager);
+    DCHECK_LE(min_size, max_size);
+  }
+
+  void Run() override {
+    HeapManagerInterface::HeapId heap_id = heap_manager_->process_heap();
+    for (size_t i = 0; i < alloc_count_; ++i) {
+      uint32_t size = min_size_ +
+          static_cast<uint32_t>((i * 7) % (max_size_ - min_size_ + 1));
+      void* alloc = heap_manager_->Allocate(heap_id, size);
+      CHECK_NE(static_cast<void*>(nullptr), alloc);
+      if (free_blocks_) {
+        CHECK(heap_manager_->Free(heap_id, alloc));
+      } else {
+        allocs_.push_back(alloc);
+      }
+    }
+    heap_manager_->FlushThreadMagazines();
+  }
+
+  const std::vector<void*>& allocs() const { return allocs_; }
+
+ private:
+  BlockHeapManager* heap_manager_;
+  size_t alloc_count_;
+  uint32_t min_size_;
+  uint32_t max_size_;
+  bool free_blocks_;
+  std::vector<void*> allocs_;
+
+  DISALLOW_COPY_AND_ASSIGN(MagazineAllocationRunner);
+};
+
+}  // namespace
+
+TEST_F(BlockHeapManagerTest, MagazinesRecycleFreedBlocks) {
+  // Have the quarantine refuse every block so that they are parked as soon as
+  // they're freed.
+  std::unique_ptr<TestBlockHeapManager> heap_manager =
+      CreateHeapManagerWithMagazines(1);
+  HeapId heap_id = heap_manager->process_heap();
+
+  const uint32_t kAllocSize = 13;
+  void* alloc = heap_manager->Allocate(heap_id, kAllocSize);
+  ASSERT_NE(static_cast<void*>(nullptr), alloc);
+  ASSERT_NO_FATAL_FAILURE(VerifyAllocAccess(alloc, kAllocSize));
+  EXPECT_TRUE(heap_manager->Free(heap_id, alloc));
+
+  // The parked block stays poisoned.
+  ASSERT_NO_FATAL_FAILURE(VerifyFreedAccess(alloc, kAllocSize));
+
+  // Allocating the same size again hands back the parked block.
+  void* alloc2 = heap_manager->Allocate(heap_id, kAllocSize);
+  EXPECT_EQ(alloc, alloc2);
+  ASSERT_NO_FATAL_FAILURE(VerifyAllocAccess(alloc2, kAllocSize));
+  EXPECT_EQ(kAllocSize, heap_manager->Size(heap_id, alloc2));
+  EXPECT_TRUE(heap_manager->Free(heap_id, alloc2));
+
+  // A different size of the same size class reuses the same block, which gets
+  // reformatted.
+  const uint32_t kOtherAllocSize = kAllocSize + 1;
+  ASSERT_EQ(GetAllocSize(kAllocSize), GetAllocSize(kOtherAllocSize));
+  void* alloc3 = heap_manager->Allocate(heap_id, kOtherAllocSize);
+  ASSERT_NE(static_cast<void*>(nullptr), alloc3);
+  ASSERT_NO_FATAL_FAILURE(VerifyAllocAccess(alloc3, kOtherAllocSize));
+  EXPECT_EQ(kOtherAllocSize, heap_manager->Size(heap_id, alloc3));
+  EXPECT_TRUE(heap_manager->Free(heap_id, alloc3));
+
+  heap_manager->FlushThreadMagazines();
+  EXPECT_TRUE(errors_.empty());
+}
+
+TEST_F(BlockHeapManagerTest, MagazinesIgnoreLargeBlocks) {
+  std::unique_ptr<TestBlockHeapManager> heap_manager =
+      CreateHeapManagerWithMagazines(1);
+  HeapId heap_id = heap_manager->process_heap();
+
+  const uint32_t kAllocSize = TestBlockHeapManager::kMagazineMaxBlockSize;
+  ASSERT_LT(TestBlockHeapManager::kMagazineMaxBlockSize,
+            GetAllocSize(kAllocSize));
+  void* alloc = heap_manager->Allocate(heap_id, kAllocSize);
+  ASSERT_NE(static_cast<void*>(nullptr), alloc);
+  EXPECT_TRUE(heap_manager->Free(heap_id, alloc));
+
+  // The block went straight back to the heap.
+  EXPECT_FALSE(heap_manager->shadow_->IsBeginningOfBlockBody(alloc));
+  EXPECT_TRUE(errors_.empty());
+}
+
+TEST_F(BlockHeapManagerTest, MagazinesDetectDoubleFree) {
+  std::unique_ptr<TestBlockHeapManager> heap_manager =
+      CreateHeapManagerWithMagazines(1);
+  HeapId heap_id = heap_manager->process_heap();
+
+  const uint32_t kAllocSize = 100;
+  void* alloc = heap_manager->Allocate(heap_id, kAllocSize);
+  ASSERT_NE(static_cast<void*>(nullptr), alloc);
+  EXPECT_TRUE(heap_manager->Free(heap_id, alloc));
+  EXPECT_FALSE(heap_manager->Free(heap_id, alloc));
+
+  EXPECT_EQ(1u, errors_.size());
+  EXPECT_EQ(DOUBLE_FREE, errors_[0].error_type);
+  EXPECT_EQ(alloc, errors_[0].location);
+
+  // The block is still usable.
+  void* alloc2 = heap_manager->Allocate(heap_id, kAllocSize);
+  EXPECT_EQ(alloc, alloc2);
+  EXPECT_TRUE(heap_manager->Free(heap_id, alloc2));
+  heap_manager->FlushThreadMagazines();
+}
+
+TEST_F(BlockHeapManagerTest, MagazinesCantBeDisabledAfterInit) {
+  std::unique_ptr<TestBlockHeapManager> heap_manager =
+      CreateHeapManagerWithMagazines(1);
+  HeapId heap_id = heap_manager->process_heap();
+
+  const uint32_t kAllocSize = 100;
+  void* alloc = heap_manager->Allocate(heap_id, kAllocSize);
+  ASSERT_NE(static_cast<void*>(nullptr), alloc);
+  EXPECT_TRUE(heap_manager->Free(heap_id, alloc));
+
+  // The block stays parked, so a double free must still be caught.
+  ::common::AsanParameters parameters = heap_manager->parameters();
+  parameters.enable_block_magazines = false;
+  heap_manager->set_parameters(parameters);
+  EXPECT_FALSE(heap_manager->Free(heap_id, alloc));
+  EXPECT_EQ(1u, errors_.size());
+  EXPECT_EQ(DOUBLE_FREE, errors_[0].error_type);
+
+  // The parked block is still handed out.
+  void* alloc2 = heap_manager->Allocate(heap_id, kAllocSize);
+  EXPECT_EQ(alloc, alloc2);
+  EXPECT_TRUE(heap_manager->Free(heap_id, alloc2));
+  heap_manager->FlushThreadMagazines();
+}
+
+TEST_F(BlockHeapManagerTest, MagazinesCrossThreadFree) {
+  std::unique_ptr<TestBlockHeapManager> heap_manager =
+      CreateHeapManagerWithMagazines(1);
+  HeapId heap_id = heap_manager->process_heap();
+
+  // Allocate blocks on a first thread.
+  const size_t kAllocCount = 3 * TestBlockHeapManager::kMagazineCapacity;
+  const uint32_t kAllocSize = 100;
+  MagazineAllocationRunner allocator(heap_manager.get(), kAllocCount,
+                                     kAllocSize, kAllocSize, false);
+  base::DelegateSimpleThread allocator_thread(&allocator, "Allocator");
+  allocator_thread.Start();
+  allocator_thread.Join();
+  ASSERT_EQ(kAllocCount, allocator.allocs().size());
+
+  // Free them on this thread, and hand the full magazines over to the depot.
+  for (void* alloc : allocator.allocs())
+    EXPECT_TRUE(heap_manager->Free(heap_id, alloc));
+  heap_manager->FlushThreadMagazines();
+  EXPECT_TRUE(errors_.empty());
+
+  // A third thread gets the freed blocks back through the depot.
+  MagazineAllocationRunner reallocator(heap_manager.get(), kAllocCount,
+                                       kAllocSize, kAllocSize, false);
+  base::DelegateSimpleThread reallocator_thread(&reallocator, "Reallocator");
+  reallocator_thread.Start();
+  reallocator_thread.Join();
+
+  // All the blocks have the same layout, so a recycled block comes back with
+  // the same body address.
+  std::set<void*> freed_blocks(allocator.allocs().begin(),
+                               allocator.allocs().end());
+  size_t recycled_blocks = 0;
+  for (void* alloc : reallocator.allocs()) {
+    ASSERT_NO_FATAL_FAILURE(VerifyAllocAccess(alloc, kAllocSize));
+    if (freed_blocks.count(alloc))
+      ++recycled_blocks;
+    EXPECT_TRUE(heap_manager->Free(heap_id, alloc));
+  }
+  EXPECT_LE(static_cast<size_t>(TestBlockHeapManager::kMagazineCapacity),
+            recycled_blocks);
+
+  heap_manager->FlushThreadMagazines();
+  EXPECT_TRUE(errors_.empty());
+}
+
+TEST_F(BlockHeapManagerTest, LockFreeQuarantine) {
+  TestBlockHeapManager heap_manager(runtime_->shadow(),
+                                    runtime_->stack_cache(),
+                                    runtime_->memory_notifier());
+  heap_manager.SetHeapErrorCallback(
+      base::Bind(&BlockHeapManagerTest::OnHeapError, base::Unretained(this)));
+  ::common::AsanParameters parameters = heap_manager_->parameters();
+  parameters.enable_lock_free_quarantine = true;
+  heap_manager.set_parameters(parameters);
+  heap_manager.Init();
+
+  // All the heaps share the lock-free quarantine.
+  ASSERT_NE(static_cast<TestBlockHeapManager::MpscBlockQuarantine*>(nullptr),
+            heap_manager.lock_free_quarantine_.get());
+  BlockQuarantineInterface* quarantine = heap_manager.GetSharedQuarantine();
+  EXPECT_EQ(heap_manager.lock_free_quarantine_.get(), quarantine);
+  HeapId heap_id = heap_manager.CreateHeap();
+  EXPECT_EQ(quarantine, heap_manager.GetQuarantineFromId(heap_id));
+  EXPECT_EQ(quarantine,
+            heap_manager.GetQuarantineFromId(heap_manager.process_heap()));
+
+  const uint32_t kAllocSize = 100;
+  void* alloc = heap_manager.Allocate(heap_id, kAllocSize);
+  ASSERT_NE(static_cast<void*>(nullptr), alloc);
+  EXPECT_TRUE(heap_manager.Free(heap_id, alloc));
+  EXPECT_EQ(1u, quarantine->GetCountForTesting());
+  EXPECT_FALSE(runtime_->shadow()->IsAccessible(alloc));
+
+  EXPECT_FALSE(heap_manager.Free(heap_id, alloc));
+  EXPECT_EQ(1u, errors_.size());
+  EXPECT_EQ(DOUBLE_FREE, errors_[0].error_type);
+
+  // Destroying the heap removes its blocks from the quarantine.
+  EXPECT_TRUE(heap_manager.DestroyHeap(heap_id));
+  EXPECT_EQ(0u, quarantine->GetCountForTesting());
+}
+
+TEST_F(BlockHeapManagerTest, TrimQuarantineWithBudget) {
+  const uint32_t kAllocSize = 100;
+  const size_t kBlockCount = 2000;
+  ::common::AsanParameters parameters = heap_manager_->parameters();
+  parameters.quarantine_size = GetAllocSize(kAllocSize) * kBlockCount;
+  heap_manager_->set_parameters(parameters);
+  HeapId heap_id = heap_manager_->process_heap();
+
+  // Fill the quarantine without the deferred free thread.
+  for (size_t i = 0; i < kBlockCount; ++i) {
+    void* alloc = heap_manager_->Allocate(heap_id, kAllocSize);
+    ASSERT_NE(static_cast<void*>(nullptr), alloc);
+    EXPECT_TRUE(heap_manager_->Free(heap_id, alloc));
+  }
+  EXPECT_EQ(kBlockCount, heap_manager_->shared_quarantine_.GetCountForTesting());
+
+  // Shrinking the quarantine to nearly nothing requires many batches.
+  parameters.quarantine_size = GetAllocSize(kAllocSize) * 10;
+  heap_manager_->shared_quarantine_.set_max_quarantine_size(
+      parameters.quarantine_size);
+  EXPECT_TRUE(heap_manager_->TrimQuarantineWithBudget(
+      GREEN, 100, &heap_manager_->shared_quarantine_));
+  EXPECT_EQ(kBlockCount - 100,
+            heap_manager_->shared_quarantine_.GetCountForTesting());
+
+  // Finishing the job doesn't exhaust the budget.
+  EXPECT_FALSE(heap_manager_->TrimQuarantineWithBudget(
+      GREEN, kBlockCount, &heap_manager_->shared_quarantine_));
+  EXPECT_GE(10u, heap_manager_->shared_quarantine_.GetCountForTesting());
+  heap_manager_->set_parameters(parameters);
+}
+
 }  // namespace heap_managers
 }  // namespace asan
 }  // namespace agent
@@ -15,6 +15,7 @@
 
 #include <stdint.h>
 
+#include "base/atomicops.h"
 #include "base/logging.h"
 #include "base/macros.h"
 #include "syzygy/agent/asan/memory_interceptors_impl.h"
@@ -35,6 +36,10 @@ RedirectEntryCallback redirect_entry_callback;
 // shadow memory must be patched directly.
 Shadow* memory_interceptor_shadow_ = nullptr;
 
+// The byte the inline checks read when no shadow memory is configured. It is
+// non-zero so that they always fall back to the out-of-line probes.
+const uint8_t kInlineCheckSlowPathMarker = 0xFF;
+
 // Helper function to find a redirector variant.
 // @param variants The array containing all the different probe variants,
 //     it should be an array of MemoryAccessorVariants or any type derived
@@ -74,6 +79,25 @@ T FindMemoryRedirectorVariant(const T2(&variants)[N],
 Shadow* SetMemoryInterceptorShadow(Shadow* shadow) {
   Shadow* old_shadow = memory_interceptor_shadow_;
   memory_interceptor_shadow_ = shadow;
+
+  // Update the inline check shadow such that it is always safe to use by a
+  // concurrently running inline check. While the mask is zero the checks read
+  // the first byte of the shadow, which is always poisoned, so the mask is
+  // cleared before the shadow pointer changes and only set afterwards. A
+  // shadow whose length isn't a power of two can't be addressed with a mask,
+  // in which case the inline checks are left disabled.
+  asan_inline_check_shadow.mask = 0;
+  base::subtle::MemoryBarrier();
+  if (shadow == nullptr) {
+    asan_inline_check_shadow.shadow = &kInlineCheckSlowPathMarker;
+    return old_shadow;
+  }
+  asan_inline_check_shadow.shadow = shadow->shadow();
+  base::subtle::MemoryBarrier();
+  size_t length = shadow->length();
+  if (length != 0 && (length & (length - 1)) == 0)
+    asan_inline_check_shadow.mask = length - 1;
+
   return old_shadow;
 }
 
@@ -96,6 +120,23 @@ const MemoryAccessorVariants kMemoryAccessorVariants[] = {
 
 #undef ENUM_MEM_INTERCEPT_FUNCTION_VARIANTS
 
+#define ENUM_RANGE_INTERCEPT_FUNCTION_VARIANTS(access_mode_str,              \
+                                               access_mode_value)            \
+  { "asan_check_range_" #access_mode_str,                                    \
+    asan_redirect_range_##access_mode_str, asan_no_range_check,              \
+    asan_check_range_##access_mode_str##_2gb,                                \
+    asan_check_range_##access_mode_str##_4gb                                 \
+  },                                                                         \
+  { "asan_check_range_" #access_mode_str "_no_flags",                        \
+     asan_redirect_range_##access_mode_str##_no_flags,                       \
+     asan_no_range_check,                                                    \
+     asan_check_range_##access_mode_str##_no_flags_2gb,                      \
+     asan_check_range_##access_mode_str##_no_flags_4gb},
+
+    ASAN_RANGE_INTERCEPT_FUNCTIONS(ENUM_RANGE_INTERCEPT_FUNCTION_VARIANTS)
+
+#undef ENUM_RANGE_INTERCEPT_FUNCTION_VARIANTS
+
 #define ENUM_STRING_INTERCEPT_FUNCTION_VARIANTS( \
     func, prefix, counter, dst_mode, src_mode, access_size, compare)         \
   { "asan_check" #prefix #access_size "_byte_" #func "_access",              \
@@ -263,7 +304,31 @@ void asan_report_bad_memory_access(void* location,
                                             asan_context);
 }
 
+// Reports a bad access to a range of memory. The range checks can't tell
+// which of the accesses they cover is bad, so this reports the first
+// inaccessible byte of the range.
+void asan_report_bad_range_access(void* location,
+                                  AccessMode access_mode,
+                                  size_t access_size,
+                                  const AsanContext& asan_context) {
+  if (memory_interceptor_shadow_) {
+    const void* poisoned = memory_interceptor_shadow_->FindFirstPoisonedByte(
+        location, access_size);
+    if (poisoned != nullptr)
+      location = const_cast<void*>(poisoned);
+  }
+  return agent::asan::ReportBadMemoryAccess(location, access_mode, access_size,
+                                            asan_context);
+}
+
 }  // extern "C"
 
 }  // namespace asan
 }  // namespace agent
+
+extern "C" {
+
+agent::asan::InlineCheckShadow asan_inline_check_shadow = {
+    0, &agent::asan::kInlineCheckSlowPathMarker};
+
+}  // extern "C"
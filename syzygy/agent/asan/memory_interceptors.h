@@ -16,6 +16,8 @@
 #ifndef SYZYGY_AGENT_ASAN_MEMORY_INTERCEPTORS_H_
 #define SYZYGY_AGENT_ASAN_MEMORY_INTERCEPTORS_H_
 
+#include <stdint.h>
+
 #include "base/callback.h"
 
 namespace agent {
@@ -30,8 +32,25 @@ class Shadow;
 // @note This only updates uses of the shadow via the Shadow API. Interceptors
 //     that make direct reference to the shadow memory must be patched in
 //     place using 'PatchMemoryInterceptorShadowReferences'.
+// @note This also updates |asan_inline_check_shadow|, which is read by the
+//     checks that the instrumenter emits inline.
 Shadow* SetMemoryInterceptorShadow(Shadow* shadow);
 
+// Describes the shadow memory to the memory checks that are emitted inline by
+// the instrumenter. The shadow byte of |address| is found at
+// shadow[(address >> 3) & mask], and the addresses with index bits above
+// |mask| aren't covered by the shadow. When no shadow is configured, |mask| is
+// zero and |shadow| points to a non-zero byte, so that every inline check
+// defers to the out-of-line probes.
+// @note The layout of this structure is part of the ABI of the runtime, the
+//     instrumented code reads its fields at fixed offsets.
+struct InlineCheckShadow {
+  uintptr_t mask;
+  const uint8_t* shadow;
+};
+static_assert(sizeof(InlineCheckShadow) == 2 * sizeof(uintptr_t),
+              "InlineCheckShadow is part of the runtime ABI");
+
 // Memory accessor mode select.
 enum MemoryAccessorMode {
   MEMORY_ACCESSOR_MODE_NOOP,  // Noop mode - no checking performed.
@@ -135,6 +154,13 @@ extern const size_t kNumClangMemoryAccessorVariants;
     F(16, write_access, AsanWriteAccess) \
     F(32, write_access, AsanWriteAccess)
 
+// List of the range check function variants this file implements. These
+// check a range of bytes whose size is passed on the stack, and are used to
+// check several adjacent accesses at once.
+#define ASAN_RANGE_INTERCEPT_FUNCTIONS(F) \
+    F(read_access, AsanReadAccess) \
+    F(write_access, AsanWriteAccess)
+
 #define ASAN_STRING_INTERCEPT_FUNCTIONS(F)                       \
   F(cmps, _repz_, ecx, AsanReadAccess, AsanReadAccess, 4, 1)     \
   F(cmps, _repz_, ecx, AsanReadAccess, AsanReadAccess, 2, 1)     \
@@ -188,6 +214,9 @@ extern "C" {
 #ifndef _WIN64
 // The no-op memory access checker.
 void asan_no_check();
+
+// The no-op range checker.
+void asan_no_range_check();
 #endif
 
 // The following functions are added for compatibility but are not implemented
@@ -209,6 +238,10 @@ void asan_string_no_check();
 // itself will not be modified, but the pointers it points to will be.
 extern const void* asan_shadow_references[];
 
+// The shadow memory description used by the inline memory checks. This is
+// exported as data, and imported by the instrumented modules.
+extern agent::asan::InlineCheckShadow asan_inline_check_shadow;
+
 #ifndef _WIN64
 #define DECLARE_MEM_INTERCEPT_FUNCTIONS(access_size, access_mode_str,      \
                                         access_mode_value)                 \
@@ -225,6 +258,20 @@ ASAN_MEM_INTERCEPT_FUNCTIONS(DECLARE_MEM_INTERCEPT_FUNCTIONS)
 
 #undef DECLARE_MEM_INTERCEPT_FUNCTIONS
 
+#define DECLARE_RANGE_INTERCEPT_FUNCTIONS(access_mode_str, access_mode_value) \
+  void asan_redirect_range_##access_mode_str();                             \
+  void asan_check_range_##access_mode_str##_2gb();                          \
+  void asan_check_range_##access_mode_str##_4gb();                          \
+  void asan_redirect_range_##access_mode_str##_no_flags();                  \
+  void asan_check_range_##access_mode_str##_no_flags_2gb();                 \
+  void asan_check_range_##access_mode_str##_no_flags_4gb();
+
+// Declare all the range check functions. Note that these functions have a
+// custom calling convention, and can't be invoked directly.
+ASAN_RANGE_INTERCEPT_FUNCTIONS(DECLARE_RANGE_INTERCEPT_FUNCTIONS)
+
+#undef DECLARE_RANGE_INTERCEPT_FUNCTIONS
+
 #define DECLARE_STRING_INTERCEPT_FUNCTIONS(func, prefix, counter, dst_mode, \
                                            src_mode, access_size, compare)  \
   void asan_redirect##prefix##access_size##_byte_##func##_access();         \
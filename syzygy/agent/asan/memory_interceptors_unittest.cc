@@ -80,6 +80,40 @@ static const TestMemoryInterceptors::InterceptFunction
 #undef DEFINE_REDIRECT_FUNCTION_TABLE_NO_FLAGS
 };
 
+static const TestMemoryInterceptors::InterceptFunction
+    range_intercept_functions[] = {
+#define DEFINE_RANGE_INTERCEPT_FUNCTION_TABLE(access_mode_str, access_mode) \
+  { asan_check_range_##access_mode_str##_2gb, 0 },                          \
+  { asan_check_range_##access_mode_str##_4gb, 0 },
+
+ASAN_RANGE_INTERCEPT_FUNCTIONS(DEFINE_RANGE_INTERCEPT_FUNCTION_TABLE)
+
+#undef DEFINE_RANGE_INTERCEPT_FUNCTION_TABLE
+};
+
+static const TestMemoryInterceptors::InterceptFunction
+    range_intercept_functions_no_flags[] = {
+#define DEFINE_RANGE_INTERCEPT_FUNCTION_TABLE_NO_FLAGS(access_mode_str, \
+                                                       access_mode)     \
+  { asan_check_range_##access_mode_str##_no_flags_2gb, 0 },             \
+  { asan_check_range_##access_mode_str##_no_flags_4gb, 0 },
+
+ASAN_RANGE_INTERCEPT_FUNCTIONS(DEFINE_RANGE_INTERCEPT_FUNCTION_TABLE_NO_FLAGS)
+
+#undef DEFINE_RANGE_INTERCEPT_FUNCTION_TABLE_NO_FLAGS
+};
+
+static const TestMemoryInterceptors::InterceptFunction
+    range_redirect_functions[] = {
+#define DEFINE_RANGE_REDIRECT_FUNCTION_TABLE(access_mode_str, access_mode) \
+  { asan_redirect_range_##access_mode_str, 0 },                            \
+  { asan_redirect_range_##access_mode_str##_no_flags, 0 },
+
+ASAN_RANGE_INTERCEPT_FUNCTIONS(DEFINE_RANGE_REDIRECT_FUNCTION_TABLE)
+
+#undef DEFINE_RANGE_REDIRECT_FUNCTION_TABLE
+};
+
 static const TestMemoryInterceptors::StringInterceptFunction
     string_intercept_functions[] = {
 #define DEFINE_STRING_INTERCEPT_FUNCTION_TABLE(func, prefix, counter, \
@@ -326,6 +360,48 @@ TYPED_TEST(MemoryInterceptorsTypedTest, TestRedirectorsSmallMemory) {
 }
 
 #ifndef _WIN64
+TEST_F(MemoryInterceptorsTest, TestRangeAccess) {
+  TestRangeAccess(range_intercept_functions);
+  TestRangeAccessIgnoreFlags(range_intercept_functions_no_flags);
+}
+
+TEST_F(MemoryInterceptorsTest, TestRangeRedirectors2G) {
+  EXPECT_CALL(*this, OnRedirectorInvocation(_))
+      // Each function is tested with two valid ranges, an overrun and an
+      // underrun.
+      .Times(4 * static_cast<int>(arraysize(range_redirect_functions)))
+      .WillRepeatedly(Return(MEMORY_ACCESSOR_MODE_2G));
+
+  TestRangeAccessIgnoreFlags(range_redirect_functions);
+}
+
+TEST_F(MemoryInterceptorsTest, InlineCheckShadow) {
+  // Reads the shadow byte of |address| the same way the inline checks do.
+  auto inline_shadow_byte = [](const void* address) {
+    uintptr_t index = (reinterpret_cast<uintptr_t>(address) >> 3) &
+                      asan_inline_check_shadow.mask;
+    return asan_inline_check_shadow.shadow[index];
+  };
+
+  // The runtime configured the inline check shadow.
+  Shadow* shadow = asan_runtime_.shadow();
+  ASSERT_NE(nullptr, shadow);
+  EXPECT_EQ(shadow->shadow(), asan_inline_check_shadow.shadow);
+  EXPECT_EQ(shadow->length() - 1, asan_inline_check_shadow.mask);
+  EXPECT_EQ(0u, inline_shadow_byte(src_));
+  EXPECT_EQ(0u, inline_shadow_byte(src_ + kAllocSize - 1));
+  EXPECT_NE(0u, inline_shadow_byte(src_ - 1));
+  EXPECT_NE(0u, inline_shadow_byte(src_ + kAllocSize));
+
+  // Without a shadow every address maps to a poisoned byte.
+  EXPECT_EQ(shadow, SetMemoryInterceptorShadow(nullptr));
+  EXPECT_EQ(0u, asan_inline_check_shadow.mask);
+  EXPECT_NE(0u, inline_shadow_byte(src_));
+
+  EXPECT_EQ(nullptr, SetMemoryInterceptorShadow(shadow));
+  EXPECT_EQ(0u, inline_shadow_byte(src_));
+}
+
 TEST_F(MemoryInterceptorsTest, TestStringValidAccess) {
   TestStringValidAccess(string_intercept_functions);
 }
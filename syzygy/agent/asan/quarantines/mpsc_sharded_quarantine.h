@@ -0,0 +1,174 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Implements a sharded quarantine whose push path is lock-free.
+
+#ifndef SYZYGY_AGENT_ASAN_QUARANTINES_MPSC_SHARDED_QUARANTINE_H_
+#define SYZYGY_AGENT_ASAN_QUARANTINES_MPSC_SHARDED_QUARANTINE_H_
+
+#include <windows.h>
+
+#include "base/atomicops.h"
+#include "base/synchronization/lock.h"
+#include "syzygy/agent/asan/quarantines/sharded_quarantine.h"
+#include "syzygy/agent/asan/quarantines/size_limited_quarantine.h"
+
+namespace agent {
+namespace asan {
+namespace quarantines {
+
+// A sharded quarantine where each shard is a multiple-producer single-consumer
+// queue. Pushing an object never takes a lock: the object is appended to the
+// pending list of the shard associated with the calling thread using an
+// interlocked singly linked list, and the size of the quarantine is kept in
+// a global atomic counter rather than behind a lock.
+//
+// Popping an object requires exclusive ownership of a shard, but a popping
+// thread skips the shards that are being drained by another thread instead of
+// waiting for them. A thread freeing memory therefore never blocks behind the
+// deferred free thread while it trims the quarantine.
+//
+// An object becomes visible to Pop only once the thread that pushed it
+// releases its quarantine lock (see QuarantineInterface::AutoQuarantineLock).
+// This preserves the guarantee offered by the lock-based quarantines that a
+// pushed object can't be popped while the pushing thread still holds its lock,
+// without ever making a thread wait. As a consequence, Push must always be
+// called under an AutoQuarantineLock.
+//
+// @tparam ObjectType The type of object being stored in the cache.
+// @tparam SizeFunctorType A functor for extracting the size associated with
+//     an object.
+// @tparam ShardingFactor The sharding factor. Must be at least 1.
+template<typename ObjectType,
+         typename SizeFunctorType,
+         size_t ShardingFactor>
+class MpscShardedQuarantine
+    : public SizeLimitedQuarantineImpl<ObjectType, SizeFunctorType> {
+ public:
+  static const size_t kShardingFactor = ShardingFactor;
+
+  // Constructor.
+  MpscShardedQuarantine();
+
+  // Virtual destructor.
+  virtual ~MpscShardedQuarantine();
+
+  // @name QuarantineInterface implementation.
+  // @note These replace the lock-based size accounting of
+  //     SizeLimitedQuarantineImpl with atomic counters.
+  // @{
+  PushResult Push(const Object& object) override;
+  PopResult Pop(Object* object) override;
+  void Empty(ObjectVector* objects) override;
+  size_t GetCountForTesting() override;
+  // @}
+
+  // @name SizeLimitedQuarantineImpl overrides.
+  // @{
+  size_t GetSizeForTesting() override;
+  // @}
+
+ protected:
+  // @name SizeLimitedQuarantineImpl implementation.
+  // @{
+  bool PushImpl(const Object& object) override;
+  bool PopImpl(Object* object) override;
+  void EmptyImpl(ObjectVector* objects) override;
+  size_t GetLockIdImpl(const Object& object) override;
+  void LockImpl(size_t id) override;
+  void UnlockImpl(size_t id) override;
+  // @}
+
+  // The internal type used for storing objects. The list entry must come
+  // first as nodes are recovered from the entries returned by the interlocked
+  // list functions.
+  struct DECLSPEC_ALIGN(MEMORY_ALLOCATION_ALIGNMENT) Node {
+    SLIST_ENTRY entry;
+    Object object;
+    // Set to 1 once the pushing thread released its quarantine lock.
+    base::subtle::Atomic32 published;
+  };
+
+  // A shard of the quarantine.
+  struct Shard {
+    // Objects pushed since the last time this shard was drained, most recent
+    // first. This is the only part of a shard touched by the producers.
+    SLIST_HEADER pending;
+    // Gives its owner the exclusive right to consume from this shard.
+    base::Lock consumer_lock;
+    // The objects that have been taken from |pending|, oldest first. Under
+    // |consumer_lock|.
+    Node* head;
+    Node* tail;
+  };
+
+  // The nodes are carved out of slabs of this size. Slabs are only returned to
+  // the OS when the quarantine is destroyed.
+  static const size_t kSlabSize = 64 * 1024;
+
+  // The header of a slab of nodes.
+  struct Slab {
+    Slab* next;
+  };
+
+  // Gets a node from the free list, allocating a new slab if necessary.
+  // @returns the node, or nullptr if no memory is available.
+  Node* AllocateNode();
+
+  // Returns a node to the free list.
+  // @param node The node to be returned.
+  void FreeNode(Node* node);
+
+  // Moves the pending objects of a shard to the end of its consumer list.
+  // @param shard The shard to refill. Its consumer lock must be held.
+  void RefillShard(Shard* shard);
+
+  // Pops the oldest published object of a shard.
+  // @param shard The shard to pop from. Its consumer lock must be held.
+  // @param object Receives the popped object.
+  // @returns true if an object was popped, false if the shard is empty or if
+  //     its oldest object hasn't been published yet.
+  bool PopFromShard(Shard* shard, Object* object);
+
+  // The shards of the quarantine.
+  Shard shards_[kShardingFactor];
+
+  // The free nodes.
+  SLIST_HEADER free_nodes_;
+
+  // The slabs of nodes allocated so far. Under |slab_lock_|.
+  Slab* slabs_;
+  base::Lock slab_lock_;
+
+  // A TLS slot containing the node pushed by the current thread that will be
+  // published when it releases its quarantine lock.
+  DWORD pushed_node_tls_;
+
+  // The size of the quarantine and the number of objects it contains. These
+  // are accessed atomically and are only eventually consistent with each
+  // other.
+  base::subtle::AtomicWord size_;
+  base::subtle::AtomicWord count_;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(MpscShardedQuarantine);
+};
+
+}  // namespace quarantines
+}  // namespace asan
+}  // namespace agent
+
+#include "syzygy/agent/asan/quarantines/mpsc_sharded_quarantine_impl.h"
+
+#endif  // SYZYGY_AGENT_ASAN_QUARANTINES_MPSC_SHARDED_QUARANTINE_H_
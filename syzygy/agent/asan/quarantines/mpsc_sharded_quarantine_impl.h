@@ -0,0 +1,331 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Internal implementation of a MPSC sharded quarantine. This file is not
+// meant to be included directly.
+
+#ifndef SYZYGY_AGENT_ASAN_QUARANTINES_MPSC_SHARDED_QUARANTINE_IMPL_H_
+#define SYZYGY_AGENT_ASAN_QUARANTINES_MPSC_SHARDED_QUARANTINE_IMPL_H_
+
+#include "syzygy/common/align.h"
+
+namespace agent {
+namespace asan {
+namespace quarantines {
+
+template<typename OT, typename SFT, size_t SF>
+MpscShardedQuarantine<OT, SFT, SF>::MpscShardedQuarantine()
+    : slabs_(nullptr), size_(0), count_(0) {
+  static_assert(kShardingFactor >= 1, "Invalid sharding factor.");
+  for (size_t i = 0; i < kShardingFactor; ++i) {
+    ::InitializeSListHead(&shards_[i].pending);
+    shards_[i].head = nullptr;
+    shards_[i].tail = nullptr;
+  }
+  ::InitializeSListHead(&free_nodes_);
+  pushed_node_tls_ = ::TlsAlloc();
+  CHECK_NE(TLS_OUT_OF_INDEXES, pushed_node_tls_);
+}
+
+template<typename OT, typename SFT, size_t SF>
+MpscShardedQuarantine<OT, SFT, SF>::~MpscShardedQuarantine() {
+  // The objects that are still in the quarantine are simply dropped, along
+  // with the slabs holding their nodes.
+  while (slabs_ != nullptr) {
+    Slab* next = slabs_->next;
+    CHECK(::VirtualFree(slabs_, 0, MEM_RELEASE));
+    slabs_ = next;
+  }
+  ::TlsFree(pushed_node_tls_);
+}
+
+template<typename OT, typename SFT, size_t SF>
+PushResult MpscShardedQuarantine<OT, SFT, SF>::Push(const Object& object) {
+  PushResult result = {false, 0};
+  size_t size = size_functor_(object);
+  if (max_object_size_ != kUnboundedSize && size > max_object_size_)
+    return result;
+
+  // The size is accounted for before the object becomes visible to the
+  // consumers, so that it can't be decremented before being incremented.
+  base::subtle::AtomicWord delta = static_cast<base::subtle::AtomicWord>(size);
+  size_t new_size = static_cast<size_t>(
+      base::subtle::Barrier_AtomicIncrement(&size_, delta));
+  base::subtle::NoBarrier_AtomicIncrement(&count_, 1);
+  size_t old_size = new_size - size;
+
+  if (PushImpl(object)) {
+    result.push_successful = true;
+  } else {
+    new_size = static_cast<size_t>(
+        base::subtle::Barrier_AtomicIncrement(&size_, -delta));
+    base::subtle::NoBarrier_AtomicIncrement(&count_, -1);
+  }
+
+  result.trim_status = GetPushTrimStatus(old_size, new_size);
+  return result;
+}
+
+template<typename OT, typename SFT, size_t SF>
+PopResult MpscShardedQuarantine<OT, SFT, SF>::Pop(Object* object) {
+  DCHECK_NE(static_cast<Object*>(nullptr), object);
+  PopResult result = {false, TrimColor::GREEN};
+
+  if (max_quarantine_size_ == kUnboundedSize)
+    return result;
+
+  // Never pop if already in GREEN as this is the lowest bound. As with the
+  // lock-based accounting, the size may be slightly stale here.
+  size_t size = static_cast<size_t>(base::subtle::Acquire_Load(&size_));
+  if (GetQuarantineColor(size) == TrimColor::GREEN)
+    return result;
+
+  if (!PopImpl(object))
+    return result;
+
+  base::subtle::AtomicWord delta =
+      static_cast<base::subtle::AtomicWord>(size_functor_(*object));
+  size_t new_size = static_cast<size_t>(
+      base::subtle::Barrier_AtomicIncrement(&size_, -delta));
+  base::subtle::NoBarrier_AtomicIncrement(&count_, -1);
+
+  result.pop_successful = true;
+  result.trim_color = GetQuarantineColor(new_size);
+  return result;
+}
+
+template<typename OT, typename SFT, size_t SF>
+void MpscShardedQuarantine<OT, SFT, SF>::Empty(ObjectVector* objects) {
+  DCHECK_NE(static_cast<ObjectVector*>(nullptr), objects);
+  size_t first_object = objects->size();
+  EmptyImpl(objects);
+
+  // Only remove the contributions of the objects that were actually removed,
+  // as some pushes may be in flight.
+  base::subtle::AtomicWord net_size = 0;
+  for (size_t i = first_object; i < objects->size(); ++i)
+    net_size += static_cast<base::subtle::AtomicWord>(
+        size_functor_(objects->at(i)));
+
+  base::subtle::Barrier_AtomicIncrement(&size_, -net_size);
+  base::subtle::NoBarrier_AtomicIncrement(
+      &count_,
+      -static_cast<base::subtle::AtomicWord>(objects->size() - first_object));
+}
+
+template<typename OT, typename SFT, size_t SF>
+size_t MpscShardedQuarantine<OT, SFT, SF>::GetCountForTesting() {
+  return static_cast<size_t>(base::subtle::Acquire_Load(&count_));
+}
+
+template<typename OT, typename SFT, size_t SF>
+size_t MpscShardedQuarantine<OT, SFT, SF>::GetSizeForTesting() {
+  return static_cast<size_t>(base::subtle::Acquire_Load(&size_));
+}
+
+template<typename OT, typename SFT, size_t SF>
+bool MpscShardedQuarantine<OT, SFT, SF>::PushImpl(const Object& object) {
+  // Only one object can be pushed per quarantine lock.
+  DCHECK_EQ(static_cast<LPVOID>(nullptr), ::TlsGetValue(pushed_node_tls_));
+
+  Node* node = AllocateNode();
+  if (node == nullptr)
+    return false;
+  node->object = object;
+  base::subtle::NoBarrier_Store(&node->published, 0);
+
+  // The node is published when the quarantine lock gets released.
+  ::TlsSetValue(pushed_node_tls_, node);
+  size_t shard = GetLockIdImpl(object);
+  ::InterlockedPushEntrySList(&shards_[shard].pending, &node->entry);
+
+  return true;
+}
+
+template<typename OT, typename SFT, size_t SF>
+bool MpscShardedQuarantine<OT, SFT, SF>::PopImpl(Object* object) {
+  DCHECK_NE(static_cast<Object*>(nullptr), object);
+
+  // Start with a random shard and scan linearly until finding one with a
+  // published object. Shards that are being consumed by another thread are
+  // skipped rather than waited for.
+  size_t shard = rand() % kShardingFactor;
+  for (size_t i = 0; i < kShardingFactor; ++i) {
+    Shard* current = &shards_[(shard + i) % kShardingFactor];
+    if (!current->consumer_lock.Try())
+      continue;
+    bool popped = PopFromShard(current, object);
+    current->consumer_lock.Release();
+    if (popped)
+      return true;
+  }
+
+  return false;
+}
+
+template<typename OT, typename SFT, size_t SF>
+void MpscShardedQuarantine<OT, SFT, SF>::EmptyImpl(ObjectVector* objects) {
+  DCHECK_NE(static_cast<ObjectVector*>(nullptr), objects);
+
+  for (size_t i = 0; i < kShardingFactor; ++i) {
+    Shard* shard = &shards_[i];
+    base::AutoLock lock(shard->consumer_lock);
+
+    // Only the objects pending at this point are removed, otherwise a steady
+    // flow of pushes could keep this from ever returning.
+    RefillShard(shard);
+    while (shard->head != nullptr) {
+      Node* node = shard->head;
+      // The pushing thread is about to release its quarantine lock. This is
+      // the only place where a thread waits on a push.
+      while (!base::subtle::Acquire_Load(&node->published))
+        ::SwitchToThread();
+      shard->head = reinterpret_cast<Node*>(node->entry.Next);
+      objects->push_back(node->object);
+      FreeNode(node);
+    }
+    shard->tail = nullptr;
+  }
+}
+
+template<typename OT, typename SFT, size_t SF>
+size_t MpscShardedQuarantine<OT, SFT, SF>::GetLockIdImpl(
+    const Object& object) {
+  // Objects are sharded by the thread pushing them. This doesn't touch the
+  // object, and keeps the threads pushing concurrently on separate lists.
+  return detail::ShardedQuarantineHash<kShardingFactor>(
+      ::GetCurrentThreadId());
+}
+
+template<typename OT, typename SFT, size_t SF>
+void MpscShardedQuarantine<OT, SFT, SF>::LockImpl(size_t id) {
+  DCHECK_LT(id, kShardingFactor);
+  // Pushing requires no lock.
+}
+
+template<typename OT, typename SFT, size_t SF>
+void MpscShardedQuarantine<OT, SFT, SF>::UnlockImpl(size_t id) {
+  DCHECK_LT(id, kShardingFactor);
+
+  // Publish the node pushed under this lock, if any.
+  Node* node = reinterpret_cast<Node*>(::TlsGetValue(pushed_node_tls_));
+  if (node == nullptr)
+    return;
+  ::TlsSetValue(pushed_node_tls_, nullptr);
+  base::subtle::Release_Store(&node->published, 1);
+}
+
+template<typename OT, typename SFT, size_t SF>
+typename MpscShardedQuarantine<OT, SFT, SF>::Node*
+MpscShardedQuarantine<OT, SFT, SF>::AllocateNode() {
+  SLIST_ENTRY* entry = ::InterlockedPopEntrySList(&free_nodes_);
+  if (entry != nullptr)
+    return reinterpret_cast<Node*>(entry);
+
+  {
+    base::AutoLock lock(slab_lock_);
+
+    // Another thread may have allocated a slab while this one was waiting.
+    entry = ::InterlockedPopEntrySList(&free_nodes_);
+    if (entry != nullptr)
+      return reinterpret_cast<Node*>(entry);
+
+    Slab* slab = reinterpret_cast<Slab*>(::VirtualAlloc(
+        nullptr, kSlabSize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+    if (slab == nullptr)
+      return nullptr;
+    slab->next = slabs_;
+    slabs_ = slab;
+
+    // Keep the first node for the caller and put the rest in the free list.
+    uint8_t* begin = ::common::AlignUp(
+        reinterpret_cast<uint8_t*>(slab + 1), MEMORY_ALLOCATION_ALIGNMENT);
+    uint8_t* end = reinterpret_cast<uint8_t*>(slab) + kSlabSize;
+    size_t node_count = (end - begin) / sizeof(Node);
+    DCHECK_LT(1u, node_count);
+    Node* nodes = reinterpret_cast<Node*>(begin);
+    for (size_t i = 1; i < node_count; ++i)
+      ::InterlockedPushEntrySList(&free_nodes_, &nodes[i].entry);
+    return &nodes[0];
+  }
+}
+
+template<typename OT, typename SFT, size_t SF>
+void MpscShardedQuarantine<OT, SFT, SF>::FreeNode(Node* node) {
+  DCHECK_NE(static_cast<Node*>(nullptr), node);
+  ::InterlockedPushEntrySList(&free_nodes_, &node->entry);
+}
+
+template<typename OT, typename SFT, size_t SF>
+void MpscShardedQuarantine<OT, SFT, SF>::RefillShard(Shard* shard) {
+  DCHECK_NE(static_cast<Shard*>(nullptr), shard);
+  shard->consumer_lock.AssertAcquired();
+
+  SLIST_ENTRY* entry = ::InterlockedFlushSList(&shard->pending);
+  if (entry == nullptr)
+    return;
+
+  // The pending list is in LIFO order, reverse it.
+  Node* new_tail = reinterpret_cast<Node*>(entry);
+  SLIST_ENTRY* reversed = nullptr;
+  while (entry != nullptr) {
+    SLIST_ENTRY* next = entry->Next;
+    entry->Next = reversed;
+    reversed = entry;
+    entry = next;
+  }
+
+  Node* new_head = reinterpret_cast<Node*>(reversed);
+  if (shard->tail != nullptr) {
+    DCHECK_NE(static_cast<Node*>(nullptr), shard->head);
+    shard->tail->entry.Next = &new_head->entry;
+  } else {
+    DCHECK_EQ(static_cast<Node*>(nullptr), shard->head);
+    shard->head = new_head;
+  }
+  shard->tail = new_tail;
+}
+
+template<typename OT, typename SFT, size_t SF>
+bool MpscShardedQuarantine<OT, SFT, SF>::PopFromShard(Shard* shard,
+                                                      Object* object) {
+  DCHECK_NE(static_cast<Shard*>(nullptr), shard);
+  DCHECK_NE(static_cast<Object*>(nullptr), object);
+  shard->consumer_lock.AssertAcquired();
+
+  if (shard->head == nullptr)
+    RefillShard(shard);
+  Node* node = shard->head;
+  if (node == nullptr)
+    return false;
+
+  // Objects are popped in order, so an unpublished object holds back the
+  // whole shard until its pushing thread releases its quarantine lock.
+  if (!base::subtle::Acquire_Load(&node->published))
+    return false;
+
+  shard->head = reinterpret_cast<Node*>(node->entry.Next);
+  if (shard->head == nullptr)
+    shard->tail = nullptr;
+  *object = node->object;
+  FreeNode(node);
+
+  return true;
+}
+
+}  // namespace quarantines
+}  // namespace asan
+}  // namespace agent
+
+#endif  // SYZYGY_AGENT_ASAN_QUARANTINES_MPSC_SHARDED_QUARANTINE_IMPL_H_
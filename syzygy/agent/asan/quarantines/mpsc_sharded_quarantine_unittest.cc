@@ -0,0 +1,272 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/agent/asan/quarantines/mpsc_sharded_quarantine.h"
+
+#include <memory>
+#include <vector>
+
+#include "base/atomicops.h"
+#include "base/threading/simple_thread.h"
+#include "gtest/gtest.h"
+
+namespace agent {
+namespace asan {
+namespace quarantines {
+
+namespace {
+
+struct DummyObject {
+  size_t size;
+  size_t id;
+
+  DummyObject() : size(0), id(0) { }
+  DummyObject(size_t size, size_t id) : size(size), id(id) { }
+};
+
+struct DummyObjectSizeFunctor {
+  size_t operator()(const DummyObject& o) {
+    return o.size;
+  }
+};
+
+class TestMpscShardedQuarantine
+    : public MpscShardedQuarantine<DummyObject, DummyObjectSizeFunctor, 8> {
+ public:
+  typedef MpscShardedQuarantine<DummyObject, DummyObjectSizeFunctor, 8> Super;
+
+  // Pushes an object the way a client of the quarantine would.
+  bool LockAndPush(const DummyObject& object) {
+    AutoQuarantineLock lock(this, object);
+    return Push(object).push_successful;
+  }
+};
+
+// Pushes objects of size 1 into a quarantine. The ID of each object encodes the
+// producer that pushed it and its rank, to allow checking the order in which
+// they get popped.
+class ProducerRunner : public base::DelegateSimpleThread::Delegate {
+ public:
+  ProducerRunner(TestMpscShardedQuarantine* quarantine,
+                 size_t producer,
+                 size_t push_count,
+                 base::subtle::Atomic32* finished_producers)
+      : quarantine_(quarantine), producer_(producer), push_count_(push_count),
+        finished_producers_(finished_producers) {}
+
+  void Run() override {
+    for (size_t i = 0; i < push_count_; ++i) {
+      DummyObject d(1, producer_ * push_count_ + i);
+      EXPECT_TRUE(quarantine_->LockAndPush(d));
+    }
+    base::subtle::Barrier_AtomicIncrement(finished_producers_, 1);
+  }
+
+ private:
+  TestMpscShardedQuarantine* quarantine_;
+  size_t producer_;
+  size_t push_count_;
+  base::subtle::Atomic32* finished_producers_;
+
+  DISALLOW_COPY_AND_ASSIGN(ProducerRunner);
+};
+
+}  // namespace
+
+TEST(MpscShardedQuarantineTest, PopsInPushOrder) {
+  TestMpscShardedQuarantine q;
+  q.set_max_object_size(TestMpscShardedQuarantine::kUnboundedSize);
+  q.set_max_quarantine_size(0);
+
+  // All the objects pushed by this thread end up in the same shard, so they
+  // must come out in the order in which they were pushed.
+  for (size_t i = 0; i < 100; ++i)
+    EXPECT_TRUE(q.LockAndPush(DummyObject(1, i)));
+  EXPECT_EQ(100u, q.GetSizeForTesting());
+  EXPECT_EQ(100u, q.GetCountForTesting());
+
+  DummyObject popped;
+  for (size_t i = 0; i < 100; ++i) {
+    EXPECT_TRUE(q.Pop(&popped).pop_successful);
+    EXPECT_EQ(i, popped.id);
+  }
+  EXPECT_FALSE(q.Pop(&popped).pop_successful);
+  EXPECT_EQ(0u, q.GetSizeForTesting());
+  EXPECT_EQ(0u, q.GetCountForTesting());
+}
+
+TEST(MpscShardedQuarantineTest, ObjectIsPublishedOnUnlock) {
+  TestMpscShardedQuarantine q;
+  q.set_max_object_size(TestMpscShardedQuarantine::kUnboundedSize);
+  q.set_max_quarantine_size(0);
+
+  DummyObject d(10, 42);
+  DummyObject popped;
+  {
+    TestMpscShardedQuarantine::AutoQuarantineLock lock(&q, d);
+    EXPECT_TRUE(q.Push(d).push_successful);
+
+    // The object is accounted for, but can't be popped before the lock is
+    // released.
+    EXPECT_EQ(10u, q.GetSizeForTesting());
+    EXPECT_FALSE(q.Pop(&popped).pop_successful);
+  }
+
+  EXPECT_TRUE(q.Pop(&popped).pop_successful);
+  EXPECT_EQ(42u, popped.id);
+}
+
+TEST(MpscShardedQuarantineTest, RejectsLargeObjects) {
+  TestMpscShardedQuarantine q;
+  q.set_max_object_size(100);
+  q.set_max_quarantine_size(1000);
+
+  EXPECT_FALSE(q.LockAndPush(DummyObject(101, 0)));
+  EXPECT_EQ(0u, q.GetSizeForTesting());
+  EXPECT_EQ(0u, q.GetCountForTesting());
+
+  EXPECT_TRUE(q.LockAndPush(DummyObject(100, 0)));
+  EXPECT_EQ(100u, q.GetSizeForTesting());
+  EXPECT_EQ(1u, q.GetCountForTesting());
+}
+
+TEST(MpscShardedQuarantineTest, TrimStatus) {
+  TestMpscShardedQuarantine q;
+  q.set_max_object_size(TestMpscShardedQuarantine::kUnboundedSize);
+  q.set_max_quarantine_size(10000);
+  q.SetOverbudgetSize(2000);
+
+  // Fill the quarantine up to YELLOW.
+  for (size_t i = 0; i < 10; ++i) {
+    TestMpscShardedQuarantine::AutoQuarantineLock lock(&q, DummyObject());
+    PushResult result = q.Push(DummyObject(1000, i));
+    EXPECT_TRUE(result.push_successful);
+    EXPECT_EQ(TrimStatusBits::TRIM_NOT_REQUIRED, result.trim_status);
+  }
+
+  // Going into RED requires asynchronous trimming.
+  {
+    TestMpscShardedQuarantine::AutoQuarantineLock lock(&q, DummyObject());
+    PushResult result = q.Push(DummyObject(1000, 10));
+    EXPECT_TRUE(result.push_successful);
+    EXPECT_EQ(TrimStatusBits::ASYNC_TRIM_REQUIRED, result.trim_status);
+  }
+
+  // Going into BLACK requires synchronous trimming.
+  {
+    TestMpscShardedQuarantine::AutoQuarantineLock lock(&q, DummyObject());
+    PushResult result = q.Push(DummyObject(2000, 11));
+    EXPECT_TRUE(result.push_successful);
+    EXPECT_EQ(TrimStatusBits::SYNC_TRIM_REQUIRED, result.trim_status);
+  }
+
+  // Trimming stops once GREEN is reached.
+  DummyObject popped;
+  PopResult result = {};
+  do {
+    result = q.Pop(&popped);
+    EXPECT_TRUE(result.pop_successful);
+  } while (result.trim_color != TrimColor::GREEN);
+  EXPECT_FALSE(q.Pop(&popped).pop_successful);
+  EXPECT_GE(8000u, q.GetSizeForTesting());
+}
+
+TEST(MpscShardedQuarantineTest, Empty) {
+  TestMpscShardedQuarantine q;
+  q.set_max_object_size(TestMpscShardedQuarantine::kUnboundedSize);
+  q.set_max_quarantine_size(TestMpscShardedQuarantine::kUnboundedSize);
+
+  size_t total_size = 0;
+  for (size_t i = 0; i < 1000; ++i) {
+    EXPECT_TRUE(q.LockAndPush(DummyObject(i, i)));
+    total_size += i;
+  }
+  EXPECT_EQ(total_size, q.GetSizeForTesting());
+
+  // An unbounded quarantine never pops.
+  DummyObject popped;
+  EXPECT_FALSE(q.Pop(&popped).pop_successful);
+
+  TestMpscShardedQuarantine::ObjectVector os;
+  q.Empty(&os);
+  EXPECT_EQ(1000u, os.size());
+  EXPECT_EQ(0u, q.GetSizeForTesting());
+  EXPECT_EQ(0u, q.GetCountForTesting());
+  for (size_t i = 0; i < os.size(); ++i)
+    EXPECT_EQ(i, os[i].id);
+}
+
+TEST(MpscShardedQuarantineTest, ConcurrentProducers) {
+  const size_t kProducerCount = 8;
+  const size_t kPushCount = 20000;
+  TestMpscShardedQuarantine q;
+  q.set_max_object_size(TestMpscShardedQuarantine::kUnboundedSize);
+  q.set_max_quarantine_size(1000);
+
+  base::subtle::Atomic32 finished_producers = 0;
+  std::vector<std::unique_ptr<ProducerRunner>> runners;
+  std::vector<std::unique_ptr<base::DelegateSimpleThread>> threads;
+  for (size_t i = 0; i < kProducerCount; ++i) {
+    runners.push_back(std::unique_ptr<ProducerRunner>(
+        new ProducerRunner(&q, i, kPushCount, &finished_producers)));
+    threads.push_back(std::unique_ptr<base::DelegateSimpleThread>(
+        new base::DelegateSimpleThread(runners.back().get(),
+                                       "MpscQuarantineProducer")));
+    threads.back()->Start();
+  }
+
+  // Consume concurrently with the producers. The objects of a given producer
+  // must come out in the order in which they were pushed.
+  std::vector<size_t> next_rank(kProducerCount, 0);
+  size_t popped_count = 0;
+  DummyObject popped;
+  while (true) {
+    bool producers_done = base::subtle::Acquire_Load(&finished_producers) ==
+        static_cast<base::subtle::Atomic32>(kProducerCount);
+    if (!q.Pop(&popped).pop_successful) {
+      if (producers_done)
+        break;
+      ::SwitchToThread();
+      continue;
+    }
+    size_t producer = popped.id / kPushCount;
+    size_t rank = popped.id % kPushCount;
+    ASSERT_LT(producer, kProducerCount);
+    EXPECT_EQ(next_rank[producer], rank);
+    next_rank[producer] = rank + 1;
+    ++popped_count;
+  }
+  EXPECT_LT(0u, popped_count);
+
+  for (const auto& thread : threads)
+    thread->Join();
+
+  // Everything that wasn't popped is still in the quarantine.
+  TestMpscShardedQuarantine::ObjectVector os;
+  q.Empty(&os);
+  EXPECT_EQ(kProducerCount * kPushCount, popped_count + os.size());
+  EXPECT_EQ(0u, q.GetSizeForTesting());
+  EXPECT_EQ(0u, q.GetCountForTesting());
+  for (const auto& object : os) {
+    size_t producer = object.id / kPushCount;
+    size_t rank = object.id % kPushCount;
+    ASSERT_LT(producer, kProducerCount);
+    EXPECT_EQ(next_rank[producer], rank);
+    next_rank[producer] = rank + 1;
+  }
+}
+
+}  // namespace quarantines
+}  // namespace asan
+}  // namespace agent
@@ -194,7 +194,7 @@ class SizeLimitedQuarantineImpl : public QuarantineInterface<ObjectType> {
   // @returns the current size of the quarantine.
   // @note that this function could be racing with a push/pop operation and
   // return a stale value. It is only used in tests.
-  size_t GetSizeForTesting() {
+  virtual size_t GetSizeForTesting() {
     ScopedQuarantineSizeCountLock size_count_lock(size_count_);
     return size_count_.size();
   }
@@ -247,6 +247,13 @@ class SizeLimitedQuarantineImpl : public QuarantineInterface<ObjectType> {
   virtual void UnlockImpl(size_t id) = 0;
   // @}
 
+  // Determines the trimming required after a push, given the size of the
+  // quarantine before and after it.
+  // @param old_size The size of the quarantine before the push.
+  // @param new_size The size of the quarantine after the push.
+  // @returns the trim status to report to the caller of Push.
+  TrimStatus GetPushTrimStatus(size_t old_size, size_t new_size) const;
+
   // Parameters controlling the quarantine invariant.
   size_t max_object_size_;
   size_t max_quarantine_size_;
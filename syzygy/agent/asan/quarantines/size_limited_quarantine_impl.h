@@ -54,33 +54,7 @@ PushResult SizeLimitedQuarantineImpl<OT, SFT>::Push(const Object& object) {
     new_size = size_count_.Decrement(size, 1);
   }
 
-  // Note that because GetQuarantineColor can return the wrong color (see note
-  // in its implementation), this function might miss a transition to RED/BLACK
-  // which would result in not signaling the asynchronous thread (under
-  // signaling). This is a tradeoff for not having to lock the overbudget size.
-  // As for the synchronous trimming, unless the wrong color is returned forever
-  // (which would obviously be a bug), it will eventually be signaled when BLACK
-  // is returned (regardless of transition).
-  TrimColor new_color = GetQuarantineColor(new_size);
-  TrimColor old_color = GetQuarantineColor(old_size);
-
-  if (new_color == TrimColor::BLACK) {
-    // If the current color is BLACK, always request synchronous trimming. As
-    // stated above, this ensures that regardless of the transition, the
-    // quarantine will eventually get trimmed (no "run away" situation should be
-    // possible).
-    result.trim_status |= TrimStatusBits::SYNC_TRIM_REQUIRED;
-    if (old_color < TrimColor::RED) {
-      // If going from GREEN/YELLOW to BLACK, also schedule asynchronous
-      // trimming (this is by design to improve the performance).
-      result.trim_status |= TrimStatusBits::ASYNC_TRIM_REQUIRED;
-    }
-  } else if (new_color == TrimColor::RED) {
-    if (old_color < TrimColor::RED) {
-      // If going from GREEN/YELLOW to RED, schedule asynchronous trimming.
-      result.trim_status |= TrimStatusBits::ASYNC_TRIM_REQUIRED;
-    }
-  }
+  result.trim_status = GetPushTrimStatus(old_size, new_size);
   return result;
 }
 
@@ -165,6 +139,41 @@ void SizeLimitedQuarantineImpl<OT, SFT>::Unlock(size_t id) {
   UnlockImpl(id);
 }
 
+template <typename OT, typename SFT>
+TrimStatus SizeLimitedQuarantineImpl<OT, SFT>::GetPushTrimStatus(
+    size_t old_size, size_t new_size) const {
+  TrimStatus trim_status = TrimStatusBits::TRIM_NOT_REQUIRED;
+
+  // Note that because GetQuarantineColor can return the wrong color (see note
+  // in its implementation), this function might miss a transition to RED/BLACK
+  // which would result in not signaling the asynchronous thread (under
+  // signaling). This is a tradeoff for not having to lock the overbudget size.
+  // As for the synchronous trimming, unless the wrong color is returned forever
+  // (which would obviously be a bug), it will eventually be signaled when BLACK
+  // is returned (regardless of transition).
+  TrimColor new_color = GetQuarantineColor(new_size);
+  TrimColor old_color = GetQuarantineColor(old_size);
+
+  if (new_color == TrimColor::BLACK) {
+    // If the current color is BLACK, always request synchronous trimming. As
+    // stated above, this ensures that regardless of the transition, the
+    // quarantine will eventually get trimmed (no "run away" situation should be
+    // possible).
+    trim_status |= TrimStatusBits::SYNC_TRIM_REQUIRED;
+    if (old_color < TrimColor::RED) {
+      // If going from GREEN/YELLOW to BLACK, also schedule asynchronous
+      // trimming (this is by design to improve the performance).
+      trim_status |= TrimStatusBits::ASYNC_TRIM_REQUIRED;
+    }
+  } else if (new_color == TrimColor::RED) {
+    if (old_color < TrimColor::RED) {
+      // If going from GREEN/YELLOW to RED, schedule asynchronous trimming.
+      trim_status |= TrimStatusBits::ASYNC_TRIM_REQUIRED;
+    }
+  }
+  return trim_status;
+}
+
 template <typename OT, typename SFT>
 TrimColor SizeLimitedQuarantineImpl<OT, SFT>::GetQuarantineColor(
     size_t size) const {
@@ -543,6 +543,8 @@ void AsanRuntime::TearDown() {
     WindowsHeapAdapter::TearDown();
   TearDownHeapManager();
   TearDownStackCache();
+  // Stop watching the modules loaded by the process.
+  common::StackCapture::set_cache_stack_walks(false);
   TearDownLogger();
   TearDownMemoryNotifier();
   TearDownShadow();
@@ -798,7 +800,7 @@ void AsanRuntime::PropagateParams() {
   static_assert(sizeof(::common::AsanParameters) == 60,
                 "Must propagate parameters.");
 #endif
-  static_assert(::common::kAsanParametersVersion == 15,
+  static_assert(::common::kAsanParametersVersion == 18,
                 "Must update parameters version.");
 
   // Push the configured parameter values to the appropriate endpoints.
@@ -806,6 +808,8 @@ void AsanRuntime::PropagateParams() {
   StackCaptureCache::set_compression_reporting_period(params_.reporting_period);
   common::StackCapture::set_bottom_frames_to_skip(
       params_.bottom_frames_to_skip);
+  common::StackCapture::set_cache_stack_walks(
+      params_.enable_stack_walk_cache);
   stack_cache_->set_max_num_frames(params_.max_num_frames);
   // ignored_stack_ids is used locally by AsanRuntime.
   logger_->set_log_as_text(params_.log_as_text);
@@ -1007,6 +1011,12 @@ void AsanRuntime::AddThreadId(uint32_t thread_id) {
   thread_ids_.insert(thread_id);
 }
 
+void AsanRuntime::OnThreadExit() {
+  heap_manager_->FlushThreadMagazines();
+  stack_cache_->ReleaseThreadState();
+  common::StackCapture::ReleaseThreadCache();
+}
+
 bool AsanRuntime::ThreadIdIsValid(uint32_t thread_id) {
   base::AutoLock lock(thread_ids_lock_);
   return thread_ids_.find(thread_id) != thread_ids_.end();
@@ -158,6 +158,10 @@ class AsanRuntime {
   // @param thread_id The thread ID that has been observed.
   void AddThreadId(uint32_t thread_id);
 
+  // Releases the per-thread resources held on behalf of the calling thread.
+  // This is to be called when a thread exits.
+  void OnThreadExit();
+
   // Determines if a thread ID has already been seen.
   // @param thread_id The thread ID to be queried.
   // @returns true if a given thread ID is valid for this process.
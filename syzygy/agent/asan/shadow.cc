@@ -81,6 +81,10 @@ LONG NTAPI ShadowExceptionHandler(PEXCEPTION_POINTERS exception_pointers) {
 
 static const size_t kPageSize = GetPageSize();
 
+// Ranges of shadow bytes shorter than this are scanned inline rather than with
+// the shadow kernels.
+static const size_t kMinShadowKernelsLength = 64;
+
 // Converts an address to a page index and bit mask.
 inline void AddressToPageMask(const void* address,
                               size_t* index,
@@ -371,66 +375,6 @@ void Shadow::Unpoison(const void* addr, size_t size) {
     shadow_[index + size] = remainder;
 }
 
-namespace {
-
-static const uint8_t kFreedMarker8 = kHeapFreedMarker;
-static const uint16_t kFreedMarker16 =
-    (static_cast<const uint16_t>(kFreedMarker8) << 8) | kFreedMarker8;
-static const uint32_t kFreedMarker32 =
-    (static_cast<const uint32_t>(kFreedMarker16) << 16) | kFreedMarker16;
-static const uint64_t kFreedMarker64 =
-    (static_cast<const uint64_t>(kFreedMarker32) << 32) | kFreedMarker32;
-
-// Marks the given range of shadow bytes as freed, preserving left and right
-// redzone bytes.
-inline void MarkAsFreedImpl8(uint8_t* cursor, uint8_t* cursor_end) {
-  for (; cursor != cursor_end; ++cursor) {
-    // Preserve block beginnings/ends/redzones as they were originally.
-    // This is necessary to preserve information about nested blocks.
-    if (ShadowMarkerHelper::IsActiveLeftRedzone(*cursor) ||
-        ShadowMarkerHelper::IsActiveRightRedzone(*cursor)) {
-      continue;
-    }
-
-    // Anything else gets marked as freed.
-    *cursor = kHeapFreedMarker;
-  }
-}
-
-// Marks the given range of shadow bytes as freed, preserving left and right
-// redzone bytes. |cursor| and |cursor_end| must be 8-byte aligned.
-inline void MarkAsFreedImplAligned64(uint64_t* cursor, uint64_t* cursor_end) {
-  DCHECK(::common::IsAligned(cursor, sizeof(uint64_t)));
-  DCHECK(::common::IsAligned(cursor_end, sizeof(uint64_t)));
-
-  for (; cursor != cursor_end; ++cursor) {
-    // If the block of shadow memory is entirely green then mark as freed.
-    // Otherwise go check its contents byte by byte.
-    if (*cursor == 0) {
-      *cursor = kFreedMarker64;
-    } else {
-      MarkAsFreedImpl8(reinterpret_cast<uint8_t*>(cursor),
-                       reinterpret_cast<uint8_t*>(cursor + 1));
-    }
-  }
-}
-
-inline void MarkAsFreedImpl64(uint8_t* cursor, uint8_t* cursor_end) {
-  if (cursor_end - cursor >= 2 * sizeof(uint64_t)) {
-    uint8_t* cursor_aligned = ::common::AlignUp(cursor, sizeof(uint64_t));
-    uint8_t* cursor_end_aligned =
-        ::common::AlignDown(cursor_end, sizeof(uint64_t));
-    MarkAsFreedImpl8(cursor, cursor_aligned);
-    MarkAsFreedImplAligned64(reinterpret_cast<uint64_t*>(cursor_aligned),
-                             reinterpret_cast<uint64_t*>(cursor_end_aligned));
-    MarkAsFreedImpl8(cursor_end_aligned, cursor_end);
-  } else {
-    MarkAsFreedImpl8(cursor, cursor_end);
-  }
-}
-
-}  // namespace
-
 void Shadow::MarkAsFreed(const void* addr, size_t size) {
   DCHECK_LE(kAddressLowerBound, reinterpret_cast<uintptr_t>(addr));
   DCHECK(::common::IsAligned(addr, kShadowRatio));
@@ -447,7 +391,7 @@ void Shadow::MarkAsFreed(const void* addr, size_t size) {
 
   // This isn't as simple as a memset because we need to preserve left and
   // right redzone padding bytes that may be found in the range.
-  MarkAsFreedImpl64(cursor, cursor_end);
+  GetShadowKernels().mark_as_freed(cursor, cursor_end);
 }
 
 bool Shadow::IsAccessible(const void* addr) const {
@@ -504,8 +448,13 @@ bool Shadow::IsRangeAccessible(const void* addr, size_t size) const {
 
   // Now run over the shadow bytes from start to end, which all need to be
   // zero.
-  if (!internal::IsZeroBufferImpl<uint64_t>(&shadow_[start], &shadow_[end]))
+  if (end - start < kMinShadowKernelsLength) {
+    if (!internal::IsZeroBufferImpl<uint64_t>(&shadow_[start], &shadow_[end]))
       return false;
+  } else if (GetShadowKernels().find_non_zero(&shadow_[start],
+                                              &shadow_[end]) != &shadow_[end]) {
+    return false;
+  }
 
   // Finally test the end point if there's a tail offset.
   if (end_offs == 0U)
@@ -560,12 +509,21 @@ const void* Shadow::FindFirstPoisonedByte(const void* addr, size_t size) const {
   if (end > length_)
     return out_addr;
 
-  for (size_t curr = start; curr < end; ++curr, out_addr += kShadowRatio) {
-    shadow = shadow_[curr];
+  // Skip over the accessible shadow bytes, and check the first one that
+  // isn't.
+  const uint8_t* curr = &shadow_[start];
+  if (end - start < kMinShadowKernelsLength) {
+    while (curr < &shadow_[end] && *curr == 0)
+      ++curr;
+  } else {
+    curr = GetShadowKernels().find_non_zero(curr, &shadow_[end]);
+  }
+  out_addr += (curr - &shadow_[start]) * kShadowRatio;
+  if (curr < &shadow_[end]) {
+    shadow = *curr;
     if (ShadowMarkerHelper::IsRedzone(shadow))
       return out_addr;
-    if (shadow != 0)
-      return out_addr + shadow;
+    return out_addr + shadow;
   }
 
   // Finally test the end point if there's a tail offset.
@@ -867,137 +825,55 @@ bool Shadow::ScanLeftForBracketingBlockStart(size_t cursor,
 
   static const size_t kLowerBound = kAddressLowerBound / kShadowRatio;
 
-  size_t left = cursor;
+  const ShadowKernels& kernels = GetShadowKernels();
+  const uint8_t* lower_bound = shadow_ + std::min(cursor, kLowerBound);
+  const uint8_t* end = shadow_ + cursor + 1;
 
 #ifdef _WIN64
   // In 64-bit we don't commit the full shadow address space, so we need to
-  // skip over the uncommitted ranges.
-  MEMORY_BASIC_INFORMATION memory_info = {};
-  SIZE_T ret =
-      ::VirtualQuery(&shadow_[left], &memory_info, sizeof(memory_info));
-  DCHECK_GT(ret, 0u);
-  if (memory_info.State != MEM_COMMIT)
-    return false;
-#endif
-
+  // skip over the uncommitted ranges. Each committed range is scanned at once.
   while (true) {
-#ifdef _WIN64
-    if (&shadow_[left] < static_cast<const uint8_t*>(memory_info.BaseAddress)) {
-      ret = ::VirtualQuery(&shadow_[left], &memory_info, sizeof(memory_info));
-      DCHECK_GT(ret, 0u);
-      if (memory_info.State != MEM_COMMIT)
-        return false;
-    }
-#endif
-    if (ShadowMarkerHelper::IsBlockStart(shadow_[left])) {
-      *location = left;
-      return true;
-    }
-    if (left <= kLowerBound)
+    MEMORY_BASIC_INFORMATION memory_info = {};
+    SIZE_T ret = ::VirtualQuery(end - 1, &memory_info, sizeof(memory_info));
+    DCHECK_GT(ret, 0u);
+    if (memory_info.State != MEM_COMMIT)
       return false;
-    --left;
-  }
 
-  NOTREACHED();
-}
-
-namespace {
-
-// This handles an unaligned input cursor. It can potentially read up to 7
-// bytes past the end of the cursor, but only up to an 8 byte boundary. Thus
-// this out of bounds access is safe.
-inline const uint8_t* ScanRightForPotentialHeaderBytes(const uint8_t* pos,
-                                                       const uint8_t* end) {
-  DCHECK(::common::IsAligned(end, 8));
-
-  // Handle the first few bytes that aren't aligned. If pos == end then
-  // it is already 8-byte aligned and we'll simply fall through to the end.
-  // This is a kind of Duffy's device that takes bytes 'as large as possible'
-  // until we reach an 8 byte alignment.
-  switch (reinterpret_cast<uintptr_t>(pos) & 0x7) {
-    case 1:
-      if (*pos != 0 && *pos != kFreedMarker8)
-        return pos;
-      pos += 1;
-    case 2:
-      if (*reinterpret_cast<const uint16_t*>(pos) != 0 &&
-          *reinterpret_cast<const uint16_t*>(pos) != kFreedMarker16) {
-        return pos;
-      }
-      pos += 2;
-    case 4:
-      if (*reinterpret_cast<const uint32_t*>(pos) != 0 &&
-          *reinterpret_cast<const uint32_t*>(pos) != kFreedMarker32) {
-        return pos;
-      }
-      pos += 4;
-      break;
-
-    case 3:
-      if (*pos != 0 && *pos != kFreedMarker8)
-        return pos;
-      pos += 1;
-      // Now have alignment of 4.
-      if (*reinterpret_cast<const uint32_t*>(pos) != 0 &&
-          *reinterpret_cast<const uint32_t*>(pos) != kFreedMarker32) {
-        return pos;
-      }
-      pos += 4;
-      break;
-
-    case 5:
-      if (*pos != 0 && *pos != kFreedMarker8)
-        return pos;
-      pos += 1;
-    case 6:
-      if (*reinterpret_cast<const uint16_t*>(pos) != 0 &&
-          *reinterpret_cast<const uint16_t*>(pos) != kFreedMarker16) {
-        return pos;
-      }
-      pos += 2;
-      break;
-
-    case 7:
-      if (*pos != 0 && *pos != kFreedMarker8)
-        return pos;
-      pos += 1;
-
-    case 0:
-    default:
-      // Do nothing, as we're already 8 byte aligned.
-      break;
-  }
-
-  // Handle the 8-byte aligned bytes as much as we can.
-  while (pos < end) {
-    if (*reinterpret_cast<const uint64_t*>(pos) != 0 &&
-        *reinterpret_cast<const uint64_t*>(pos) != kFreedMarker64) {
-      return pos;
+    const uint8_t* begin = std::max(
+        static_cast<const uint8_t*>(memory_info.BaseAddress), lower_bound);
+    const uint8_t* block_start = kernels.find_last_block_start(begin, end);
+    if (block_start != nullptr) {
+      *location = block_start - shadow_;
+      return true;
     }
-    pos += 8;
+    if (begin == lower_bound)
+      return false;
+    end = begin;
   }
-
-  return pos;
+#else
+  const uint8_t* block_start = kernels.find_last_block_start(lower_bound, end);
+  if (block_start == nullptr)
+    return false;
+  *location = block_start - shadow_;
+  return true;
+#endif
 }
 
-}  // namespace
-
 bool Shadow::ScanRightForBracketingBlockEnd(size_t cursor,
                                             size_t* location) const {
   DCHECK_NE(static_cast<size_t*>(NULL), location);
 
+  const ShadowKernels& kernels = GetShadowKernels();
   const uint8_t* shadow_end = shadow_ + length_;
   const uint8_t* pos = shadow_ + cursor;
   while (pos < shadow_end) {
     // Skips past as many addressable and freed bytes as possible.
-    pos = ScanRightForPotentialHeaderBytes(pos, shadow_end);
+    pos = kernels.find_non_zero_or_freed(pos, shadow_end);
     if (pos == shadow_end)
       return false;
 
-    // When the above loop exits early then somewhere in the next 8 bytes
-    // there's non-addressable data that isn't 'freed'. Look byte by byte to
-    // see what's up.
-
+    // When the above scan stops there's non-addressable data that isn't
+    // 'freed'. Check if it's the end of a block.
     if (ShadowMarkerHelper::IsBlockEnd(*pos)) {
       *location = pos - shadow_;
       return true;
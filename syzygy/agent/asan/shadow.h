@@ -67,6 +67,7 @@
 #include "base/synchronization/lock.h"
 #include "syzygy/agent/asan/block.h"
 #include "syzygy/agent/asan/constants.h"
+#include "syzygy/agent/asan/shadow_kernels.h"
 #include "syzygy/agent/asan/shadow_marker.h"
 
 namespace agent {
@@ -18,44 +18,6 @@
 #ifndef SYZYGY_AGENT_ASAN_SHADOW_IMPL_H_
 #define SYZYGY_AGENT_ASAN_SHADOW_IMPL_H_
 
-template <typename type>
-bool Shadow::GetNullTerminatedArraySize(const void* addr,
-                                        size_t max_size,
-                                        size_t* size) const {
-  DCHECK_NE(reinterpret_cast<const void*>(NULL), addr);
-  DCHECK_NE(reinterpret_cast<size_t*>(NULL), size);
-
-  uintptr_t index = reinterpret_cast<uintptr_t>(addr);
-  const type* addr_value = reinterpret_cast<const type*>(addr);
-  index >>= 3;
-  *size = 0;
-
-  if (index > length_)
-    return false;
-
-  // Scan the input array 8 bytes at a time until we've found a NULL value or
-  // we've reached the end of an accessible memory block.
-  // TODO(sebmarchand): Look into doing this more efficiently.
-  while (true) {
-    uint8_t shadow = shadow_[index++];
-    if (ShadowMarkerHelper::IsRedzone(shadow))
-      return false;
-
-    uint8_t max_index = shadow ? shadow : kShadowRatio;
-    DCHECK_EQ(0U, max_index % sizeof(type));
-    max_index /= sizeof(type);
-    while (max_index-- > 0) {
-      (*size) += sizeof(type);
-      if (*size == max_size || *addr_value == 0)
-        return true;
-      addr_value++;
-    }
-
-    if (shadow != 0)
-      return false;
-  }
-}
-
 namespace internal {
 
 template <typename AccessType>
@@ -119,4 +81,86 @@ bool IsZeroBufferImpl(const uint8_t* start_in, const uint8_t* end_in) {
 
 }  // namespace internal
 
+template <typename type>
+bool Shadow::GetNullTerminatedArraySize(const void* addr,
+                                        size_t max_size,
+                                        size_t* size) const {
+  DCHECK_NE(reinterpret_cast<const void*>(NULL), addr);
+  DCHECK_NE(reinterpret_cast<size_t*>(NULL), size);
+
+  uintptr_t index = reinterpret_cast<uintptr_t>(addr);
+  const type* addr_value = reinterpret_cast<const type*>(addr);
+  index >>= 3;
+  *size = 0;
+
+  if (index > length_)
+    return false;
+
+  // Arrays of 8-bit and 16-bit values that are aligned on the shadow ratio are
+  // first scanned a chunk at a time with the shadow kernels, for as long as the
+  // chunks are entirely accessible. As untracked memory also has a zero shadow
+  // a chunk may extend into an inaccessible page, which is fine as the kernels
+  // never read across a page boundary past the first null value.
+  static const size_t kChunkLength = 64;  // In shadow bytes.
+  static_assert(
+      (kChunkLength * kShadowRatio) % kShadowKernelsNullScanGranularity == 0,
+      "Invalid chunk length.");
+  ShadowKernels::FindFunction find_null = nullptr;
+  if (::common::IsAligned(addr, kShadowRatio)) {
+    if (sizeof(type) == 1)
+      find_null = GetShadowKernels().find_null8;
+    else if (sizeof(type) == 2)
+      find_null = GetShadowKernels().find_null16;
+  }
+
+  // Scan the input array 8 bytes at a time until we've found a NULL value or
+  // we've reached the end of an accessible memory block.
+  while (true) {
+    if (find_null != nullptr) {
+      const uint8_t* chunk_shadow = shadow_ + index;
+      if (index + kChunkLength <= length_ &&
+          internal::IsZeroBufferImpl<uint64_t>(chunk_shadow,
+                                               chunk_shadow + kChunkLength)) {
+        const uint8_t* chunk = reinterpret_cast<const uint8_t*>(addr_value);
+        const uint8_t* chunk_end = chunk + kChunkLength * kShadowRatio;
+        const uint8_t* null_value = find_null(chunk, chunk_end);
+        size_t chunk_size = chunk_end - chunk;
+        if (null_value != chunk_end)
+          chunk_size = null_value - chunk + sizeof(type);
+
+        // Let the slow path find where the scan stops if it's due to
+        // |max_size|.
+        if (max_size == 0 || *size + chunk_size < max_size) {
+          *size += chunk_size;
+          if (null_value != chunk_end)
+            return true;
+          addr_value = reinterpret_cast<const type*>(chunk_end);
+          index += kChunkLength;
+          continue;
+        }
+      }
+
+      // Scan the rest of the array 8 bytes at a time.
+      find_null = nullptr;
+    }
+
+    uint8_t shadow = shadow_[index++];
+    if (ShadowMarkerHelper::IsRedzone(shadow))
+      return false;
+
+    uint8_t max_index = shadow ? shadow : kShadowRatio;
+    DCHECK_EQ(0U, max_index % sizeof(type));
+    max_index /= sizeof(type);
+    while (max_index-- > 0) {
+      (*size) += sizeof(type);
+      if (*size == max_size || *addr_value == 0)
+        return true;
+      addr_value++;
+    }
+
+    if (shadow != 0)
+      return false;
+  }
+}
+
 #endif  // SYZYGY_AGENT_ASAN_SHADOW_IMPL_H_
@@ -0,0 +1,504 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/agent/asan/shadow_kernels.h"
+
+#include <emmintrin.h>
+#include <immintrin.h>
+#include <intrin.h>
+
+#include "base/atomicops.h"
+#include "base/logging.h"
+#include "syzygy/agent/asan/shadow_marker.h"
+
+namespace agent {
+namespace asan {
+
+namespace {
+
+// The vectorized kernels mirror these ShadowMarkerHelper predicates:
+// - IsBlockStart: (marker & kBlockStartMask) == kBlockStartValue.
+// - IsActiveBlockStart: (marker & kFirstNibble) == kHeapBlockStartMarker0.
+static const uint8_t kBlockStartMask = 0xD0;
+static const uint8_t kBlockStartValue = kHeapHistoricBlockStartMarker0;
+static const uint8_t kFirstNibble = 0xF0;
+
+// @returns @p pointer rounded down to a multiple of @p kAlignment.
+template <size_t kAlignment, typename T>
+__forceinline T* AlignDown(T* pointer) {
+  return reinterpret_cast<T*>(reinterpret_cast<uintptr_t>(pointer) &
+                              ~(kAlignment - 1));
+}
+
+// @returns @p pointer rounded up to a multiple of @p kAlignment.
+template <size_t kAlignment, typename T>
+__forceinline T* AlignUp(T* pointer) {
+  return AlignDown<kAlignment>(reinterpret_cast<T*>(
+      reinterpret_cast<uintptr_t>(pointer) + kAlignment - 1));
+}
+
+__forceinline size_t FindLowestBit(uint32_t mask) {
+  DCHECK_NE(0u, mask);
+  unsigned long index = 0;
+  _BitScanForward(&index, mask);
+  return index;
+}
+
+__forceinline size_t FindHighestBit(uint32_t mask) {
+  DCHECK_NE(0u, mask);
+  unsigned long index = 0;
+  _BitScanReverse(&index, mask);
+  return index;
+}
+
+// @name The instruction sets used by the vectorized kernels.
+// @{
+struct Sse2 {
+  typedef __m128i Vector;
+  static const size_t kSize = 16;
+  static const uint32_t kFullMask = 0xFFFF;
+
+  static __forceinline Vector Load(const uint8_t* p) {
+    return _mm_load_si128(reinterpret_cast<const Vector*>(p));
+  }
+  static __forceinline void Store(uint8_t* p, const Vector& v) {
+    _mm_store_si128(reinterpret_cast<Vector*>(p), v);
+  }
+  static __forceinline Vector Set(uint8_t value) {
+    return _mm_set1_epi8(static_cast<char>(value));
+  }
+  static __forceinline Vector Zero() { return _mm_setzero_si128(); }
+  static __forceinline Vector CmpEq8(const Vector& a, const Vector& b) {
+    return _mm_cmpeq_epi8(a, b);
+  }
+  static __forceinline Vector CmpEq16(const Vector& a, const Vector& b) {
+    return _mm_cmpeq_epi16(a, b);
+  }
+  static __forceinline Vector And(const Vector& a, const Vector& b) {
+    return _mm_and_si128(a, b);
+  }
+  // Returns ~a & b.
+  static __forceinline Vector AndNot(const Vector& a, const Vector& b) {
+    return _mm_andnot_si128(a, b);
+  }
+  static __forceinline Vector Or(const Vector& a, const Vector& b) {
+    return _mm_or_si128(a, b);
+  }
+  static __forceinline uint32_t MoveMask(const Vector& v) {
+    return static_cast<uint32_t>(_mm_movemask_epi8(v));
+  }
+  static __forceinline void Cleanup() {}
+};
+
+struct Avx2 {
+  typedef __m256i Vector;
+  static const size_t kSize = 32;
+  static const uint32_t kFullMask = 0xFFFFFFFF;
+
+  static __forceinline Vector Load(const uint8_t* p) {
+    return _mm256_load_si256(reinterpret_cast<const Vector*>(p));
+  }
+  static __forceinline void Store(uint8_t* p, const Vector& v) {
+    _mm256_store_si256(reinterpret_cast<Vector*>(p), v);
+  }
+  static __forceinline Vector Set(uint8_t value) {
+    return _mm256_set1_epi8(static_cast<char>(value));
+  }
+  static __forceinline Vector Zero() { return _mm256_setzero_si256(); }
+  static __forceinline Vector CmpEq8(const Vector& a, const Vector& b) {
+    return _mm256_cmpeq_epi8(a, b);
+  }
+  static __forceinline Vector CmpEq16(const Vector& a, const Vector& b) {
+    return _mm256_cmpeq_epi16(a, b);
+  }
+  static __forceinline Vector And(const Vector& a, const Vector& b) {
+    return _mm256_and_si256(a, b);
+  }
+  // Returns ~a & b.
+  static __forceinline Vector AndNot(const Vector& a, const Vector& b) {
+    return _mm256_andnot_si256(a, b);
+  }
+  static __forceinline Vector Or(const Vector& a, const Vector& b) {
+    return _mm256_or_si256(a, b);
+  }
+  static __forceinline uint32_t MoveMask(const Vector& v) {
+    return static_cast<uint32_t>(_mm256_movemask_epi8(v));
+  }
+  // Avoids the penalty of transitioning to SSE code with dirty upper halves
+  // of the YMM registers.
+  static __forceinline void Cleanup() { _mm256_zeroupper(); }
+};
+// @}
+
+// @name The byte predicates used by the find kernels. Each one has a scalar
+//     version, and a vectorized version returning a bit mask of the matching
+//     bytes of a vector.
+// @{
+struct NonZeroMatcher {
+  static __forceinline bool Matches(uint8_t value) { return value != 0; }
+
+  template <typename Isa>
+  static __forceinline uint32_t Match(const typename Isa::Vector& v) {
+    return Isa::MoveMask(Isa::CmpEq8(v, Isa::Zero())) ^ Isa::kFullMask;
+  }
+};
+
+struct NonZeroOrFreedMatcher {
+  static __forceinline bool Matches(uint8_t value) {
+    return value != 0 && value != kHeapFreedMarker;
+  }
+
+  template <typename Isa>
+  static __forceinline uint32_t Match(const typename Isa::Vector& v) {
+    typename Isa::Vector skipped =
+        Isa::Or(Isa::CmpEq8(v, Isa::Zero()),
+                Isa::CmpEq8(v, Isa::Set(kHeapFreedMarker)));
+    return Isa::MoveMask(skipped) ^ Isa::kFullMask;
+  }
+};
+
+struct BlockStartMatcher {
+  static __forceinline bool Matches(uint8_t value) {
+    return ShadowMarkerHelper::IsBlockStart(value);
+  }
+
+  template <typename Isa>
+  static __forceinline uint32_t Match(const typename Isa::Vector& v) {
+    return Isa::MoveMask(Isa::CmpEq8(Isa::And(v, Isa::Set(kBlockStartMask)),
+                                     Isa::Set(kBlockStartValue)));
+  }
+};
+// @}
+
+// @name Scalar kernels.
+// @{
+template <typename Matcher>
+const uint8_t* FindFirstScalar(const uint8_t* begin, const uint8_t* end) {
+  for (; begin < end; ++begin) {
+    if (Matcher::Matches(*begin))
+      return begin;
+  }
+  return end;
+}
+
+template <typename Matcher>
+const uint8_t* FindLastScalar(const uint8_t* begin, const uint8_t* end) {
+  while (end > begin) {
+    --end;
+    if (Matcher::Matches(*end))
+      return end;
+  }
+  return nullptr;
+}
+
+static const uint8_t kFreedMarker8 = kHeapFreedMarker;
+static const uint16_t kFreedMarker16 =
+    (static_cast<const uint16_t>(kFreedMarker8) << 8) | kFreedMarker8;
+static const uint32_t kFreedMarker32 =
+    (static_cast<const uint32_t>(kFreedMarker16) << 16) | kFreedMarker16;
+static const uint64_t kFreedMarker64 =
+    (static_cast<const uint64_t>(kFreedMarker32) << 32) | kFreedMarker32;
+
+// Marks the given range of shadow bytes as freed, preserving left and right
+// redzone bytes.
+inline void MarkAsFreedImpl8(uint8_t* cursor, uint8_t* cursor_end) {
+  for (; cursor < cursor_end; ++cursor) {
+    // Preserve block beginnings/ends/redzones as they were originally.
+    // This is necessary to preserve information about nested blocks.
+    if (ShadowMarkerHelper::IsActiveLeftRedzone(*cursor) ||
+        ShadowMarkerHelper::IsActiveRightRedzone(*cursor)) {
+      continue;
+    }
+
+    // Anything else gets marked as freed.
+    *cursor = kHeapFreedMarker;
+  }
+}
+
+// Marks the given range of shadow bytes as freed, preserving left and right
+// redzone bytes. |cursor| and |cursor_end| must be 8-byte aligned.
+inline void MarkAsFreedImplAligned64(uint64_t* cursor, uint64_t* cursor_end) {
+  DCHECK_EQ(0u, reinterpret_cast<uintptr_t>(cursor) % sizeof(uint64_t));
+  DCHECK_EQ(0u, reinterpret_cast<uintptr_t>(cursor_end) % sizeof(uint64_t));
+
+  for (; cursor != cursor_end; ++cursor) {
+    // If the block of shadow memory is entirely green then mark as freed.
+    // Otherwise go check its contents byte by byte.
+    if (*cursor == 0) {
+      *cursor = kFreedMarker64;
+    } else {
+      MarkAsFreedImpl8(reinterpret_cast<uint8_t*>(cursor),
+                       reinterpret_cast<uint8_t*>(cursor + 1));
+    }
+  }
+}
+
+void MarkAsFreedScalar(uint8_t* cursor, uint8_t* cursor_end) {
+  if (cursor_end - cursor >= 2 * sizeof(uint64_t)) {
+    uint8_t* cursor_aligned = AlignUp<sizeof(uint64_t)>(cursor);
+    uint8_t* cursor_end_aligned = AlignDown<sizeof(uint64_t)>(cursor_end);
+    MarkAsFreedImpl8(cursor, cursor_aligned);
+    MarkAsFreedImplAligned64(reinterpret_cast<uint64_t*>(cursor_aligned),
+                             reinterpret_cast<uint64_t*>(cursor_end_aligned));
+    MarkAsFreedImpl8(cursor_end_aligned, cursor_end);
+  } else {
+    MarkAsFreedImpl8(cursor, cursor_end);
+  }
+}
+
+template <typename ElementType>
+const uint8_t* FindNullImpl(const uint8_t* begin, const uint8_t* end) {
+  const ElementType* element = reinterpret_cast<const ElementType*>(begin);
+  const ElementType* element_end = reinterpret_cast<const ElementType*>(end);
+  for (; element < element_end; ++element) {
+    if (*element == 0)
+      return reinterpret_cast<const uint8_t*>(element);
+  }
+  return end;
+}
+
+template <typename ElementType>
+const uint8_t* FindNullScalar(const uint8_t* begin, const uint8_t* end) {
+  DCHECK_EQ(0u, (end - begin) % kShadowKernelsNullScanGranularity);
+  return FindNullImpl<ElementType>(begin, end);
+}
+// @}
+
+// @name Vectorized kernels. These use aligned loads, which never cross a page
+//     boundary.
+// @{
+template <typename Isa, typename Matcher>
+const uint8_t* FindFirstVector(const uint8_t* begin, const uint8_t* end) {
+  if (begin >= end)
+    return end;
+
+  // Ignore the bytes of the first vector that precede the range.
+  const uint8_t* block = AlignDown<Isa::kSize>(begin);
+  uint32_t mask = Matcher::template Match<Isa>(Isa::Load(block));
+  mask &= Isa::kFullMask << (begin - block);
+
+  while (mask == 0) {
+    block += Isa::kSize;
+    if (block >= end) {
+      Isa::Cleanup();
+      return end;
+    }
+    mask = Matcher::template Match<Isa>(Isa::Load(block));
+  }
+  Isa::Cleanup();
+
+  // The match may be in the bytes of the last vector that follow the range.
+  const uint8_t* found = block + FindLowestBit(mask);
+  return found < end ? found : end;
+}
+
+template <typename Isa, typename Matcher>
+const uint8_t* FindLastVector(const uint8_t* begin, const uint8_t* end) {
+  if (begin >= end)
+    return nullptr;
+
+  // Ignore the bytes of the last vector that follow the range.
+  const uint8_t* block = AlignDown<Isa::kSize>(end - 1);
+  uint32_t mask = Matcher::template Match<Isa>(Isa::Load(block));
+  mask &= Isa::kFullMask >> (Isa::kSize - 1 - (end - 1 - block));
+
+  while (mask == 0) {
+    if (block <= begin) {
+      Isa::Cleanup();
+      return nullptr;
+    }
+    block -= Isa::kSize;
+    mask = Matcher::template Match<Isa>(Isa::Load(block));
+  }
+  Isa::Cleanup();
+
+  // The match may be in the bytes of the first vector that precede the range.
+  const uint8_t* found = block + FindHighestBit(mask);
+  return found >= begin ? found : nullptr;
+}
+
+template <typename Isa>
+void MarkAsFreedVector(uint8_t* begin, uint8_t* end) {
+  uint8_t* aligned_begin = AlignUp<Isa::kSize>(begin);
+  uint8_t* aligned_end = AlignDown<Isa::kSize>(end);
+  if (aligned_begin >= aligned_end) {
+    MarkAsFreedScalar(begin, end);
+    return;
+  }
+
+  MarkAsFreedImpl8(begin, aligned_begin);
+
+  const typename Isa::Vector left_padding = Isa::Set(kHeapLeftPaddingMarker);
+  const typename Isa::Vector right_padding = Isa::Set(kHeapRightPaddingMarker);
+  const typename Isa::Vector block_end = Isa::Set(kHeapBlockEndMarker);
+  const typename Isa::Vector first_nibble = Isa::Set(kFirstNibble);
+  const typename Isa::Vector block_start = Isa::Set(kHeapBlockStartMarker0);
+  const typename Isa::Vector freed = Isa::Set(kHeapFreedMarker);
+  for (uint8_t* cursor = aligned_begin; cursor < aligned_end;
+       cursor += Isa::kSize) {
+    typename Isa::Vector v = Isa::Load(cursor);
+
+    // Preserve the active left and right redzone bytes, and mark anything
+    // else as freed.
+    typename Isa::Vector preserved = Isa::Or(
+        Isa::Or(Isa::CmpEq8(v, left_padding), Isa::CmpEq8(v, right_padding)),
+        Isa::Or(Isa::CmpEq8(v, block_end),
+                Isa::CmpEq8(Isa::And(v, first_nibble), block_start)));
+    Isa::Store(cursor, Isa::Or(Isa::And(preserved, v),
+                               Isa::AndNot(preserved, freed)));
+  }
+  Isa::Cleanup();
+
+  MarkAsFreedImpl8(aligned_end, end);
+}
+
+template <typename Isa>
+__forceinline typename Isa::Vector CmpEq(const typename Isa::Vector& a,
+                                         const typename Isa::Vector& b,
+                                         uint8_t) {
+  return Isa::CmpEq8(a, b);
+}
+
+template <typename Isa>
+__forceinline typename Isa::Vector CmpEq(const typename Isa::Vector& a,
+                                         const typename Isa::Vector& b,
+                                         uint16_t) {
+  return Isa::CmpEq16(a, b);
+}
+
+template <typename Isa, typename ElementType>
+const uint8_t* FindNullVector(const uint8_t* begin, const uint8_t* end) {
+  DCHECK_EQ(0u, (end - begin) % kShadowKernelsNullScanGranularity);
+  DCHECK_EQ(0u, reinterpret_cast<uintptr_t>(begin) % sizeof(ElementType));
+
+  // These must not read outside of the range, as it may be followed by an
+  // inaccessible page. The unaligned head and tail are scanned one element at
+  // a time.
+  const uint8_t* aligned_begin = AlignUp<Isa::kSize>(begin);
+  const uint8_t* aligned_end = AlignDown<Isa::kSize>(end);
+  if (aligned_begin >= aligned_end)
+    return FindNullImpl<ElementType>(begin, end);
+
+  const uint8_t* found = FindNullImpl<ElementType>(begin, aligned_begin);
+  if (found != aligned_begin)
+    return found;
+
+  const typename Isa::Vector zero = Isa::Zero();
+  for (const uint8_t* cursor = aligned_begin; cursor < aligned_end;
+       cursor += Isa::kSize) {
+    uint32_t mask = Isa::MoveMask(
+        CmpEq<Isa>(Isa::Load(cursor), zero, ElementType()));
+    if (mask != 0) {
+      Isa::Cleanup();
+      return cursor + FindLowestBit(mask);
+    }
+  }
+  Isa::Cleanup();
+
+  return FindNullImpl<ElementType>(aligned_end, end);
+}
+// @}
+
+const ShadowKernels kScalarKernels = {
+  &FindFirstScalar<NonZeroMatcher>,
+  &FindFirstScalar<NonZeroOrFreedMatcher>,
+  &FindLastScalar<BlockStartMatcher>,
+  &MarkAsFreedScalar,
+  &FindNullScalar<uint8_t>,
+  &FindNullScalar<uint16_t>,
+};
+
+const ShadowKernels kSse2Kernels = {
+  &FindFirstVector<Sse2, NonZeroMatcher>,
+  &FindFirstVector<Sse2, NonZeroOrFreedMatcher>,
+  &FindLastVector<Sse2, BlockStartMatcher>,
+  &MarkAsFreedVector<Sse2>,
+  &FindNullVector<Sse2, uint8_t>,
+  &FindNullVector<Sse2, uint16_t>,
+};
+
+const ShadowKernels kAvx2Kernels = {
+  &FindFirstVector<Avx2, NonZeroMatcher>,
+  &FindFirstVector<Avx2, NonZeroOrFreedMatcher>,
+  &FindLastVector<Avx2, BlockStartMatcher>,
+  &MarkAsFreedVector<Avx2>,
+  &FindNullVector<Avx2, uint8_t>,
+  &FindNullVector<Avx2, uint16_t>,
+};
+
+const ShadowKernels* const kKernels[kShadowKernelsLevelMax] = {
+  &kScalarKernels,
+  &kSse2Kernels,
+  &kAvx2Kernels,
+};
+
+bool CpuSupportsSse2() {
+  int info[4] = {};
+  ::__cpuid(info, 1);
+  return (info[3] & (1 << 26)) != 0;
+}
+
+bool CpuSupportsAvx2() {
+  int info[4] = {};
+  ::__cpuid(info, 0);
+  if (info[0] < 7)
+    return false;
+
+  // The CPU must support AVX, and the OS must save the YMM registers on
+  // context switches.
+  ::__cpuid(info, 1);
+  static const int kOsxsaveAndAvx = (1 << 27) | (1 << 28);
+  if ((info[2] & kOsxsaveAndAvx) != kOsxsaveAndAvx)
+    return false;
+  static const uint64_t kXmmAndYmmState = 0x6;
+  if ((::_xgetbv(0) & kXmmAndYmmState) != kXmmAndYmmState)
+    return false;
+
+  ::__cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+}
+
+// The kernels returned by GetShadowKernels. They are selected on first use,
+// and racing threads select the same ones.
+base::subtle::AtomicWord best_kernels = 0;
+
+}  // namespace
+
+const ShadowKernels& GetShadowKernels() {
+  base::subtle::AtomicWord kernels = base::subtle::Acquire_Load(&best_kernels);
+  if (kernels == 0) {
+    kernels = reinterpret_cast<base::subtle::AtomicWord>(
+        kKernels[GetBestShadowKernelsLevel()]);
+    base::subtle::Release_Store(&best_kernels, kernels);
+  }
+  return *reinterpret_cast<const ShadowKernels*>(kernels);
+}
+
+ShadowKernelsLevel GetBestShadowKernelsLevel() {
+  if (CpuSupportsAvx2())
+    return kShadowKernelsAvx2;
+  if (CpuSupportsSse2())
+    return kShadowKernelsSse2;
+  return kShadowKernelsScalar;
+}
+
+const ShadowKernels* GetShadowKernels(ShadowKernelsLevel level) {
+  DCHECK_GT(kShadowKernelsLevelMax, level);
+  if (level > GetBestShadowKernelsLevel())
+    return nullptr;
+  return kKernels[level];
+}
+
+}  // namespace asan
+}  // namespace agent
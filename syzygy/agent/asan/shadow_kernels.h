@@ -0,0 +1,92 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares the kernels used by the shadow memory to scan and update large
+// ranges of shadow bytes. Each kernel has a scalar implementation and
+// vectorized ones, the best of which is selected at runtime depending on the
+// features of the CPU.
+
+#ifndef SYZYGY_AGENT_ASAN_SHADOW_KERNELS_H_
+#define SYZYGY_AGENT_ASAN_SHADOW_KERNELS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace agent {
+namespace asan {
+
+// The instruction sets for which the shadow kernels are implemented, from the
+// least to the most capable.
+enum ShadowKernelsLevel {
+  kShadowKernelsScalar,
+  kShadowKernelsSse2,
+  kShadowKernelsAvx2,
+  kShadowKernelsLevelMax,
+};
+
+// The size of the ranges given to the null scanning kernels must be a
+// multiple of this.
+static const size_t kShadowKernelsNullScanGranularity = 32;
+
+// A set of kernels operating on a range of bytes [@p begin, @p end).
+//
+// Unless specified otherwise the ranges can have any alignment, and the
+// kernels may read the bytes surrounding a range up to the closest 32-byte
+// boundaries. As these reads never cross a page boundary they can't fault if
+// the range itself is readable. The kernels never write outside of a range.
+struct ShadowKernels {
+  typedef const uint8_t* (*FindFunction)(const uint8_t* begin,
+                                         const uint8_t* end);
+  typedef void (*UpdateFunction)(uint8_t* begin, uint8_t* end);
+
+  // Returns the first non-zero byte of a range, or @p end if there's none.
+  FindFunction find_non_zero;
+
+  // Returns the first byte of a range that is neither zero nor a freed
+  // marker, or @p end if there's none.
+  FindFunction find_non_zero_or_freed;
+
+  // Returns the last block start marker of a range, or nullptr if there's
+  // none.
+  FindFunction find_last_block_start;
+
+  // Marks a range of shadow bytes as freed, preserving the active left and
+  // right redzone bytes.
+  UpdateFunction mark_as_freed;
+
+  // Return the first null 8-bit or 16-bit value of a range, or @p end if
+  // there's none. These never read outside of the range, whose size must be a
+  // multiple of kShadowKernelsNullScanGranularity, nor past the 32-byte
+  // boundary that follows the first null value. The range may hence extend
+  // into an inaccessible page past that value. The 16-bit version requires
+  // @p begin to be 2-byte aligned.
+  FindFunction find_null8;
+  FindFunction find_null16;
+};
+
+// @returns the best kernels supported by the CPU.
+const ShadowKernels& GetShadowKernels();
+
+// @returns the level of the kernels returned by GetShadowKernels.
+ShadowKernelsLevel GetBestShadowKernelsLevel();
+
+// @param level The instruction set of the kernels.
+// @returns the kernels using the given instruction set, or nullptr if it
+//     isn't supported by the CPU.
+const ShadowKernels* GetShadowKernels(ShadowKernelsLevel level);
+
+}  // namespace asan
+}  // namespace agent
+
+#endif  // SYZYGY_AGENT_ASAN_SHADOW_KERNELS_H_
@@ -0,0 +1,211 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/agent/asan/shadow_kernels.h"
+
+#include "base/rand_util.h"
+#include "gtest/gtest.h"
+#include "syzygy/agent/asan/shadow_marker.h"
+
+namespace agent {
+namespace asan {
+
+namespace {
+
+// The markers used to fill the synthetic shadow buffers.
+const uint8_t kMarkers[] = {
+    kHeapAddressableMarker,
+    kHeapPartiallyAddressableByte3,
+    kHeapHistoricBlockStartMarker2,
+    kHeapHistoricBlockEndMarker,
+    kHeapHistoricLeftPaddingMarker,
+    kHeapHistoricFreedMarker,
+    kHeapBlockStartMarker5,
+    kHeapBlockEndMarker,
+    kHeapLeftPaddingMarker,
+    kHeapRightPaddingMarker,
+    kHeapFreedMarker,
+    kAsanReservedMarker,
+};
+
+class ShadowKernelsTest : public testing::Test {
+ public:
+  static const size_t kBufferSize = 256;
+
+  ShadowKernelsTest() : reference_(GetShadowKernels(kShadowKernelsScalar)) {}
+
+  void SetUp() override {
+    ASSERT_NE(static_cast<const ShadowKernels*>(nullptr), reference_);
+  }
+
+  // Fills the buffer with mostly zeros and a few markers, which is what the
+  // shadow of a heap typically looks like.
+  void FillBuffer() {
+    for (size_t i = 0; i < kBufferSize; ++i) {
+      buffer_[i] = 0;
+      if (base::RandInt(0, 15) == 0)
+        buffer_[i] = kMarkers[base::RandInt(0, arraysize(kMarkers) - 1)];
+    }
+  }
+
+  // Compares the kernels of the given level to the scalar ones on all the
+  // alignments of a range.
+  void CompareToReference(ShadowKernelsLevel level) {
+    const ShadowKernels* kernels = GetShadowKernels(level);
+    if (kernels == nullptr)
+      return;
+
+    for (size_t iteration = 0; iteration < 16; ++iteration) {
+      FillBuffer();
+      for (size_t i = 0; i < 40; ++i) {
+        for (size_t j = 0; j < 40; ++j) {
+          const uint8_t* begin = buffer_ + i;
+          const uint8_t* end = buffer_ + kBufferSize - j;
+          EXPECT_EQ(reference_->find_non_zero(begin, end),
+                    kernels->find_non_zero(begin, end));
+          EXPECT_EQ(reference_->find_non_zero_or_freed(begin, end),
+                    kernels->find_non_zero_or_freed(begin, end));
+          EXPECT_EQ(reference_->find_last_block_start(begin, end),
+                    kernels->find_last_block_start(begin, end));
+
+          uint8_t expected[kBufferSize] = {};
+          ::memcpy(expected, buffer_, kBufferSize);
+          reference_->mark_as_freed(expected + i, expected + kBufferSize - j);
+          uint8_t actual[kBufferSize] = {};
+          ::memcpy(actual, buffer_, kBufferSize);
+          kernels->mark_as_freed(actual + i, actual + kBufferSize - j);
+          EXPECT_EQ(0, ::memcmp(expected, actual, kBufferSize));
+        }
+      }
+    }
+  }
+
+  // Compares the null scanning kernels of the given level to the scalar
+  // ones.
+  void CompareNullScanToReference(ShadowKernelsLevel level) {
+    const ShadowKernels* kernels = GetShadowKernels(level);
+    if (kernels == nullptr)
+      return;
+
+    const size_t kRangeSize = 4 * kShadowKernelsNullScanGranularity;
+    for (size_t i = 0; i < kShadowKernelsNullScanGranularity; i += 2) {
+      const uint8_t* begin = buffer_ + i;
+      const uint8_t* end = begin + kRangeSize;
+      ::memset(buffer_, 0xAB, kBufferSize);
+      EXPECT_EQ(end, kernels->find_null8(begin, end));
+      EXPECT_EQ(end, kernels->find_null16(begin, end));
+
+      for (size_t j = 0; j < kRangeSize; ++j) {
+        ::memset(buffer_, 0xAB, kBufferSize);
+        buffer_[i + j] = 0;
+        EXPECT_EQ(begin + j, kernels->find_null8(begin, end));
+        EXPECT_EQ(reference_->find_null16(begin, end),
+                  kernels->find_null16(begin, end));
+        buffer_[i + (j ^ 1)] = 0;
+        EXPECT_EQ(begin + (j & ~1), kernels->find_null16(begin, end));
+      }
+
+      // A null value right after the range isn't found.
+      ::memset(buffer_, 0xAB, kBufferSize);
+      buffer_[i + kRangeSize] = 0;
+      EXPECT_EQ(end, kernels->find_null8(begin, end));
+    }
+  }
+
+  const ShadowKernels* reference_;
+  ALIGNAS(32) uint8_t buffer_[kBufferSize];
+};
+
+}  // namespace
+
+TEST_F(ShadowKernelsTest, LevelsAreSupported) {
+  EXPECT_NE(static_cast<const ShadowKernels*>(nullptr),
+            GetShadowKernels(kShadowKernelsScalar));
+  ShadowKernelsLevel best_level = GetBestShadowKernelsLevel();
+  EXPECT_EQ(GetShadowKernels(best_level), &GetShadowKernels());
+  for (size_t level = 0; level < kShadowKernelsLevelMax; ++level) {
+    EXPECT_EQ(level <= best_level,
+              GetShadowKernels(static_cast<ShadowKernelsLevel>(level)) !=
+                  nullptr);
+  }
+}
+
+TEST_F(ShadowKernelsTest, MatchShadowMarkerHelper) {
+  for (size_t level = 0; level < kShadowKernelsLevelMax; ++level) {
+    const ShadowKernels* kernels =
+        GetShadowKernels(static_cast<ShadowKernelsLevel>(level));
+    if (kernels == nullptr)
+      continue;
+
+    for (size_t i = 0; i < 256; ++i) {
+      uint8_t marker = static_cast<uint8_t>(i);
+
+      ::memset(buffer_, 0, kBufferSize);
+      buffer_[100] = marker;
+      const uint8_t* expected = ShadowMarkerHelper::IsBlockStart(marker) ?
+          buffer_ + 100 : nullptr;
+      EXPECT_EQ(expected,
+                kernels->find_last_block_start(buffer_, buffer_ + kBufferSize));
+      expected = marker != 0 && marker != kHeapFreedMarker ?
+          buffer_ + 100 : buffer_ + kBufferSize;
+      EXPECT_EQ(expected, kernels->find_non_zero_or_freed(
+                              buffer_, buffer_ + kBufferSize));
+
+      ::memset(buffer_, marker, kBufferSize);
+      kernels->mark_as_freed(buffer_, buffer_ + kBufferSize);
+      uint8_t expected_marker = kHeapFreedMarker;
+      if (ShadowMarkerHelper::IsActiveLeftRedzone(marker) ||
+          ShadowMarkerHelper::IsActiveRightRedzone(marker)) {
+        expected_marker = marker;
+      }
+      for (size_t j = 0; j < kBufferSize; ++j)
+        EXPECT_EQ(expected_marker, buffer_[j]);
+    }
+  }
+}
+
+TEST_F(ShadowKernelsTest, EmptyRanges) {
+  for (size_t level = 0; level < kShadowKernelsLevelMax; ++level) {
+    const ShadowKernels* kernels =
+        GetShadowKernels(static_cast<ShadowKernelsLevel>(level));
+    if (kernels == nullptr)
+      continue;
+
+    ::memset(buffer_, kHeapBlockStartMarker0, kBufferSize);
+    const uint8_t* cursor = buffer_ + 17;
+    EXPECT_EQ(cursor, kernels->find_non_zero(cursor, cursor));
+    EXPECT_EQ(cursor, kernels->find_non_zero_or_freed(cursor, cursor));
+    EXPECT_EQ(static_cast<const uint8_t*>(nullptr),
+              kernels->find_last_block_start(cursor, cursor));
+    kernels->mark_as_freed(buffer_ + 17, buffer_ + 17);
+    EXPECT_EQ(kHeapBlockStartMarker0, buffer_[17]);
+  }
+}
+
+TEST_F(ShadowKernelsTest, Sse2MatchesScalar) {
+  CompareToReference(kShadowKernelsSse2);
+  CompareNullScanToReference(kShadowKernelsSse2);
+}
+
+TEST_F(ShadowKernelsTest, Avx2MatchesScalar) {
+  CompareToReference(kShadowKernelsAvx2);
+  CompareNullScanToReference(kShadowKernelsAvx2);
+}
+
+TEST_F(ShadowKernelsTest, ScalarNullScan) {
+  CompareNullScanToReference(kShadowKernelsScalar);
+}
+
+}  // namespace asan
+}  // namespace agent
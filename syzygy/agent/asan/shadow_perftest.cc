@@ -0,0 +1,228 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Measures the cost of the shadow memory kernels at each of the supported
+// instruction set levels, and of the Shadow functions built on top of them,
+// on synthetic buffers.
+
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+#include "base/time/time.h"
+#include "gtest/gtest.h"
+#include "syzygy/agent/asan/shadow.h"
+#include "syzygy/agent/asan/shadow_kernels.h"
+#include "testing/perf/perf_test.h"
+
+namespace agent {
+namespace asan {
+
+namespace {
+
+// The number of times each benchmark is repeated.
+const size_t kIterations = 100;
+
+// The size of the synthetic shadow buffers.
+const size_t kBufferSize = 1024 * 1024;
+
+const char* kLevelNames[] = { "Scalar", "Sse2", "Avx2" };
+static_assert(arraysize(kLevelNames) == kShadowKernelsLevelMax,
+              "Missing kernels level name.");
+
+// A derived class to expose protected members for benchmarking.
+class TestShadow : public Shadow {
+ public:
+  using Shadow::ScanLeftForBracketingBlockStart;
+  using Shadow::ScanRightForBracketingBlockEnd;
+  using Shadow::shadow_;
+};
+
+class ShadowPerfTest : public testing::Test {
+ public:
+  void SetUp() override {
+    ASSERT_NE(static_cast<const uint8_t*>(nullptr), test_shadow_.shadow());
+    // Offset the buffer so that the kernels have to deal with an unaligned
+    // head and tail.
+    buffer_.resize(kBufferSize + 64, 0);
+    begin_ = buffer_.data() + 7;
+    end_ = begin_ + kBufferSize - 7;
+  }
+
+  // Prints the average time of a benchmark, in milliseconds.
+  void PrintResult(const char* measurement,
+                   const std::string& trace,
+                   base::TimeDelta time) {
+    perf_test::PrintResult(measurement, "", trace,
+                           time.InMillisecondsF() / kIterations, "ms", true);
+  }
+
+  // Runs @p function over the synthetic buffer for each supported level.
+  void RunFindBenchmark(const char* measurement,
+                        ShadowKernels::FindFunction ShadowKernels::*function) {
+    for (size_t level = 0; level < kShadowKernelsLevelMax; ++level) {
+      const ShadowKernels* kernels =
+          GetShadowKernels(static_cast<ShadowKernelsLevel>(level));
+      if (kernels == nullptr)
+        continue;
+
+      base::TimeTicks start = base::TimeTicks::Now();
+      for (size_t i = 0; i < kIterations; ++i)
+        (kernels->*function)(begin_, end_);
+      PrintResult(measurement, kLevelNames[level],
+                  base::TimeTicks::Now() - start);
+    }
+  }
+
+  TestShadow test_shadow_;
+  std::vector<uint8_t> buffer_;
+  uint8_t* begin_;
+  uint8_t* end_;
+};
+
+}  // namespace
+
+TEST_F(ShadowPerfTest, FindNonZero) {
+  // The worst case is a range that contains no marker at all.
+  RunFindBenchmark("ShadowKernelsFindNonZero",
+                   &ShadowKernels::find_non_zero);
+}
+
+TEST_F(ShadowPerfTest, FindNonZeroOrFreed) {
+  for (uint8_t* cursor = begin_; cursor < end_; cursor += 2)
+    *cursor = kHeapFreedMarker;
+  RunFindBenchmark("ShadowKernelsFindNonZeroOrFreed",
+                   &ShadowKernels::find_non_zero_or_freed);
+}
+
+TEST_F(ShadowPerfTest, FindLastBlockStart) {
+  for (uint8_t* cursor = begin_; cursor < end_; cursor += 4)
+    *cursor = kHeapFreedMarker;
+  RunFindBenchmark("ShadowKernelsFindLastBlockStart",
+                   &ShadowKernels::find_last_block_start);
+}
+
+TEST_F(ShadowPerfTest, FindNull) {
+  ::memset(buffer_.data(), 0xAB, buffer_.size());
+  begin_ = buffer_.data();
+  end_ = begin_ + kBufferSize;
+  RunFindBenchmark("ShadowKernelsFindNull8", &ShadowKernels::find_null8);
+  RunFindBenchmark("ShadowKernelsFindNull16", &ShadowKernels::find_null16);
+}
+
+TEST_F(ShadowPerfTest, MarkAsFreed) {
+  for (size_t level = 0; level < kShadowKernelsLevelMax; ++level) {
+    const ShadowKernels* kernels =
+        GetShadowKernels(static_cast<ShadowKernelsLevel>(level));
+    if (kernels == nullptr)
+      continue;
+
+    base::TimeDelta time;
+    for (size_t i = 0; i < kIterations; ++i) {
+      // Mimic the shadow of a block whose body is being freed.
+      ::memset(begin_, 0, end_ - begin_);
+      begin_[0] = kHeapBlockStartMarker0;
+      end_[-1] = kHeapBlockEndMarker;
+
+      base::TimeTicks start = base::TimeTicks::Now();
+      kernels->mark_as_freed(begin_, end_);
+      time += base::TimeTicks::Now() - start;
+    }
+    PrintResult("ShadowKernelsMarkAsFreed", kLevelNames[level], time);
+  }
+}
+
+TEST_F(ShadowPerfTest, PoisonUnpoison) {
+  // The shadow functions only touch the shadow of the range, so a synthetic
+  // address is fine.
+  const uint8_t* addr = reinterpret_cast<const uint8_t*>(64 * 1024 * 1024);
+  const size_t kSize = kBufferSize * kShadowRatio;
+
+  base::TimeDelta poison_time;
+  base::TimeDelta mark_as_freed_time;
+  base::TimeDelta is_range_accessible_time;
+  base::TimeDelta unpoison_time;
+  for (size_t i = 0; i < kIterations; ++i) {
+    base::TimeTicks start = base::TimeTicks::Now();
+    EXPECT_TRUE(test_shadow_.IsRangeAccessible(addr, kSize));
+    is_range_accessible_time += base::TimeTicks::Now() - start;
+
+    start = base::TimeTicks::Now();
+    test_shadow_.Poison(addr, kSize, kHeapLeftPaddingMarker);
+    poison_time += base::TimeTicks::Now() - start;
+
+    start = base::TimeTicks::Now();
+    test_shadow_.Unpoison(addr, kSize);
+    unpoison_time += base::TimeTicks::Now() - start;
+
+    start = base::TimeTicks::Now();
+    test_shadow_.MarkAsFreed(addr, kSize);
+    mark_as_freed_time += base::TimeTicks::Now() - start;
+
+    test_shadow_.Unpoison(addr, kSize);
+  }
+
+  PrintResult("ShadowIsRangeAccessible", "", is_range_accessible_time);
+  PrintResult("ShadowPoison", "", poison_time);
+  PrintResult("ShadowUnpoison", "", unpoison_time);
+  PrintResult("ShadowMarkAsFreed", "", mark_as_freed_time);
+}
+
+TEST_F(ShadowPerfTest, GetNullTerminatedArraySize) {
+  std::vector<char> string(kBufferSize, 'a');
+  string.back() = 0;
+
+  base::TimeTicks start = base::TimeTicks::Now();
+  for (size_t i = 0; i < kIterations; ++i) {
+    size_t size = 0;
+    EXPECT_TRUE(test_shadow_.GetNullTerminatedArraySize<char>(
+        string.data(), 0, &size));
+    EXPECT_EQ(kBufferSize, size);
+  }
+  PrintResult("ShadowGetNullTerminatedArraySize", "",
+              base::TimeTicks::Now() - start);
+}
+
+TEST_F(ShadowPerfTest, ScanForBracketingBlock) {
+  size_t offset = test_shadow_.length() / 2;
+
+  test_shadow_.shadow_[offset] = kHeapBlockStartMarker0;
+  test_shadow_.shadow_[offset + kBufferSize - 1] = kHeapBlockEndMarker;
+
+  base::TimeDelta scan_left_time;
+  base::TimeDelta scan_right_time;
+  for (size_t i = 0; i < kIterations; ++i) {
+    size_t location = 0;
+    base::TimeTicks start = base::TimeTicks::Now();
+    EXPECT_TRUE(test_shadow_.ScanLeftForBracketingBlockStart(
+        offset + kBufferSize - 2, &location));
+    scan_left_time += base::TimeTicks::Now() - start;
+    EXPECT_EQ(offset, location);
+
+    start = base::TimeTicks::Now();
+    EXPECT_TRUE(test_shadow_.ScanRightForBracketingBlockEnd(offset + 1,
+                                                            &location));
+    scan_right_time += base::TimeTicks::Now() - start;
+    EXPECT_EQ(offset + kBufferSize - 1, location);
+  }
+
+  PrintResult("ShadowScanLeftForBracketingBlockStart", "", scan_left_time);
+  PrintResult("ShadowScanRightForBracketingBlockEnd", "", scan_right_time);
+
+  test_shadow_.shadow_[offset] = 0;
+  test_shadow_.shadow_[offset + kBufferSize - 1] = 0;
+}
+
+}  // namespace asan
+}  // namespace agent
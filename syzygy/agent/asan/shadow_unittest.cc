@@ -14,6 +14,7 @@
 
 #include "syzygy/agent/asan/shadow.h"
 
+#include <algorithm>
 #include <memory>
 
 #include "base/rand_util.h"
@@ -243,6 +244,49 @@ TEST_F(ShadowTest, GetNullTerminatedArraySize) {
   test_shadow.Unpoison(aligned_test_array, aligned_array_length);
 }
 
+TEST_F(ShadowTest, GetNullTerminatedArraySizeBeforeInaccessiblePage) {
+  const size_t kPageSize = GetPageSize();
+  uint8_t* pages = reinterpret_cast<uint8_t*>(::VirtualAlloc(
+      nullptr, 2 * kPageSize, MEM_COMMIT, PAGE_READWRITE));
+  ASSERT_NE(static_cast<uint8_t*>(nullptr), pages);
+  DWORD old_protection = 0;
+  ASSERT_TRUE(::VirtualProtect(pages + kPageSize, kPageSize, PAGE_NOACCESS,
+                               &old_protection));
+
+  // The array ends right before the inaccessible page. Its memory isn't
+  // tracked, so it is scanned a chunk at a time, and the last chunk extends
+  // into the inaccessible page. It starts 8 bytes past a 32-byte boundary so
+  // that unaligned vector loads would straddle the page boundary.
+  uint8_t* page_end = pages + kPageSize;
+  uint8_t* array = pages + 8;
+  size_t array_size = page_end - array;
+  ::memset(array, 0xAA, array_size);
+  page_end[-1] = 0;
+
+  size_t size = 0;
+  EXPECT_TRUE(test_shadow.GetNullTerminatedArraySize<uint8_t>(
+      array, 0U, &size));
+  EXPECT_EQ(array_size, size);
+
+  page_end[-2] = 0;
+  EXPECT_TRUE(test_shadow.GetNullTerminatedArraySize<uint16_t>(
+      array, 0U, &size));
+  EXPECT_EQ(array_size, size);
+  page_end[-2] = 0xAA;
+
+  // A |max_size| that ends in the last chunk hands the scan over to the slow
+  // path, which must stop at the same place.
+  const size_t kMaxSizes[] = {
+      array_size - 3, array_size, array_size + 1, 2 * kPageSize };
+  for (size_t max_size : kMaxSizes) {
+    EXPECT_TRUE(test_shadow.GetNullTerminatedArraySize<uint8_t>(
+        array, max_size, &size));
+    EXPECT_EQ(std::min(max_size, array_size), size);
+  }
+
+  EXPECT_TRUE(::VirtualFree(pages, 0, MEM_RELEASE));
+}
+
 TEST_F(ShadowTest, IsAccessibleRange) {
   ScopedAlignedArray scoped_test_array;
   const uint8_t* aligned_test_array = scoped_test_array.get_aligned_array();
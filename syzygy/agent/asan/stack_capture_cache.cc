@@ -32,14 +32,104 @@ namespace {
 static base::LazyInstance<common::StackCapture> g_empty_stack_capture =
     LAZY_INSTANCE_INITIALIZER;
 
-// Gives us access to the first frame of a stack capture as link-list pointer.
-common::StackCapture** GetFirstFrameAsLink(
+class PrivateStackCapture : public common::StackCapture {
+ public:
+  // Expose the actual number of frames. We use this to make reclaimed
+  // stack captures look invalid when they're in a free list.
+  using common::StackCapture::num_frames_;
+  // Expose the reference count so that it can be updated atomically.
+  using common::StackCapture::ref_count_;
+};
+
+// The entry linking a reclaimed stack capture into a list. It is stored in the
+// frames of the stack capture.
+struct DECLSPEC_ALIGN(MEMORY_ALLOCATION_ALIGNMENT) ReclaimedStackCapture {
+  SLIST_ENTRY entry;
+  common::StackCapture* stack_capture;
+};
+
+// Gives us access to the frames of a stack capture as a list entry.
+// @returns the entry, or nullptr if the stack capture is too small to hold
+//     one.
+ReclaimedStackCapture* GetFramesAsReclaimedEntry(
     common::StackCapture* stack_capture) {
   DCHECK_NE(static_cast<common::StackCapture*>(nullptr), stack_capture);
-  common::StackCapture** link = reinterpret_cast<common::StackCapture**>(
+  uint8_t* frames = reinterpret_cast<uint8_t*>(
       const_cast<void**>(stack_capture->frames()));
-  DCHECK_NE(static_cast<common::StackCapture**>(nullptr), link);
-  return link;
+  DCHECK_NE(static_cast<uint8_t*>(nullptr), frames);
+  uint8_t* entry = ::common::AlignUp(frames, MEMORY_ALLOCATION_ALIGNMENT);
+  uint8_t* end = reinterpret_cast<uint8_t*>(stack_capture) +
+      stack_capture->Size();
+  if (entry + sizeof(ReclaimedStackCapture) > end)
+    return nullptr;
+  return reinterpret_cast<ReclaimedStackCapture*>(entry);
+}
+
+// The outcome of an attempt to reference a stack capture.
+enum AddRefResult {
+  // The stack capture is unreferenced, no reference was taken.
+  ADD_REF_FAILED,
+  // A reference was taken.
+  ADD_REF_SUCCEEDED,
+  // A reference was taken and it saturated the reference count.
+  ADD_REF_SATURATED,
+};
+
+// Atomically references a stack capture, unless it's unreferenced. An
+// unreferenced stack capture is either being reclaimed or has already been
+// reclaimed, and can't be revived.
+AddRefResult AddRefIfReferenced(common::StackCapture* stack_capture) {
+  volatile SHORT* ref_count = reinterpret_cast<volatile SHORT*>(
+      &reinterpret_cast<PrivateStackCapture*>(stack_capture)->ref_count_);
+  while (true) {
+    common::StackCapture::RefCount count =
+        static_cast<common::StackCapture::RefCount>(*ref_count);
+    if (count == 0)
+      return ADD_REF_FAILED;
+    if (count == common::StackCapture::kMaxRefCount)
+      return ADD_REF_SUCCEEDED;
+    common::StackCapture::RefCount new_count =
+        static_cast<common::StackCapture::RefCount>(count + 1);
+    if (::InterlockedCompareExchange16(ref_count,
+                                       static_cast<SHORT>(new_count),
+                                       static_cast<SHORT>(count)) ==
+            static_cast<SHORT>(count)) {
+      return new_count == common::StackCapture::kMaxRefCount ?
+          ADD_REF_SATURATED : ADD_REF_SUCCEEDED;
+    }
+  }
+}
+
+// Atomically takes the first reference to an unreferenced stack capture. Other
+// threads may still hold a pointer to it from before it was reclaimed, and can
+// reference it as soon as this is done.
+void AddFirstRefAtomic(common::StackCapture* stack_capture) {
+  volatile SHORT* ref_count = reinterpret_cast<volatile SHORT*>(
+      &reinterpret_cast<PrivateStackCapture*>(stack_capture)->ref_count_);
+  SHORT previous_count = ::InterlockedExchange16(ref_count, 1);
+  DCHECK_EQ(0, previous_count);
+}
+
+// Atomically dereferences a stack capture.
+// @returns true if this released the last reference.
+bool RemoveRefAtomic(common::StackCapture* stack_capture) {
+  volatile SHORT* ref_count = reinterpret_cast<volatile SHORT*>(
+      &reinterpret_cast<PrivateStackCapture*>(stack_capture)->ref_count_);
+  while (true) {
+    common::StackCapture::RefCount count =
+        static_cast<common::StackCapture::RefCount>(*ref_count);
+    DCHECK_LT(0u, count);
+    if (count == common::StackCapture::kMaxRefCount)
+      return false;
+    common::StackCapture::RefCount new_count =
+        static_cast<common::StackCapture::RefCount>(count - 1);
+    if (::InterlockedCompareExchange16(ref_count,
+                                       static_cast<SHORT>(new_count),
+                                       static_cast<SHORT>(count)) ==
+            static_cast<SHORT>(count)) {
+      return new_count == 0;
+    }
+  }
 }
 
 }  // namespace
@@ -57,68 +147,37 @@ StackCaptureCache::CachePage* StackCaptureCache::CachePage::CreateInPlace(
   return new(alloc) CachePage(link);
 }
 
-common::StackCapture* StackCaptureCache::CachePage::GetNextStackCapture(
-    size_t max_num_frames, size_t metadata_size) {
-  metadata_size = ::common::AlignUp(metadata_size, sizeof(void*));
-
-  size_t stack_size = common::StackCapture::GetSize(max_num_frames);
-  size_t size = stack_size + metadata_size;
-  if (bytes_used_ + size > kDataSize)
-    return nullptr;
-
-  // Use placement new for the StackCapture and zero initialize the metadata.
-  common::StackCapture* stack =
-      new(data_ + bytes_used_) common::StackCapture(max_num_frames);
-  ::memset(data_ + bytes_used_ + stack_size, 0, metadata_size);
-
-  // Update the allocation cursor.
-  bytes_used_ += size;
-
-  return stack;
-}
-
-common::StackCapture* StackCaptureCache::CachePage::GetNextStackCapture(
-    size_t max_num_frames) {
-  return GetNextStackCapture(max_num_frames, 0);
-}
-
-bool StackCaptureCache::CachePage::ReturnStackCapture(
-    common::StackCapture* stack_capture, size_t metadata_size) {
-  DCHECK_NE(static_cast<common::StackCapture*>(nullptr), stack_capture);
-
-  metadata_size = ::common::AlignUp(metadata_size, sizeof(void*));
-
-  uint8_t* stack = reinterpret_cast<uint8_t*>(stack_capture);
-  size_t size = stack_capture->Size() + metadata_size;
-
-  // If this was the last stack capture provided by this page then the end of
-  // it must align with our current data pointer.
-  if (data_ + bytes_used_ != stack + size)
-    return false;
-
-  bytes_used_ -= size;
-  return true;
-}
-
-bool StackCaptureCache::CachePage::ReturnStackCapture(
-    common::StackCapture* stack_capture) {
-  return ReturnStackCapture(stack_capture, 0);
+uint8_t* StackCaptureCache::CachePage::AllocateChunk(size_t min_size,
+                                                     size_t max_size,
+                                                     size_t* chunk_size) {
+  DCHECK_LE(min_size, max_size);
+  DCHECK_NE(static_cast<size_t*>(nullptr), chunk_size);
+  min_size = ::common::AlignUp(min_size, MEMORY_ALLOCATION_ALIGNMENT);
+  max_size = ::common::AlignUp(max_size, MEMORY_ALLOCATION_ALIGNMENT);
+
+  base::subtle::AtomicWord bytes_used =
+      base::subtle::NoBarrier_Load(&bytes_used_);
+  while (true) {
+    size_t bytes_left = kDataSize - static_cast<size_t>(bytes_used);
+    bytes_left = ::common::AlignDown(bytes_left, MEMORY_ALLOCATION_ALIGNMENT);
+    if (bytes_left < min_size)
+      return nullptr;
+    size_t size = std::min(bytes_left, max_size);
+    base::subtle::AtomicWord old_bytes_used =
+        base::subtle::NoBarrier_CompareAndSwap(
+            &bytes_used_, bytes_used, bytes_used + size);
+    if (old_bytes_used == bytes_used) {
+      *chunk_size = size;
+      return data_ + bytes_used;
+    }
+    bytes_used = old_bytes_used;
+  }
 }
 
 StackCaptureCache::StackCaptureCache(
     AsanLogger* logger, MemoryNotifierInterface* memory_notifier)
-    : logger_(logger),
-      memory_notifier_(memory_notifier),
-      max_num_frames_(common::StackCapture::kMaxNumFrames),
-      current_page_(nullptr) {
-  DCHECK_NE(static_cast<AsanLogger*>(nullptr), logger);
-  DCHECK_NE(static_cast<MemoryNotifierInterface*>(nullptr), memory_notifier);
-
-  AllocateCachePage();
-
-  ::memset(&statistics_, 0, sizeof(statistics_));
-  ::memset(reclaimed_, 0, sizeof(reclaimed_));
-  statistics_.size = sizeof(CachePage);
+    : StackCaptureCache(logger, memory_notifier,
+                        common::StackCapture::kMaxNumFrames) {
 }
 
 StackCaptureCache::StackCaptureCache(
@@ -127,24 +186,48 @@ StackCaptureCache::StackCaptureCache(
     : logger_(logger),
       memory_notifier_(memory_notifier),
       max_num_frames_(0),
-      current_page_(nullptr) {
+      known_stacks_(nullptr),
+      current_page_(0),
+      thread_state_tls_(TLS_OUT_OF_INDEXES),
+      thread_states_(0) {
   DCHECK_NE(static_cast<AsanLogger*>(nullptr), logger);
   DCHECK_NE(static_cast<MemoryNotifierInterface*>(nullptr), memory_notifier);
   DCHECK_LT(0u, max_num_frames);
   max_num_frames_ = static_cast<uint8_t>(
       std::min(max_num_frames, common::StackCapture::kMaxNumFrames));
 
+  for (size_t i = 0; i < arraysize(reclaimed_); ++i)
+    ::InitializeSListHead(&reclaimed_[i]);
+  ::InitializeSListHead(&free_thread_states_);
+
+  thread_state_tls_ = ::TlsAlloc();
+  CHECK_NE(TLS_OUT_OF_INDEXES, thread_state_tls_);
+
+  // The table is committed up front, its pages only get backed by physical
+  // memory as they get touched.
+  size_t table_size = kKnownStacksTableSize * sizeof(KnownStack);
+  known_stacks_ = reinterpret_cast<KnownStack*>(::VirtualAlloc(
+      nullptr, table_size, MEM_COMMIT, PAGE_READWRITE));
+  CHECK_NE(static_cast<KnownStack*>(nullptr), known_stacks_);
+  memory_notifier_->NotifyInternalUse(known_stacks_, table_size);
+
+  base::AutoLock lock(current_page_lock_);
   AllocateCachePage();
-  ::memset(&statistics_, 0, sizeof(statistics_));
-  ::memset(reclaimed_, 0, sizeof(reclaimed_));
-  statistics_.size = sizeof(CachePage);
 }
 
 StackCaptureCache::~StackCaptureCache() {
-  // Clean up the linked list of cache pages.
-  while (current_page_ != nullptr) {
-    CachePage* page = current_page_;
-    current_page_ = page->next_page_;
+  ::TlsFree(thread_state_tls_);
+
+  size_t table_size = kKnownStacksTableSize * sizeof(KnownStack);
+  memory_notifier_->NotifyReturnedToOS(known_stacks_, table_size);
+  CHECK_EQ(TRUE, ::VirtualFree(known_stacks_, 0, MEM_RELEASE));
+
+  // Clean up the linked list of cache pages. This also frees the thread
+  // states.
+  CachePage* current_page = GetCurrentPage();
+  while (current_page != nullptr) {
+    CachePage* page = current_page;
+    current_page = page->next_page_;
     page->next_page_ = nullptr;
 
     memory_notifier_->NotifyReturnedToOS(page, sizeof(*page));
@@ -165,7 +248,6 @@ const common::StackCapture* StackCaptureCache::SaveStackTrace(
   auto num_frames = stack_capture.num_frames();
   auto absolute_stack_id = stack_capture.absolute_stack_id();
   DCHECK_NE(static_cast<void**>(nullptr), frames);
-  DCHECK_NE(static_cast<CachePage*>(nullptr), current_page_);
 
   // If the number of frames is zero, the stack_capture was not captured
   // correctly. In that case, return an empty stack_capture. Otherwise, saving a
@@ -173,77 +255,123 @@ const common::StackCapture* StackCaptureCache::SaveStackTrace(
   if (!num_frames)
     return &g_empty_stack_capture.Get();
 
+  ThreadState* thread_state = GetThreadState();
+  StackId key = GetKnownStackKey(absolute_stack_id);
+  KnownStack* known_stack = FindKnownStack(key, true);
+
   bool already_cached = false;
   common::StackCapture* stack_trace = nullptr;
+  common::StackCapture* new_stack_trace = nullptr;
   bool saturated = false;
+  bool uncached = false;
+
+  while (true) {
+    common::StackCapture* cached_stack_trace = nullptr;
+    if (known_stack != nullptr) {
+      // The entry may have been handed over to another key since it was looked
+      // up, in which case this key has to be looked up again.
+      if (base::subtle::Acquire_Load(&known_stack->key) !=
+          static_cast<base::subtle::Atomic32>(key)) {
+        known_stack = FindKnownStack(key, true);
+        continue;
+      }
+      cached_stack_trace = reinterpret_cast<common::StackCapture*>(
+          base::subtle::Acquire_Load(&known_stack->stack));
+    }
+
+    if (cached_stack_trace != nullptr) {
+      AddRefResult result = AddRefIfReferenced(cached_stack_trace);
+      if (result != ADD_REF_FAILED) {
+        // The stack capture may have been reclaimed and reused for another
+        // stack since it was read from the table. Holding a reference
+        // prevents this from happening again, so its key can be trusted.
+        if (GetKnownStackKey(cached_stack_trace->absolute_stack_id()) == key) {
+          already_cached = true;
+          stack_trace = cached_stack_trace;
+          saturated = result == ADD_REF_SATURATED;
+          break;
+        }
+        DropReference(thread_state, cached_stack_trace);
+
+        // The stack capture is still in the table, so it was published under
+        // the previous key of this entry. It gets replaced.
+        if (base::subtle::Acquire_Load(&known_stack->stack) !=
+            reinterpret_cast<base::subtle::AtomicWord>(cached_stack_trace)) {
+          continue;
+        }
+      }
+      // The cached stack capture is being reclaimed. It gets replaced rather
+      // than waiting for the thread reclaiming it to unlink it.
+    }
+
+    // This stack has to be initialized and referenced before being published.
+    // It may come from a reclaimed list, in which case it must be initialized
+    // before taking the reference, as this lets the threads holding a stale
+    // pointer to it reference it as well.
+    if (new_stack_trace == nullptr) {
+      new_stack_trace = GetStackCapture(thread_state, num_frames);
+      DCHECK_NE(static_cast<common::StackCapture*>(nullptr), new_stack_trace);
+      new_stack_trace->InitFromExistingStack(stack_capture);
+      AddFirstRefAtomic(new_stack_trace);
+    }
 
-  {
-    size_t known_stack_shard = absolute_stack_id % kKnownStacksSharding;
-    // Get or insert the current stack trace while under the lock for this
-    // bucket.
-    base::AutoLock auto_lock(known_stacks_locks_[known_stack_shard]);
-
-    // Check if the stack capture is already in the cache map.
-    StackMap::iterator result =
-        known_stacks_[known_stack_shard].find(absolute_stack_id);
-
-    // If this capture has not already been cached then we have to initialize
-    // the data.
-    if (result == known_stacks_[known_stack_shard].end()) {
-      stack_trace = GetStackCapture(num_frames);
-      DCHECK_NE(static_cast<common::StackCapture*>(nullptr), stack_trace);
-      stack_trace->InitFromExistingStack(stack_capture);
-      auto result = known_stacks_[known_stack_shard].insert(
-          std::make_pair(absolute_stack_id, stack_trace));
-      DCHECK(result.second);
-      DCHECK(stack_trace->HasNoRefs());
-      FOR_EACH_OBSERVER(Observer, observer_list_, OnNewStack(stack_trace));
-    } else {
-      already_cached = true;
-      stack_trace = result->second;
+    // Stacks that can't be stored in the table aren't deduplicated.
+    if (known_stack == nullptr) {
+      uncached = true;
+      break;
     }
-    // Increment the reference count for this stack trace.
-    if (!stack_trace->RefCountIsSaturated()) {
-      stack_trace->AddRef();
-    } else {
-      saturated = true;
+
+    base::subtle::AtomicWord expected =
+        reinterpret_cast<base::subtle::AtomicWord>(cached_stack_trace);
+    if (base::subtle::Release_CompareAndSwap(
+            &known_stack->stack, expected,
+            reinterpret_cast<base::subtle::AtomicWord>(new_stack_trace)) ==
+        expected) {
+      break;
     }
   }
+
+  if (!already_cached) {
+    stack_trace = new_stack_trace;
+    new_stack_trace = nullptr;
+    FOR_EACH_OBSERVER(Observer, observer_list_, OnNewStack(stack_trace));
+  }
   DCHECK_NE(static_cast<common::StackCapture*>(nullptr), stack_trace);
 
-  bool must_log = false;
-  Statistics statistics = {};
+  // Another thread cached this stack while we were initializing our copy. A
+  // thread holding a stale pointer to our copy may have referenced it and be
+  // using it as the cached stack, so it's accounted as cached and only gets
+  // reclaimed along with the last reference.
+  if (new_stack_trace != nullptr) {
+    if (compression_reporting_period_ != 0) {
+      ++thread_state->statistics.cached;
+      thread_state->statistics.frames_alive += new_stack_trace->num_frames();
+    }
+    DropReference(thread_state, new_stack_trace);
+  }
+
   // Update the statistics.
   if (compression_reporting_period_ != 0) {
-    base::AutoLock stats_lock(stats_lock_);
-    if (already_cached) {
-      // If the existing stack capture is previously unreferenced and becoming
-      // referenced again, then decrement the unreferenced counter.
-      if (stack_trace->HasNoRefs()) {
-        DCHECK_LT(0u, statistics_.unreferenced);
-        --statistics_.unreferenced;
-      }
-    } else {
-      ++statistics_.cached;
-      statistics_.frames_alive += num_frames;
-      ++statistics_.allocated;
-    }
-    if (!saturated && stack_trace->RefCountIsSaturated()) {
-      saturated = true;
-      ++statistics_.saturated;
+    Statistics& statistics = thread_state->statistics;
+    if (!already_cached) {
+      ++statistics.cached;
+      statistics.frames_alive += num_frames;
+      ++statistics.allocated;
     }
-    ++statistics_.requested;
-    ++statistics_.references;
-    statistics_.frames_stored += num_frames;
-    if (statistics_.requested % compression_reporting_period_ == 0) {
-      must_log = true;
-      GetStatisticsUnlocked(&statistics);
+    if (saturated)
+      ++statistics.saturated;
+    if (uncached)
+      ++statistics.uncached;
+    ++statistics.requested;
+    ++statistics.references;
+    statistics.frames_stored += num_frames;
+    if (statistics.requested % compression_reporting_period_ == 0) {
+      Statistics report = {};
+      GetStatistics(&report);
+      LogStatisticsImpl(report);
     }
   }
 
-  if (must_log)
-    LogStatisticsImpl(statistics);
-
   // Return the stack trace pointer that is now in the cache.
   return stack_trace;
 }
@@ -257,48 +385,19 @@ void StackCaptureCache::ReleaseStackTrace(
     return;
   }
 
-  size_t known_stack_shard =
-      stack_capture->absolute_stack_id() % kKnownStacksSharding;
-  bool add_to_reclaimed_list = false;
-  common::StackCapture* stack = nullptr;
-  {
-    base::AutoLock auto_lock(known_stacks_locks_[known_stack_shard]);
-
-    // We own the stack so its fine to remove the const. We double check this
-    // is the case in debug builds with the DCHECK.
-    stack = const_cast<common::StackCapture*>(stack_capture);
-
-    stack->RemoveRef();
-
-    if (stack->HasNoRefs()) {
-      add_to_reclaimed_list = true;
-      // Remove this from the known stacks as we're going to reclaim it and
-      // overwrite part of its data as we insert into the reclaimed_ list.
-      size_t num_erased = known_stacks_[known_stack_shard].erase(
-          stack_capture->absolute_stack_id());
-      DCHECK_EQ(num_erased, 1u);
-    }
-  }
+  // We own the stack so its fine to remove the const.
+  common::StackCapture* stack = const_cast<common::StackCapture*>(
+      stack_capture);
+  ThreadState* thread_state = GetThreadState();
 
-  // Update the statistics.
+  // Update the statistics. This must come before dropping the reference, as
+  // the stack capture may be reclaimed and reused by another thread.
   if (compression_reporting_period_ != 0) {
-    base::AutoLock stats_lock(stats_lock_);
-    DCHECK_LT(0u, statistics_.references);
-    --statistics_.references;
-    statistics_.frames_stored -= stack->num_frames();
-    if (add_to_reclaimed_list) {
-      --statistics_.cached;
-      ++statistics_.unreferenced;
-      // The frames in this stack capture are no longer alive.
-      statistics_.frames_alive -= stack->num_frames();
-    }
+    --thread_state->statistics.references;
+    thread_state->statistics.frames_stored -= stack->num_frames();
   }
 
-  // Link this stack capture into the list of reclaimed stacks. This
-  // must come after the statistics updating, as we modify the |num_frames|
-  // parameter in place.
-  if (add_to_reclaimed_list)
-    AddStackCaptureToReclaimedList(stack);
+  DropReference(thread_state, stack);
 }
 
 bool StackCaptureCache::StackCapturePointerIsValid(
@@ -310,9 +409,9 @@ bool StackCaptureCache::StackCapturePointerIsValid(
   const uint8_t* stack_capture_addr =
       reinterpret_cast<const uint8_t*>(stack_capture);
 
-  // Walk over the allocated pages and see if it lands within any of them.
-  base::AutoLock lock(current_page_lock_);
-  CachePage* page = current_page_;
+  // Walk over the allocated pages and see if it lands within any of them. The
+  // pages are only ever prepended to the list, so this doesn't need a lock.
+  CachePage* page = GetCurrentPage();
   while (page != nullptr) {
     const uint8_t* page_end = page->data() + page->bytes_used();
 
@@ -343,36 +442,123 @@ void StackCaptureCache::RemoveObserver(Observer* obs) {
 
 void StackCaptureCache::LogStatistics()  {
   Statistics statistics = {};
-
-  {
-    base::AutoLock auto_lock(stats_lock_);
-    GetStatisticsUnlocked(&statistics);
-  }
-
+  GetStatistics(&statistics);
   LogStatisticsImpl(statistics);
 }
 
+void StackCaptureCache::ReleaseThreadState() {
+  ThreadState* thread_state =
+      reinterpret_cast<ThreadState*>(::TlsGetValue(thread_state_tls_));
+  if (thread_state == nullptr)
+    return;
+  ::TlsSetValue(thread_state_tls_, nullptr);
+  ::InterlockedPushEntrySList(&free_thread_states_, &thread_state->free_entry);
+}
+
 void StackCaptureCache::AllocateCachePage() {
   static_assert(sizeof(CachePage) % (64 * 1024) == 0,
                 "kCachePageSize should be a multiple of the system allocation "
                 "granularity.");
+#ifndef NDEBUG
+  current_page_lock_.AssertAcquired();
+#endif
 
   void* new_page = ::VirtualAlloc(nullptr, sizeof(CachePage), MEM_COMMIT,
                                   PAGE_READWRITE);
   CHECK_NE(static_cast<void*>(nullptr), new_page);
 
   // Use a placement new and notify the shadow memory.
-  current_page_ = CachePage::CreateInPlace(new_page, current_page_);
+  CachePage* page = CachePage::CreateInPlace(new_page, GetCurrentPage());
   memory_notifier_->NotifyInternalUse(new_page, sizeof(CachePage));
+
+  // Publish the page once it's fully initialized.
+  base::subtle::Release_Store(&current_page_,
+                              reinterpret_cast<base::subtle::AtomicWord>(page));
 }
 
-void StackCaptureCache::GetStatisticsUnlocked(Statistics* statistics) const {
-#ifndef NDEBUG
-  stats_lock_.AssertAcquired();
-#endif
+StackCaptureCache::CachePage* StackCaptureCache::GetCurrentPage() const {
+  return reinterpret_cast<CachePage*>(
+      base::subtle::Acquire_Load(&current_page_));
+}
+
+uint8_t* StackCaptureCache::AllocateChunk(size_t min_size,
+                                          size_t max_size,
+                                          size_t* chunk_size) {
+  DCHECK_NE(static_cast<size_t*>(nullptr), chunk_size);
+  while (true) {
+    CachePage* page = GetCurrentPage();
+    uint8_t* chunk = page->AllocateChunk(min_size, max_size, chunk_size);
+    if (chunk != nullptr)
+      return chunk;
+
+    // The page is full. Allocate a new one, unless another thread beat us to
+    // it.
+    base::AutoLock lock(current_page_lock_);
+    if (GetCurrentPage() == page)
+      AllocateCachePage();
+  }
+}
+
+StackCaptureCache::ThreadState* StackCaptureCache::GetThreadState() {
+  ThreadState* thread_state =
+      reinterpret_cast<ThreadState*>(::TlsGetValue(thread_state_tls_));
+  if (thread_state != nullptr)
+    return thread_state;
+
+  // Reuse the state of a thread that exited if possible.
+  PSLIST_ENTRY entry = ::InterlockedPopEntrySList(&free_thread_states_);
+  if (entry != nullptr) {
+    thread_state = CONTAINING_RECORD(entry, ThreadState, free_entry);
+  } else {
+    size_t size = 0;
+    void* memory = AllocateChunk(sizeof(ThreadState), sizeof(ThreadState),
+                                 &size);
+    thread_state = new(memory) ThreadState();
+
+    // Link the state into the list of all the states.
+    base::subtle::AtomicWord head = base::subtle::NoBarrier_Load(
+        &thread_states_);
+    while (true) {
+      thread_state->next = reinterpret_cast<ThreadState*>(head);
+      base::subtle::AtomicWord old_head = base::subtle::Release_CompareAndSwap(
+          &thread_states_, head,
+          reinterpret_cast<base::subtle::AtomicWord>(thread_state));
+      if (old_head == head)
+        break;
+      head = old_head;
+    }
+  }
 
+  ::TlsSetValue(thread_state_tls_, thread_state);
+  return thread_state;
+}
+
+void StackCaptureCache::GetStatistics(Statistics* statistics) const {
   DCHECK_NE(static_cast<Statistics*>(nullptr), statistics);
-  *statistics = statistics_;
+  ::memset(statistics, 0, sizeof(*statistics));
+
+  // The size of the cache is that of its pages and of the known stacks table.
+  statistics->size = kKnownStacksTableSize * sizeof(KnownStack);
+  for (CachePage* page = GetCurrentPage(); page != nullptr;
+       page = page->next_page_) {
+    statistics->size += sizeof(CachePage);
+  }
+
+  const ThreadState* thread_state = reinterpret_cast<const ThreadState*>(
+      base::subtle::Acquire_Load(&thread_states_));
+  for (; thread_state != nullptr; thread_state = thread_state->next) {
+    const Statistics& s = thread_state->statistics;
+    statistics->cached += s.cached;
+    statistics->saturated += s.saturated;
+    statistics->unreferenced += s.unreferenced;
+    statistics->requested += s.requested;
+    statistics->allocated += s.allocated;
+    statistics->uncached += s.uncached;
+    statistics->references += s.references;
+    statistics->frames_stored += s.frames_stored;
+    statistics->frames_alive += s.frames_alive;
+    statistics->frames_dead += s.frames_dead;
+  }
 }
 
 void StackCaptureCache::LogStatisticsImpl(const Statistics& statistics) const {
@@ -398,7 +584,8 @@ void StackCaptureCache::LogStatisticsImpl(const Statistics& statistics) const {
 
   logger_->Write(base::StringPrintf(
       "PID=%d; Stack cache size=%.2f MB; Compression=%.2f%%; "
-      "Alive=%.2f%%; Dead=%.2f%%; Overhead=%.2f%%; Saturated=%d; Entries=%d",
+      "Alive=%.2f%%; Dead=%.2f%%; Overhead=%.2f%%; Saturated=%d; Entries=%d; "
+      "Uncached=%llu",
       ::GetCurrentProcessId(),
       cache_size / 1024.0 / 1024.0,
       compression,
@@ -406,99 +593,153 @@ void StackCaptureCache::LogStatisticsImpl(const Statistics& statistics) const {
       dead,
       overhead,
       statistics.saturated,
-      statistics.cached));
+      statistics.cached,
+      statistics.uncached));
+}
+
+StackCaptureCache::KnownStack* StackCaptureCache::FindKnownStack(
+    StackId key, bool claim) {
+  DCHECK_NE(0u, key);
+  static_assert((kKnownStacksTableSize & (kKnownStacksTableSize - 1)) == 0,
+                "kKnownStacksTableSize must be a power of two.");
+
+  // Use linear probing. As the entries are never unclaimed, a key can't be
+  // found past the first unclaimed entry.
+  base::subtle::Atomic32 wanted_key = static_cast<base::subtle::Atomic32>(key);
+  KnownStack* tombstone = nullptr;
+  base::subtle::Atomic32 tombstone_key = 0;
+  for (size_t i = 0; i < kMaxKnownStackProbeCount; ++i) {
+    KnownStack* known_stack =
+        &known_stacks_[(key + i) & (kKnownStacksTableSize - 1)];
+    base::subtle::Atomic32 entry_key =
+        base::subtle::Acquire_Load(&known_stack->key);
+    if (entry_key == 0) {
+      if (!claim)
+        return nullptr;
+      entry_key = base::subtle::Acquire_CompareAndSwap(
+          &known_stack->key, 0, wanted_key);
+      if (entry_key == 0)
+        return known_stack;
+    }
+    if (entry_key == wanted_key)
+      return known_stack;
+    if (tombstone == nullptr &&
+        base::subtle::Acquire_Load(&known_stack->stack) == 0) {
+      tombstone = known_stack;
+      tombstone_key = entry_key;
+    }
+  }
+
+  if (!claim || tombstone == nullptr)
+    return nullptr;
+
+  // All the entries that this key can use are claimed. Hand over the first
+  // one that has no stack capture. A stack capture may still be published to
+  // it under its previous key, SaveStackTrace takes care of replacing it.
+  base::subtle::Atomic32 entry_key = base::subtle::Acquire_CompareAndSwap(
+      &tombstone->key, tombstone_key, wanted_key);
+  if (entry_key == tombstone_key || entry_key == wanted_key)
+    return tombstone;
+  return nullptr;
+}
+
+void StackCaptureCache::DropReference(ThreadState* thread_state,
+                                      common::StackCapture* stack_capture) {
+  DCHECK_NE(static_cast<ThreadState*>(nullptr), thread_state);
+  DCHECK_NE(static_cast<common::StackCapture*>(nullptr), stack_capture);
+
+  if (!RemoveRefAtomic(stack_capture))
+    return;
+
+  // Unlink the stack capture from the known stacks as we're going to reclaim
+  // it. This fails if it has already been replaced by a thread saving the
+  // same stack, or if it never was in the table.
+  KnownStack* known_stack = FindKnownStack(
+      GetKnownStackKey(stack_capture->absolute_stack_id()), false);
+  if (known_stack != nullptr) {
+    base::subtle::NoBarrier_CompareAndSwap(
+        &known_stack->stack,
+        reinterpret_cast<base::subtle::AtomicWord>(stack_capture), 0);
+  }
+
+  // Update the statistics. This must come before the reclaiming, as we modify
+  // the |num_frames| parameter in place.
+  if (compression_reporting_period_ != 0) {
+    --thread_state->statistics.cached;
+    // The frames in this stack capture are no longer alive.
+    thread_state->statistics.frames_alive -= stack_capture->num_frames();
+  }
+
+  // Stack captures too small to be linked into a reclaimed list are simply
+  // abandoned.
+  if (AddStackCaptureToReclaimedList(thread_state, stack_capture) &&
+      compression_reporting_period_ != 0) {
+    ++thread_state->statistics.unreferenced;
+  }
 }
 
-common::StackCapture* StackCaptureCache::GetStackCapture(size_t num_frames) {
-  common::StackCapture* stack_capture = nullptr;
+common::StackCapture* StackCaptureCache::GetStackCapture(
+    ThreadState* thread_state, size_t num_frames) {
+  DCHECK_NE(static_cast<ThreadState*>(nullptr), thread_state);
 
   // First look to the reclaimed stacks and try to use one of those. We'll use
   // the first one that's big enough.
   for (size_t n = num_frames; n <= max_num_frames_; ++n) {
-    base::AutoLock lock(reclaimed_locks_[n]);
-    if (reclaimed_[n] != nullptr) {
-      common::StackCapture* reclaimed_stack_capture = reclaimed_[n];
-      common::StackCapture** link =
-          GetFirstFrameAsLink(reclaimed_stack_capture);
-      reclaimed_[n] = *link;
-      stack_capture = reclaimed_stack_capture;
-      break;
-    }
-  }
-
-  if (stack_capture != nullptr) {
+    PSLIST_ENTRY entry = ::InterlockedPopEntrySList(&reclaimed_[n]);
+    if (entry == nullptr)
+      continue;
+
+    common::StackCapture* stack_capture =
+        reinterpret_cast<ReclaimedStackCapture*>(entry)->stack_capture;
+    DCHECK_EQ(n, stack_capture->max_num_frames());
+    DCHECK(stack_capture->HasNoRefs());
     if (compression_reporting_period_ != 0) {
-      base::AutoLock stats_lock(stats_lock_);
       // These frames are no longer dead, but in limbo. If the stack capture
       // is used they'll be added to frames_alive and frames_stored.
-      statistics_.frames_dead -= stack_capture->max_num_frames();
+      thread_state->statistics.frames_dead -= stack_capture->max_num_frames();
     }
     return stack_capture;
   }
 
-  common::StackCapture* unused_stack_capture = nullptr;
-  {
-    base::AutoLock current_page_lock(current_page_lock_);
-
-    // We didn't find a reusable stack capture. Go to the cache page.
-    stack_capture = current_page_->GetNextStackCapture(num_frames);
-
-    if (stack_capture != nullptr)
-      return stack_capture;
-
-    // If the allocation failed we don't have enough room on the current page.
-
+  // We didn't find a reusable stack capture. Go to the chunk of this thread.
+  size_t size = common::StackCapture::GetSize(num_frames);
+  size_t bytes_left = thread_state->chunk_end - thread_state->chunk_cursor;
+  if (size > bytes_left) {
     // Use the remaining bytes to create one more maximally sized stack
     // capture. We will stuff this into the reclaimed_ structure for later
     // use.
-    size_t bytes_left = current_page_->bytes_left();
     size_t max_num_frames = common::StackCapture::GetMaxNumFrames(bytes_left);
     if (max_num_frames > 0) {
       DCHECK_LT(max_num_frames, num_frames);
-      DCHECK_LE(common::StackCapture::GetSize(max_num_frames), bytes_left);
-      unused_stack_capture =
-          current_page_->GetNextStackCapture(max_num_frames);
-      DCHECK_NE(static_cast<common::StackCapture*>(nullptr),
-                unused_stack_capture);
+      common::StackCapture* unused_stack_capture = new(
+          thread_state->chunk_cursor) common::StackCapture(max_num_frames);
+      // We're creating an unreferenced stack capture.
+      if (AddStackCaptureToReclaimedList(thread_state, unused_stack_capture) &&
+          compression_reporting_period_ != 0) {
+        ++thread_state->statistics.unreferenced;
+      }
     }
 
-    // Allocate a new page (that links to the current page) and use it to
-    // allocate a new stack capture.
-    AllocateCachePage();
-    CHECK_NE(static_cast<CachePage*>(nullptr), current_page_);
-    statistics_.size += sizeof(CachePage);
-    stack_capture = current_page_->GetNextStackCapture(num_frames);
-  }
-
-  if (unused_stack_capture != nullptr) {
-    // We're creating an unreferenced stack capture.
-    AddStackCaptureToReclaimedList(unused_stack_capture);
-  }
-
-  // Update the statistics.
-  if (compression_reporting_period_ != 0) {
-    base::AutoLock stats_lock(stats_lock_);
-    ++statistics_.unreferenced;
+    size_t chunk_size = 0;
+    thread_state->chunk_cursor = AllocateChunk(size, kChunkSize, &chunk_size);
+    thread_state->chunk_end = thread_state->chunk_cursor + chunk_size;
   }
 
-  DCHECK_NE(static_cast<common::StackCapture*>(nullptr), stack_capture);
+  common::StackCapture* stack_capture =
+      new(thread_state->chunk_cursor) common::StackCapture(num_frames);
+  thread_state->chunk_cursor += size;
   return stack_capture;
 }
 
-namespace {
-
-class PrivateStackCapture : public common::StackCapture {
- public:
-  // Expose the actual number of frames. We use this to make reclaimed
-  // stack captures look invalid when they're in a free list.
-  using common::StackCapture::num_frames_;
-};
-
-}
-
-void StackCaptureCache::AddStackCaptureToReclaimedList(
-    common::StackCapture* stack_capture) {
+bool StackCaptureCache::AddStackCaptureToReclaimedList(
+    ThreadState* thread_state, common::StackCapture* stack_capture) {
+  DCHECK_NE(static_cast<ThreadState*>(nullptr), thread_state);
   DCHECK_NE(static_cast<common::StackCapture*>(nullptr), stack_capture);
+  DCHECK(stack_capture->HasNoRefs());
+
+  ReclaimedStackCapture* reclaimed = GetFramesAsReclaimedEntry(stack_capture);
+  if (reclaimed == nullptr)
+    return false;
 
   // Make the stack capture internally inconsistent so that it can't be
   // interpreted as being valid. This is rewritten upon reuse so not
@@ -506,20 +747,14 @@ void StackCaptureCache::AddStackCaptureToReclaimedList(
   reinterpret_cast<PrivateStackCapture*>(stack_capture)->num_frames_ =
       UINT8_MAX;
 
-  {
-    base::AutoLock lock(reclaimed_locks_[stack_capture->max_num_frames()]);
-
-    common::StackCapture** link = GetFirstFrameAsLink(stack_capture);
-    size_t num_frames = stack_capture->max_num_frames();
-    *link = reclaimed_[num_frames];
-    reclaimed_[num_frames] = stack_capture;
-  }
-
   // Update the statistics.
-  if (compression_reporting_period_ != 0) {
-    base::AutoLock stats_lock(stats_lock_);
-    statistics_.frames_dead += stack_capture->max_num_frames();
-  }
+  if (compression_reporting_period_ != 0)
+    thread_state->statistics.frames_dead += stack_capture->max_num_frames();
+
+  reclaimed->stack_capture = stack_capture;
+  ::InterlockedPushEntrySList(&reclaimed_[stack_capture->max_num_frames()],
+                              &reclaimed->entry);
+  return true;
 }
 
 }  // namespace asan
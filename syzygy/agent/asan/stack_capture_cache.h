@@ -15,8 +15,9 @@
 #ifndef SYZYGY_AGENT_ASAN_STACK_CAPTURE_CACHE_H_
 #define SYZYGY_AGENT_ASAN_STACK_CAPTURE_CACHE_H_
 
-#include <unordered_map>
+#include <windows.h>
 
+#include "base/atomicops.h"
 #include "base/observer_list.h"
 #include "base/synchronization/lock.h"
 #include "syzygy/agent/asan/shadow.h"
@@ -31,6 +32,12 @@ class AsanLogger;
 class MemoryNotifierInterface;
 
 // A class which manages a thread-safe cache of unique stack traces, by ID.
+//
+// The cache is lock-free on its hot paths. The known stacks are stored in an
+// open-addressing table keyed on the stack ID, the reference counts of the
+// stack captures are updated atomically, and each thread carves its stack
+// captures and accumulates its statistics in a state of its own. The only
+// lock is taken when a new cache page has to be allocated.
 class StackCaptureCache {
  public:
   // The size of a page of stack captures, in bytes. This should be in the
@@ -110,6 +117,11 @@ class StackCaptureCache {
   // safe.
   void LogStatistics();
 
+  // Gives the state associated with the calling thread back to the cache so
+  // that it can be reused by another thread. This is to be called when a
+  // thread exits.
+  void ReleaseThreadState();
+
   // Checks if a StackCapture pointer seems to be valid. This only ensure that
   // it point into a CachePage.
   // @param stack_capture The pointer that we want to check.
@@ -130,9 +142,20 @@ class StackCaptureCache {
   void RemoveObserver(Observer* obs);
 
  protected:
-  // The container type in which we store the cached stacks. This enforces
-  // uniqueness based on their hash value, nothing more.
-  typedef std::unordered_map<StackId, common::StackCapture*> StackMap;
+  // An entry of the known stacks table. An entry is claimed for a given key
+  // the first time a stack with this key is saved and is never unclaimed,
+  // which allows lookups to proceed without locks. The stack capture of an
+  // entry comes and goes as the stacks with this key are cached and reclaimed.
+  // An entry without a stack capture is a tombstone, which is handed over to
+  // another key if that key finds no other room in the table. A stack capture
+  // must hence always be checked against its key after being referenced.
+  struct KnownStack {
+    // The key of this entry, or 0 if it's unclaimed. See GetKnownStackKey.
+    base::subtle::Atomic32 key;
+    // The cached stack capture, or nullptr if there is none. This is a
+    // common::StackCapture*.
+    base::subtle::AtomicWord stack;
+  };
 
   // Used for shuttling around statistics about this cache.
   struct Statistics {
@@ -159,6 +182,9 @@ class StackCaptureCache {
     // necessarily the same as |cached| as the stack cache can reclaim
     // unreferenced stacks.
     uint64_t allocated;
+    // The total number of stacks that couldn't be stored in the known stacks
+    // table, and hence weren't deduplicated.
+    uint64_t uncached;
     // The total number of active references to stack captures.
     uint64_t references;
     // @}
@@ -178,73 +204,140 @@ class StackCaptureCache {
     // @}
   };
 
-  // Allocates a CachePage.
+  // The state of the cache that is private to a thread. The states are never
+  // freed, they are recycled when their thread exits.
+  struct DECLSPEC_ALIGN(MEMORY_ALLOCATION_ALIGNMENT) ThreadState {
+    // Links this state into |free_thread_states_| while no thread owns it.
+    SLIST_ENTRY free_entry;
+    // The next state in the list of all the states. This is immutable once the
+    // state has been linked into |thread_states_|.
+    ThreadState* next;
+    // The cache page memory from which the owning thread carves its stack
+    // captures.
+    uint8_t* chunk_cursor;
+    uint8_t* chunk_end;
+    // The updates made by the owning thread to the cache statistics. A single
+    // thread's counters can wrap around, but summing them over all the states
+    // always yields the actual values.
+    Statistics statistics;
+  };
+
+  // The number of entries in the known stacks table. This must be a power of
+  // two.
+  static const size_t kKnownStacksTableSize = 1 << 18;
+
+  // The maximum number of entries that are probed when looking for a key.
+  // Stacks whose key can't be found or given an entry within this many
+  // entries are not deduplicated.
+  static const size_t kMaxKnownStackProbeCount = 64;
+
+  // The size of the chunks of cache page memory handed out to the threads.
+  static const size_t kChunkSize = 16 * 1024;
+
+  // Allocates a CachePage. Must be called under current_page_lock_.
   void AllocateCachePage();
 
-  // Gets the current cache statistics. This must be called under lock_.
+  // @returns the current page.
+  CachePage* GetCurrentPage() const;
+
+  // Gets a chunk of memory from the current page, allocating a new page if
+  // necessary.
+  // @param min_size The minimum size of the chunk.
+  // @param max_size The maximum size of the chunk.
+  // @param chunk_size Will receive the size of the chunk.
+  // @returns the chunk.
+  uint8_t* AllocateChunk(size_t min_size, size_t max_size, size_t* chunk_size);
+
+  // @returns the state of the calling thread, creating one if necessary.
+  ThreadState* GetThreadState();
+
+  // Gets the current cache statistics by summing the updates made by all the
+  // threads. The result is only approximate while other threads are using the
+  // cache.
   // @param statistics Will be populated with current cache statistics.
-  void GetStatisticsUnlocked(Statistics* statistics) const;
+  void GetStatistics(Statistics* statistics) const;
 
   // Implementation function for logging statistics.
   // @param report The statistics to be reported.
   void LogStatisticsImpl(const Statistics& statistics) const;
 
-  // Grabs a temporary StackCapture from reclaimed_ or the current CachePage.
-  // Must be called under lock_. Takes care of updating frames_dead.
+  // @returns the key under which stacks with the given ID are stored in the
+  //     known stacks table.
+  static StackId GetKnownStackKey(StackId stack_id) {
+    // 0 marks the unclaimed entries, so the stacks with this ID share the
+    // entry of another ID. This is no different from a hash collision.
+    return stack_id != 0 ? stack_id : 1;
+  }
+
+  // Looks up the known stacks table entry of a key.
+  // @param key The key to look for.
+  // @param claim If true, an unclaimed entry or a tombstone is claimed for the
+  //     key if it isn't already in the table.
+  // @returns the entry, or nullptr if there is none.
+  KnownStack* FindKnownStack(StackId key, bool claim);
+
+  // Drops a reference to a stack capture. If this was the last reference the
+  // stack capture is unlinked from the known stacks table and reclaimed.
+  // @param thread_state The state of the calling thread.
+  // @param stack_capture The stack capture to dereference.
+  void DropReference(ThreadState* thread_state,
+                     common::StackCapture* stack_capture);
+
+  // Grabs a temporary StackCapture from reclaimed_ or from the chunk of the
+  // calling thread. Takes care of updating frames_dead.
+  // @param thread_state The state of the calling thread.
   // @param num_frames The minimum number of frames that are required.
-  common::StackCapture* GetStackCapture(size_t num_frames);
+  common::StackCapture* GetStackCapture(ThreadState* thread_state,
+                                        size_t num_frames);
 
-  // Links a stack capture into the reclaimed_ list. Meant to be called by
-  // ReturnStackCapture only. Must be called under lock_. Takes care of
-  // updating frames_dead (on behalf of ReturnStackCapture).
+  // Links a stack capture into the reclaimed_ list. Takes care of updating
+  // frames_dead.
+  // @param thread_state The state of the calling thread.
   // @param stack_capture The stack capture to be linked into reclaimed_.
-  void AddStackCaptureToReclaimedList(common::StackCapture* stack_capture);
-
-  // The default number of known stacks sets that we keep.
-  static const size_t kKnownStacksSharding = 16;
+  // @returns true if the stack capture has been reclaimed, false if it is too
+  //     small to be linked into a list.
+  bool AddStackCaptureToReclaimedList(ThreadState* thread_state,
+                                      common::StackCapture* stack_capture);
 
   // The number of allocations between reports of the stack trace cache
   // compression ratio. Zero (0) means do not report. Values like 1 million
-  // seem to be pretty good with Chrome.
+  // seem to be pretty good with Chrome. The reports are triggered by the
+  // number of requests made by each thread.
   static size_t compression_reporting_period_;
 
+  // StackCaptures that have been reclaimed for reuse are stored in interlocked
+  // lists according to their length. The list entry is stored in the frames
+  // of the stack capture.
+  SLIST_HEADER reclaimed_[common::StackCapture::kMaxNumFrames + 1];
+
+  // The states that aren't owned by a thread.
+  SLIST_HEADER free_thread_states_;
+
   // Logger instance to which to report the compression ratio.
   AsanLogger* const logger_;
 
   // The memory notifier that is informed of allocations made by the cache.
   MemoryNotifierInterface* memory_notifier_;
 
-  // Locks to protect the known stacks sets from concurrent access.
-  mutable base::Lock known_stacks_locks_[kKnownStacksSharding];
-
   // The max depth of the stack traces to allocate. This can change, but it
   // doesn't really make sense to do so.
   size_t max_num_frames_;
 
-  // The maps of known stacks. Accessed under known_stacks_locks_.
-  StackMap known_stacks_[kKnownStacksSharding];
+  // The table of known stacks. This has kKnownStacksTableSize entries.
+  KnownStack* known_stacks_;
 
-  // A lock protecting access to current_page_.
+  // A lock serializing the allocation of the cache pages.
   base::Lock current_page_lock_;
 
-  // The current page from which new stack captures are allocated.
-  // Accessed under current_page_lock_.
-  CachePage* current_page_;
-
-  // A lock protecting access to statistics_.
-  mutable base::Lock stats_lock_;
+  // The current page from which the chunks are allocated. This is a
+  // CachePage*, and it only changes under current_page_lock_.
+  base::subtle::AtomicWord current_page_;
 
-  // Aggregate statistics about the cache. Accessed under stats_lock_.
-  Statistics statistics_;
+  // A TLS slot containing the state of the current thread.
+  DWORD thread_state_tls_;
 
-  // Locks to protect each reclaimed list from concurrent access.
-  base::Lock reclaimed_locks_[common::StackCapture::kMaxNumFrames + 1];
-
-  // StackCaptures that have been reclaimed for reuse are stored in a link list
-  // according to their length. We reuse the first frame in the stack capture
-  // as a pointer to the next StackCapture of that size, if there is one.
-  // Accessed under reclaimed_locks_.
-  common::StackCapture* reclaimed_[common::StackCapture::kMaxNumFrames + 1];
+  // The head of the list of all the thread states. This is a ThreadState*.
+  base::subtle::AtomicWord thread_states_;
 
   // The list of observers.
   base::ObserverList<Observer> observer_list_;
@@ -262,33 +355,22 @@ class StackCaptureCache::CachePage {
   // @param alloc The allocation to use. Must be the appropriate size.
   static CachePage* CreateInPlace(void* alloc, CachePage* link);
 
-  // Allocates a stack capture from this cache page if possible.
-  // @param max_num_frames The maximum number of frames the object needs to be
-  //     able to store.
-  // @param metadata_size The number of bytes to reserve for metadata. These
-  //     bytes will be reserved *after* the StackCapture object and zero
-  //     initialized. Defaults to zero if not provided.
-  // @returns a new StackCapture, or nullptr if the page is full.
-  common::StackCapture* GetNextStackCapture(size_t max_num_frames,
-                                            size_t metadata_size);
-  common::StackCapture* GetNextStackCapture(size_t max_num_frames);
-
-  // Returns the most recently allocated stack capture back to the page.
-  // @param stack_capture The stack capture to return.
-  // @param metadata_size The number of bytes of metadata that was also
-  //     allocated.
-  // @returns false if the provided stack capture was not the most recently
-  //     allocated one, true otherwise.
-  bool ReturnStackCapture(common::StackCapture* stack_capture,
-                          size_t metadata_size);
-  bool ReturnStackCapture(common::StackCapture* stack_capture);
+  // Carves a chunk of memory out of this page. This is thread-safe.
+  // @param min_size The minimum size of the chunk.
+  // @param max_size The maximum size of the chunk.
+  // @param chunk_size Will receive the size of the chunk. This is a multiple
+  //     of MEMORY_ALLOCATION_ALIGNMENT.
+  // @returns the chunk, or nullptr if less than |min_size| bytes are left.
+  uint8_t* AllocateChunk(size_t min_size, size_t max_size, size_t* chunk_size);
 
   // @returns the number of bytes used in this page. This is mainly a hook
   //     for unittesting.
-  size_t bytes_used() const { return bytes_used_; }
+  size_t bytes_used() const {
+    return static_cast<size_t>(base::subtle::NoBarrier_Load(&bytes_used_));
+  }
 
   // @returns the number of bytes left in this page.
-  size_t bytes_left() const { return kDataSize - bytes_used_; }
+  size_t bytes_left() const { return kDataSize - bytes_used(); }
 
   // @returns a pointer to the beginning of the stack captures.
   uint8_t* data() { return data_; }
@@ -312,14 +394,14 @@ class StackCaptureCache::CachePage {
   CachePage* next_page_;
 
   // The number of bytes used, also equal to the byte offset of the next
-  // StackCapture object to be allocated.
-  size_t bytes_used_;
+  // chunk to be allocated. This is updated atomically.
+  base::subtle::AtomicWord bytes_used_;
 
   // A page's worth of data, which will be allocated as StackCapture objects.
   // NOTE: Using offsetof would be ideal, but we can't do that on an incomplete
   //       type. Thus, this needs to be maintained.
   static const size_t kDataSize = kCachePageSize - sizeof(CachePage*)
-      - sizeof(size_t);
+      - sizeof(base::subtle::AtomicWord);
   static_assert(kDataSize < kCachePageSize,
                 "kCachePageSize must be big enough for CachePage header.");
   uint8_t data_[kDataSize];
@@ -14,10 +14,17 @@
 
 #include "syzygy/agent/asan/stack_capture_cache.h"
 
+#include <deque>
 #include <memory>
+#include <vector>
+
+#include "base/synchronization/lock.h"
+#include "base/threading/platform_thread.h"
+#include "base/threading/simple_thread.h"
 #include "gtest/gtest.h"
 #include "syzygy/agent/asan/logger.h"
 #include "syzygy/agent/asan/memory_notifiers/null_memory_notifier.h"
+#include "syzygy/common/align.h"
 #include "testing/gmock/include/gmock/gmock.h"
 
 namespace agent {
@@ -43,18 +50,15 @@ class TestStackCaptureCache : public StackCaptureCache {
       : StackCaptureCache(logger, &null_memory_notifier, max_num_frames) {
   }
 
+  using StackCaptureCache::KnownStack;
   using StackCaptureCache::Statistics;
+  using StackCaptureCache::FindKnownStack;
+  using StackCaptureCache::GetKnownStackKey;
+  using StackCaptureCache::GetStatistics;
+  using StackCaptureCache::kKnownStacksTableSize;
+  using StackCaptureCache::kMaxKnownStackProbeCount;
 
-  void GetStatistics(Statistics* s) {
-    DCHECK(s != NULL);
-    base::AutoLock auto_lock(stats_lock_);
-    GetStatisticsUnlocked(s);
-  }
-
-  CachePage* current_page() { return current_page_; }
-
- private:
-  using StackCaptureCache::current_page_;
+  CachePage* current_page() { return GetCurrentPage(); }
 };
 
 class StackCaptureCacheTest : public testing::Test {
@@ -73,44 +77,179 @@ class TestStackCaptureCacheObserver : public StackCaptureCache::Observer {
   MOCK_METHOD1(OnNewStack, void(common::StackCapture* new_stack));
 };
 
+// Repeatedly saves and releases stacks drawn from a small set, so that the
+// threads running it keep caching, sharing and reclaiming the same stacks.
+class SaveAndReleaseRunner : public base::DelegateSimpleThread::Delegate {
+ public:
+  static const size_t kStackCount = 64;
+  static const size_t kHeldStackCount = 16;
+
+  SaveAndReleaseRunner(StackCaptureCache* cache, size_t seed,
+                       size_t iterations)
+      : cache_(cache), seed_(seed), iterations_(iterations) {}
+
+  void Run() override {
+    void* frames[8] = {};
+    const StackCapture* held[kHeldStackCount] = {};
+    for (size_t i = 0; i < iterations_; ++i) {
+      size_t stack_index = (seed_ * 7 + i * 13) % kStackCount;
+      frames[0] = reinterpret_cast<void*>(stack_index + 1);
+      StackCapture stack;
+      stack.InitFromBuffer(frames, arraysize(frames));
+
+      size_t slot = i % kHeldStackCount;
+      if (held[slot] != nullptr)
+        cache_->ReleaseStackTrace(held[slot]);
+      held[slot] = cache_->SaveStackTrace(stack);
+
+      // The saved stack must be the requested one, even if it was concurrently
+      // reclaimed and reused by another thread.
+      EXPECT_EQ(stack.absolute_stack_id(), held[slot]->absolute_stack_id());
+      EXPECT_EQ(frames[0], held[slot]->frames()[0]);
+    }
+    for (size_t i = 0; i < kHeldStackCount; ++i) {
+      if (held[i] != nullptr)
+        cache_->ReleaseStackTrace(held[i]);
+    }
+    cache_->ReleaseThreadState();
+  }
+
+ private:
+  StackCaptureCache* cache_;
+  size_t seed_;
+  size_t iterations_;
+
+  DISALLOW_COPY_AND_ASSIGN(SaveAndReleaseRunner);
+};
+
+// The references to a single stack, handed over from the threads saving it to
+// the threads releasing it.
+struct HandedOverStacks {
+  // The number of references that can be pending at once. This is kept low so
+  // that the stack keeps being reclaimed and cached again.
+  static const size_t kMaxPendingCount = 4;
+
+  HandedOverStacks() : savers_running(0) {}
+
+  base::Lock lock;
+  std::deque<const StackCapture*> pending;  // Under lock.
+  size_t savers_running;  // Under lock.
+};
+
+// Saves the same stack over and over and hands the references over to the
+// releasing threads, or releases the references handed over by the saving
+// threads. Every reference is checked to still refer to the saved stack.
+class SameStackRunner : public base::DelegateSimpleThread::Delegate {
+ public:
+  SameStackRunner(StackCaptureCache* cache, HandedOverStacks* stacks,
+                  size_t iterations, bool save)
+      : cache_(cache), stacks_(stacks), iterations_(iterations), save_(save) {
+    void* frames[8] = {};
+    frames[0] = reinterpret_cast<void*>(1);
+    stack_.InitFromBuffer(frames, arraysize(frames));
+  }
+
+  void Run() override {
+    if (save_) {
+      for (size_t i = 0; i < iterations_; ++i) {
+        const StackCapture* saved = cache_->SaveStackTrace(stack_);
+        ExpectSavedStack(saved);
+        while (!HandOver(saved))
+          base::PlatformThread::YieldCurrentThread();
+      }
+      base::AutoLock lock(stacks_->lock);
+      --stacks_->savers_running;
+    } else {
+      while (true) {
+        const StackCapture* saved = nullptr;
+        {
+          base::AutoLock lock(stacks_->lock);
+          if (stacks_->pending.empty() && stacks_->savers_running == 0)
+            break;
+          if (!stacks_->pending.empty()) {
+            saved = stacks_->pending.front();
+            stacks_->pending.pop_front();
+          }
+        }
+        if (saved == nullptr) {
+          base::PlatformThread::YieldCurrentThread();
+          continue;
+        }
+        ExpectSavedStack(saved);
+        cache_->ReleaseStackTrace(saved);
+      }
+    }
+    cache_->ReleaseThreadState();
+  }
+
+ private:
+  // A stack capture that got reclaimed while referenced is either marked as
+  // invalid or reused for another stack.
+  void ExpectSavedStack(const StackCapture* saved) {
+    EXPECT_EQ(stack_.num_frames(), saved->num_frames());
+    EXPECT_EQ(stack_.absolute_stack_id(), saved->absolute_stack_id());
+    EXPECT_EQ(stack_.frames()[0], saved->frames()[0]);
+  }
+
+  bool HandOver(const StackCapture* saved) {
+    base::AutoLock lock(stacks_->lock);
+    if (stacks_->pending.size() >= HandedOverStacks::kMaxPendingCount)
+      return false;
+    stacks_->pending.push_back(saved);
+    return true;
+  }
+
+  StackCaptureCache* cache_;
+  HandedOverStacks* stacks_;
+  size_t iterations_;
+  bool save_;
+  StackCapture stack_;
+
+  DISALLOW_COPY_AND_ASSIGN(SameStackRunner);
+};
+
 }  // namespace
 
 TEST_F(StackCaptureCacheTest, CachePageTest) {
-  static const size_t kFrameCounts[] =
-      { 5, 10, 30, StackCapture::kMaxNumFrames };
+  static const size_t kChunkSizes[] = { 16, 100, 4096, 16 * 1024 };
 
   void* alloc = ::VirtualAlloc(nullptr,
         sizeof(TestStackCaptureCache::CachePage), MEM_COMMIT, PAGE_READWRITE);
 
-  for (size_t i = 0; i < arraysize(kFrameCounts); ++i) {
-    size_t max_num_frames = kFrameCounts[i];
+  for (size_t i = 0; i < arraysize(kChunkSizes); ++i) {
+    size_t chunk_size = kChunkSizes[i];
+    size_t aligned_chunk_size =
+        ::common::AlignUp(chunk_size, MEMORY_ALLOCATION_ALIGNMENT);
     TestStackCaptureCache::CachePage* page =
         TestStackCaptureCache::CachePage::CreateInPlace(alloc, nullptr);
 
-    // Ensure that returning a stack to a page works.
-    EXPECT_EQ(0u, page->bytes_used());
-    StackCapture* s1 = page->GetNextStackCapture(max_num_frames);
-    ASSERT_TRUE(s1 != NULL);
-    EXPECT_EQ(max_num_frames, s1->max_num_frames());
-    EXPECT_EQ(s1->Size(), page->bytes_used());
-    page->ReturnStackCapture(s1);
+    // The chunks are carved contiguously out of the page.
     EXPECT_EQ(0u, page->bytes_used());
-
-    // Reallocating should get us the same page as the one we just returned.
-    StackCapture* s2 = page->GetNextStackCapture(max_num_frames);
-    EXPECT_EQ(s1, s2);
-
-    // Figure out how many more allocations the page should give us.
-    size_t bytes_left = page->bytes_left();
-    size_t allocations_left = bytes_left / s2->Size();
-
-    // Ensure we get exactly that many.
-    for (size_t j = 0; j < allocations_left; ++j) {
-      EXPECT_TRUE(page->GetNextStackCapture(max_num_frames) != NULL);
-    }
+    size_t size = 0;
+    uint8_t* c1 = page->AllocateChunk(chunk_size, chunk_size, &size);
+    ASSERT_TRUE(c1 != nullptr);
+    EXPECT_EQ(page->data(), c1);
+    EXPECT_EQ(aligned_chunk_size, size);
+    EXPECT_EQ(aligned_chunk_size, page->bytes_used());
+    EXPECT_TRUE(::common::IsAligned(c1, MEMORY_ALLOCATION_ALIGNMENT));
+
+    uint8_t* c2 = page->AllocateChunk(chunk_size, chunk_size, &size);
+    ASSERT_TRUE(c2 != nullptr);
+    EXPECT_EQ(c1 + aligned_chunk_size, c2);
+
+    // Exhaust the page.
+    while (page->bytes_left() >= 2 * aligned_chunk_size)
+      EXPECT_TRUE(page->AllocateChunk(chunk_size, chunk_size, &size) != NULL);
+
+    // The last chunk may be smaller than the maximum size.
+    size_t bytes_left = ::common::AlignDown(page->bytes_left(),
+                                            MEMORY_ALLOCATION_ALIGNMENT);
+    EXPECT_TRUE(page->AllocateChunk(
+        chunk_size, 2 * aligned_chunk_size, &size) != NULL);
+    EXPECT_EQ(bytes_left, size);
 
     // And no more than that.
-    EXPECT_TRUE(page->GetNextStackCapture(max_num_frames) == NULL);
+    EXPECT_TRUE(page->AllocateChunk(chunk_size, chunk_size, &size) == NULL);
   }
 
   ::VirtualFree(alloc, 0, MEM_RELEASE);
@@ -220,6 +359,7 @@ TEST_F(StackCaptureCacheTest, Statistics) {
   EXPECT_EQ(0u, s.unreferenced);
   EXPECT_EQ(0u, s.requested);
   EXPECT_EQ(0u, s.allocated);
+  EXPECT_EQ(0u, s.uncached);
   EXPECT_EQ(0u, s.references);
   EXPECT_EQ(0u, s.frames_stored);
   EXPECT_EQ(0u, s.frames_alive);
@@ -421,6 +561,67 @@ TEST_F(StackCaptureCacheTest, AllocateMultiplePages) {
   EXPECT_NE(page, cache.current_page());
 }
 
+TEST_F(StackCaptureCacheTest, KnownStackTombstonesAreReused) {
+  AsanLogger logger;
+  TestStackCaptureCache cache(&logger);
+  cache.set_compression_reporting_period(1U);
+
+  void* frames[8] = {};
+  frames[0] = reinterpret_cast<void*>(0x1234);
+  StackCapture stack;
+  stack.InitFromBuffer(frames, arraysize(frames));
+  StackCaptureCache::StackId key =
+      TestStackCaptureCache::GetKnownStackKey(stack.absolute_stack_id());
+
+  // @returns the |i|th other key that uses the same entries as |key|.
+  auto other_key = [key](size_t i) {
+    return static_cast<StackCaptureCache::StackId>(
+        key + i * TestStackCaptureCache::kKnownStacksTableSize);
+  };
+
+  // Give all the entries that this stack can use to other keys, and mark them
+  // as holding a stack capture. These are never dereferenced.
+  const base::subtle::AtomicWord kDummyStack = 1;
+  std::vector<TestStackCaptureCache::KnownStack*> entries;
+  for (size_t i = 1; i <= TestStackCaptureCache::kMaxKnownStackProbeCount;
+       ++i) {
+    TestStackCaptureCache::KnownStack* entry =
+        cache.FindKnownStack(other_key(i), true);
+    ASSERT_NE(static_cast<TestStackCaptureCache::KnownStack*>(nullptr), entry);
+    base::subtle::NoBarrier_Store(&entry->stack, kDummyStack);
+    entries.push_back(entry);
+  }
+
+  // The stack can't be stored in the table, so it isn't deduplicated.
+  const StackCapture* s1 = cache.SaveStackTrace(stack);
+  const StackCapture* s2 = cache.SaveStackTrace(stack);
+  EXPECT_NE(s1, s2);
+  TestStackCaptureCache::Statistics s = {};
+  cache.GetStatistics(&s);
+  EXPECT_EQ(2u, s.uncached);
+  cache.ReleaseStackTrace(s1);
+  cache.ReleaseStackTrace(s2);
+
+  // An entry that no longer holds a stack capture is handed over.
+  const size_t kTombstone = 10;
+  base::subtle::NoBarrier_Store(&entries[kTombstone]->stack, 0);
+  s1 = cache.SaveStackTrace(stack);
+  EXPECT_EQ(s1, cache.SaveStackTrace(stack));
+  EXPECT_EQ(entries[kTombstone], cache.FindKnownStack(key, false));
+  EXPECT_EQ(static_cast<TestStackCaptureCache::KnownStack*>(nullptr),
+            cache.FindKnownStack(other_key(kTombstone + 1), false));
+  cache.GetStatistics(&s);
+  EXPECT_EQ(2u, s.uncached);
+
+  // Releasing the stack turns the entry back into a tombstone.
+  cache.ReleaseStackTrace(s1);
+  cache.ReleaseStackTrace(s1);
+  EXPECT_EQ(0, base::subtle::NoBarrier_Load(&entries[kTombstone]->stack));
+
+  for (auto entry : entries)
+    base::subtle::NoBarrier_Store(&entry->stack, 0);
+}
+
 TEST_F(StackCaptureCacheTest, EmptyStackCapture) {
   AsanLogger logger;
   TestStackCaptureCache cache(&logger);
@@ -436,5 +637,113 @@ TEST_F(StackCaptureCacheTest, EmptyStackCapture) {
   cache.ReleaseStackTrace(saved_stack2);
 }
 
+TEST_F(StackCaptureCacheTest, ConcurrentSaveAndRelease) {
+  static const size_t kThreadCount = 8;
+  static const size_t kIterations = 100000;
+
+  AsanLogger logger;
+  TestStackCaptureCache cache(&logger);
+  cache.set_compression_reporting_period(0U);
+
+  std::vector<std::unique_ptr<SaveAndReleaseRunner>> runners;
+  std::vector<std::unique_ptr<base::DelegateSimpleThread>> threads;
+  for (size_t i = 0; i < kThreadCount; ++i) {
+    runners.push_back(std::unique_ptr<SaveAndReleaseRunner>(
+        new SaveAndReleaseRunner(&cache, i, kIterations)));
+    threads.push_back(std::unique_ptr<base::DelegateSimpleThread>(
+        new base::DelegateSimpleThread(runners.back().get(),
+                                       "StackCaptureCacheTest")));
+  }
+  for (const auto& thread : threads)
+    thread->Start();
+  for (const auto& thread : threads)
+    thread->Join();
+
+  // Every stack has been released, so saving one of them again must yield a
+  // fresh reference.
+  void* frames[8] = {};
+  frames[0] = reinterpret_cast<void*>(1);
+  StackCapture stack;
+  stack.InitFromBuffer(frames, arraysize(frames));
+  const StackCapture* s1 = cache.SaveStackTrace(stack);
+  EXPECT_EQ(1u, s1->ref_count());
+  EXPECT_EQ(s1, cache.SaveStackTrace(stack));
+  EXPECT_EQ(2u, s1->ref_count());
+  cache.ReleaseStackTrace(s1);
+  cache.ReleaseStackTrace(s1);
+}
+
+TEST_F(StackCaptureCacheTest, ConcurrentSaveAndReleaseOfTheSameStack) {
+  static const size_t kSaverCount = 4;
+  static const size_t kReleaserCount = 4;
+  static const size_t kIterations = 100000;
+
+  AsanLogger logger;
+  TestStackCaptureCache cache(&logger);
+  cache.set_compression_reporting_period(0U);
+
+  HandedOverStacks stacks;
+  stacks.savers_running = kSaverCount;
+  std::vector<std::unique_ptr<SameStackRunner>> runners;
+  std::vector<std::unique_ptr<base::DelegateSimpleThread>> threads;
+  for (size_t i = 0; i < kSaverCount + kReleaserCount; ++i) {
+    runners.push_back(std::unique_ptr<SameStackRunner>(
+        new SameStackRunner(&cache, &stacks, kIterations, i < kSaverCount)));
+    threads.push_back(std::unique_ptr<base::DelegateSimpleThread>(
+        new base::DelegateSimpleThread(runners.back().get(),
+                                       "StackCaptureCacheTest")));
+  }
+  for (const auto& thread : threads)
+    thread->Start();
+  for (const auto& thread : threads)
+    thread->Join();
+  EXPECT_TRUE(stacks.pending.empty());
+
+  // Every reference has been released, so saving the stack again must yield a
+  // fresh reference.
+  void* frames[8] = {};
+  frames[0] = reinterpret_cast<void*>(1);
+  StackCapture stack;
+  stack.InitFromBuffer(frames, arraysize(frames));
+  const StackCapture* s1 = cache.SaveStackTrace(stack);
+  EXPECT_EQ(1u, s1->ref_count());
+  cache.ReleaseStackTrace(s1);
+}
+
+TEST_F(StackCaptureCacheTest, StatisticsAreSummedOverThreads) {
+  AsanLogger logger;
+  TestStackCaptureCache cache(&logger);
+  cache.set_compression_reporting_period(1U);
+
+  SaveAndReleaseRunner runner(&cache, 0, 1000);
+  base::DelegateSimpleThread thread(&runner, "StackCaptureCacheTest");
+  thread.Start();
+  thread.Join();
+
+  // All the work was done by another thread, which released all its
+  // references.
+  TestStackCaptureCache::Statistics s = {};
+  cache.GetStatistics(&s);
+  EXPECT_EQ(0u, s.cached);
+  EXPECT_EQ(1000u, s.requested);
+  EXPECT_EQ(0u, s.references);
+  EXPECT_EQ(0u, s.frames_stored);
+  EXPECT_EQ(0u, s.frames_alive);
+  EXPECT_LT(0u, s.unreferenced);
+  EXPECT_LT(0u, s.frames_dead);
+
+  // Releasing a reference on this thread is accounted for as well.
+  StackCapture stack;
+  stack.InitFromStack();
+  const StackCapture* s1 = cache.SaveStackTrace(stack);
+  cache.GetStatistics(&s);
+  EXPECT_EQ(1u, s.cached);
+  EXPECT_EQ(1u, s.references);
+  cache.ReleaseStackTrace(s1);
+  cache.GetStatistics(&s);
+  EXPECT_EQ(0u, s.cached);
+  EXPECT_EQ(0u, s.references);
+}
+
 }  // namespace asan
 }  // namespace agent
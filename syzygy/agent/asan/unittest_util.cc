@@ -17,6 +17,7 @@
 #include "syzygy/agent/asan/unittest_util.h"
 
 #include <algorithm>
+#include <memory>
 
 #include "base/bind.h"
 #include "base/command_line.h"
@@ -689,6 +690,72 @@ void SyzyAsanMemoryAccessorTester::CheckAccessAndCompareContexts(
 
 namespace {
 
+void CheckRangeAccessAndCaptureContexts(
+    CONTEXT* before, CONTEXT* after, void* location, size_t size) {
+  __asm {
+    pushad
+    pushfd
+
+    // Avoid undefined behavior by forcing values.
+    mov eax, 0x01234567
+    mov ebx, 0x70123456
+    mov ecx, 0x12345678
+    mov edx, 0x56701234
+    mov esi, 0xCCAACCAA
+    mov edi, 0xAACCAACC
+
+    RTL_CAPTURE_CONTEXT(before, check_range_access_expected_eip)
+
+    // Push EDX and the size of the range as we're required to do by the
+    // custom calling convention.
+    push edx
+    push size
+    // Ptr is the pointer to the start of the range to check.
+    mov edx, location
+    // Call through.
+    call dword ptr[check_access_fn + 0]
+ check_range_access_expected_eip:
+
+    RTL_CAPTURE_CONTEXT(after, check_range_access_expected_eip)
+
+    popfd
+    popad
+  }
+}
+
+}  // namespace
+
+void SyzyAsanMemoryAccessorTester::CheckRangeAccessAndCompareContexts(
+    FARPROC access_fn,
+    void* ptr,
+    size_t size) {
+  memory_error_detected_ = false;
+
+  check_access_fn = access_fn;
+
+  CheckRangeAccessAndCaptureContexts(
+      &context_before_hook_, &context_after_hook_, ptr, size);
+
+  ExpectEqualContexts(context_before_hook_, context_after_hook_, ignore_flags_);
+  if (memory_error_detected_) {
+    ExpectEqualContexts(context_before_hook_, error_context_, ignore_flags_);
+  }
+
+  check_access_fn = NULL;
+}
+
+void SyzyAsanMemoryAccessorTester::AssertRangeMemoryErrorIsDetected(
+    FARPROC access_fn,
+    void* ptr,
+    size_t size,
+    BadAccessKind bad_access_type) {
+  expected_error_type_ = bad_access_type;
+  CheckRangeAccessAndCompareContexts(access_fn, ptr, size);
+  ASSERT_TRUE(memory_error_detected_);
+}
+
+namespace {
+
 void CheckSpecialAccess(CONTEXT* before, CONTEXT* after,
                         void* dst, void* src, int len) {
   __asm {
@@ -933,6 +1000,43 @@ void TestMemoryInterceptors::TestUnderrunAccessIgnoreFlags(
   }
 }
 
+void TestMemoryInterceptors::TestRangeAccess(const InterceptFunction* fns,
+                                             size_t num_fns,
+                                             bool ignore_flags) {
+  for (size_t i = 0; i < num_fns; ++i) {
+    const InterceptFunction& fn = fns[i];
+
+    std::unique_ptr<SyzyAsanMemoryAccessorTester> tester;
+    if (ignore_flags) {
+      tester.reset(new SyzyAsanMemoryAccessorTester(
+          SyzyAsanMemoryAccessorTester::IGNORE_FLAGS));
+    } else {
+      tester.reset(new SyzyAsanMemoryAccessorTester());
+    }
+
+    // The whole allocation, and an unaligned range inside of it.
+    tester->CheckRangeAccessAndCompareContexts(
+        reinterpret_cast<FARPROC>(fn.function), src_, kAllocSize);
+    ASSERT_FALSE(tester->memory_error_detected());
+    tester->CheckRangeAccessAndCompareContexts(
+        reinterpret_cast<FARPROC>(fn.function), src_ + 3, 13);
+    ASSERT_FALSE(tester->memory_error_detected());
+
+    // A range that starts inside of the allocation and ends beyond it. This
+    // is reported at the first byte past the allocation.
+    tester->AssertRangeMemoryErrorIsDetected(
+        reinterpret_cast<FARPROC>(fn.function), src_ + kAllocSize - 4, 8,
+        MemoryAccessorTester::BadAccessKind::HEAP_BUFFER_OVERFLOW);
+    EXPECT_EQ(src_ + kAllocSize, tester->last_error_info().location);
+
+    // A range that starts before the allocation.
+    tester->AssertRangeMemoryErrorIsDetected(
+        reinterpret_cast<FARPROC>(fn.function), src_ - 8, 12,
+        MemoryAccessorTester::BadAccessKind::HEAP_BUFFER_UNDERFLOW);
+    EXPECT_EQ(src_ - 8, tester->last_error_info().location);
+  }
+}
+
 void TestMemoryInterceptors::TestStringValidAccess(
     const StringInterceptFunction* fns, size_t num_fns) {
   for (size_t i = 0; i < num_fns; ++i) {
@@ -15,6 +15,7 @@
 #ifndef SYZYGY_AGENT_ASAN_UNITTEST_UTIL_H_
 #define SYZYGY_AGENT_ASAN_UNITTEST_UTIL_H_
 
+#include <memory>
 #include <string>
 #include <utility>
 #include <vector>
@@ -24,6 +25,7 @@
 #include "base/files/scoped_temp_dir.h"
 #include "base/memory/ref_counted.h"
 #include "base/strings/string_piece.h"
+#include "base/threading/simple_thread.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "syzygy/agent/asan/block.h"
@@ -668,6 +670,20 @@ class SyzyAsanMemoryAccessorTester : public MemoryAccessorTester {
                                    void* ptr,
                                    BadAccessKind bad_access_type) override;
 
+  // Checks that the range check @p access_fn doesn't raise exceptions on
+  // checking the @p size bytes at @p ptr, and that @p access_fn doesn't
+  // modify any registers or flags when executed.
+  void CheckRangeAccessAndCompareContexts(FARPROC access_fn,
+                                          void* ptr,
+                                          size_t size);
+
+  // Checks that the range check @p access_fn generates @p bad_access_type on
+  // checking the @p size bytes at @p ptr.
+  void AssertRangeMemoryErrorIsDetected(FARPROC access_fn,
+                                        void* ptr,
+                                        size_t size,
+                                        BadAccessKind bad_access_type);
+
   enum StringOperationDirection {
     DIRECTION_FORWARD,
     DIRECTION_BACKWARD
@@ -776,6 +792,14 @@ class TestMemoryInterceptors : public TestWithAsanLogger {
     TestUnderrunAccessIgnoreFlags(fns, N);
   }
   template <size_t N>
+  void TestRangeAccess(const InterceptFunction (&fns)[N]) {
+    TestRangeAccess(fns, N, false);
+  }
+  template <size_t N>
+  void TestRangeAccessIgnoreFlags(const InterceptFunction (&fns)[N]) {
+    TestRangeAccess(fns, N, true);
+  }
+  template <size_t N>
   void TestStringValidAccess(const StringInterceptFunction (&fns)[N]) {
     TestStringValidAccess(fns, N);
   }
@@ -808,6 +832,11 @@ class TestMemoryInterceptors : public TestWithAsanLogger {
   void TestUnderrunAccess(const InterceptFunction* fns, size_t num_fns);
   void TestUnderrunAccessIgnoreFlags(const InterceptFunction* fns,
                                      size_t num_fns);
+  // Tests valid, overrun and underrun accesses with the range checks @p fns.
+  // The size of the intercept functions is ignored.
+  void TestRangeAccess(const InterceptFunction* fns,
+                       size_t num_fns,
+                       bool ignore_flags);
   void TestStringValidAccess(
       const StringInterceptFunction* fns, size_t num_fns);
   void TestStringOverrunAccess(
@@ -859,6 +888,28 @@ bool IsAccessible(void* address);
 //     false otherwise.
 bool IsNotAccessible(void* address);
 
+// Runs each of @p delegates on its own thread, and waits for all of them to
+// complete. All the threads are started before any of them is joined, so that
+// the delegates run concurrently.
+// @tparam DelegateType The type of the delegates, which must derive from
+//     base::DelegateSimpleThread::Delegate.
+// @param delegates The delegates to run.
+// @param thread_name The name to give to the threads.
+template <typename DelegateType>
+void RunDelegatesConcurrently(
+    const std::vector<std::unique_ptr<DelegateType>>& delegates,
+    const std::string& thread_name) {
+  std::vector<std::unique_ptr<base::DelegateSimpleThread>> threads;
+  for (const auto& delegate : delegates) {
+    threads.push_back(std::unique_ptr<base::DelegateSimpleThread>(
+        new base::DelegateSimpleThread(delegate.get(), thread_name)));
+  }
+  for (const auto& thread : threads)
+    thread->Start();
+  for (const auto& thread : threads)
+    thread->Join();
+}
+
 // A scoped block access helper. Removes block protections when created via
 // BlockProtectNone, and restores them via BlockProtectAuto.
 // TODO(chrisha): Consider recording the fact the block protections on this
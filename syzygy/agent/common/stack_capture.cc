@@ -16,7 +16,12 @@
 
 #include <algorithm>
 
+#include "base/atomicops.h"
+#include "base/bind.h"
+#include "base/lazy_instance.h"
 #include "base/logging.h"
+#include "base/threading/thread_local.h"
+#include "syzygy/agent/common/dll_notifications.h"
 #include "syzygy/agent/common/stack_walker.h"
 #include "syzygy/core/address_space.h"
 
@@ -30,6 +35,68 @@ namespace common {
 size_t StackCapture::bottom_frames_to_skip_ =
     ::common::kDefaultBottomFramesToSkip;
 
+// Indicates if the stack walk cache is enabled.
+bool StackCapture::cache_stack_walks_ = false;
+
+namespace {
+
+// The number of entries of the per-thread cache of the modules containing the
+// frames. This must be a power of two.
+const size_t kModuleCacheSize = 256;
+
+// An entry of the module cache.
+struct ModuleCacheEntry {
+  // The address of a frame.
+  const void* address;
+  // The module containing |address|, or nullptr if it isn't in a module.
+  HMODULE module;
+  // The module generation at which this entry was filled.
+  base::subtle::Atomic32 generation;
+};
+
+// The caches used by a thread when capturing stacks.
+struct ThreadCache {
+  StackWalkCache stack_walk_cache;
+  ModuleCacheEntry module_cache[kModuleCacheSize];
+};
+
+base::LazyInstance<base::ThreadLocalPointer<ThreadCache>>::Leaky
+    thread_cache = LAZY_INSTANCE_INITIALIZER;
+
+// Incremented whenever a module gets loaded or unloaded, which invalidates the
+// entries of the module caches. This starts at 1 so that zero initialized
+// entries are invalid.
+base::subtle::Atomic32 module_generation = 1;
+
+// Watches the modules being loaded and unloaded while the stack walk cache is
+// enabled.
+base::LazyInstance<DllNotificationWatcher>::Leaky dll_watcher =
+    LAZY_INSTANCE_INITIALIZER;
+
+void InvalidateModuleCaches() {
+  base::subtle::Barrier_AtomicIncrement(&module_generation, 1);
+}
+
+void OnDllNotification(DllNotificationWatcher::EventType type,
+                       HMODULE module,
+                       size_t module_size,
+                       const base::StringPiece16& dll_path,
+                       const base::StringPiece16& dll_base_name) {
+  InvalidateModuleCaches();
+}
+
+// @returns the caches of the calling thread, creating them if necessary.
+ThreadCache* GetThreadCache() {
+  ThreadCache* cache = thread_cache.Get().Get();
+  if (cache == nullptr) {
+    cache = new ThreadCache();
+    thread_cache.Get().Set(cache);
+  }
+  return cache;
+}
+
+}  // namespace
+
 size_t StackCapture::GetSize(size_t max_num_frames) {
   DCHECK_LT(0u, max_num_frames);
   max_num_frames = std::min(max_num_frames, kMaxNumFrames);
@@ -68,6 +135,36 @@ StackId StackCapture::relative_stack_id() const {
 // static
 void StackCapture::Init() {
   bottom_frames_to_skip_ = ::common::kDefaultBottomFramesToSkip;
+  set_cache_stack_walks(false);
+}
+
+// static
+void StackCapture::set_cache_stack_walks(bool cache_stack_walks) {
+  if (cache_stack_walks == cache_stack_walks_)
+    return;
+
+  if (!cache_stack_walks) {
+    cache_stack_walks_ = false;
+    dll_watcher.Get().Reset();
+    return;
+  }
+
+  // The modules may have changed while the cache was disabled.
+  InvalidateModuleCaches();
+  if (!dll_watcher.Get().Init(base::Bind(&OnDllNotification))) {
+    LOG(ERROR) << "Unable to watch the modules, not caching stack walks.";
+    return;
+  }
+  cache_stack_walks_ = true;
+}
+
+// static
+void StackCapture::ReleaseThreadCache() {
+  ThreadCache* cache = thread_cache.Get().Get();
+  if (cache == nullptr)
+    return;
+  thread_cache.Get().Set(nullptr);
+  delete cache;
 }
 
 void StackCapture::InitFromBuffer(const void* const* frames,
@@ -105,8 +202,14 @@ void StackCapture::InitFromExistingStack(const StackCapture& stack_capture) {
 // don't allow it to be inlined.
 #pragma optimize("", off)
 void __declspec(noinline) StackCapture::InitFromStack() {
-  num_frames_ = static_cast<uint8_t>(agent::common::WalkStack(
-      1, max_num_frames_, frames_, &absolute_stack_id_));
+  if (cache_stack_walks_) {
+    StackWalkCache* cache = &GetThreadCache()->stack_walk_cache;
+    num_frames_ = static_cast<uint8_t>(agent::common::WalkStackCached(
+        1, max_num_frames_, frames_, &absolute_stack_id_, cache));
+  } else {
+    num_frames_ = static_cast<uint8_t>(agent::common::WalkStack(
+        1, max_num_frames_, frames_, &absolute_stack_id_));
+  }
 
   if (bottom_frames_to_skip_) {
     num_frames_ -=
@@ -123,6 +226,46 @@ namespace {
 using FalseModuleSpace = core::AddressSpace<uintptr_t, uintptr_t, const char*>;
 FalseModuleSpace false_module_space;
 
+// Returns an untracked handle to the module containing the given address, if
+// there is one, by querying the OS. Returns nullptr if no module is found.
+HMODULE QueryModuleFromAddress(void* address) {
+  HMODULE instance = nullptr;
+  if (!::GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS |
+                            GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+                            static_cast<char*>(address),
+                            &instance)) {
+    // Because of JITted code it is entirely possible to encounter frames
+    // that lie outside of all modules. In this case GetModuleHandlExA will
+    // fail, which actually causes an error in base::GetModuleHandleExA.
+    return nullptr;
+  }
+  return instance;
+}
+
+// Same as QueryModuleFromAddress, but goes through the module cache of the
+// calling thread.
+HMODULE QueryModuleFromAddressCached(void* address) {
+  // Read the generation before querying the OS, so that an entry filled
+  // concurrently with a module being unloaded gets invalidated.
+  base::subtle::Atomic32 generation =
+      base::subtle::Acquire_Load(&module_generation);
+
+  // Return addresses are rarely aligned, so use all of their bits.
+  uintptr_t hash = reinterpret_cast<uintptr_t>(address);
+  hash ^= hash >> 8;
+  hash ^= hash >> 16;
+  ModuleCacheEntry* entry =
+      &GetThreadCache()->module_cache[hash & (kModuleCacheSize - 1)];
+  if (entry->address == address && entry->generation == generation)
+    return entry->module;
+
+  HMODULE module = QueryModuleFromAddress(address);
+  entry->address = address;
+  entry->module = module;
+  entry->generation = generation;
+  return module;
+}
+
 // Returns an untracked handle to the module containing the given address, if
 // there is one. Returns nullptr if no module is found. If false modules have
 // been injected via the testing seam, will first check those.
@@ -136,17 +279,9 @@ HMODULE GetModuleFromAddress(void* address) {
   }
 
   // Query the OS for any loaded modules that house the given address.
-  HMODULE instance = nullptr;
-  if (!::GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS |
-                            GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
-                            static_cast<char*>(address),
-                            &instance)) {
-    // Because of JITted code it is entirely possible to encounter frames
-    // that lie outside of all modules. In this case GetModuleHandlExA will
-    // fail, which actually causes an error in base::GetModuleHandleExA.
-    return nullptr;
-  }
-  return instance;
+  if (StackCapture::cache_stack_walks())
+    return QueryModuleFromAddressCached(address);
+  return QueryModuleFromAddress(address);
 }
 
 }  // namespace
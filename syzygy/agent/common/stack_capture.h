@@ -131,6 +131,20 @@ class StackCapture {
   // Get the number of bottom frames to skip per stack trace.
   static size_t bottom_frames_to_skip() { return bottom_frames_to_skip_; }
 
+  // Enables or disables the stack walk cache. When enabled, InitFromStack
+  // reuses the outer frames of the previous stacks captured by the same thread
+  // while they remain unchanged, and the modules containing the frames are
+  // remembered per thread when computing relative stack IDs.
+  // @param cache_stack_walks True to enable the stack walk cache.
+  static void set_cache_stack_walks(bool cache_stack_walks);
+
+  // @returns true if the stack walk cache is enabled.
+  static bool cache_stack_walks() { return cache_stack_walks_; }
+
+  // Releases the caches of the calling thread. This must be called when a
+  // thread that captured stacks exits.
+  static void ReleaseThreadCache();
+
   // Initializes a stack trace from an array of frame pointers and a count.
   // @param frames an array of frame pointers.
   // @param num_frames the number of valid frame pointers in @frames. Note
@@ -174,6 +188,9 @@ class StackCapture {
   // The number of bottom frames to skip on the stack traces.
   static size_t bottom_frames_to_skip_;
 
+  // Indicates if the stack walk cache is enabled.
+  static bool cache_stack_walks_;
+
   // The absolute unique ID of this hash. This is used for storing the hash in
   // the set.
   StackId absolute_stack_id_;
@@ -47,6 +47,11 @@ class StackCaptureTest : public testing::Test {
   }
 };
 
+// Captures the stack from the same call site regardless of the caller.
+void __declspec(noinline) CaptureStack(StackCapture* capture) {
+  capture->InitFromStack();
+}
+
 }  // namespace
 
 TEST_F(StackCaptureTest, InitFromBuffer) {
@@ -96,6 +101,32 @@ TEST_F(StackCaptureTest, InitFromStack) {
   EXPECT_EQ(StackCapture::kMaxNumFrames, capture.max_num_frames());
 }
 
+TEST_F(StackCaptureTest, InitFromStackWithStackWalkCache) {
+  StackCapture expected;
+  CaptureStack(&expected);
+  EXPECT_TRUE(expected.IsValid());
+  StackCapture::StackId expected_relative_stack_id =
+      expected.relative_stack_id();
+
+  StackCapture::set_cache_stack_walks(true);
+  EXPECT_TRUE(StackCapture::cache_stack_walks());
+
+  // The captures must be the same whether or not they are completed from the
+  // cache.
+  for (size_t i = 0; i < 2 * StackWalkCache::kRevalidationPeriod; ++i) {
+    StackCapture capture;
+    CaptureStack(&capture);
+    EXPECT_EQ(expected.num_frames(), capture.num_frames());
+    EXPECT_EQ(expected.absolute_stack_id(), capture.absolute_stack_id());
+    EXPECT_EQ(expected_relative_stack_id, capture.relative_stack_id());
+    for (size_t j = 0; j < capture.num_frames(); ++j)
+      EXPECT_EQ(expected.frames()[j], capture.frames()[j]);
+  }
+
+  StackCapture::set_cache_stack_walks(false);
+  StackCapture::ReleaseThreadCache();
+}
+
 TEST_F(StackCaptureTest, InitFromExistingStack) {
   StackCapture capture;
   capture.InitFromStack();
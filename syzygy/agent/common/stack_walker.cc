@@ -17,6 +17,8 @@
 #include <windows.h>
 
 #ifndef _WIN64
+#include <algorithm>
+
 #include "base/logging.h"
 #include "syzygy/agent/common/stack_capture.h"
 #include "syzygy/common/align.h"
@@ -97,42 +99,176 @@ __forceinline bool CanAdvanceFrame(const StackFrame* frame) {
   return true;
 }
 
-}  // namespace
-
-size_t __declspec(noinline) WalkStack(uint32_t bottom_frames_to_skip,
-                                      uint32_t max_frame_count,
-                                      void** frames,
-                                      StackId* absolute_stack_id) {
+// Gets the extents of the current stack and ensures that they make sense
+// along with the frame pointer from which a walk will start.
+// @param current_ebp The frame pointer of the function walking the stack.
+// @param stack_bottom Will receive the bottom of the stack.
+// @param stack_top Will receive the top of the stack.
+// @returns true if the stack can be walked, false otherwise.
+__forceinline bool GetWalkableStack(const void* current_ebp,
+                                    void** stack_bottom,
+                                    void** stack_top) {
   // Get the stack extents.
   // The first thing in the TEB is actually the TIB.
   // http://www.nirsoft.net/kernel_struct/vista/TEB.html
   NT_TIB* tib = reinterpret_cast<NT_TIB*>(NtCurrentTeb());
-  void* stack_bottom = tib->StackLimit;  // Lower address.
-  void* stack_top = tib->StackBase;  // Higher address.
+  *stack_bottom = tib->StackLimit;  // Lower address.
+  *stack_top = tib->StackBase;  // Higher address.
 
   // Ensure that the stack extents make sense, and bail early if they
   // don't. Only proceed if there's at least room for a single pointer on
   // the stack.
-  if (!::common::IsAligned(stack_top, kPointerSize) ||
-      stack_bottom >= stack_top ||
-      reinterpret_cast<StackFrame*>(stack_bottom) + 1 >= stack_top) {
-    return 0;
+  if (!::common::IsAligned(*stack_top, kPointerSize) ||
+      *stack_bottom >= *stack_top ||
+      reinterpret_cast<StackFrame*>(*stack_bottom) + 1 >= *stack_top) {
+    return false;
   }
 
   // Ensure that the stack makes sense. If not, it's been hijacked and
   // something is seriously wrong.
   void *current_esp = GetEsp();
-  void* current_ebp = GetEbp();
-  if (stack_bottom > current_esp || current_esp > current_ebp ||
-      !IsFrameInBounds(stack_top, current_ebp)) {
+  if (*stack_bottom > current_esp || current_esp > current_ebp ||
+      !IsFrameInBounds(*stack_top, current_ebp)) {
+    return false;
+  }
+
+  return true;
+}
+
+// Skips over the requested number of frames.
+// @param stack_bottom The bottom of the stack.
+// @param stack_top The top of the stack.
+// @param bottom_frames_to_skip The number of frames to skip.
+// @param frame The frame to start from. Will receive the first frame that
+//     isn't skipped.
+// @returns true on success, false if the stack doesn't have enough frames.
+__forceinline bool SkipFrames(const void* stack_bottom,
+                              const void* stack_top,
+                              size_t bottom_frames_to_skip,
+                              const StackFrame** frame) {
+  while (bottom_frames_to_skip) {
+    if (!FrameHasValidReturnAddress(stack_bottom, stack_top, *frame))
+      return false;
+    if (!CanAdvanceFrame(*frame))
+      return false;
+    --bottom_frames_to_skip;
+    *frame = (*frame)->next_frame;
+  }
+  return true;
+}
+
+// Checks if the frames starting at @p frame are those of @p walk starting at
+// @p junction, and if so completes the current walk with the frames of
+// @p walk.
+// @param stack_bottom The bottom of the stack.
+// @param stack_top The top of the stack.
+// @param frame The current frame of the walk.
+// @param walk The cached walk.
+// @param junction The index of the frame of @p walk that has the same frame
+//     pointer as @p frame.
+// @param num_frames The number of frames walked so far.
+// @param max_frame_count The maximum number of frames that can be written to
+//     @p frames.
+// @param frames The frames walked so far.
+// @param absolute_stack_id The stack ID of the frames walked so far.
+// @returns the number of frames added to @p frames, or 0 if the cached walk
+//     can't be used.
+size_t CompleteWalkFromCache(const void* stack_bottom,
+                             const void* stack_top,
+                             const StackFrame* frame,
+                             const StackWalkCache::Walk& walk,
+                             size_t junction,
+                             size_t num_frames,
+                             size_t max_frame_count,
+                             void** frames,
+                             StackId* absolute_stack_id) {
+  DCHECK_LT(junction, walk.num_frames);
+  DCHECK_LT(num_frames, max_frame_count);
+
+  // If the cached walk was truncated then it can only be used if this walk
+  // would be truncated as well.
+  size_t cached_frames = walk.num_frames - junction;
+  if (!walk.complete && num_frames + cached_frames < max_frame_count)
     return 0;
+  cached_frames = std::min(cached_frames, max_frame_count - num_frames);
+
+  // Ensure that the frames at the junction haven't changed.
+  size_t junction_frames =
+      std::min(cached_frames, StackWalkCache::kJunctionFrameCount);
+  for (size_t i = 0; i < junction_frames; ++i) {
+    if (frame != walk.frame_pointers[junction + i] ||
+        !FrameHasValidReturnAddress(stack_bottom, stack_top, frame) ||
+        frame->return_address != walk.return_addresses[junction + i]) {
+      return 0;
+    }
+    if (i + 1 < cached_frames) {
+      if (!CanAdvanceFrame(frame) ||
+          frame->next_frame != walk.frame_pointers[junction + i + 1]) {
+        return 0;
+      }
+      frame = frame->next_frame;
+    }
   }
 
+  for (size_t i = 0; i < cached_frames; ++i) {
+    void* return_address = walk.return_addresses[junction + i];
+    frames[num_frames + i] = return_address;
+    *absolute_stack_id =
+        StackCapture::UpdateStackId(*absolute_stack_id, return_address);
+  }
+  return cached_frames;
+}
+
+// @returns the index of the first frame of @p walk from which it is identical
+//     to @p previous_walk, or the number of frames of @p walk if they don't
+//     end with the same frames.
+size_t GetStableFrameIndex(const StackWalkCache::Walk& walk,
+                           const StackWalkCache::Walk& previous_walk) {
+  size_t i = walk.num_frames;
+  size_t j = previous_walk.num_frames;
+  while (i > 0 && j > 0 &&
+         walk.frame_pointers[i - 1] == previous_walk.frame_pointers[j - 1] &&
+         walk.return_addresses[i - 1] ==
+             previous_walk.return_addresses[j - 1]) {
+    --i;
+    --j;
+  }
+  return i;
+}
+
+}  // namespace
+
+size_t __declspec(noinline) WalkStack(uint32_t bottom_frames_to_skip,
+                                      uint32_t max_frame_count,
+                                      void** frames,
+                                      StackId* absolute_stack_id) {
+  void* current_ebp = GetEbp();
+  void* stack_bottom = nullptr;
+  void* stack_top = nullptr;
+  if (!GetWalkableStack(current_ebp, &stack_bottom, &stack_top))
+    return 0;
+
   return WalkStackImpl(current_ebp, stack_bottom, stack_top,
                        bottom_frames_to_skip, max_frame_count, frames,
                        absolute_stack_id);
 }
 
+size_t __declspec(noinline) WalkStackCached(uint32_t bottom_frames_to_skip,
+                                            uint32_t max_frame_count,
+                                            void** frames,
+                                            StackId* absolute_stack_id,
+                                            StackWalkCache* cache) {
+  void* current_ebp = GetEbp();
+  void* stack_bottom = nullptr;
+  void* stack_top = nullptr;
+  if (!GetWalkableStack(current_ebp, &stack_bottom, &stack_top))
+    return 0;
+
+  return WalkStackCachedImpl(current_ebp, stack_bottom, stack_top,
+                             bottom_frames_to_skip, max_frame_count, frames,
+                             absolute_stack_id, cache);
+}
+
 size_t WalkStackImpl(const void* current_ebp,
                      const void* stack_bottom,
                      const void* stack_top,
@@ -154,21 +290,108 @@ size_t WalkStackImpl(const void* current_ebp,
       reinterpret_cast<const StackFrame*>(current_ebp);
 
   // Skip over any requested frames.
-  while (bottom_frames_to_skip) {
+  if (!SkipFrames(stack_bottom, stack_top, bottom_frames_to_skip,
+                  &current_frame)) {
+    return 0;
+  }
+
+  // Grab as many frames as possible.
+  size_t num_frames = 0;
+  while (num_frames < max_frame_count) {
     if (!FrameHasValidReturnAddress(stack_bottom, stack_top, current_frame))
-      return 0;
+      break;
+    frames[num_frames] = current_frame->return_address;
+    ++num_frames;
+    *absolute_stack_id = StackCapture::UpdateStackId(
+        *absolute_stack_id, current_frame->return_address);
+
     if (!CanAdvanceFrame(current_frame))
-      return 0;
-    --bottom_frames_to_skip;
+      break;
+
     current_frame = current_frame->next_frame;
   }
 
-  // Grab as many frames as possible.
+  *absolute_stack_id =
+      StackCapture::FinalizeStackId(*absolute_stack_id, num_frames);
+
+  return num_frames;
+}
+
+size_t WalkStackCachedImpl(const void* current_ebp,
+                           const void* stack_bottom,
+                           const void* stack_top,
+                           size_t bottom_frames_to_skip,
+                           size_t max_frame_count,
+                           void** frames,
+                           StackId* absolute_stack_id,
+                           StackWalkCache* cache) {
+  static_assert(StackWalkCache::kMaxFrameCount == StackCapture::kMaxNumFrames,
+                "The stack walk cache must be able to hold any stack.");
+  DCHECK(::common::IsAligned(current_ebp, kPointerSize));
+  DCHECK(::common::IsAligned(stack_top, kPointerSize));
+  DCHECK_LT(stack_bottom, stack_top);
+  DCHECK_LE(reinterpret_cast<const StackFrame*>(stack_bottom) + 1, stack_top);
+  DCHECK_LE(current_ebp, stack_top);
+  DCHECK_NE(static_cast<void**>(nullptr), frames);
+  DCHECK_NE(static_cast<StackId*>(nullptr), absolute_stack_id);
+  DCHECK_NE(static_cast<StackWalkCache*>(nullptr), cache);
+  DCHECK_GE(StackWalkCache::kMaxFrameCount, max_frame_count);
+
+  *absolute_stack_id = StackCapture::StartStackId();
+
+  const StackFrame* current_frame =
+      reinterpret_cast<const StackFrame*>(current_ebp);
+
+  // Skip over any requested frames.
+  if (!SkipFrames(stack_bottom, stack_top, bottom_frames_to_skip,
+                  &current_frame)) {
+    return 0;
+  }
+
+  const StackWalkCache::Walk& last_walk = cache->walks[cache->last_walk];
+  StackWalkCache::Walk& walk = cache->walks[cache->last_walk ^ 1];
+  bool use_cache = cache->stable_from < last_walk.num_frames &&
+      cache->cached_walks < StackWalkCache::kRevalidationPeriod;
+  size_t junction = cache->stable_from;
+
+  // Grab as many frames as possible, until reaching the stable part of the
+  // last walk.
   size_t num_frames = 0;
-  while (num_frames < max_frame_count) {
+  bool complete = true;
+  while (true) {
+    if (num_frames == max_frame_count) {
+      complete = false;
+      break;
+    }
     if (!FrameHasValidReturnAddress(stack_bottom, stack_top, current_frame))
       break;
+
+    if (use_cache) {
+      // The frame pointers increase along both walks, so the junction with
+      // the last walk can only move outwards.
+      while (junction < last_walk.num_frames &&
+             last_walk.frame_pointers[junction] < current_frame) {
+        ++junction;
+      }
+      if (junction == last_walk.num_frames) {
+        use_cache = false;
+      } else if (last_walk.frame_pointers[junction] == current_frame) {
+        size_t cached_frames = CompleteWalkFromCache(
+            stack_bottom, stack_top, current_frame, last_walk, junction,
+            num_frames, max_frame_count, frames, absolute_stack_id);
+        if (cached_frames != 0) {
+          ++cache->cached_walks;
+          num_frames += cached_frames;
+          *absolute_stack_id =
+              StackCapture::FinalizeStackId(*absolute_stack_id, num_frames);
+          return num_frames;
+        }
+      }
+    }
+
     frames[num_frames] = current_frame->return_address;
+    walk.frame_pointers[num_frames] = current_frame;
+    walk.return_addresses[num_frames] = current_frame->return_address;
     ++num_frames;
     *absolute_stack_id = StackCapture::UpdateStackId(
         *absolute_stack_id, current_frame->return_address);
@@ -179,6 +402,13 @@ size_t WalkStackImpl(const void* current_ebp,
     current_frame = current_frame->next_frame;
   }
 
+  // This was a full walk, it becomes the last walk.
+  walk.num_frames = num_frames;
+  walk.complete = complete;
+  cache->stable_from = GetStableFrameIndex(walk, last_walk);
+  cache->last_walk ^= 1;
+  cache->cached_walks = 0;
+
   *absolute_stack_id =
       StackCapture::FinalizeStackId(*absolute_stack_id, num_frames);
 
@@ -198,6 +428,18 @@ size_t __declspec(noinline) WalkStack(uint32_t bottom_frames_to_skip,
                                reinterpret_cast<PDWORD>(absolute_stack_id));
 }
 
+size_t __declspec(noinline) WalkStackCached(uint32_t bottom_frames_to_skip,
+                                            uint32_t max_frame_count,
+                                            void** frames,
+                                            StackId* absolute_stack_id,
+                                            StackWalkCache* cache) {
+  // Skip one more frame for call of this function
+  return CaptureStackBackTrace(bottom_frames_to_skip + 1,
+                               max_frame_count,
+                               frames,
+                               reinterpret_cast<PDWORD>(absolute_stack_id));
+}
+
 #endif  // !defined _WIN64
 
 }  // namespace common
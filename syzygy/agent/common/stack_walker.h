@@ -90,6 +90,79 @@ size_t WalkStack(uint32_t bottom_frames_to_skip,
                  void** frames,
                  StackId* absolute_stack_id);
 
+// Remembers the last stack fully walked by a thread, so that the outer part of
+// the stack doesn't need to be walked again while it stays the same. This is
+// meant to be used by a single thread.
+//
+// The outer part of the last walk is known to be stable when it was also found
+// in the previous full walk, at the same frame pointers. A later walk that
+// reaches one of these frames, and finds it and the next frames to be
+// unchanged, stops there and copies the remaining frames from the cache. A
+// full walk is forced every once in a while to refresh the cache.
+//
+// Only the frames at the junction with the cached walk are checked, so a
+// change further up the stack that leaves these frames identical goes
+// unnoticed until the next full walk. This requires the outer functions to
+// have returned and to have been replaced by frames with the same frame
+// pointers and the same return addresses at the junction.
+struct StackWalkCache {
+  // The maximum number of frames remembered by the cache. This is the same as
+  // StackCapture::kMaxNumFrames.
+  static const size_t kMaxFrameCount = 62;
+
+  // The number of frames that must be found unchanged before the rest of a
+  // walk is taken from the cache.
+  static const size_t kJunctionFrameCount = 4;
+
+  // The number of consecutive walks that can be completed from the cache
+  // before a full walk is forced.
+  static const size_t kRevalidationPeriod = 16;
+
+  // A full stack walk.
+  struct Walk {
+    // The number of frames in this walk.
+    size_t num_frames;
+    // True if the walk stopped because the stack couldn't be walked further,
+    // false if it stopped because it reached the maximum number of frames.
+    bool complete;
+    // The frame pointer and return address of each frame.
+    const void* frame_pointers[kMaxFrameCount];
+    void* return_addresses[kMaxFrameCount];
+  };
+
+  // The last two full walks. |walks[last_walk]| is the most recent one.
+  Walk walks[2];
+  size_t last_walk;
+
+  // The frames of the last walk starting at this index are known to be
+  // stable. This is equal to the number of frames of the last walk if none
+  // is.
+  size_t stable_from;
+
+  // The number of walks completed from the cache since the last full walk.
+  size_t cached_walks;
+};
+
+// Same as WalkStack, but stops walking as soon as it reaches the stable part
+// of the stack remembered by @p cache, and updates the cache.
+// @param bottom_frames_to_skip The number of frames to skip from the bottom
+//     of the stack.
+// @param max_frame_count The maximum number of frames that can be written to
+//     @p frames.
+// @param frames The array to be populated with the computed frames.
+// @param absolute_stack_id Pointer to the stack ID that will be calculated as
+//     we are walking the stack.
+// @param cache The stack walk cache of the calling thread. Must be zero
+//     initialized before its first use.
+// @returns the number of frames successfully walked and stored in @p frames.
+// @note The stack walk cache is only implemented on X86. On Win64 this is the
+//     same as WalkStack.
+size_t WalkStackCached(uint32_t bottom_frames_to_skip,
+                       uint32_t max_frame_count,
+                       void** frames,
+                       StackId* absolute_stack_id,
+                       StackWalkCache* cache);
+
 #ifndef _WIN64
 // Implementation of WalkStack, with explicitly provided @p current_ebp,
 // @p stack_bottom and @p stack_top. Exposed for much easier unittesting.
@@ -112,6 +185,18 @@ size_t WalkStackImpl(const void* current_ebp,
                      uint32_t max_frame_count,
                      void** frames,
                      StackId* absolute_stack_id);
+
+// Implementation of WalkStackCached, with explicitly provided
+// @p current_ebp, @p stack_bottom and @p stack_top. Exposed for much easier
+// unittesting. The other parameters are the same as those of WalkStackCached.
+size_t WalkStackCachedImpl(const void* current_ebp,
+                           const void* stack_bottom,
+                           const void* stack_top,
+                           uint32_t bottom_frames_to_skip,
+                           uint32_t max_frame_count,
+                           void** frames,
+                           StackId* absolute_stack_id,
+                           StackWalkCache* cache);
 #endif  // !defined _WIN64
 
 }  // namespace common
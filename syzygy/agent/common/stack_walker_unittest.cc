@@ -32,6 +32,7 @@ class StackWalkerTest : public testing::Test {
     ::memset(frames_, 0, sizeof(frames_));
     ::memset(frames2_, 0, sizeof(frames2_));
     ::memset(dummy_stack_, 0, sizeof(dummy_stack_));
+    ::memset(&cache_, 0, sizeof(cache_));
   }
 #ifndef _WIN64
   static const uintptr_t kBaseRet = 0x1000000u;
@@ -135,8 +136,31 @@ class StackWalkerTest : public testing::Test {
     PopEbp();
   }
 
+  // Walks the dummy stack with and without the cache, and expects the same
+  // results.
+  void ExpectCachedWalkMatches(size_t max_frame_count) {
+    ASSERT_GE(StackWalkCache::kMaxFrameCount, max_frame_count);
+
+    PushEbp();
+    StackId stack_id = 0;
+    StackId stack_id2 = 0;
+    size_t num_frames = WalkStackImpl(
+        dummy_ebp_, dummy_esp_, dummy_stack_ + arraysize(dummy_stack_), 0,
+        max_frame_count, frames_, &stack_id);
+    size_t num_frames2 = WalkStackCachedImpl(
+        dummy_ebp_, dummy_esp_, dummy_stack_ + arraysize(dummy_stack_), 0,
+        max_frame_count, frames2_, &stack_id2, &cache_);
+    EXPECT_EQ(num_frames, num_frames2);
+    EXPECT_EQ(stack_id, stack_id2);
+    EXPECT_EQ(0, ::memcmp(frames_, frames2_, num_frames * sizeof(*frames_)));
+
+    PopEbp();
+  }
+
 #endif  // !defined _WIN64
 
+  StackWalkCache cache_;
+
   static const size_t kMaxFrames = 100;
   void* frames_[kMaxFrames];
   void* frames2_[kMaxFrames];
@@ -252,6 +276,96 @@ TEST_F(StackWalkerTest, WalkStopAtOverflowingBasePointer) {
   ExpectSuccessfulWalk(3, 1);
 }
 
+TEST_F(StackWalkerTest, CachedWalkReusesStableFrames) {
+  for (size_t i = 0; i < 10; ++i)
+    BuildValidFrame(i % 3);
+
+  // The first two walks are full walks, after which the whole stack is known
+  // to be stable.
+  ExpectCachedWalkMatches(StackWalkCache::kMaxFrameCount);
+  EXPECT_EQ(0u, cache_.cached_walks);
+  ExpectCachedWalkMatches(StackWalkCache::kMaxFrameCount);
+  EXPECT_EQ(0u, cache_.cached_walks);
+  EXPECT_EQ(0u, cache_.stable_from);
+
+  ExpectCachedWalkMatches(StackWalkCache::kMaxFrameCount);
+  EXPECT_EQ(1u, cache_.cached_walks);
+
+  // Deeper walks still reuse the stable frames.
+  BuildValidFrame(1);
+  BuildValidFrame(2);
+  ExpectCachedWalkMatches(StackWalkCache::kMaxFrameCount);
+  EXPECT_EQ(2u, cache_.cached_walks);
+  ExpectCachedWalkMatches(StackWalkCache::kMaxFrameCount);
+  EXPECT_EQ(3u, cache_.cached_walks);
+}
+
+TEST_F(StackWalkerTest, CachedWalkIsRevalidated) {
+  for (size_t i = 0; i < 10; ++i)
+    BuildValidFrame(0);
+
+  ExpectCachedWalkMatches(StackWalkCache::kMaxFrameCount);
+  ExpectCachedWalkMatches(StackWalkCache::kMaxFrameCount);
+  for (size_t i = 0; i < StackWalkCache::kRevalidationPeriod; ++i) {
+    ExpectCachedWalkMatches(StackWalkCache::kMaxFrameCount);
+    EXPECT_EQ(i + 1, cache_.cached_walks);
+  }
+
+  // This one must be a full walk.
+  ExpectCachedWalkMatches(StackWalkCache::kMaxFrameCount);
+  EXPECT_EQ(0u, cache_.cached_walks);
+  ExpectCachedWalkMatches(StackWalkCache::kMaxFrameCount);
+  EXPECT_EQ(1u, cache_.cached_walks);
+}
+
+TEST_F(StackWalkerTest, CachedWalkDetectsChangedFrames) {
+  for (size_t i = 0; i < 10; ++i)
+    BuildValidFrame(1);
+
+  ExpectCachedWalkMatches(StackWalkCache::kMaxFrameCount);
+  ExpectCachedWalkMatches(StackWalkCache::kMaxFrameCount);
+  ExpectCachedWalkMatches(StackWalkCache::kMaxFrameCount);
+  EXPECT_EQ(1u, cache_.cached_walks);
+
+  // Change the return address of the innermost frame, as if another function
+  // had been called at the same depth. The outer frames are still reused.
+  dummy_esp_[0] += 0x1000;
+  ExpectCachedWalkMatches(StackWalkCache::kMaxFrameCount);
+  EXPECT_EQ(2u, cache_.cached_walks);
+
+  // Change the return address of every frame, nothing can be reused.
+  dummy_esp_[0] += 0x1000;
+  uintptr_t* ebp = dummy_ebp_;
+  while (ebp < dummy_stack_ + arraysize(dummy_stack_)) {
+    ebp[1] += 0x1000;
+    ebp = reinterpret_cast<uintptr_t*>(ebp[0]);
+  }
+  ExpectCachedWalkMatches(StackWalkCache::kMaxFrameCount);
+  EXPECT_EQ(0u, cache_.cached_walks);
+
+  // The new stack needs to be seen twice before being reused.
+  ExpectCachedWalkMatches(StackWalkCache::kMaxFrameCount);
+  EXPECT_EQ(0u, cache_.cached_walks);
+  ExpectCachedWalkMatches(StackWalkCache::kMaxFrameCount);
+  EXPECT_EQ(1u, cache_.cached_walks);
+}
+
+TEST_F(StackWalkerTest, CachedWalkHandlesTruncatedWalks) {
+  for (size_t i = 0; i < 20; ++i)
+    BuildValidFrame(0);
+
+  // Truncated walks are only completed from the cache when they would be
+  // truncated as well.
+  ExpectCachedWalkMatches(10);
+  ExpectCachedWalkMatches(10);
+  ExpectCachedWalkMatches(10);
+  EXPECT_EQ(1u, cache_.cached_walks);
+  ExpectCachedWalkMatches(5);
+  EXPECT_EQ(2u, cache_.cached_walks);
+  ExpectCachedWalkMatches(StackWalkCache::kMaxFrameCount);
+  EXPECT_EQ(0u, cache_.cached_walks);
+}
+
 #endif  // !defined _WIN64
 
 TEST_F(StackWalkerTest, CompareToCaptureStackBackTrace) {
@@ -274,5 +388,21 @@ TEST_F(StackWalkerTest, CompareToCaptureStackBackTrace) {
   }
 }
 
+TEST_F(StackWalkerTest, CompareCachedWalkToWalkStack) {
+  // Skip the top frame as the two walks aren't done from the same call site.
+  for (size_t i = 0; i < 2 * StackWalkCache::kRevalidationPeriod; ++i) {
+    StackId stack_id = 0;
+    StackId stack_id2 = 0;
+    size_t num_frames =
+        WalkStack(1, StackWalkCache::kMaxFrameCount, frames_, &stack_id);
+    size_t num_frames2 = WalkStackCached(1, StackWalkCache::kMaxFrameCount,
+                                         frames2_, &stack_id2, &cache_);
+    EXPECT_LT(0u, num_frames);
+    EXPECT_EQ(num_frames, num_frames2);
+    EXPECT_EQ(stack_id, stack_id2);
+    EXPECT_EQ(0, ::memcmp(frames_, frames2_, num_frames * sizeof(*frames_)));
+  }
+}
+
 }  // namespace common
 }  // namespace agent
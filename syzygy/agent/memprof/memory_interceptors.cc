@@ -28,6 +28,16 @@ extern "C" {
     __asm ret 4  \
   }
 
+// Range probes are called with EDX and the size of the range on the stack, and
+// the first address of the range in EDX.
+#define DEFINE_NULL_RANGE_PROBE(name)  \
+  void __declspec(naked) name() {  \
+    /* Restore the value of EDX. */  \
+    __asm mov edx, DWORD PTR[esp + 8]  \
+    /* Return and pop the size and saved EDX value off the stack. */  \
+    __asm ret 8  \
+  }
+
 // Special instruction takes their addresses directly in some known registers,
 // so no extra information gets pushed onto the stack and there's nothing to
 // clean, we can simply return.
@@ -65,6 +75,10 @@ DEFINE_NULL_MEMORY_PROBE(asan_check_8_byte_write_access_no_flags);
 DEFINE_NULL_MEMORY_PROBE(asan_check_10_byte_write_access_no_flags);
 DEFINE_NULL_MEMORY_PROBE(asan_check_16_byte_write_access_no_flags);
 DEFINE_NULL_MEMORY_PROBE(asan_check_32_byte_write_access_no_flags);
+DEFINE_NULL_RANGE_PROBE(asan_check_range_read_access);
+DEFINE_NULL_RANGE_PROBE(asan_check_range_write_access);
+DEFINE_NULL_RANGE_PROBE(asan_check_range_read_access_no_flags);
+DEFINE_NULL_RANGE_PROBE(asan_check_range_write_access_no_flags);
 DEFINE_NULL_SPECIAL_PROBE(asan_check_repz_1_byte_cmps_access);
 DEFINE_NULL_SPECIAL_PROBE(asan_check_repz_2_byte_cmps_access);
 DEFINE_NULL_SPECIAL_PROBE(asan_check_repz_4_byte_cmps_access);
@@ -90,6 +104,17 @@ DEFINE_NULL_SPECIAL_PROBE(asan_check_1_byte_stos_access);
 DEFINE_NULL_SPECIAL_PROBE(asan_check_2_byte_stos_access);
 DEFINE_NULL_SPECIAL_PROBE(asan_check_4_byte_stos_access);
 #undef DEFINE_NULL_MEMORY_PROBE
+#undef DEFINE_NULL_RANGE_PROBE
 #undef DEFINE_NULL_STRING_PROBE
 
+// The zero shadow byte read by the inline memory checks. The mask being zero,
+// every address maps to it and the checks always succeed.
+static const unsigned char asan_inline_check_zero_shadow = 0;
+
+// Mirrors agent::asan::InlineCheckShadow.
+struct {
+  unsigned int mask;
+  const unsigned char* shadow;
+} asan_inline_check_shadow = { 0, &asan_inline_check_zero_shadow };
+
 }  // extern "C"
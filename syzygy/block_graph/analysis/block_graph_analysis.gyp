@@ -56,5 +56,28 @@
         '<(src)/testing/gtest.gyp:gtest',
       ],
     },
+    {
+      'target_name': 'block_graph_analysis_perftests',
+      'type': 'executable',
+      'sources': [
+        'liveness_analysis_perftest.cc',
+        '<(src)/syzygy/testing/run_all_unittests.cc',
+        '<(src)/testing/perf/perf_test.cc',
+        '<(src)/testing/perf/perf_test.h',
+      ],
+      'dependencies': [
+        'block_graph_analysis_lib',
+        '<(src)/base/base.gyp:base',
+        '<(src)/base/base.gyp:test_support_base',
+        '<(src)/syzygy/block_graph/block_graph.gyp:block_graph_lib',
+        '<(src)/syzygy/core/core.gyp:core_lib',
+        '<(src)/syzygy/pe/pe.gyp:pe_lib',
+        '<(src)/syzygy/pe/pe.gyp:pe_unittest_utils',
+        '<(src)/syzygy/pe/pe.gyp:test_dll',
+        '<(src)/syzygy/test_data/test_data.gyp:copy_test_dll',
+        '<(src)/syzygy/testing/testing.gyp:testing_lib',
+        '<(src)/testing/gtest.gyp:gtest',
+      ],
+    },
   ],
 }
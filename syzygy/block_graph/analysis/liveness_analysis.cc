@@ -38,6 +38,30 @@ typedef ControlFlowAnalysis::BasicBlockOrdering BasicBlockOrdering;
 typedef LivenessAnalysis::State State;
 typedef LivenessAnalysis::State::RegisterMask RegisterMask;
 typedef LivenessAnalysis::State::FlagsMask FlagsMask;
+typedef LivenessAnalysis::StateHelper StateHelper;
+
+// Marks a basic block that wasn't analyzed in the index of the analysis.
+const uint32_t kNoIndex = 0xFFFFFFFF;
+
+// The information used by the fix-point iteration for a basic block. The
+// effect of the instructions of the block and of its successors to blocks that
+// aren't analyzed is computed once, so that each iteration only combines
+// states.
+struct BlockSummary {
+  // The registers alive at exit of the block, besides those alive at entry of
+  // its analyzed successors.
+  State exit;
+  // The effect of the instructions of the block, such that the registers
+  // alive at entry are (those alive at exit & keep) | gen.
+  State keep;
+  State gen;
+  // The range of the analyzed successors and predecessors of the block in
+  // the adjacency arrays.
+  uint32_t successors_begin;
+  uint32_t successors_end;
+  uint32_t predecessors_begin;
+  uint32_t predecessors_end;
+};
 
 }  // namespace
 
@@ -62,7 +86,7 @@ bool State::AreArithmeticFlagsLive() const {
   return StateHelper::AreArithmeticFlagsLive(*this);
 }
 
-LivenessAnalysis::LivenessAnalysis() : live_in_() {
+LivenessAnalysis::LivenessAnalysis() : subgraph_(NULL), live_in_() {
 }
 
 void LivenessAnalysis::GetStateAtEntryOf(const BasicBlock* bb,
@@ -71,12 +95,10 @@ void LivenessAnalysis::GetStateAtEntryOf(const BasicBlock* bb,
   // registers alive.
   DCHECK(state != NULL);
 
-  if (bb != NULL) {
-    LiveMap::const_iterator look = live_in_.find(bb);
-    if (look != live_in_.end()) {
-      StateHelper::Copy(look->second, state);
-      return;
-    }
+  size_t index = GetIndexOf(bb);
+  if (index != kNoIndex) {
+    StateHelper::Copy(live_in_[index], state);
+    return;
   }
 
   StateHelper::SetAll(state);
@@ -129,77 +151,171 @@ void LivenessAnalysis::PropagateBackward(const Instruction& instr,
                                          State* state) {
   DCHECK(state != NULL);
 
-  // Skip 'nop' instructions. It's better to skip them (i.e. mov %eax, %eax).
-  if (instr.IsNop())
-    return;
-
-  // Remove 'defs' from current state.
-  State defs;
-  if (StateHelper::GetDefsOf(instr, &defs))
-    StateHelper::Subtract(defs, state);
-
-  if (instr.IsCall() || instr.IsReturn()) {
-    // TODO(etienneb): Can we verify the calling convention? If so we can do
-    // better than SetAll here.
-    StateHelper::SetAll(state);
-  } else if (instr.IsBranch() ||
-             instr.IsInterrupt() ||
-             instr.IsControlFlow()) {
-    // Don't mess with these instructions.
-    StateHelper::SetAll(state);
-  }
-
-  // Add 'uses' of instruction to current state, or assume all alive when 'uses'
-  // information is not available.
-  State uses;
-  if (StateHelper::GetUsesOf(instr, &uses)) {
-    StateHelper::Union(uses, state);
-  } else {
-    StateHelper::SetAll(state);
-  }
+  State keep;
+  State gen;
+  StateHelper::Clear(&gen);
+  StateHelper::PropagateBackward(instr, &keep, &gen);
+  StateHelper::Intersect(keep, state);
+  StateHelper::Union(gen, state);
 }
 
 void LivenessAnalysis::Analyze(const BasicBlockSubGraph* subgraph) {
   DCHECK(subgraph != NULL);
   DCHECK(live_in_.empty());
 
-  // Produce a post-order basic blocks ordering.
+  subgraph_ = subgraph;
   const BBCollection& basic_blocks = subgraph->basic_blocks();
-  std::vector<const BasicCodeBlock*> order;
-  ControlFlowAnalysis::FlattenBasicBlocksInPostOrder(basic_blocks, &order);
-
-  // Initialize liveness information of each basic block (empty set).
-  BasicBlockOrdering::const_iterator fw_iter = order.begin();
-  for (; fw_iter != order.end(); ++fw_iter)
-    StateHelper::Clear(&live_in_[*fw_iter]);
-
-  // Propagate liveness information until stable (fix-point). Each set may only
-  // grow, thus we have a halting condition.
-  bool changed = true;
-  while (changed) {
-    changed = false;
+  if (basic_blocks.empty())
+    return;
 
-    BasicBlockOrdering::const_iterator  bb_iter = order.begin();
-    for (; bb_iter != order.end(); ++bb_iter) {
-      const BasicCodeBlock* bb = *bb_iter;
+  // Produce a post-order basic blocks ordering. Successors come before their
+  // predecessors, which is the order in which a backward analysis converges
+  // the fastest.
+  BasicBlockOrdering order;
+  ControlFlowAnalysis::FlattenBasicBlocksInPostOrder(basic_blocks, &order);
 
-      // Merge current liveness information with every successor information.
+  // Index the basic blocks densely by their position in the ordering, and
+  // initialize their liveness information (empty set). The collection is
+  // sorted by id.
+  index_of_id_.assign((*basic_blocks.rbegin())->id() + 1, kNoIndex);
+  for (size_t i = 0; i < order.size(); ++i)
+    index_of_id_[order[i]->id()] = static_cast<uint32_t>(i);
+  live_in_.resize(order.size());
+  for (size_t i = 0; i < live_in_.size(); ++i)
+    StateHelper::Clear(&live_in_[i]);
+
+  // A single basic block that doesn't loop on itself needs a single pass.
+  if (order.size() == 1) {
+    const BasicCodeBlock* bb = order[0];
+    bool loops = false;
+    const Successors& successors = bb->successors();
+    for (Successors::const_iterator succ = successors.begin();
+         succ != successors.end(); ++succ) {
+      if (succ->reference().basic_block() == bb)
+        loops = true;
+    }
+    if (!loops) {
       State state;
       GetStateAtExitOf(bb, &state);
-
-      // Propagate liveness information backward until the basic block entry.
       const Instructions& instructions = bb->instructions();
       Instructions::const_reverse_iterator instr_iter = instructions.rbegin();
       for (; instr_iter != instructions.rend(); ++instr_iter)
         PropagateBackward(*instr_iter, &state);
+      StateHelper::Copy(state, &live_in_[0]);
+      return;
+    }
+  }
+
+  // Summarize each basic block, and collect the edges between the analyzed
+  // basic blocks.
+  std::vector<BlockSummary> summaries(order.size());
+  std::vector<uint32_t> successors;
+  std::vector<uint32_t> predecessor_counts(order.size(), 0);
+  for (size_t i = 0; i < order.size(); ++i) {
+    const BasicCodeBlock* bb = order[i];
+    BlockSummary& summary = summaries[i];
+
+    // Merge the liveness information of every successor that isn't analyzed,
+    // and of the implicit instruction of every successor.
+    summary.successors_begin = static_cast<uint32_t>(successors.size());
+    const Successors& bb_successors = bb->successors();
+    if (bb_successors.empty()) {
+      StateHelper::SetAll(&summary.exit);
+    } else {
+      StateHelper::Clear(&summary.exit);
+      Successors::const_iterator succ = bb_successors.begin();
+      for (; succ != bb_successors.end(); ++succ) {
+        State uses;
+        if (StateHelper::GetUsesOf(*succ, &uses)) {
+          StateHelper::Union(uses, &summary.exit);
+        } else {
+          StateHelper::SetAll(&summary.exit);
+        }
+
+        size_t index = GetIndexOf(succ->reference().basic_block());
+        if (index == kNoIndex) {
+          // Successor is not an analyzed BasicBlock. Assume all registers are
+          // alive.
+          StateHelper::SetAll(&summary.exit);
+        } else {
+          successors.push_back(static_cast<uint32_t>(index));
+          ++predecessor_counts[index];
+        }
+      }
+    }
+    summary.successors_end = static_cast<uint32_t>(successors.size());
+
+    // Summarize the instructions backward until the basic block entry.
+    StateHelper::Clear(&summary.gen);
+    const Instructions& instructions = bb->instructions();
+    Instructions::const_reverse_iterator instr_iter = instructions.rbegin();
+    for (; instr_iter != instructions.rend(); ++instr_iter) {
+      StateHelper::PropagateBackward(*instr_iter, &summary.keep,
+                                     &summary.gen);
+    }
+  }
 
-      // Commit liveness information to the global state.
-      if (StateHelper::Union(state, &live_in_[bb]))
-        changed = true;
+  // Invert the edges.
+  std::vector<uint32_t> predecessors(successors.size());
+  uint32_t offset = 0;
+  for (size_t i = 0; i < summaries.size(); ++i) {
+    summaries[i].predecessors_begin = offset;
+    summaries[i].predecessors_end = offset;
+    offset += predecessor_counts[i];
+  }
+  for (size_t i = 0; i < summaries.size(); ++i) {
+    for (uint32_t j = summaries[i].successors_begin;
+         j < summaries[i].successors_end; ++j) {
+      BlockSummary& successor = summaries[successors[j]];
+      predecessors[successor.predecessors_end++] = static_cast<uint32_t>(i);
+    }
+  }
+
+  // Propagate liveness information until stable (fix-point). Each set may only
+  // grow, thus we have a halting condition. Only the basic blocks whose
+  // successors changed are revisited, in post-order.
+  std::vector<bool> pending(order.size(), true);
+  bool sweep = true;
+  while (sweep) {
+    sweep = false;
+    for (size_t i = 0; i < summaries.size(); ++i) {
+      if (!pending[i])
+        continue;
+      pending[i] = false;
+
+      // Merge current liveness information with every successor information,
+      // then propagate it backward until the basic block entry.
+      const BlockSummary& summary = summaries[i];
+      State state(summary.exit);
+      for (uint32_t j = summary.successors_begin;
+           j < summary.successors_end; ++j) {
+        StateHelper::Union(live_in_[successors[j]], &state);
+      }
+      StateHelper::Intersect(summary.keep, &state);
+      StateHelper::Union(summary.gen, &state);
+
+      // Commit liveness information to the global state, and revisit the
+      // predecessors if it changed.
+      if (!StateHelper::Union(state, &live_in_[i]))
+        continue;
+      for (uint32_t j = summary.predecessors_begin;
+           j < summary.predecessors_end; ++j) {
+        pending[predecessors[j]] = true;
+        if (predecessors[j] <= i)
+          sweep = true;
+      }
     }
   }
 }
 
+size_t LivenessAnalysis::GetIndexOf(const BasicBlock* bb) const {
+  if (bb == NULL || bb->subgraph() != subgraph_ ||
+      bb->id() >= index_of_id_.size()) {
+    return kNoIndex;
+  }
+  return index_of_id_[bb->id()];
+}
+
 RegisterMask LivenessAnalysis::StateHelper::RegisterToRegisterMask(
     uint8_t reg) {
   LivenessAnalysis::StateHelper::RegisterBits mask =
@@ -336,6 +452,54 @@ void LivenessAnalysis::StateHelper::Subtract(const State& src, State* state) {
   state->registers_ &= ~(src.registers_);
 }
 
+void LivenessAnalysis::StateHelper::Intersect(const State& src,
+                                              State* state) {
+  DCHECK(state != NULL);
+  state->flags_ &= src.flags_;
+  state->registers_ &= src.registers_;
+}
+
+void LivenessAnalysis::StateHelper::PropagateBackward(const Instruction& instr,
+                                                      State* keep,
+                                                      State* gen) {
+  DCHECK(keep != NULL);
+  DCHECK(gen != NULL);
+
+  // Skip 'nop' instructions. It's better to skip them (i.e. mov %eax, %eax).
+  if (instr.IsNop())
+    return;
+
+  // Remove 'defs' from current state.
+  State defs;
+  if (GetDefsOf(instr, &defs)) {
+    Subtract(defs, keep);
+    Subtract(defs, gen);
+  }
+
+  if (instr.IsCall() || instr.IsReturn()) {
+    // TODO(etienneb): Can we verify the calling convention? If so we can do
+    // better than SetAll here.
+    Clear(keep);
+    SetAll(gen);
+  } else if (instr.IsBranch() ||
+             instr.IsInterrupt() ||
+             instr.IsControlFlow()) {
+    // Don't mess with these instructions.
+    Clear(keep);
+    SetAll(gen);
+  }
+
+  // Add 'uses' of instruction to current state, or assume all alive when 'uses'
+  // information is not available.
+  State uses;
+  if (GetUsesOf(instr, &uses)) {
+    Union(uses, gen);
+  } else {
+    Clear(keep);
+    SetAll(gen);
+  }
+}
+
 void LivenessAnalysis::StateHelper::StateDefOperand(
     const _Operand& operand, State* state) {
   DCHECK(state != NULL);
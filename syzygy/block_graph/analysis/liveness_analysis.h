@@ -27,7 +27,7 @@
 #ifndef SYZYGY_BLOCK_GRAPH_ANALYSIS_LIVENESS_ANALYSIS_H_
 #define SYZYGY_BLOCK_GRAPH_ANALYSIS_LIVENESS_ANALYSIS_H_
 
-#include <map>
+#include <vector>
 
 #include "syzygy/block_graph/basic_block.h"
 #include "syzygy/block_graph/basic_block_subgraph.h"
@@ -148,9 +148,20 @@ class LivenessAnalysis {
   void Analyze(const BasicBlockSubGraph* subgraph);
 
  private:
-  // Contains the registers alive at entry of each basic block.
-  typedef std::map<const BasicBlock*, State> LiveMap;
-  LiveMap live_in_;
+  // @param bb A basic block.
+  // @returns the index of the state of @p bb in live_in_, or kNoIndex if it
+  //     wasn't analyzed.
+  size_t GetIndexOf(const BasicBlock* bb) const;
+
+  // The subgraph that was analyzed.
+  const BasicBlockSubGraph* subgraph_;
+
+  // Maps the id of each analyzed basic block to the index of its state in
+  // live_in_. Basic block ids are dense within a subgraph.
+  std::vector<uint32_t> index_of_id_;
+
+  // Contains the registers alive at entry of each basic block, in post-order.
+  std::vector<State> live_in_;
 
   DISALLOW_COPY_AND_ASSIGN(LivenessAnalysis);
 };
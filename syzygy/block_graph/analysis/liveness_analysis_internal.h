@@ -138,6 +138,23 @@ class LivenessAnalysis::StateHelper {
   // @param state State to apply modifications.
   static void Subtract(const State& src, State* state);
 
+  // Keep only the registers of @p state that are also in @p src.
+  // @param src State to intersect with.
+  // @param state State to apply modifications.
+  static void Intersect(const State& src, State* state);
+
+  // The effect of a sequence of instructions on liveness is summarized by two
+  // states, @p keep and @p gen, such that the state before the sequence is
+  // (state after & keep) | gen. This composes the effect of @p instr, which
+  // precedes the sequence, into that summary. An empty sequence is summarized
+  // by keep = all and gen = none.
+  // @param instr Instruction to analyze.
+  // @param keep The registers that remain live across the sequence.
+  // @param gen The registers made live by the sequence.
+  static void PropagateBackward(const Instruction& instr,
+                                State* keep,
+                                State* gen);
+
   // Find the registers defined by an operand.
   // @param operand Operand to analyze.
   // @param state Receives defined registers.
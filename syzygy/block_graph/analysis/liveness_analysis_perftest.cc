@@ -0,0 +1,107 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Measures the cost of the global liveness analysis over every function of
+// test_dll that can be basic-block decomposed.
+
+#include <memory>
+#include <vector>
+
+#include "base/time/time.h"
+#include "gtest/gtest.h"
+#include "syzygy/block_graph/basic_block_decomposer.h"
+#include "syzygy/block_graph/analysis/liveness_analysis.h"
+#include "syzygy/pe/pe_transform_policy.h"
+#include "syzygy/pe/unittest_util.h"
+#include "testing/perf/perf_test.h"
+
+namespace block_graph {
+namespace analysis {
+
+namespace {
+
+// The number of times the analysis is repeated.
+const size_t kIterations = 10;
+
+class LivenessAnalysisPerfTest : public testing::PELibUnitTest {
+ public:
+  LivenessAnalysisPerfTest() : image_layout_(&block_graph_) {
+  }
+
+  void SetUp() override {
+    testing::PELibUnitTest::SetUp();
+    ASSERT_NO_FATAL_FAILURE(DecomposeTestDll(&pe_file_, &image_layout_));
+  }
+
+  // Decomposes every function that can be, into subgraphs_.
+  void DecomposeFunctions();
+
+  pe::PEFile pe_file_;
+  BlockGraph block_graph_;
+  pe::ImageLayout image_layout_;
+  std::vector<std::unique_ptr<BasicBlockSubGraph>> subgraphs_;
+};
+
+void LivenessAnalysisPerfTest::DecomposeFunctions() {
+  pe::PETransformPolicy policy;
+  BlockGraph::BlockMap::const_iterator it = block_graph_.blocks().begin();
+  for (; it != block_graph_.blocks().end(); ++it) {
+    const BlockGraph::Block* block = &it->second;
+    if (!policy.BlockIsSafeToBasicBlockDecompose(block))
+      continue;
+
+    std::unique_ptr<BasicBlockSubGraph> subgraph(new BasicBlockSubGraph());
+    BasicBlockDecomposer decomposer(block, subgraph.get());
+    if (decomposer.Decompose())
+      subgraphs_.push_back(std::move(subgraph));
+  }
+}
+
+}  // namespace
+
+TEST_F(LivenessAnalysisPerfTest, AnalyzeAllFunctions) {
+  ASSERT_NO_FATAL_FAILURE(DecomposeFunctions());
+  ASSERT_FALSE(subgraphs_.empty());
+
+  size_t basic_block_count = 0;
+  size_t single_block_count = 0;
+  for (size_t i = 0; i < subgraphs_.size(); ++i) {
+    basic_block_count += subgraphs_[i]->basic_blocks().size();
+    if (subgraphs_[i]->basic_blocks().size() == 1)
+      ++single_block_count;
+  }
+
+  base::TimeDelta analyze_time;
+  for (size_t iteration = 0; iteration < kIterations; ++iteration) {
+    base::TimeTicks start = base::TimeTicks::Now();
+    for (size_t i = 0; i < subgraphs_.size(); ++i) {
+      LivenessAnalysis liveness;
+      liveness.Analyze(subgraphs_[i].get());
+    }
+    analyze_time += base::TimeTicks::Now() - start;
+  }
+
+  perf_test::PrintResult("LivenessAnalyze", "", "all_functions",
+                         analyze_time.InMillisecondsF() / kIterations, "ms",
+                         true);
+  perf_test::PrintResult("LivenessFunctions", "", "all_functions",
+                         subgraphs_.size(), "functions", true);
+  perf_test::PrintResult("LivenessSingleBlockFunctions", "", "all_functions",
+                         single_block_count, "functions", true);
+  perf_test::PrintResult("LivenessBasicBlocks", "", "all_functions",
+                         basic_block_count, "basic blocks", true);
+}
+
+}  // namespace analysis
+}  // namespace block_graph
@@ -1783,6 +1783,110 @@ TEST_F(LivenessAnalysisTest, AnalyzeWithData) {
   EXPECT_TRUE(is_live(assm::esi));
 }
 
+TEST_F(LivenessAnalysisTest, SummaryMatchesPropagateBackward) {
+  asm_.mov(assm::eax, assm::ebx);
+  asm_.add(assm::ecx, Immediate(1));
+  asm_.mov(assm::esi, Operand(assm::edi));
+  asm_.cmp(assm::edx, assm::eax);
+  asm_.mov(assm::edi, Immediate(2));
+
+  State keep;
+  State gen;
+  StateHelper::Clear(&gen);
+  Instructions::reverse_iterator instr_iter = instructions_.rbegin();
+  for (; instr_iter != instructions_.rend(); ++instr_iter)
+    StateHelper::PropagateBackward(*instr_iter, &keep, &gen);
+
+  // Applying the summary to a state is the same as propagating the state
+  // through each instruction.
+  State exit_states[3];
+  StateHelper::Clear(&exit_states[1]);
+  StateHelper::Clear(&exit_states[2]);
+  StateHelper::Set(StateHelper::REGBITS_ESI | StateHelper::REGBITS_EBP,
+                   &exit_states[2]);
+  for (size_t i = 0; i < arraysize(exit_states); ++i) {
+    StateHelper::Copy(exit_states[i], &state_);
+    AnalyzeInstructionsWithoutReset();
+
+    State summarized(exit_states[i]);
+    StateHelper::Intersect(keep, &summarized);
+    StateHelper::Union(gen, &summarized);
+
+    State merged(state_);
+    EXPECT_FALSE(StateHelper::Union(summarized, &merged));
+    EXPECT_FALSE(StateHelper::Union(state_, &summarized));
+  }
+}
+
+TEST_F(LivenessAnalysisTest, AnalyzeSingleBlockLoop) {
+  BasicBlockSubGraph subgraph;
+
+  // Build and analyze this flow graph:
+  //       [loop]  <----
+  //       mov eax, ebx  |
+  //       mov ebx, ecx  |
+  //          |    \-----
+  //       [exit]
+  //       ret
+  BasicCodeBlock* loop = subgraph.AddBasicCodeBlock("loop");
+  BasicCodeBlock* exit = subgraph.AddBasicCodeBlock("exit");
+  AddSuccessorBetween(Successor::kConditionEqual, loop, loop);
+  AddSuccessorBetween(Successor::kConditionNotEqual, loop, exit);
+
+  BasicBlockAssembler asm_loop(loop->instructions().end(),
+                               &loop->instructions());
+  asm_loop.mov(assm::eax, assm::ebx);
+  asm_loop.mov(assm::ebx, assm::ecx);
+  BasicBlockAssembler asm_exit(exit->instructions().end(),
+                               &exit->instructions());
+  asm_exit.ret();
+
+  liveness_.Analyze(&subgraph);
+
+  // ecx flows into ebx, which is used by the next iteration.
+  liveness_.GetStateAtEntryOf(loop, &state_);
+  EXPECT_FALSE(is_live(assm::eax));
+  EXPECT_TRUE(is_live(assm::ebx));
+  EXPECT_TRUE(is_live(assm::ecx));
+
+  // The same analysis over a single basic block that loops on itself.
+  BasicBlockSubGraph single_subgraph;
+  BasicCodeBlock* single = single_subgraph.AddBasicCodeBlock("single");
+  AddSuccessorBetween(Successor::kConditionTrue, single, single);
+  BasicBlockAssembler asm_single(single->instructions().end(),
+                                 &single->instructions());
+  asm_single.mov(assm::eax, assm::ebx);
+  asm_single.mov(assm::ebx, assm::ecx);
+  asm_single.mov(assm::ecx, Immediate(0));
+
+  LivenessAnalysis single_liveness;
+  single_liveness.Analyze(&single_subgraph);
+  single_liveness.GetStateAtEntryOf(single, &state_);
+  EXPECT_FALSE(is_live(assm::eax));
+  EXPECT_TRUE(is_live(assm::ebx));
+  EXPECT_TRUE(is_live(assm::ecx));
+  EXPECT_FALSE(is_live(assm::esi));
+
+  // Basic blocks of other subgraphs aren't analyzed.
+  liveness_.GetStateAtEntryOf(single, &state_);
+  EXPECT_TRUE(is_live(assm::eax));
+  EXPECT_TRUE(is_live(assm::esi));
+}
+
+TEST_F(LivenessAnalysisTest, AnalyzeSingleBlock) {
+  BasicBlockSubGraph subgraph;
+  BasicCodeBlock* bb = subgraph.AddBasicCodeBlock("bb");
+  BasicBlockAssembler asm_bb(bb->instructions().end(), &bb->instructions());
+  asm_bb.mov(assm::eax, assm::ebx);
+
+  // The basic block has no successors, so everything is live at exit.
+  liveness_.Analyze(&subgraph);
+  liveness_.GetStateAtEntryOf(bb, &state_);
+  EXPECT_FALSE(is_live(assm::eax));
+  EXPECT_TRUE(is_live(assm::ebx));
+  EXPECT_TRUE(is_live(assm::esi));
+}
+
 }  // namespace
 
 }  // namespace analysis
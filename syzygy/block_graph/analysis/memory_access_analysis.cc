@@ -14,8 +14,11 @@
 
 #include "syzygy/block_graph/analysis/memory_access_analysis.h"
 
+#include <algorithm>
+#include <map>
 #include <queue>
 #include <set>
+#include <utility>
 #include <vector>
 
 // TODO(etienneb): liveness analysis internal should be hoisted to an
@@ -37,6 +40,115 @@ typedef assm::RegisterId RegisterId;
 typedef block_graph::BasicBlockSubGraph::BasicBlock BasicBlock;
 typedef block_graph::BasicBlockSubGraph::BasicBlock::Instructions Instructions;
 
+// The number of times the entry state of a basic block may shrink before it is
+// assumed to be empty. Shifted ranges flowing around a loop may otherwise
+// shrink one byte at a time.
+const size_t kMaxStateChanges = 16;
+
+// Gets the index of the 32-bit general purpose register @p reg.
+// @param reg A distorm register.
+// @param index Receives the index of the register.
+// @returns true if @p reg is a 32-bit general purpose register.
+bool GetRegister32Index(uint8_t reg, size_t* index) {
+  DCHECK(index != NULL);
+  if (reg < R_EAX || reg > R_EDI)
+    return false;
+
+  RegisterId reg_id = core::GetRegisterId(reg);
+  DCHECK_LE(assm::kRegister32Min, reg_id);
+  DCHECK_LT(reg_id, assm::kRegister32Max);
+  *index = reg_id - assm::kRegister32Min;
+  return true;
+}
+
+// Gets the range of bytes accessed by a simple memory operand.
+// @param instr The instruction.
+// @param op_id The index of the operand in @p instr.
+// @param base_reg Receives the index of the base register.
+// @param range Receives the range of offsets accessed from the base register.
+// @returns true if the operand is a simple memory dereference with a known
+//     size and without reference, false otherwise.
+bool GetAccessedRange(const Instruction& instr,
+                      size_t op_id,
+                      size_t* base_reg,
+                      std::pair<int64_t, int64_t>* range) {
+  DCHECK(base_reg != NULL);
+  DCHECK(range != NULL);
+
+  const _DInst& repr = instr.representation();
+  const _Operand& op = repr.ops[op_id];
+  if (op.type != O_SMEM || op.size == 0)
+    return false;
+
+  if (!GetRegister32Index(op.index, base_reg))
+    return false;
+
+  BasicBlockReference reference;
+  if (instr.FindOperandReference(op_id, &reference))
+    return false;
+
+  int64_t displ = static_cast<int32_t>(repr.disp);
+  *range = std::make_pair(displ, displ + (op.size + 7) / 8);
+  return true;
+}
+
+// Checks whether an instruction adds a constant to a 32-bit register.
+// @param instr The instruction.
+// @param base_reg Receives the index of the register.
+// @param delta Receives the constant.
+// @returns true if @p instr adds a constant to a register, false otherwise.
+bool GetRegisterShift(const Instruction& instr,
+                      size_t* base_reg,
+                      int32_t* delta) {
+  DCHECK(base_reg != NULL);
+  DCHECK(delta != NULL);
+
+  const _DInst& repr = instr.representation();
+  const _Operand& dst = repr.ops[0];
+  const _Operand& src = repr.ops[1];
+  if (dst.type != O_REG || !GetRegister32Index(dst.index, base_reg))
+    return false;
+
+  switch (repr.opcode) {
+    case I_INC:
+      *delta = 1;
+      return true;
+    case I_DEC:
+      *delta = -1;
+      return true;
+    case I_ADD:
+    case I_SUB: {
+      if (src.type != O_IMM)
+        return false;
+      int32_t imm = 0;
+      if (src.size == 8) {
+        imm = repr.imm.sbyte;
+      } else if (src.size == 32) {
+        imm = repr.imm.sdword;
+      } else {
+        return false;
+      }
+      *delta = repr.opcode == I_ADD ? imm : -imm;
+      return true;
+    }
+    case I_LEA: {
+      // lea reg, [reg + displ]
+      size_t src_reg = 0;
+      if (src.type != O_SMEM || !GetRegister32Index(src.index, &src_reg) ||
+          src_reg != *base_reg) {
+        return false;
+      }
+      BasicBlockReference reference;
+      if (instr.FindOperandReference(1, &reference))
+        return false;
+      *delta = static_cast<int32_t>(repr.disp);
+      return true;
+    }
+  }
+
+  return false;
+}
+
 }  // namespace
 
 MemoryAccessAnalysis::MemoryAccessAnalysis() {
@@ -80,8 +192,16 @@ void MemoryAccessAnalysis::PropagateForward(const Instruction& instr,
     return;
   }
 
+  // A register that is incremented by a constant keeps its accesses, shifted.
+  size_t shifted_reg = assm::kRegister32Count;
+  int32_t delta = 0;
+  if (!GetRegisterShift(instr, &shifted_reg, &delta))
+    shifted_reg = assm::kRegister32Count;
+
   for (size_t r = 0; r < assm::kRegister32Count; ++r) {
-    if (defs.IsLive(assm::kRegisters32[r])) {
+    if (r == shifted_reg) {
+      state->Shift(r, delta);
+    } else if (defs.IsLive(assm::kRegisters32[r])) {
       // This register is modified, clear all memory accesses with this base.
       state->active_memory_accesses_[r].clear();
     }
@@ -97,31 +217,7 @@ bool MemoryAccessAnalysis::Intersect(const block_graph::BasicBlock* bb,
     return true;
   }
 
-  bool changed = false;
-  // Subtract non redundant memory accesses.
-  for (size_t r = 0; r < assm::kRegister32Count; ++r) {
-    const std::set<int32_t>& from = state.active_memory_accesses_[r];
-    std::set<int32_t>& to = bbentry_state->second.active_memory_accesses_[r];
-
-    // In-place intersection. Remove unknown accesses of the destination set.
-    std::set<int32_t>::iterator it1 = to.begin();
-    std::set<int32_t>::const_iterator it2 = from.begin();
-    while (it1 != to.end()) {
-      if (it2 == from.end() || *it1 < *it2) {
-        std::set<int32_t>::iterator old = it1;
-        ++it1;
-        to.erase(old);
-        changed = true;
-      } else if (*it2 < *it1) {
-        ++it2;
-      } else {  // *it1 == *it2
-        ++it1;
-        ++it2;
-      }
-    }
-  }
-
-  return changed;
+  return bbentry_state->second.Intersect(state);
 }
 
 // This function performs a global redundant memory access analysis.
@@ -135,6 +231,7 @@ void MemoryAccessAnalysis::Analyze(const BasicBlockSubGraph* subgraph) {
 
   std::queue<const BasicBlock*> working;
   std::set<const BasicBlock*> marked;
+  std::map<const BasicBlock*, size_t> changes;
 
   states_.clear();
 
@@ -194,8 +291,11 @@ void MemoryAccessAnalysis::Analyze(const BasicBlockSubGraph* subgraph) {
         return;
       }
 
-      // Intersect current state with successor 'basic_block'.
+      // Intersect current state with successor 'basic_block'. Give up on
+      // the accesses of basic blocks whose state keeps shrinking.
       bool changed = Intersect(basic_block, state);
+      if (changed && ++changes[basic_block] > kMaxStateChanges)
+        states_[basic_block].Clear();
       if (changed) {
         // When not already in working queue, mark and add it.
         if (marked.insert(basic_block).second)
@@ -236,21 +336,13 @@ bool MemoryAccessAnalysis::State::HasNonRedundantAccess(
       case O_MEM:
         return true;
       case O_SMEM: {
-        if (op.index < R_EAX || op.index > R_EDI)
-          return true;
-
         // Simple memory dereference with optional displacement.
-        RegisterId base_reg_id = core::GetRegisterId(op.index);
-        DCHECK_LE(assm::kRegister32Min, base_reg_id);
-        DCHECK_LT(base_reg_id, assm::kRegister32Max);
-        size_t base_reg = base_reg_id - assm::kRegister32Min;
-
-        BasicBlockReference reference;
-        if (instr.FindOperandReference(op_id, &reference))
+        size_t base_reg = 0;
+        Range range;
+        if (!GetAccessedRange(instr, op_id, &base_reg, &range))
           return true;
 
-        const std::set<int32_t>& accesses = active_memory_accesses_[base_reg];
-        if (accesses.find(repr.disp) == accesses.end())
+        if (!Covers(base_reg, range))
           return true;
       }
       break;
@@ -273,31 +365,98 @@ void MemoryAccessAnalysis::State::Execute(const Instruction& instr) {
 
   // For each operand, insert them as a redundant access.
   for (size_t op_id = 0; op_id < OPERANDS_NO; ++op_id) {
-    const _Operand& op = repr.ops[op_id];
+    size_t base_reg = 0;
+    Range range;
+    if (GetAccessedRange(instr, op_id, &base_reg, &range))
+      Insert(base_reg, range);
+  }
+}
 
-    if (op.type != O_SMEM)
-      continue;
+void MemoryAccessAnalysis::State::Clear() {
+  for (size_t r = 0; r < assm::kRegister32Count; ++r) {
+    active_memory_accesses_[r].clear();
+  }
+}
 
-    if (op.index < R_EAX || op.index > R_EDI)
-      continue;
+void MemoryAccessAnalysis::State::Insert(size_t base_reg, const Range& range) {
+  DCHECK_LT(base_reg, static_cast<size_t>(assm::kRegister32Count));
+  DCHECK_LT(range.first, range.second);
+  Ranges& ranges = active_memory_accesses_[base_reg];
+
+  // Find the ranges that overlap or touch the new one, and merge them into it.
+  Ranges::iterator first = std::lower_bound(
+      ranges.begin(), ranges.end(), range,
+      [](const Range& r1, const Range& r2) { return r1.second < r2.first; });
+  Ranges::iterator last = first;
+  Range merged(range);
+  for (; last != ranges.end() && last->first <= merged.second; ++last) {
+    merged.first = std::min(merged.first, last->first);
+    merged.second = std::max(merged.second, last->second);
+  }
+
+  if (first == last) {
+    ranges.insert(first, merged);
+  } else {
+    *first = merged;
+    ranges.erase(first + 1, last);
+  }
+}
 
-    // Simple memory dereference with optional displacement.
-    RegisterId base_reg_id = core::GetRegisterId(op.index);
-    DCHECK_LE(assm::kRegister32Min, base_reg_id);
-    DCHECK_LT(base_reg_id, assm::kRegister32Max);
-    size_t base_reg = base_reg_id - assm::kRegister32Min;
+bool MemoryAccessAnalysis::State::Covers(size_t base_reg,
+                                         const Range& range) const {
+  DCHECK_LT(base_reg, static_cast<size_t>(assm::kRegister32Count));
+  const Ranges& ranges = active_memory_accesses_[base_reg];
 
-    BasicBlockReference reference;
-    if (instr.FindOperandReference(op_id, &reference))
-      continue;
+  // Find the last range that starts at or before the start of @p range.
+  Ranges::const_iterator it = std::upper_bound(
+      ranges.begin(), ranges.end(), range,
+      [](const Range& r1, const Range& r2) { return r1.first < r2.first; });
+  if (it == ranges.begin())
+    return false;
+  --it;
+  return range.second <= it->second;
+}
+
+bool MemoryAccessAnalysis::State::Intersect(const State& state) {
+  bool changed = false;
+  for (size_t r = 0; r < assm::kRegister32Count; ++r) {
+    const Ranges& from = state.active_memory_accesses_[r];
+    Ranges& to = active_memory_accesses_[r];
+
+    // Both lists are sorted, so they are intersected by a single merge.
+    Ranges intersection;
+    Ranges::const_iterator it1 = to.begin();
+    Ranges::const_iterator it2 = from.begin();
+    while (it1 != to.end() && it2 != from.end()) {
+      int64_t first = std::max(it1->first, it2->first);
+      int64_t second = std::min(it1->second, it2->second);
+      if (first < second)
+        intersection.push_back(std::make_pair(first, second));
+      if (it1->second < it2->second) {
+        ++it1;
+      } else {
+        ++it2;
+      }
+    }
 
-    active_memory_accesses_[base_reg].insert(repr.disp);
+    if (intersection != to) {
+      to.swap(intersection);
+      changed = true;
+    }
   }
+
+  return changed;
 }
 
-void MemoryAccessAnalysis::State::Clear() {
-  for (size_t r = 0; r < assm::kRegister32Count; ++r) {
-    active_memory_accesses_[r].clear();
+void MemoryAccessAnalysis::State::Shift(size_t base_reg, int32_t delta) {
+  DCHECK_LT(base_reg, static_cast<size_t>(assm::kRegister32Count));
+
+  // The bytes at [old_base + first, old_base + second) are now at
+  // [new_base + first - delta, new_base + second - delta).
+  Ranges& ranges = active_memory_accesses_[base_reg];
+  for (size_t i = 0; i < ranges.size(); ++i) {
+    ranges[i].first -= delta;
+    ranges[i].second -= delta;
   }
 }
 
@@ -30,6 +30,10 @@
 #ifndef SYZYGY_BLOCK_GRAPH_ANALYSIS_MEMORY_ACCESS_ANALYSIS_H_
 #define SYZYGY_BLOCK_GRAPH_ANALYSIS_MEMORY_ACCESS_ANALYSIS_H_
 
+#include <map>
+#include <utility>
+#include <vector>
+
 #include "syzygy/block_graph/basic_block.h"
 #include "syzygy/block_graph/basic_block_assembler.h"
 #include "syzygy/block_graph/basic_block_subgraph.h"
@@ -147,7 +151,10 @@ class MemoryAccessAnalysis {
 // This class contains the memory access information at a given program point.
 // The implementation only supports memory access through a single base register
 // (e.g. [eax] or [esi+12]). For each general purpose register (eax, ebx, ecx,
-// edx, esi, edi, esp, ebp) we keep a set of offsets accessed via the base.
+// edx, esi, edi, esp, ebp) we keep the ranges of bytes accessed via the base.
+// An access is redundant when all of its bytes were already accessed via the
+// same base. Ranges survive the base register being incremented or decremented
+// by a constant, as happens when walking a buffer.
 class MemoryAccessAnalysis::State {
  public:
   // On creation, a state is assumed to be empty.
@@ -169,11 +176,37 @@ class MemoryAccessAnalysis::State {
   // Simulate the execution of @intr and keep track of memory locations
   // accessed.
   // @param instr Instruction to analyze.
-  void State::Execute(const Instruction& instr);
+  void Execute(const Instruction& instr);
+
+  // A range [first, second) of offsets from a base register.
+  typedef std::pair<int64_t, int64_t> Range;
+  typedef std::vector<Range> Ranges;
+
+  // Record the access of a range of bytes.
+  // @param base_reg The index of the base register.
+  // @param range The range of offsets accessed from the base register.
+  void Insert(size_t base_reg, const Range& range);
+
+  // Check whether a range of bytes was accessed.
+  // @param base_reg The index of the base register.
+  // @param range The range of offsets from the base register.
+  // @returns true if every byte of @p range was accessed, false otherwise.
+  bool Covers(size_t base_reg, const Range& range) const;
+
+  // Keep only the bytes that were also accessed in @p state.
+  // @param state The state to intersect with.
+  // @returns true if this state changed, false otherwise.
+  bool Intersect(const State& state);
+
+  // Update the accesses via a base register after a constant was added to it.
+  // @param base_reg The index of the base register.
+  // @param delta The constant added to the base register.
+  void Shift(size_t base_reg, int32_t delta);
 
   // Contains active memory accesses. For each 32-bit base register, we keep a
-  // set of distances (displacements) done via the base register.
-  std::set<int32_t> active_memory_accesses_[assm::kRegister32Count];
+  // sorted list of disjoint, non-adjacent ranges of offsets accessed via the
+  // base register.
+  Ranges active_memory_accesses_[assm::kRegister32Count];
 
   friend class MemoryAccessAnalysis;
 };
@@ -52,12 +52,31 @@ const uint8_t kLeaEax42[] = {0x8D, 0x48, 0x2A};
 const uint8_t kRepMovsb[] = {0xF2, 0xA4};
 
 // _asm add ecx, [eax + C]
+const uint8_t kReadEax4[] = {0x03, 0x48, 0x04};
 const uint8_t kReadEax10[] = {0x03, 0x48, 0x0A};
-const uint8_t kReadEax11[] = {0x03, 0x48, 0x0B};
-const uint8_t kReadEax12[] = {0x03, 0x48, 0x0C};
-const uint8_t kReadEax13[] = {0x03, 0x48, 0x0D};
 const uint8_t kReadEax14[] = {0x03, 0x48, 0x0E};
-const uint8_t kReadEax15[] = {0x03, 0x48, 0x0F};
+const uint8_t kReadEax18[] = {0x03, 0x48, 0x12};
+const uint8_t kReadEax22[] = {0x03, 0x48, 0x16};
+const uint8_t kReadEax30[] = {0x03, 0x48, 0x1E};
+// _asm add ecx, [eax + 2]
+const uint8_t kReadEax2[] = {0x03, 0x48, 0x02};
+// _asm add ecx, [eax - 4]
+const uint8_t kReadEaxMinus4[] = {0x03, 0x48, 0xFC};
+// _asm mov cl, [eax]
+const uint8_t kReadByteEax[] = {0x8A, 0x08};
+// _asm mov cl, [eax + 3]
+const uint8_t kReadByteEax3[] = {0x8A, 0x48, 0x03};
+
+// _asm add eax, 4
+const uint8_t kAddEax4[] = {0x83, 0xC0, 0x04};
+// _asm sub eax, 4
+const uint8_t kSubEax4[] = {0x83, 0xE8, 0x04};
+// _asm add eax, 0x1000
+const uint8_t kAddEax1000[] = {0x05, 0x00, 0x10, 0x00, 0x00};
+// _asm inc eax
+const uint8_t kIncEax[] = {0x40};
+// _asm lea eax, [eax + 8]
+const uint8_t kLeaEaxEax8[] = {0x8D, 0x40, 0x08};
 
 // _asm ret
 const uint8_t kRet[] = {0xC3};
@@ -138,9 +157,9 @@ bool TestMemoryAccessAnalysisState::IsEmpty() const {
 
 bool TestMemoryAccessAnalysisState::Contains(const assm::Register32& reg,
                                              int32_t displ) const {
-  const std::set<int32_t>& offsets =
-      active_memory_accesses_[reg.id() - assm::kRegister32Min];
-  return offsets.find(displ) != offsets.end();
+  // All the accesses in these tests are 32-bit wide.
+  return Covers(reg.id() - assm::kRegister32Min,
+                std::make_pair(displ, displ + 4));
 }
 
 template <size_t N>
@@ -331,52 +350,50 @@ TEST_F(MemoryAccessAnalysisTest, IntersectEmpty) {
 }
 
 TEST_F(MemoryAccessAnalysisTest, IntersectStates) {
-  // Intersection with displacements [10, 11, 12, 13, 14, 15].
+  // Intersection with displacements [10, 14, 18, 22], or bytes [10, 26).
   TestMemoryAccessAnalysisState state1;
   state1.Execute(kReadEax10);
-  state1.Execute(kReadEax11);
-  state1.Execute(kReadEax12);
-  state1.Execute(kReadEax13);
   state1.Execute(kReadEax14);
-  state1.Execute(kReadEax15);
+  state1.Execute(kReadEax18);
+  state1.Execute(kReadEax22);
   Intersect(bb_, state1);
 
-  // Intersection with displacements [10, 11, 12, 14].
+  // Intersection with displacements [10, 14, 22], or bytes [10, 18) and
+  // [22, 26).
   TestMemoryAccessAnalysisState state2;
   state2.Execute(kReadEax10);
-  state2.Execute(kReadEax11);
-  state2.Execute(kReadEax12);
   state2.Execute(kReadEax14);
+  state2.Execute(kReadEax22);
   Intersect(bb_, state2);
 
-  // Check current state [10, 11, 12, 14].
+  // Check current state [10, 18) and [22, 26).
   GetStateAtEntryOf(bb_, &state_);
   EXPECT_TRUE(state_.Contains(assm::eax, 10));
-  EXPECT_TRUE(state_.Contains(assm::eax, 11));
   EXPECT_TRUE(state_.Contains(assm::eax, 12));
-  EXPECT_FALSE(state_.Contains(assm::eax, 13));
   EXPECT_TRUE(state_.Contains(assm::eax, 14));
-  EXPECT_FALSE(state_.Contains(assm::eax, 15));
+  EXPECT_FALSE(state_.Contains(assm::eax, 16));
+  EXPECT_FALSE(state_.Contains(assm::eax, 18));
+  EXPECT_TRUE(state_.Contains(assm::eax, 22));
 
-  // Intersection with displacements [10, 11, 15].
+  // Intersection with displacements [10, 22], or bytes [10, 14) and [22, 26).
   TestMemoryAccessAnalysisState state3;
   state3.Execute(kReadEax10);
-  state3.Execute(kReadEax11);
-  state3.Execute(kReadEax15);
+  state3.Execute(kReadEax22);
   Intersect(bb_, state3);
 
-  // Check current state [10, 11].
+  // Check current state [10, 14) and [22, 26).
   GetStateAtEntryOf(bb_, &state_);
   EXPECT_TRUE(state_.Contains(assm::eax, 10));
-  EXPECT_TRUE(state_.Contains(assm::eax, 11));
   EXPECT_FALSE(state_.Contains(assm::eax, 12));
-  EXPECT_FALSE(state_.Contains(assm::eax, 13));
   EXPECT_FALSE(state_.Contains(assm::eax, 14));
-  EXPECT_FALSE(state_.Contains(assm::eax, 15));
+  EXPECT_TRUE(state_.Contains(assm::eax, 22));
 
-  // Intersection with displacements [15].
+  // Intersecting with the same state doesn't change it.
+  EXPECT_FALSE(Intersect(bb_, state3));
+
+  // Intersection with displacements [30].
   TestMemoryAccessAnalysisState state4;
-  state4.Execute(kReadEax15);
+  state4.Execute(kReadEax30);
   Intersect(bb_, state4);
 
   // The state must be empty.
@@ -384,6 +401,53 @@ TEST_F(MemoryAccessAnalysisTest, IntersectStates) {
   EXPECT_TRUE(state_.IsEmpty());
 }
 
+TEST_F(MemoryAccessAnalysisTest, AccessSizes) {
+  // A byte access doesn't cover a wider access at the same address.
+  ASSERT_NO_FATAL_FAILURE(PropagateForward(kReadByteEax));
+  EXPECT_TRUE(state_.HasNonRedundantAccess(kReadEax));
+  EXPECT_FALSE(state_.HasNonRedundantAccess(kReadByteEax));
+
+  // A wider access covers the byte accesses within it.
+  ASSERT_NO_FATAL_FAILURE(PropagateForward(kReadEax));
+  EXPECT_FALSE(state_.HasNonRedundantAccess(kReadByteEax3));
+  EXPECT_TRUE(state_.HasNonRedundantAccess(kReadEax2));
+
+  // Adjacent accesses are merged, and cover the accesses spanning them.
+  ASSERT_NO_FATAL_FAILURE(PropagateForward(kReadEax4));
+  EXPECT_FALSE(state_.HasNonRedundantAccess(kReadEax2));
+  EXPECT_TRUE(state_.HasNonRedundantAccess(kReadEaxMinus4));
+}
+
+TEST_F(MemoryAccessAnalysisTest, ShiftedBaseRegister) {
+  ASSERT_NO_FATAL_FAILURE(PropagateForward(kReadEax));
+  ASSERT_NO_FATAL_FAILURE(PropagateForward(kReadEax4));
+
+  // After eax += 4, the accessed bytes are [eax - 4, eax + 4).
+  ASSERT_NO_FATAL_FAILURE(PropagateForward(kAddEax4));
+  EXPECT_TRUE(state_.Contains(assm::eax, -4));
+  EXPECT_TRUE(state_.Contains(assm::eax, 0));
+  EXPECT_FALSE(state_.Contains(assm::eax, 4));
+
+  ASSERT_NO_FATAL_FAILURE(PropagateForward(kSubEax4));
+  EXPECT_TRUE(state_.Contains(assm::eax, 0));
+  EXPECT_TRUE(state_.Contains(assm::eax, 4));
+
+  ASSERT_NO_FATAL_FAILURE(PropagateForward(kIncEax));
+  EXPECT_TRUE(state_.Contains(assm::eax, -1));
+  EXPECT_FALSE(state_.Contains(assm::eax, 4));
+
+  ASSERT_NO_FATAL_FAILURE(PropagateForward(kLeaEaxEax8));
+  EXPECT_TRUE(state_.Contains(assm::eax, -9));
+  EXPECT_FALSE(state_.Contains(assm::eax, -1));
+
+  ASSERT_NO_FATAL_FAILURE(PropagateForward(kAddEax1000));
+  EXPECT_TRUE(state_.Contains(assm::eax, -9 - 0x1000));
+
+  // Any other definition of the register clears its accesses.
+  ASSERT_NO_FATAL_FAILURE(PropagateForward(kClearEax));
+  EXPECT_TRUE(state_.IsEmpty());
+}
+
 TEST_F(MemoryAccessAnalysisTest, PropagateForwardSimple) {
   ASSERT_NO_FATAL_FAILURE(PropagateForward(kReadEax10));
   EXPECT_TRUE(state_.Contains(assm::eax, 10));
@@ -526,5 +590,58 @@ TEST_F(MemoryAccessAnalysisTest, AnalyzeWithData) {
   EXPECT_TRUE(state_.IsEmpty());
 }
 
+TEST_F(MemoryAccessAnalysisTest, AnalyzeLoopWithInvariantBase) {
+  BasicBlockSubGraph subgraph;
+
+  BlockDescription* block = subgraph.AddBlockDescription(
+      "b1", "b1.obj", BlockGraph::CODE_BLOCK, 7, 2, 42);
+
+  // Build and analyze this flow graph:
+  //       [entry]
+  //       mov ecx, [esi]
+  //          |
+  //       [loop]  <-------
+  //       mov edx, [esi]   |
+  //       mov edx, [edi]   |
+  //       add edi, 4       |
+  //          |     \-------
+  //       [exit]
+  BasicCodeBlock* bb_entry = subgraph.AddBasicCodeBlock("entry");
+  BasicCodeBlock* bb_loop = subgraph.AddBasicCodeBlock("loop");
+  BasicCodeBlock* bb_exit = subgraph.AddBasicCodeBlock("exit");
+
+  block->basic_block_order.push_back(bb_entry);
+  block->basic_block_order.push_back(bb_loop);
+  block->basic_block_order.push_back(bb_exit);
+
+  AddSuccessorBetween(Successor::kConditionTrue, bb_entry, bb_loop);
+  AddSuccessorBetween(Successor::kConditionEqual, bb_loop, bb_loop);
+  AddSuccessorBetween(Successor::kConditionNotEqual, bb_loop, bb_exit);
+
+  BasicBlockAssembler asm_entry(bb_entry->instructions().end(),
+                                &bb_entry->instructions());
+  asm_entry.mov(assm::ecx, Operand(assm::esi));
+
+  BasicBlockAssembler asm_loop(bb_loop->instructions().end(),
+                               &bb_loop->instructions());
+  asm_loop.mov(assm::edx, Operand(assm::esi));
+  asm_loop.mov(assm::edx, Operand(assm::edi));
+  asm_loop.add(assm::edi, Immediate(4));
+
+  memory_access_.Analyze(&subgraph);
+
+  // The access through the invariant base is known on every iteration, but
+  // the one through the induction variable isn't.
+  GetStateAtEntryOf(bb_loop, &state_);
+  EXPECT_TRUE(state_.Contains(assm::esi, 0));
+  EXPECT_TRUE(state_.IsEmpty(assm::edi));
+
+  // On exit, both are known.
+  GetStateAtEntryOf(bb_exit, &state_);
+  EXPECT_TRUE(state_.Contains(assm::esi, 0));
+  EXPECT_TRUE(state_.Contains(assm::edi, -4));
+  EXPECT_FALSE(state_.Contains(assm::edi, 0));
+}
+
 }  // namespace analysis
 }  // namespace block_graph
@@ -250,7 +250,8 @@ void BasicBlockTest::InitBasicBlockSubGraphWithLabelPastEnd() {
       block_graph::BasicEndBlock::Cast(bb);
   ASSERT_TRUE(beb != NULL);
 
-  BlockGraph::Label expected_label("debug-end", BlockGraph::DEBUG_END_LABEL);
+  BlockGraph::Label expected_label("debug-end", BlockGraph::DEBUG_END_LABEL,
+                                   &block_graph_.string_table());
   ASSERT_TRUE(beb->has_label());
   ASSERT_EQ(expected_label, beb->label());
 
@@ -47,11 +47,12 @@ class BasicBlockTest: public testing::Test {
     basic_data_block_ =
         subgraph_.AddBasicDataBlock(kBlockName, kBlockSize, kBlockData);
     basic_data_block_->set_label(BlockGraph::Label(
-        "data", BlockGraph::DATA_LABEL | BlockGraph::CASE_TABLE_LABEL));
+        "data", BlockGraph::DATA_LABEL | BlockGraph::CASE_TABLE_LABEL,
+        &block_graph_.string_table()));
     basic_end_block_ =
         subgraph_.AddBasicEndBlock();
     basic_end_block_->set_label(BlockGraph::Label(
-        "end", BlockGraph::DEBUG_END_LABEL));
+        "end", BlockGraph::DEBUG_END_LABEL, &block_graph_.string_table()));
   }
 
   // Convert @p opcode to a branch type.
@@ -114,7 +115,8 @@ class BasicBlockTest: public testing::Test {
     EXPECT_TRUE(call_inst.IsCall());
     call_inst.SetReference(1, ref);
     EXPECT_FALSE(call_inst.has_label());
-    call_inst.set_label(BlockGraph::Label("call", BlockGraph::CALL_SITE_LABEL));
+    call_inst.set_label(BlockGraph::Label(
+        "call", BlockGraph::CALL_SITE_LABEL, &block_graph_.string_table()));
     EXPECT_TRUE(call_inst.has_label());
     EXPECT_TRUE(call_inst.label().has_attributes(BlockGraph::CALL_SITE_LABEL));
     return call_inst;
@@ -544,7 +546,8 @@ TEST_F(SuccessorTest, LabelsAndTags) {
   Successor successor;
   EXPECT_FALSE(successor.has_label());
 
-  BlockGraph::Label label("Foo", BlockGraph::CODE_LABEL);
+  BlockGraph::Label label("Foo", BlockGraph::CODE_LABEL,
+                          &block_graph_.string_table());
   successor.set_label(label);
   successor.tags().insert(&successor);
 
@@ -659,7 +662,8 @@ TEST_F(InstructionTest, ConstructionFromData) {
   EXPECT_EQ(O_PC, repr.ops[0].type);
   TestInstructionCopy(call);
 
-  BlockGraph::Label label("Foo", BlockGraph::CODE_LABEL);
+  BlockGraph::Label label("Foo", BlockGraph::CODE_LABEL,
+                          &block_graph_.string_table());
   call.set_label(label);
   EXPECT_EQ(label, call.label());
   TestInstructionCopy(call);
@@ -671,7 +675,7 @@ TEST_F(InstructionTest, Copy) {
   ASSERT_TRUE(
       Instruction::FromBuffer(kCallRelative, arraysize(kCallRelative), &call));
   call.set_source_range(Instruction::SourceRange(core::RelativeAddress(0), 5));
-  call.set_label(BlockGraph::Label("foo", 0));
+  call.set_label(BlockGraph::Label("foo", 0, &block_graph_.string_table()));
   call.tags().insert(&call);
 
   Instruction copy(call);
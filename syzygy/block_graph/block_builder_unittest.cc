@@ -126,9 +126,13 @@ class BlockBuilderTest : public testing::BasicBlockTest {
                   0));
 
     // BB5 and BB6 both carry labels.
-    bb5->set_label(BlockGraph::Label("bb5", BlockGraph::CODE_LABEL));
-    if (multi_end_block)
-      bb6->set_label(BlockGraph::Label("bb6", BlockGraph::DEBUG_END_LABEL));
+    core::StringTable* string_table = &block_graph_.string_table();
+    bb5->set_label(
+        BlockGraph::Label("bb5", BlockGraph::CODE_LABEL, string_table));
+    if (multi_end_block) {
+      bb6->set_label(
+          BlockGraph::Label("bb6", BlockGraph::DEBUG_END_LABEL, string_table));
+    }
 
     BasicBlockSubGraph::BlockDescription* d1 = subgraph_.AddBlockDescription(
         "new_block", "new_compiland", BlockGraph::CODE_BLOCK, 0, 1, 0);
@@ -151,9 +155,11 @@ class BlockBuilderTest : public testing::BasicBlockTest {
     BlockGraph::Label expected_label;
     if (multi_end_block) {
       expected_label = BlockGraph::Label(
-          "bb5, bb6", BlockGraph::CODE_LABEL | BlockGraph::DEBUG_END_LABEL);
+          "bb5, bb6", BlockGraph::CODE_LABEL | BlockGraph::DEBUG_END_LABEL,
+          string_table);
     } else {
-      expected_label = BlockGraph::Label("bb5", BlockGraph::CODE_LABEL);
+      expected_label =
+          BlockGraph::Label("bb5", BlockGraph::CODE_LABEL, string_table);
     }
     BlockGraph::Label label;
     EXPECT_TRUE(new_block->GetLabel(new_block->size(), &label));
@@ -307,7 +313,9 @@ TEST_F(BlockBuilderTest, Merge) {
 
   // Flesh out bb1 with an instruction having a reference and 2 successors.
   Instruction* inst = AddInstruction(bb1, kCall, sizeof(kCall));
-  Label label_1("1", BlockGraph::CODE_LABEL | BlockGraph::CALL_SITE_LABEL);
+  core::StringTable* string_table = &block_graph_.string_table();
+  Label label_1("1", BlockGraph::CODE_LABEL | BlockGraph::CALL_SITE_LABEL,
+                string_table);
   inst->set_label(label_1);
   ASSERT_TRUE(inst != NULL);
   BasicBlockReference bb1_abs_ref(BlockGraph::ABSOLUTE_REF, 4, other, 0, 0);
@@ -328,7 +336,7 @@ TEST_F(BlockBuilderTest, Merge) {
 
   // Flesh out bb2 with some instructions and no successor.
   inst = AddInstruction(bb2, testing::kNop2, sizeof(testing::kNop2));
-  Label label_2("2", BlockGraph::CODE_LABEL);
+  Label label_2("2", BlockGraph::CODE_LABEL, string_table);
   inst->set_label(label_2);
   ASSERT_TRUE(inst != NULL);
   ASSERT_TRUE(
@@ -338,7 +346,7 @@ TEST_F(BlockBuilderTest, Merge) {
   // We set tags on the successor and its reference. Since these are elided
   // we expect zero-sized entries in the tag info map.
   inst = AddInstruction(bb3, testing::kNop2, sizeof(testing::kNop2));
-  Label label_3("3", BlockGraph::CODE_LABEL);
+  Label label_3("3", BlockGraph::CODE_LABEL, string_table);
   inst->set_label(label_3);
   ASSERT_TRUE(inst != NULL);
   ASSERT_TRUE(
@@ -348,7 +356,7 @@ TEST_F(BlockBuilderTest, Merge) {
   Successor bb3_succ(Successor::kConditionTrue, bb3_succ_ref, 0);
   bb3_succ.tags().insert(&bb3_succ);
   bb3->successors().push_back(bb3_succ);
-  Label label_4("4", BlockGraph::CODE_LABEL);
+  Label label_4("4", BlockGraph::CODE_LABEL, string_table);
   bb3->successors().back().set_label(label_4);
 
   // Flesh out bb4 with some instructions and a single successor.
@@ -363,7 +371,8 @@ TEST_F(BlockBuilderTest, Merge) {
 
   // Flesh out table with references. Make the table aligned so that we test
   // our NOP insertion code.
-  Label label_5("5", BlockGraph::DATA_LABEL | BlockGraph::JUMP_TABLE_LABEL);
+  Label label_5("5", BlockGraph::DATA_LABEL | BlockGraph::JUMP_TABLE_LABEL,
+                string_table);
   table->set_label(label_5);
   table->set_alignment(4);
   ASSERT_TRUE(table->references().insert(std::make_pair(
@@ -473,7 +482,8 @@ TEST_F(BlockBuilderTest, FailsForInvalidEndBlockPlacement) {
   BasicCodeBlock* bb1 = CreateCodeBB("bb1", 10);
   BasicEndBlock* bb2 = subgraph_.AddBasicEndBlock();
 
-  bb2->set_label(BlockGraph::Label("bb2", BlockGraph::CODE_LABEL));
+  bb2->set_label(BlockGraph::Label("bb2", BlockGraph::CODE_LABEL,
+                                   &block_graph_.string_table()));
 
   // Place the end block in an invalid location in the basic block order.
   BasicBlockSubGraph::BlockDescription* d1 = subgraph_.AddBlockDescription(
@@ -15,8 +15,11 @@
 #include "syzygy/block_graph/block_graph.h"
 
 #include <limits>
+#include <new>
+#include <type_traits>
 
 #include "base/logging.h"
+#include "base/strings/string_util.h"
 #include "base/strings/stringprintf.h"
 
 // Pretty prints a BlockInfo to an ostream. This has to be outside of any
@@ -69,6 +72,22 @@ const char* kBlockType[] = {
 static_assert(arraysize(kBlockType) == BlockGraph::BLOCK_TYPE_MAX,
               "Block type not in sync.");
 
+// Moves the nodes of @p container into an empty container that is constructed
+// in @p arena and never destroyed. The nodes are then released along with the
+// arena slabs, rather than one at a time.
+template <typename Container>
+void AbandonToArena(core::Arena* arena, Container* container) {
+  static_assert(
+      std::is_trivially_destructible<typename Container::value_type>::value,
+      "Abandoned nodes must not need to be destroyed.");
+  DCHECK(arena != NULL);
+  DCHECK_EQ(arena, container->get_allocator().arena());
+  void* storage = arena->Allocate(sizeof(Container));
+  Container* abandoned = new (storage) Container(container->key_comp(),
+                                                 container->get_allocator());
+  abandoned->swap(*container);
+}
+
 // Shift all items in an offset -> item map by 'distance', provided the initial
 // item offset was >= @p offset.
 template<typename ItemType>
@@ -259,7 +278,23 @@ BlockGraph::BlockGraph()
       image_format_(UNKNOWN_IMAGE_FORMAT) {
 }
 
+BlockGraph::BlockGraph(AllocationMode allocation_mode)
+    : arena_(allocation_mode == kArenaAllocation ? new core::Arena() : NULL),
+      next_section_id_(0),
+      blocks_(BlockMap::key_compare(), BlockMap::allocator_type(arena_.get())),
+      next_block_id_(0),
+      image_format_(UNKNOWN_IMAGE_FORMAT) {
+}
+
 BlockGraph::~BlockGraph() {
+  if (arena_.get() == NULL)
+    return;
+
+  // The blocks may own heap memory so they are still destroyed one by one, but
+  // their references, referrers and labels are released with the arena.
+  BlockMap::iterator it = blocks_.begin();
+  for (; it != blocks_.end(); ++it)
+    it->second.AbandonArenaNodes();
 }
 
 BlockGraph::Section* BlockGraph::AddSection(const base::StringPiece& name,
@@ -795,9 +830,23 @@ bool BlockGraph::Section::Load(core::InArchive* in_archive) {
       in_archive->Load(&characteristics_);
 }
 
+BlockGraph::Label::Label(const base::StringPiece& name,
+                         LabelAttributes attributes,
+                         core::StringTable* string_table)
+    : string_table_(string_table), attributes_(attributes) {
+  DCHECK(string_table != NULL);
+  name_id_ = string_table->InternStringId(name);
+}
+
+const std::string& BlockGraph::Label::name() const {
+  if (string_table_ == NULL)
+    return base::EmptyString();
+  return string_table_->GetString(name_id_);
+}
+
 std::string BlockGraph::Label::ToString() const {
   return base::StringPrintf("%s (%s)",
-                            name_.c_str(),
+                            name().c_str(),
                             LabelAttributesToString(attributes_).c_str());
 }
 
@@ -873,12 +922,18 @@ BlockGraph::Block::Block(BlockGraph* block_graph)
       alignment_(1U),
       alignment_offset_(0),
       padding_before_(0U),
-      name_(NULL),
-      compiland_name_(NULL),
+      name_id_(core::StringTable::kInvalidStringId),
+      compiland_name_id_(core::StringTable::kInvalidStringId),
       addr_(RelativeAddress::kInvalidAddress),
       block_graph_(block_graph),
       section_(kInvalidSectionId),
       attributes_(0U),
+      references_(ReferenceMap::key_compare(),
+                  ReferenceMap::allocator_type(block_graph->arena())),
+      referrers_(ReferrerSet::key_compare(),
+                 ReferrerSet::allocator_type(block_graph->arena())),
+      labels_(LabelMap::key_compare(),
+              LabelMap::allocator_type(block_graph->arena())),
       owns_data_(false),
       data_(NULL),
       data_size_(0U) {
@@ -896,12 +951,18 @@ BlockGraph::Block::Block(BlockId id,
       alignment_(1U),
       alignment_offset_(0),
       padding_before_(0U),
-      name_(NULL),
-      compiland_name_(NULL),
+      name_id_(core::StringTable::kInvalidStringId),
+      compiland_name_id_(core::StringTable::kInvalidStringId),
       addr_(RelativeAddress::kInvalidAddress),
       block_graph_(block_graph),
       section_(kInvalidSectionId),
       attributes_(0U),
+      references_(ReferenceMap::key_compare(),
+                  ReferenceMap::allocator_type(block_graph->arena())),
+      referrers_(ReferrerSet::key_compare(),
+                 ReferrerSet::allocator_type(block_graph->arena())),
+      labels_(LabelMap::key_compare(),
+              LabelMap::allocator_type(block_graph->arena())),
       owns_data_(false),
       data_(NULL),
       data_size_(0U) {
@@ -917,23 +978,26 @@ BlockGraph::Block::~Block() {
 
 void BlockGraph::Block::set_name(const base::StringPiece& name) {
   DCHECK(block_graph_ != NULL);
-  const std::string& interned_name =
-      block_graph_->string_table().InternString(name);
-  name_ = &interned_name;
+  name_id_ = block_graph_->string_table().InternStringId(name);
 }
 
 const std::string& BlockGraph::Block::compiland_name() const {
   DCHECK(block_graph_ != NULL);
-  if (compiland_name_ == NULL)
-    return block_graph_->string_table().InternString("");
-  return *compiland_name_;
+  if (compiland_name_id_ == core::StringTable::kInvalidStringId)
+    return base::EmptyString();
+  return block_graph_->string_table().GetString(compiland_name_id_);
 }
 
 void BlockGraph::Block::set_compiland_name(const base::StringPiece& name) {
   DCHECK(block_graph_ != NULL);
-  const std::string& interned_name =
-      block_graph_->string_table().InternString(name);
-  compiland_name_ = &interned_name;
+  compiland_name_id_ = block_graph_->string_table().InternStringId(name);
+}
+
+void BlockGraph::Block::AbandonArenaNodes() {
+  core::Arena* arena = block_graph_->arena();
+  AbandonToArena(arena, &references_);
+  AbandonToArena(arena, &referrers_);
+  AbandonToArena(arena, &labels_);
 }
 
 uint8_t* BlockGraph::Block::AllocateRawData(size_t data_size) {
@@ -1301,9 +1365,16 @@ bool BlockGraph::Block::SetLabel(Offset offset, const Label& label) {
           << LabelAttributesToString(label.attributes()) << " label '"
           << label.name() << "' at offset " << offset << ".";
 
-  // Try inserting the label into the label map.
-  std::pair<LabelMap::iterator, bool> result(
-      labels_.insert(std::make_pair(offset, label)));
+  // Labels stored in the block always refer to the string table of the block
+  // graph, so that they remain valid for as long as the block does.
+  core::StringTable* string_table = &block_graph_->string_table();
+  std::pair<LabelMap::iterator, bool> result;
+  if (label.string_table_ == string_table) {
+    result = labels_.insert(std::make_pair(offset, label));
+  } else {
+    result = labels_.insert(std::make_pair(
+        offset, Label(label.name(), label.attributes(), string_table)));
+  }
 
   // If it was freshly inserted then we're done.
   if (result.second)
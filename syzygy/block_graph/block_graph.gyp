@@ -46,6 +46,8 @@
         'hot_patching_metadata.h',
         'iterate.cc',
         'iterate.h',
+        'lazy_block_graph_loader.cc',
+        'lazy_block_graph_loader.h',
         'ordered_block_graph.cc',
         'ordered_block_graph.h',
         'ordered_block_graph_internal.h',
@@ -99,6 +101,7 @@
         'filter_util_unittest.cc',
         'filterable_unittest.cc',
         'iterate_unittest.cc',
+        'lazy_block_graph_loader_unittest.cc',
         'ordered_block_graph_unittest.cc',
         'orderer_unittest.cc',
         'transform_unittest.cc',
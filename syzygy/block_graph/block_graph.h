@@ -25,6 +25,7 @@
 #define SYZYGY_BLOCK_GRAPH_BLOCK_GRAPH_H_
 
 #include <map>
+#include <memory>
 #include <set>
 #include <string>
 #include <unordered_map>
@@ -34,6 +35,7 @@
 #include "base/strings/string_piece.h"
 #include "syzygy/common/align.h"
 #include "syzygy/core/address.h"
+#include "syzygy/core/arena.h"
 #include "syzygy/core/address_space.h"
 #include "syzygy/core/string_table.h"
 
@@ -242,9 +244,25 @@ class BlockGraph {
   struct BlockIdLess;
 
   // The block map contains all blocks, indexed by id.
-  typedef std::map<BlockId, Block> BlockMap;
+  typedef std::map<BlockId, Block, std::less<BlockId>,
+                   core::ArenaAllocator<std::pair<const BlockId, Block>>>
+      BlockMap;
+
+  // Determines where the blocks and their reference, referrer and label maps
+  // get their memory from.
+  enum AllocationMode {
+    // Every block, reference, referrer and label is allocated on the heap.
+    kHeapAllocation,
+    // Blocks, references, referrers and labels are allocated from slabs owned
+    // by the block graph. This saves millions of tiny heap allocations when
+    // dealing with large images, and the slabs are all released in one shot
+    // when the block graph is destroyed. This is not thread-safe, even for
+    // operations touching distinct blocks.
+    kArenaAllocation,
+  };
 
   BlockGraph();
+  explicit BlockGraph(AllocationMode allocation_mode);
   ~BlockGraph();
 
   // Adds a section with the given name.
@@ -345,6 +363,16 @@ class BlockGraph {
   // Get the string table.
   // @returns the string table of this BlockGraph.
   core::StringTable& string_table() { return string_table_; }
+  const core::StringTable& string_table() const { return string_table_; }
+
+  // @returns the allocation mode of this BlockGraph.
+  AllocationMode allocation_mode() const {
+    return arena_.get() != NULL ? kArenaAllocation : kHeapAllocation;
+  }
+
+  // @returns the arena from which the blocks of this BlockGraph are
+  //     allocated, or NULL if this BlockGraph uses kHeapAllocation.
+  core::Arena* arena() const { return arena_.get(); }
 
   // Sets the image format.
   // @param image_format The format of the image.
@@ -361,6 +389,10 @@ class BlockGraph {
   // Removes a block by the iterator to it. The iterator must be valid.
   bool RemoveBlockByIterator(BlockMap::iterator it);
 
+  // The arena used to allocate our blocks and their maps, if any. This needs
+  // to outlive all of the blocks, so it is declared first.
+  std::unique_ptr<core::Arena> arena_;
+
   // All sections we contain.
   SectionMap sections_;
 
@@ -480,22 +512,34 @@ struct BlockGraph::Section {
 class BlockGraph::Label {
  public:
   // Default constructor.
-  Label() : attributes_(0) {
+  Label()
+      : string_table_(NULL),
+        name_id_(core::StringTable::kInvalidStringId),
+        attributes_(0) {
   }
 
   // Full constructor.
-  Label(const base::StringPiece& name, LabelAttributes attributes)
-      : name_(name.begin(), name.end()), attributes_(attributes) {
-  }
+  // @param name the name of the label.
+  // @param attributes the attributes of the label.
+  // @param string_table the string table in which @p name is interned. This
+  //     must outlive the label. When the label is set on a block its name is
+  //     interned in the string table of the block graph instead.
+  // @note Interning a name is not thread-safe with respect to other users of
+  //     @p string_table.
+  Label(const base::StringPiece& name,
+        LabelAttributes attributes,
+        core::StringTable* string_table);
 
   // Copy construction.
   Label(const Label& other)
-      : name_(other.name_), attributes_(other.attributes_) {
+      : string_table_(other.string_table_),
+        name_id_(other.name_id_),
+        attributes_(other.attributes_) {
   }
 
   // @name Accessors.
   // @{
-  const std::string& name() const { return name_; }
+  const std::string& name() const;
   // @}
 
   // A helper function for logging and debugging.
@@ -503,7 +547,7 @@ class BlockGraph::Label {
 
   // Equality comparator for unittesting.
   bool operator==(const Label& other) const {
-    return name_ == other.name_ && attributes_ == other.attributes_;
+    return name() == other.name() && attributes_ == other.attributes_;
   }
 
   // The label attributes are a bitmask. You can set them wholesale,
@@ -532,8 +576,14 @@ class BlockGraph::Label {
   static bool AreValidAttributes(LabelAttributes attributes);
 
  private:
-  // The name by which this label is known.
-  std::string name_;
+  friend class Block;
+
+  // The string table in which the name of this label is interned. This is
+  // NULL for a default constructed label.
+  const core::StringTable* string_table_;
+
+  // The id of the name by which this label is known in |string_table_|.
+  core::StringTable::StringId name_id_;
 
   // The disposition of the bytes found at this label.
   LabelAttributes attributes_;
@@ -559,10 +609,13 @@ class BlockGraph::Block {
   // to allow one to easily locate and remove the backreferences on change or
   // deletion.
   typedef std::pair<Block*, Offset> Referrer;
-  typedef std::set<Referrer> ReferrerSet;
+  typedef std::set<Referrer, std::less<Referrer>,
+                   core::ArenaAllocator<Referrer>> ReferrerSet;
 
   // Map of references that this block makes to other blocks.
-  typedef std::map<Offset, Reference> ReferenceMap;
+  typedef std::map<Offset, Reference, std::less<Offset>,
+                   core::ArenaAllocator<std::pair<const Offset, Reference>>>
+      ReferenceMap;
 
   // Represents a range of data in this block.
   typedef core::AddressRange<Offset, Size> DataRange;
@@ -585,7 +638,9 @@ class BlockGraph::Block {
   // within the block. Note that, while possible, it is NOT guaranteed that
   // all basic blocks are marked with a label. Basic block decomposition should
   // disassemble from the code labels to discover all basic blocks.
-  typedef std::map<Offset, Label> LabelMap;
+  typedef std::map<Offset, Label, std::less<Offset>,
+                   core::ArenaAllocator<std::pair<const Offset, Label>>>
+      LabelMap;
 
   ~Block();
 
@@ -604,11 +659,14 @@ class BlockGraph::Block {
   }
 
   const std::string& name() const {
-    DCHECK(name_ != NULL);
-    return *name_;
+    return block_graph_->string_table().GetString(name_id_);
   }
   void set_name(const base::StringPiece& name);
 
+  // @returns the id of the name of this block in the string table of the
+  //     block graph.
+  core::StringTable::StringId name_id() const { return name_id_; }
+
   const std::string& compiland_name() const;
   void set_compiland_name(const base::StringPiece& name);
 
@@ -798,7 +856,8 @@ class BlockGraph::Block {
   bool SetLabel(Offset offset,
                 const base::StringPiece& name,
                 LabelAttributes attributes) {
-    return SetLabel(offset, Label(name, attributes));
+    return SetLabel(offset,
+                    Label(name, attributes, &block_graph_->string_table()));
   }
   // @}
 
@@ -855,14 +914,21 @@ class BlockGraph::Block {
   // data buffer will not have been initialized in any way.
   uint8_t* AllocateRawData(size_t size);
 
+  // Hands the reference, referrer and label nodes of this block over to the
+  // arena of the block graph, which releases them wholesale when it is
+  // destroyed. The block is left without references, referrers or labels.
+  // @pre The block graph uses kArenaAllocation.
+  void AbandonArenaNodes();
+
   BlockId id_;
   BlockType type_;
   Size size_;
   Size alignment_;
   Offset alignment_offset_;
   Size padding_before_;
-  const std::string* name_;
-  const std::string* compiland_name_;
+  // The names of the block, as ids into the string table of the block graph.
+  core::StringTable::StringId name_id_;
+  core::StringTable::StringId compiland_name_id_;
   RelativeAddress addr_;
 
   // BlockGraph to which belongs this Block. A block can only belongs to one
@@ -14,6 +14,9 @@
 
 #include "syzygy/block_graph/block_graph_serializer.h"
 
+#include <iterator>
+
+#include "base/strings/string_util.h"
 #include "base/strings/stringprintf.h"
 
 namespace block_graph {
@@ -31,33 +34,46 @@ using core::OutArchive;
 // Version 3: Added image_format_ block-graph property.
 // Version 4: Deprecated old decomposer attributes.
 // Version 5: Added new Block attributes: padding_before and alignment_offset.
-static const uint32_t kSerializedBlockGraphVersion = 5;
+// Version 6: Strings are saved once, in a string table in the header, and
+//     are referred to by id.
+static const uint32_t kSerializedBlockGraphVersion = 6;
 
 // Some constants for use in dealing with backwards compatibility.
 static const uint32_t kMinSupportedSerializedBlockGraphVersion = 2;
 static const uint32_t kImageFormatPropertyBlockGraphVersion = 3;
 static const uint32_t kPaddingBeforePropertyBlockGraphVersion = 5;
+static const uint32_t kStringTableBlockGraphVersion = 6;
 
-// Potentially saves a string, depending on whether or not OMIT_STRINGS is
-// enabled.
-bool MaybeSaveString(const BlockGraphSerializer& bgs,
-                     const std::string& value,
-                     OutArchive* out_archive) {
-  DCHECK(out_archive != NULL);
+// Builds the table of the strings to be saved for a block-graph. The strings
+// are interned in the order in which they are saved, so that the ids are
+// the same from one serialization to the next.
+void BuildStringTable(const BlockGraphSerializer& bgs,
+                      const BlockGraph& block_graph,
+                      core::StringTable* strings) {
+  DCHECK(strings != NULL);
 
   if (bgs.has_attributes(BlockGraphSerializer::OMIT_STRINGS))
-    return true;
+    return;
 
-  if (!out_archive->Save(value)) {
-    LOG(ERROR) << "Unable to save string \"" << value << "\".";
-    return false;
-  }
+  BlockGraph::BlockMap::const_iterator it = block_graph.blocks().begin();
+  for (; it != block_graph.blocks().end(); ++it) {
+    const BlockGraph::Block& block = it->second;
+    strings->InternStringId(block.name());
+    strings->InternStringId(block.compiland_name());
 
-  return true;
+    if (bgs.has_attributes(BlockGraphSerializer::OMIT_LABELS))
+      continue;
+
+    BlockGraph::Block::LabelMap::const_iterator label_it =
+        block.labels().begin();
+    for (; label_it != block.labels().end(); ++label_it)
+      strings->InternStringId(label_it->second.name());
+  }
 }
 
 // Potentially loads a string, depending on whether or not OMIT_STRINGS is
-// enabled.
+// enabled. This is used by versions of the serialization that predate the
+// string table.
 bool MaybeLoadString(const BlockGraphSerializer& bgs,
                      std::string* value,
                      InArchive* in_archive) {
@@ -85,26 +101,16 @@ bool BlockGraphSerializer::Save(const BlockGraph& block_graph,
                                 core::OutArchive* out_archive) const {
   CHECK(out_archive != NULL);
 
-  // Save the serialization attributes so we can read this block-graph without
-  // having to be told how it was saved.
-  if (!out_archive->Save(kSerializedBlockGraphVersion) ||
-      !out_archive->Save(static_cast<uint32_t>(data_mode_)) ||
-      !out_archive->Save(attributes_)) {
-    LOG(ERROR) << "Unable to save serialized block-graph properties.";
-    return false;
-  }
-
-  // TODO(etienneb): We should serialize the string table in the block graph,
-  //    and encode string ids instead of the raw strings.
-
   // This function takes care of outputting a meaningful log message on
   // failure.
-  if (!SaveBlockGraphProperties(block_graph, out_archive))
+  core::StringTable strings;
+  BuildStringTable(*this, block_graph, &strings);
+  if (!SaveHeader(block_graph, strings, out_archive))
     return false;
 
   // Save the blocks, except for their references. We do that in a second pass
   // so that when loading the referenced blocks will exist.
-  if (!SaveBlocks(block_graph, out_archive)) {
+  if (!SaveBlocks(block_graph, strings, out_archive)) {
     LOG(ERROR) << "Unable to save blocks.";
     return false;
   }
@@ -123,16 +129,154 @@ bool BlockGraphSerializer::Load(BlockGraph* block_graph,
   CHECK(block_graph != NULL);
   CHECK(in_archive != NULL);
 
+  // This function takes care of outputting a meaningful log message on
+  // failure.
   uint32_t version = 0;
-  if (!in_archive->Load(&version)) {
+  if (!LoadHeader(block_graph, &version, in_archive))
+    return false;
+
+  // Load the blocks, except for their references.
+  if (!LoadBlocks(version, block_graph, in_archive)) {
+    LOG(ERROR) << "Unable to load blocks.";
+    return false;
+  }
+
+  // Now load the references and wire them up.
+  if (!LoadBlockGraphReferences(block_graph, in_archive)) {
+    LOG(ERROR) << "Unable to load block graph references.";
+    return false;
+  }
+
+  return true;
+}
+
+bool BlockGraphSerializer::SaveIndexed(const BlockGraph& block_graph,
+                                       std::vector<uint8_t>* buffer) const {
+  DCHECK(buffer != NULL);
+
+  // Offsets are relative to the beginning of the indexed serialization.
+  size_t start = buffer->size();
+  core::ScopedOutStreamPtr out_stream(
+      core::CreateByteOutStream(std::back_inserter(*buffer)));
+  OutArchive out_archive(out_stream.get());
+
+  core::StringTable strings;
+  BuildStringTable(*this, block_graph, &strings);
+  if (!SaveHeader(block_graph, strings, &out_archive))
+    return false;
+
+  // Save one record per block. These are in increasing order of block id, as
+  // the block map is sorted by id.
+  std::vector<IndexEntry> index;
+  index.reserve(block_graph.blocks().size());
+  BlockGraph::BlockMap::const_iterator it = block_graph.blocks().begin();
+  for (; it != block_graph.blocks().end(); ++it) {
+    const BlockGraph::Block& block = it->second;
+    IndexEntry entry = {};
+    entry.id = static_cast<uint32_t>(block.id());
+    entry.block_offset = static_cast<uint32_t>(buffer->size() - start);
+    if (!out_archive.Save(block.id()) ||
+        !SaveBlockProperties(block, strings, &out_archive) ||
+        !SaveBlockLabels(block, strings, &out_archive) ||
+        !SaveBlockData(block, &out_archive)) {
+      LOG(ERROR) << "Unable to save block with id " << block.id() << ".";
+      return false;
+    }
+    index.push_back(entry);
+  }
+
+  // Save the references in a second set of records, so that loading a block
+  // doesn't require loading the blocks it refers to.
+  it = block_graph.blocks().begin();
+  for (size_t i = 0; it != block_graph.blocks().end(); ++it, ++i) {
+    index[i].references_offset =
+        static_cast<uint32_t>(buffer->size() - start);
+    if (!SaveBlockReferences(it->second, &out_archive)) {
+      LOG(ERROR) << "Unable to save references for block with id "
+                 << it->second.id() << ".";
+      return false;
+    }
+  }
+
+  // Finally, save the index and its location.
+  uint32_t index_offset = static_cast<uint32_t>(buffer->size() - start);
+  if (!out_archive.Save(static_cast<uint32_t>(index.size()))) {
+    LOG(ERROR) << "Unable to save block index.";
+    return false;
+  }
+  for (size_t i = 0; i < index.size(); ++i) {
+    if (!out_archive.Save(index[i].id) ||
+        !out_archive.Save(index[i].block_offset) ||
+        !out_archive.Save(index[i].references_offset)) {
+      LOG(ERROR) << "Unable to save block index.";
+      return false;
+    }
+  }
+  if (!out_archive.Save(index_offset)) {
+    LOG(ERROR) << "Unable to save block index offset.";
+    return false;
+  }
+
+  return true;
+}
+
+bool BlockGraphSerializer::SaveHeader(const BlockGraph& block_graph,
+                                      const core::StringTable& strings,
+                                      OutArchive* out_archive) const {
+  DCHECK(out_archive != NULL);
+
+  // Save the serialization attributes so we can read this block-graph without
+  // having to be told how it was saved.
+  if (!out_archive->Save(kSerializedBlockGraphVersion) ||
+      !out_archive->Save(static_cast<uint32_t>(data_mode_)) ||
+      !out_archive->Save(attributes_)) {
+    LOG(ERROR) << "Unable to save serialized block-graph properties.";
+    return false;
+  }
+
+  // This function takes care of outputting a meaningful log message on
+  // failure.
+  if (!SaveBlockGraphProperties(block_graph, out_archive))
+    return false;
+
+  if (has_attributes(OMIT_STRINGS))
+    return true;
+
+  // Save the string table. The blocks and labels refer to these strings by
+  // id.
+  if (!SaveUint32(static_cast<uint32_t>(strings.size()), out_archive)) {
+    LOG(ERROR) << "Unable to save string table size.";
+    return false;
+  }
+  for (size_t i = 0; i < strings.size(); ++i) {
+    const std::string& value =
+        strings.GetString(static_cast<core::StringTable::StringId>(i));
+    if (!out_archive->Save(value)) {
+      LOG(ERROR) << "Unable to save string \"" << value << "\".";
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool BlockGraphSerializer::LoadHeader(BlockGraph* block_graph,
+                                      uint32_t* version,
+                                      InArchive* in_archive) {
+  DCHECK(block_graph != NULL);
+  DCHECK(version != NULL);
+  DCHECK(in_archive != NULL);
+
+  if (!in_archive->Load(version)) {
     LOG(ERROR) << "Unable to load serialized block graph version.";
     return false;
   }
 
   // We are backwards compatible back to version 2, for now.
-  if (version < kMinSupportedSerializedBlockGraphVersion ||
-      version > kSerializedBlockGraphVersion) {
-    LOG(ERROR) << "Unable to load block graph with version " << version << ".";
+  if (*version < kMinSupportedSerializedBlockGraphVersion ||
+      *version > kSerializedBlockGraphVersion) {
+    LOG(ERROR) << "Unable to load block graph with version " << *version
+               << ".";
     return false;
   }
 
@@ -154,20 +298,27 @@ bool BlockGraphSerializer::Load(BlockGraph* block_graph,
 
   // This function takes care of outputting a meaningful log message on
   // failure.
-  if (!LoadBlockGraphProperties(version, block_graph, in_archive))
+  if (!LoadBlockGraphProperties(*version, block_graph, in_archive))
     return false;
 
-  // Load the blocks, except for their references.
-  if (!LoadBlocks(version, block_graph, in_archive)) {
-    LOG(ERROR) << "Unable to load blocks.";
-    return false;
-  }
+  strings_.clear();
+  if (*version < kStringTableBlockGraphVersion || has_attributes(OMIT_STRINGS))
+    return true;
 
-  // Now load the references and wire them up.
-  if (!LoadBlockGraphReferences(block_graph, in_archive)) {
-    LOG(ERROR) << "Unable to load block graph references.";
+  // Load the string table.
+  uint32_t string_count = 0;
+  if (!LoadUint32(&string_count, in_archive)) {
+    LOG(ERROR) << "Unable to load string table size.";
     return false;
   }
+  strings_.resize(string_count);
+  for (size_t i = 0; i < string_count; ++i) {
+    if (!in_archive->Load(&strings_[i])) {
+      LOG(ERROR) << "Unable to load string " << i << " of " << string_count
+                 << ".";
+      return false;
+    }
+  }
 
   return true;
 }
@@ -227,6 +378,7 @@ bool BlockGraphSerializer::LoadBlockGraphProperties(
 }
 
 bool BlockGraphSerializer::SaveBlocks(const BlockGraph& block_graph,
+                                      const core::StringTable& strings,
                                       OutArchive* out_archive) const {
   DCHECK(out_archive != NULL);
 
@@ -241,8 +393,8 @@ bool BlockGraphSerializer::SaveBlocks(const BlockGraph& block_graph,
     BlockGraph::BlockId block_id = it->first;
     const BlockGraph::Block& block = it->second;
     if (!out_archive->Save(block_id) ||
-        !SaveBlockProperties(block, out_archive) ||
-        !SaveBlockLabels(block, out_archive) ||
+        !SaveBlockProperties(block, strings, out_archive) ||
+        !SaveBlockLabels(block, strings, out_archive) ||
         !SaveBlockData(block, out_archive)) {
       LOG(ERROR) << "Unable to save block with id " << block_id << ".";
       return false;
@@ -267,28 +419,9 @@ bool BlockGraphSerializer::LoadBlocks(uint32_t version,
   }
 
   for (size_t i = 0; i < count; ++i) {
-    BlockGraph::BlockId id = 0;
-    if (!in_archive->Load(&id)) {
-      LOG(ERROR) << "Unable to load id for block " << i << " of " << count
-                 << ".";
-      return false;
-    }
-
-    std::pair<BlockGraph::BlockMap::iterator, bool> result =
-        block_graph->blocks_.insert(
-            std::make_pair(id, BlockGraph::Block(block_graph)));
-    if (!result.second) {
-      LOG(ERROR) << "Unable to insert block with id " << id << ".";
-      return false;
-    }
-    BlockGraph::Block* block = &result.first->second;
-    block->id_ = id;
-
-    if (!LoadBlockProperties(version, block, in_archive) ||
-        !LoadBlockLabels(block, in_archive) ||
-        !LoadBlockData(block, in_archive)) {
-      LOG(ERROR) << "Unable to load block " << i << " of " << count
-                 << " with id " << id << ".";
+    BlockGraph::Block* block = NULL;
+    if (!LoadBlock(version, block_graph, in_archive, &block)) {
+      LOG(ERROR) << "Unable to load block " << i << " of " << count << ".";
       return false;
     }
   }
@@ -297,6 +430,41 @@ bool BlockGraphSerializer::LoadBlocks(uint32_t version,
   return true;
 }
 
+bool BlockGraphSerializer::LoadBlock(uint32_t version,
+                                     BlockGraph* block_graph,
+                                     InArchive* in_archive,
+                                     BlockGraph::Block** block) const {
+  DCHECK(block_graph != NULL);
+  DCHECK(in_archive != NULL);
+  DCHECK(block != NULL);
+
+  BlockGraph::BlockId id = 0;
+  if (!in_archive->Load(&id)) {
+    LOG(ERROR) << "Unable to load block id.";
+    return false;
+  }
+
+  std::pair<BlockGraph::BlockMap::iterator, bool> result =
+      block_graph->blocks_.insert(
+          std::make_pair(id, BlockGraph::Block(block_graph)));
+  if (!result.second) {
+    LOG(ERROR) << "Unable to insert block with id " << id << ".";
+    return false;
+  }
+  BlockGraph::Block* new_block = &result.first->second;
+  new_block->id_ = id;
+
+  if (!LoadBlockProperties(version, new_block, in_archive) ||
+      !LoadBlockLabels(version, new_block, in_archive) ||
+      !LoadBlockData(new_block, in_archive)) {
+    LOG(ERROR) << "Unable to load block with id " << id << ".";
+    return false;
+  }
+
+  *block = new_block;
+  return true;
+}
+
 bool BlockGraphSerializer::SaveBlockGraphReferences(
     const BlockGraph& block_graph, OutArchive* out_archive) const {
   DCHECK(out_archive != NULL);
@@ -314,7 +482,7 @@ bool BlockGraphSerializer::SaveBlockGraphReferences(
 }
 
 bool BlockGraphSerializer::LoadBlockGraphReferences(
-    BlockGraph* block_graph, InArchive* in_archive) const {
+    BlockGraph* block_graph, InArchive* in_archive) {
   DCHECK(block_graph != NULL);
   DCHECK(in_archive != NULL);
 
@@ -330,8 +498,10 @@ bool BlockGraphSerializer::LoadBlockGraphReferences(
   return true;
 }
 
-bool BlockGraphSerializer::SaveBlockProperties(const BlockGraph::Block& block,
-                                               OutArchive* out_archive) const {
+bool BlockGraphSerializer::SaveBlockProperties(
+    const BlockGraph::Block& block,
+    const core::StringTable& strings,
+    OutArchive* out_archive) const {
   DCHECK(out_archive != NULL);
 
   uint8_t type = static_cast<uint8_t>(block.type());
@@ -347,8 +517,8 @@ bool BlockGraphSerializer::SaveBlockProperties(const BlockGraph::Block& block,
       !out_archive->Save(block.addr()) ||
       !SaveInt32(static_cast<uint32_t>(block.section()), out_archive) ||
       !out_archive->Save(block.attributes()) ||
-      !MaybeSaveString(*this, block.name(), out_archive) ||
-      !MaybeSaveString(*this, block.compiland_name(), out_archive)) {
+      !MaybeSaveStringId(strings, block.name(), out_archive) ||
+      !MaybeSaveStringId(strings, block.compiland_name(), out_archive)) {
     LOG(ERROR) << "Unable to save properties for block with id "
                << block.id() << ".";
     return false;
@@ -380,8 +550,8 @@ bool BlockGraphSerializer::LoadBlockPropertiesImpl(
   uint32_t padding_before = 0;
   uint32_t section = 0;
   uint32_t attributes = 0;
-  std::string name;
-  std::string compiland_name;
+  const std::string* name = &base::EmptyString();
+  const std::string* compiland_name = &base::EmptyString();
   if (!in_archive->Load(&type) ||
       !LoadUint32(&size, in_archive) ||
       !LoadUint32(&alignment, in_archive)) {
@@ -396,11 +566,24 @@ bool BlockGraphSerializer::LoadBlockPropertiesImpl(
   if (!in_archive->Load(&block->source_ranges_) ||
       !in_archive->Load(&block->addr_) ||
       !LoadInt32(reinterpret_cast<int32_t*>(&section), in_archive) ||
-      !in_archive->Load(&attributes) ||
-      !MaybeLoadString(*this, &name, in_archive) ||
-      !MaybeLoadString(*this, &compiland_name, in_archive)) {
+      !in_archive->Load(&attributes)) {
     return false;
   }
+  std::string name_value;
+  std::string compiland_name_value;
+  if (version >= kStringTableBlockGraphVersion) {
+    if (!MaybeLoadStringId(&name, in_archive) ||
+        !MaybeLoadStringId(&compiland_name, in_archive)) {
+      return false;
+    }
+  } else {
+    if (!MaybeLoadString(*this, &name_value, in_archive) ||
+        !MaybeLoadString(*this, &compiland_name_value, in_archive)) {
+      return false;
+    }
+    name = &name_value;
+    compiland_name = &compiland_name_value;
+  }
 
   if (type > BlockGraph::BLOCK_TYPE_MAX ||
       !ValidAttributes(attributes, BlockGraph::BLOCK_ATTRIBUTES_MAX)) {
@@ -418,8 +601,8 @@ bool BlockGraphSerializer::LoadBlockPropertiesImpl(
   block->padding_before_ = padding_before;
   block->section_ = section;
   block->attributes_ = attributes;
-  block->set_name(name);
-  block->set_compiland_name(compiland_name);
+  block->set_name(*name);
+  block->set_compiland_name(*compiland_name);
   return true;
 }
 
@@ -439,6 +622,7 @@ bool BlockGraphSerializer::LoadBlockProperties(uint32_t version,
 }
 
 bool BlockGraphSerializer::SaveBlockLabels(const BlockGraph::Block& block,
+                                           const core::StringTable& strings,
                                            OutArchive* out_archive) const {
   DCHECK(out_archive != NULL);
 
@@ -462,7 +646,7 @@ bool BlockGraphSerializer::SaveBlockLabels(const BlockGraph::Block& block,
     uint16_t attributes = static_cast<uint16_t>(label.attributes());
 
     if (!SaveInt32(offset, out_archive) || !out_archive->Save(attributes) ||
-        !MaybeSaveString(*this, label.name(), out_archive)) {
+        !MaybeSaveStringId(strings, label.name(), out_archive)) {
       LOG(ERROR) << "Unable to save label at offset "
                  << label_iter->first << " of block with id "
                  << block.id() << ".";
@@ -473,7 +657,8 @@ bool BlockGraphSerializer::SaveBlockLabels(const BlockGraph::Block& block,
   return true;
 }
 
-bool BlockGraphSerializer::LoadBlockLabels(BlockGraph::Block* block,
+bool BlockGraphSerializer::LoadBlockLabels(uint32_t version,
+                                           BlockGraph::Block* block,
                                            InArchive* in_archive) const {
   DCHECK(block != NULL);
   DCHECK(in_archive != NULL);
@@ -493,10 +678,20 @@ bool BlockGraphSerializer::LoadBlockLabels(BlockGraph::Block* block,
   for (size_t i = 0; i < label_count; ++i) {
     int32_t offset = 0;
     uint16_t attributes = 0;
-    std::string name;
-
-    if (!LoadInt32(&offset, in_archive) || !(in_archive->Load(&attributes)) ||
-        !MaybeLoadString(*this, &name, in_archive)) {
+    const std::string* name = &base::EmptyString();
+    std::string name_value;
+
+    bool loaded = LoadInt32(&offset, in_archive) &&
+        in_archive->Load(&attributes);
+    if (loaded) {
+      if (version >= kStringTableBlockGraphVersion) {
+        loaded = MaybeLoadStringId(&name, in_archive);
+      } else {
+        loaded = MaybeLoadString(*this, &name_value, in_archive);
+        name = &name_value;
+      }
+    }
+    if (!loaded) {
       LOG(ERROR) << "Unable to load label " << i << " of " << label_count
                  << " for block with id " << block->id() << ".";
       return false;
@@ -510,8 +705,7 @@ bool BlockGraphSerializer::LoadBlockLabels(BlockGraph::Block* block,
       return false;
     }
 
-    BlockGraph::Label label(name, attributes);
-    CHECK(block->SetLabel(offset, label));
+    CHECK(block->SetLabel(offset, *name, attributes));
   }
   DCHECK_EQ(label_count, block->labels().size());
 
@@ -710,7 +904,7 @@ bool BlockGraphSerializer::SaveBlockReferences(const BlockGraph::Block& block,
 
 bool BlockGraphSerializer::LoadBlockReferences(BlockGraph* block_graph,
                                                BlockGraph::Block* block,
-                                               InArchive* in_archive) const {
+                                               InArchive* in_archive) {
   DCHECK(block_graph != NULL);
   DCHECK(block != NULL);
   DCHECK(in_archive != NULL);
@@ -776,7 +970,7 @@ bool BlockGraphSerializer::SaveReference(const BlockGraph::Reference& ref,
 
 bool BlockGraphSerializer::LoadReference(BlockGraph* block_graph,
                                          BlockGraph::Reference* ref,
-                                         InArchive* in_archive) const {
+                                         InArchive* in_archive) {
   DCHECK(block_graph != NULL);
   DCHECK(ref != NULL);
   DCHECK(in_archive != NULL);
@@ -803,7 +997,7 @@ bool BlockGraphSerializer::LoadReference(BlockGraph* block_graph,
     return false;
   }
 
-  BlockGraph::Block* referenced = block_graph->GetBlockById(id);
+  BlockGraph::Block* referenced = ResolveReferencedBlock(block_graph, id);
   if (referenced == NULL) {
     LOG(ERROR) << "Unable to find referenced block with id " << id << ".";
     return false;
@@ -815,6 +1009,57 @@ bool BlockGraphSerializer::LoadReference(BlockGraph* block_graph,
   return true;
 }
 
+BlockGraph::Block* BlockGraphSerializer::ResolveReferencedBlock(
+    BlockGraph* block_graph, BlockGraph::BlockId id) {
+  DCHECK(block_graph != NULL);
+  return block_graph->GetBlockById(id);
+}
+
+bool BlockGraphSerializer::MaybeSaveStringId(const core::StringTable& strings,
+                                             const std::string& value,
+                                             OutArchive* out_archive) const {
+  DCHECK(out_archive != NULL);
+
+  if (has_attributes(OMIT_STRINGS))
+    return true;
+
+  core::StringTable::StringId id = core::StringTable::kInvalidStringId;
+  if (!strings.FindStringId(value, &id)) {
+    LOG(ERROR) << "String \"" << value << "\" is not in the string table.";
+    return false;
+  }
+
+  if (!SaveUint32(id, out_archive)) {
+    LOG(ERROR) << "Unable to save id of string \"" << value << "\".";
+    return false;
+  }
+
+  return true;
+}
+
+bool BlockGraphSerializer::MaybeLoadStringId(const std::string** value,
+                                             InArchive* in_archive) const {
+  DCHECK(value != NULL);
+  DCHECK(in_archive != NULL);
+
+  if (has_attributes(OMIT_STRINGS))
+    return true;
+
+  uint32_t id = 0;
+  if (!LoadUint32(&id, in_archive)) {
+    LOG(ERROR) << "Unable to load string id.";
+    return false;
+  }
+
+  if (id >= strings_.size()) {
+    LOG(ERROR) << "Invalid string id " << id << ".";
+    return false;
+  }
+
+  *value = &strings_[id];
+  return true;
+}
+
 // Saves an unsigned 32 bit value. This uses a variable length encoding where
 // the first three bits are reserved to indicate the number of bytes required to
 // store the value.
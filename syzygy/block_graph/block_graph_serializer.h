@@ -17,9 +17,13 @@
 #ifndef SYZYGY_BLOCK_GRAPH_BLOCK_GRAPH_SERIALIZER_H_
 #define SYZYGY_BLOCK_GRAPH_BLOCK_GRAPH_SERIALIZER_H_
 
+#include <string>
+#include <vector>
+
 #include "base/callback.h"
 #include "syzygy/block_graph/block_graph.h"
 #include "syzygy/core/address.h"
+#include "syzygy/core/string_table.h"
 
 namespace block_graph {
 
@@ -133,6 +137,8 @@ class BlockGraphSerializer {
   BlockGraphSerializer()
       : data_mode_(DEFAULT_DATA_MODE), attributes_(DEFAULT_ATTRIBUTES) { }
 
+  virtual ~BlockGraphSerializer() { }
+
   // @name For setting and accessing the data mode.
   // @{
   DataMode data_mode() const { return data_mode_; }
@@ -182,6 +188,27 @@ class BlockGraphSerializer {
   // @returns true on success, false otherwise.
   bool Save(const BlockGraph& block_graph, core::OutArchive* out_archive) const;
 
+  // Saves the given block-graph using the indexed format. Each block is saved
+  // in a record of its own, and an index of these records is appended. This
+  // allows a LazyBlockGraphLoader to load the blocks individually, on demand.
+  // The indexed format is laid out as follows:
+  //
+  //   header      The serialization version, data mode, attributes and
+  //               block-graph properties, as saved by Save.
+  //   blocks      A record per block, in increasing order of block id. Each
+  //               record holds the block id, properties, labels and data.
+  //   references  A record per block, holding the references of the block.
+  //   index       A uint32_t block count, followed by an IndexEntry per block,
+  //               in increasing order of block id.
+  //   trailer     The uint32_t offset of the index.
+  //
+  // All offsets are relative to the beginning of the indexed serialization.
+  // @param block_graph the block-graph to be serialized.
+  // @param buffer the buffer to which the serialization is appended.
+  // @returns true on success, false otherwise.
+  bool SaveIndexed(const BlockGraph& block_graph,
+                   std::vector<uint8_t>* buffer) const;
+
   // Sets a callback to be used by the load function for retrieving block
   // data. This is optional, but is required to be set prior to calling Load
   // for any block-graph that was serialized using OUTPUT_NO_DATA or
@@ -202,34 +229,61 @@ class BlockGraphSerializer {
   bool Load(BlockGraph* block_graph, core::InArchive* in_archive);
 
  protected:
+  // An entry in the index of the indexed format.
+  struct IndexEntry {
+    uint32_t id;
+    uint32_t block_offset;
+    uint32_t references_offset;
+  };
+
   // @{
   // The block-graph is serialized by breaking it down into its constituent
   // pieces, and saving each of these using the following functions.
+  bool SaveHeader(const BlockGraph& block_graph,
+                  const core::StringTable& strings,
+                  OutArchive* out_archive) const;
+  bool LoadHeader(BlockGraph* block_graph,
+                  uint32_t* version,
+                  InArchive* in_archive);
+
   bool SaveBlockGraphProperties(const BlockGraph& block_graph,
                                 OutArchive* out_archive) const;
   bool LoadBlockGraphProperties(uint32_t version,
                                 BlockGraph* block_graph,
                                 InArchive* in_archive) const;
 
-  bool SaveBlocks(const BlockGraph& block_graph, OutArchive* out_archive) const;
+  bool SaveBlocks(const BlockGraph& block_graph,
+                  const core::StringTable& strings,
+                  OutArchive* out_archive) const;
   bool LoadBlocks(uint32_t version,
                   BlockGraph* block_graph,
                   InArchive* in_archive) const;
 
+  // Loads a single block, without its references, and adds it to
+  // @p block_graph.
+  bool LoadBlock(uint32_t version,
+                 BlockGraph* block_graph,
+                 InArchive* in_archive,
+                 BlockGraph::Block** block) const;
+
   bool SaveBlockGraphReferences(const BlockGraph& block_graph,
                                 OutArchive* out_archive) const;
   bool LoadBlockGraphReferences(BlockGraph* block_graph,
-                                InArchive* in_archive) const;
+                                InArchive* in_archive);
 
   bool SaveBlockProperties(const BlockGraph::Block& block,
+                           const core::StringTable& strings,
                            OutArchive* out_archive) const;
   bool LoadBlockProperties(uint32_t version,
                            BlockGraph::Block* block,
                            InArchive* in_archive) const;
 
   bool SaveBlockLabels(const BlockGraph::Block& block,
+                       const core::StringTable& strings,
                        OutArchive* out_archive) const;
-  bool LoadBlockLabels(BlockGraph::Block* block, InArchive* in_archive) const;
+  bool LoadBlockLabels(uint32_t version,
+                       BlockGraph::Block* block,
+                       InArchive* in_archive) const;
 
   bool SaveBlockData(const BlockGraph::Block& block,
                      OutArchive* out_archive) const;
@@ -239,13 +293,32 @@ class BlockGraphSerializer {
                            OutArchive* out_archive) const;
   bool LoadBlockReferences(BlockGraph* block_graph,
                            BlockGraph::Block* block,
-                           InArchive* in_archive) const;
+                           InArchive* in_archive);
 
   bool SaveReference(const BlockGraph::Reference& ref,
                      OutArchive* out_archive) const;
   bool LoadReference(BlockGraph* block_graph,
                      BlockGraph::Reference* ref,
-                     InArchive* in_archive) const;
+                     InArchive* in_archive);
+  // @}
+
+  // Looks up the block referred to by a reference that is being loaded. This
+  // may be overridden by serializers that load blocks on demand.
+  // @param block_graph the block-graph being loaded.
+  // @param id the id of the referenced block.
+  // @returns the referenced block, or NULL if it doesn't exist.
+  virtual BlockGraph::Block* ResolveReferencedBlock(BlockGraph* block_graph,
+                                                    BlockGraph::BlockId id);
+
+  // @{
+  // Utility functions for saving and loading strings by id, depending on
+  // whether or not OMIT_STRINGS is enabled. Strings are saved as ids into
+  // @p strings, and loaded from the string table read by LoadHeader.
+  bool MaybeSaveStringId(const core::StringTable& strings,
+                         const std::string& value,
+                         OutArchive* out_archive) const;
+  bool MaybeLoadStringId(const std::string** value,
+                         InArchive* in_archive) const;
   // @}
 
   // @{
@@ -262,6 +335,9 @@ class BlockGraphSerializer {
   // Controls the specifics of how the serialization is performed.
   Attributes attributes_;
 
+  // The string table loaded by LoadHeader.
+  std::vector<std::string> strings_;
+
   // Optional callbacks.
   std::unique_ptr<SaveBlockDataCallback> save_block_data_callback_;
   std::unique_ptr<LoadBlockDataCallback> load_block_data_callback_;
@@ -14,6 +14,8 @@
 
 #include "syzygy/block_graph/block_graph_serializer.h"
 
+#include <algorithm>
+
 #include "base/bind.h"
 #include "gtest/gtest.h"
 #include "syzygy/block_graph/unittest_util.h"
@@ -102,18 +104,18 @@ class BlockGraphSerializerTest : public ::testing::Test {
         BlockGraph::Block::SourceRange(core::RelativeAddress(1040), 1056));
 
     // Set up labels.
-    c1->SetLabel(0, BlockGraph::Label("code1",
-        BlockGraph::CODE_LABEL | BlockGraph::DEBUG_START_LABEL));
-    c1->SetLabel(8, BlockGraph::Label("label", BlockGraph::CODE_LABEL));
-    c1->SetLabel(11, BlockGraph::Label("debug", BlockGraph::DEBUG_END_LABEL));
-    c1->SetLabel(12, BlockGraph::Label("jump",
-        BlockGraph::DATA_LABEL | BlockGraph::JUMP_TABLE_LABEL));
-    c2->SetLabel(0, BlockGraph::Label("code1", BlockGraph::CODE_LABEL));
-    c2->SetLabel(8, BlockGraph::Label("jump",
-        BlockGraph::DATA_LABEL | BlockGraph::JUMP_TABLE_LABEL));
-    c2->SetLabel(12, BlockGraph::Label("case",
-        BlockGraph::DATA_LABEL | BlockGraph::CASE_TABLE_LABEL));
-    d1->SetLabel(0, BlockGraph::Label("data", BlockGraph::DATA_LABEL));
+    c1->SetLabel(0, "code1",
+        BlockGraph::CODE_LABEL | BlockGraph::DEBUG_START_LABEL);
+    c1->SetLabel(8, "label", BlockGraph::CODE_LABEL);
+    c1->SetLabel(11, "debug", BlockGraph::DEBUG_END_LABEL);
+    c1->SetLabel(12, "jump",
+        BlockGraph::DATA_LABEL | BlockGraph::JUMP_TABLE_LABEL);
+    c2->SetLabel(0, "code1", BlockGraph::CODE_LABEL);
+    c2->SetLabel(8, "jump",
+        BlockGraph::DATA_LABEL | BlockGraph::JUMP_TABLE_LABEL);
+    c2->SetLabel(12, "case",
+        BlockGraph::DATA_LABEL | BlockGraph::CASE_TABLE_LABEL);
+    d1->SetLabel(0, "data", BlockGraph::DATA_LABEL);
 
     // Set up some references.
     c1->SetReference(4, BlockGraph::Reference(
@@ -543,6 +545,36 @@ TEST_F(BlockGraphSerializerTest, RoundTripAllData) {
       eNoBlockDataCallbacks, 0));
 }
 
+TEST_F(BlockGraphSerializerTest, StringsAreSavedOnce) {
+  InitBlockGraph();
+
+  // Add a few blocks and labels sharing a name.
+  static const char kName[] = "a_rather_long_and_recognizable_name";
+  for (size_t i = 0; i < 3; ++i) {
+    BlockGraph::Block* block =
+        bg_.AddBlock(BlockGraph::CODE_BLOCK, 16, kName);
+    block->set_compiland_name(kName);
+    block->SetLabel(0, kName, BlockGraph::CODE_LABEL);
+  }
+
+  InitOutArchive();
+  s_.set_data_mode(BlockGraphSerializer::OUTPUT_ALL_DATA);
+  ASSERT_TRUE(s_.Save(bg_, oa_.get()));
+
+  // The name should appear exactly once in the serialization.
+  std::string name(kName);
+  std::vector<uint8_t>::iterator it =
+      std::search(v_.begin(), v_.end(), name.begin(), name.end());
+  ASSERT_TRUE(it != v_.end());
+  EXPECT_TRUE(std::search(it + 1, v_.end(), name.begin(), name.end()) ==
+              v_.end());
+
+  InitInArchive();
+  BlockGraph bg;
+  ASSERT_TRUE(s_.Load(&bg, ia_.get()));
+  ASSERT_TRUE(testing::BlockGraphsEqual(bg_, bg, s_));
+}
+
 // TODO(chrisha): Do a heck of a lot more testing of protected member functions.
 
 }  // namespace block_graph
@@ -116,11 +116,43 @@ TEST(LabelTest, Initialization) {
 }
 
 TEST(LabelTest, InitializationFullConstructor) {
-  BlockGraph::Label label("foo", BlockGraph::CODE_LABEL);
+  core::StringTable string_table;
+  BlockGraph::Label label("foo", BlockGraph::CODE_LABEL, &string_table);
   ASSERT_EQ(std::string("foo"), label.name());
   ASSERT_EQ(BlockGraph::CODE_LABEL, label.attributes());
 }
 
+TEST(LabelTest, NamesAreShared) {
+  core::StringTable string_table;
+  BlockGraph::Label label1("foo", BlockGraph::CODE_LABEL, &string_table);
+  BlockGraph::Label label2(std::string("foo"), BlockGraph::DATA_LABEL,
+                           &string_table);
+  BlockGraph::Label label3("bar", BlockGraph::CODE_LABEL, &string_table);
+  EXPECT_EQ(&label1.name(), &label2.name());
+  EXPECT_NE(&label1.name(), &label3.name());
+  EXPECT_EQ(std::string("bar"), label3.name());
+  EXPECT_EQ(2u, string_table.size());
+}
+
+TEST(LabelTest, SetLabelInternsNameInBlockGraph) {
+  core::StringTable string_table;
+  BlockGraph::Label label("foo", BlockGraph::CODE_LABEL, &string_table);
+
+  BlockGraph image;
+  BlockGraph::Block* block = image.AddBlock(BlockGraph::CODE_BLOCK, 10, "b");
+  ASSERT_TRUE(block->SetLabel(0, label));
+  ASSERT_TRUE(block->SetLabel(4, "foo", BlockGraph::DATA_LABEL));
+
+  BlockGraph::Label label0;
+  BlockGraph::Label label4;
+  ASSERT_TRUE(block->GetLabel(0, &label0));
+  ASSERT_TRUE(block->GetLabel(4, &label4));
+  EXPECT_EQ(label, label0);
+  EXPECT_NE(&label.name(), &label0.name());
+  EXPECT_EQ(&label0.name(), &label4.name());
+  EXPECT_EQ(&image.string_table().InternString("foo"), &label0.name());
+}
+
 TEST(LabelTest, Attributes) {
   BlockGraph::Label label;
   ASSERT_EQ(0u, label.attributes());
@@ -220,6 +252,9 @@ TEST_F(BlockTest, Accessors) {
   ASSERT_STRNE("foo", block_->name().c_str());
   block_->set_name("foo");
   ASSERT_STREQ("foo", block_->name().c_str());
+  core::StringTable::StringId name_id = core::StringTable::kInvalidStringId;
+  ASSERT_TRUE(image_.string_table().FindStringId("foo", &name_id));
+  ASSERT_EQ(name_id, block_->name_id());
 
   ASSERT_STRNE("foo.o", block_->compiland_name().c_str());
   block_->set_compiland_name("foo.o");
@@ -393,13 +428,16 @@ TEST_F(BlockTest, InsertData) {
   BlockGraph::Block::LabelMap expected_labels;
   expected_labels.insert(std::make_pair(
       0 * kPtrSize,
-      BlockGraph::Label("Pointer1", BlockGraph::DATA_LABEL)));
+      BlockGraph::Label("Pointer1", BlockGraph::DATA_LABEL,
+                        &image_.string_table())));
   expected_labels.insert(std::make_pair(
       2 * kPtrSize,
-      BlockGraph::Label("Pointer2", BlockGraph::DATA_LABEL)));
+      BlockGraph::Label("Pointer2", BlockGraph::DATA_LABEL,
+                        &image_.string_table())));
   expected_labels.insert(std::make_pair(
       3 * kPtrSize,
-      BlockGraph::Label("Pointer3", BlockGraph::DATA_LABEL)));
+      BlockGraph::Label("Pointer3", BlockGraph::DATA_LABEL,
+                        &image_.string_table())));
   EXPECT_THAT(expected_labels, testing::ContainerEq(block1->labels()));
 
   // Ensure that the referrers are as expected.
@@ -630,13 +668,16 @@ TEST_F(BlockTest, RemoveData) {
   BlockGraph::Block::LabelMap expected_labels;
   expected_labels.insert(std::make_pair(
       0 * kPtrSize,
-      BlockGraph::Label("Pointer1", BlockGraph::DATA_LABEL)));
+      BlockGraph::Label("Pointer1", BlockGraph::DATA_LABEL,
+                        &image_.string_table())));
   expected_labels.insert(std::make_pair(
       1 * kPtrSize,
-      BlockGraph::Label("Pointer3", BlockGraph::DATA_LABEL)));
+      BlockGraph::Label("Pointer3", BlockGraph::DATA_LABEL,
+                        &image_.string_table())));
   expected_labels.insert(std::make_pair(
       2 * kPtrSize,
-      BlockGraph::Label("EndOfPointers", BlockGraph::DATA_LABEL)));
+      BlockGraph::Label("EndOfPointers", BlockGraph::DATA_LABEL,
+                        &image_.string_table())));
   EXPECT_THAT(expected_labels, testing::ContainerEq(block1->labels()));
 
   // Ensure that the referrers are as expected.
@@ -1229,9 +1270,11 @@ TEST(BlockGraphTest, Labels) {
 
   BlockGraph::Block::LabelMap expected;
   expected.insert(std::make_pair(
-      13, BlockGraph::Label("foo", BlockGraph::DATA_LABEL)));
+      13, BlockGraph::Label("foo", BlockGraph::DATA_LABEL,
+                            &image.string_table())));
   expected.insert(std::make_pair(
-      17, BlockGraph::Label("bar", BlockGraph::CODE_LABEL)));
+      17, BlockGraph::Label("bar", BlockGraph::CODE_LABEL,
+                            &image.string_table())));
   EXPECT_THAT(block->labels(), testing::ContainerEq(expected));
 }
 
@@ -1257,6 +1300,54 @@ TEST(BlockGraphTest, StringTable) {
   EXPECT_NE(&interned_str3, &interned_str4);
 }
 
+TEST(BlockGraphTest, ArenaAllocation) {
+  BlockGraph heap_image;
+  EXPECT_EQ(BlockGraph::kHeapAllocation, heap_image.allocation_mode());
+  EXPECT_TRUE(heap_image.arena() == NULL);
+
+  BlockGraph image(BlockGraph::kArenaAllocation);
+  EXPECT_EQ(BlockGraph::kArenaAllocation, image.allocation_mode());
+  ASSERT_TRUE(image.arena() != NULL);
+  size_t allocation_count = image.arena()->allocation_count();
+
+  BlockGraph::Block* b1 = image.AddBlock(BlockGraph::CODE_BLOCK, 0x20, "b1");
+  BlockGraph::Block* b2 = image.AddBlock(BlockGraph::DATA_BLOCK, 0x20, "b2");
+  ASSERT_TRUE(b1 != NULL);
+  ASSERT_TRUE(b2 != NULL);
+
+  // The blocks themselves come from the arena.
+  EXPECT_LT(allocation_count, image.arena()->allocation_count());
+  allocation_count = image.arena()->allocation_count();
+
+  // So do their references, referrers and labels.
+  BlockGraph::Reference ref(BlockGraph::ABSOLUTE_REF, 4, b2, 0, 0);
+  ASSERT_TRUE(b1->SetReference(0, ref));
+  ASSERT_TRUE(b1->SetLabel(0, "label", BlockGraph::CODE_LABEL));
+  EXPECT_LT(allocation_count, image.arena()->allocation_count());
+  EXPECT_THAT(b1->references(), testing::Contains(std::make_pair(0, ref)));
+  EXPECT_THAT(b2->referrers(), testing::Contains(std::make_pair(b1, 0)));
+
+  // Copies of blocks share the arena.
+  BlockGraph::Block* b3 = image.CopyBlock(b1, "b3");
+  ASSERT_TRUE(b3 != NULL);
+  EXPECT_EQ(b1->references(), b3->references());
+  EXPECT_EQ(image.arena(), b3->references().get_allocator().arena());
+  EXPECT_EQ(image.arena(), b3->labels().get_allocator().arena());
+
+  ASSERT_TRUE(b1->RemoveReference(0));
+  ASSERT_TRUE(b3->RemoveReference(0));
+  EXPECT_TRUE(image.RemoveBlock(b1));
+  EXPECT_TRUE(image.RemoveBlock(b3));
+  EXPECT_EQ(1u, image.blocks().size());
+
+  // Removing references and blocks recycles their memory.
+  size_t recycled_count = image.arena()->recycled_count();
+  BlockGraph::Block* b4 = image.AddBlock(BlockGraph::CODE_BLOCK, 0x20, "b4");
+  ASSERT_TRUE(b4 != NULL);
+  ASSERT_TRUE(b4->SetReference(0, ref));
+  EXPECT_LT(recycled_count, image.arena()->recycled_count());
+}
+
 namespace {
 
 class BlockGraphSerializationTest : public testing::Test {
@@ -1634,13 +1725,17 @@ TEST(BlockGraphAddressSpaceTest, MergeIntersectingBlocks) {
 
   BlockGraph::Block::LabelMap expected_labels;
   expected_labels.insert(std::make_pair(
-      0x00, BlockGraph::Label("0x1010", BlockGraph::CODE_LABEL)));
+      0x00, BlockGraph::Label("0x1010", BlockGraph::CODE_LABEL,
+                              &image.string_table())));
   expected_labels.insert(std::make_pair(
-      0x04, BlockGraph::Label("0x1014", BlockGraph::CODE_LABEL)));
+      0x04, BlockGraph::Label("0x1014", BlockGraph::CODE_LABEL,
+                              &image.string_table())));
   expected_labels.insert(std::make_pair(
-      0x20, BlockGraph::Label("0x1030", BlockGraph::CODE_LABEL)));
+      0x20, BlockGraph::Label("0x1030", BlockGraph::CODE_LABEL,
+                              &image.string_table())));
   expected_labels.insert(std::make_pair(
-      0x24, BlockGraph::Label("0x1034", BlockGraph::CODE_LABEL)));
+      0x24, BlockGraph::Label("0x1034", BlockGraph::CODE_LABEL,
+                              &image.string_table())));
   EXPECT_THAT(merged->labels(), testing::ContainerEq(expected_labels));
 
   BlockGraph::Block::ReferenceMap expected_refs;
@@ -0,0 +1,244 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/block_graph/lazy_block_graph_loader.h"
+
+#include <string.h>
+
+namespace block_graph {
+
+namespace {
+
+// The serialized size of an index entry.
+const size_t kIndexEntrySize = 3 * sizeof(uint32_t);
+
+// Reads a uint32_t from a possibly unaligned location.
+uint32_t ReadUint32(const uint8_t* data) {
+  uint32_t value = 0;
+  ::memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+}  // namespace
+
+LazyBlockGraphLoader::LazyBlockGraphLoader()
+    : data_(NULL),
+      size_(0),
+      block_graph_(NULL),
+      version_(0),
+      index_(NULL),
+      block_count_(0),
+      loaded_block_count_(0) {
+}
+
+bool LazyBlockGraphLoader::Init(const uint8_t* data,
+                                size_t size,
+                                BlockGraph* block_graph) {
+  DCHECK(data != NULL);
+  DCHECK(block_graph != NULL);
+  DCHECK(data_ == NULL);
+
+  // Find the index via the trailer, and make sure it is consistent.
+  if (size < 2 * sizeof(uint32_t)) {
+    LOG(ERROR) << "Serialized block-graph is too small.";
+    return false;
+  }
+  size_t index_offset = ReadUint32(data + size - sizeof(uint32_t));
+  if (index_offset > size - 2 * sizeof(uint32_t)) {
+    LOG(ERROR) << "Invalid block index offset.";
+    return false;
+  }
+  size_t block_count = ReadUint32(data + index_offset);
+  size_t index_size = size - sizeof(uint32_t) - index_offset -
+      sizeof(uint32_t);
+  if (index_size / kIndexEntrySize != block_count ||
+      index_size % kIndexEntrySize != 0) {
+    LOG(ERROR) << "Invalid block index size.";
+    return false;
+  }
+
+  // Read the header. This sets the block-graph properties.
+  core::ScopedInStreamPtr in_stream(
+      core::CreateByteInStream(data, data + index_offset));
+  InArchive in_archive(in_stream.get());
+  if (!LoadHeader(block_graph, &version_, &in_archive))
+    return false;
+
+  data_ = data;
+  size_ = size;
+  block_graph_ = block_graph;
+  index_ = data + index_offset + sizeof(uint32_t);
+  block_count_ = block_count;
+  block_states_.resize(block_count, kNotLoaded);
+
+  return true;
+}
+
+BlockGraph::Block* LazyBlockGraphLoader::GetBlock(BlockGraph::BlockId id) {
+  DCHECK(data_ != NULL);
+
+  size_t index = 0;
+  IndexEntry entry = {};
+  if (!FindIndexEntry(id, &index, &entry))
+    return NULL;
+
+  if (block_states_[index] != kNotLoaded)
+    return block_graph_->GetBlockById(id);
+
+  return LoadBlockAt(index, entry);
+}
+
+bool LazyBlockGraphLoader::LoadReferences(BlockGraph::Block* block) {
+  DCHECK(data_ != NULL);
+  DCHECK(block != NULL);
+
+  size_t index = 0;
+  IndexEntry entry = {};
+  if (!FindIndexEntry(block->id(), &index, &entry)) {
+    LOG(ERROR) << "No block with id " << block->id() << " in the index.";
+    return false;
+  }
+
+  return LoadReferencesAt(index, entry, block);
+}
+
+bool LazyBlockGraphLoader::LoadAll() {
+  DCHECK(data_ != NULL);
+
+  // Walk the index in order rather than looking up each block. All of the
+  // blocks are loaded first, so that loading the references doesn't recurse.
+  std::vector<BlockGraph::Block*> blocks(block_count_);
+  for (size_t i = 0; i < block_count_; ++i) {
+    IndexEntry entry = GetIndexEntry(i);
+    if (block_states_[i] != kNotLoaded) {
+      blocks[i] = block_graph_->GetBlockById(entry.id);
+    } else {
+      blocks[i] = LoadBlockAt(i, entry);
+    }
+    if (blocks[i] == NULL) {
+      LOG(ERROR) << "Unable to load block with id " << entry.id << ".";
+      return false;
+    }
+  }
+
+  for (size_t i = 0; i < block_count_; ++i) {
+    if (!LoadReferencesAt(i, GetIndexEntry(i), blocks[i]))
+      return false;
+  }
+
+  return true;
+}
+
+BlockGraph::Block* LazyBlockGraphLoader::ResolveReferencedBlock(
+    BlockGraph* block_graph, BlockGraph::BlockId id) {
+  DCHECK_EQ(block_graph_, block_graph);
+  // Once everything is loaded there's no need to go through the index.
+  if (loaded_block_count_ == block_count_)
+    return block_graph_->GetBlockById(id);
+  return GetBlock(id);
+}
+
+BlockGraph::Block* LazyBlockGraphLoader::LoadBlockAt(size_t index,
+                                                   const IndexEntry& entry) {
+  DCHECK_EQ(kNotLoaded, block_states_[index]);
+
+  if (entry.block_offset >= size_) {
+    LOG(ERROR) << "Invalid record offset for block with id " << entry.id
+               << ".";
+    return NULL;
+  }
+
+  core::ScopedInStreamPtr in_stream(
+      core::CreateByteInStream(data_ + entry.block_offset, data_ + size_));
+  InArchive in_archive(in_stream.get());
+  BlockGraph::Block* block = NULL;
+  if (!LoadBlock(version_, block_graph_, &in_archive, &block))
+    return NULL;
+  if (block->id() != entry.id) {
+    LOG(ERROR) << "Block record does not match the index for block with id "
+               << entry.id << ".";
+    return NULL;
+  }
+
+  block_states_[index] = kBlockLoaded;
+  ++loaded_block_count_;
+
+  return block;
+}
+
+bool LazyBlockGraphLoader::LoadReferencesAt(size_t index,
+                                            const IndexEntry& entry,
+                                            BlockGraph::Block* block) {
+  DCHECK_NE(kNotLoaded, block_states_[index]);
+  DCHECK_EQ(entry.id, block->id());
+
+  if (block_states_[index] == kReferencesLoaded)
+    return true;
+
+  if (entry.references_offset >= size_) {
+    LOG(ERROR) << "Invalid references record offset for block with id "
+               << block->id() << ".";
+    return false;
+  }
+
+  core::ScopedInStreamPtr in_stream(core::CreateByteInStream(
+      data_ + entry.references_offset, data_ + size_));
+  InArchive in_archive(in_stream.get());
+  if (!LoadBlockReferences(block_graph_, block, &in_archive))
+    return false;
+
+  block_states_[index] = kReferencesLoaded;
+
+  return true;
+}
+
+LazyBlockGraphLoader::IndexEntry LazyBlockGraphLoader::GetIndexEntry(
+    size_t index) const {
+  DCHECK_LT(index, block_count_);
+  const uint8_t* data = index_ + index * kIndexEntrySize;
+  IndexEntry entry = {};
+  entry.id = ReadUint32(data);
+  entry.block_offset = ReadUint32(data + sizeof(uint32_t));
+  entry.references_offset = ReadUint32(data + 2 * sizeof(uint32_t));
+  return entry;
+}
+
+bool LazyBlockGraphLoader::FindIndexEntry(BlockGraph::BlockId id,
+                                          size_t* index,
+                                          IndexEntry* entry) const {
+  DCHECK(index != NULL);
+  DCHECK(entry != NULL);
+
+  // The index is sorted by block id, so we can binary search it in place.
+  size_t begin = 0;
+  size_t end = block_count_;
+  while (begin < end) {
+    size_t mid = begin + (end - begin) / 2;
+    const uint8_t* mid_entry = index_ + mid * kIndexEntrySize;
+    uint32_t mid_id = ReadUint32(mid_entry);
+    if (mid_id < id) {
+      begin = mid + 1;
+    } else if (mid_id > id) {
+      end = mid;
+    } else {
+      *index = mid;
+      *entry = GetIndexEntry(mid);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+}  // namespace block_graph
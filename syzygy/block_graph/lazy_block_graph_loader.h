@@ -0,0 +1,139 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares a loader for block-graphs serialized in the indexed format by
+// BlockGraphSerializer::SaveIndexed. Rather than deserializing everything up
+// front, blocks are deserialized the first time they are asked for, and their
+// references only when explicitly requested. Initialization only reads the
+// header of the serialization, so it is cheap regardless of the size of the
+// block-graph.
+//
+// The loader works directly on the serialized bytes, which are typically a
+// view of a stream that is already in memory or that is memory-mapped. These
+// must outlive the loader.
+
+#ifndef SYZYGY_BLOCK_GRAPH_LAZY_BLOCK_GRAPH_LOADER_H_
+#define SYZYGY_BLOCK_GRAPH_LAZY_BLOCK_GRAPH_LOADER_H_
+
+#include <vector>
+
+#include "syzygy/block_graph/block_graph_serializer.h"
+
+namespace block_graph {
+
+class LazyBlockGraphLoader : public BlockGraphSerializer {
+ public:
+  LazyBlockGraphLoader();
+
+  // Initializes the loader. This reads the header of the serialization and
+  // sets the properties of @p block_graph, but doesn't load any blocks. If
+  // an external data source is required set_load_block_data_callback must be
+  // called prior to loading any blocks.
+  // @param data the indexed serialization.
+  // @param size the size of @p data, in bytes.
+  // @param block_graph the block-graph to be populated. This must be empty.
+  // @returns true on success, false otherwise.
+  bool Init(const uint8_t* data, size_t size, BlockGraph* block_graph);
+
+  // Gets a block, loading it if necessary. The references of the block are
+  // not loaded.
+  // @param id the id of the block.
+  // @returns the block, or NULL if it doesn't exist or could not be loaded.
+  BlockGraph::Block* GetBlock(BlockGraph::BlockId id);
+
+  // Loads the references of a block, loading the referenced blocks as
+  // necessary. This is a no-op if the references are already loaded.
+  // @param block a block that was returned by GetBlock.
+  // @returns true on success, false otherwise.
+  bool LoadReferences(BlockGraph::Block* block);
+
+  // Loads all of the blocks and their references. After this the block-graph
+  // is identical to one deserialized by BlockGraphSerializer::Load.
+  // @returns true on success, false otherwise.
+  bool LoadAll();
+
+  // @returns the number of blocks in the serialized block-graph.
+  size_t block_count() const { return block_count_; }
+
+  // @returns the number of blocks that have been loaded so far.
+  size_t loaded_block_count() const { return loaded_block_count_; }
+
+ protected:
+  // @name BlockGraphSerializer overrides.
+  // @{
+  BlockGraph::Block* ResolveReferencedBlock(BlockGraph* block_graph,
+                                            BlockGraph::BlockId id) override;
+  // @}
+
+ private:
+  // The load state of a block.
+  enum BlockState : uint8_t {
+    kNotLoaded,
+    kBlockLoaded,
+    kReferencesLoaded,
+  };
+
+  // Looks up a block in the index.
+  // @param id the id of the block.
+  // @param index receives the position of the block in the index.
+  // @param entry receives the index entry of the block.
+  // @returns true if the block was found, false otherwise.
+  bool FindIndexEntry(BlockGraph::BlockId id,
+                      size_t* index,
+                      IndexEntry* entry) const;
+
+  // Loads the block at a given position in the index.
+  // @param index the position of the block in the index.
+  // @param entry the index entry of the block.
+  // @returns the block, or NULL if it could not be loaded.
+  BlockGraph::Block* LoadBlockAt(size_t index, const IndexEntry& entry);
+
+  // Loads the references of the block at a given position in the index. This
+  // is a no-op if they are already loaded.
+  // @param index the position of the block in the index.
+  // @param entry the index entry of the block.
+  // @param block the block, which must already be loaded.
+  // @returns true on success, false otherwise.
+  bool LoadReferencesAt(size_t index,
+                        const IndexEntry& entry,
+                        BlockGraph::Block* block);
+
+  // @param index a position in the index.
+  // @returns the index entry at @p index.
+  IndexEntry GetIndexEntry(size_t index) const;
+
+  // The serialized block-graph.
+  const uint8_t* data_;
+  size_t size_;
+
+  // The block-graph being populated.
+  BlockGraph* block_graph_;
+
+  // The version of the serialization.
+  uint32_t version_;
+
+  // The index of the block records. This points into data_.
+  const uint8_t* index_;
+  size_t block_count_;
+
+  // The load state of each block, by position in the index.
+  std::vector<BlockState> block_states_;
+  size_t loaded_block_count_;
+
+  DISALLOW_COPY_AND_ASSIGN(LazyBlockGraphLoader);
+};
+
+}  // namespace block_graph
+
+#endif  // SYZYGY_BLOCK_GRAPH_LAZY_BLOCK_GRAPH_LOADER_H_
@@ -0,0 +1,113 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/block_graph/lazy_block_graph_loader.h"
+
+#include "gtest/gtest.h"
+#include "syzygy/block_graph/unittest_util.h"
+
+namespace block_graph {
+
+namespace {
+
+class LazyBlockGraphLoaderTest : public ::testing::Test {
+ public:
+  virtual void SetUp() override {
+    ASSERT_TRUE(testing::GenerateTestBlockGraph(&block_graph_));
+
+    BlockGraphSerializer serializer;
+    serializer.set_data_mode(BlockGraphSerializer::OUTPUT_ALL_DATA);
+    ASSERT_TRUE(serializer.SaveIndexed(block_graph_, &buffer_));
+    ASSERT_LT(0u, buffer_.size());
+  }
+
+  BlockGraph block_graph_;
+  std::vector<uint8_t> buffer_;
+};
+
+}  // namespace
+
+TEST_F(LazyBlockGraphLoaderTest, InitLoadsNoBlocks) {
+  BlockGraph block_graph;
+  LazyBlockGraphLoader loader;
+  ASSERT_TRUE(loader.Init(buffer_.data(), buffer_.size(), &block_graph));
+
+  EXPECT_EQ(block_graph_.blocks().size(), loader.block_count());
+  EXPECT_EQ(0u, loader.loaded_block_count());
+  EXPECT_TRUE(block_graph.blocks().empty());
+  EXPECT_EQ(block_graph_.sections().size(), block_graph.sections().size());
+  EXPECT_EQ(BlockGraphSerializer::OUTPUT_ALL_DATA, loader.data_mode());
+}
+
+TEST_F(LazyBlockGraphLoaderTest, GetBlock) {
+  BlockGraph block_graph;
+  LazyBlockGraphLoader loader;
+  ASSERT_TRUE(loader.Init(buffer_.data(), buffer_.size(), &block_graph));
+
+  // Find a block that refers to other blocks.
+  const BlockGraph::Block* original = NULL;
+  BlockGraph::BlockMap::const_iterator block_it = block_graph_.blocks().begin();
+  for (; block_it != block_graph_.blocks().end(); ++block_it) {
+    if (!block_it->second.references().empty()) {
+      original = &block_it->second;
+      break;
+    }
+  }
+  ASSERT_TRUE(original != NULL);
+
+  BlockGraph::Block* block = loader.GetBlock(original->id());
+  ASSERT_TRUE(block != NULL);
+  EXPECT_EQ(1u, loader.loaded_block_count());
+  EXPECT_EQ(original->name(), block->name());
+  EXPECT_EQ(original->size(), block->size());
+  EXPECT_EQ(original->labels(), block->labels());
+  EXPECT_TRUE(block->references().empty());
+
+  // Getting the same block again should not load it again.
+  EXPECT_EQ(block, loader.GetBlock(original->id()));
+  EXPECT_EQ(1u, loader.loaded_block_count());
+
+  // Loading the references should bring in the referenced blocks.
+  ASSERT_TRUE(loader.LoadReferences(block));
+  EXPECT_EQ(original->references().size(), block->references().size());
+  EXPECT_LT(1u, loader.loaded_block_count());
+  EXPECT_GT(loader.block_count(), loader.loaded_block_count());
+  BlockGraph::Block::ReferenceMap::const_iterator it =
+      block->references().begin();
+  for (; it != block->references().end(); ++it) {
+    EXPECT_EQ(block_graph.GetBlockById(it->second.referenced()->id()),
+              it->second.referenced());
+  }
+
+  // Unknown blocks can't be loaded.
+  EXPECT_TRUE(loader.GetBlock(block_graph_.next_block_id()) == NULL);
+}
+
+TEST_F(LazyBlockGraphLoaderTest, LoadAll) {
+  BlockGraph block_graph;
+  LazyBlockGraphLoader loader;
+  ASSERT_TRUE(loader.Init(buffer_.data(), buffer_.size(), &block_graph));
+  ASSERT_TRUE(loader.LoadAll());
+  EXPECT_EQ(loader.block_count(), loader.loaded_block_count());
+
+  EXPECT_TRUE(testing::BlockGraphsEqual(block_graph_, block_graph, loader));
+}
+
+TEST_F(LazyBlockGraphLoaderTest, FailsOnTruncatedData) {
+  BlockGraph block_graph;
+  LazyBlockGraphLoader loader;
+  EXPECT_FALSE(loader.Init(buffer_.data(), buffer_.size() - 1, &block_graph));
+}
+
+}  // namespace block_graph
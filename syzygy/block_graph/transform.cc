@@ -14,12 +14,262 @@
 
 #include "syzygy/block_graph/transform.h"
 
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <set>
+
+#include "base/threading/simple_thread.h"
 #include "syzygy/block_graph/basic_block_decomposer.h"
 #include "syzygy/block_graph/block_builder.h"
 #include "syzygy/block_graph/block_util.h"
 
 namespace block_graph {
 
+namespace {
+
+// The number of blocks handed to each worker thread per batch when applying
+// a basic-block transform in parallel.
+const size_t kBlocksPerThreadPerBatch = 256;
+
+// Holds the state associated with a block that is being transformed in
+// parallel. The decomposition and transform are run on a worker thread, the
+// merge on the calling thread.
+class ParallelTransformItem : public base::DelegateSimpleThread::Delegate {
+ public:
+  ParallelTransformItem(BlockGraph::Block* block,
+                        BasicBlockSubGraphTransformInterface* transform,
+                        const TransformPolicyInterface* policy,
+                        BlockGraph* block_graph)
+      : block_(block), transform_(transform), policy_(policy),
+        block_graph_(block_graph), decomposed_(false),
+        unsupported_instructions_(false), transformed_(false) {
+    DCHECK_NE(reinterpret_cast<BlockGraph::Block*>(NULL), block);
+    DCHECK_NE(reinterpret_cast<BasicBlockSubGraphTransformInterface*>(NULL),
+              transform);
+  }
+
+  // Decomposes and transforms the block. This is run on a worker thread, and
+  // only reads from the block graph.
+  void Run() override {
+    subgraph_.reset(new BasicBlockSubGraph());
+    BasicBlockDecomposer bb_decomposer(block_, subgraph_.get());
+    if (!bb_decomposer.Decompose()) {
+      unsupported_instructions_ =
+          bb_decomposer.contains_unsupported_instructions();
+      return;
+    }
+    decomposed_ = true;
+
+    transformed_ = transform_->TransformBasicBlockSubGraph(
+        policy_, block_graph_, subgraph_.get());
+  }
+
+  // Merges the transformed subgraph into the block graph. The original block
+  // is left in place, as other subgraphs of the same batch may still refer to
+  // it. The location of each of its basic blocks is recorded so that its
+  // referrers can be redirected once the whole batch has been merged.
+  // @param new_blocks receives the newly created blocks.
+  // @param merged is set to true if the block was replaced.
+  // @returns true on success, false otherwise.
+  bool Merge(BlockVector* new_blocks, bool* merged) {
+    DCHECK_NE(reinterpret_cast<BlockVector*>(NULL), new_blocks);
+    DCHECK_NE(reinterpret_cast<bool*>(NULL), merged);
+    *merged = false;
+
+    if (!decomposed_) {
+      // If the failure is due to unsupported instructions then simply mark
+      // the block as undecomposable so it won't be processed again.
+      if (unsupported_instructions_) {
+        VLOG(1) << "Block contains unsupported instruction(s): "
+                << BlockInfo(block_);
+        block_->set_attribute(BlockGraph::UNSUPPORTED_INSTRUCTIONS);
+        subgraph_.reset();
+        return true;
+      }
+      LOG(ERROR) << "Failed to decompose " << BlockInfo(block_) << ".";
+      return false;
+    }
+
+    if (!transformed_) {
+      LOG(ERROR) << "Transform \"" << transform_->name() << "\" failed for "
+                 << BlockInfo(block_) << ".";
+      return false;
+    }
+
+    // Tag the basic blocks that came from the original block so that we can
+    // find where they end up.
+    BasicBlockSubGraph::BBCollection& basic_blocks = subgraph_->basic_blocks();
+    BasicBlockSubGraph::BBCollection::iterator bb_it = basic_blocks.begin();
+    for (; bb_it != basic_blocks.end(); ++bb_it) {
+      if ((*bb_it)->offset() != BasicBlock::kNoOffset)
+        (*bb_it)->tags().insert(*bb_it);
+    }
+
+    subgraph_->set_original_block(NULL);
+    BlockBuilder builder(block_graph_);
+    if (!builder.Merge(subgraph_.get()))
+      return false;
+
+    const TagInfoMap& tag_info_map = builder.tag_info_map();
+    for (bb_it = basic_blocks.begin(); bb_it != basic_blocks.end(); ++bb_it) {
+      TagInfoMap::const_iterator tag_it = tag_info_map.find(*bb_it);
+      if (tag_it == tag_info_map.end())
+        continue;
+      DCHECK(!tag_it->second.empty());
+      const TagInfo& tag_info = tag_it->second.front();
+      locations_[(*bb_it)->offset()] =
+          BasicBlockLocation(tag_info.block, tag_info.offset);
+    }
+
+    new_blocks->insert(new_blocks->end(),
+                       builder.new_blocks().begin(),
+                       builder.new_blocks().end());
+    subgraph_.reset();
+    *merged = true;
+
+    return true;
+  }
+
+  // Redirects the referrers of the original block to the merged basic blocks.
+  // @param ignored the blocks whose references need not be redirected, as
+  //     they are about to be removed.
+  // @returns true on success, false otherwise.
+  bool TransferReferrers(const std::set<BlockGraph::Block*>& ignored) {
+    // Work on a copy, as updating the references modifies the referrers.
+    BlockGraph::Block::ReferrerSet referrers(block_->referrers());
+    BlockGraph::Block::ReferrerSet::const_iterator it = referrers.begin();
+    for (; it != referrers.end(); ++it) {
+      BlockGraph::Block* referrer = it->first;
+      if (ignored.find(referrer) != ignored.end())
+        continue;
+
+      BlockGraph::Reference old_ref;
+      bool found = referrer->GetReference(it->second, &old_ref);
+      DCHECK(found);
+      DCHECK_EQ(block_, old_ref.referenced());
+
+      BasicBlockLocationMap::const_iterator location_it =
+          locations_.find(old_ref.base());
+      if (location_it == locations_.end()) {
+        LOG(ERROR) << "Reference from " << BlockInfo(referrer) << " at offset "
+                   << it->second << " does not land on a basic block of "
+                   << BlockInfo(block_) << ".";
+        return false;
+      }
+
+      BlockGraph::Reference new_ref(old_ref.type(),
+                                    old_ref.size(),
+                                    location_it->second.first,
+                                    location_it->second.second,
+                                    location_it->second.second);
+      bool is_new = referrer->SetReference(it->second, new_ref);
+      DCHECK(!is_new);
+    }
+
+    return true;
+  }
+
+  BlockGraph::Block* block() const { return block_; }
+  const BasicBlockLocationMap& locations() const { return locations_; }
+
+ private:
+  BlockGraph::Block* block_;
+  std::unique_ptr<BasicBlockSubGraphTransformInterface> transform_;
+  const TransformPolicyInterface* policy_;
+  BlockGraph* block_graph_;
+
+  // Populated by Run.
+  std::unique_ptr<BasicBlockSubGraph> subgraph_;
+  bool decomposed_;
+  bool unsupported_instructions_;
+  bool transformed_;
+
+  // Populated by Merge.
+  BasicBlockLocationMap locations_;
+
+  DISALLOW_COPY_AND_ASSIGN(ParallelTransformItem);
+};
+
+// Transforms a batch of blocks in parallel and merges the results. The
+// blocks are transformed on the calling thread if @p thread_count is 1 or
+// less.
+bool ApplyBasicBlockSubGraphTransformToBatch(
+    const BasicBlockSubGraphTransformFactory& factory,
+    const TransformPolicyInterface* policy,
+    BlockGraph* block_graph,
+    BlockVector::const_iterator begin,
+    BlockVector::const_iterator end,
+    size_t thread_count,
+    const BasicBlockSubGraphMergeCallback& merge_callback,
+    BlockVector* new_blocks) {
+
+  std::vector<std::unique_ptr<ParallelTransformItem>> items;
+  items.reserve(end - begin);
+  for (BlockVector::const_iterator it = begin; it != end; ++it) {
+    BlockGraph::Block* block = *it;
+    DCHECK_EQ(BlockGraph::CODE_BLOCK, block->type());
+    DCHECK(policy->BlockIsSafeToBasicBlockDecompose(block));
+    items.push_back(std::unique_ptr<ParallelTransformItem>(
+        new ParallelTransformItem(block, factory.Run(block), policy,
+                                  block_graph)));
+  }
+
+  // Decompose and transform the blocks. The block graph is left untouched
+  // until all of the worker threads are done.
+  if (thread_count <= 1) {
+    for (size_t i = 0; i < items.size(); ++i)
+      items[i]->Run();
+  } else {
+    base::DelegateSimpleThreadPool pool("BasicBlockTransform",
+                                        static_cast<int>(thread_count));
+    pool.Start();
+    for (size_t i = 0; i < items.size(); ++i)
+      pool.AddWork(items[i].get());
+    pool.JoinAll();
+  }
+
+  // Merge the subgraphs in order. This creates the new blocks, but leaves
+  // the original blocks in place.
+  std::vector<ParallelTransformItem*> merged_items;
+  std::set<BlockGraph::Block*> merged_blocks;
+  for (size_t i = 0; i < items.size(); ++i) {
+    bool merged = false;
+    if (!items[i]->Merge(new_blocks, &merged))
+      return false;
+    if (merged) {
+      merged_items.push_back(items[i].get());
+      merged_blocks.insert(items[i]->block());
+      if (!merge_callback.is_null())
+        merge_callback.Run(items[i]->block(), items[i]->locations());
+    }
+  }
+
+  // Redirect the references to the original blocks. References between
+  // original blocks need not be updated, as those blocks are going away.
+  for (size_t i = 0; i < merged_items.size(); ++i) {
+    if (!merged_items[i]->TransferReferrers(merged_blocks))
+      return false;
+  }
+
+  // Finally remove the original blocks.
+  for (size_t i = 0; i < merged_items.size(); ++i) {
+    bool removed = merged_items[i]->block()->RemoveAllReferences();
+    DCHECK(removed);
+  }
+  for (size_t i = 0; i < merged_items.size(); ++i) {
+    BlockGraph::Block* block = merged_items[i]->block();
+    if (!block_graph->RemoveBlock(block)) {
+      LOG(ERROR) << "Unable to remove " << BlockInfo(block) << ".";
+      return false;
+    }
+  }
+
+  return true;
+}
+
+}  // namespace
+
 bool ApplyImageLayoutTransform(
     ImageLayoutTransformInterface* transform,
     const TransformPolicyInterface* policy,
@@ -232,4 +482,68 @@ bool ApplyBasicBlockSubGraphTransforms(
   return true;
 }
 
+bool ApplyBasicBlockSubGraphTransformInParallel(
+    const BasicBlockSubGraphTransformFactory& factory,
+    const TransformPolicyInterface* policy,
+    BlockGraph* block_graph,
+    const BlockVector& blocks,
+    size_t thread_count,
+    BlockVector* new_blocks) {
+  return ApplyBasicBlockSubGraphTransformInParallel(
+      factory, policy, block_graph, blocks, thread_count,
+      BasicBlockSubGraphMergeCallback(), new_blocks);
+}
+
+bool ApplyBasicBlockSubGraphTransformInParallel(
+    const BasicBlockSubGraphTransformFactory& factory,
+    const TransformPolicyInterface* policy,
+    BlockGraph* block_graph,
+    const BlockVector& blocks,
+    size_t thread_count,
+    const BasicBlockSubGraphMergeCallback& merge_callback,
+    BlockVector* new_blocks) {
+  DCHECK(!factory.is_null());
+  DCHECK(policy != NULL);
+  DCHECK(block_graph != NULL);
+
+  BlockVector created_blocks;
+
+  if (thread_count <= 1 && merge_callback.is_null()) {
+    for (size_t i = 0; i < blocks.size(); ++i) {
+      std::unique_ptr<BasicBlockSubGraphTransformInterface> transform(
+          factory.Run(blocks[i]));
+      BlockVector block_new_blocks;
+      if (!ApplyBasicBlockSubGraphTransform(transform.get(), policy,
+                                            block_graph, blocks[i],
+                                            &block_new_blocks)) {
+        return false;
+      }
+      created_blocks.insert(created_blocks.end(), block_new_blocks.begin(),
+                            block_new_blocks.end());
+    }
+  } else {
+    size_t batch_size =
+        std::max<size_t>(thread_count, 1) * kBlocksPerThreadPerBatch;
+    BlockVector::const_iterator it = blocks.begin();
+    while (it != blocks.end()) {
+      BlockVector::const_iterator batch_end = it;
+      std::advance(batch_end,
+                   std::min<size_t>(batch_size, blocks.end() - it));
+      if (!ApplyBasicBlockSubGraphTransformToBatch(factory, policy,
+                                                   block_graph, it, batch_end,
+                                                   thread_count,
+                                                   merge_callback,
+                                                   &created_blocks)) {
+        return false;
+      }
+      it = batch_end;
+    }
+  }
+
+  if (new_blocks != NULL)
+    new_blocks->swap(created_blocks);
+
+  return true;
+}
+
 }  // namespace block_graph
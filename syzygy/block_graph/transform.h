@@ -17,6 +17,10 @@
 #ifndef SYZYGY_BLOCK_GRAPH_TRANSFORM_H_
 #define SYZYGY_BLOCK_GRAPH_TRANSFORM_H_
 
+#include <map>
+#include <utility>
+
+#include "base/callback.h"
 #include "syzygy/block_graph/basic_block_subgraph.h"
 #include "syzygy/block_graph/block_graph.h"
 #include "syzygy/block_graph/ordered_block_graph.h"
@@ -140,6 +144,76 @@ bool ApplyBasicBlockSubGraphTransforms(
     BlockGraph::Block* block,
     BlockVector* new_blocks);
 
+// A factory of basic-block subgraph transforms. Applying a transform to many
+// blocks concurrently requires an independent transform instance per block,
+// as basic-block transforms typically carry per-subgraph state. The factory
+// is only ever invoked on the calling thread, and the returned transform is
+// owned by the caller.
+typedef base::Callback<BasicBlockSubGraphTransformInterface*(
+    BlockGraph::Block* block)> BasicBlockSubGraphTransformFactory;
+
+// The location of a basic block once its subgraph has been merged into the
+// block graph: the block it ended up in, and its offset in that block.
+typedef std::pair<BlockGraph::Block*, BlockGraph::Offset> BasicBlockLocation;
+
+// Maps the offset of each basic block in its original block to its location
+// once merged.
+typedef std::map<BlockGraph::Offset, BasicBlockLocation> BasicBlockLocationMap;
+
+// A callback that is invoked on the calling thread each time the transformed
+// subgraph of a block has been merged into the block graph. At that point the
+// original block is still intact: its referrers have not yet been redirected
+// and it has not been removed. The references of the new blocks to other
+// blocks of the same batch still refer to the original blocks.
+typedef base::Callback<void(const BlockGraph::Block* original_block,
+                            const BasicBlockLocationMap& locations)>
+    BasicBlockSubGraphMergeCallback;
+
+// Applies a BasicBlockSubGraphTransform to a collection of blocks, using a
+// pool of worker threads to basic-block decompose and transform the blocks.
+// The transformed subgraphs are merged back into the block graph on the
+// calling thread, in the order in which the blocks were provided. The result
+// is the same as calling ApplyBasicBlockSubGraphTransform on each block in
+// turn.
+//
+// Blocks are processed in batches to bound the number of subgraphs that are
+// held in memory at any given time.
+//
+// @param factory the factory used to create the transform to apply to each
+//     block.
+// @param policy The policy object restricting how the transform is applied.
+// @param block_graph the block graph containing the blocks to be transformed.
+// @param blocks the blocks to be transformed.
+// @param thread_count the number of worker threads to use. If this is 1 or
+//     less the blocks are processed on the calling thread.
+// @param new_blocks On success, any newly created blocks will be returned
+//     here. Note that this parameter may be NULL if you are not interested
+//     in retrieving the set of new blocks.
+// @pre each block must be a code block that is safe to basic-block decompose.
+// @pre the transforms must only modify the subgraph they are given. In
+//     particular they must not modify the block graph nor share mutable state
+//     with one another, as they are run concurrently.
+// @returns true on success, false otherwise.
+bool ApplyBasicBlockSubGraphTransformInParallel(
+    const BasicBlockSubGraphTransformFactory& factory,
+    const TransformPolicyInterface* policy,
+    BlockGraph* block_graph,
+    const BlockVector& blocks,
+    size_t thread_count,
+    BlockVector* new_blocks);
+
+// Same as above, but invokes @p merge_callback for every block that is
+// replaced. When a callback is provided the blocks are always processed in
+// batches, on the calling thread if @p thread_count is 1 or less.
+bool ApplyBasicBlockSubGraphTransformInParallel(
+    const BasicBlockSubGraphTransformFactory& factory,
+    const TransformPolicyInterface* policy,
+    BlockGraph* block_graph,
+    const BlockVector& blocks,
+    size_t thread_count,
+    const BasicBlockSubGraphMergeCallback& merge_callback,
+    BlockVector* new_blocks);
+
 // An ImageLayoutTransformInterface is a pure virtual base class defining the
 // PE image layout transform API
 class ImageLayoutTransformInterface {
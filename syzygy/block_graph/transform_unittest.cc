@@ -16,6 +16,12 @@
 
 #include "syzygy/block_graph/transform.h"
 
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "base/atomicops.h"
+#include "base/bind.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "syzygy/block_graph/unittest_util.h"
@@ -121,7 +127,7 @@ class ApplyBasicBlockSubGraphTransformTest : public testing::Test {
     // Set up the code block.
     ASSERT_TRUE(code_block_->SetLabel(
         kOffsetOfCode,
-        BlockGraph::Label("Code", BlockGraph::CODE_LABEL)));
+        "Code", BlockGraph::CODE_LABEL));
     code_block_->SetData(kCodeBytes, sizeof(kCodeBytes));
 
     // Set up the references
@@ -161,6 +167,120 @@ class MockBasicBlockSubGraphTransform :
                     BasicBlockSubGraph*));
 };
 
+// A code block calling another code block. The original C source code for
+// this function is:
+//
+//     void next();
+//     void call_next() {
+//       next();
+//     }
+const uint8_t kCallBytes[] = {
+    0xE8,
+    0x00,
+    0x00,
+    0x00,
+    0x00,  // call next
+    0xC3   // ret
+};
+const BlockGraph::Offset kOffsetOfCallTarget = 1;
+
+// A basic-block transform that counts the number of times it is applied.
+class CountingBasicBlockSubGraphTransform
+    : public BasicBlockSubGraphTransformInterface {
+ public:
+  CountingBasicBlockSubGraphTransform(bool result,
+                                      base::subtle::Atomic32* count)
+      : result_(result), count_(count) {
+  }
+
+  virtual const char* name() const {
+    return "CountingBasicBlockSubGraphTransform";
+  }
+
+  virtual bool TransformBasicBlockSubGraph(const TransformPolicyInterface*,
+                                           BlockGraph*,
+                                           BasicBlockSubGraph*) {
+    base::subtle::NoBarrier_AtomicIncrement(count_, 1);
+    return result_;
+  }
+
+  static BasicBlockSubGraphTransformInterface* Create(
+      bool result, base::subtle::Atomic32* count, BlockGraph::Block*) {
+    return new CountingBasicBlockSubGraphTransform(result, count);
+  }
+
+ private:
+  bool result_;
+  base::subtle::Atomic32* count_;
+};
+
+// Records the blocks and locations reported by a merge callback.
+typedef std::vector<std::pair<const BlockGraph::Block*, BasicBlockLocationMap>>
+    MergedBlocks;
+void RecordMergedBlock(MergedBlocks* merged,
+                       const BlockGraph::Block* original_block,
+                       const BasicBlockLocationMap& locations) {
+  // The original block must still be intact.
+  EXPECT_FALSE(original_block->referrers().empty());
+  merged->push_back(std::make_pair(original_block, locations));
+}
+
+// Builds a ring of code blocks, each calling the next one, along with a data
+// block referring to all of them.
+class ApplyBasicBlockSubGraphTransformInParallelTest : public testing::Test {
+ public:
+  // Enough blocks to span several batches.
+  static const size_t kBlockCount = 1500;
+  static const size_t kThreadCount = 2;
+
+  ApplyBasicBlockSubGraphTransformInParallelTest()
+      : data_block_(NULL), count_(0) {
+  }
+
+  virtual void SetUp() {
+    data_block_ = block_graph_.AddBlock(
+        BlockGraph::DATA_BLOCK, kBlockCount * sizeof(uint32_t), "Data");
+    ASSERT_TRUE(data_block_ != NULL);
+
+    for (size_t i = 0; i < kBlockCount; ++i) {
+      BlockGraph::Block* code_block = block_graph_.AddBlock(
+          BlockGraph::CODE_BLOCK, sizeof(kCallBytes), "Code");
+      ASSERT_TRUE(code_block != NULL);
+      ASSERT_TRUE(code_block->SetLabel(
+          0, "Code", BlockGraph::CODE_LABEL));
+      code_block->SetData(kCallBytes, sizeof(kCallBytes));
+      code_blocks_.push_back(code_block);
+
+      ASSERT_TRUE(data_block_->SetReference(
+          i * sizeof(uint32_t),
+          BlockGraph::Reference(BlockGraph::ABSOLUTE_REF, sizeof(uint32_t),
+                                code_block, 0, 0)));
+    }
+
+    for (size_t i = 0; i < kBlockCount; ++i) {
+      BlockGraph::Block* next = code_blocks_[(i + 1) % kBlockCount];
+      ASSERT_TRUE(code_blocks_[i]->SetReference(
+          kOffsetOfCallTarget,
+          BlockGraph::Reference(BlockGraph::PC_RELATIVE_REF, sizeof(uint32_t),
+                                next, 0, 0)));
+    }
+  }
+
+  BasicBlockSubGraphTransformFactory MakeFactory(bool result) {
+    return base::Bind(&CountingBasicBlockSubGraphTransform::Create, result,
+                      &count_);
+  }
+
+ protected:
+  DummyTransformPolicy policy_;
+  BlockGraph block_graph_;
+  BlockGraph::Block* data_block_;
+  BlockVector code_blocks_;
+  base::subtle::Atomic32 count_;
+};
+
+const size_t ApplyBasicBlockSubGraphTransformInParallelTest::kBlockCount;
+const size_t ApplyBasicBlockSubGraphTransformInParallelTest::kThreadCount;
 
 class ApplyImageLayoutTransformTest : public testing::Test {
 public:
@@ -368,4 +488,82 @@ TEST_F(ApplyImageLayoutTransformTest, VectorTransformSucceeds) {
   EXPECT_TRUE(ApplyImageLayoutTransforms(
     txs, &policy_, image_layout_, ordered_block_graph_));
 }
+
+TEST_F(ApplyBasicBlockSubGraphTransformInParallelTest, TransformSucceeds) {
+  BlockVector new_blocks;
+  EXPECT_TRUE(ApplyBasicBlockSubGraphTransformInParallel(
+      MakeFactory(true), &policy_, &block_graph_, code_blocks_, kThreadCount,
+      &new_blocks));
+  EXPECT_EQ(static_cast<base::subtle::Atomic32>(kBlockCount), count_);
+
+  // Every code block should have been replaced.
+  ASSERT_EQ(kBlockCount, new_blocks.size());
+  EXPECT_EQ(kBlockCount + 1, block_graph_.blocks().size());
+  std::set<BlockGraph::Block*> new_block_set(new_blocks.begin(),
+                                             new_blocks.end());
+  EXPECT_EQ(kBlockCount, new_block_set.size());
+
+  // The data block should refer to the new blocks, in order.
+  ASSERT_EQ(kBlockCount, data_block_->references().size());
+  for (size_t i = 0; i < kBlockCount; ++i) {
+    BlockGraph::Reference ref;
+    ASSERT_TRUE(data_block_->GetReference(i * sizeof(uint32_t), &ref));
+    EXPECT_EQ(new_blocks[i], ref.referenced());
+    EXPECT_EQ(0, ref.offset());
+  }
+
+  // The ring should have been preserved, across batches.
+  for (size_t i = 0; i < kBlockCount; ++i) {
+    ASSERT_EQ(1u, new_blocks[i]->references().size());
+    BlockGraph::Reference ref;
+    ASSERT_TRUE(new_blocks[i]->GetReference(kOffsetOfCallTarget, &ref));
+    EXPECT_EQ(new_blocks[(i + 1) % kBlockCount], ref.referenced());
+    EXPECT_EQ(0, ref.offset());
+    EXPECT_EQ(2u, new_blocks[i]->referrers().size());
+  }
+}
+
+TEST_F(ApplyBasicBlockSubGraphTransformInParallelTest, SingleThreadSucceeds) {
+  BlockVector new_blocks;
+  EXPECT_TRUE(ApplyBasicBlockSubGraphTransformInParallel(
+      MakeFactory(true), &policy_, &block_graph_, code_blocks_, 1,
+      &new_blocks));
+  EXPECT_EQ(static_cast<base::subtle::Atomic32>(kBlockCount), count_);
+  EXPECT_EQ(kBlockCount, new_blocks.size());
+  EXPECT_EQ(kBlockCount + 1, block_graph_.blocks().size());
+}
+
+TEST_F(ApplyBasicBlockSubGraphTransformInParallelTest, MergeCallback) {
+  for (size_t thread_count = 1; thread_count <= kThreadCount; ++thread_count) {
+    BlockVector blocks(code_blocks_);
+    MergedBlocks merged;
+    BlockVector new_blocks;
+    EXPECT_TRUE(ApplyBasicBlockSubGraphTransformInParallel(
+        MakeFactory(true), &policy_, &block_graph_, blocks, thread_count,
+        base::Bind(&RecordMergedBlock, base::Unretained(&merged)),
+        &new_blocks));
+    ASSERT_EQ(kBlockCount, new_blocks.size());
+    EXPECT_EQ(kBlockCount + 1, block_graph_.blocks().size());
+
+    // Each block should have been reported, in order, with the location of
+    // its single basic block.
+    ASSERT_EQ(kBlockCount, merged.size());
+    for (size_t i = 0; i < kBlockCount; ++i) {
+      EXPECT_EQ(blocks[i], merged[i].first);
+      ASSERT_EQ(1u, merged[i].second.size());
+      EXPECT_EQ(0, merged[i].second.begin()->first);
+      EXPECT_EQ(BasicBlockLocation(new_blocks[i], 0),
+                merged[i].second.begin()->second);
+    }
+
+    code_blocks_.swap(new_blocks);
+  }
+}
+
+TEST_F(ApplyBasicBlockSubGraphTransformInParallelTest, TransformFails) {
+  EXPECT_FALSE(ApplyBasicBlockSubGraphTransformInParallel(
+      MakeFactory(false), &policy_, &block_graph_, code_blocks_, kThreadCount,
+      NULL));
+}
+
 }  // namespace block_graph
@@ -169,6 +169,9 @@ const bool kDefaultEnableZebraBlockHeap = false;
 const bool kDefaultEnableAllocationFilter = false;
 const float kDefaultQuarantineFloodFillRate = 0.5f;
 const bool kDefaultPreventDuplicateCorruptionCrashes = false;
+const bool kDefaultEnableBlockMagazines = false;
+const bool kDefaultEnableLockFreeQuarantine = false;
+const bool kDefaultEnableStackWalkCache = false;
 
 // Default values of LargeBlockHeap parameters.
 extern const bool kDefaultEnableLargeBlockHeap = true;
@@ -219,6 +222,9 @@ const char kParamEnableAllocationFilter[] = "enable_allocation_filter";
 const char kParamQuarantineFloodFillRate[] = "quarantine_flood_fill_rate";
 const char kParamPreventDuplicateCorruptionCrashes[] =
     "prevent_duplicate_corruption_crashes";
+const char kParamEnableBlockMagazines[] = "enable_block_magazines";
+const char kParamEnableLockFreeQuarantine[] = "enable_lock_free_quarantine";
+const char kParamEnableStackWalkCache[] = "enable_stack_walk_cache";
 
 // String names of LargeBlockHeap parameters.
 const char kParamDisableLargeBlockHeap[] = "disable_large_block_heap";
@@ -308,13 +314,18 @@ void SetDefaultAsanParameters(AsanParameters* asan_parameters) {
   asan_parameters->report_invalid_accesses = kDefaultReportInvalidAccesses;
   asan_parameters->defer_crash_reporter_initialization =
       kDefaultDeferCrashReporterInitialization;
+  asan_parameters->enable_block_magazines = kDefaultEnableBlockMagazines;
+  asan_parameters->enable_lock_free_quarantine =
+      kDefaultEnableLockFreeQuarantine;
+  asan_parameters->enable_stack_walk_cache = kDefaultEnableStackWalkCache;
 }
 
 bool InflateAsanParameters(const AsanParameters* pod_params,
                            InflatedAsanParameters* inflated_params) {
   // This must be kept up to date with AsanParameters as it evolves.
   static const size_t kSizeOfAsanParametersByVersion[] = {
-      40, 44, 48, 52, 52, 52, 56, 56, 56, 56, 60, 60, 60, 60, 60, 60};
+      40, 44, 48, 52, 52, 52, 56, 56, 56, 56, 60, 60, 60, 60, 60, 60, 60, 60,
+      60};
   static_assert(
       arraysize(kSizeOfAsanParametersByVersion) == kAsanParametersVersion + 1,
       "Size of parameters version out of date.");
@@ -520,6 +531,12 @@ bool ParseAsanParameters(const base::StringPiece16& param_string,
     asan_parameters->report_invalid_accesses = true;
   if (cmd_line.HasSwitch(kParamDeferCrashReporterInitialization))
     asan_parameters->defer_crash_reporter_initialization = true;
+  if (cmd_line.HasSwitch(kParamEnableBlockMagazines))
+    asan_parameters->enable_block_magazines = true;
+  if (cmd_line.HasSwitch(kParamEnableLockFreeQuarantine))
+    asan_parameters->enable_lock_free_quarantine = true;
+  if (cmd_line.HasSwitch(kParamEnableStackWalkCache))
+    asan_parameters->enable_stack_walk_cache = true;
 
   // New style boolean flags with both positive and negative setters. This
   // allows them to be set one way in the baked in configuration, and set
@@ -36,7 +36,7 @@ namespace common {
 // the StackCaptureCache.
 typedef uint32_t AsanStackId;
 
-static const size_t kAsanParametersReserved1Bits = 19;
+static const size_t kAsanParametersReserved1Bits = 16;
 
 // This data structure is injected into an instrumented image in a read-only
 // section. It is initialized by the instrumenter, and will be looked up at
@@ -119,6 +119,17 @@ struct AsanParameters {
       // Runtime: Defer the crash reporter initialization, the client has to
       // manually call the crash reporter initialization function.
       unsigned defer_crash_reporter_initialization : 1;
+      // BlockHeapManager: Indicates if small blocks are recycled through
+      // per-thread magazines rather than being returned to the heap.
+      unsigned enable_block_magazines : 1;
+      // BlockHeapManager: Indicates if the shared quarantine is the lock-free
+      // MPSC variant rather than the lock-based sharded one. This is only
+      // taken into account when the heap manager is initialized.
+      unsigned enable_lock_free_quarantine : 1;
+      // StackCapture: Indicates if the threads reuse the outer part of their
+      // previous stack walks once it is known to be stable, rather than
+      // walking their whole stack on every capture.
+      unsigned enable_stack_walk_cache : 1;
 
       // Add new flags here!
 
@@ -162,13 +173,13 @@ COMPILE_ASSERT_IS_POD_OF_SIZE(AsanParameters, 64);
 // The current version of the Asan parameters structure. This must be updated
 // if any changes are made to the above structure! This is defined in the header
 // file to allow compile time assertions against this version number.
-const uint32_t kAsanParametersVersion = 15;
+const uint32_t kAsanParametersVersion = 18;
 
 // If the number of free bits in the parameters struct changes, then the
 // version has to change as well. This is simply here to make sure that
 // everything changes in lockstep.
-static_assert(kAsanParametersReserved1Bits == 19 &&
-                  kAsanParametersVersion == 15,
+static_assert(kAsanParametersReserved1Bits == 16 &&
+                  kAsanParametersVersion == 18,
               "Version must change if reserved bits changes.");
 
 // The name of the section that will be injected into an instrumented image,
@@ -252,6 +263,9 @@ extern const bool kDefaultEnableZebraBlockHeap;
 extern const bool kDefaultEnableAllocationFilter;
 extern const float kDefaultQuarantineFloodFillRate;
 extern const bool kDefaultPreventDuplicateCorruptionCrashes;
+extern const bool kDefaultEnableBlockMagazines;
+extern const bool kDefaultEnableLockFreeQuarantine;
+extern const bool kDefaultEnableStackWalkCache;
 // Default values of LargeBlockHeap parameters.
 extern const bool kDefaultEnableLargeBlockHeap;
 extern const size_t kDefaultLargeAllocationThreshold;
@@ -292,6 +306,9 @@ extern const char kParamEnableZebraBlockHeap[];
 extern const char kParamEnableAllocationFilter[];
 extern const char kParamQuarantineFloodFillRate[];
 extern const char kParamPreventDuplicateCorruptionCrashes[];
+extern const char kParamEnableBlockMagazines[];
+extern const char kParamEnableLockFreeQuarantine[];
+extern const char kParamEnableStackWalkCache[];
 // String names of LargeBlockHeap parameters.
 extern const char kParamDisableLargeBlockHeap[];
 extern const char kParamLargeAllocationThreshold[];
@@ -98,6 +98,12 @@ TEST(AsanParametersTest, SetDefaultAsanParameters) {
             static_cast<bool>(aparams.report_invalid_accesses));
   EXPECT_EQ(kDefaultDeferCrashReporterInitialization,
             static_cast<bool>(aparams.defer_crash_reporter_initialization));
+  EXPECT_EQ(kDefaultEnableBlockMagazines,
+            static_cast<bool>(aparams.enable_block_magazines));
+  EXPECT_EQ(kDefaultEnableLockFreeQuarantine,
+            static_cast<bool>(aparams.enable_lock_free_quarantine));
+  EXPECT_EQ(kDefaultEnableStackWalkCache,
+            static_cast<bool>(aparams.enable_stack_walk_cache));
 }
 
 TEST(AsanParametersTest, InflateAsanParametersStackIdsPastEnd) {
@@ -255,6 +261,12 @@ TEST(AsanParametersTest, ParseAsanParametersMinimal) {
             static_cast<bool>(iparams.report_invalid_accesses));
   EXPECT_EQ(kDefaultDeferCrashReporterInitialization,
             static_cast<bool>(iparams.defer_crash_reporter_initialization));
+  EXPECT_EQ(kDefaultEnableBlockMagazines,
+            static_cast<bool>(iparams.enable_block_magazines));
+  EXPECT_EQ(kDefaultEnableLockFreeQuarantine,
+            static_cast<bool>(iparams.enable_lock_free_quarantine));
+  EXPECT_EQ(kDefaultEnableStackWalkCache,
+            static_cast<bool>(iparams.enable_stack_walk_cache));
 }
 
 TEST(AsanParametersTest, ParseAsanParametersMaximal) {
@@ -283,7 +295,10 @@ TEST(AsanParametersTest, ParseAsanParametersMaximal) {
       L"--enable_feature_randomization "
       L"--prevent_duplicate_corruption_crashes "
       L"--report_invalid_accesses "
-      L"--defer_crash_reporter_initialization";
+      L"--defer_crash_reporter_initialization "
+      L"--enable_block_magazines "
+      L"--enable_lock_free_quarantine "
+      L"--enable_stack_walk_cache";
 
   InflatedAsanParameters iparams;
   SetDefaultAsanParameters(&iparams);
@@ -320,6 +335,9 @@ TEST(AsanParametersTest, ParseAsanParametersMaximal) {
   EXPECT_EQ(true, static_cast<bool>(iparams.report_invalid_accesses));
   EXPECT_EQ(true,
             static_cast<bool>(iparams.defer_crash_reporter_initialization));
+  EXPECT_EQ(true, static_cast<bool>(iparams.enable_block_magazines));
+  EXPECT_EQ(true, static_cast<bool>(iparams.enable_lock_free_quarantine));
+  EXPECT_EQ(true, static_cast<bool>(iparams.enable_stack_walk_cache));
 }
 
 }  // namespace common
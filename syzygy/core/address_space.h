@@ -33,19 +33,48 @@
 #include "syzygy/core/address_range.h"
 #include "syzygy/core/address_space_internal.h"
 #include "syzygy/core/serialization.h"
+#include "syzygy/core/sorted_vector_map.h"
 
 namespace core {
 
+// Backend policies for AddressSpace. A policy selects the container used to
+// store the ranges of an address space, via its nested RangeMap template.
+//
+// The default backend is a std::map. It has cheap insertions and removals at
+// arbitrary locations and stable iterators.
+struct MapRangeMapPolicy {
+  template <typename RangeType, typename ItemType>
+  struct Rebind {
+    typedef std::map<RangeType, ItemType> RangeMap;
+  };
+};
+
+// This backend stores the ranges in a single sorted array. Lookups and
+// iteration are much faster and the memory footprint is a fraction of that of
+// a std::map, but insertions and removals in the middle of the address space
+// are O(N) and invalidate all iterators. This is best suited to address spaces
+// that are built in order (see AddressSpace::Push) and then mostly queried.
+struct SortedVectorRangeMapPolicy {
+  template <typename RangeType, typename ItemType>
+  struct Rebind {
+    typedef SortedVectorMap<RangeType, ItemType> RangeMap;
+  };
+};
+
 // An address space is a mapping from a set of non-overlapping address ranges
 // (AddressSpace::Range), each of non-zero size, to an ItemType.
-template <typename AddressType, typename SizeType, typename ItemType>
+template <typename AddressType,
+          typename SizeType,
+          typename ItemType,
+          typename RangeMapPolicy = MapRangeMapPolicy>
 class AddressSpace {
  public:
   // Typedef we use for convenience throughout.
   typedef AddressRange<AddressType, SizeType> Range;
-  typedef std::map<Range, ItemType> RangeMap;
-  typedef typename std::map<Range, ItemType>::iterator RangeMapIter;
-  typedef typename std::map<Range, ItemType>::const_iterator RangeMapConstIter;
+  typedef typename RangeMapPolicy::template Rebind<Range, ItemType>::RangeMap
+      RangeMap;
+  typedef typename RangeMap::iterator RangeMapIter;
+  typedef typename RangeMap::const_iterator RangeMapConstIter;
   typedef std::pair<RangeMapConstIter, RangeMapConstIter> RangeMapConstIterPair;
   typedef std::pair<RangeMapIter, RangeMapIter> RangeMapIterPair;
 
@@ -128,6 +157,18 @@ class AddressSpace {
                    const ItemType& item,
                    typename RangeMap::iterator* ret_it = NULL);
 
+  // Appends @p range mapping to @p item at the tail end of the address space.
+  //
+  // This method is amortized O(1) for all backends, and is the preferred way
+  // of building an address space when the ranges are visited in increasing
+  // order. This will fail if @p range is empty or if it does not start at or
+  // beyond the end of all existing ranges.
+  //
+  // @param range the range to insert.
+  // @param item the item to associate with @p range.
+  // @returns true iff @p range inserted.
+  bool Push(const Range& range, const ItemType& item);
+
   // Remove the range that exactly matches @p range.
   // Returns true iff @p range is removed.
   bool Remove(const Range& range);
@@ -385,12 +426,18 @@ class AddressRangeMap {
   RangePairs range_pairs_;
 };
 
-template <typename AddressType, typename SizeType, typename ItemType>
-AddressSpace<AddressType, SizeType, ItemType>::AddressSpace() {
+template <typename AddressType,
+          typename SizeType,
+          typename ItemType,
+          typename RangeMapPolicy>
+AddressSpace<AddressType, SizeType, ItemType, RangeMapPolicy>::AddressSpace() {
 }
 
-template <typename AddressType, typename SizeType, typename ItemType>
-bool AddressSpace<AddressType, SizeType, ItemType>::Insert(
+template <typename AddressType,
+          typename SizeType,
+          typename ItemType,
+          typename RangeMapPolicy>
+bool AddressSpace<AddressType, SizeType, ItemType, RangeMapPolicy>::Insert(
     const Range& range,
     const ItemType& item,
     typename RangeMap::iterator* ret_it) {
@@ -412,11 +459,14 @@ bool AddressSpace<AddressType, SizeType, ItemType>::Insert(
   return true;
 }
 
-template <typename AddressType, typename SizeType, typename ItemType>
-bool AddressSpace<AddressType, SizeType, ItemType>::FindOrInsert(
-    const Range& range,
-    const ItemType& item,
-    typename RangeMap::iterator* ret_it) {
+template <typename AddressType,
+          typename SizeType,
+          typename ItemType,
+          typename RangeMapPolicy>
+bool AddressSpace<AddressType, SizeType, ItemType, RangeMapPolicy>::
+    FindOrInsert(const Range& range,
+                 const ItemType& item,
+                 typename RangeMap::iterator* ret_it) {
   // We can't insert empty ranges.
   if (range.IsEmpty())
     return false;
@@ -439,11 +489,14 @@ bool AddressSpace<AddressType, SizeType, ItemType>::FindOrInsert(
   return true;
 }
 
-template <typename AddressType, typename SizeType, typename ItemType>
-bool AddressSpace<AddressType, SizeType, ItemType>::SubsumeInsert(
-    const Range& range,
-    const ItemType& item,
-    typename RangeMap::iterator* ret_it) {
+template <typename AddressType,
+          typename SizeType,
+          typename ItemType,
+          typename RangeMapPolicy>
+bool AddressSpace<AddressType, SizeType, ItemType, RangeMapPolicy>::
+    SubsumeInsert(const Range& range,
+                  const ItemType& item,
+                  typename RangeMap::iterator* ret_it) {
   // We can't insert empty ranges.
   if (range.IsEmpty())
     return false;
@@ -495,8 +548,11 @@ bool AddressSpace<AddressType, SizeType, ItemType>::SubsumeInsert(
   return true;
 }
 
-template <typename AddressType, typename SizeType, typename ItemType>
-void AddressSpace<AddressType, SizeType, ItemType>::MergeInsert(
+template <typename AddressType,
+          typename SizeType,
+          typename ItemType,
+          typename RangeMapPolicy>
+void AddressSpace<AddressType, SizeType, ItemType, RangeMapPolicy>::MergeInsert(
     const Range& range,
     const ItemType& item,
     typename RangeMap::iterator* ret_it) {
@@ -540,8 +596,31 @@ void AddressSpace<AddressType, SizeType, ItemType>::MergeInsert(
   return;
 }
 
-template <typename AddressType, typename SizeType, typename ItemType>
-bool AddressSpace<AddressType, SizeType, ItemType>::Remove(const Range& range) {
+template <typename AddressType,
+          typename SizeType,
+          typename ItemType,
+          typename RangeMapPolicy>
+bool AddressSpace<AddressType, SizeType, ItemType, RangeMapPolicy>::Push(
+    const Range& range,
+    const ItemType& item) {
+  // We can't insert empty ranges.
+  if (range.IsEmpty())
+    return false;
+
+  // The range must lie beyond all existing ranges.
+  if (!ranges_.empty() && range.start() < ranges_.rbegin()->first.end())
+    return false;
+
+  ranges_.insert(ranges_.end(), std::make_pair(range, item));
+  return true;
+}
+
+template <typename AddressType,
+          typename SizeType,
+          typename ItemType,
+          typename RangeMapPolicy>
+bool AddressSpace<AddressType, SizeType, ItemType, RangeMapPolicy>::Remove(
+    const Range& range) {
   // We can't remove empty ranges.
   if (range.IsEmpty())
     return false;
@@ -554,17 +633,25 @@ bool AddressSpace<AddressType, SizeType, ItemType>::Remove(const Range& range) {
   return true;
 }
 
-template <typename AddressType, typename SizeType, typename ItemType>
-typename AddressSpace<AddressType, SizeType, ItemType>::RangeMap::const_iterator
-AddressSpace<AddressType, SizeType, ItemType>::FindFirstIntersection(
-    const Range& range) const {
+template <typename AddressType,
+          typename SizeType,
+          typename ItemType,
+          typename RangeMapPolicy>
+typename AddressSpace<AddressType, SizeType, ItemType, RangeMapPolicy>::
+    RangeMap::const_iterator
+AddressSpace<AddressType, SizeType, ItemType, RangeMapPolicy>::
+    FindFirstIntersection(const Range& range) const {
   return const_cast<AddressSpace*>(this)->FindFirstIntersection(range);
 }
 
-template <typename AddressType, typename SizeType, typename ItemType>
-typename AddressSpace<AddressType, SizeType, ItemType>::RangeMap::iterator
-AddressSpace<AddressType, SizeType, ItemType>::FindFirstIntersection(
-    const Range& range) {
+template <typename AddressType,
+          typename SizeType,
+          typename ItemType,
+          typename RangeMapPolicy>
+typename AddressSpace<AddressType, SizeType, ItemType, RangeMapPolicy>::
+    RangeMap::iterator
+AddressSpace<AddressType, SizeType, ItemType, RangeMapPolicy>::
+    FindFirstIntersection(const Range& range) {
   // Empty items do not exist in the address-space.
   if (range.IsEmpty())
     return ranges_.end();
@@ -593,16 +680,24 @@ AddressSpace<AddressType, SizeType, ItemType>::FindFirstIntersection(
   return ranges_.end();
 }
 
-template <typename AddressType, typename SizeType, typename ItemType>
-typename AddressSpace<AddressType, SizeType, ItemType>::RangeMapConstIterPair
-AddressSpace<AddressType, SizeType, ItemType>::FindIntersecting(
+template <typename AddressType,
+          typename SizeType,
+          typename ItemType,
+          typename RangeMapPolicy>
+typename AddressSpace<AddressType, SizeType, ItemType, RangeMapPolicy>::
+    RangeMapConstIterPair
+AddressSpace<AddressType, SizeType, ItemType, RangeMapPolicy>::FindIntersecting(
     const Range& range) const {
   return const_cast<AddressSpace*>(this)->FindIntersecting(range);
 }
 
-template <typename AddressType, typename SizeType, typename ItemType>
-typename AddressSpace<AddressType, SizeType, ItemType>::RangeMapIterPair
-AddressSpace<AddressType, SizeType, ItemType>::FindIntersecting(
+template <typename AddressType,
+          typename SizeType,
+          typename ItemType,
+          typename RangeMapPolicy>
+typename AddressSpace<AddressType, SizeType, ItemType, RangeMapPolicy>::
+    RangeMapIterPair
+AddressSpace<AddressType, SizeType, ItemType, RangeMapPolicy>::FindIntersecting(
     const Range& range) {
   // Empty ranges find nothing.
   if (range.IsEmpty())
@@ -630,24 +725,33 @@ AddressSpace<AddressType, SizeType, ItemType>::FindIntersecting(
   return std::make_pair(begin, end);
 }
 
-template <typename AddressType, typename SizeType, typename ItemType>
-bool AddressSpace<AddressType, SizeType, ItemType>::Intersects(
+template <typename AddressType,
+          typename SizeType,
+          typename ItemType,
+          typename RangeMapPolicy>
+bool AddressSpace<AddressType, SizeType, ItemType, RangeMapPolicy>::Intersects(
     const Range& range) const {
   RangeMapConstIterPair its = FindIntersecting(range);
   return (its.first != its.second);
 }
 
-template <typename AddressType, typename SizeType, typename ItemType>
-bool AddressSpace<AddressType, SizeType, ItemType>::ContainsExactly(
-    const Range& range) const {
+template <typename AddressType,
+          typename SizeType,
+          typename ItemType,
+          typename RangeMapPolicy>
+bool AddressSpace<AddressType, SizeType, ItemType, RangeMapPolicy>::
+    ContainsExactly(const Range& range) const {
   RangeMapConstIterPair its = FindIntersecting(range);
   if (its.first == its.second)
     return false;
   return its.first->first == range;
 }
 
-template <typename AddressType, typename SizeType, typename ItemType>
-bool AddressSpace<AddressType, SizeType, ItemType>::Contains(
+template <typename AddressType,
+          typename SizeType,
+          typename ItemType,
+          typename RangeMapPolicy>
+bool AddressSpace<AddressType, SizeType, ItemType, RangeMapPolicy>::Contains(
     const Range& range) const {
   RangeMapConstIterPair its = FindIntersecting(range);
   if (its.first == its.second)
@@ -655,9 +759,13 @@ bool AddressSpace<AddressType, SizeType, ItemType>::Contains(
   return its.first->first.Contains(range);
 }
 
-template <typename AddressType, typename SizeType, typename ItemType>
-typename AddressSpace<AddressType, SizeType, ItemType>::RangeMap::const_iterator
-AddressSpace<AddressType, SizeType, ItemType>::FindContaining(
+template <typename AddressType,
+          typename SizeType,
+          typename ItemType,
+          typename RangeMapPolicy>
+typename AddressSpace<AddressType, SizeType, ItemType, RangeMapPolicy>::
+    RangeMap::const_iterator
+AddressSpace<AddressType, SizeType, ItemType, RangeMapPolicy>::FindContaining(
     const Range& range) const {
   // If there is a containing range, it must be the first intersection.
   RangeMap::const_iterator it(FindFirstIntersection(range));
@@ -667,9 +775,13 @@ AddressSpace<AddressType, SizeType, ItemType>::FindContaining(
   return ranges_.end();
 }
 
-template <typename AddressType, typename SizeType, typename ItemType>
-typename AddressSpace<AddressType, SizeType, ItemType>::RangeMap::iterator
-AddressSpace<AddressType, SizeType, ItemType>::FindContaining(
+template <typename AddressType,
+          typename SizeType,
+          typename ItemType,
+          typename RangeMapPolicy>
+typename AddressSpace<AddressType, SizeType, ItemType, RangeMapPolicy>::
+    RangeMap::iterator
+AddressSpace<AddressType, SizeType, ItemType, RangeMapPolicy>::FindContaining(
     const Range& range) {
   // If there is a containing range, it must be the first intersection.
   RangeMap::iterator it(FindFirstIntersection(range));
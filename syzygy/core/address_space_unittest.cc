@@ -396,6 +396,75 @@ TEST(AddressSpaceTest, FindIntersecting) {
   EXPECT_TRUE(it_pair.first == address_space.ranges().end());
 }
 
+TEST(AddressSpaceTest, Push) {
+  IntegerAddressSpace address_space;
+  void* item = "Something to point at";
+
+  // In-order pushes should work.
+  EXPECT_TRUE(address_space.Push(IntegerAddressSpace::Range(100, 10), item));
+  EXPECT_TRUE(address_space.Push(IntegerAddressSpace::Range(110, 5), item));
+  EXPECT_TRUE(address_space.Push(IntegerAddressSpace::Range(120, 10), item));
+  EXPECT_EQ(3u, address_space.size());
+
+  // Out-of-order and overlapping pushes should be rejected.
+  EXPECT_FALSE(address_space.Push(IntegerAddressSpace::Range(0, 10), item));
+  EXPECT_FALSE(address_space.Push(IntegerAddressSpace::Range(125, 10), item));
+
+  // Empty pushes should be rejected.
+  EXPECT_FALSE(address_space.Push(IntegerAddressSpace::Range(200, 0), item));
+  EXPECT_EQ(3u, address_space.size());
+}
+
+TEST(SortedVectorAddressSpaceTest, InsertAndFind) {
+  typedef AddressSpace<size_t, size_t, void*, SortedVectorRangeMapPolicy>
+      VectorAddressSpace;
+  typedef VectorAddressSpace::Range Range;
+  VectorAddressSpace address_space;
+  void* item = "Something to point at";
+
+  // Insert out of order, and make sure the ranges end up sorted.
+  EXPECT_TRUE(address_space.Insert(Range(120, 10), item));
+  EXPECT_TRUE(address_space.Insert(Range(100, 10), item));
+  EXPECT_TRUE(address_space.Insert(Range(110, 5), item));
+  EXPECT_FALSE(address_space.Insert(Range(105, 10), item));
+  EXPECT_FALSE(address_space.Insert(Range(10, 0), item));
+  ASSERT_EQ(3u, address_space.size());
+  VectorAddressSpace::const_iterator it = address_space.begin();
+  EXPECT_EQ(Range(100, 10), it->first);
+  EXPECT_EQ(Range(110, 5), (++it)->first);
+  EXPECT_EQ(Range(120, 10), (++it)->first);
+
+  EXPECT_TRUE(address_space.Push(Range(130, 10), item));
+  EXPECT_FALSE(address_space.Push(Range(135, 10), item));
+
+  EXPECT_TRUE(address_space.Intersects(95, 10));
+  EXPECT_FALSE(address_space.Intersects(115, 5));
+  EXPECT_TRUE(address_space.Contains(101, 8));
+  EXPECT_FALSE(address_space.Contains(110, 6));
+  EXPECT_TRUE(address_space.ContainsExactly(130, 10));
+
+  VectorAddressSpace::RangeMapConstIter found =
+      address_space.FindContaining(Range(122, 4));
+  ASSERT_TRUE(found != address_space.end());
+  EXPECT_EQ(Range(120, 10), found->first);
+
+  VectorAddressSpace::RangeMapIterPair its =
+      address_space.FindIntersecting(Range(105, 20));
+  EXPECT_EQ(3, std::distance(its.first, its.second));
+
+  // Subsuming and merging insertions should behave as with the default
+  // backend.
+  EXPECT_TRUE(address_space.SubsumeInsert(Range(100, 15), item));
+  EXPECT_EQ(3u, address_space.size());
+  address_space.MergeInsert(Range(112, 10), item);
+  EXPECT_EQ(2u, address_space.size());
+  EXPECT_TRUE(address_space.ContainsExactly(100, 30));
+
+  EXPECT_TRUE(address_space.Remove(Range(100, 30)));
+  EXPECT_FALSE(address_space.Remove(Range(100, 30)));
+  EXPECT_EQ(1u, address_space.size());
+}
+
 TEST(AddressRangeMapTest, IsSimple) {
   IntegerRangeMap map;
   EXPECT_FALSE(map.IsSimple());
@@ -0,0 +1,104 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/core/arena.h"
+
+#include <string.h>
+
+#include "syzygy/common/align.h"
+
+namespace core {
+
+const size_t Arena::kDefaultSlabSize;
+const size_t Arena::kAllocationGranularity;
+const size_t Arena::kMaxSmallAllocationSize;
+
+Arena::Arena(size_t slab_size)
+    : slab_size_(slab_size),
+      cursor_(NULL),
+      slab_end_(NULL),
+      allocation_count_(0),
+      recycled_count_(0) {
+  DCHECK_LE(kMaxSmallAllocationSize, slab_size);
+  ::memset(free_lists_, 0, sizeof(free_lists_));
+}
+
+Arena::~Arena() {
+  for (size_t i = 0; i < slabs_.size(); ++i)
+    delete [] slabs_[i];
+}
+
+void* Arena::Allocate(size_t size) {
+  ++allocation_count_;
+
+  // Big allocations go straight to the heap.
+  if (size > kMaxSmallAllocationSize)
+    return ::operator new(size);
+
+  // Zero-sized allocations still need to return a unique pointer.
+  if (size == 0)
+    size = 1;
+
+  // Try to recycle a freed allocation of the same size class.
+  size_t size_class = SizeClass(size);
+  FreeEntry* entry = free_lists_[size_class];
+  if (entry != NULL) {
+    free_lists_[size_class] = entry->next;
+    ++recycled_count_;
+    return entry;
+  }
+
+  // Otherwise carve the allocation out of the current slab.
+  size_t rounded_size = (size_class + 1) * kAllocationGranularity;
+  if (cursor_ == NULL ||
+      static_cast<size_t>(slab_end_ - cursor_) < rounded_size) {
+    AllocateSlab();
+  }
+
+  void* ptr = cursor_;
+  cursor_ += rounded_size;
+  return ptr;
+}
+
+void Arena::Free(void* ptr, size_t size) {
+  if (ptr == NULL)
+    return;
+
+  if (size > kMaxSmallAllocationSize) {
+    ::operator delete(ptr);
+    return;
+  }
+
+  if (size == 0)
+    size = 1;
+
+  // Push the allocation on the free list of its size class. The slab memory
+  // itself is only released when the arena is destroyed.
+  size_t size_class = SizeClass(size);
+  FreeEntry* entry = reinterpret_cast<FreeEntry*>(ptr);
+  entry->next = free_lists_[size_class];
+  free_lists_[size_class] = entry;
+}
+
+void Arena::AllocateSlab() {
+  // The remainder of the current slab, if any, is simply abandoned. It is
+  // smaller than kMaxSmallAllocationSize, so this wastes very little.
+  uint8_t* slab = new uint8_t[slab_size_];
+  DCHECK(common::IsAligned(slab, kAllocationGranularity));
+  slabs_.push_back(slab);
+  cursor_ = slab;
+  slab_end_ = slab + slab_size_;
+}
+
+}  // namespace core
@@ -0,0 +1,199 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares Arena, a slab allocator for large numbers of small objects, and
+// ArenaAllocator, an STL-compatible allocator that draws from an Arena.
+//
+// Small allocations are carved out of large slabs and recycled through
+// per-size-class free lists. Freeing an individual allocation is therefore a
+// couple of pointer writes, and destroying the arena releases all of its
+// memory in one shot, no matter how many objects were allocated from it.
+// Allocations bigger than kMaxSmallAllocationSize go straight to the heap.
+//
+// An Arena is not thread-safe.
+
+#ifndef SYZYGY_CORE_ARENA_H_
+#define SYZYGY_CORE_ARENA_H_
+
+#include <stdint.h>
+
+#include <memory>
+#include <vector>
+
+#include "base/logging.h"
+#include "base/macros.h"
+
+namespace core {
+
+class Arena {
+ public:
+  // The default size of the slabs from which small allocations are served.
+  static const size_t kDefaultSlabSize = 1024 * 1024;
+  // The granularity, and thus alignment, of small allocations.
+  static const size_t kAllocationGranularity = 8;
+  // The biggest allocation that is served from the slabs.
+  static const size_t kMaxSmallAllocationSize = 256;
+
+  // Constructor.
+  // @param slab_size the size of the slabs to allocate. Must be at least
+  //     kMaxSmallAllocationSize.
+  explicit Arena(size_t slab_size = kDefaultSlabSize);
+
+  // Destructor. Releases all slabs. Allocations bigger than
+  // kMaxSmallAllocationSize are not tracked, and must have been freed.
+  ~Arena();
+
+  // Allocates @p size bytes. The returned memory is aligned to
+  // kAllocationGranularity.
+  // @param size the number of bytes to allocate.
+  // @returns a pointer to the allocated memory.
+  void* Allocate(size_t size);
+
+  // Frees memory previously returned by Allocate.
+  // @param ptr the memory to free.
+  // @param size the size that was passed to Allocate.
+  void Free(void* ptr, size_t size);
+
+  // @name Statistics.
+  // @{
+  // @returns the total number of calls to Allocate.
+  size_t allocation_count() const { return allocation_count_; }
+  // @returns the number of allocations that were served from a free list.
+  size_t recycled_count() const { return recycled_count_; }
+  // @returns the number of slabs that have been allocated from the heap.
+  size_t slab_count() const { return slabs_.size(); }
+  // @returns the size of the slabs used by this arena.
+  size_t slab_size() const { return slab_size_; }
+  // @}
+
+ private:
+  // An entry in a free list. This overlays freed allocations.
+  struct FreeEntry {
+    FreeEntry* next;
+  };
+
+  // The number of small allocation size classes.
+  static const size_t kSizeClassCount =
+      kMaxSmallAllocationSize / kAllocationGranularity;
+
+  // @returns the size class of an allocation of @p size bytes.
+  static size_t SizeClass(size_t size) {
+    DCHECK_LT(0u, size);
+    DCHECK_GE(kMaxSmallAllocationSize, size);
+    return (size - 1) / kAllocationGranularity;
+  }
+
+  // Allocates a new slab and makes it the current one.
+  void AllocateSlab();
+
+  // The size of the slabs.
+  size_t slab_size_;
+
+  // All the slabs we've allocated so far.
+  std::vector<uint8_t*> slabs_;
+
+  // The unused portion of the current slab.
+  uint8_t* cursor_;
+  uint8_t* slab_end_;
+
+  // The free lists, by size class.
+  FreeEntry* free_lists_[kSizeClassCount];
+
+  // Statistics.
+  size_t allocation_count_;
+  size_t recycled_count_;
+
+  DISALLOW_COPY_AND_ASSIGN(Arena);
+};
+
+// An STL-compatible allocator that uses an Arena under the hood. An allocator
+// with a NULL arena falls back to the heap, which allows containers using this
+// allocator to be used interchangeably whether or not an arena is available.
+// @tparam T The type of object that is returned by the allocator.
+template <typename T>
+class ArenaAllocator : public std::allocator<T> {
+ public:
+  typedef size_t size_type;
+  typedef T* pointer;
+  typedef const T* const_pointer;
+
+  // Functor that converts this allocator to an equivalent one for another
+  // type.
+  // @tparam T2 The type being casted to.
+  template <typename T2>
+  struct rebind {
+    typedef ArenaAllocator<T2> other;
+  };
+
+  // Default constructor. Allocations are served from the heap.
+  ArenaAllocator() : arena_(NULL) {}
+
+  // Constructor with an arena.
+  // @param arena The arena that will be used to make the allocations. May be
+  //     NULL, in which case allocations are served from the heap.
+  explicit ArenaAllocator(Arena* arena) : arena_(arena) {}
+
+  // Copy constructor. Necessary for STL compatibility.
+  ArenaAllocator(const ArenaAllocator& other) : arena_(other.arena_) {}
+
+  // Copy constructor from another type. Necessary for STL compatibility.
+  // This simply copies the arena.
+  // @tparam T2 The type of the other allocator.
+  // @param other The allocator being copied.
+  template <typename T2>
+  ArenaAllocator(const ArenaAllocator<T2>& other)
+      : arena_(other.arena()) {}
+
+  // Allocates @p count objects of type T.
+  // @param count The number of objects to allocate.
+  // @param hint A hint as to where the objects should be allocated.
+  // @returns a pointer to the allocated objects.
+  pointer allocate(size_type count, const void* hint = NULL) {
+    if (arena_ == NULL)
+      return std::allocator<T>::allocate(count, hint);
+    return reinterpret_cast<pointer>(arena_->Allocate(count * sizeof(T)));
+  }
+
+  // Deallocates a group of @p n objects.
+  // @param objects A pointer to the allocated objects. This must have
+  //     previously been returned a call to 'allocate'.
+  // @param count The number of objects in the allocation.
+  void deallocate(pointer objects, size_type count) {
+    if (arena_ == NULL)
+      return std::allocator<T>::deallocate(objects, count);
+    arena_->Free(objects, count * sizeof(T));
+  }
+
+  // @returns the Arena used by this allocator.
+  Arena* arena() const { return arena_; }
+
+  // Allocators are interchangeable if they use the same arena.
+  // @{
+  template <typename T2>
+  bool operator==(const ArenaAllocator<T2>& other) const {
+    return arena_ == other.arena();
+  }
+  template <typename T2>
+  bool operator!=(const ArenaAllocator<T2>& other) const {
+    return arena_ != other.arena();
+  }
+  // @}
+
+ protected:
+  Arena* arena_;
+};
+
+}  // namespace core
+
+#endif  // SYZYGY_CORE_ARENA_H_
@@ -0,0 +1,96 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/core/arena.h"
+
+#include <map>
+#include <set>
+
+#include "gtest/gtest.h"
+#include "syzygy/common/align.h"
+
+namespace core {
+
+TEST(ArenaTest, AllocateAndFree) {
+  Arena arena(4096);
+  EXPECT_EQ(0u, arena.slab_count());
+
+  void* ptr1 = arena.Allocate(10);
+  void* ptr2 = arena.Allocate(10);
+  ASSERT_TRUE(ptr1 != NULL);
+  ASSERT_TRUE(ptr2 != NULL);
+  EXPECT_NE(ptr1, ptr2);
+  EXPECT_TRUE(common::IsAligned(ptr1, Arena::kAllocationGranularity));
+  EXPECT_TRUE(common::IsAligned(ptr2, Arena::kAllocationGranularity));
+  EXPECT_EQ(1u, arena.slab_count());
+
+  // Freed allocations should be recycled for allocations of the same size
+  // class.
+  arena.Free(ptr1, 10);
+  void* ptr3 = arena.Allocate(12);
+  EXPECT_EQ(ptr1, ptr3);
+  EXPECT_EQ(1u, arena.recycled_count());
+
+  // But not for allocations of another size class.
+  arena.Free(ptr2, 10);
+  void* ptr4 = arena.Allocate(32);
+  EXPECT_NE(ptr2, ptr4);
+
+  // Big allocations go to the heap.
+  void* big = arena.Allocate(Arena::kMaxSmallAllocationSize + 1);
+  ASSERT_TRUE(big != NULL);
+  arena.Free(big, Arena::kMaxSmallAllocationSize + 1);
+
+  arena.Free(ptr3, 12);
+  arena.Free(ptr4, 32);
+  EXPECT_EQ(5u, arena.allocation_count());
+}
+
+TEST(ArenaTest, ManySlabs) {
+  Arena arena(Arena::kMaxSmallAllocationSize);
+  for (size_t i = 0; i < 100; ++i)
+    ASSERT_TRUE(arena.Allocate(Arena::kMaxSmallAllocationSize) != NULL);
+  EXPECT_EQ(100u, arena.slab_count());
+}
+
+TEST(ArenaAllocatorTest, Containers) {
+  Arena arena;
+
+  typedef std::map<int, int, std::less<int>,
+                   ArenaAllocator<std::pair<const int, int>>> ArenaMap;
+  ArenaMap::allocator_type allocator(&arena);
+  ArenaMap map(allocator);
+  for (int i = 0; i < 1000; ++i)
+    map.insert(std::make_pair(i, i));
+  EXPECT_EQ(1000u, map.size());
+  EXPECT_LE(1000u, arena.allocation_count());
+
+  // A copy should share the arena.
+  ArenaMap copy(map);
+  EXPECT_TRUE(copy.get_allocator() == map.get_allocator());
+  EXPECT_TRUE(copy == map);
+
+  map.clear();
+  copy.clear();
+
+  // A container with no arena falls back to the heap.
+  size_t allocation_count = arena.allocation_count();
+  std::set<int, std::less<int>, ArenaAllocator<int>> set;
+  for (int i = 0; i < 1000; ++i)
+    set.insert(i);
+  EXPECT_EQ(allocation_count, arena.allocation_count());
+  EXPECT_TRUE(set.get_allocator().arena() == NULL);
+}
+
+}  // namespace core
@@ -0,0 +1,603 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/core/chunked_compression.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <memory>
+
+#include "base/logging.h"
+#include "base/threading/simple_thread.h"
+#include "third_party/zlib/zlib.h"
+
+namespace core {
+
+const uint32_t kChunkedCompressionMagic = 0x4B435A53;  // 'SZCK'.
+const size_t kDefaultChunkSize = 256 * 1024;
+
+namespace {
+
+// The size of the fixed part of the container header.
+const size_t kHeaderSize = 4 * sizeof(uint32_t) + sizeof(uint8_t);
+
+const char* kChunkCodecNames[] = { "none", "zlib", "lz" };
+static_assert(arraysize(kChunkCodecNames) == kChunkCodecMax,
+              "Codec names out of sync with ChunkCodec.");
+
+// @name Parameters of the LZ codec. These are those of the LZ4 block format,
+// which requires the last 5 bytes of a block to be literals, and the last
+// match to start at least 12 bytes before the end of the block.
+// @{
+const size_t kLzMinMatch = 4;
+const size_t kLzHashLog = 14;
+const size_t kLzLastLiterals = 5;
+const size_t kLzMatchLimit = 12;
+const size_t kLzMaxOffset = 0xFFFF;
+// @}
+
+// The largest ratio of uncompressed to compressed size that each codec can
+// achieve. These bound the size of the data that a container may claim to
+// hold, so that a malformed header can't cause a huge allocation.
+// @{
+const uint64_t kZlibMaxRatio = 1032;
+const uint64_t kLzMaxRatio = 255;
+// @}
+
+// @returns the largest ratio of uncompressed to compressed size that @p codec
+//     can achieve.
+uint64_t MaxCompressionRatio(ChunkCodec codec) {
+  switch (codec) {
+    case kChunkCodecZlib:
+      return kZlibMaxRatio;
+    case kChunkCodecLz:
+      return kLzMaxRatio;
+    default:
+      return 1;
+  }
+}
+
+uint32_t ReadUint32(const uint8_t* data) {
+  uint32_t value = 0;
+  ::memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+void AppendUint32(uint32_t value, std::vector<uint8_t>* buffer) {
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+  buffer->insert(buffer->end(), bytes, bytes + sizeof(value));
+}
+
+// Appends a length using the LZ4 length encoding: a run of 255 bytes
+// followed by the remainder.
+void AppendLzLength(size_t length, std::vector<uint8_t>* buffer) {
+  for (; length >= 255; length -= 255)
+    buffer->push_back(255);
+  buffer->push_back(static_cast<uint8_t>(length));
+}
+
+// Appends an LZ4 sequence: a run of literals, optionally followed by a match.
+void AppendLzSequence(const uint8_t* literals,
+                      size_t literal_length,
+                      size_t offset,
+                      size_t match_length,
+                      std::vector<uint8_t>* buffer) {
+  uint8_t token = static_cast<uint8_t>(std::min<size_t>(literal_length, 15)
+                                       << 4);
+  if (match_length != 0) {
+    DCHECK_LE(kLzMinMatch, match_length);
+    token |= static_cast<uint8_t>(
+        std::min<size_t>(match_length - kLzMinMatch, 15));
+  }
+  buffer->push_back(token);
+
+  if (literal_length >= 15)
+    AppendLzLength(literal_length - 15, buffer);
+  buffer->insert(buffer->end(), literals, literals + literal_length);
+
+  if (match_length == 0)
+    return;
+
+  DCHECK_LT(0u, offset);
+  DCHECK_GE(kLzMaxOffset, offset);
+  buffer->push_back(static_cast<uint8_t>(offset));
+  buffer->push_back(static_cast<uint8_t>(offset >> 8));
+  if (match_length - kLzMinMatch >= 15)
+    AppendLzLength(match_length - kLzMinMatch - 15, buffer);
+}
+
+// Compresses a buffer to the LZ4 block format. This is a greedy compressor
+// with a single hash table, which favours speed over ratio.
+void LzCompress(const uint8_t* data,
+                size_t size,
+                std::vector<uint8_t>* compressed) {
+  DCHECK(compressed != NULL);
+
+  size_t anchor = 0;
+  if (size > kLzMatchLimit) {
+    std::vector<uint32_t> table(1 << kLzHashLog, 0);
+    size_t limit = size - kLzMatchLimit;
+    size_t match_end_limit = size - kLzLastLiterals;
+
+    // Position 0 can't be a match candidate as it is also the value of empty
+    // hash table entries, so start at 1.
+    size_t pos = 1;
+    while (pos < limit) {
+      uint32_t sequence = ReadUint32(data + pos);
+      uint32_t hash = (sequence * 2654435761U) >> (32 - kLzHashLog);
+      size_t candidate = table[hash];
+      table[hash] = static_cast<uint32_t>(pos);
+
+      if (candidate == 0 || pos - candidate > kLzMaxOffset ||
+          ReadUint32(data + candidate) != sequence) {
+        ++pos;
+        continue;
+      }
+
+      // Extend the match forward.
+      size_t match_end = pos + kLzMinMatch;
+      size_t source = candidate + kLzMinMatch;
+      while (match_end < match_end_limit && data[match_end] == data[source]) {
+        ++match_end;
+        ++source;
+      }
+
+      AppendLzSequence(data + anchor, pos - anchor, pos - candidate,
+                       match_end - pos, compressed);
+      pos = match_end;
+      anchor = pos;
+    }
+  }
+
+  // The last sequence only contains literals.
+  AppendLzSequence(data + anchor, size - anchor, 0, 0, compressed);
+}
+
+// Reads an LZ4 length continuation.
+bool ReadLzLength(const uint8_t** input,
+                  const uint8_t* input_end,
+                  size_t* length) {
+  uint8_t byte = 0;
+  do {
+    if (*input >= input_end)
+      return false;
+    byte = *(*input)++;
+    *length += byte;
+  } while (byte == 255);
+  return true;
+}
+
+// Decompresses a block in the LZ4 block format.
+bool LzDecompress(const uint8_t* data,
+                  size_t size,
+                  uint8_t* buffer,
+                  size_t buffer_size) {
+  const uint8_t* input = data;
+  const uint8_t* input_end = data + size;
+  uint8_t* output = buffer;
+  uint8_t* output_end = buffer + buffer_size;
+
+  while (input < input_end) {
+    uint8_t token = *input++;
+
+    size_t literal_length = token >> 4;
+    if (literal_length == 15 &&
+        !ReadLzLength(&input, input_end, &literal_length)) {
+      return false;
+    }
+    if (literal_length > static_cast<size_t>(input_end - input) ||
+        literal_length > static_cast<size_t>(output_end - output)) {
+      return false;
+    }
+    ::memcpy(output, input, literal_length);
+    input += literal_length;
+    output += literal_length;
+
+    // The last sequence has no match.
+    if (input == input_end)
+      break;
+
+    if (input_end - input < 2)
+      return false;
+    size_t offset = input[0] | (input[1] << 8);
+    input += 2;
+    if (offset == 0 || offset > static_cast<size_t>(output - buffer))
+      return false;
+
+    size_t match_length = token & 15;
+    if (match_length == 15 &&
+        !ReadLzLength(&input, input_end, &match_length)) {
+      return false;
+    }
+    match_length += kLzMinMatch;
+    if (match_length > static_cast<size_t>(output_end - output))
+      return false;
+
+    // The match may overlap the output, so this must be a forward byte copy.
+    const uint8_t* source = output - offset;
+    for (size_t i = 0; i < match_length; ++i)
+      output[i] = source[i];
+    output += match_length;
+  }
+
+  return output == output_end;
+}
+
+bool ZlibCompress(const uint8_t* data,
+                  size_t size,
+                  std::vector<uint8_t>* compressed) {
+  DCHECK(compressed != NULL);
+
+  uLongf compressed_size = compressBound(static_cast<uLong>(size));
+  compressed->resize(compressed_size);
+  int ret = compress2(compressed->data(), &compressed_size, data,
+                      static_cast<uLong>(size), Z_BEST_COMPRESSION);
+  if (ret != Z_OK) {
+    LOG(ERROR) << "compress2 returned " << ret << ".";
+    return false;
+  }
+  compressed->resize(compressed_size);
+
+  return true;
+}
+
+bool ZlibDecompress(const uint8_t* data,
+                    size_t size,
+                    uint8_t* buffer,
+                    size_t buffer_size) {
+  uLongf uncompressed_size = static_cast<uLongf>(buffer_size);
+  int ret = uncompress(buffer, &uncompressed_size, data,
+                       static_cast<uLong>(size));
+  if (ret != Z_OK || uncompressed_size != buffer_size) {
+    LOG(ERROR) << "uncompress returned " << ret << ".";
+    return false;
+  }
+  return true;
+}
+
+// A unit of work compressing or decompressing a single chunk.
+class ChunkWorkItem : public base::DelegateSimpleThread::Delegate {
+ public:
+  ChunkWorkItem() : succeeded_(false) {}
+
+  bool succeeded() const { return succeeded_; }
+
+ protected:
+  bool succeeded_;
+};
+
+class CompressChunkWorkItem : public ChunkWorkItem {
+ public:
+  CompressChunkWorkItem(const uint8_t* data, size_t size, ChunkCodec codec)
+      : data_(data), size_(size), codec_(codec) {
+  }
+
+  // base::DelegateSimpleThread::Delegate implementation.
+  void Run() override {
+    switch (codec_) {
+      case kChunkCodecNone:
+        succeeded_ = true;
+        break;
+      case kChunkCodecZlib:
+        succeeded_ = ZlibCompress(data_, size_, &compressed_);
+        break;
+      case kChunkCodecLz:
+        LzCompress(data_, size_, &compressed_);
+        succeeded_ = true;
+        break;
+      default:
+        NOTREACHED();
+        break;
+    }
+
+    // Store chunks that don't compress as is.
+    if (succeeded_ && (codec_ == kChunkCodecNone ||
+                       compressed_.size() >= size_)) {
+      compressed_.assign(data_, data_ + size_);
+    }
+  }
+
+  const std::vector<uint8_t>& compressed() const { return compressed_; }
+
+ private:
+  const uint8_t* data_;
+  size_t size_;
+  ChunkCodec codec_;
+  std::vector<uint8_t> compressed_;
+};
+
+class DecompressChunkWorkItem : public ChunkWorkItem {
+ public:
+  DecompressChunkWorkItem(const ChunkedDecompressor* decompressor,
+                          size_t index,
+                          uint8_t* buffer)
+      : decompressor_(decompressor), index_(index), buffer_(buffer) {
+  }
+
+  // base::DelegateSimpleThread::Delegate implementation.
+  void Run() override {
+    succeeded_ = decompressor_->DecompressChunk(index_, buffer_);
+  }
+
+ private:
+  const ChunkedDecompressor* decompressor_;
+  size_t index_;
+  uint8_t* buffer_;
+};
+
+// Runs a set of work items, on a pool of @p thread_count threads if there is
+// more than one.
+template <typename WorkItem>
+bool RunWorkItems(const char* name,
+                  size_t thread_count,
+                  std::vector<std::unique_ptr<WorkItem>>* items) {
+  DCHECK(items != NULL);
+
+  if (thread_count <= 1 || items->size() <= 1) {
+    for (size_t i = 0; i < items->size(); ++i)
+      (*items)[i]->Run();
+  } else {
+    base::DelegateSimpleThreadPool pool(
+        name, static_cast<int>(std::min(thread_count, items->size())));
+    pool.Start();
+    for (size_t i = 0; i < items->size(); ++i)
+      pool.AddWork((*items)[i].get());
+    pool.JoinAll();
+  }
+
+  for (size_t i = 0; i < items->size(); ++i) {
+    if (!(*items)[i]->succeeded())
+      return false;
+  }
+
+  return true;
+}
+
+}  // namespace
+
+const char* ChunkCodecName(ChunkCodec codec) {
+  DCHECK_GT(kChunkCodecMax, codec);
+  return kChunkCodecNames[codec];
+}
+
+bool ParseChunkCodec(const std::string& name, ChunkCodec* codec) {
+  DCHECK(codec != NULL);
+  for (size_t i = 0; i < arraysize(kChunkCodecNames); ++i) {
+    if (name == kChunkCodecNames[i]) {
+      *codec = static_cast<ChunkCodec>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool CompressChunked(const uint8_t* data,
+                     size_t size,
+                     ChunkCodec codec,
+                     size_t chunk_size,
+                     size_t thread_count,
+                     std::vector<uint8_t>* container) {
+  DCHECK(data != NULL || size == 0);
+  DCHECK_GT(kChunkCodecMax, codec);
+  DCHECK_LT(0u, chunk_size);
+  DCHECK(container != NULL);
+
+  size_t chunk_count = (size + chunk_size - 1) / chunk_size;
+  std::vector<std::unique_ptr<CompressChunkWorkItem>> items;
+  items.reserve(chunk_count);
+  for (size_t offset = 0; offset < size; offset += chunk_size) {
+    items.push_back(std::unique_ptr<CompressChunkWorkItem>(
+        new CompressChunkWorkItem(data + offset,
+                                  std::min(chunk_size, size - offset),
+                                  codec)));
+  }
+
+  if (!RunWorkItems("ChunkedCompression", thread_count, &items)) {
+    LOG(ERROR) << "Failed to compress chunks.";
+    return false;
+  }
+
+  AppendUint32(kChunkedCompressionMagic, container);
+  container->push_back(static_cast<uint8_t>(codec));
+  AppendUint32(static_cast<uint32_t>(chunk_size), container);
+  AppendUint32(static_cast<uint32_t>(size), container);
+  AppendUint32(static_cast<uint32_t>(chunk_count), container);
+  for (size_t i = 0; i < items.size(); ++i)
+    AppendUint32(static_cast<uint32_t>(items[i]->compressed().size()),
+                 container);
+  for (size_t i = 0; i < items.size(); ++i) {
+    container->insert(container->end(), items[i]->compressed().begin(),
+                      items[i]->compressed().end());
+  }
+
+  return true;
+}
+
+ChunkedDecompressor::ChunkedDecompressor()
+    : data_(NULL),
+      size_(0),
+      codec_(kChunkCodecNone),
+      chunk_size_(0),
+      uncompressed_size_(0),
+      chunk_count_(0) {
+}
+
+bool ChunkedDecompressor::Init(const uint8_t* data, size_t size) {
+  DCHECK(data != NULL);
+  DCHECK(data_ == NULL);
+
+  if (size < kHeaderSize || ReadUint32(data) != kChunkedCompressionMagic) {
+    LOG(ERROR) << "Not a chunked compression container.";
+    return false;
+  }
+
+  const uint8_t* header = data + sizeof(uint32_t);
+  uint8_t codec = *header++;
+  size_t chunk_size = ReadUint32(header);
+  size_t uncompressed_size = ReadUint32(header + sizeof(uint32_t));
+  size_t chunk_count = ReadUint32(header + 2 * sizeof(uint32_t));
+  if (codec >= kChunkCodecMax) {
+    LOG(ERROR) << "Unknown chunk codec " << static_cast<int>(codec) << ".";
+    return false;
+  }
+  if (chunk_size == 0 ||
+      chunk_count != uncompressed_size / chunk_size +
+          (uncompressed_size % chunk_size != 0 ? 1 : 0)) {
+    LOG(ERROR) << "Invalid chunked compression container header.";
+    return false;
+  }
+  if (chunk_count > (size - kHeaderSize) / sizeof(uint32_t)) {
+    LOG(ERROR) << "Chunked compression container index is truncated.";
+    return false;
+  }
+
+  // Compute the offsets of the chunks from their sizes.
+  std::vector<size_t> chunk_offsets(chunk_count + 1);
+  const uint8_t* index = data + kHeaderSize;
+  chunk_offsets[0] = kHeaderSize + chunk_count * sizeof(uint32_t);
+  for (size_t i = 0; i < chunk_count; ++i) {
+    size_t compressed_size = ReadUint32(index + i * sizeof(uint32_t));
+    if (compressed_size > size - chunk_offsets[i]) {
+      LOG(ERROR) << "Chunked compression container is truncated.";
+      return false;
+    }
+    size_t chunk_uncompressed_size =
+        std::min(chunk_size, uncompressed_size - i * chunk_size);
+    if (chunk_uncompressed_size > compressed_size *
+            MaxCompressionRatio(static_cast<ChunkCodec>(codec))) {
+      LOG(ERROR) << "Invalid size for chunk " << i << " of chunked "
+                 << "compression container.";
+      return false;
+    }
+    chunk_offsets[i + 1] = chunk_offsets[i] + compressed_size;
+  }
+
+  data_ = data;
+  size_ = size;
+  codec_ = static_cast<ChunkCodec>(codec);
+  chunk_size_ = chunk_size;
+  uncompressed_size_ = uncompressed_size;
+  chunk_count_ = chunk_count;
+  chunk_offsets_.swap(chunk_offsets);
+
+  return true;
+}
+
+bool ChunkedDecompressor::Read(size_t offset,
+                               size_t length,
+                               uint8_t* buffer) const {
+  DCHECK(data_ != NULL);
+  DCHECK(buffer != NULL || length == 0);
+
+  if (offset > uncompressed_size_ || length > uncompressed_size_ - offset) {
+    LOG(ERROR) << "Read past the end of the chunked compression container.";
+    return false;
+  }
+
+  // Chunks entirely covered by the range are decompressed directly into the
+  // buffer, the others are decompressed into a temporary buffer.
+  std::vector<uint8_t> chunk;
+  size_t end = offset + length;
+  while (offset < end) {
+    size_t index = offset / chunk_size_;
+    size_t chunk_start = index * chunk_size_;
+    size_t chunk_length = ChunkUncompressedSize(index);
+    size_t copy_length = std::min(end, chunk_start + chunk_length) - offset;
+
+    if (offset == chunk_start && copy_length == chunk_length) {
+      if (!DecompressChunk(index, buffer))
+        return false;
+    } else {
+      chunk.resize(chunk_length);
+      if (!DecompressChunk(index, chunk.data()))
+        return false;
+      ::memcpy(buffer, chunk.data() + offset - chunk_start, copy_length);
+    }
+
+    offset += copy_length;
+    buffer += copy_length;
+  }
+
+  return true;
+}
+
+bool ChunkedDecompressor::DecompressAll(size_t thread_count,
+                                        std::vector<uint8_t>* data) const {
+  DCHECK(data_ != NULL);
+  DCHECK(data != NULL);
+
+  data->resize(uncompressed_size_);
+
+  std::vector<std::unique_ptr<DecompressChunkWorkItem>> items;
+  items.reserve(chunk_count_);
+  for (size_t i = 0; i < chunk_count_; ++i) {
+    items.push_back(std::unique_ptr<DecompressChunkWorkItem>(
+        new DecompressChunkWorkItem(this, i,
+                                    data->data() + i * chunk_size_)));
+  }
+
+  if (!RunWorkItems("ChunkedDecompression", thread_count, &items)) {
+    LOG(ERROR) << "Failed to decompress chunks.";
+    return false;
+  }
+
+  return true;
+}
+
+bool ChunkedDecompressor::DecompressChunk(size_t index,
+                                          uint8_t* buffer) const {
+  DCHECK_GT(chunk_count_, index);
+  DCHECK(buffer != NULL);
+
+  const uint8_t* compressed = data_ + chunk_offsets_[index];
+  size_t compressed_size = chunk_offsets_[index + 1] - chunk_offsets_[index];
+  size_t uncompressed_size = ChunkUncompressedSize(index);
+
+  // Chunks that didn't compress are stored as is.
+  if (compressed_size == uncompressed_size) {
+    ::memcpy(buffer, compressed, uncompressed_size);
+    return true;
+  }
+
+  bool succeeded = false;
+  switch (codec_) {
+    case kChunkCodecZlib:
+      succeeded = ZlibDecompress(compressed, compressed_size, buffer,
+                                 uncompressed_size);
+      break;
+    case kChunkCodecLz:
+      succeeded = LzDecompress(compressed, compressed_size, buffer,
+                               uncompressed_size);
+      break;
+    default:
+      break;
+  }
+
+  if (!succeeded) {
+    LOG(ERROR) << "Failed to decompress chunk " << index << ".";
+    return false;
+  }
+
+  return true;
+}
+
+size_t ChunkedDecompressor::ChunkUncompressedSize(size_t index) const {
+  DCHECK_GT(chunk_count_, index);
+  if (index + 1 < chunk_count_)
+    return chunk_size_;
+  return uncompressed_size_ - index * chunk_size_;
+}
+
+}  // namespace core
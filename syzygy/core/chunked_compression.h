@@ -0,0 +1,159 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares a chunked compression container. The input is split into chunks
+// of a fixed size that are compressed independently of each other, and an
+// index of the compressed chunks is stored up front. This allows the chunks
+// to be decompressed in parallel, and arbitrary ranges of the input to be
+// decompressed without touching the rest of it.
+//
+// The container has the following layout. All integers are little-endian.
+//
+//   uint32_t magic;              // kChunkedCompressionMagic.
+//   uint8_t codec;               // A ChunkCodec value.
+//   uint32_t chunk_size;         // Size of uncompressed chunks.
+//   uint32_t uncompressed_size;  // Total size of the uncompressed data.
+//   uint32_t chunk_count;
+//   uint32_t compressed_sizes[chunk_count];
+//   uint8_t chunks[];            // The compressed chunks, back to back.
+//
+// Every chunk but the last decompresses to exactly chunk_size bytes. A chunk
+// whose compressed size is equal to its uncompressed size is stored as is;
+// this is used for chunks that don't compress.
+
+#ifndef SYZYGY_CORE_CHUNKED_COMPRESSION_H_
+#define SYZYGY_CORE_CHUNKED_COMPRESSION_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+
+namespace core {
+
+// The codecs that can be used to compress the chunks.
+enum ChunkCodec {
+  // No compression.
+  kChunkCodecNone,
+  // zlib, at its best compression level. This compresses best, but is the
+  // slowest to decompress.
+  kChunkCodecZlib,
+  // A byte-oriented LZ77 codec using the LZ4 block format. This compresses
+  // less well than zlib, but decompresses several times faster.
+  kChunkCodecLz,
+  // This must be last.
+  kChunkCodecMax
+};
+
+// The magic number identifying a chunked compression container.
+extern const uint32_t kChunkedCompressionMagic;
+
+// The default size of uncompressed chunks.
+extern const size_t kDefaultChunkSize;
+
+// @param codec a codec.
+// @returns the name of @p codec.
+const char* ChunkCodecName(ChunkCodec codec);
+
+// Parses the name of a codec, as returned by ChunkCodecName.
+// @param name the name of the codec.
+// @param codec receives the codec.
+// @returns true on success, false if @p name is not a valid codec name.
+bool ParseChunkCodec(const std::string& name, ChunkCodec* codec);
+
+// Compresses a buffer into a chunked compression container.
+// @param data the data to compress.
+// @param size the size of @p data, in bytes.
+// @param codec the codec to use.
+// @param chunk_size the size of the chunks to compress independently.
+// @param thread_count the number of threads to use. If this is 1 or less the
+//     chunks are compressed on the calling thread.
+// @param container the buffer to which the container is appended.
+// @returns true on success, false otherwise.
+bool CompressChunked(const uint8_t* data,
+                     size_t size,
+                     ChunkCodec codec,
+                     size_t chunk_size,
+                     size_t thread_count,
+                     std::vector<uint8_t>* container);
+
+// Provides random access to the uncompressed contents of a chunked
+// compression container.
+class ChunkedDecompressor {
+ public:
+  ChunkedDecompressor();
+
+  // Initializes the decompressor. This only parses the header and index of
+  // the container. The sizes of the chunks are validated against the ratio
+  // that their codec can achieve, which bounds the uncompressed size.
+  // @param data the container. This must outlive the decompressor.
+  // @param size the size of @p data, in bytes.
+  // @returns true on success, false if the container is malformed.
+  bool Init(const uint8_t* data, size_t size);
+
+  // Decompresses a range of the uncompressed data. Only the chunks that
+  // overlap the range are decompressed.
+  // @param offset the offset of the range in the uncompressed data.
+  // @param length the length of the range.
+  // @param buffer a buffer of at least @p length bytes to receive the data.
+  // @returns true on success, false otherwise.
+  bool Read(size_t offset, size_t length, uint8_t* buffer) const;
+
+  // Decompresses all of the data.
+  // @param thread_count the number of threads to use. If this is 1 or less
+  //     the chunks are decompressed on the calling thread.
+  // @param data receives the uncompressed data.
+  // @returns true on success, false otherwise.
+  bool DecompressAll(size_t thread_count, std::vector<uint8_t>* data) const;
+
+  // Decompresses a single chunk.
+  // @param index the index of the chunk.
+  // @param buffer a buffer large enough for the uncompressed chunk.
+  // @returns true on success, false otherwise.
+  bool DecompressChunk(size_t index, uint8_t* buffer) const;
+
+  // @name Accessors.
+  // @{
+  ChunkCodec codec() const { return codec_; }
+  size_t chunk_size() const { return chunk_size_; }
+  size_t chunk_count() const { return chunk_count_; }
+  size_t uncompressed_size() const { return uncompressed_size_; }
+  // @}
+
+ private:
+  // @returns the uncompressed size of the chunk at @p index.
+  size_t ChunkUncompressedSize(size_t index) const;
+
+  // The container.
+  const uint8_t* data_;
+  size_t size_;
+
+  // The header of the container.
+  ChunkCodec codec_;
+  size_t chunk_size_;
+  size_t uncompressed_size_;
+  size_t chunk_count_;
+
+  // The offsets of the compressed chunks in data_. This has an extra entry
+  // marking the end of the last chunk.
+  std::vector<size_t> chunk_offsets_;
+
+  DISALLOW_COPY_AND_ASSIGN(ChunkedDecompressor);
+};
+
+}  // namespace core
+
+#endif  // SYZYGY_CORE_CHUNKED_COMPRESSION_H_
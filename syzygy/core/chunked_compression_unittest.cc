@@ -0,0 +1,175 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/core/chunked_compression.h"
+
+#include "gtest/gtest.h"
+#include "syzygy/core/random_number_generator.h"
+
+namespace core {
+
+namespace {
+
+const size_t kChunkSize = 1024;
+
+class ChunkedCompressionTest : public ::testing::TestWithParam<ChunkCodec> {
+ public:
+  void SetUp() override {
+    // Generate data that is compressible, but not trivially so, and that
+    // isn't a whole number of chunks.
+    RandomNumberGenerator random(42);
+    data_.resize(10 * kChunkSize + 123);
+    for (size_t i = 0; i < data_.size(); ++i) {
+      if (i % 64 < 48)
+        data_[i] = static_cast<uint8_t>('a' + i % 13);
+      else
+        data_[i] = static_cast<uint8_t>(random(256));
+    }
+  }
+
+  std::vector<uint8_t> data_;
+  std::vector<uint8_t> container_;
+};
+
+}  // namespace
+
+TEST(ChunkCodecTest, Names) {
+  for (size_t i = 0; i < kChunkCodecMax; ++i) {
+    ChunkCodec codec = static_cast<ChunkCodec>(i);
+    ChunkCodec parsed = kChunkCodecMax;
+    EXPECT_TRUE(ParseChunkCodec(ChunkCodecName(codec), &parsed));
+    EXPECT_EQ(codec, parsed);
+  }
+
+  ChunkCodec parsed = kChunkCodecMax;
+  EXPECT_FALSE(ParseChunkCodec("foo", &parsed));
+}
+
+TEST_P(ChunkedCompressionTest, RoundTrip) {
+  ASSERT_TRUE(CompressChunked(data_.data(), data_.size(), GetParam(),
+                              kChunkSize, 1, &container_));
+
+  ChunkedDecompressor decompressor;
+  ASSERT_TRUE(decompressor.Init(container_.data(), container_.size()));
+  EXPECT_EQ(GetParam(), decompressor.codec());
+  EXPECT_EQ(kChunkSize, decompressor.chunk_size());
+  EXPECT_EQ(11u, decompressor.chunk_count());
+  EXPECT_EQ(data_.size(), decompressor.uncompressed_size());
+  if (GetParam() != kChunkCodecNone)
+    EXPECT_GT(data_.size(), container_.size());
+
+  std::vector<uint8_t> data;
+  ASSERT_TRUE(decompressor.DecompressAll(1, &data));
+  EXPECT_EQ(data_, data);
+}
+
+TEST_P(ChunkedCompressionTest, ParallelRoundTrip) {
+  ASSERT_TRUE(CompressChunked(data_.data(), data_.size(), GetParam(),
+                              kChunkSize, 4, &container_));
+
+  // The output shouldn't depend on the number of threads.
+  std::vector<uint8_t> serial_container;
+  ASSERT_TRUE(CompressChunked(data_.data(), data_.size(), GetParam(),
+                              kChunkSize, 1, &serial_container));
+  EXPECT_EQ(serial_container, container_);
+
+  ChunkedDecompressor decompressor;
+  ASSERT_TRUE(decompressor.Init(container_.data(), container_.size()));
+  std::vector<uint8_t> data;
+  ASSERT_TRUE(decompressor.DecompressAll(4, &data));
+  EXPECT_EQ(data_, data);
+}
+
+TEST_P(ChunkedCompressionTest, RandomAccess) {
+  ASSERT_TRUE(CompressChunked(data_.data(), data_.size(), GetParam(),
+                              kChunkSize, 1, &container_));
+  ChunkedDecompressor decompressor;
+  ASSERT_TRUE(decompressor.Init(container_.data(), container_.size()));
+
+  // A range within a chunk, a range spanning several chunks, a whole chunk
+  // and the tail of the data.
+  const size_t kRanges[][2] = {
+      { 10, 100 },
+      { kChunkSize - 10, 2 * kChunkSize + 20 },
+      { 3 * kChunkSize, kChunkSize },
+      { 10 * kChunkSize + 100, 23 },
+  };
+  for (size_t i = 0; i < arraysize(kRanges); ++i) {
+    std::vector<uint8_t> buffer(kRanges[i][1]);
+    ASSERT_TRUE(decompressor.Read(kRanges[i][0], kRanges[i][1],
+                                  buffer.data()));
+    EXPECT_TRUE(std::equal(buffer.begin(), buffer.end(),
+                           data_.begin() + kRanges[i][0]));
+  }
+
+  uint8_t byte = 0;
+  EXPECT_FALSE(decompressor.Read(data_.size(), 1, &byte));
+}
+
+TEST_P(ChunkedCompressionTest, IncompressibleData) {
+  RandomNumberGenerator random(17);
+  for (size_t i = 0; i < data_.size(); ++i)
+    data_[i] = static_cast<uint8_t>(random(256));
+
+  ASSERT_TRUE(CompressChunked(data_.data(), data_.size(), GetParam(),
+                              kChunkSize, 1, &container_));
+  ChunkedDecompressor decompressor;
+  ASSERT_TRUE(decompressor.Init(container_.data(), container_.size()));
+  std::vector<uint8_t> data;
+  ASSERT_TRUE(decompressor.DecompressAll(1, &data));
+  EXPECT_EQ(data_, data);
+}
+
+TEST_P(ChunkedCompressionTest, EmptyData) {
+  ASSERT_TRUE(CompressChunked(NULL, 0, GetParam(), kChunkSize, 1,
+                              &container_));
+  ChunkedDecompressor decompressor;
+  ASSERT_TRUE(decompressor.Init(container_.data(), container_.size()));
+  EXPECT_EQ(0u, decompressor.chunk_count());
+  std::vector<uint8_t> data;
+  ASSERT_TRUE(decompressor.DecompressAll(1, &data));
+  EXPECT_TRUE(data.empty());
+}
+
+TEST_P(ChunkedCompressionTest, FailsOnTruncatedContainer) {
+  ASSERT_TRUE(CompressChunked(data_.data(), data_.size(), GetParam(),
+                              kChunkSize, 1, &container_));
+  ChunkedDecompressor decompressor;
+  EXPECT_FALSE(decompressor.Init(container_.data(), container_.size() - 1));
+}
+
+TEST_P(ChunkedCompressionTest, FailsOnInflatedUncompressedSize) {
+  ASSERT_TRUE(CompressChunked(data_.data(), kChunkSize, GetParam(),
+                              kChunkSize, 1, &container_));
+
+  // Claim that the single chunk decompresses to 1GB. The chunk count is
+  // still consistent with the header.
+  const uint32_t kInflatedSize = 1024 * 1024 * 1024;
+  const size_t kChunkSizeOffset = sizeof(uint32_t) + sizeof(uint8_t);
+  ::memcpy(container_.data() + kChunkSizeOffset, &kInflatedSize,
+           sizeof(kInflatedSize));
+  ::memcpy(container_.data() + kChunkSizeOffset + sizeof(uint32_t),
+           &kInflatedSize, sizeof(kInflatedSize));
+
+  ChunkedDecompressor decompressor;
+  EXPECT_FALSE(decompressor.Init(container_.data(), container_.size()));
+}
+
+INSTANTIATE_TEST_CASE_P(Codecs,
+                        ChunkedCompressionTest,
+                        ::testing::Values(kChunkCodecNone,
+                                          kChunkCodecZlib,
+                                          kChunkCodecLz));
+
+}  // namespace core
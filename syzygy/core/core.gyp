@@ -30,6 +30,10 @@
         'address_space.cc',
         'address_space.h',
         'address_space_internal.h',
+        'arena.cc',
+        'arena.h',
+        'chunked_compression.cc',
+        'chunked_compression.h',
         'disassembler.cc',
         'disassembler.h',
         'disassembler_util.cc',
@@ -45,6 +49,7 @@
         'serialization.cc',
         'serialization.h',
         'serialization_impl.h',
+        'sorted_vector_map.h',
         'string_table.cc',
         'string_table.h',
         'zstream.cc',
@@ -80,6 +85,8 @@
         'address_filter_unittest.cc',
         'address_space_unittest.cc',
         'address_range_unittest.cc',
+        'arena_unittest.cc',
+        'chunked_compression_unittest.cc',
         'disassembler_test_code.asm',
         'disassembler_unittest.cc',
         'disassembler_util_unittest.cc',
@@ -89,6 +96,7 @@
         'json_file_writer_unittest.cc',
         'section_offset_address_unittest.cc',
         'serialization_unittest.cc',
+        'sorted_vector_map_unittest.cc',
         'string_table_unittest.cc',
         'unittest_util_unittest.cc',
         'zstream_unittest.cc',
@@ -0,0 +1,309 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares SortedVectorMap, an associative container with a std::map-like
+// interface that stores its elements in a single sorted contiguous array.
+// Lookups are binary searches over contiguous memory and iteration is a linear
+// scan, which makes it considerably faster and much more compact than a
+// std::map for collections that are built once and then mostly queried.
+//
+// The price to pay is that insertions and erasures in the middle of the
+// container are O(N), and that they invalidate all iterators. Appending
+// elements in increasing key order (using the end() hint to insert) is
+// amortized O(1).
+
+#ifndef SYZYGY_CORE_SORTED_VECTOR_MAP_H_
+#define SYZYGY_CORE_SORTED_VECTOR_MAP_H_
+
+#include <algorithm>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include "base/logging.h"
+
+namespace core {
+
+template <typename KeyType,
+          typename MappedType,
+          typename KeyCompare = std::less<KeyType>>
+class SortedVectorMap {
+ public:
+  typedef KeyType key_type;
+  typedef MappedType mapped_type;
+  // Unlike std::map the key is not const, as the elements need to be
+  // assignable in order to be stored in a vector. It is up to the user not to
+  // modify keys in a way that would break the ordering of the container.
+  typedef std::pair<KeyType, MappedType> value_type;
+  typedef KeyCompare key_compare;
+  typedef std::vector<value_type> Container;
+  typedef typename Container::iterator iterator;
+  typedef typename Container::const_iterator const_iterator;
+  typedef typename Container::reverse_iterator reverse_iterator;
+  typedef typename Container::const_reverse_iterator const_reverse_iterator;
+  typedef typename Container::size_type size_type;
+
+  SortedVectorMap() {}
+
+  // @name std::map-like accessors.
+  // @{
+  iterator begin() { return elements_.begin(); }
+  const_iterator begin() const { return elements_.begin(); }
+  iterator end() { return elements_.end(); }
+  const_iterator end() const { return elements_.end(); }
+  reverse_iterator rbegin() { return elements_.rbegin(); }
+  const_reverse_iterator rbegin() const { return elements_.rbegin(); }
+  reverse_iterator rend() { return elements_.rend(); }
+  const_reverse_iterator rend() const { return elements_.rend(); }
+  bool empty() const { return elements_.empty(); }
+  size_type size() const { return elements_.size(); }
+  void clear() { elements_.clear(); }
+  // @}
+
+  // @name Lookup functions, all of which are O(log N).
+  // @{
+  iterator lower_bound(const key_type& key);
+  const_iterator lower_bound(const key_type& key) const;
+  iterator upper_bound(const key_type& key);
+  const_iterator upper_bound(const key_type& key) const;
+  iterator find(const key_type& key);
+  const_iterator find(const key_type& key) const;
+  size_type count(const key_type& key) const {
+    return find(key) == end() ? 0 : 1;
+  }
+  // @}
+
+  // Inserts @p value unless an element with an equivalent key already exists.
+  // This invalidates all iterators.
+  // @param value the element to insert.
+  // @returns a pair made of an iterator to the inserted or existing element,
+  //     and a boolean that is true iff the insertion took place.
+  std::pair<iterator, bool> insert(const value_type& value);
+
+  // Inserts @p value using @p hint as a suggestion of where it belongs. If
+  // @p value belongs immediately before @p hint the insertion doesn't require
+  // a search. In particular, inserting at end() in increasing key order is
+  // amortized O(1). This invalidates all iterators.
+  // @param hint the suggested insertion position.
+  // @param value the element to insert.
+  // @returns an iterator to the inserted or existing element.
+  iterator insert(const_iterator hint, const value_type& value);
+
+  // Erases elements. This invalidates all iterators at or after the erased
+  // position.
+  // @returns an iterator to the element following the last erased one.
+  // @{
+  iterator erase(const_iterator it);
+  iterator erase(const_iterator first, const_iterator last);
+  // @}
+
+  // Erases the element with key @p key.
+  // @returns the number of erased elements.
+  size_type erase(const key_type& key);
+
+  // Bulk-builds this map from an arbitrary sequence of elements, replacing
+  // its current content. This is O(N log N) rather than the O(N^2) of
+  // individual insertions in arbitrary order. When equivalent keys are found
+  // only the first one encountered is kept.
+  // @param first the beginning of the sequence of elements.
+  // @param last the end of the sequence of elements.
+  template <typename InputIterator>
+  void Assign(InputIterator first, InputIterator last);
+
+  // @name Capacity management.
+  // @{
+  void reserve(size_type capacity) { elements_.reserve(capacity); }
+  size_type capacity() const { return elements_.capacity(); }
+  void shrink_to_fit() { Container(elements_).swap(elements_); }
+  // @}
+
+  void swap(SortedVectorMap& other) { elements_.swap(other.elements_); }
+
+  bool operator==(const SortedVectorMap& other) const {
+    return elements_ == other.elements_;
+  }
+  bool operator!=(const SortedVectorMap& other) const {
+    return elements_ != other.elements_;
+  }
+
+ private:
+  // A functor for comparing an element against a key, in both directions.
+  struct ValueKeyCompare {
+    bool operator()(const value_type& value, const key_type& key) const {
+      return key_compare()(value.first, key);
+    }
+    bool operator()(const key_type& key, const value_type& value) const {
+      return key_compare()(key, value.first);
+    }
+    bool operator()(const value_type& value1, const value_type& value2) const {
+      return key_compare()(value1.first, value2.first);
+    }
+  };
+
+  // Returns true if @p key1 and @p key2 are equivalent.
+  static bool Equivalent(const key_type& key1, const key_type& key2) {
+    return !key_compare()(key1, key2) && !key_compare()(key2, key1);
+  }
+
+  // The sorted elements.
+  Container elements_;
+};
+
+template <typename KeyType, typename MappedType, typename KeyCompare>
+typename SortedVectorMap<KeyType, MappedType, KeyCompare>::iterator
+SortedVectorMap<KeyType, MappedType, KeyCompare>::lower_bound(
+    const key_type& key) {
+  return std::lower_bound(elements_.begin(), elements_.end(), key,
+                          ValueKeyCompare());
+}
+
+template <typename KeyType, typename MappedType, typename KeyCompare>
+typename SortedVectorMap<KeyType, MappedType, KeyCompare>::const_iterator
+SortedVectorMap<KeyType, MappedType, KeyCompare>::lower_bound(
+    const key_type& key) const {
+  return std::lower_bound(elements_.begin(), elements_.end(), key,
+                          ValueKeyCompare());
+}
+
+template <typename KeyType, typename MappedType, typename KeyCompare>
+typename SortedVectorMap<KeyType, MappedType, KeyCompare>::iterator
+SortedVectorMap<KeyType, MappedType, KeyCompare>::upper_bound(
+    const key_type& key) {
+  return std::upper_bound(elements_.begin(), elements_.end(), key,
+                          ValueKeyCompare());
+}
+
+template <typename KeyType, typename MappedType, typename KeyCompare>
+typename SortedVectorMap<KeyType, MappedType, KeyCompare>::const_iterator
+SortedVectorMap<KeyType, MappedType, KeyCompare>::upper_bound(
+    const key_type& key) const {
+  return std::upper_bound(elements_.begin(), elements_.end(), key,
+                          ValueKeyCompare());
+}
+
+template <typename KeyType, typename MappedType, typename KeyCompare>
+typename SortedVectorMap<KeyType, MappedType, KeyCompare>::iterator
+SortedVectorMap<KeyType, MappedType, KeyCompare>::find(const key_type& key) {
+  iterator it = lower_bound(key);
+  if (it != elements_.end() && Equivalent(it->first, key))
+    return it;
+  return elements_.end();
+}
+
+template <typename KeyType, typename MappedType, typename KeyCompare>
+typename SortedVectorMap<KeyType, MappedType, KeyCompare>::const_iterator
+SortedVectorMap<KeyType, MappedType, KeyCompare>::find(
+    const key_type& key) const {
+  const_iterator it = lower_bound(key);
+  if (it != elements_.end() && Equivalent(it->first, key))
+    return it;
+  return elements_.end();
+}
+
+template <typename KeyType, typename MappedType, typename KeyCompare>
+std::pair<typename SortedVectorMap<KeyType, MappedType, KeyCompare>::iterator,
+          bool>
+SortedVectorMap<KeyType, MappedType, KeyCompare>::insert(
+    const value_type& value) {
+  // Fast path for in-order insertions.
+  if (elements_.empty() || key_compare()(elements_.back().first, value.first)) {
+    elements_.push_back(value);
+    return std::make_pair(elements_.end() - 1, true);
+  }
+
+  iterator it = lower_bound(value.first);
+  if (it != elements_.end() && Equivalent(it->first, value.first))
+    return std::make_pair(it, false);
+
+  it = elements_.insert(it, value);
+  return std::make_pair(it, true);
+}
+
+template <typename KeyType, typename MappedType, typename KeyCompare>
+typename SortedVectorMap<KeyType, MappedType, KeyCompare>::iterator
+SortedVectorMap<KeyType, MappedType, KeyCompare>::insert(
+    const_iterator hint, const value_type& value) {
+  // The hint is correct if the element before it is less than the value and
+  // the value is less than the hint.
+  bool hint_ok = true;
+  if (hint != elements_.end() && !key_compare()(value.first, hint->first))
+    hint_ok = false;
+  if (hint_ok && hint != elements_.begin()) {
+    const_iterator prev = hint - 1;
+    if (!key_compare()(prev->first, value.first))
+      hint_ok = false;
+  }
+
+  if (!hint_ok)
+    return insert(value).first;
+
+  size_t index = hint - elements_.begin();
+  if (hint == elements_.end()) {
+    elements_.push_back(value);
+  } else {
+    elements_.insert(elements_.begin() + index, value);
+  }
+  return elements_.begin() + index;
+}
+
+template <typename KeyType, typename MappedType, typename KeyCompare>
+typename SortedVectorMap<KeyType, MappedType, KeyCompare>::iterator
+SortedVectorMap<KeyType, MappedType, KeyCompare>::erase(const_iterator it) {
+  DCHECK(it != elements_.end());
+  size_t index = it - elements_.begin();
+  return elements_.erase(elements_.begin() + index);
+}
+
+template <typename KeyType, typename MappedType, typename KeyCompare>
+typename SortedVectorMap<KeyType, MappedType, KeyCompare>::iterator
+SortedVectorMap<KeyType, MappedType, KeyCompare>::erase(const_iterator first,
+                                                        const_iterator last) {
+  size_t first_index = first - elements_.begin();
+  size_t last_index = last - elements_.begin();
+  DCHECK_LE(first_index, last_index);
+  return elements_.erase(elements_.begin() + first_index,
+                         elements_.begin() + last_index);
+}
+
+template <typename KeyType, typename MappedType, typename KeyCompare>
+typename SortedVectorMap<KeyType, MappedType, KeyCompare>::size_type
+SortedVectorMap<KeyType, MappedType, KeyCompare>::erase(const key_type& key) {
+  iterator it = find(key);
+  if (it == elements_.end())
+    return 0;
+  elements_.erase(it);
+  return 1;
+}
+
+template <typename KeyType, typename MappedType, typename KeyCompare>
+template <typename InputIterator>
+void SortedVectorMap<KeyType, MappedType, KeyCompare>::Assign(
+    InputIterator first, InputIterator last) {
+  elements_.assign(first, last);
+
+  // A stable sort guarantees that the first of a run of equivalent keys is the
+  // one that survives the deduplication.
+  std::stable_sort(elements_.begin(), elements_.end(), ValueKeyCompare());
+
+  iterator new_end = std::unique(
+      elements_.begin(), elements_.end(),
+      [](const value_type& value1, const value_type& value2) {
+        return Equivalent(value1.first, value2.first);
+      });
+  elements_.erase(new_end, elements_.end());
+}
+
+}  // namespace core
+
+#endif  // SYZYGY_CORE_SORTED_VECTOR_MAP_H_
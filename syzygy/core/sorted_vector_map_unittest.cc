@@ -0,0 +1,133 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/core/sorted_vector_map.h"
+
+#include <map>
+
+#include "gtest/gtest.h"
+
+namespace core {
+
+namespace {
+
+typedef SortedVectorMap<int, int> IntMap;
+
+}  // namespace
+
+TEST(SortedVectorMapTest, InsertAndFind) {
+  IntMap map;
+  EXPECT_TRUE(map.empty());
+
+  EXPECT_TRUE(map.insert(std::make_pair(5, 50)).second);
+  EXPECT_TRUE(map.insert(std::make_pair(1, 10)).second);
+  EXPECT_TRUE(map.insert(std::make_pair(3, 30)).second);
+  EXPECT_FALSE(map.insert(std::make_pair(3, 31)).second);
+  EXPECT_EQ(3u, map.size());
+
+  // The elements should be sorted.
+  IntMap::const_iterator it = map.begin();
+  EXPECT_EQ(1, it->first);
+  EXPECT_EQ(3, (++it)->first);
+  EXPECT_EQ(5, (++it)->first);
+
+  // The first insertion should have won.
+  ASSERT_TRUE(map.find(3) != map.end());
+  EXPECT_EQ(30, map.find(3)->second);
+  EXPECT_TRUE(map.find(4) == map.end());
+  EXPECT_EQ(1u, map.count(5));
+  EXPECT_EQ(0u, map.count(6));
+
+  EXPECT_EQ(3, map.lower_bound(2)->first);
+  EXPECT_EQ(3, map.lower_bound(3)->first);
+  EXPECT_EQ(5, map.upper_bound(3)->first);
+  EXPECT_TRUE(map.lower_bound(6) == map.end());
+}
+
+TEST(SortedVectorMapTest, InsertWithHint) {
+  IntMap map;
+
+  // In-order insertions at the end.
+  for (int i = 0; i < 10; i += 2)
+    map.insert(map.end(), std::make_pair(i, i));
+  EXPECT_EQ(5u, map.size());
+
+  // A correct hint in the middle.
+  IntMap::iterator it = map.insert(map.find(4), std::make_pair(3, 3));
+  EXPECT_EQ(3, it->first);
+
+  // An incorrect hint should still lead to a correct insertion.
+  it = map.insert(map.begin(), std::make_pair(7, 7));
+  EXPECT_EQ(7, it->first);
+
+  // An existing element should be returned.
+  it = map.insert(map.end(), std::make_pair(2, 20));
+  EXPECT_EQ(2, it->first);
+  EXPECT_EQ(2, it->second);
+
+  std::map<int, int> expected = {
+      {0, 0}, {2, 2}, {3, 3}, {4, 4}, {6, 6}, {7, 7}, {8, 8}};
+  EXPECT_TRUE(std::equal(map.begin(), map.end(), expected.begin()));
+  EXPECT_EQ(expected.size(), map.size());
+}
+
+TEST(SortedVectorMapTest, Erase) {
+  IntMap map;
+  for (int i = 0; i < 10; ++i)
+    map.insert(std::make_pair(i, i));
+
+  EXPECT_EQ(1u, map.erase(3));
+  EXPECT_EQ(0u, map.erase(3));
+  EXPECT_EQ(9u, map.size());
+
+  IntMap::iterator it = map.erase(map.begin());
+  EXPECT_EQ(1, it->first);
+
+  it = map.erase(map.find(5), map.find(8));
+  EXPECT_EQ(8, it->first);
+  EXPECT_EQ(5u, map.size());
+
+  map.clear();
+  EXPECT_TRUE(map.empty());
+}
+
+TEST(SortedVectorMapTest, Assign) {
+  std::vector<std::pair<int, int>> elements = {
+      {4, 40}, {2, 20}, {9, 90}, {2, 21}, {7, 70}};
+
+  IntMap map;
+  map.insert(std::make_pair(100, 100));
+  map.Assign(elements.begin(), elements.end());
+
+  std::map<int, int> expected = {{2, 20}, {4, 40}, {7, 70}, {9, 90}};
+  EXPECT_EQ(expected.size(), map.size());
+  EXPECT_TRUE(std::equal(map.begin(), map.end(), expected.begin()));
+}
+
+TEST(SortedVectorMapTest, Comparison) {
+  IntMap map1;
+  IntMap map2;
+  EXPECT_TRUE(map1 == map2);
+
+  map1.insert(std::make_pair(1, 1));
+  EXPECT_TRUE(map1 != map2);
+
+  map2.insert(std::make_pair(1, 1));
+  EXPECT_TRUE(map1 == map2);
+
+  map2.swap(map1);
+  EXPECT_TRUE(map1 == map2);
+}
+
+}  // namespace core
@@ -17,9 +17,83 @@
 
 namespace core {
 
-const std::string& StringTable::InternString(const base::StringPiece& str) {
-  std::string value(str.data(), str.size());
-  return *(string_table_.insert(value).first);
+namespace {
+
+// The initial size of the index. This must be a power of two.
+const size_t kInitialIndexSize = 256;
+
+// Hashes a string. This is the 32-bit FNV-1a hash.
+size_t HashString(const base::StringPiece& str) {
+  uint32_t hash = 2166136261U;
+  for (size_t i = 0; i < str.size(); ++i) {
+    hash ^= static_cast<uint8_t>(str[i]);
+    hash *= 16777619U;
+  }
+  return hash;
+}
+
+}  // namespace
+
+const StringTable::StringId StringTable::kInvalidStringId = 0xFFFFFFFF;
+
+StringTable::StringId StringTable::InternStringId(
+    const base::StringPiece& str) {
+  // Keep the index at most half full, so that probe sequences stay short.
+  if (2 * (strings_.size() + 1) > index_.size())
+    GrowIndex();
+
+  size_t slot = FindSlot(str, HashString(str));
+  if (index_[slot] != kInvalidStringId)
+    return index_[slot];
+
+  DCHECK_GT(kInvalidStringId, strings_.size());
+  StringId id = static_cast<StringId>(strings_.size());
+  strings_.push_back(str.as_string());
+  index_[slot] = id;
+  return id;
+}
+
+bool StringTable::FindStringId(const base::StringPiece& str,
+                               StringId* id) const {
+  DCHECK(id != NULL);
+
+  if (index_.empty())
+    return false;
+
+  size_t slot = FindSlot(str, HashString(str));
+  if (index_[slot] == kInvalidStringId)
+    return false;
+
+  *id = index_[slot];
+  return true;
+}
+
+size_t StringTable::FindSlot(const base::StringPiece& str, size_t hash) const {
+  DCHECK(!index_.empty());
+
+  size_t mask = index_.size() - 1;
+  size_t slot = hash & mask;
+  while (index_[slot] != kInvalidStringId) {
+    if (strings_[index_[slot]] == str)
+      break;
+    slot = (slot + 1) & mask;
+  }
+  return slot;
+}
+
+void StringTable::GrowIndex() {
+  size_t size = index_.empty() ? kInitialIndexSize : 2 * index_.size();
+  index_.assign(size, kInvalidStringId);
+
+  // Reinsert the existing strings. These are all distinct, so there's no need
+  // to compare them.
+  size_t mask = size - 1;
+  for (size_t id = 0; id < strings_.size(); ++id) {
+    size_t slot = HashString(strings_[id]) & mask;
+    while (index_[slot] != kInvalidStringId)
+      slot = (slot + 1) & mask;
+    index_[slot] = static_cast<StringId>(id);
+  }
 }
 
 }  // namespace core
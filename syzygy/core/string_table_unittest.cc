@@ -14,29 +14,21 @@
 
 #include "syzygy/core/string_table.h"
 
+#include "base/strings/stringprintf.h"
 #include "gtest/gtest.h"
 
 namespace core {
 
-namespace {
-
-class TestStringTable : public StringTable {
- public:
-  using StringTable::string_table_;
-};
-
-}  // namespace
-
 TEST(StringTableTest, DefaultConstructor) {
-  TestStringTable strtab;
-  EXPECT_TRUE(strtab.string_table_.empty());
+  StringTable strtab;
+  EXPECT_EQ(0U, strtab.size());
 }
 
 TEST(StringTableTest, InternString) {
-  TestStringTable strtab;
+  StringTable strtab;
 
   // The pool is initially empty.
-  EXPECT_EQ(0U, strtab.string_table_.size());
+  EXPECT_EQ(0U, strtab.size());
 
   const std::string& str1 = strtab.InternString("foo");
   const std::string& str2 = strtab.InternString("bar");
@@ -45,7 +37,7 @@ TEST(StringTableTest, InternString) {
   const std::string& str5 = strtab.InternString("bat");
 
   // Validate the size of the internal strings pool.
-  EXPECT_EQ(3U, strtab.string_table_.size());
+  EXPECT_EQ(3U, strtab.size());
 
   // Validate string sharing.
   EXPECT_FALSE(str1.c_str() == str2.c_str());
@@ -54,4 +46,45 @@ TEST(StringTableTest, InternString) {
   EXPECT_FALSE(str1.c_str() == str5.c_str());
 }
 
+TEST(StringTableTest, InternStringId) {
+  StringTable strtab;
+
+  // Ids are handed out densely, in order of interning.
+  EXPECT_EQ(0U, strtab.InternStringId("foo"));
+  EXPECT_EQ(1U, strtab.InternStringId("bar"));
+  EXPECT_EQ(0U, strtab.InternStringId("foo"));
+  EXPECT_EQ(2U, strtab.InternStringId(""));
+  EXPECT_EQ("foo", strtab.GetString(0));
+  EXPECT_EQ("bar", strtab.GetString(1));
+  EXPECT_EQ("", strtab.GetString(2));
+
+  StringTable::StringId id = StringTable::kInvalidStringId;
+  EXPECT_TRUE(strtab.FindStringId("bar", &id));
+  EXPECT_EQ(1U, id);
+  EXPECT_FALSE(strtab.FindStringId("baz", &id));
+  EXPECT_EQ(3U, strtab.size());
+}
+
+TEST(StringTableTest, ManyStrings) {
+  StringTable strtab;
+
+  // Intern enough strings for the index to be grown several times, and make
+  // sure that the references handed out remain valid.
+  const size_t kStringCount = 10000;
+  std::vector<const std::string*> strings;
+  for (size_t i = 0; i < kStringCount; ++i) {
+    std::string str = base::StringPrintf("string%d", i);
+    EXPECT_EQ(i, strtab.InternStringId(str));
+    strings.push_back(&strtab.GetString(static_cast<StringTable::StringId>(i)));
+  }
+  EXPECT_EQ(kStringCount, strtab.size());
+
+  for (size_t i = 0; i < kStringCount; ++i) {
+    std::string str = base::StringPrintf("string%d", i);
+    EXPECT_EQ(strings[i], &strtab.InternString(str));
+    EXPECT_EQ(str, *strings[i]);
+  }
+  EXPECT_EQ(kStringCount, strtab.size());
+}
+
 }  // namespace core
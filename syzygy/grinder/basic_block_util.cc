@@ -130,7 +130,7 @@ bool LoadBasicBlockRanges(const base::FilePath& pdb_path,
   // Read the PDB file.
   pdb::PdbReader pdb_reader;
   pdb::PdbFile pdb_file;
-  if (!pdb_reader.Read(pdb_path, &pdb_file)) {
+  if (!pdb_reader.ReadMapped(pdb_path, &pdb_file)) {
     LOG(ERROR) << "Failed to read PDB: " << pdb_path.value();
     return false;
   }
@@ -32,7 +32,7 @@ bool GetBasicBlockAddresses(const base::FilePath& pdb_path,
 
   pdb::PdbFile pdb_file;
   pdb::PdbReader pdb_reader;
-  if (!pdb_reader.Read(pdb_path, &pdb_file)) {
+  if (!pdb_reader.ReadMapped(pdb_path, &pdb_file)) {
     LOG(ERROR) << "Failed to read PDB file: " << pdb_path.value();
     return false;
   }
@@ -64,6 +64,8 @@
         'transforms/asan_transform.h',
         'transforms/basic_block_entry_hook_transform.cc',
         'transforms/basic_block_entry_hook_transform.h',
+        'transforms/block_transform_cache.cc',
+        'transforms/block_transform_cache.h',
         'transforms/branch_hook_transform.cc',
         'transforms/branch_hook_transform.h',
         'transforms/coverage_transform.cc',
@@ -94,6 +96,7 @@
         '<(src)/syzygy/pe/pe.gyp:pe_lib',
         '<(src)/syzygy/pe/transforms/pe_transforms.gyp:pe_transforms_lib',
         '<(src)/syzygy/relink/relink.gyp:relink_lib',
+        '<(src)/syzygy/version/version.gyp:version_lib',
       ],
     },
     {
@@ -140,6 +143,7 @@
         'transforms/asan_interceptor_filter_unittest.cc',
         'transforms/asan_transform_unittest.cc',
         'transforms/basic_block_entry_hook_transform_unittest.cc',
+        'transforms/block_transform_cache_unittest.cc',
         'transforms/branch_hook_transform_unittest.cc',
         'transforms/coverage_transform_unittest.cc',
         'transforms/entry_call_transform_unittest.cc',
@@ -84,6 +84,12 @@ static const char kUsageFormatStr[] =
     "    --output-pdb=<path>     The PDB for the instrumented DLL. If not\n"
     "                            provided will attempt to generate one.\n"
     "    --overwrite             Allow output files to be overwritten.\n"
+    "    --previous-decomposition=<path>\n"
+    "                            The decomposition of a previous build of\n"
+    "                            the input image, as output by decompose\n"
+    "                            with --graph-only. The symbols of blocks\n"
+    "                            that are unchanged since then are not\n"
+    "                            parsed again. Ignored for COFF images.\n"
     "  afl options:\n"
     "    --config=<path>         Specifies a JSON file describing, either\n"
     "                            a whitelist of functions to instrument or\n"
@@ -99,11 +105,26 @@ static const char kUsageFormatStr[] =
     "                            these options see common/asan_parameters. If\n"
     "                            not specified then the defaults of the RTL\n"
     "                            will be used.\n"
+    "    --cache-dir=<path>      Caches the instrumented code blocks in the\n"
+    "                            given directory, and reuses those that are\n"
+    "                            found there. Ignored in hot patching mode,\n"
+    "                            with a filter or with an instrumentation\n"
+    "                            rate below 1.\n"
+    "    --coalesce-checks       Checks the adjacent accesses through the same\n"
+    "                            base register in a basic block with a single\n"
+    "                            range check.\n"
     "    --hot-patching          Use hot patching Asan instrumentation.\n"
+    "    --inline-checks         Checks the shadow byte of the accesses inline,\n"
+    "                            and only calls the runtime when it isn't zero.\n"
+    "                            PE only, incompatible with\n"
+    "                            --no-liveness-analysis.\n"
     "    --instrumentation-rate=DOUBLE\n"
     "                            Specifies the fraction of instructions to\n"
     "                            be instrumented, as a value in the range\n"
     "                            0..1, inclusive. Defaults to 1.\n"
+    "    --jobs=N                Instruments the code blocks using N worker\n"
+    "                            threads. Ignored in hot patching mode.\n"
+    "                            Defaults to 1.\n"
     "    --no-interceptors       Disable the interception of the functions\n"
     "                            like memset, memcpy, stcpy, ReadFile... to\n"
     "                            check their parameters.\n"
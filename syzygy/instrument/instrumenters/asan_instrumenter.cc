@@ -18,6 +18,7 @@
 
 #include "base/logging.h"
 #include "base/files/file_util.h"
+#include "base/strings/string_number_conversions.h"
 #include "syzygy/application/application.h"
 #include "syzygy/instrument/transforms/allocation_filter_transform.h"
 
@@ -31,10 +32,13 @@ namespace instrumenters {
 AsanInstrumenter::AsanInstrumenter()
     : use_interceptors_(true),
       remove_redundant_checks_(true),
+      coalesce_checks_(false),
+      inline_checks_(false),
       use_liveness_analysis_(true),
       instrumentation_rate_(1.0),
       asan_rtl_options_(false),
-      hot_patching_(false) {
+      hot_patching_(false),
+      jobs_(1) {
 }
 
 bool AsanInstrumenter::ImageFormatIsSupported(ImageFormat image_format) {
@@ -71,8 +75,12 @@ bool AsanInstrumenter::InstrumentImpl() {
   asan_transform_->set_use_interceptors(use_interceptors_);
   asan_transform_->set_use_liveness_analysis(use_liveness_analysis_);
   asan_transform_->set_remove_redundant_checks(remove_redundant_checks_);
+  asan_transform_->set_coalesce_checks(coalesce_checks_);
+  asan_transform_->set_inline_checks(inline_checks_);
   asan_transform_->set_instrumentation_rate(instrumentation_rate_);
   asan_transform_->set_hot_patching(hot_patching_);
+  asan_transform_->set_parallel_thread_count(jobs_);
+  asan_transform_->set_block_cache_directory(cache_dir_);
 
   // Set up the filter if one was provided.
   if (filter.get()) {
@@ -108,11 +116,22 @@ bool AsanInstrumenter::DoCommandLineParse(
 
   // Parse the additional command line arguments.
   filter_path_ = command_line->GetSwitchValuePath("filter");
+  cache_dir_ = command_line->GetSwitchValuePath("cache-dir");
   use_liveness_analysis_ = !command_line->HasSwitch("no-liveness-analysis");
   remove_redundant_checks_ = !command_line->HasSwitch("no-redundancy-analysis");
+  coalesce_checks_ = command_line->HasSwitch("coalesce-checks");
+  inline_checks_ = command_line->HasSwitch("inline-checks");
   use_interceptors_ = !command_line->HasSwitch("no-interceptors");
   hot_patching_ = command_line->HasSwitch("hot-patching");
 
+  // The inline checks get their scratch registers from the liveness analysis,
+  // and would silently never be emitted without it.
+  if (inline_checks_ && !use_liveness_analysis_) {
+    LOG(ERROR) << "--inline-checks requires the liveness analysis, and can't "
+               << "be used with --no-liveness-analysis.";
+    return false;
+  }
+
   // Parse the instrumentation rate if one has been provided.
   static const char kInstrumentationRate[] = "instrumentation-rate";
   if (command_line->HasSwitch(kInstrumentationRate)) {
@@ -126,6 +145,16 @@ bool AsanInstrumenter::DoCommandLineParse(
     instrumentation_rate_ = std::max(0.0, std::min(1.0, d));
   }
 
+  // Parse the number of instrumentation threads if one has been provided.
+  static const char kJobs[] = "jobs";
+  if (command_line->HasSwitch(kJobs)) {
+    std::string s = command_line->GetSwitchValueASCII(kJobs);
+    if (!base::StringToSizeT(s, &jobs_) || jobs_ == 0) {
+      LOG(ERROR) << "Invalid number of jobs: " << s;
+      return false;
+    }
+  }
+
   // Parse Asan RTL options if present.
   asan_rtl_options_ = command_line->HasSwitch(common::kAsanRtlOptions);
   if (asan_rtl_options_) {
@@ -53,12 +53,16 @@ class AsanInstrumenter : public InstrumenterWithAgent {
   // @name Command-line parameters.
   // @{
   base::FilePath filter_path_;
+  base::FilePath cache_dir_;
   bool use_interceptors_;
   bool remove_redundant_checks_;
+  bool coalesce_checks_;
+  bool inline_checks_;
   bool use_liveness_analysis_;
   double instrumentation_rate_;
   bool asan_rtl_options_;
   bool hot_patching_;
+  size_t jobs_;
   // @}
 
   // Valid if asan_rtl_options_ is true.
@@ -38,9 +38,12 @@ class TestAsanInstrumenter : public AsanInstrumenter {
   using AsanInstrumenter::allow_overwrite_;
   using AsanInstrumenter::asan_params_;
   using AsanInstrumenter::asan_rtl_options_;
+  using AsanInstrumenter::cache_dir_;
+  using AsanInstrumenter::coalesce_checks_;
   using AsanInstrumenter::debug_friendly_;
   using AsanInstrumenter::filter_path_;
   using AsanInstrumenter::hot_patching_;
+  using AsanInstrumenter::inline_checks_;
   using AsanInstrumenter::input_image_path_;
   using AsanInstrumenter::input_pdb_path_;
   using AsanInstrumenter::instrumentation_rate_;
@@ -48,6 +51,7 @@ class TestAsanInstrumenter : public AsanInstrumenter {
   using AsanInstrumenter::no_strip_strings_;
   using AsanInstrumenter::output_image_path_;
   using AsanInstrumenter::output_pdb_path_;
+  using AsanInstrumenter::previous_decomposition_path_;
   using AsanInstrumenter::remove_redundant_checks_;
   using AsanInstrumenter::use_interceptors_;
   using AsanInstrumenter::use_liveness_analysis_;
@@ -153,19 +157,25 @@ TEST_F(AsanInstrumenterTest, ParseMinimalAsan) {
   EXPECT_FALSE(instrumenter_.allow_overwrite_);
   EXPECT_FALSE(instrumenter_.no_augment_pdb_);
   EXPECT_FALSE(instrumenter_.no_strip_strings_);
+  EXPECT_TRUE(instrumenter_.previous_decomposition_path_.empty());
   EXPECT_FALSE(instrumenter_.debug_friendly_);
   EXPECT_TRUE(instrumenter_.use_interceptors_);
   EXPECT_TRUE(instrumenter_.use_liveness_analysis_);
   EXPECT_TRUE(instrumenter_.remove_redundant_checks_);
+  EXPECT_FALSE(instrumenter_.coalesce_checks_);
+  EXPECT_FALSE(instrumenter_.inline_checks_);
   EXPECT_EQ(1.0, instrumenter_.instrumentation_rate_);
   EXPECT_FALSE(instrumenter_.asan_rtl_options_);
   EXPECT_FALSE(instrumenter_.hot_patching_);
+  EXPECT_TRUE(instrumenter_.cache_dir_.empty());
 }
 
 TEST_F(AsanInstrumenterTest, ParseFullAsan) {
   SetUpValidCommandLine();
   cmd_line_.AppendSwitchPath("filter", test_dll_filter_path_);
   cmd_line_.AppendSwitchASCII("agent", "foo.dll");
+  cmd_line_.AppendSwitchPath("cache-dir", temp_dir_);
+  cmd_line_.AppendSwitch("coalesce-checks");
   cmd_line_.AppendSwitch("debug-friendly");
   cmd_line_.AppendSwitch("hot-patching");
   cmd_line_.AppendSwitchPath("input-pdb", input_pdb_path_);
@@ -174,6 +184,7 @@ TEST_F(AsanInstrumenterTest, ParseFullAsan) {
   cmd_line_.AppendSwitch("no-strip-strings");
   cmd_line_.AppendSwitchPath("output-pdb", output_pdb_path_);
   cmd_line_.AppendSwitch("overwrite");
+  cmd_line_.AppendSwitchPath("previous-decomposition", temp_dir_);
   cmd_line_.AppendSwitch("no-liveness-analysis");
   cmd_line_.AppendSwitch("no-redundancy-analysis");
   cmd_line_.AppendSwitchASCII("instrumentation-rate", "0.5");
@@ -188,14 +199,17 @@ TEST_F(AsanInstrumenterTest, ParseFullAsan) {
   EXPECT_EQ(abs_input_pdb_path_, instrumenter_.input_pdb_path_);
   EXPECT_EQ(output_pdb_path_, instrumenter_.output_pdb_path_);
   EXPECT_EQ(test_dll_filter_path_, instrumenter_.filter_path_);
+  EXPECT_EQ(temp_dir_, instrumenter_.cache_dir_);
   EXPECT_EQ(std::string("foo.dll"), instrumenter_.agent_dll_);
   EXPECT_TRUE(instrumenter_.allow_overwrite_);
   EXPECT_TRUE(instrumenter_.no_augment_pdb_);
   EXPECT_TRUE(instrumenter_.no_strip_strings_);
+  EXPECT_EQ(temp_dir_, instrumenter_.previous_decomposition_path_);
   EXPECT_TRUE(instrumenter_.debug_friendly_);
   EXPECT_FALSE(instrumenter_.use_interceptors_);
   EXPECT_FALSE(instrumenter_.use_liveness_analysis_);
   EXPECT_FALSE(instrumenter_.remove_redundant_checks_);
+  EXPECT_TRUE(instrumenter_.coalesce_checks_);
   EXPECT_EQ(0.5, instrumenter_.instrumentation_rate_);
   EXPECT_TRUE(instrumenter_.asan_rtl_options_);
   EXPECT_TRUE(instrumenter_.hot_patching_);
@@ -245,6 +259,23 @@ TEST_F(AsanInstrumenterTest, SucceedsWithValidFilter) {
   EXPECT_TRUE(instrumenter_.InstrumentImpl());
 }
 
+TEST_F(AsanInstrumenterTest, ParseInlineChecks) {
+  SetUpValidCommandLine();
+  cmd_line_.AppendSwitch("inline-checks");
+
+  EXPECT_TRUE(instrumenter_.ParseCommandLine(&cmd_line_));
+  EXPECT_TRUE(instrumenter_.inline_checks_);
+  EXPECT_TRUE(instrumenter_.use_liveness_analysis_);
+}
+
+TEST_F(AsanInstrumenterTest, FailsWithInlineChecksWithoutLivenessAnalysis) {
+  SetUpValidCommandLine();
+  cmd_line_.AppendSwitch("inline-checks");
+  cmd_line_.AppendSwitch("no-liveness-analysis");
+
+  EXPECT_FALSE(instrumenter_.ParseCommandLine(&cmd_line_));
+}
+
 TEST_F(AsanInstrumenterTest, FailsWithInvalidInstrumentationRate) {
   cmd_line_.AppendSwitchPath("input-image", input_image_path_);
   cmd_line_.AppendSwitchPath("output-image", output_image_path_);
@@ -99,6 +99,8 @@ bool InstrumenterWithRelinker::DoCommandLineParse(
       command_line->GetSwitchValuePath("input-pdb"));
   output_pdb_path_ = application::AppImplBase::AbsolutePath(
       command_line->GetSwitchValuePath("output-pdb"));
+  previous_decomposition_path_ = application::AppImplBase::AbsolutePath(
+      command_line->GetSwitchValuePath("previous-decomposition"));
   allow_overwrite_ = command_line->HasSwitch("overwrite");
   debug_friendly_ = command_line->HasSwitch("debug-friendly");
   no_augment_pdb_ = command_line->HasSwitch("no-augment-pdb");
@@ -203,6 +205,7 @@ bool InstrumenterWithRelinker::CreateRelinker() {
     relinker->set_input_pdb_path(input_pdb_path_);
     relinker->set_output_path(output_image_path_);
     relinker->set_output_pdb_path(output_pdb_path_);
+    relinker->set_previous_decomposition_path(previous_decomposition_path_);
     relinker->set_allow_overwrite(allow_overwrite_);
     relinker->set_augment_pdb(!no_augment_pdb_);
     relinker->set_strip_strings(!no_strip_strings_);
@@ -104,6 +104,7 @@ class InstrumenterWithRelinker : public InstrumenterInterface {
   base::FilePath input_pdb_path_;
   base::FilePath output_image_path_;
   base::FilePath output_pdb_path_;
+  base::FilePath previous_decomposition_path_;
   bool allow_overwrite_;
   bool debug_friendly_;
   bool no_augment_pdb_;
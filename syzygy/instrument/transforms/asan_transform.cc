@@ -16,8 +16,10 @@
 
 #include <algorithm>
 #include <list>
+#include <memory>
 #include <vector>
 
+#include "base/bind.h"
 #include "base/logging.h"
 #include "base/rand_util.h"
 #include "base/memory/ref_counted.h"
@@ -29,6 +31,7 @@
 #include "syzygy/block_graph/block_builder.h"
 #include "syzygy/block_graph/block_util.h"
 #include "syzygy/block_graph/typed_block.h"
+#include "syzygy/block_graph/analysis/liveness_analysis_internal.h"
 #include "syzygy/common/defs.h"
 #include "syzygy/instrument/transforms/asan_intercepts.h"
 #include "syzygy/instrument/transforms/entry_thunk_transform.h"
@@ -55,6 +58,7 @@ using block_graph::Displacement;
 using block_graph::Immediate;
 using block_graph::Instruction;
 using block_graph::Operand;
+using block_graph::Successor;
 using block_graph::TransformPolicyInterface;
 using block_graph::TypedBlock;
 using block_graph::analysis::LivenessAnalysis;
@@ -86,6 +90,10 @@ typedef TypedBlock<StringStruct> String;
 // the sandbox lets the loader finish patching the IAT entries.
 static const size_t kDateInThePast = 1;
 
+// The name of the runtime's description of the shadow memory, which is used by
+// the inline checks.
+const char kInlineCheckShadowName[] = "asan_inline_check_shadow";
+
 // Returns true iff opcode should be instrumented.
 bool ShouldInstrumentOpcode(uint16_t opcode) {
   switch (opcode) {
@@ -278,6 +286,22 @@ bool DecodeMemoryAccess(const Instruction& instr,
   return true;
 }
 
+// Use @p bb_asm to inject a call to @p hook.
+void CallAsanHook(BasicBlockAssembler* bb_asm,
+                  BlockGraph::Reference* hook,
+                  BlockGraph::ImageFormat image_format) {
+  if (image_format == BlockGraph::PE_IMAGE) {
+    // In PE images the hooks are brought in as imports, so they are indirect
+    // references.
+    bb_asm->call(Operand(Displacement(hook->referenced(), hook->offset())));
+  } else {
+    DCHECK_EQ(BlockGraph::COFF_IMAGE, image_format);
+    // In COFF images the hooks are brought in as symbols, so they are direct
+    // references.
+    bb_asm->call(Immediate(hook->referenced(), hook->offset()));
+  }
+}
+
 // Use @p bb_asm to inject a hook to @p hook to instrument the access to the
 // address stored in the operand @p op.
 void InjectAsanHook(BasicBlockAssembler* bb_asm,
@@ -301,16 +325,276 @@ void InjectAsanHook(BasicBlockAssembler* bb_asm,
   }
 
   // Call the hook.
-  if (image_format == BlockGraph::PE_IMAGE) {
-    // In PE images the hooks are brought in as imports, so they are indirect
-    // references.
-    bb_asm->call(Operand(Displacement(hook->referenced(), hook->offset())));
-  } else {
-    DCHECK_EQ(BlockGraph::COFF_IMAGE, image_format);
-    // In COFF images the hooks are brought in as symbols, so they are direct
-    // references.
-    bb_asm->call(Immediate(hook->referenced(), hook->offset()));
+  CallAsanHook(bb_asm, hook, image_format);
+}
+
+// Use @p bb_asm to inject a hook to the range check @p hook, to instrument an
+// access to the @p size bytes starting at @p first_byte.
+void InjectAsanRangeHook(BasicBlockAssembler* bb_asm,
+                         const BasicBlockAssembler::Operand& first_byte,
+                         uint32_t size,
+                         BlockGraph::Reference* hook,
+                         BlockGraph::ImageFormat image_format) {
+  DCHECK(hook != NULL);
+  DCHECK_LT(1U, size);
+
+  // The range probe receives the first address of the range in EDX and the
+  // size of the range on the stack. It restores the original value of EDX and
+  // cleans up the stack.
+  bb_asm->push(assm::edx);
+  bb_asm->lea(assm::edx, first_byte);
+  bb_asm->push(Immediate(size, assm::kSize32Bit));
+
+  CallAsanHook(bb_asm, hook, image_format);
+}
+
+// The registers that may be used as scratch registers by an inline check.
+const assm::RegisterId kInlineCheckScratchRegisters[] = {
+    assm::kRegisterEax, assm::kRegisterEcx, assm::kRegisterEdx,
+    assm::kRegisterEbx, assm::kRegisterEsi, assm::kRegisterEdi };
+
+// Use @p bb_asm to inject the inline check of the access to the address stored
+// in the operand @p op. The check looks up the shadow byte of the address
+// through the runtime's inline check shadow, whose import entry is @p shadow,
+// and leaves ZF set iff the address is covered by the shadow and that byte is
+// zero. It clobbers the arithmetic flags.
+// The scratch registers are preferably chosen among the registers that are
+// dead in @p state, the others are saved on the stack.
+// @returns true on success, false if the check can't be injected. Nothing is
+//     injected in that case.
+bool InjectInlineCheck(BasicBlockAssembler* bb_asm,
+                       const BasicBlockAssembler::Operand& op,
+                       const BlockGraph::Reference& shadow,
+                       const LivenessAnalysis::State& state) {
+  DCHECK(shadow.referenced() != NULL);
+
+  // Pick the dead registers first, then complete with live registers.
+  const Register32* scratch[2] = {};
+  bool save[2] = {};
+  size_t scratch_count = 0;
+  for (size_t i = 0; i < arraysize(kInlineCheckScratchRegisters); ++i) {
+    const Register32& reg = assm::kRegisters32[
+        kInlineCheckScratchRegisters[i] - assm::kRegister32Min];
+    if (scratch_count < 2 && !state.IsLive(reg))
+      scratch[scratch_count++] = &reg;
+  }
+  for (size_t i = 0; i < arraysize(kInlineCheckScratchRegisters); ++i) {
+    const Register32& reg = assm::kRegisters32[
+        kInlineCheckScratchRegisters[i] - assm::kRegister32Min];
+    if (scratch_count < 2 && state.IsLive(reg)) {
+      save[scratch_count] = true;
+      scratch[scratch_count++] = &reg;
+    }
+  }
+  DCHECK_EQ(2U, scratch_count);
+
+  // Saving a register moves the stack pointer, which would change the address
+  // computed from an operand based on ESP.
+  if ((save[0] || save[1]) &&
+      (op.base() == assm::kRegisterEsp || op.index() == assm::kRegisterEsp)) {
+    return false;
+  }
+
+  const Register32& address = *scratch[0];
+  const Register32& shadow_info = *scratch[1];
+  if (save[0])
+    bb_asm->push(address);
+  if (save[1])
+    bb_asm->push(shadow_info);
+
+  // Load the byte at &shadow[(address >> 3) & mask]. The inline check shadow
+  // is imported as data, so the import entry holds its address. It contains
+  // the mask followed by the shadow pointer. The index is kept on the stack.
+  bb_asm->lea(address, op);
+  bb_asm->mov(shadow_info,
+              Operand(Displacement(shadow.referenced(), shadow.offset())));
+  bb_asm->shr(address, Immediate(3));
+  bb_asm->push(address);
+  bb_asm->and(address, Operand(shadow_info));
+  bb_asm->add(address, Operand(shadow_info, Displacement(4)));
+  bb_asm->movzx_b(address, Operand(address));
+
+  // The mask wraps the addresses that aren't covered by the shadow (e.g. above
+  // 2GB with a 2GB shadow), so the index bits above the mask must be zero as
+  // well. The byte is below 256 and these bits are a multiple of the shadow
+  // length, so their sum is zero iff both are.
+  bb_asm->mov(shadow_info, Operand(shadow_info));
+  bb_asm->xor(shadow_info, Immediate(0xFFFFFFFF, assm::kSize32Bit));
+  bb_asm->and(shadow_info, Operand(assm::esp));
+  bb_asm->add(address, shadow_info);
+
+  // Popping the registers doesn't affect the flags.
+  bb_asm->pop(shadow_info);
+  if (save[1])
+    bb_asm->pop(shadow_info);
+  if (save[0])
+    bb_asm->pop(address);
+
+  return true;
+}
+
+// A read or write access of a basic block that needs to be checked.
+struct AccessCheck {
+  AccessCheck(BasicBlock::Instructions::iterator instr,
+              const BasicBlockAssembler::Operand& operand,
+              const AsanBasicBlockTransform::MemoryAccessInfo& info,
+              const LivenessAnalysis::State& state)
+      : instr(instr), operand(operand), info(info), state(state) {
+  }
+
+  // The instruction doing the access.
+  BasicBlock::Instructions::iterator instr;
+  // The operand addressing the last byte of the access.
+  BasicBlockAssembler::Operand operand;
+  // The information about the access, with the flags saving resolved.
+  AsanBasicBlockTransform::MemoryAccessInfo info;
+  // The liveness information before the access.
+  LivenessAnalysis::State state;
+};
+typedef std::vector<AccessCheck> AccessChecks;
+
+// A set of accesses through the same base register that are covered by a
+// single check of the bytes [base + begin, base + end).
+struct CoalescedCheck {
+  // The indices of the covered accesses. The first one is the access before
+  // which the check is injected.
+  std::vector<size_t> checks;
+  int32_t begin;
+  int32_t end;
+};
+typedef std::vector<CoalescedCheck> CoalescedChecks;
+
+// Returns true iff @p check is a read/write access through a base register
+// with a constant displacement, whose bytes may be checked along with those of
+// the neighbouring accesses.
+bool IsCoalescible(const AccessCheck& check) {
+  if (check.info.mode != AsanBasicBlockTransform::kReadAccess &&
+      check.info.mode != AsanBasicBlockTransform::kWriteAccess) {
+    return false;
+  }
+  if (check.operand.base() == assm::kRegisterNone ||
+      check.operand.index() != assm::kRegisterNone) {
+    return false;
+  }
+  return check.operand.displacement().reference().referred_type() ==
+      BasicBlockReference::REFERRED_TYPE_UNKNOWN;
+}
+
+// @returns the base register of the coalescible access @p check.
+const Register32& GetBaseRegister(const AccessCheck& check) {
+  DCHECK(IsCoalescible(check));
+  return assm::kRegisters32[check.operand.base() - assm::kRegister32Min];
+}
+
+// Gets the bytes [base + @p begin, base + @p end) accessed by the coalescible
+// access @p check. Its operand refers to the last of these bytes.
+void GetAccessRange(const AccessCheck& check, int32_t* begin, int32_t* end) {
+  DCHECK(IsCoalescible(check));
+  DCHECK_NE(static_cast<int32_t*>(NULL), begin);
+  DCHECK_NE(static_cast<int32_t*>(NULL), end);
+  *end = static_cast<int32_t>(check.operand.displacement().value()) + 1;
+  *begin = *end - check.info.size;
+}
+
+// Groups the accesses @p checks of @p basic_block into coalesced checks. The
+// accesses of a group have the same mode and base register, the base register
+// isn't modified between them and their bytes form a contiguous range, so a
+// check of the whole range is equivalent to checking each of them. Groups never
+// span a call or any other control flow, as the state of the memory may change
+// there. The accesses that can't be coalesced end up alone in their group.
+void CoalesceAccessChecks(BasicCodeBlock* basic_block,
+                          const AccessChecks& checks,
+                          CoalescedChecks* coalesced_checks) {
+  DCHECK_NE(reinterpret_cast<BasicCodeBlock*>(NULL), basic_block);
+  DCHECK_NE(reinterpret_cast<CoalescedChecks*>(NULL), coalesced_checks);
+
+  CoalescedChecks open_checks;
+  size_t check_index = 0;
+  BasicBlock::Instructions::iterator iter_inst =
+      basic_block->instructions().begin();
+  for (; iter_inst != basic_block->instructions().end(); ++iter_inst) {
+    // Add the access of this instruction, if any. It happens before the
+    // effects of the instruction on the registers.
+    if (check_index < checks.size() && checks[check_index].instr == iter_inst) {
+      const AccessCheck& check = checks[check_index];
+      CoalescedCheck* coalesced_check = NULL;
+      int32_t end = 0;
+      int32_t begin = 0;
+      if (IsCoalescible(check)) {
+        GetAccessRange(check, &begin, &end);
+
+        for (size_t i = 0; i < open_checks.size(); ++i) {
+          const AccessCheck& first = checks[open_checks[i].checks.front()];
+          if (first.info.mode == check.info.mode &&
+              first.operand.base() == check.operand.base() &&
+              begin <= open_checks[i].end && end >= open_checks[i].begin) {
+            coalesced_check = &open_checks[i];
+            break;
+          }
+        }
+      }
+
+      if (coalesced_check != NULL) {
+        coalesced_check->checks.push_back(check_index);
+        coalesced_check->begin = std::min(coalesced_check->begin, begin);
+        coalesced_check->end = std::max(coalesced_check->end, end);
+      } else {
+        CoalescedCheck new_check;
+        new_check.checks.push_back(check_index);
+        new_check.begin = begin;
+        new_check.end = end;
+        if (IsCoalescible(check))
+          open_checks.push_back(new_check);
+        else
+          coalesced_checks->push_back(new_check);
+      }
+      ++check_index;
+    }
+
+    // Close the groups whose base register is modified by this instruction.
+    const Instruction& instr = *iter_inst;
+    LivenessAnalysis::State defs;
+    LivenessAnalysis::StateHelper::Clear(&defs);
+    bool close_all = instr.IsCall() || instr.IsControlFlow() ||
+        instr.IsInterrupt() ||
+        !LivenessAnalysis::StateHelper::GetDefsOf(instr, &defs);
+
+    CoalescedChecks::iterator open_check = open_checks.begin();
+    while (open_check != open_checks.end()) {
+      const AccessCheck& first = checks[open_check->checks.front()];
+      if (close_all || defs.IsLive(GetBaseRegister(first))) {
+        coalesced_checks->push_back(*open_check);
+        open_check = open_checks.erase(open_check);
+      } else {
+        ++open_check;
+      }
+    }
   }
+
+  DCHECK_EQ(checks.size(), check_index);
+  coalesced_checks->insert(coalesced_checks->end(),
+                           open_checks.begin(),
+                           open_checks.end());
+}
+
+// @returns the access of @p coalesced_check whose bytes cover those of all
+//     the accesses of the group, or NULL if there is none. A single access
+//     covers its own group. Several accesses may also fall within the bytes
+//     of one of them, e.g. two 1-byte reads of the same address.
+const AccessCheck* FindCoveringAccess(const AccessChecks& checks,
+                                      const CoalescedCheck& coalesced_check) {
+  if (coalesced_check.checks.size() == 1)
+    return &checks[coalesced_check.checks.front()];
+
+  for (size_t i = 0; i < coalesced_check.checks.size(); ++i) {
+    const AccessCheck& check = checks[coalesced_check.checks[i]];
+    int32_t begin = 0;
+    int32_t end = 0;
+    GetAccessRange(check, &begin, &end);
+    if (begin == coalesced_check.begin && end == coalesced_check.end)
+      return &check;
+  }
+  return NULL;
 }
 
 // Get the name of an asan check access function for an @p access_mode access.
@@ -320,6 +604,22 @@ std::string GetAsanCheckAccessFunctionName(
     AsanBasicBlockTransform::MemoryAccessInfo info,
     BlockGraph::ImageFormat image_format) {
   DCHECK(info.mode != AsanBasicBlockTransform::kNoAccess);
+
+  // For COFF images we use the decorated function name, which contains a
+  // leading underscore.
+  const char* prefix_str = image_format == BlockGraph::PE_IMAGE ? "" : "_";
+
+  // The range checks don't have a fixed access size.
+  if (info.mode == AsanBasicBlockTransform::kRangeReadAccess ||
+      info.mode == AsanBasicBlockTransform::kRangeWriteAccess) {
+    return base::StringPrintf(
+        "%sasan_check_range_%s_access%s",
+        prefix_str,
+        info.mode == AsanBasicBlockTransform::kRangeReadAccess ? "read"
+                                                               : "write",
+        info.save_flags ? "" : "_no_flags");
+  }
+
   DCHECK_NE(0U, info.size);
   DCHECK(info.mode == AsanBasicBlockTransform::kReadAccess ||
          info.mode == AsanBasicBlockTransform::kWriteAccess ||
@@ -341,11 +641,9 @@ std::string GetAsanCheckAccessFunctionName(
   else
     access_mode_str = reinterpret_cast<char*>(GET_MNEMONIC_NAME(info.opcode));
 
-  // For COFF images we use the decorated function name, which contains a
-  // leading underscore.
   std::string function_name =
       base::StringPrintf("%sasan_check%s_%d_byte_%s_access%s",
-                         image_format == BlockGraph::PE_IMAGE ? "" : "_",
+                         prefix_str,
                          rep_str,
                          info.size,
                          access_mode_str,
@@ -475,9 +773,9 @@ bool AddAsanCheckAccessHooks(
   return true;
 }
 
-// Create a stub for the asan_check_access functions. For load/store, the stub
-// consists of a small block of code that restores the value of EDX and returns
-// to the caller. Otherwise, the stub do return.
+// Create a stub for the asan_check_access functions. For load/store and range
+// checks, the stub consists of a small block of code that restores the value of
+// EDX and returns to the caller. Otherwise, the stub do return.
 // @param block_graph The block-graph to populate with the stub.
 // @param stub_name The stub's name.
 // @param mode The kind of memory access.
@@ -521,6 +819,11 @@ bool CreateHooksStub(BlockGraph* block_graph,
     // return.
     assm.mov(assm::edx, Operand(assm::esp, Displacement(4)));
     assm.ret(4);
+  } else if (mode == AsanBasicBlockTransform::kRangeReadAccess ||
+             mode == AsanBasicBlockTransform::kRangeWriteAccess) {
+    // The range size is pushed on top of the original value of EDX.
+    assm.mov(assm::edx, Operand(assm::esp, Displacement(8)));
+    assm.ret(8);
   } else {
     assm.ret();
   }
@@ -541,14 +844,64 @@ bool CreateHooksStub(BlockGraph* block_graph,
   return true;
 }
 
+// Create a stub for the runtime's inline check shadow, to be used until the
+// imports of the runtime are resolved. Its mask is zero and its shadow pointer
+// refers to a non-zero byte, so that the inline checks always call the hooks,
+// which are stubbed as well.
+// @param block_graph The block-graph to populate with the stub.
+// @param stub_name The stub's name.
+// @param reference Will receive the reference to the created stub.
+// @returns true on success, false otherwise.
+bool CreateInlineCheckShadowStub(BlockGraph* block_graph,
+                                 const base::StringPiece& stub_name,
+                                 BlockGraph::Reference* reference) {
+  DCHECK(reference != NULL);
+
+  // Find or create the section we put our thunks in.
+  BlockGraph::Section* thunk_section = block_graph->FindOrAddSection(
+      common::kThunkSectionName, pe::kCodeCharacteristics);
+
+  if (thunk_section == NULL) {
+    LOG(ERROR) << "Unable to find or create .thunks section.";
+    return false;
+  }
+
+  // The stub is laid out as the mask, the shadow pointer and the byte it
+  // points to.
+  std::string stub_data_name = base::StringPrintf(
+      "%.*s_shadow", stub_name.length(), stub_name.data());
+  const BlockGraph::Size kStubSize = 3 * sizeof(uint32_t);
+  BlockGraph::Block* stub = block_graph->AddBlock(BlockGraph::DATA_BLOCK,
+                                                  kStubSize,
+                                                  stub_data_name);
+  stub->set_section(thunk_section->id());
+  uint8_t* data = stub->AllocateData(kStubSize);
+  ::memset(data, 0, kStubSize);
+  data[2 * sizeof(uint32_t)] = 0xFF;
+  stub->SetReference(sizeof(uint32_t),
+                     BlockGraph::Reference(BlockGraph::ABSOLUTE_REF,
+                                           sizeof(uint32_t),
+                                           stub,
+                                           2 * sizeof(uint32_t),
+                                           2 * sizeof(uint32_t)));
+
+  *reference = BlockGraph::Reference(BlockGraph::ABSOLUTE_REF, 4, stub, 0, 0);
+
+  return true;
+}
+
 // Creates stubs for Asan check access hooks (PE only), imports them from the
 // runtime module and adds them to the block graph.
 // @param asan_hook_stub_name Name prefix of the stubs for the asan check access
 //     functions.
 // @param use_liveness_analysis true iff we use liveness analysis.
+// @param coalesce_checks true iff the range check hooks are needed.
 // @param import_module The module for which the import should be added.
 // @param check_access_hooks_ref The map where the reference to the imports
 //     should be stored.
+// @param inline_check_shadow_ref If not NULL, the runtime's inline check shadow
+//     is imported as well (PE only), and this receives the reference to its
+//     import entry.
 // @param policy The policy object restricting how the transform is applied.
 // @param block_graph The block-graph to populate.
 // @param header_block The block containing the module's DOS header of this
@@ -557,13 +910,20 @@ bool CreateHooksStub(BlockGraph* block_graph,
 bool ImportAsanCheckAccessHooks(
     const char* asan_hook_stub_name,
     bool use_liveness_analysis,
+    bool coalesce_checks,
     ImportedModule* import_module,
     AsanBasicBlockTransform::AsanHookMap* check_access_hooks_ref,
+    BlockGraph::Reference* inline_check_shadow_ref,
     const TransformPolicyInterface* policy,
     BlockGraph* block_graph,
     BlockGraph::Block* header_block) {
   typedef AsanBasicBlockTransform::MemoryAccessInfo MemoryAccessInfo;
 
+  // The inline checks read the shadow through an import entry, which COFF
+  // images don't have.
+  if (block_graph->image_format() != BlockGraph::PE_IMAGE)
+    inline_check_shadow_ref = NULL;
+
   AccessHookParamVector access_hook_param_vec;
   AsanBasicBlockTransform::AsanDefaultHookMap default_stub_map;
 
@@ -588,12 +948,25 @@ bool ImportAsanCheckAccessHooks(
       return false;
     }
 
+    // Create the hook stub for range checks.
+    BlockGraph::Reference range_hook;
+    if (coalesce_checks &&
+        !CreateHooksStub(block_graph, asan_hook_stub_name,
+                         AsanBasicBlockTransform::kRangeReadAccess,
+                         &range_hook)) {
+      return false;
+    }
+
     // Map each memory access kind to an appropriate stub.
     default_stub_map[AsanBasicBlockTransform::kReadAccess] = read_write_hook;
     default_stub_map[AsanBasicBlockTransform::kWriteAccess] = read_write_hook;
     default_stub_map[AsanBasicBlockTransform::kInstrAccess] = instr_hook;
     default_stub_map[AsanBasicBlockTransform::kRepzAccess] = instr_hook;
     default_stub_map[AsanBasicBlockTransform::kRepnzAccess] = instr_hook;
+    if (coalesce_checks) {
+      default_stub_map[AsanBasicBlockTransform::kRangeReadAccess] = range_hook;
+      default_stub_map[AsanBasicBlockTransform::kRangeWriteAccess] = range_hook;
+    }
   }
 
   // Import the hooks for the read/write accesses.
@@ -632,6 +1005,25 @@ bool ImportAsanCheckAccessHooks(
     access_hook_param_vec.push_back(write_info_10);
   }
 
+  // Import the hooks for the coalesced range checks.
+  if (coalesce_checks) {
+    MemoryAccessInfo range_read_info =
+        { AsanBasicBlockTransform::kRangeReadAccess, 0, 0, true };
+    access_hook_param_vec.push_back(range_read_info);
+    if (use_liveness_analysis) {
+      range_read_info.save_flags = false;
+      access_hook_param_vec.push_back(range_read_info);
+    }
+
+    MemoryAccessInfo range_write_info =
+        { AsanBasicBlockTransform::kRangeWriteAccess, 0, 0, true };
+    access_hook_param_vec.push_back(range_write_info);
+    if (use_liveness_analysis) {
+      range_write_info.save_flags = false;
+      access_hook_param_vec.push_back(range_write_info);
+    }
+  }
+
   // Import the hooks for string/prefix memory accesses.
   const _InstructionType strings[] = {I_CMPS, I_LODS, I_MOVS, I_STOS};
   int strings_length = sizeof(strings)/sizeof(_InstructionType);
@@ -656,6 +1048,13 @@ bool ImportAsanCheckAccessHooks(
     }
   }
 
+  // Import the inline check shadow along with the hooks.
+  size_t inline_check_shadow_idx = 0;
+  if (inline_check_shadow_ref != NULL) {
+    inline_check_shadow_idx = import_module->AddSymbol(
+        kInlineCheckShadowName, ImportedModule::kAlwaysImport);
+  }
+
   if (!AddAsanCheckAccessHooks(access_hook_param_vec,
                                default_stub_map,
                                import_module,
@@ -666,6 +1065,25 @@ bool ImportAsanCheckAccessHooks(
     return false;
   }
 
+  if (inline_check_shadow_ref != NULL) {
+    if (!import_module->GetSymbolReference(inline_check_shadow_idx,
+                                           inline_check_shadow_ref)) {
+      LOG(ERROR) << "Unable to get import reference for "
+                 << kInlineCheckShadowName << ".";
+      return false;
+    }
+
+    // As for the hooks, the import entry refers to a stub until the imports
+    // of the runtime are resolved.
+    BlockGraph::Reference stub_reference;
+    if (!CreateInlineCheckShadowStub(block_graph, asan_hook_stub_name,
+                                     &stub_reference)) {
+      return false;
+    }
+    inline_check_shadow_ref->referenced()->SetReference(
+        inline_check_shadow_ref->offset(), stub_reference);
+  }
+
   return true;
 }
 
@@ -1057,6 +1475,15 @@ bool PeGetRedirectsForStaticallyLinkedFunctions(
   return true;
 }
 
+// Adapts a factory of Asan basic-block transforms to a generic basic-block
+// transform factory.
+block_graph::BasicBlockSubGraphTransformInterface* RunAsanTransformFactory(
+    const base::Callback<AsanBasicBlockTransform*(BlockGraph::Block*)>&
+        factory,
+    BlockGraph::Block* block) {
+  return factory.Run(block);
+}
+
 }  // namespace
 
 const char AsanBasicBlockTransform::kTransformName[] =
@@ -1095,6 +1522,10 @@ bool AsanBasicBlockTransform::InstrumentBasicBlock(
   if (remove_redundant_checks_)
     memory_accesses_.GetStateAtEntryOf(basic_block, &memory_state);
 
+  // The accesses to check. They are instrumented once the whole basic block
+  // has been visited, so that their checks may be coalesced.
+  AccessChecks checks;
+
   // Process each instruction and inject a call to Asan when we find an
   // instrumentable memory access.
   BasicBlock::Instructions::iterator iter_inst =
@@ -1184,16 +1615,6 @@ bool AsanBasicBlockTransform::InstrumentBasicBlock(
       continue;
     }
 
-    // Create a BasicBlockAssembler to insert new instruction.
-    BasicBlockAssembler bb_asm(iter_inst, &basic_block->instructions());
-
-    // Configure the assembler to copy the SourceRange information of the
-    // current instrumented instruction into newly created instructions. This is
-    // a hack to allow valid stack walking and better error reporting, but
-    // breaks the 1:1 OMAP mapping and may confuse some debuggers.
-    if (debug_friendly_)
-      bb_asm.set_source_range(instr.source_range());
-
     if (use_liveness_analysis_ &&
         (info.mode == kReadAccess || info.mode == kWriteAccess)) {
       // Use the liveness information to skip saving the flags if possible.
@@ -1204,26 +1625,187 @@ bool AsanBasicBlockTransform::InstrumentBasicBlock(
     // hook so we can call a dry run without hooks present.
     instrumentation_happened_ = true;
 
-    if (!dry_run_) {
-      // Insert hook for standard instructions.
-      AsanHookMap::iterator hook = check_access_hooks_->find(info);
-      if (hook == check_access_hooks_->end()) {
-        LOG(ERROR) << "Invalid access : "
-                   << GetAsanCheckAccessFunctionName(info, image_format);
-        return false;
-      }
+    if (!dry_run_)
+      checks.push_back(AccessCheck(iter_inst, operand, info, state));
+  }
+
+  DCHECK(iter_state == states.end());
 
-      // Instrument this instruction.
-      InjectAsanHook(
-          &bb_asm, info, operand, &hook->second, state, image_format);
+  if (checks.empty())
+    return true;
+
+  CoalescedChecks coalesced_checks;
+  if (coalesce_checks_) {
+    CoalesceAccessChecks(basic_block, checks, &coalesced_checks);
+  } else {
+    coalesced_checks.resize(checks.size());
+    for (size_t i = 0; i < checks.size(); ++i)
+      coalesced_checks[i].checks.push_back(i);
+  }
+
+  // The inline checks, indexed by the access they check.
+  std::vector<InlineCheck> inline_checks(checks.size());
+
+  for (size_t i = 0; i < coalesced_checks.size(); ++i) {
+    const CoalescedCheck& coalesced_check = coalesced_checks[i];
+    const AccessCheck& first = checks[coalesced_check.checks.front()];
+
+    // Create a BasicBlockAssembler to insert the check of the group before its
+    // first access.
+    BasicBlockAssembler bb_asm(first.instr, &basic_block->instructions());
+
+    // Configure the assembler to copy the SourceRange information of the
+    // instrumented instruction into newly created instructions. This is a hack
+    // to allow valid stack walking and better error reporting, but breaks the
+    // 1:1 OMAP mapping and may confuse some debuggers.
+    if (debug_friendly_)
+      bb_asm.set_source_range(first.instr->source_range());
+
+    // A group is checked through the fixed-size check of one of its accesses
+    // if that access covers the others, and through a range check otherwise.
+    // The check is injected before the first access, where the base register
+    // has the same value as at the covering access.
+    const AccessCheck* covering = FindCoveringAccess(checks, coalesced_check);
+    MemoryAccessInfo info = first.info;
+    if (covering == NULL) {
+      info.mode = first.info.mode == kReadAccess ? kRangeReadAccess
+                                                 : kRangeWriteAccess;
+      info.size = 0;
+    } else {
+      info.size = covering->info.size;
+    }
+
+    AsanHookMap::iterator hook = check_access_hooks_->find(info);
+    if (hook == check_access_hooks_->end()) {
+      LOG(ERROR) << "Invalid access : "
+                 << GetAsanCheckAccessFunctionName(info, image_format);
+      return false;
+    }
+
+    if (covering == NULL) {
+      InjectAsanRangeHook(
+          &bb_asm,
+          Operand(GetBaseRegister(first),
+                  Displacement(static_cast<uint32_t>(coalesced_check.begin))),
+          coalesced_check.end - coalesced_check.begin,
+          &hook->second,
+          image_format);
+      continue;
+    }
+
+    // Check the shadow byte inline when the flags of the access don't need to
+    // be saved. The hook is then only called when the byte isn't zero, which
+    // is arranged by SplitInlineChecks.
+    bool inline_check = inline_checks_ && !info.save_flags &&
+        image_format == BlockGraph::PE_IMAGE &&
+        inline_check_shadow_.referenced() != NULL &&
+        InjectInlineCheck(&bb_asm, covering->operand, inline_check_shadow_,
+                          first.state);
+    BasicBlock::Instructions::iterator fast_path_end = first.instr;
+    if (inline_check)
+      --fast_path_end;
+
+    InjectAsanHook(&bb_asm, info, covering->operand, &hook->second,
+                   first.state, image_format);
+
+    if (inline_check) {
+      InlineCheck& check = inline_checks[coalesced_check.checks.front()];
+      check.basic_block = basic_block;
+      check.slow_path = ++fast_path_end;
+      check.access = first.instr;
     }
   }
 
-  DCHECK(iter_state == states.end());
+  // Record the inline checks in the order of their accesses.
+  for (size_t i = 0; i < inline_checks.size(); ++i) {
+    if (inline_checks[i].basic_block != NULL)
+      injected_inline_checks_.push_back(inline_checks[i]);
+  }
 
   return true;
 }
 
+bool AsanBasicBlockTransform::SplitInlineChecks(
+    BasicBlockSubGraph* subgraph) {
+  DCHECK_NE(reinterpret_cast<BasicBlockSubGraph*>(NULL), subgraph);
+
+  // The checks are split from the last to the first, so that the access of
+  // each check is still in the basic block it was injected in. Each split turns
+  // a basic block B = [before, fast path, slow path, access, after] into:
+  //   B = [before, fast path] -> C if equal, S otherwise,
+  //   C = [access, after] -> the successors of B,
+  //   S = [slow path] -> C.
+  // The slow paths are moved after the other basic blocks of the block.
+  std::vector<InlineCheck>::reverse_iterator check_it =
+      injected_inline_checks_.rbegin();
+  for (; check_it != injected_inline_checks_.rend(); ++check_it) {
+    BasicCodeBlock* bb = check_it->basic_block;
+
+    // Find the position of the basic block in its block.
+    BasicBlockSubGraph::BasicBlockOrdering* order = NULL;
+    BasicBlockSubGraph::BasicBlockOrdering::iterator bb_pos;
+    BasicBlockSubGraph::BlockDescriptionList::iterator desc_it =
+        subgraph->block_descriptions().begin();
+    for (; order == NULL && desc_it != subgraph->block_descriptions().end();
+         ++desc_it) {
+      bb_pos = std::find(desc_it->basic_block_order.begin(),
+                         desc_it->basic_block_order.end(),
+                         bb);
+      if (bb_pos != desc_it->basic_block_order.end())
+        order = &desc_it->basic_block_order;
+    }
+    if (order == NULL) {
+      LOG(ERROR) << "Unable to find the basic block " << bb->name() << ".";
+      return false;
+    }
+
+    BasicCodeBlock* cont_bb = subgraph->AddBasicCodeBlock(bb->name());
+    BasicCodeBlock* slow_bb = subgraph->AddBasicCodeBlock(bb->name());
+    if (cont_bb == NULL || slow_bb == NULL) {
+      LOG(ERROR) << "Unable to add the basic blocks of an inline check.";
+      return false;
+    }
+
+    cont_bb->instructions().splice(cont_bb->instructions().begin(),
+                                   bb->instructions(),
+                                   check_it->access,
+                                   bb->instructions().end());
+    cont_bb->successors().swap(bb->successors());
+    slow_bb->instructions().splice(slow_bb->instructions().begin(),
+                                   bb->instructions(),
+                                   check_it->slow_path,
+                                   bb->instructions().end());
+
+    bb->successors().push_back(
+        Successor(Successor::kConditionEqual,
+                  BasicBlockReference(BlockGraph::RELATIVE_REF,
+                                      BlockGraph::Reference::kMaximumSize,
+                                      cont_bb),
+                  0));
+    bb->successors().push_back(
+        Successor(Successor::kConditionNotEqual,
+                  BasicBlockReference(BlockGraph::RELATIVE_REF,
+                                      BlockGraph::Reference::kMaximumSize,
+                                      slow_bb),
+                  0));
+    slow_bb->successors().push_back(
+        Successor(Successor::kConditionTrue,
+                  BasicBlockReference(BlockGraph::RELATIVE_REF,
+                                      BlockGraph::Reference::kMaximumSize,
+                                      cont_bb),
+                  0));
+
+    order->insert(++bb_pos, cont_bb);
+    BasicBlockSubGraph::BasicBlockOrdering::iterator slow_pos = order->end();
+    if (order->back()->type() == BasicBlock::BASIC_END_BLOCK)
+      --slow_pos;
+    order->insert(slow_pos, slow_bb);
+  }
+
+  injected_inline_checks_.clear();
+  return true;
+}
+
 void AsanBasicBlockTransform::set_instrumentation_rate(
     double instrumentation_rate) {
   // Set the instrumentation rate, capping it between 0 and 1.
@@ -1262,7 +1844,10 @@ bool AsanBasicBlockTransform::TransformBasicBlockSubGraph(
       return false;
     }
   }
-  return true;
+
+  // Split the basic blocks around the inline checks. This adds basic blocks to
+  // the subgraph, so it's done once they have all been instrumented.
+  return SplitInlineChecks(subgraph);
 }
 
 HotPatchingAsanBasicBlockTransform::HotPatchingAsanBasicBlockTransform(
@@ -1313,12 +1898,15 @@ AsanTransform::AsanTransform()
     : debug_friendly_(false),
       use_liveness_analysis_(false),
       remove_redundant_checks_(false),
+      coalesce_checks_(false),
+      inline_checks_(false),
       use_interceptors_(false),
       instrumentation_rate_(1.0),
       asan_parameters_(nullptr),
       check_access_hooks_ref_(),
       asan_parameters_block_(nullptr),
-      hot_patching_(false) {
+      hot_patching_(false),
+      parallel_thread_count_(1) {
 }
 
 AsanTransform::~AsanTransform() { }
@@ -1362,8 +1950,11 @@ bool AsanTransform::PreBlockGraphIteration(
   if (!hot_patching_) {
     if (!ImportAsanCheckAccessHooks(kAsanHookStubName,
                                     use_liveness_analysis(),
+                                    coalesce_checks(),
                                     &import_module,
                                     &check_access_hooks_ref_,
+                                    inline_checks() ? &inline_check_shadow_ref_
+                                                    : NULL,
                                     policy,
                                     block_graph,
                                     header_block)) {
@@ -1371,6 +1962,9 @@ bool AsanTransform::PreBlockGraphIteration(
     }
   }
 
+  if (!InitBlockCache(block_graph))
+    return false;
+
   // Redirect DllMain entry thunk in hot patching mode.
   if (hot_patching_) {
     EntryThunkTransform entry_thunk_tx;
@@ -1399,25 +1993,35 @@ bool AsanTransform::OnBlock(const TransformPolicyInterface* policy,
   if (ShouldSkipBlock(policy, block))
     return true;
 
-  // Use the filter that was passed to us for our child transform.
-  AsanBasicBlockTransform transform(&check_access_hooks_ref_);
-  transform.set_debug_friendly(debug_friendly());
-  transform.set_use_liveness_analysis(use_liveness_analysis());
-  transform.set_remove_redundant_checks(remove_redundant_checks());
-  transform.set_filter(filter());
-  transform.set_instrumentation_rate(instrumentation_rate_);
+  // Splice in the instrumented block if it is in the cache. Those that aren't
+  // are instrumented in PostBlockGraphIteration, which adds them to the cache.
+  if (block_cache_.get() != NULL) {
+    if (!block_cache_->Apply(block))
+      parallel_blocks_.push_back(block);
+    return true;
+  }
+
+  // Defer the instrumentation to PostBlockGraphIteration when running in
+  // parallel.
+  if (parallel_thread_count_ > 1 && !hot_patching_) {
+    parallel_blocks_.push_back(block);
+    return true;
+  }
+
+  std::unique_ptr<AsanBasicBlockTransform> transform(
+      CreateBasicBlockTransform(block));
 
   if (!hot_patching_) {
     if (!ApplyBasicBlockSubGraphTransform(
-            &transform, policy, block_graph, block, NULL)) {
+            transform.get(), policy, block_graph, block, NULL)) {
       return false;
     }
   } else {
     // If we run in hot patching mode we just want to check if the block would
     // be instrumented.
-    transform.set_dry_run(true);
+    transform->set_dry_run(true);
 
-    HotPatchingAsanBasicBlockTransform hp_asan_bb_transform(&transform);
+    HotPatchingAsanBasicBlockTransform hp_asan_bb_transform(transform.get());
 
     block_graph::BlockVector new_blocks;
     if (!ApplyBasicBlockSubGraphTransform(
@@ -1435,6 +2039,70 @@ bool AsanTransform::OnBlock(const TransformPolicyInterface* policy,
   return true;
 }
 
+AsanBasicBlockTransform* AsanTransform::CreateBasicBlockTransform(
+    BlockGraph::Block* block) {
+  DCHECK(block != NULL);
+
+  // Use the filter that was passed to us for our child transform.
+  AsanBasicBlockTransform* transform =
+      new AsanBasicBlockTransform(&check_access_hooks_ref_);
+  transform->set_debug_friendly(debug_friendly());
+  transform->set_use_liveness_analysis(use_liveness_analysis());
+  transform->set_remove_redundant_checks(remove_redundant_checks());
+  transform->set_coalesce_checks(coalesce_checks());
+  transform->set_inline_checks(inline_checks());
+  transform->set_inline_check_shadow(inline_check_shadow_ref_);
+  transform->set_filter(filter());
+  transform->set_instrumentation_rate(instrumentation_rate_);
+  return transform;
+}
+
+bool AsanTransform::InitBlockCache(const BlockGraph* block_graph) {
+  DCHECK_NE(static_cast<BlockGraph*>(nullptr), block_graph);
+  DCHECK(block_cache_.get() == NULL);
+
+  if (block_cache_directory_.empty())
+    return true;
+
+  if (hot_patching_ || filter() != NULL || instrumentation_rate_ < 1.0) {
+    LOG(WARNING) << "The block cache can't be used in hot patching mode, "
+                 << "with a filter or with an instrumentation rate below 1.";
+    return true;
+  }
+
+  // Everything that influences the instrumentation of a block goes into the
+  // parameters. The hooks are listed in the order of the hook map, which is
+  // also the order of the external targets.
+  std::string parameters = base::StringPrintf(
+      "%s;format=%d;dll=%s;liveness=%d;redundancy=%d;coalesce=%d;inline=%d;"
+      "debug_friendly=%d;hooks=",
+      kTransformName, block_graph->image_format(),
+      instrument_dll_name().as_string().c_str(), use_liveness_analysis_,
+      remove_redundant_checks_, coalesce_checks_, inline_checks_,
+      debug_friendly_);
+  std::vector<BlockGraph::Reference> hooks;
+  AsanBasicBlockTransform::AsanHookMap::const_iterator hook_it =
+      check_access_hooks_ref_.begin();
+  for (; hook_it != check_access_hooks_ref_.end(); ++hook_it) {
+    base::StringAppendF(&parameters, "%d:%d:%d:%d,", hook_it->first.mode,
+                        hook_it->first.size, hook_it->first.opcode,
+                        hook_it->first.save_flags);
+    hooks.push_back(hook_it->second);
+  }
+
+  // The inline checks refer to the import of the inline check shadow.
+  if (inline_check_shadow_ref_.referenced() != NULL)
+    hooks.push_back(inline_check_shadow_ref_);
+
+  block_cache_.reset(new BlockTransformCache(block_cache_directory_,
+                                             parameters));
+  if (!block_cache_->Init())
+    return false;
+  block_cache_->set_external_targets(hooks);
+
+  return true;
+}
+
 bool AsanTransform::PostBlockGraphIteration(
     const TransformPolicyInterface* policy,
     BlockGraph* block_graph,
@@ -1443,6 +2111,30 @@ bool AsanTransform::PostBlockGraphIteration(
   DCHECK(block_graph != NULL);
   DCHECK(header_block != NULL);
 
+  // Instrument the blocks that were collected by OnBlock.
+  if (!parallel_blocks_.empty()) {
+    block_graph::BasicBlockSubGraphMergeCallback merge_callback;
+    if (block_cache_.get() != NULL) {
+      merge_callback = base::Bind(&BlockTransformCache::Store,
+                                  base::Unretained(block_cache_.get()));
+    }
+    if (!ApplyBasicBlockSubGraphTransformInParallel(
+            base::Bind(&RunAsanTransformFactory,
+                       base::Bind(&AsanTransform::CreateBasicBlockTransform,
+                                  base::Unretained(this))),
+            policy, block_graph, parallel_blocks_, parallel_thread_count_,
+            merge_callback, NULL)) {
+      return false;
+    }
+    parallel_blocks_.clear();
+  }
+
+  if (block_cache_.get() != NULL) {
+    LOG(INFO) << "Block cache: " << block_cache_->hit_count() << " hit(s), "
+              << block_cache_->miss_count() << " miss(es), "
+              << block_cache_->store_count() << " block(s) stored.";
+  }
+
   if (block_graph->image_format() == BlockGraph::PE_IMAGE) {
     if (!PeInterceptFunctions(kAsanIntercepts, policy, block_graph,
                               header_block)) {
@@ -1687,7 +2379,7 @@ bool AsanTransform::PeInjectAsanParameters(
   params_block->CopyData(fparams.data().size(), fparams.data().data());
 
   // Wire up any references that are required.
-  static_assert(15 == common::kAsanParametersVersion,
+  static_assert(18 == common::kAsanParametersVersion,
                 "Pointers in the params must be linked up here.");
   block_graph::TypedBlock<common::AsanParameters> params;
   CHECK(params.Init(0, params_block));
@@ -18,11 +18,13 @@
 #define SYZYGY_INSTRUMENT_TRANSFORMS_ASAN_TRANSFORM_H_
 
 #include <map>
+#include <memory>
 #include <set>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "base/files/file_path.h"
 #include "base/strings/string_piece.h"
 #include "syzygy/block_graph/filterable.h"
 #include "syzygy/block_graph/iterate.h"
@@ -33,6 +35,7 @@
 #include "syzygy/common/asan_parameters.h"
 #include "syzygy/instrument/transforms/asan_interceptor_filter.h"
 #include "syzygy/instrument/transforms/asan_intercepts.h"
+#include "syzygy/instrument/transforms/block_transform_cache.h"
 #include "syzygy/pe/transforms/pe_add_imports_transform.h"
 
 namespace instrument {
@@ -52,6 +55,10 @@ class AsanBasicBlockTransform
     kInstrAccess,
     kRepzAccess,
     kRepnzAccess,
+    // A coalesced check of a range of bytes, read or written by several
+    // instructions of a basic block.
+    kRangeReadAccess,
+    kRangeWriteAccess,
   };
 
   enum StackAccessMode {
@@ -82,8 +89,10 @@ class AsanBasicBlockTransform
   //     indirect references for PE images.
   explicit AsanBasicBlockTransform(AsanHookMap* check_access_hooks) :
       check_access_hooks_(check_access_hooks),
+      coalesce_checks_(false),
       debug_friendly_(false),
       dry_run_(false),
+      inline_checks_(false),
       instrumentation_happened_(false),
       instrumentation_rate_(1.0),
       remove_redundant_checks_(false),
@@ -106,6 +115,30 @@ class AsanBasicBlockTransform
     remove_redundant_checks_ = remove_redundant_checks;
   }
 
+  // When activated, the read/write accesses of a basic block that go through
+  // the same base register and touch adjacent or overlapping bytes are checked
+  // with a single range check. This requires the range check hooks.
+  bool coalesce_checks() const { return coalesce_checks_; }
+  void set_coalesce_checks(bool coalesce_checks) {
+    coalesce_checks_ = coalesce_checks;
+  }
+
+  // When activated, the shadow byte of the read/write accesses whose flags
+  // don't need to be saved is checked inline, and the hooks are only called
+  // when it isn't zero. This requires the liveness analysis and a reference to
+  // the import of the runtime's inline check shadow, and is only available for
+  // PE images.
+  bool inline_checks() const { return inline_checks_; }
+  void set_inline_checks(bool inline_checks) {
+    inline_checks_ = inline_checks;
+  }
+  const BlockGraph::Reference& inline_check_shadow() const {
+    return inline_check_shadow_;
+  }
+  void set_inline_check_shadow(const BlockGraph::Reference& shadow) {
+    inline_check_shadow_ = shadow;
+  }
+
   // The instrumentation rate must be in the range [0, 1], inclusive.
   double instrumentation_rate() const { return instrumentation_rate_; }
   void set_instrumentation_rate(double instrumentation_rate);
@@ -150,7 +183,23 @@ class AsanBasicBlockTransform
                             StackAccessMode stack_mode,
                             BlockGraph::ImageFormat image_format);
 
+  // Splits the basic blocks around the inline checks injected by
+  // InstrumentBasicBlock, so that the hooks are only called when the inline
+  // check fails. Until then, the hooks are called unconditionally.
+  // @param subgraph The subgraph containing the instrumented basic blocks.
+  // @returns true on success, false otherwise.
+  bool SplitInlineChecks(BasicBlockSubGraph* subgraph);
+
  private:
+  // An inline check injected in a basic block. The instructions in
+  // [slow_path, access) call the hook, and must only be executed when the
+  // instructions before them clear ZF.
+  struct InlineCheck {
+    block_graph::BasicCodeBlock* basic_block;
+    block_graph::BasicBlock::Instructions::iterator slow_path;
+    block_graph::BasicBlock::Instructions::iterator access;
+  };
+
   // Liveness analysis and liveness information for this subgraph.
   block_graph::analysis::LivenessAnalysis liveness_;
 
@@ -160,6 +209,10 @@ class AsanBasicBlockTransform
   // The references to the Asan access check import entries.
   AsanHookMap* check_access_hooks_;
 
+  // When activated, adjacent accesses through the same base register are
+  // checked with a single range check.
+  bool coalesce_checks_;
+
   // Activate the overwriting of source range for created instructions.
   bool debug_friendly_;
 
@@ -167,6 +220,15 @@ class AsanBasicBlockTransform
   // signal whether there would be an instrumentation in the block.
   bool dry_run_;
 
+  // When activated, the shadow byte of the accesses is checked inline when
+  // possible, using the runtime's inline check shadow.
+  bool inline_checks_;
+  BlockGraph::Reference inline_check_shadow_;
+
+  // The inline checks injected in the basic blocks of the current subgraph, in
+  // the order of their accesses.
+  std::vector<InlineCheck> injected_inline_checks_;
+
   // Controls the rate at which reads/writes are instrumented. This is
   // implemented using random sampling.
   double instrumentation_rate_;
@@ -283,6 +345,16 @@ class AsanTransform
     remove_redundant_checks_ = remove_redundant_checks;
   }
 
+  bool coalesce_checks() const { return coalesce_checks_; }
+  void set_coalesce_checks(bool coalesce_checks) {
+    coalesce_checks_ = coalesce_checks;
+  }
+
+  bool inline_checks() const { return inline_checks_; }
+  void set_inline_checks(bool inline_checks) {
+    inline_checks_ = inline_checks;
+  }
+
   // The instrumentation rate must be in the range [0, 1], inclusive.
   double instrumentation_rate() const { return instrumentation_rate_; }
   void set_instrumentation_rate(double instrumentation_rate);
@@ -309,6 +381,30 @@ class AsanTransform
     hot_patching_ = hot_patching;
   }
 
+  // The number of threads used to instrument the code blocks. If this is
+  // greater than 1 the blocks are collected in OnBlock and instrumented in
+  // parallel in PostBlockGraphIteration. This is ignored in hot patching mode.
+  size_t parallel_thread_count() const { return parallel_thread_count_; }
+  void set_parallel_thread_count(size_t parallel_thread_count) {
+    parallel_thread_count_ = parallel_thread_count;
+  }
+
+  // The directory of the persistent cache of instrumented blocks. The cache
+  // is disabled if this is empty, which is the default. It is also disabled
+  // in hot patching mode, when a filter is used and when the instrumentation
+  // rate is less than 1, as the instrumentation of a block then depends on
+  // more than its contents.
+  const base::FilePath& block_cache_directory() const {
+    return block_cache_directory_;
+  }
+  void set_block_cache_directory(const base::FilePath& directory) {
+    block_cache_directory_ = directory;
+  }
+
+  // @returns the cache of instrumented blocks, or NULL if it is disabled.
+  //     This is valid after a successful PreBlockGraphIteration.
+  const BlockTransformCache* block_cache() const { return block_cache_.get(); }
+
   // The name of the DLL that is imported by default if hot patching mode is
   // inactive.
   static const char kSyzyAsanDll[];
@@ -346,6 +442,18 @@ class AsanTransform
   bool ShouldSkipBlock(const TransformPolicyInterface* policy,
                        BlockGraph::Block* block);
 
+  // Creates the basic-block transform used to instrument a block, configured
+  // according to the settings of this transform.
+  // @param block The block to be instrumented.
+  // @returns a new transform, owned by the caller.
+  AsanBasicBlockTransform* CreateBasicBlockTransform(BlockGraph::Block* block);
+
+  // Sets up the cache of instrumented blocks, if it is enabled. This must be
+  // called once the check access hooks have been imported.
+  // @param block_graph The block graph being instrumented.
+  // @returns true on success, false otherwise.
+  bool InitBlockCache(const BlockGraph* block_graph);
+
   // @name PE-specific methods.
   // @{
   // Finds statically linked functions that need to be intercepted. Called in
@@ -398,6 +506,14 @@ class AsanTransform
   // memory checks added by this transform.
   bool remove_redundant_checks_;
 
+  // When activated, adjacent accesses through the same base register are
+  // checked with a single range check.
+  bool coalesce_checks_;
+
+  // When activated, the shadow byte of the accesses is checked inline when
+  // possible, and the hooks are only called when it isn't zero.
+  bool inline_checks_;
+
   // Set iff we should use the functions interceptors.
   bool use_interceptors_;
 
@@ -416,6 +532,10 @@ class AsanTransform
   // successful PreBlockGraphIteration.
   AsanBasicBlockTransform::AsanHookMap check_access_hooks_ref_;
 
+  // Reference to the import entry of the runtime's inline check shadow. Valid
+  // after successful PreBlockGraphIteration in PE mode with inline checks.
+  BlockGraph::Reference inline_check_shadow_ref_;
+
   // Block containing any injected runtime parameters. Valid in PE mode after
   // a successful PostBlockGraphIteration. This is a unittesting seam.
   block_graph::BlockGraph::Block* asan_parameters_block_;
@@ -440,6 +560,20 @@ class AsanTransform
   // metadata stream in the PostBlockGraphIteration.
   std::vector<BlockGraph::Block*> hot_patched_blocks_;
 
+  // The number of threads used to instrument the code blocks.
+  size_t parallel_thread_count_;
+
+  // The blocks collected by OnBlock to be instrumented in parallel in
+  // PostBlockGraphIteration. This is also used to collect the blocks that
+  // aren't found in the block cache.
+  block_graph::BlockVector parallel_blocks_;
+
+  // The directory of the cache of instrumented blocks.
+  base::FilePath block_cache_directory_;
+
+  // The cache of instrumented blocks. This is NULL if it is disabled.
+  std::unique_ptr<BlockTransformCache> block_cache_;
+
  private:
   DISALLOW_COPY_AND_ASSIGN(AsanTransform);
 };
@@ -66,6 +66,7 @@ typedef AsanBasicBlockTransform::AsanHookMapEntryKey HookMapEntryKey;
 class TestAsanBasicBlockTransform : public AsanBasicBlockTransform {
  public:
   using AsanBasicBlockTransform::InstrumentBasicBlock;
+  using AsanBasicBlockTransform::SplitInlineChecks;
 
   explicit TestAsanBasicBlockTransform(AsanHookMap* hooks_check_access)
       : AsanBasicBlockTransform(hooks_check_access) {
@@ -83,6 +84,7 @@ class TestAsanTransform : public AsanTransform {
   using AsanTransform::heap_init_blocks_;
   using AsanTransform::hot_patched_blocks_;
   using AsanTransform::static_intercepted_blocks_;
+  using AsanTransform::parallel_blocks_;
   using AsanTransform::use_interceptors_;
   using AsanTransform::use_liveness_analysis_;
   using AsanTransform::CoffInterceptFunctions;
@@ -169,6 +171,16 @@ class AsanTransformTest : public testing::TestDllTransformTest {
                  false);
     }
 
+    // Initialize the range check hooks.
+    AddHookRef("asan_check_range_read_access",
+               AsanBasicBlockTransform::kRangeReadAccess, 0, 0, true);
+    AddHookRef("asan_check_range_read_access_no_flags",
+               AsanBasicBlockTransform::kRangeReadAccess, 0, 0, false);
+    AddHookRef("asan_check_range_write_access",
+               AsanBasicBlockTransform::kRangeWriteAccess, 0, 0, true);
+    AddHookRef("asan_check_range_write_access_no_flags",
+               AsanBasicBlockTransform::kRangeWriteAccess, 0, 0, false);
+
     const _InstructionType strings[] = {I_CMPS, I_LODS, I_MOVS, I_STOS};
     int strings_length = arraysize(strings);
 
@@ -261,6 +273,36 @@ TEST_F(AsanTransformTest, SetAsanParameters) {
   EXPECT_EQ(null, asan_transform_.asan_parameters());
 }
 
+TEST_F(AsanTransformTest, SetCoalesceChecksFlag) {
+  EXPECT_FALSE(asan_transform_.coalesce_checks());
+  asan_transform_.set_coalesce_checks(true);
+  EXPECT_TRUE(asan_transform_.coalesce_checks());
+  asan_transform_.set_coalesce_checks(false);
+  EXPECT_FALSE(asan_transform_.coalesce_checks());
+
+  TestAsanBasicBlockTransform bb_transform(&hooks_check_access_ref_);
+  EXPECT_FALSE(bb_transform.coalesce_checks());
+  bb_transform.set_coalesce_checks(true);
+  EXPECT_TRUE(bb_transform.coalesce_checks());
+  bb_transform.set_coalesce_checks(false);
+  EXPECT_FALSE(bb_transform.coalesce_checks());
+}
+
+TEST_F(AsanTransformTest, SetInlineChecksFlag) {
+  EXPECT_FALSE(asan_transform_.inline_checks());
+  asan_transform_.set_inline_checks(true);
+  EXPECT_TRUE(asan_transform_.inline_checks());
+  asan_transform_.set_inline_checks(false);
+  EXPECT_FALSE(asan_transform_.inline_checks());
+
+  TestAsanBasicBlockTransform bb_transform(&hooks_check_access_ref_);
+  EXPECT_FALSE(bb_transform.inline_checks());
+  bb_transform.set_inline_checks(true);
+  EXPECT_TRUE(bb_transform.inline_checks());
+  bb_transform.set_inline_checks(false);
+  EXPECT_FALSE(bb_transform.inline_checks());
+}
+
 TEST_F(AsanTransformTest, SetDryRunFlag) {
   TestAsanBasicBlockTransform bb_transform(&hooks_check_access_ref_);
   EXPECT_FALSE(bb_transform.dry_run());
@@ -363,6 +405,63 @@ TEST_F(AsanTransformTest, ApplyAsanTransformPE) {
       &asan_transform_, policy_, &block_graph_, header_block_));
 }
 
+TEST_F(AsanTransformTest, ApplyAsanTransformPEInParallel) {
+  ASSERT_NO_FATAL_FAILURE(DecomposeTestDll());
+
+  asan_transform_.use_interceptors_ = true;
+  asan_transform_.set_parallel_thread_count(4);
+  ASSERT_TRUE(block_graph::ApplyBlockGraphTransform(
+      &asan_transform_, policy_, &block_graph_, header_block_));
+  EXPECT_TRUE(asan_transform_.parallel_blocks_.empty());
+}
+
+TEST_F(AsanTransformTest, ApplyAsanTransformPEWithBlockCache) {
+  base::FilePath cache_dir;
+  ASSERT_NO_FATAL_FAILURE(CreateTemporaryDir(&cache_dir));
+
+  // The first instrumentation populates the cache.
+  ASSERT_NO_FATAL_FAILURE(DecomposeTestDll());
+  asan_transform_.set_block_cache_directory(cache_dir);
+  ASSERT_TRUE(block_graph::ApplyBlockGraphTransform(
+      &asan_transform_, policy_, &block_graph_, header_block_));
+  const BlockTransformCache* first_cache = asan_transform_.block_cache();
+  ASSERT_TRUE(first_cache != NULL);
+  EXPECT_EQ(0u, first_cache->hit_count());
+  EXPECT_LT(0u, first_cache->store_count());
+
+  // Instrumenting the same image again should take every block that was
+  // stored from the cache, and produce the same code.
+  BlockGraph block_graph;
+  pe::ImageLayout layout(&block_graph);
+  pe::Decomposer decomposer(pe_file_);
+  ASSERT_TRUE(decomposer.Decompose(&layout));
+  BlockGraph::Block* header_block =
+      layout.blocks.GetBlockByAddress(core::RelativeAddress(0));
+  ASSERT_TRUE(header_block != NULL);
+
+  TestAsanTransform asan_transform;
+  asan_transform.set_block_cache_directory(cache_dir);
+  ASSERT_TRUE(block_graph::ApplyBlockGraphTransform(
+      &asan_transform, policy_, &block_graph, header_block));
+  const BlockTransformCache* second_cache = asan_transform.block_cache();
+  ASSERT_TRUE(second_cache != NULL);
+  EXPECT_EQ(first_cache->store_count(), second_cache->hit_count());
+  EXPECT_EQ(first_cache->miss_count() - first_cache->store_count(),
+            second_cache->miss_count());
+
+  size_t first_code_size = 0;
+  for (const auto& entry : block_graph_.blocks()) {
+    if (entry.second.type() == BlockGraph::CODE_BLOCK)
+      first_code_size += entry.second.size();
+  }
+  size_t second_code_size = 0;
+  for (const auto& entry : block_graph.blocks()) {
+    if (entry.second.type() == BlockGraph::CODE_BLOCK)
+      second_code_size += entry.second.size();
+  }
+  EXPECT_EQ(first_code_size, second_code_size);
+}
+
 TEST_F(AsanTransformTest, ApplyAsanTransformCoff) {
   ASSERT_NO_FATAL_FAILURE(DecomposeTestDllObj());
 
@@ -634,6 +733,286 @@ TEST_F(AsanTransformTest, InstrumentAndRemoveRedundantChecks) {
   ASSERT_EQ(basic_block_->instructions().size(), expected_instructions_count);
 }
 
+TEST_F(AsanTransformTest, InstrumentAndCoalesceChecks) {
+  // Adjacent reads through ECX, covering the bytes [ecx + 4, ecx + 16).
+  bb_asm_->mov(assm::eax,
+               block_graph::Operand(assm::ecx, block_graph::Displacement(12)));
+  bb_asm_->mov(assm::ebx,
+               block_graph::Operand(assm::ecx, block_graph::Displacement(8)));
+  bb_asm_->mov(assm::edx,
+               block_graph::Operand(assm::ecx, block_graph::Displacement(4)));
+  // A write through ECX isn't coalesced with the reads.
+  bb_asm_->mov(block_graph::Operand(assm::ecx, block_graph::Displacement(16)),
+               assm::edx);
+
+  // Instrument this basic block.
+  InitHooksRefs();
+  TestAsanBasicBlockTransform bb_transform(&hooks_check_access_ref_);
+  bb_transform.set_coalesce_checks(true);
+  ASSERT_TRUE(bb_transform.InstrumentBasicBlock(
+      basic_block_,
+      AsanBasicBlockTransform::kSafeStackAccess,
+      BlockGraph::PE_IMAGE));
+  EXPECT_TRUE(bb_transform.instrumentation_happened());
+
+  // The reads are covered by a single range check of 4 instructions, and the
+  // write gets a regular check of 3 instructions.
+  ASSERT_EQ(4U + 4U + 3U, basic_block_->instructions().size());
+
+  BasicBlock::Instructions::const_iterator iter_inst =
+      basic_block_->instructions().begin();
+  ASSERT_EQ(I_PUSH, (iter_inst++)->representation().opcode);
+  ASSERT_EQ(I_LEA, iter_inst->representation().opcode);
+  EXPECT_EQ(4U, iter_inst->representation().disp);
+  ++iter_inst;
+  ASSERT_EQ(I_PUSH, iter_inst->representation().opcode);
+  EXPECT_EQ(12U, iter_inst->representation().imm.dword);
+  ++iter_inst;
+  ASSERT_EQ(1U, iter_inst->references().size());
+  HookMapEntryKey range_read_key =
+      { AsanBasicBlockTransform::kRangeReadAccess, 0, 0, true };
+  ASSERT_EQ(hooks_check_access_[range_read_key],
+            iter_inst->references().begin()->second.block());
+  ASSERT_EQ(I_CALL, (iter_inst++)->representation().opcode);
+  ASSERT_EQ(I_MOV, (iter_inst++)->representation().opcode);
+  ASSERT_EQ(I_MOV, (iter_inst++)->representation().opcode);
+  ASSERT_EQ(I_MOV, (iter_inst++)->representation().opcode);
+
+  ASSERT_EQ(I_PUSH, (iter_inst++)->representation().opcode);
+  ASSERT_EQ(I_LEA, (iter_inst++)->representation().opcode);
+  HookMapEntryKey check_4_byte_write_key =
+      { AsanBasicBlockTransform::kWriteAccess, 4, 0, true };
+  ASSERT_EQ(hooks_check_access_[check_4_byte_write_key],
+            iter_inst->references().begin()->second.block());
+  ASSERT_EQ(I_CALL, (iter_inst++)->representation().opcode);
+  ASSERT_EQ(I_MOV, (iter_inst++)->representation().opcode);
+
+  ASSERT_TRUE(iter_inst == basic_block_->instructions().end());
+}
+
+TEST_F(AsanTransformTest, CoalescedChecksOfTheSameByte) {
+  // cmp byte ptr [eax], 0
+  static const uint8_t kCmpByte[] = { 0x80, 0x38, 0x00 };
+  // mov cl, byte ptr [eax]
+  static const uint8_t kMovByte[] = { 0x8A, 0x08 };
+  ASSERT_TRUE(AddInstructionFromBuffer(kCmpByte, sizeof(kCmpByte)));
+  ASSERT_TRUE(AddInstructionFromBuffer(kMovByte, sizeof(kMovByte)));
+
+  // Instrument this basic block.
+  InitHooksRefs();
+  TestAsanBasicBlockTransform bb_transform(&hooks_check_access_ref_);
+  bb_transform.set_coalesce_checks(true);
+  ASSERT_TRUE(bb_transform.InstrumentBasicBlock(
+      basic_block_,
+      AsanBasicBlockTransform::kSafeStackAccess,
+      BlockGraph::PE_IMAGE));
+  EXPECT_TRUE(bb_transform.instrumentation_happened());
+
+  // Both reads are of the same byte, so they are covered by a single regular
+  // 1-byte check rather than by a range check.
+  ASSERT_EQ(3U + 2U, basic_block_->instructions().size());
+
+  BasicBlock::Instructions::const_iterator iter_inst =
+      basic_block_->instructions().begin();
+  ASSERT_EQ(I_PUSH, (iter_inst++)->representation().opcode);
+  ASSERT_EQ(I_LEA, (iter_inst++)->representation().opcode);
+  ASSERT_EQ(1U, iter_inst->references().size());
+  HookMapEntryKey check_1_byte_read_key =
+      { AsanBasicBlockTransform::kReadAccess, 1, 0, true };
+  ASSERT_EQ(hooks_check_access_[check_1_byte_read_key],
+            iter_inst->references().begin()->second.block());
+  ASSERT_EQ(I_CALL, (iter_inst++)->representation().opcode);
+  ASSERT_EQ(I_CMP, (iter_inst++)->representation().opcode);
+  ASSERT_EQ(I_MOV, (iter_inst++)->representation().opcode);
+
+  ASSERT_TRUE(iter_inst == basic_block_->instructions().end());
+}
+
+TEST_F(AsanTransformTest, CoalescedChecksAreSplit) {
+  uint32_t instrumentable_instructions = 0;
+
+  // These accesses aren't contiguous.
+  bb_asm_->mov(assm::eax, block_graph::Operand(assm::ecx));
+  instrumentable_instructions++;
+  bb_asm_->mov(assm::eax,
+               block_graph::Operand(assm::ecx, block_graph::Displacement(8)));
+  instrumentable_instructions++;
+  // The base register is modified between these accesses.
+  bb_asm_->mov(assm::eax, block_graph::Operand(assm::ebx));
+  instrumentable_instructions++;
+  bb_asm_->lea(assm::ebx,
+               block_graph::Operand(assm::ebx, block_graph::Displacement(4)));
+  bb_asm_->mov(assm::eax, block_graph::Operand(assm::ebx));
+  instrumentable_instructions++;
+  // A call may change the state of the memory.
+  bb_asm_->mov(assm::eax, block_graph::Operand(assm::esi));
+  instrumentable_instructions++;
+  bb_asm_->call(block_graph::Operand(assm::edi));
+  instrumentable_instructions++;
+  bb_asm_->mov(assm::eax,
+               block_graph::Operand(assm::esi, block_graph::Displacement(4)));
+  instrumentable_instructions++;
+
+  uint32_t expected_instructions_count =
+      basic_block_->instructions().size() + 3 * instrumentable_instructions;
+  // Instrument this basic block.
+  InitHooksRefs();
+  TestAsanBasicBlockTransform bb_transform(&hooks_check_access_ref_);
+  bb_transform.set_coalesce_checks(true);
+  ASSERT_TRUE(bb_transform.InstrumentBasicBlock(
+      basic_block_,
+      AsanBasicBlockTransform::kSafeStackAccess,
+      BlockGraph::PE_IMAGE));
+  EXPECT_TRUE(bb_transform.instrumentation_happened());
+  ASSERT_EQ(basic_block_->instructions().size(), expected_instructions_count);
+}
+
+TEST_F(AsanTransformTest, InstrumentWithInlineChecks) {
+  // The flags and EDX are dead before the read, and EAX is overwritten by it.
+  bb_asm_->mov(assm::eax,
+               block_graph::Operand(assm::ecx, block_graph::Displacement(8)));
+  bb_asm_->xor(assm::edx, assm::edx);
+
+  // Instrument this basic block.
+  InitHooksRefs();
+  block_graph_.set_image_format(BlockGraph::PE_IMAGE);
+  BlockGraph::Block* shadow_import =
+      block_graph_.AddBlock(BlockGraph::DATA_BLOCK, 4, "shadow_import");
+  TestAsanBasicBlockTransform bb_transform(&hooks_check_access_ref_);
+  bb_transform.set_use_liveness_analysis(true);
+  bb_transform.set_inline_checks(true);
+  bb_transform.set_inline_check_shadow(
+      BlockGraph::Reference(BlockGraph::ABSOLUTE_REF, 4, shadow_import, 0, 0));
+  ASSERT_TRUE(bb_transform.TransformBasicBlockSubGraph(
+      &pe_policy_, &block_graph_, &subgraph_));
+  EXPECT_TRUE(bb_transform.instrumentation_happened());
+
+  // The basic block was split in the fast path, the access and the slow path.
+  ASSERT_EQ(1U, subgraph_.block_descriptions().size());
+  const BasicBlockSubGraph::BasicBlockOrdering& order =
+      subgraph_.block_descriptions().front().basic_block_order;
+  ASSERT_EQ(3U, order.size());
+  BasicBlockSubGraph::BasicBlockOrdering::const_iterator order_it =
+      order.begin();
+  ASSERT_EQ(basic_block_, *order_it);
+  BasicCodeBlock* access_bb = BasicCodeBlock::Cast(*(++order_it));
+  BasicCodeBlock* slow_path_bb = BasicCodeBlock::Cast(*(++order_it));
+  ASSERT_NE(static_cast<BasicCodeBlock*>(NULL), access_bb);
+  ASSERT_NE(static_cast<BasicCodeBlock*>(NULL), slow_path_bb);
+
+  // The fast path uses the dead registers, and doesn't save anything.
+  ASSERT_EQ(12U, basic_block_->instructions().size());
+  BasicBlock::Instructions::const_iterator iter_inst =
+      basic_block_->instructions().begin();
+  ASSERT_EQ(I_LEA, (iter_inst++)->representation().opcode);
+  ASSERT_EQ(I_MOV, iter_inst->representation().opcode);
+  ASSERT_EQ(1U, iter_inst->references().size());
+  EXPECT_EQ(shadow_import, iter_inst->references().begin()->second.block());
+  ++iter_inst;
+  ASSERT_EQ(I_SHR, (iter_inst++)->representation().opcode);
+  ASSERT_EQ(I_PUSH, (iter_inst++)->representation().opcode);
+  ASSERT_EQ(I_AND, (iter_inst++)->representation().opcode);
+  ASSERT_EQ(I_ADD, (iter_inst++)->representation().opcode);
+  ASSERT_EQ(I_MOVZX, (iter_inst++)->representation().opcode);
+  // The addresses beyond the shadow take the slow path.
+  ASSERT_EQ(I_MOV, (iter_inst++)->representation().opcode);
+  ASSERT_EQ(I_XOR, (iter_inst++)->representation().opcode);
+  ASSERT_EQ(I_AND, (iter_inst++)->representation().opcode);
+  ASSERT_EQ(I_ADD, (iter_inst++)->representation().opcode);
+  ASSERT_EQ(I_POP, (iter_inst++)->representation().opcode);
+
+  ASSERT_EQ(2U, basic_block_->successors().size());
+  const block_graph::Successor& fast = basic_block_->successors().front();
+  const block_graph::Successor& slow = basic_block_->successors().back();
+  EXPECT_EQ(block_graph::Successor::kConditionEqual, fast.condition());
+  EXPECT_EQ(access_bb, fast.reference().basic_block());
+  EXPECT_EQ(block_graph::Successor::kConditionNotEqual, slow.condition());
+  EXPECT_EQ(slow_path_bb, slow.reference().basic_block());
+
+  // The slow path calls the hook that doesn't save the flags.
+  ASSERT_EQ(3U, slow_path_bb->instructions().size());
+  iter_inst = slow_path_bb->instructions().begin();
+  ASSERT_EQ(I_PUSH, (iter_inst++)->representation().opcode);
+  ASSERT_EQ(I_LEA, (iter_inst++)->representation().opcode);
+  HookMapEntryKey check_4_byte_read_key =
+      { AsanBasicBlockTransform::kReadAccess, 4, 0, false };
+  ASSERT_EQ(hooks_check_access_[check_4_byte_read_key],
+            iter_inst->references().begin()->second.block());
+  ASSERT_EQ(I_CALL, (iter_inst++)->representation().opcode);
+  ASSERT_EQ(1U, slow_path_bb->successors().size());
+  EXPECT_EQ(block_graph::Successor::kConditionTrue,
+            slow_path_bb->successors().front().condition());
+  EXPECT_EQ(access_bb,
+            slow_path_bb->successors().front().reference().basic_block());
+
+  // The access and the rest of the original basic block follow.
+  ASSERT_EQ(2U, access_bb->instructions().size());
+  ASSERT_EQ(I_MOV, access_bb->instructions().front().representation().opcode);
+  ASSERT_EQ(I_XOR, access_bb->instructions().back().representation().opcode);
+  EXPECT_TRUE(access_bb->successors().empty());
+}
+
+TEST_F(AsanTransformTest, InlineChecksSaveLiveRegisters) {
+  // The flags are dead before the read, and EAX is overwritten by it. ECX is
+  // the next candidate register and is live.
+  bb_asm_->mov(assm::eax,
+               block_graph::Operand(assm::ecx, block_graph::Displacement(8)));
+  bb_asm_->test(assm::ebx, assm::ebx);
+
+  InitHooksRefs();
+  block_graph_.set_image_format(BlockGraph::PE_IMAGE);
+  BlockGraph::Block* shadow_import =
+      block_graph_.AddBlock(BlockGraph::DATA_BLOCK, 4, "shadow_import");
+  TestAsanBasicBlockTransform bb_transform(&hooks_check_access_ref_);
+  bb_transform.set_use_liveness_analysis(true);
+  bb_transform.set_inline_checks(true);
+  bb_transform.set_inline_check_shadow(
+      BlockGraph::Reference(BlockGraph::ABSOLUTE_REF, 4, shadow_import, 0, 0));
+  ASSERT_TRUE(bb_transform.TransformBasicBlockSubGraph(
+      &pe_policy_, &block_graph_, &subgraph_));
+
+  // ECX is saved around the fast path.
+  ASSERT_EQ(14U, basic_block_->instructions().size());
+  EXPECT_EQ(I_PUSH,
+            basic_block_->instructions().front().representation().opcode);
+  EXPECT_EQ(I_POP,
+            basic_block_->instructions().back().representation().opcode);
+  EXPECT_EQ(2U, basic_block_->successors().size());
+  EXPECT_EQ(3U, subgraph_.block_descriptions().front().basic_block_order.size());
+}
+
+TEST_F(AsanTransformTest, NoInlineCheckWhenFlagsAreLive) {
+  // The flags are live at the end of the basic block.
+  bb_asm_->mov(assm::eax,
+               block_graph::Operand(assm::ecx, block_graph::Displacement(8)));
+
+  InitHooksRefs();
+  block_graph_.set_image_format(BlockGraph::PE_IMAGE);
+  BlockGraph::Block* shadow_import =
+      block_graph_.AddBlock(BlockGraph::DATA_BLOCK, 4, "shadow_import");
+  TestAsanBasicBlockTransform bb_transform(&hooks_check_access_ref_);
+  bb_transform.set_use_liveness_analysis(true);
+  bb_transform.set_inline_checks(true);
+  bb_transform.set_inline_check_shadow(
+      BlockGraph::Reference(BlockGraph::ABSOLUTE_REF, 4, shadow_import, 0, 0));
+  ASSERT_TRUE(bb_transform.TransformBasicBlockSubGraph(
+      &pe_policy_, &block_graph_, &subgraph_));
+
+  // The regular check is used, and the basic block isn't split.
+  ASSERT_EQ(4U, basic_block_->instructions().size());
+  EXPECT_EQ(1U, subgraph_.block_descriptions().front().basic_block_order.size());
+  BasicBlock::Instructions::const_iterator iter_inst =
+      basic_block_->instructions().begin();
+  ASSERT_EQ(I_PUSH, (iter_inst++)->representation().opcode);
+  ASSERT_EQ(I_LEA, (iter_inst++)->representation().opcode);
+  HookMapEntryKey check_4_byte_read_key =
+      { AsanBasicBlockTransform::kReadAccess, 4, 0, true };
+  ASSERT_EQ(hooks_check_access_[check_4_byte_read_key],
+            iter_inst->references().begin()->second.block());
+  ASSERT_EQ(I_CALL, (iter_inst++)->representation().opcode);
+  ASSERT_EQ(I_MOV, (iter_inst++)->representation().opcode);
+}
+
 TEST_F(AsanTransformTest, NonInstrumentableStackBasedInstructions) {
   // DEC DWORD [EBP - 0x2830]
   static const uint8_t kDec1[6] = {0xff, 0x8d, 0xd0, 0xd7, 0xff, 0xff};
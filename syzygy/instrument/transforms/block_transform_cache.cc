@@ -0,0 +1,558 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/instrument/transforms/block_transform_cache.h"
+
+#include <iterator>
+#include <set>
+
+#include "base/logging.h"
+#include "base/md5.h"
+#include "base/files/file_util.h"
+#include "syzygy/block_graph/block_hash.h"
+#include "syzygy/block_graph/block_util.h"
+#include "syzygy/core/serialization.h"
+#include "syzygy/version/syzygy_version.h"
+
+namespace instrument {
+namespace transforms {
+
+namespace {
+
+using block_graph::BlockGraph;
+using block_graph::BlockInfo;
+
+typedef BlockGraph::Block::SourceRanges SourceRanges;
+
+// The magic number at the start of every cache entry.
+const uint32_t kEntryMagic = 0x43425A53;  // 'SZBC'.
+
+// The kinds of targets of a cached reference.
+enum CachedReferenceTarget : uint8_t {
+  // The block itself.
+  kSelfTarget,
+  // The target of a reference of the original block.
+  kOriginalTarget,
+  // An external target provided by the transform.
+  kExternalTarget,
+};
+
+// A reference of a cached block.
+struct CachedReference {
+  template<class OutArchive> bool Save(OutArchive* out_archive) const {
+    return out_archive->Save(source_offset) &&
+        out_archive->Save(type) &&
+        out_archive->Save(size) &&
+        out_archive->Save(target) &&
+        out_archive->Save(index) &&
+        out_archive->Save(offset) &&
+        out_archive->Save(base);
+  }
+
+  template<class InArchive> bool Load(InArchive* in_archive) {
+    return in_archive->Load(&source_offset) &&
+        in_archive->Load(&type) &&
+        in_archive->Load(&size) &&
+        in_archive->Load(&target) &&
+        in_archive->Load(&index) &&
+        in_archive->Load(&offset) &&
+        in_archive->Load(&base);
+  }
+
+  int32_t source_offset;
+  uint8_t type;
+  uint32_t size;
+  uint8_t target;
+  // The index of the original reference or of the external target.
+  uint32_t index;
+  // For external targets the offset and base are relative to the offset of
+  // the target.
+  int32_t offset;
+  int32_t base;
+};
+
+// A label of a cached block.
+struct CachedLabel {
+  template<class OutArchive> bool Save(OutArchive* out_archive) const {
+    return out_archive->Save(offset) &&
+        out_archive->Save(name) &&
+        out_archive->Save(attributes);
+  }
+
+  template<class InArchive> bool Load(InArchive* in_archive) {
+    return in_archive->Load(&offset) &&
+        in_archive->Load(&name) &&
+        in_archive->Load(&attributes);
+  }
+
+  int32_t offset;
+  std::string name;
+  uint32_t attributes;
+};
+
+// A source range of a cached block. The source addresses are relative to the
+// start of the first source range of the original block.
+struct CachedSourceRange {
+  template<class OutArchive> bool Save(OutArchive* out_archive) const {
+    return out_archive->Save(data_offset) &&
+        out_archive->Save(data_size) &&
+        out_archive->Save(source_offset) &&
+        out_archive->Save(source_size);
+  }
+
+  template<class InArchive> bool Load(InArchive* in_archive) {
+    return in_archive->Load(&data_offset) &&
+        in_archive->Load(&data_size) &&
+        in_archive->Load(&source_offset) &&
+        in_archive->Load(&source_size);
+  }
+
+  int32_t data_offset;
+  uint32_t data_size;
+  uint32_t source_offset;
+  uint32_t source_size;
+};
+
+// A cached transformed block.
+struct CacheEntry {
+  template<class OutArchive> bool Save(OutArchive* out_archive) const {
+    return out_archive->Save(kEntryMagic) &&
+        out_archive->Save(BlockTransformCache::kVersion) &&
+        out_archive->Save(original_reference_count) &&
+        out_archive->Save(size) &&
+        out_archive->Save(alignment) &&
+        out_archive->Save(attributes) &&
+        out_archive->Save(data) &&
+        out_archive->Save(references) &&
+        out_archive->Save(labels) &&
+        out_archive->Save(source_ranges) &&
+        out_archive->Save(locations);
+  }
+
+  template<class InArchive> bool Load(InArchive* in_archive) {
+    uint32_t magic = 0;
+    uint32_t version = 0;
+    if (!in_archive->Load(&magic) || magic != kEntryMagic ||
+        !in_archive->Load(&version) ||
+        version != BlockTransformCache::kVersion) {
+      return false;
+    }
+    return in_archive->Load(&original_reference_count) &&
+        in_archive->Load(&size) &&
+        in_archive->Load(&alignment) &&
+        in_archive->Load(&attributes) &&
+        in_archive->Load(&data) &&
+        in_archive->Load(&references) &&
+        in_archive->Load(&labels) &&
+        in_archive->Load(&source_ranges) &&
+        in_archive->Load(&locations);
+  }
+
+  uint32_t original_reference_count;
+  uint32_t size;
+  uint32_t alignment;
+  uint32_t attributes;
+  std::vector<uint8_t> data;
+  std::vector<CachedReference> references;
+  std::vector<CachedLabel> labels;
+  std::vector<CachedSourceRange> source_ranges;
+  // Maps the offsets of the basic blocks of the original block to their
+  // offsets in the transformed block.
+  std::map<int32_t, int32_t> locations;
+};
+
+template<typename T>
+void MD5UpdateValue(base::MD5Context* context, const T& value) {
+  base::MD5Update(context, base::StringPiece(
+      reinterpret_cast<const char*>(&value), sizeof(value)));
+}
+
+// Updates @p context with @p str, preceded by its length so that consecutive
+// strings can't be confused with one another.
+void MD5UpdateString(base::MD5Context* context, const std::string& str) {
+  MD5UpdateValue(context, static_cast<uint32_t>(str.size()));
+  base::MD5Update(context, str);
+}
+
+// @returns the offsets at which @p block is referred to.
+std::set<BlockGraph::Offset> GetReferredOffsets(
+    const BlockGraph::Block* block) {
+  std::set<BlockGraph::Offset> offsets;
+  BlockGraph::Block::ReferrerSet::const_iterator it =
+      block->referrers().begin();
+  for (; it != block->referrers().end(); ++it) {
+    BlockGraph::Reference ref;
+    bool found = it->first->GetReference(it->second, &ref);
+    DCHECK(found);
+    offsets.insert(ref.base());
+  }
+  return offsets;
+}
+
+bool ReadEntry(const base::FilePath& path, CacheEntry* entry) {
+  DCHECK_NE(static_cast<CacheEntry*>(nullptr), entry);
+
+  std::string contents;
+  if (!base::ReadFileToString(path, &contents))
+    return false;
+
+  core::ScopedInStreamPtr in_stream(
+      core::CreateByteInStream(contents.begin(), contents.end()));
+  core::NativeBinaryInArchive in_archive(in_stream.get());
+  if (!entry->Load(&in_archive)) {
+    LOG(WARNING) << "Ignoring invalid cache entry: " << path.value();
+    return false;
+  }
+
+  return true;
+}
+
+bool WriteEntry(const base::FilePath& path, const CacheEntry& entry) {
+  std::vector<uint8_t> contents;
+  core::ScopedOutStreamPtr out_stream(
+      core::CreateByteOutStream(std::back_inserter(contents)));
+  core::NativeBinaryOutArchive out_archive(out_stream.get());
+  if (!entry.Save(&out_archive) || !out_archive.Flush())
+    return false;
+
+  // Write to a temporary file first so that concurrent users of the cache
+  // never see a partial entry.
+  base::FilePath temp_path;
+  if (!base::CreateTemporaryFileInDir(path.DirName(), &temp_path))
+    return false;
+  int size = static_cast<int>(contents.size());
+  if (base::WriteFile(temp_path, reinterpret_cast<const char*>(
+          contents.data()), size) != size ||
+      !base::ReplaceFile(temp_path, path, NULL)) {
+    base::DeleteFile(temp_path, false);
+    return false;
+  }
+
+  return true;
+}
+
+}  // namespace
+
+const uint32_t BlockTransformCache::kVersion = 2;
+
+BlockTransformCache::BlockTransformCache(const base::FilePath& directory,
+                                         const base::StringPiece& parameters)
+    : directory_(directory),
+      parameters_(parameters.as_string()),
+      hit_count_(0),
+      miss_count_(0),
+      store_count_(0) {
+}
+
+bool BlockTransformCache::Init() {
+  if (!base::CreateDirectory(directory_)) {
+    LOG(ERROR) << "Unable to create cache directory: " << directory_.value();
+    return false;
+  }
+  return true;
+}
+
+void BlockTransformCache::set_external_targets(
+    const std::vector<BlockGraph::Reference>& targets) {
+  external_targets_ = targets;
+  external_target_map_.clear();
+  for (size_t i = 0; i < targets.size(); ++i) {
+    external_target_map_.insert(std::make_pair(
+        std::make_pair(targets[i].referenced(), targets[i].offset()), i));
+  }
+}
+
+bool BlockTransformCache::Apply(BlockGraph::Block* block) {
+  DCHECK_NE(static_cast<BlockGraph::Block*>(nullptr), block);
+
+  CacheEntry entry;
+  if (!ReadEntry(GetEntryPath(block), &entry) ||
+      entry.original_reference_count != block->references().size()) {
+    ++miss_count_;
+    return false;
+  }
+
+  // Resolve the references of the cached block.
+  std::vector<BlockGraph::Reference> original_refs;
+  original_refs.reserve(block->references().size());
+  BlockGraph::Block::ReferenceMap::const_iterator ref_it =
+      block->references().begin();
+  for (; ref_it != block->references().end(); ++ref_it)
+    original_refs.push_back(ref_it->second);
+
+  std::vector<std::pair<BlockGraph::Offset, BlockGraph::Reference>> refs;
+  refs.reserve(entry.references.size());
+  for (size_t i = 0; i < entry.references.size(); ++i) {
+    const CachedReference& cached = entry.references[i];
+    BlockGraph::ReferenceType type =
+        static_cast<BlockGraph::ReferenceType>(cached.type);
+    BlockGraph::Block* referenced = NULL;
+    BlockGraph::Offset offset = cached.offset;
+    BlockGraph::Offset base = cached.base;
+    switch (cached.target) {
+      case kSelfTarget:
+        referenced = block;
+        break;
+      case kOriginalTarget:
+        if (cached.index >= original_refs.size())
+          break;
+        referenced = original_refs[cached.index].referenced();
+        offset = original_refs[cached.index].offset();
+        base = original_refs[cached.index].base();
+        break;
+      case kExternalTarget:
+        if (cached.index >= external_targets_.size())
+          break;
+        referenced = external_targets_[cached.index].referenced();
+        offset += external_targets_[cached.index].offset();
+        base += external_targets_[cached.index].offset();
+        break;
+    }
+    if (referenced == NULL) {
+      ++miss_count_;
+      return false;
+    }
+    refs.push_back(std::make_pair(
+        cached.source_offset,
+        BlockGraph::Reference(type, cached.size, referenced, offset, base)));
+  }
+
+  // Every referrer must land on a basic block.
+  BlockGraph::Block::ReferrerSet referrers;
+  BlockGraph::Block::ReferrerSet::const_iterator referrer_it =
+      block->referrers().begin();
+  for (; referrer_it != block->referrers().end(); ++referrer_it) {
+    if (referrer_it->first == block)
+      continue;
+    BlockGraph::Reference ref;
+    bool found = referrer_it->first->GetReference(referrer_it->second, &ref);
+    DCHECK(found);
+    if (entry.locations.find(ref.base()) == entry.locations.end()) {
+      ++miss_count_;
+      return false;
+    }
+    referrers.insert(*referrer_it);
+  }
+
+  // The source ranges are relative to the start of the original block.
+  bool has_source_ranges = !block->source_ranges().empty();
+  core::RelativeAddress source_start;
+  if (has_source_ranges)
+    source_start = block->source_ranges().range_pair(0).second.start();
+
+  // Replace the contents of the block.
+  block->RemoveAllReferences();
+  while (!block->labels().empty())
+    block->RemoveLabel(block->labels().begin()->first);
+  block->SetData(NULL, 0);
+  block->set_size(entry.size);
+  block->CopyData(entry.data.size(), entry.data.data());
+  block->set_alignment(entry.alignment);
+  block->set_attributes(entry.attributes);
+
+  block->source_ranges().clear();
+  if (has_source_ranges) {
+    for (size_t i = 0; i < entry.source_ranges.size(); ++i) {
+      const CachedSourceRange& range = entry.source_ranges[i];
+      block->source_ranges().Push(
+          BlockGraph::Block::DataRange(range.data_offset, range.data_size),
+          BlockGraph::Block::SourceRange(source_start + range.source_offset,
+                                         range.source_size));
+    }
+  }
+
+  for (size_t i = 0; i < refs.size(); ++i)
+    block->SetReference(refs[i].first, refs[i].second);
+
+  for (size_t i = 0; i < entry.labels.size(); ++i) {
+    const CachedLabel& label = entry.labels[i];
+    block->SetLabel(label.offset, label.name, label.attributes);
+  }
+
+  // Redirect the referrers to the new location of the basic blocks.
+  for (referrer_it = referrers.begin(); referrer_it != referrers.end();
+       ++referrer_it) {
+    BlockGraph::Reference old_ref;
+    bool found = referrer_it->first->GetReference(referrer_it->second,
+                                                  &old_ref);
+    DCHECK(found);
+    BlockGraph::Offset offset = entry.locations[old_ref.base()];
+    BlockGraph::Reference new_ref(old_ref.type(), old_ref.size(), block,
+                                  offset, offset);
+    referrer_it->first->SetReference(referrer_it->second, new_ref);
+  }
+
+  ++hit_count_;
+  return true;
+}
+
+void BlockTransformCache::Store(const BlockGraph::Block* original_block,
+                                const BasicBlockLocationMap& locations) {
+  DCHECK_NE(static_cast<BlockGraph::Block*>(nullptr), original_block);
+
+  if (locations.empty())
+    return;
+
+  // Only blocks that were transformed into a single block can be cached.
+  const BlockGraph::Block* block = locations.begin()->second.first;
+  CacheEntry entry;
+  BasicBlockLocationMap::const_iterator location_it = locations.begin();
+  for (; location_it != locations.end(); ++location_it) {
+    if (location_it->second.first != block)
+      return;
+    entry.locations[location_it->first] = location_it->second.second;
+  }
+
+  entry.original_reference_count =
+      static_cast<uint32_t>(original_block->references().size());
+  entry.size = static_cast<uint32_t>(block->size());
+  entry.alignment = static_cast<uint32_t>(block->alignment());
+  entry.attributes = block->attributes();
+  entry.data.assign(block->data(), block->data() + block->data_size());
+
+  // Index the references of the original block by their target.
+  typedef std::map<std::pair<const BlockGraph::Block*,
+                             std::pair<BlockGraph::Offset, BlockGraph::Offset>>,
+                   uint32_t> OriginalTargetMap;
+  OriginalTargetMap original_targets;
+  BlockGraph::Block::ReferenceMap::const_iterator ref_it =
+      original_block->references().begin();
+  for (uint32_t i = 0; ref_it != original_block->references().end();
+       ++ref_it, ++i) {
+    const BlockGraph::Reference& ref = ref_it->second;
+    original_targets.insert(std::make_pair(
+        std::make_pair(ref.referenced(),
+                       std::make_pair(ref.offset(), ref.base())), i));
+  }
+
+  for (ref_it = block->references().begin();
+       ref_it != block->references().end(); ++ref_it) {
+    const BlockGraph::Reference& ref = ref_it->second;
+    CachedReference cached = {};
+    cached.source_offset = ref_it->first;
+    cached.type = static_cast<uint8_t>(ref.type());
+    cached.size = static_cast<uint32_t>(ref.size());
+    cached.offset = ref.offset();
+    cached.base = ref.base();
+
+    ExternalTargetMap::const_iterator external_it =
+        external_target_map_.find(std::make_pair(ref.referenced(),
+                                                 ref.offset()));
+    OriginalTargetMap::const_iterator original_it = original_targets.find(
+        std::make_pair(ref.referenced(),
+                       std::make_pair(ref.offset(), ref.base())));
+    if (ref.referenced() == block) {
+      cached.target = kSelfTarget;
+    } else if (external_it != external_target_map_.end()) {
+      const BlockGraph::Reference& target =
+          external_targets_[external_it->second];
+      cached.target = kExternalTarget;
+      cached.index = static_cast<uint32_t>(external_it->second);
+      cached.offset -= target.offset();
+      cached.base -= target.offset();
+    } else if (original_it != original_targets.end()) {
+      cached.target = kOriginalTarget;
+      cached.index = original_it->second;
+    } else {
+      VLOG(1) << "Not caching " << BlockInfo(original_block)
+              << " as it has a reference to an unknown target.";
+      return;
+    }
+    entry.references.push_back(cached);
+  }
+
+  BlockGraph::Block::LabelMap::const_iterator label_it =
+      block->labels().begin();
+  for (; label_it != block->labels().end(); ++label_it) {
+    CachedLabel label = { label_it->first, label_it->second.name(),
+                          label_it->second.attributes() };
+    entry.labels.push_back(label);
+  }
+
+  if (!original_block->source_ranges().empty()) {
+    core::RelativeAddress source_start =
+        original_block->source_ranges().range_pair(0).second.start();
+    SourceRanges::RangePairs::const_iterator range_it =
+        block->source_ranges().range_pairs().begin();
+    for (; range_it != block->source_ranges().range_pairs().end();
+         ++range_it) {
+      if (range_it->second.start() < source_start)
+        return;
+      CachedSourceRange range = {
+          range_it->first.start(),
+          static_cast<uint32_t>(range_it->first.size()),
+          static_cast<uint32_t>(range_it->second.start() - source_start),
+          static_cast<uint32_t>(range_it->second.size()) };
+      entry.source_ranges.push_back(range);
+    }
+  }
+
+  if (!WriteEntry(GetEntryPath(original_block), entry)) {
+    LOG(WARNING) << "Unable to write cache entry for "
+                 << BlockInfo(original_block) << ".";
+    return;
+  }
+
+  ++store_count_;
+}
+
+base::FilePath BlockTransformCache::GetEntryPath(
+    const BlockGraph::Block* block) const {
+  DCHECK_NE(static_cast<BlockGraph::Block*>(nullptr), block);
+
+  // The key covers everything that influences the basic-block decomposition
+  // of the block, as well as the parameters of the transform and the version
+  // of the toolchain that implements them.
+  base::MD5Context context;
+  base::MD5Init(&context);
+  block_graph::BlockHash hash(block);
+  MD5UpdateValue(&context, hash.md5_digest);
+  MD5UpdateValue(&context, block->attributes());
+
+  BlockGraph::Block::LabelMap::const_iterator label_it =
+      block->labels().begin();
+  for (; label_it != block->labels().end(); ++label_it) {
+    MD5UpdateValue(&context, label_it->first);
+    MD5UpdateValue(&context, label_it->second.attributes());
+    MD5UpdateString(&context, label_it->second.name());
+  }
+
+  // The decomposition also depends on the blocks that are referred to, e.g.
+  // a call to a non-returning function ends its basic block.
+  BlockGraph::Block::ReferenceMap::const_iterator ref_it =
+      block->references().begin();
+  for (; ref_it != block->references().end(); ++ref_it) {
+    const BlockGraph::Block* target = ref_it->second.referenced();
+    MD5UpdateValue(&context, ref_it->first);
+    MD5UpdateValue(&context, target->type());
+    MD5UpdateValue(&context, target->attributes());
+    MD5UpdateString(&context, target->name());
+  }
+
+  std::set<BlockGraph::Offset> referred_offsets(GetReferredOffsets(block));
+  std::set<BlockGraph::Offset>::const_iterator offset_it =
+      referred_offsets.begin();
+  for (; offset_it != referred_offsets.end(); ++offset_it)
+    MD5UpdateValue(&context, *offset_it);
+
+  base::MD5Update(&context, parameters_);
+  MD5UpdateString(&context, version::kSyzygyVersion.GetVersionString());
+
+  base::MD5Digest digest;
+  base::MD5Final(&digest, &context);
+  return directory_.AppendASCII(base::MD5DigestToBase16(digest));
+}
+
+}  // namespace transforms
+}  // namespace instrument
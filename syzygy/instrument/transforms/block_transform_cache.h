@@ -0,0 +1,140 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares a persistent, content-addressed cache of the results of
+// basic-block transforms. Instrumenting the same image repeatedly with the
+// same parameters transforms identical blocks over and over; this cache
+// allows the previously transformed version of a block to be spliced
+// straight into the block graph instead.
+//
+// Entries are stored one per file in a cache directory. They are keyed by
+// the content of the original block (its BlockHash, attributes, labels, the
+// offsets at which it is referred to and the name, type and attributes of
+// the blocks it refers to, all of which influence its basic-block
+// decomposition), by a string describing the transform and its parameters,
+// and by the version of the toolchain, so that a new toolchain never uses
+// the entries of an older one.
+//
+// The references of a cached block are stored symbolically, so that they can
+// be resolved in a different block graph:
+//   - references to the block itself;
+//   - references that are copies of a reference of the original block, which
+//     are identified by the index of that reference;
+//   - references to external targets that were added by the transform, such
+//     as instrumentation hooks, which are identified by their index in a list
+//     provided by the transform.
+// Blocks whose references don't fit these categories aren't cached.
+
+#ifndef SYZYGY_INSTRUMENT_TRANSFORMS_BLOCK_TRANSFORM_CACHE_H_
+#define SYZYGY_INSTRUMENT_TRANSFORMS_BLOCK_TRANSFORM_CACHE_H_
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "base/files/file_path.h"
+#include "base/strings/string_piece.h"
+#include "syzygy/block_graph/block_graph.h"
+#include "syzygy/block_graph/transform.h"
+
+namespace instrument {
+namespace transforms {
+
+class BlockTransformCache {
+ public:
+  typedef block_graph::BlockGraph BlockGraph;
+  typedef block_graph::BasicBlockLocationMap BasicBlockLocationMap;
+
+  // The version of the cache entries. Entries of other versions are ignored.
+  static const uint32_t kVersion;
+
+  // Constructor.
+  // @param directory the directory in which the cache entries are stored.
+  // @param parameters a string identifying the transform and all of the
+  //     parameters that influence the way it transforms a block. Only entries
+  //     that were stored with the same parameters are used.
+  BlockTransformCache(const base::FilePath& directory,
+                      const base::StringPiece& parameters);
+
+  // Creates the cache directory if it doesn't exist yet.
+  // @returns true on success, false otherwise.
+  bool Init();
+
+  // Sets the external targets of the references that the transform adds to
+  // the blocks. These must be provided in the same order from one use of the
+  // cache to the next.
+  // @param targets the external targets.
+  void set_external_targets(const std::vector<BlockGraph::Reference>& targets);
+
+  // Looks up the transformed version of a block in the cache and, if found,
+  // replaces the contents of the block with it in place. The referrers of the
+  // block are updated to refer to the new location of the basic blocks they
+  // referred to.
+  // @param block the block to look up.
+  // @returns true if @p block was replaced, false if there is no usable entry
+  //     for it in the cache.
+  bool Apply(BlockGraph::Block* block);
+
+  // Stores the transformed version of a block in the cache. Failing to store
+  // an entry is not an error; the block simply won't be found next time. This
+  // is meant to be used as a block_graph::BasicBlockSubGraphMergeCallback.
+  // @param original_block the original block, which must still be intact.
+  // @param locations the locations of the basic blocks of @p original_block
+  //     once transformed.
+  void Store(const BlockGraph::Block* original_block,
+             const BasicBlockLocationMap& locations);
+
+  // @name Accessors.
+  // @{
+  const base::FilePath& directory() const { return directory_; }
+  size_t hit_count() const { return hit_count_; }
+  size_t miss_count() const { return miss_count_; }
+  size_t store_count() const { return store_count_; }
+  // @}
+
+ protected:
+  // @param block a block.
+  // @returns the path of the cache entry for @p block.
+  base::FilePath GetEntryPath(const BlockGraph::Block* block) const;
+
+  // The directory in which the entries are stored.
+  base::FilePath directory_;
+
+  // The parameters of the transform.
+  std::string parameters_;
+
+  // The external targets of the transformed blocks.
+  std::vector<BlockGraph::Reference> external_targets_;
+
+  // Maps the external targets to their index in external_targets_.
+  typedef std::map<std::pair<const BlockGraph::Block*, BlockGraph::Offset>,
+                   size_t> ExternalTargetMap;
+  ExternalTargetMap external_target_map_;
+
+  // @name Statistics.
+  // @{
+  size_t hit_count_;
+  size_t miss_count_;
+  size_t store_count_;
+  // @}
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(BlockTransformCache);
+};
+
+}  // namespace transforms
+}  // namespace instrument
+
+#endif  // SYZYGY_INSTRUMENT_TRANSFORMS_BLOCK_TRANSFORM_CACHE_H_
@@ -0,0 +1,286 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/instrument/transforms/block_transform_cache.h"
+
+#include "base/bind.h"
+#include "gtest/gtest.h"
+#include "syzygy/block_graph/basic_block_assembler.h"
+#include "syzygy/block_graph/unittest_util.h"
+#include "syzygy/common/unittest_util.h"
+
+namespace instrument {
+namespace transforms {
+
+namespace {
+
+using block_graph::BasicBlockSubGraph;
+using block_graph::BasicBlockSubGraphTransformInterface;
+using block_graph::BasicCodeBlock;
+using block_graph::BlockGraph;
+using block_graph::BlockVector;
+using block_graph::TransformPolicyInterface;
+
+// A function with a single basic block that calls another function.
+const uint8_t kFunctionBytes[] = {
+    0x55,                          // push ebp
+    0x8B, 0xEC,                    // mov ebp, esp
+    0xE8, 0x00, 0x00, 0x00, 0x00,  // call other
+    0x5D,                          // pop ebp
+    0xC3                           // ret
+};
+const BlockGraph::Offset kOffsetOfCallTarget = 4;
+
+const uint8_t kRetBytes[] = { 0xC3 };
+
+// A transform that inserts a call to a hook at the start of every basic code
+// block.
+class CallHookTransform : public BasicBlockSubGraphTransformInterface {
+ public:
+  explicit CallHookTransform(BlockGraph::Block* hook) : hook_(hook) {
+  }
+
+  const char* name() const override { return "CallHookTransform"; }
+
+  bool TransformBasicBlockSubGraph(const TransformPolicyInterface* policy,
+                                   BlockGraph* block_graph,
+                                   BasicBlockSubGraph* subgraph) override {
+    BasicBlockSubGraph::BBCollection::iterator it =
+        subgraph->basic_blocks().begin();
+    for (; it != subgraph->basic_blocks().end(); ++it) {
+      BasicCodeBlock* bb = BasicCodeBlock::Cast(*it);
+      if (bb == NULL)
+        continue;
+      block_graph::BasicBlockAssembler assm(bb->instructions().begin(),
+                                            &bb->instructions());
+      assm.call(block_graph::Immediate(hook_, 0));
+    }
+    return true;
+  }
+
+  static BasicBlockSubGraphTransformInterface* Create(
+      BlockGraph::Block* hook, BlockGraph::Block* block) {
+    return new CallHookTransform(hook);
+  }
+
+ private:
+  BlockGraph::Block* hook_;
+};
+
+// The blocks of a test image.
+struct TestImage {
+  BlockGraph block_graph;
+  BlockGraph::Block* function;
+  BlockGraph::Block* other;
+  BlockGraph::Block* hook;
+  BlockGraph::Block* data;
+};
+
+class BlockTransformCacheTest : public testing::ApplicationTestBase {
+ public:
+  void SetUp() override {
+    testing::ApplicationTestBase::SetUp();
+    ASSERT_NO_FATAL_FAILURE(CreateTemporaryDir(&cache_dir_));
+  }
+
+  void BuildImage(TestImage* image) {
+    BlockGraph& block_graph = image->block_graph;
+    image->other = block_graph.AddBlock(BlockGraph::CODE_BLOCK,
+                                        sizeof(kRetBytes), "Other");
+    image->other->SetData(kRetBytes, sizeof(kRetBytes));
+    image->hook = block_graph.AddBlock(BlockGraph::CODE_BLOCK,
+                                       sizeof(kRetBytes), "Hook");
+    image->hook->SetData(kRetBytes, sizeof(kRetBytes));
+
+    image->function = block_graph.AddBlock(BlockGraph::CODE_BLOCK,
+                                           sizeof(kFunctionBytes), "Function");
+    image->function->SetData(kFunctionBytes, sizeof(kFunctionBytes));
+    ASSERT_TRUE(image->function->SetLabel(
+        0, "Function", BlockGraph::CODE_LABEL));
+    ASSERT_TRUE(image->function->SetReference(
+        kOffsetOfCallTarget,
+        BlockGraph::Reference(BlockGraph::PC_RELATIVE_REF, sizeof(uint32_t),
+                              image->other, 0, 0)));
+
+    image->data = block_graph.AddBlock(BlockGraph::DATA_BLOCK,
+                                       sizeof(uint32_t), "Data");
+    ASSERT_TRUE(image->data->SetReference(
+        0, BlockGraph::Reference(BlockGraph::ABSOLUTE_REF, sizeof(uint32_t),
+                                 image->function, 0, 0)));
+  }
+
+  std::vector<BlockGraph::Reference> Hooks(const TestImage& image) {
+    return std::vector<BlockGraph::Reference>(
+        1, BlockGraph::Reference(BlockGraph::PC_RELATIVE_REF, sizeof(uint32_t),
+                                 image.hook, 0, 0));
+  }
+
+  // Transforms the function of @p image, storing the result in @p cache.
+  // @returns the transformed function.
+  BlockGraph::Block* TransformAndStore(TestImage* image,
+                                       BlockTransformCache* cache) {
+    BlockVector new_blocks;
+    EXPECT_TRUE(block_graph::ApplyBasicBlockSubGraphTransformInParallel(
+        base::Bind(&CallHookTransform::Create, image->hook), &policy_,
+        &image->block_graph, BlockVector(1, image->function), 1,
+        base::Bind(&BlockTransformCache::Store, base::Unretained(cache)),
+        &new_blocks));
+    EXPECT_EQ(1u, new_blocks.size());
+    return new_blocks.empty() ? NULL : new_blocks.front();
+  }
+
+ protected:
+  testing::DummyTransformPolicy policy_;
+  base::FilePath cache_dir_;
+};
+
+}  // namespace
+
+TEST_F(BlockTransformCacheTest, StoreAndApply) {
+  TestImage first;
+  ASSERT_NO_FATAL_FAILURE(BuildImage(&first));
+  BlockTransformCache first_cache(cache_dir_, "parameters");
+  ASSERT_TRUE(first_cache.Init());
+  first_cache.set_external_targets(Hooks(first));
+
+  // The cache is empty.
+  EXPECT_FALSE(first_cache.Apply(first.function));
+  EXPECT_EQ(0u, first_cache.hit_count());
+  EXPECT_EQ(1u, first_cache.miss_count());
+
+  BlockGraph::Block* transformed = TransformAndStore(&first, &first_cache);
+  ASSERT_TRUE(transformed != NULL);
+  EXPECT_EQ(1u, first_cache.store_count());
+  EXPECT_LT(sizeof(kFunctionBytes), transformed->size());
+
+  // A new image with the same contents should be found in the cache.
+  TestImage second;
+  ASSERT_NO_FATAL_FAILURE(BuildImage(&second));
+  BlockTransformCache second_cache(cache_dir_, "parameters");
+  ASSERT_TRUE(second_cache.Init());
+  second_cache.set_external_targets(Hooks(second));
+  ASSERT_TRUE(second_cache.Apply(second.function));
+  EXPECT_EQ(1u, second_cache.hit_count());
+  EXPECT_EQ(0u, second_cache.miss_count());
+
+  // The function should have been replaced in place by the transformed one.
+  ASSERT_EQ(transformed->size(), second.function->size());
+  ASSERT_EQ(transformed->data_size(), second.function->data_size());
+  EXPECT_EQ(0, ::memcmp(transformed->data(), second.function->data(),
+                        transformed->data_size()));
+  EXPECT_EQ(transformed->labels().size(), second.function->labels().size());
+
+  // Its references should have been resolved in the new image.
+  ASSERT_EQ(transformed->references().size(),
+            second.function->references().size());
+  BlockGraph::Block::ReferenceMap::const_iterator it =
+      transformed->references().begin();
+  BlockGraph::Block::ReferenceMap::const_iterator second_it =
+      second.function->references().begin();
+  for (; it != transformed->references().end(); ++it, ++second_it) {
+    EXPECT_EQ(it->first, second_it->first);
+    EXPECT_EQ(it->second.type(), second_it->second.type());
+    EXPECT_EQ(it->second.offset(), second_it->second.offset());
+    if (it->second.referenced() == first.hook)
+      EXPECT_EQ(second.hook, second_it->second.referenced());
+    else
+      EXPECT_EQ(second.other, second_it->second.referenced());
+  }
+
+  // Its referrers should refer to the new location of the basic blocks.
+  BlockGraph::Reference first_ref;
+  BlockGraph::Reference second_ref;
+  ASSERT_TRUE(first.data->GetReference(0, &first_ref));
+  ASSERT_TRUE(second.data->GetReference(0, &second_ref));
+  EXPECT_EQ(second.function, second_ref.referenced());
+  EXPECT_EQ(first_ref.offset(), second_ref.offset());
+}
+
+TEST_F(BlockTransformCacheTest, ParametersArePartOfTheKey) {
+  TestImage first;
+  ASSERT_NO_FATAL_FAILURE(BuildImage(&first));
+  BlockTransformCache first_cache(cache_dir_, "parameters");
+  ASSERT_TRUE(first_cache.Init());
+  first_cache.set_external_targets(Hooks(first));
+  ASSERT_TRUE(TransformAndStore(&first, &first_cache) != NULL);
+  EXPECT_EQ(1u, first_cache.store_count());
+
+  TestImage second;
+  ASSERT_NO_FATAL_FAILURE(BuildImage(&second));
+  BlockTransformCache second_cache(cache_dir_, "other parameters");
+  ASSERT_TRUE(second_cache.Init());
+  second_cache.set_external_targets(Hooks(second));
+  EXPECT_FALSE(second_cache.Apply(second.function));
+  EXPECT_EQ(1u, second_cache.miss_count());
+  EXPECT_EQ(sizeof(kFunctionBytes), second.function->size());
+}
+
+TEST_F(BlockTransformCacheTest, ContentsArePartOfTheKey) {
+  TestImage first;
+  ASSERT_NO_FATAL_FAILURE(BuildImage(&first));
+  BlockTransformCache first_cache(cache_dir_, "parameters");
+  ASSERT_TRUE(first_cache.Init());
+  first_cache.set_external_targets(Hooks(first));
+  ASSERT_TRUE(TransformAndStore(&first, &first_cache) != NULL);
+
+  // Referring to the function at another offset changes its decomposition.
+  TestImage second;
+  ASSERT_NO_FATAL_FAILURE(BuildImage(&second));
+  ASSERT_TRUE(second.data->SetReference(
+      0, BlockGraph::Reference(BlockGraph::ABSOLUTE_REF, sizeof(uint32_t),
+                               second.function, 1, 1)));
+  BlockTransformCache second_cache(cache_dir_, "parameters");
+  second_cache.set_external_targets(Hooks(second));
+  EXPECT_FALSE(second_cache.Apply(second.function));
+  EXPECT_EQ(1u, second_cache.miss_count());
+}
+
+TEST_F(BlockTransformCacheTest, LabelNamesArePartOfTheKey) {
+  TestImage first;
+  ASSERT_NO_FATAL_FAILURE(BuildImage(&first));
+  BlockTransformCache first_cache(cache_dir_, "parameters");
+  ASSERT_TRUE(first_cache.Init());
+  first_cache.set_external_targets(Hooks(first));
+  ASSERT_TRUE(TransformAndStore(&first, &first_cache) != NULL);
+
+  TestImage second;
+  ASSERT_NO_FATAL_FAILURE(BuildImage(&second));
+  ASSERT_TRUE(second.function->RemoveLabel(0));
+  ASSERT_TRUE(second.function->SetLabel(0, "Renamed", BlockGraph::CODE_LABEL));
+  BlockTransformCache second_cache(cache_dir_, "parameters");
+  second_cache.set_external_targets(Hooks(second));
+  EXPECT_FALSE(second_cache.Apply(second.function));
+  EXPECT_EQ(1u, second_cache.miss_count());
+}
+
+TEST_F(BlockTransformCacheTest, CalleeAttributesArePartOfTheKey) {
+  TestImage first;
+  ASSERT_NO_FATAL_FAILURE(BuildImage(&first));
+  BlockTransformCache first_cache(cache_dir_, "parameters");
+  ASSERT_TRUE(first_cache.Init());
+  first_cache.set_external_targets(Hooks(first));
+  ASSERT_TRUE(TransformAndStore(&first, &first_cache) != NULL);
+
+  // A call to a non-returning function ends its basic block.
+  TestImage second;
+  ASSERT_NO_FATAL_FAILURE(BuildImage(&second));
+  second.other->set_attribute(BlockGraph::NON_RETURN_FUNCTION);
+  BlockTransformCache second_cache(cache_dir_, "parameters");
+  second_cache.set_external_targets(Hooks(second));
+  EXPECT_FALSE(second_cache.Apply(second.function));
+  EXPECT_EQ(1u, second_cache.miss_count());
+}
+
+}  // namespace transforms
+}  // namespace instrument
@@ -27,6 +27,9 @@ namespace detail {
 template <MsfFileType T>
 class MsfByteStreamImpl : public MsfStreamImpl<T> {
  public:
+  typedef typename MsfStreamImpl<T>::Span Span;
+  typedef typename MsfStreamImpl<T>::Spans Spans;
+
   MsfByteStreamImpl();
 
   // Initializes the stream from the contents of a byte array.
@@ -42,6 +45,7 @@ class MsfByteStreamImpl : public MsfStreamImpl<T> {
   // @{
   bool ReadBytesAt(size_t pos, size_t count, void* dest) override;
   scoped_refptr<WritableMsfStreamImpl<T>> GetWritableStream() override;
+  bool GetSpans(size_t pos, size_t count, Spans* spans) const override;
   // @}
 
   // Gets the stream's data pointer.
@@ -114,6 +114,21 @@ bool MsfByteStreamImpl<T>::ReadBytesAt(size_t pos, size_t count, void* dest) {
   return true;
 }
 
+template <MsfFileType T>
+bool MsfByteStreamImpl<T>::GetSpans(size_t pos,
+                                    size_t count,
+                                    Spans* spans) const {
+  DCHECK(spans != NULL);
+
+  spans->clear();
+  if (pos > length() || count > length() - pos)
+    return false;
+
+  if (count > 0)
+    spans->push_back(Span(data_.data() + pos, count));
+  return true;
+}
+
 template <MsfFileType T>
 scoped_refptr<WritableMsfStreamImpl<T>>
 MsfByteStreamImpl<T>::GetWritableStream() {
@@ -113,6 +113,25 @@ TEST(MsfByteStreamTest, ReadBytesAt) {
   }
 }
 
+TEST(MsfByteStreamTest, GetSpans) {
+  uint8_t data[] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13};
+  scoped_refptr<MsfByteStream> stream(new MsfByteStream());
+  EXPECT_TRUE(stream->Init(data, arraysize(data)));
+
+  // The stream is in memory, so any range is a single span.
+  MsfStream::Spans spans;
+  ASSERT_TRUE(stream->GetSpans(2, 10, &spans));
+  ASSERT_EQ(1u, spans.size());
+  EXPECT_EQ(stream->data() + 2, spans[0].first);
+  EXPECT_EQ(10u, spans[0].second);
+
+  ASSERT_TRUE(stream->GetSpans(sizeof(data), 0, &spans));
+  EXPECT_TRUE(spans.empty());
+
+  EXPECT_FALSE(stream->GetSpans(10, 5, &spans));
+  EXPECT_FALSE(stream->GetSpans(sizeof(data) + 1, 0, &spans));
+}
+
 TEST(MsfByteStreamTest, GetWritableStream) {
   scoped_refptr<MsfStream> stream(new MsfByteStream());
   scoped_refptr<WritableMsfStream> writer1 = stream->GetWritableStream();
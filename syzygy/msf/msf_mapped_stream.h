@@ -0,0 +1,133 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SYZYGY_MSF_MSF_MAPPED_STREAM_H_
+#define SYZYGY_MSF_MSF_MAPPED_STREAM_H_
+
+#include <vector>
+
+#include "base/files/memory_mapped_file.h"
+#include "base/memory/ref_counted.h"
+#include "syzygy/msf/msf_decl.h"
+#include "syzygy/msf/msf_stream.h"
+
+namespace msf {
+
+// A reference counted read-only mapping of a file. Unlike RefCountedFILE this
+// has no cursor, so the streams that share it may be read from several
+// threads at once.
+class RefCountedMappedFile
+    : public base::RefCountedThreadSafe<RefCountedMappedFile> {
+ public:
+  RefCountedMappedFile() {}
+
+  // Maps a file.
+  // @param path the file to map.
+  // @returns true on success, false otherwise.
+  bool Initialize(const base::FilePath& path) {
+    return file_.Initialize(path);
+  }
+
+  // @name Accessors.
+  // @{
+  const uint8_t* data() const { return file_.data(); }
+  size_t length() const { return file_.length(); }
+  // @}
+
+ private:
+  friend base::RefCountedThreadSafe<RefCountedMappedFile>;
+
+  // We disallow access to the destructor to enforce the use of reference
+  // counting pointers.
+  ~RefCountedMappedFile() {}
+
+  base::MemoryMappedFile file_;
+
+  DISALLOW_COPY_AND_ASSIGN(RefCountedMappedFile);
+};
+
+namespace detail {
+
+// This class represents an MSF stream in a mapped file. Reading from it
+// copies straight from the mapping. A stream whose pages are contiguous in the
+// file is also exposed as a single pointer into the mapping, and any stream
+// can be viewed as the list of the runs of contiguous pages that it spans,
+// without copying.
+template <MsfFileType T>
+class MsfMappedStreamImpl : public MsfStreamImpl<T> {
+ public:
+  typedef typename MsfStreamImpl<T>::Span Span;
+  typedef typename MsfStreamImpl<T>::Spans Spans;
+
+  // Constructor.
+  // @param file the mapped file housing this stream.
+  // @param length the length of this stream.
+  // @param pages the indices of the pages that make up this stream in the file.
+  //     A copy is made of the data so the pointer need not remain valid
+  //     beyond the constructor. The length of this array is implicit in the
+  //     stream length and the page size.
+  // @param page_size the size of the pages, in bytes.
+  MsfMappedStreamImpl(RefCountedMappedFile* file,
+                      uint32_t length,
+                      const uint32_t* pages,
+                      uint32_t page_size);
+
+  // @name MsfStreamImpl implementation. These may be called from several
+  //     threads at once.
+  // @{
+  bool ReadBytesAt(size_t pos, size_t count, void* dest) override;
+  // Consecutive pages of the stream that are adjacent in the file are merged
+  // into a single span. The spans remain valid for as long as the stream.
+  bool GetSpans(size_t pos, size_t count, Spans* spans) const override;
+  // @}
+
+  // @returns a pointer to the contents of the stream in the mapping if its
+  //     pages are contiguous, NULL otherwise. This remains valid for as long
+  //     as the stream.
+  const uint8_t* data() const { return data_; }
+
+ protected:
+  // Protected to enforce reference counted pointers at compile time.
+  virtual ~MsfMappedStreamImpl();
+
+  // @returns a pointer to the page @p page_num in the mapping, or NULL if it
+  //     lies outside of the file.
+  const uint8_t* GetPage(uint32_t page_num) const;
+
+ private:
+  // The mapping of the MSF file. This is reference counted so that streams
+  // can outlive the MsfReaderImpl that created them.
+  scoped_refptr<RefCountedMappedFile> file_;
+
+  // The list of pages in the MSF file that make up this stream.
+  std::vector<uint32_t> pages_;
+
+  // The size of pages within the stream.
+  size_t page_size_;
+
+  // The contents of the stream if its pages are contiguous, NULL otherwise.
+  const uint8_t* data_;
+
+  DISALLOW_COPY_AND_ASSIGN(MsfMappedStreamImpl);
+};
+
+}  // namespace detail
+
+using MsfMappedStream = detail::MsfMappedStreamImpl<kGenericMsfFileType>;
+
+}  // namespace msf
+
+#include "syzygy/msf/msf_mapped_stream_impl.h"
+
+#endif  // SYZYGY_MSF_MSF_MAPPED_STREAM_H_
@@ -0,0 +1,146 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Internal implementation details for msf_mapped_stream.h. Not meant to be
+// included directly.
+
+#ifndef SYZYGY_MSF_MSF_MAPPED_STREAM_IMPL_H_
+#define SYZYGY_MSF_MSF_MAPPED_STREAM_IMPL_H_
+
+#include <algorithm>
+#include <cstring>
+
+#include "base/logging.h"
+#include "syzygy/msf/msf_decl.h"
+
+namespace msf {
+namespace detail {
+
+template <MsfFileType T>
+MsfMappedStreamImpl<T>::MsfMappedStreamImpl(RefCountedMappedFile* file,
+                                            uint32_t length,
+                                            const uint32_t* pages,
+                                            uint32_t page_size)
+    : MsfStreamImpl(length), file_(file), page_size_(page_size), data_(NULL) {
+  DCHECK(file != NULL);
+  uint32_t num_pages = (length + page_size - 1) / page_size;
+  pages_.assign(pages, pages + num_pages);
+
+  // Determine whether the stream can be exposed as a single pointer.
+  if (pages_.empty())
+    return;
+  for (size_t i = 1; i < pages_.size(); ++i) {
+    if (pages_[i] != pages_[i - 1] + 1)
+      return;
+  }
+  const uint8_t* first_page = GetPage(pages_.front());
+  if (first_page == NULL ||
+      first_page + length > file_->data() + file_->length()) {
+    return;
+  }
+  data_ = first_page;
+}
+
+template <MsfFileType T>
+MsfMappedStreamImpl<T>::~MsfMappedStreamImpl() {
+}
+
+template <MsfFileType T>
+bool MsfMappedStreamImpl<T>::ReadBytesAt(size_t pos, size_t count, void* dest) {
+  DCHECK(dest != NULL);
+
+  // Don't read beyond the end of the known stream length.
+  if (pos > length() || count > length() - pos)
+    return false;
+
+  if (data_ != NULL) {
+    ::memcpy(dest, data_ + pos, count);
+    return true;
+  }
+
+  // Read the stream.
+  while (count > 0) {
+    size_t page_index = pos / page_size_;
+    size_t offset = pos % page_size_;
+    size_t chunk_size = std::min(count, page_size_ - offset);
+    const uint8_t* page = GetPage(pages_[page_index]);
+    if (page == NULL) {
+      LOG(ERROR) << "Page read failed";
+      return false;
+    }
+    ::memcpy(dest, page + offset, chunk_size);
+
+    count -= chunk_size;
+    pos += chunk_size;
+    dest = reinterpret_cast<uint8_t*>(dest) + chunk_size;
+  }
+
+  return true;
+}
+
+template <MsfFileType T>
+bool MsfMappedStreamImpl<T>::GetSpans(size_t pos,
+                                      size_t count,
+                                      Spans* spans) const {
+  DCHECK(spans != NULL);
+
+  spans->clear();
+  if (pos > length() || count > length() - pos)
+    return false;
+
+  if (data_ != NULL) {
+    if (count > 0)
+      spans->push_back(Span(data_ + pos, count));
+    return true;
+  }
+
+  while (count > 0) {
+    size_t page_index = pos / page_size_;
+    size_t offset = pos % page_size_;
+    size_t chunk_size = std::min(count, page_size_ - offset);
+    const uint8_t* page = GetPage(pages_[page_index]);
+    if (page == NULL) {
+      spans->clear();
+      return false;
+    }
+
+    // Extend the previous span if this chunk follows it in the mapping.
+    if (!spans->empty() &&
+        spans->back().first + spans->back().second == page + offset) {
+      spans->back().second += chunk_size;
+    } else {
+      spans->push_back(Span(page + offset, chunk_size));
+    }
+
+    count -= chunk_size;
+    pos += chunk_size;
+  }
+
+  return true;
+}
+
+template <MsfFileType T>
+const uint8_t* MsfMappedStreamImpl<T>::GetPage(uint32_t page_num) const {
+  size_t page_offset = page_size_ * page_num;
+  if (page_offset / page_size_ != page_num ||
+      page_offset + page_size_ > file_->length()) {
+    return NULL;
+  }
+  return file_->data() + page_offset;
+}
+
+}  // namespace detail
+}  // namespace msf
+
+#endif  // SYZYGY_MSF_MSF_MAPPED_STREAM_IMPL_H_
@@ -0,0 +1,136 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/msf/msf_mapped_stream.h"
+
+#include "gtest/gtest.h"
+#include "syzygy/core/unittest_util.h"
+#include "syzygy/msf/msf_constants.h"
+#include "syzygy/msf/msf_data.h"
+#include "syzygy/msf/unittest_util.h"
+
+namespace msf {
+
+namespace {
+
+class MsfMappedStreamTest : public testing::Test {
+ public:
+  virtual void SetUp() {
+    file_ = new RefCountedMappedFile();
+    ASSERT_TRUE(file_->Initialize(
+        testing::GetSrcRelativePath(testing::kTestPdbFilePath)));
+  }
+
+ protected:
+  scoped_refptr<RefCountedMappedFile> file_;
+};
+
+}  // namespace
+
+TEST_F(MsfMappedStreamTest, Constructor) {
+  uint32_t pages[] = {1, 2, 3};
+  scoped_refptr<MsfMappedStream> stream(
+      new MsfMappedStream(file_.get(), 10, pages, 8));
+  EXPECT_EQ(10, stream->length());
+}
+
+TEST_F(MsfMappedStreamTest, ReadBytesAt) {
+  // Different sections of the MSF header magic string.
+  char* test_cases[] = {"Mic", "roso", "ft", " C/C+", "+ MS", "F 7.00"};
+
+  // Test that we can read varying sizes of bytes from the header of the
+  // file with varying page sizes.
+  char buffer[8] = {0};
+  for (uint32_t page_size = 4; page_size <= 32; page_size *= 2) {
+    uint32_t pages[] = {0, 1, 2, 3, 4, 5, 6, 7};
+    scoped_refptr<MsfMappedStream> stream(new MsfMappedStream(
+        file_.get(), sizeof(MsfHeader), pages, page_size));
+
+    size_t pos = 0;
+    for (uint32_t j = 0; j < arraysize(test_cases); ++j) {
+      char* test_case = test_cases[j];
+      size_t len = strlen(test_case);
+      EXPECT_TRUE(stream->ReadBytesAt(pos, len, &buffer));
+      EXPECT_EQ(0U, ::memcmp(buffer, test_case, len));
+      pos += len;
+    }
+
+    // Try a read past the end of the stream.
+    EXPECT_FALSE(stream->ReadBytesAt(sizeof(MsfHeader) - 1, 2, buffer));
+  }
+}
+
+TEST_F(MsfMappedStreamTest, ContiguousStreamIsExposedDirectly) {
+  uint32_t pages[] = {0, 1, 2, 3};
+  scoped_refptr<MsfMappedStream> stream(
+      new MsfMappedStream(file_.get(), 16, pages, 4));
+  ASSERT_TRUE(stream->data() != NULL);
+  EXPECT_EQ(file_->data(), stream->data());
+
+  MsfMappedStream::Spans spans;
+  ASSERT_TRUE(stream->GetSpans(2, 10, &spans));
+  ASSERT_EQ(1u, spans.size());
+  EXPECT_EQ(file_->data() + 2, spans[0].first);
+  EXPECT_EQ(10u, spans[0].second);
+}
+
+TEST_F(MsfMappedStreamTest, NonContiguousStreamIsGathered) {
+  // The stream is "Micr", then "t C/", then "osof".
+  uint32_t pages[] = {0, 2, 1};
+  scoped_refptr<MsfMappedStream> stream(
+      new MsfMappedStream(file_.get(), 12, pages, 4));
+  EXPECT_TRUE(stream->data() == NULL);
+
+  char buffer[12] = {0};
+  ASSERT_TRUE(stream->ReadBytesAt(0, sizeof(buffer), buffer));
+  EXPECT_EQ(0, ::memcmp(buffer, "Micrt C/osof", sizeof(buffer)));
+
+  MsfMappedStream::Spans spans;
+  ASSERT_TRUE(stream->GetSpans(1, 10, &spans));
+  ASSERT_EQ(3u, spans.size());
+  EXPECT_EQ(file_->data() + 1, spans[0].first);
+  EXPECT_EQ(3u, spans[0].second);
+  EXPECT_EQ(file_->data() + 8, spans[1].first);
+  EXPECT_EQ(4u, spans[1].second);
+  EXPECT_EQ(file_->data() + 4, spans[2].first);
+  EXPECT_EQ(3u, spans[2].second);
+
+  // Pages that are adjacent in the file are merged into one span.
+  uint32_t adjacent_pages[] = {2, 3, 0};
+  stream = new MsfMappedStream(file_.get(), 12, adjacent_pages, 4);
+  ASSERT_TRUE(stream->GetSpans(0, 12, &spans));
+  ASSERT_EQ(2u, spans.size());
+  EXPECT_EQ(file_->data() + 8, spans[0].first);
+  EXPECT_EQ(8u, spans[0].second);
+  EXPECT_EQ(file_->data(), spans[1].first);
+  EXPECT_EQ(4u, spans[1].second);
+
+  EXPECT_FALSE(stream->GetSpans(10, 4, &spans));
+}
+
+TEST_F(MsfMappedStreamTest, PagesOutsideOfTheFileFail) {
+  uint32_t pages[] = {0, 0xFFFFFFF0};
+  scoped_refptr<MsfMappedStream> stream(
+      new MsfMappedStream(file_.get(), 8, pages, 4));
+  EXPECT_TRUE(stream->data() == NULL);
+
+  char buffer[8] = {0};
+  EXPECT_TRUE(stream->ReadBytesAt(0, 4, buffer));
+  EXPECT_FALSE(stream->ReadBytesAt(0, 8, buffer));
+
+  MsfMappedStream::Spans spans;
+  EXPECT_FALSE(stream->GetSpans(0, 8, &spans));
+}
+
+}  // namespace msf
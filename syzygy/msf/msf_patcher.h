@@ -0,0 +1,131 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares a class that writes the changes made to an MSF file back into the
+// file in place. Rewriting a whole MSF costs as much as its size, even when
+// only a few of its streams were touched; the patcher instead only writes the
+// streams that changed, followed by a new directory, free page map and header.
+//
+// A stream is considered unchanged if it is still one of the stream objects
+// that were read from the file, in which case its pages are simply referred
+// to by the new directory. Any other stream is written to pages that are free
+// in the file, or appended to it. The pages that were in use before the patch
+// are never overwritten, and the header is written last, so the file stays
+// valid if the patch is interrupted. The free page map is written to the copy
+// that isn't in use, which the new header then designates.
+//
+// Unlike MsfWriterImpl the result isn't canonical: its layout depends on the
+// layout of the original file, and free pages keep their stale contents.
+
+#ifndef SYZYGY_MSF_MSF_PATCHER_H_
+#define SYZYGY_MSF_MSF_PATCHER_H_
+
+#include <map>
+#include <set>
+#include <vector>
+
+#include "base/files/file_path.h"
+#include "base/memory/ref_counted.h"
+#include "syzygy/msf/msf_data.h"
+#include "syzygy/msf/msf_decl.h"
+#include "syzygy/msf/msf_file.h"
+#include "syzygy/msf/msf_file_stream.h"
+#include "syzygy/msf/msf_stream.h"
+
+namespace msf {
+namespace detail {
+
+template <MsfFileType T>
+class MsfPatcherImpl {
+ public:
+  MsfPatcherImpl();
+  virtual ~MsfPatcherImpl();
+
+  // Opens an MSF file for patching, populating the given MsfFileImpl object
+  // with its streams. These read from the file through the patcher's handle,
+  // so they remain valid across calls to Commit.
+  // @param msf_path the MSF file to patch. It must be writable, and must use
+  //     pages of kMsfPageSize bytes.
+  // @param msf_file the MsfFileImpl object to be filled in.
+  // @returns true on success, false otherwise.
+  bool Open(const base::FilePath& msf_path, MsfFileImpl<T>* msf_file);
+
+  // Writes the streams of the given MsfFileImpl to the open file, reusing the
+  // pages of the streams that are unchanged. This may be called repeatedly;
+  // the streams written by a commit are themselves unchanged in the next one.
+  // @param msf_file the new contents of the file. This is usually the object
+  //     passed to Open, after having been modified.
+  // @returns true on success, false otherwise.
+  // @pre Open has been successfully called.
+  bool Commit(const MsfFileImpl<T>& msf_file);
+
+  // @returns the number of pages that were written by the last commit,
+  //     including those of the directory and of the free page map.
+  uint32_t pages_written() const { return pages_written_; }
+
+ protected:
+  // Allocates a page to write to, either a free page of the file or a new
+  // page at its end.
+  // @param page receives the index of the page.
+  // @returns true on success, false otherwise.
+  bool AllocatePage(uint32_t* page);
+
+  // Writes a stream to newly allocated pages.
+  // @param stream the stream to write.
+  // @param pages receives the indices of the pages the stream was written to.
+  // @returns true on success, false otherwise.
+  bool WriteStream(MsfStreamImpl<T>* stream, std::vector<uint32_t>* pages);
+
+  // Writes whole pages to the file, coalescing the writes of consecutive
+  // pages.
+  // @param data the contents of the pages, @p count * kMsfPageSize bytes.
+  // @param pages the indices of the pages to write.
+  // @param count the number of pages to write.
+  // @returns true on success, false otherwise.
+  bool WritePages(const uint8_t* data, const uint32_t* pages, size_t count);
+
+  // The file being patched.
+  scoped_refptr<RefCountedFILE> file_;
+
+  // The header of the file as of the last commit.
+  MsfHeader header_;
+
+  // The streams of the file as of the last commit, which are kept alive so
+  // that their addresses can't be reused by other streams. Each of them maps
+  // to the pages that hold it.
+  typedef std::map<MsfStreamImpl<T>*, std::vector<uint32_t>> StreamPagesMap;
+  std::vector<scoped_refptr<MsfStreamImpl<T>>> streams_;
+  StreamPagesMap stream_pages_;
+
+  // The pages that may be written to, in increasing order, and the number of
+  // pages of the file, past which new pages are appended.
+  std::set<uint32_t> free_pages_;
+  uint32_t page_count_;
+
+  // The number of pages written by the last commit.
+  uint32_t pages_written_;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(MsfPatcherImpl);
+};
+
+}  // namespace detail
+
+using MsfPatcher = detail::MsfPatcherImpl<kGenericMsfFileType>;
+
+}  // namespace msf
+
+#include "syzygy/msf/msf_patcher_impl.h"
+
+#endif  // SYZYGY_MSF_MSF_PATCHER_H_
@@ -0,0 +1,396 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Internal implementation details for msf_patcher.h. Not meant to be included
+// directly.
+
+#ifndef SYZYGY_MSF_MSF_PATCHER_IMPL_H_
+#define SYZYGY_MSF_MSF_PATCHER_IMPL_H_
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include "base/logging.h"
+#include "base/files/file_util.h"
+#include "syzygy/msf/msf_constants.h"
+#include "syzygy/msf/msf_reader.h"
+#include "syzygy/msf/msf_writer.h"
+
+namespace msf {
+namespace detail {
+
+namespace {
+
+// @returns true if @p page_index is one of the two pages reserved for the
+//     free page map in each interval of kMsfPageSize pages.
+bool IsFreePageMapPage(uint32_t page_index) {
+  uint32_t index_in_interval = page_index % kMsfPageSize;
+  return index_in_interval == 1 || index_in_interval == 2;
+}
+
+// Reads the copy of the free page map that starts at @p first_page.
+bool ReadFreePageBitMap(uint32_t first_page,
+                        uint32_t page_count,
+                        FILE* file,
+                        FreePageBitMap* free) {
+  DCHECK(first_page == 1 || first_page == 2);
+  DCHECK(file != NULL);
+  DCHECK(free != NULL);
+
+  free->SetPageCount(page_count);
+  std::vector<uint8_t> data(kMsfPageSize);
+  uint32_t page_index = first_page;
+  for (uint32_t i = 0; i < page_count; i += kMsfPageSize * 8) {
+    if (::fseek(file, static_cast<long>(page_index * kMsfPageSize),
+                SEEK_SET) != 0 ||
+        ::fread(data.data(), 1, kMsfPageSize, file) != kMsfPageSize) {
+      LOG(ERROR) << "Failed to read page " << page_index
+                 << " of free page map.";
+      return false;
+    }
+
+    uint32_t bits = std::min(page_count - i, kMsfPageSize * 8);
+    for (uint32_t bit = 0; bit < bits; ++bit) {
+      if ((data[bit / 8] & (1 << (bit % 8))) != 0)
+        free->SetFree(i + bit);
+    }
+
+    page_index += kMsfPageSize;
+  }
+
+  return true;
+}
+
+}  // namespace
+
+template <MsfFileType T>
+MsfPatcherImpl<T>::MsfPatcherImpl() : page_count_(0), pages_written_(0) {
+  ::memset(&header_, 0, sizeof(header_));
+}
+
+template <MsfFileType T>
+MsfPatcherImpl<T>::~MsfPatcherImpl() {
+}
+
+template <MsfFileType T>
+bool MsfPatcherImpl<T>::Open(const base::FilePath& msf_path,
+                             MsfFileImpl<T>* msf_file) {
+  DCHECK(msf_file != NULL);
+
+  msf_file->Clear();
+  streams_.clear();
+  stream_pages_.clear();
+  free_pages_.clear();
+
+  file_ = new RefCountedFILE(base::OpenFile(msf_path, "r+b"));
+  if (!file_->file()) {
+    LOG(ERROR) << "Unable to open '" << msf_path.value() << "' for writing.";
+    return false;
+  }
+
+  uint32_t file_size = 0;
+  if (!GetFileSize(file_->file(), &file_size)) {
+    LOG(ERROR) << "Unable to determine size of '" << msf_path.value() << "'.";
+    return false;
+  }
+
+  // The streams read through the same handle as the one that is written to,
+  // so they see the file as it is patched.
+  std::vector<uint32_t> directory;
+  if (!MsfReaderImpl<T>::template ReadStreams<MsfFileStreamImpl<T>>(
+          file_.get(), file_size, msf_file, &header_, &directory)) {
+    LOG(ERROR) << "Failed to read '" << msf_path.value() << "'.";
+    return false;
+  }
+
+  // The layout of the free page map depends on the page size.
+  if (header_.page_size != kMsfPageSize) {
+    LOG(ERROR) << "Unable to patch an MSF with pages of " << header_.page_size
+               << " bytes.";
+    return false;
+  }
+  if (header_.free_page_map != 1 && header_.free_page_map != 2) {
+    LOG(ERROR) << "Invalid free page map in MSF header: "
+               << header_.free_page_map << ".";
+    return false;
+  }
+
+  // Remember which pages hold each stream.
+  uint32_t stream_count = directory[0];
+  const uint32_t* stream_lengths = &directory[1];
+  const uint32_t* stream_pages = &directory[1 + stream_count];
+  for (uint32_t i = 0; i < stream_count; ++i) {
+    uint32_t num_pages = GetNumPages(header_, stream_lengths[i]);
+    MsfStreamImpl<T>* stream = msf_file->GetStream(i).get();
+    streams_.push_back(stream);
+    stream_pages_[stream].assign(stream_pages, stream_pages + num_pages);
+    stream_pages += num_pages;
+  }
+
+  // Only the pages that are free according to the free page map may be
+  // written to. As some writers mark the pages of the old directory stream as
+  // free, the pages of the streams are excluded explicitly.
+  FreePageBitMap free;
+  if (!ReadFreePageBitMap(header_.free_page_map, header_.num_pages,
+                          file_->file(), &free)) {
+    return false;
+  }
+  for (uint32_t i = 1; i < header_.num_pages; ++i) {
+    if (free.IsFree(i) && !IsFreePageMapPage(i))
+      free_pages_.insert(i);
+  }
+  typename StreamPagesMap::const_iterator it = stream_pages_.begin();
+  for (; it != stream_pages_.end(); ++it) {
+    for (size_t i = 0; i < it->second.size(); ++i)
+      free_pages_.erase(it->second[i]);
+  }
+
+  page_count_ = header_.num_pages;
+  pages_written_ = 0;
+
+  return true;
+}
+
+template <MsfFileType T>
+bool MsfPatcherImpl<T>::Commit(const MsfFileImpl<T>& msf_file) {
+  DCHECK(file_.get() != NULL);
+
+  pages_written_ = 0;
+
+  // Reuse the pages of the unchanged streams, and write the others. A stream
+  // that appears more than once is only reused once, so that no page ends up
+  // in two streams.
+  std::vector<uint32_t> directory;
+  directory.push_back(static_cast<uint32_t>(msf_file.StreamCount()));
+  StreamPagesMap new_stream_pages;
+  std::vector<std::vector<uint32_t>> pages(msf_file.StreamCount());
+  for (uint32_t i = 0; i < msf_file.StreamCount(); ++i) {
+    // Null streams are treated as empty streams.
+    MsfStreamImpl<T>* stream = msf_file.GetStream(i).get();
+    if (stream == NULL) {
+      directory.push_back(0);
+      continue;
+    }
+    directory.push_back(stream->length());
+
+    typename StreamPagesMap::const_iterator it = stream_pages_.find(stream);
+    if (it != stream_pages_.end() &&
+        it->second.size() == GetNumPages(header_, stream->length()) &&
+        new_stream_pages.find(stream) == new_stream_pages.end()) {
+      pages[i] = it->second;
+    } else if (!WriteStream(stream, &pages[i])) {
+      LOG(ERROR) << "Failed to write stream " << i << ".";
+      return false;
+    }
+    new_stream_pages.insert(std::make_pair(stream, pages[i]));
+  }
+  for (size_t i = 0; i < pages.size(); ++i)
+    directory.insert(directory.end(), pages[i].begin(), pages[i].end());
+
+  // Write the directory, then the list of its pages.
+  uint32_t directory_size =
+      static_cast<uint32_t>(sizeof(directory[0]) * directory.size());
+  std::vector<uint32_t> directory_pages;
+  scoped_refptr<MsfStreamImpl<T>> directory_stream(
+      new ReadOnlyMsfStream<T>(directory.data(), directory_size));
+  if (!WriteStream(directory_stream.get(), &directory_pages)) {
+    LOG(ERROR) << "Failed to write directory.";
+    return false;
+  }
+
+  std::vector<uint32_t> root_directory_pages;
+  scoped_refptr<MsfStreamImpl<T>> root_directory_stream(
+      new ReadOnlyMsfStream<T>(
+          directory_pages.data(),
+          static_cast<uint32_t>(sizeof(directory_pages[0]) *
+                                directory_pages.size())));
+  if (!WriteStream(root_directory_stream.get(), &root_directory_pages)) {
+    LOG(ERROR) << "Failed to write root directory.";
+    return false;
+  }
+
+  MsfHeader header = header_;
+  if (root_directory_pages.size() > arraysize(header.root_pages)) {
+    LOG(ERROR) << "Too many root directory pages for header ("
+               << root_directory_pages.size() << " > "
+               << arraysize(header.root_pages) << ").";
+    return false;
+  }
+
+  // Every page that isn't referred to by the new directory is free once the
+  // new header is written.
+  FreePageBitMap free;
+  free.SetPageCount(page_count_);
+  for (uint32_t i = 1; i < page_count_; ++i) {
+    if (!IsFreePageMapPage(i))
+      free.SetFree(i);
+  }
+  for (size_t i = 1 + msf_file.StreamCount(); i < directory.size(); ++i)
+    free.SetUsed(directory[i]);
+  for (size_t i = 0; i < directory_pages.size(); ++i)
+    free.SetUsed(directory_pages[i]);
+  for (size_t i = 0; i < root_directory_pages.size(); ++i)
+    free.SetUsed(root_directory_pages[i]);
+  free.Finalize();
+
+  // Write the free page map to the copy that isn't in use.
+  uint32_t free_page_map = 3 - header_.free_page_map;
+  if (!WriteFreePageBitMap(free, free_page_map, file_->file())) {
+    LOG(ERROR) << "Failed to write free page bitmap.";
+    return false;
+  }
+  pages_written_ += static_cast<uint32_t>(
+      (free.data().size() + kMsfPageSize - 1) / kMsfPageSize);
+
+  // Everything the new header refers to must be on disk before the header.
+  if (::fflush(file_->file()) != 0) {
+    LOG(ERROR) << "Failed to flush MSF file.";
+    return false;
+  }
+
+  header.free_page_map = free_page_map;
+  header.num_pages = page_count_;
+  header.directory_size = directory_size;
+  ::memset(header.root_pages, 0, sizeof(header.root_pages));
+  ::memcpy(header.root_pages, root_directory_pages.data(),
+           sizeof(root_directory_pages[0]) * root_directory_pages.size());
+  if (::fseek(file_->file(), 0, SEEK_SET) != 0 ||
+      ::fwrite(&header, sizeof(header), 1, file_->file()) != 1 ||
+      ::fflush(file_->file()) != 0) {
+    LOG(ERROR) << "Failed to write header.";
+    return false;
+  }
+  ++pages_written_;
+
+  // The new contents of the file become the base of the next commit.
+  header_ = header;
+  streams_.clear();
+  for (uint32_t i = 0; i < msf_file.StreamCount(); ++i) {
+    if (msf_file.GetStream(i).get() != NULL)
+      streams_.push_back(msf_file.GetStream(i));
+  }
+  stream_pages_.swap(new_stream_pages);
+  free_pages_.clear();
+  for (uint32_t i = 1; i < page_count_; ++i) {
+    if (free.IsFree(i) && !IsFreePageMapPage(i))
+      free_pages_.insert(i);
+  }
+
+  return true;
+}
+
+template <MsfFileType T>
+bool MsfPatcherImpl<T>::AllocatePage(uint32_t* page) {
+  DCHECK(page != NULL);
+
+  if (!free_pages_.empty()) {
+    *page = *free_pages_.begin();
+    free_pages_.erase(free_pages_.begin());
+    return true;
+  }
+
+  // Reserve the free page map pages of a new interval before growing into
+  // it.
+  if (IsFreePageMapPage(page_count_)) {
+    DCHECK_EQ(1u, page_count_ % kMsfPageSize);
+    if (::fseek(file_->file(), static_cast<long>(page_count_ * kMsfPageSize),
+                SEEK_SET) != 0 ||
+        ::fwrite(kZeroBuffer, 1, kMsfPageSize, file_->file()) !=
+            kMsfPageSize ||
+        ::fwrite(kZeroBuffer, 1, kMsfPageSize, file_->file()) !=
+            kMsfPageSize) {
+      LOG(ERROR) << "Failed to allocate free page map pages.";
+      return false;
+    }
+    page_count_ += 2;
+  }
+
+  *page = page_count_++;
+  return true;
+}
+
+template <MsfFileType T>
+bool MsfPatcherImpl<T>::WriteStream(MsfStreamImpl<T>* stream,
+                                    std::vector<uint32_t>* pages) {
+  DCHECK(stream != NULL);
+  DCHECK(pages != NULL);
+
+  std::vector<uint8_t> buffer(kPagesPerChunk * kMsfPageSize);
+  size_t bytes_left = stream->length();
+  size_t bytes_read = 0;
+  while (bytes_left) {
+    size_t bytes_to_read = std::min(bytes_left, buffer.size());
+    if (!stream->ReadBytesAt(bytes_read, bytes_to_read, buffer.data())) {
+      LOG(ERROR) << "Failed to read " << bytes_to_read << " bytes at offset "
+                 << bytes_read << " of MSF stream.";
+      return false;
+    }
+
+    // If we've only read a partial page then pad the end of it with zeros.
+    size_t num_pages = (bytes_to_read + kMsfPageSize - 1) / kMsfPageSize;
+    ::memset(buffer.data() + bytes_to_read, 0,
+             num_pages * kMsfPageSize - bytes_to_read);
+
+    size_t first_page = pages->size();
+    for (size_t i = 0; i < num_pages; ++i) {
+      uint32_t page = 0;
+      if (!AllocatePage(&page))
+        return false;
+      pages->push_back(page);
+    }
+    if (!WritePages(buffer.data(), pages->data() + first_page, num_pages))
+      return false;
+
+    bytes_read += bytes_to_read;
+    bytes_left -= bytes_to_read;
+  }
+
+  return true;
+}
+
+template <MsfFileType T>
+bool MsfPatcherImpl<T>::WritePages(const uint8_t* data,
+                                   const uint32_t* pages,
+                                   size_t count) {
+  DCHECK(data != NULL);
+  DCHECK(pages != NULL);
+
+  size_t i = 0;
+  while (i < count) {
+    size_t run = 1;
+    while (i + run < count && pages[i + run] == pages[i] + run)
+      ++run;
+
+    if (::fseek(file_->file(), static_cast<long>(pages[i] * kMsfPageSize),
+                SEEK_SET) != 0 ||
+        ::fwrite(data + i * kMsfPageSize, kMsfPageSize, run, file_->file()) !=
+            run) {
+      LOG(ERROR) << "Failed to write page " << pages[i] << ".";
+      return false;
+    }
+
+    pages_written_ += static_cast<uint32_t>(run);
+    i += run;
+  }
+
+  return true;
+}
+
+}  // namespace detail
+}  // namespace msf
+
+#endif  // SYZYGY_MSF_MSF_PATCHER_IMPL_H_
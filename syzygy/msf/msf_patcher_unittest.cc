@@ -0,0 +1,168 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/msf/msf_patcher.h"
+
+#include <vector>
+
+#include "base/files/file_util.h"
+#include "base/files/scoped_temp_dir.h"
+#include "gtest/gtest.h"
+#include "syzygy/core/unittest_util.h"
+#include "syzygy/msf/msf_byte_stream.h"
+#include "syzygy/msf/msf_constants.h"
+#include "syzygy/msf/msf_data.h"
+#include "syzygy/msf/msf_reader.h"
+#include "syzygy/msf/unittest_util.h"
+
+namespace msf {
+
+namespace {
+
+class MsfPatcherTest : public testing::Test {
+ public:
+  void SetUp() override {
+    ASSERT_TRUE(temp_dir_.CreateUniqueTempDir());
+    path_ = temp_dir_.path().Append(L"patched.msf");
+    ASSERT_TRUE(base::CopyFile(
+        testing::GetSrcRelativePath(testing::kTestPdbFilePath), path_));
+  }
+
+  // @returns the size of the patched file.
+  int64_t GetPatchedFileSize() {
+    int64_t size = 0;
+    EXPECT_TRUE(base::GetFileSize(path_, &size));
+    return size;
+  }
+
+  // Reads the header of the patched file.
+  void ReadHeader(MsfHeader* header) {
+    base::ScopedFILE file(base::OpenFile(path_, "rb"));
+    ASSERT_TRUE(file.get() != NULL);
+    ASSERT_EQ(1u, ::fread(header, sizeof(*header), 1, file.get()));
+  }
+
+  // Checks that the patched file contains the streams of @p msf_file.
+  void ExpectPatchedFileContains(const MsfFile& msf_file) {
+    MsfReader reader;
+    MsfFile patched_file;
+    ASSERT_TRUE(reader.Read(path_, &patched_file));
+    testing::EnsureMsfContentsAreIdentical(msf_file, patched_file);
+  }
+
+  base::ScopedTempDir temp_dir_;
+  base::FilePath path_;
+};
+
+scoped_refptr<MsfByteStream> CreateStream(uint32_t length, uint8_t value) {
+  std::vector<uint8_t> data(length, value);
+  scoped_refptr<MsfByteStream> stream(new MsfByteStream());
+  EXPECT_TRUE(stream->Init(data.data(), length));
+  return stream;
+}
+
+}  // namespace
+
+TEST_F(MsfPatcherTest, OpenFailsOnMissingFile) {
+  MsfPatcher patcher;
+  MsfFile msf_file;
+  EXPECT_FALSE(patcher.Open(temp_dir_.path().Append(L"missing.msf"),
+                            &msf_file));
+}
+
+TEST_F(MsfPatcherTest, CommitUnchangedFile) {
+  MsfHeader header = {};
+  ASSERT_NO_FATAL_FAILURE(ReadHeader(&header));
+
+  MsfPatcher patcher;
+  MsfFile msf_file;
+  ASSERT_TRUE(patcher.Open(path_, &msf_file));
+  EXPECT_EQ(168u, msf_file.StreamCount());
+  ASSERT_TRUE(patcher.Commit(msf_file));
+
+  // Only the directory, the free page map and the header are written.
+  uint32_t directory_pages =
+      (header.directory_size + kMsfPageSize - 1) / kMsfPageSize;
+  EXPECT_GE(directory_pages + 3, patcher.pages_written());
+
+  MsfHeader patched_header = {};
+  ASSERT_NO_FATAL_FAILURE(ReadHeader(&patched_header));
+  EXPECT_EQ(header.directory_size, patched_header.directory_size);
+  EXPECT_EQ(3 - header.free_page_map, patched_header.free_page_map);
+
+  ASSERT_NO_FATAL_FAILURE(ExpectPatchedFileContains(msf_file));
+}
+
+TEST_F(MsfPatcherTest, CommitChangedStreams) {
+  int64_t original_size = GetPatchedFileSize();
+
+  MsfPatcher patcher;
+  MsfFile msf_file;
+  ASSERT_TRUE(patcher.Open(path_, &msf_file));
+
+  // Replace a stream, move another one and add a new one spanning several
+  // pages.
+  const uint32_t kNewStreamLength = 3 * kMsfPageSize + 17;
+  scoped_refptr<MsfStream> moved_stream = msf_file.GetStream(2);
+  msf_file.ReplaceStream(1, CreateStream(100, 0xAB).get());
+  msf_file.ReplaceStream(2, msf_file.GetStream(3).get());
+  msf_file.ReplaceStream(3, moved_stream.get());
+  msf_file.AppendStream(CreateStream(kNewStreamLength, 0xCD).get());
+  ASSERT_TRUE(patcher.Commit(msf_file));
+
+  // The moved streams aren't rewritten, and the file grows by at most the
+  // size of the new streams and of the new directory.
+  MsfHeader header = {};
+  ASSERT_NO_FATAL_FAILURE(ReadHeader(&header));
+  uint32_t directory_pages =
+      (header.directory_size + kMsfPageSize - 1) / kMsfPageSize;
+  EXPECT_GE(directory_pages + 9, patcher.pages_written());
+  EXPECT_GE(original_size + (directory_pages + 6) * kMsfPageSize,
+            GetPatchedFileSize());
+
+  ASSERT_NO_FATAL_FAILURE(ExpectPatchedFileContains(msf_file));
+}
+
+TEST_F(MsfPatcherTest, CommitRepeatedly) {
+  MsfPatcher patcher;
+  MsfFile msf_file;
+  ASSERT_TRUE(patcher.Open(path_, &msf_file));
+
+  msf_file.ReplaceStream(1, CreateStream(2 * kMsfPageSize, 0x11).get());
+  ASSERT_TRUE(patcher.Commit(msf_file));
+  ASSERT_NO_FATAL_FAILURE(ExpectPatchedFileContains(msf_file));
+
+  msf_file.ReplaceStream(1, CreateStream(2 * kMsfPageSize, 0x22).get());
+  ASSERT_TRUE(patcher.Commit(msf_file));
+  ASSERT_NO_FATAL_FAILURE(ExpectPatchedFileContains(msf_file));
+  int64_t size = GetPatchedFileSize();
+
+  // The pages freed by the previous commit are reused, so patching the same
+  // stream again doesn't grow the file.
+  msf_file.ReplaceStream(1, CreateStream(2 * kMsfPageSize, 0x33).get());
+  ASSERT_TRUE(patcher.Commit(msf_file));
+  ASSERT_NO_FATAL_FAILURE(ExpectPatchedFileContains(msf_file));
+  EXPECT_EQ(size, GetPatchedFileSize());
+
+  // The patched file can itself be patched.
+  MsfPatcher other_patcher;
+  MsfFile other_msf_file;
+  ASSERT_TRUE(other_patcher.Open(path_, &other_msf_file));
+  ASSERT_NO_FATAL_FAILURE(ExpectPatchedFileContains(other_msf_file));
+  other_msf_file.ReplaceStream(4, CreateStream(10, 0x44).get());
+  ASSERT_TRUE(other_patcher.Commit(other_msf_file));
+  ASSERT_NO_FATAL_FAILURE(ExpectPatchedFileContains(other_msf_file));
+}
+
+}  // namespace msf
@@ -15,6 +15,8 @@
 #ifndef SYZYGY_MSF_MSF_READER_H_
 #define SYZYGY_MSF_MSF_READER_H_
 
+#include <vector>
+
 #include "base/files/file_path.h"
 #include "base/files/file_util.h"
 #include "syzygy/msf/msf_constants.h"
@@ -22,11 +24,16 @@
 #include "syzygy/msf/msf_decl.h"
 #include "syzygy/msf/msf_file.h"
 #include "syzygy/msf/msf_file_stream.h"
+#include "syzygy/msf/msf_mapped_stream.h"
 #include "syzygy/msf/msf_stream.h"
 
 namespace msf {
 namespace detail {
 
+// Forward declaration.
+template <MsfFileType T>
+class MsfPatcherImpl;
+
 // This class is used to read an MSF file from disk, populating an MsfFileImpl
 // object with its streams.
 template <MsfFileType T>
@@ -46,7 +53,41 @@ class MsfReaderImpl {
   // @returns true on success, false otherwise.
   bool Read(const base::FilePath& msf_path, MsfFileImpl<T>* msf_file);
 
+  // Reads an MSF through a read-only mapping of the file, populating the
+  // given MsfFileImpl object with MsfMappedStreamImpl streams. These read
+  // straight from the mapping and may be read from several threads at once.
+  // Falls back to Read if the file can't be mapped, as happens when it doesn't
+  // fit in the address space.
+  //
+  // @note The file remains mapped for as long as any of its streams is alive,
+  //     during which it can't be overwritten.
+  //
+  // @param msf_path the MSF file to read.
+  // @param msf_file the empty MsfFileImpl object to be filled in.
+  // @returns true on success, false otherwise.
+  bool ReadMapped(const base::FilePath& msf_path, MsfFileImpl<T>* msf_file);
+
  private:
+  // Reads the header and the directory of an MSF, and appends its streams to
+  // @p msf_file.
+  // @tparam StreamType the type of the streams, which is constructed from a
+  //     FileType pointer, a length, a page list and a page size.
+  // @param file the file housing the MSF.
+  // @param file_size the size of @p file.
+  // @param msf_file the MsfFileImpl object to be filled in.
+  // @param header if not NULL, receives the header of the MSF.
+  // @param directory if not NULL, receives the directory of the MSF.
+  // @returns true on success, false otherwise.
+  template <typename StreamType, typename FileType>
+  static bool ReadStreams(FileType* file,
+                          uint32_t file_size,
+                          MsfFileImpl<T>* msf_file,
+                          MsfHeader* header = NULL,
+                          std::vector<uint32_t>* directory = NULL);
+
+  // The patcher reads the MSF it patches with ReadStreams.
+  friend class MsfPatcherImpl<T>;
+
   DISALLOW_COPY_AND_ASSIGN(MsfReaderImpl);
 };
 
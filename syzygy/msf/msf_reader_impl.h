@@ -28,6 +28,7 @@
 #include "base/strings/string_util.h"
 #include "syzygy/msf/msf_data.h"
 #include "syzygy/msf/msf_file_stream.h"
+#include "syzygy/msf/msf_mapped_stream.h"
 
 namespace msf {
 namespace detail {
@@ -81,14 +82,45 @@ bool MsfReaderImpl<T>::Read(const base::FilePath& msf_path,
     return false;
   }
 
+  return ReadStreams<MsfFileStreamImpl<T>>(file.get(), file_size, msf_file);
+}
+
+template <MsfFileType T>
+bool MsfReaderImpl<T>::ReadMapped(const base::FilePath& msf_path,
+                                  MsfFileImpl<T>* msf_file) {
+  DCHECK(msf_file != NULL);
+
+  msf_file->Clear();
+
+  scoped_refptr<RefCountedMappedFile> file(new RefCountedMappedFile());
+  if (!file->Initialize(msf_path)) {
+    VLOG(1) << "Unable to map '" << msf_path.value() << "', reading it "
+            << "instead.";
+    return Read(msf_path, msf_file);
+  }
+
+  return ReadStreams<MsfMappedStreamImpl<T>>(
+      file.get(), static_cast<uint32_t>(file->length()), msf_file);
+}
+
+template <MsfFileType T>
+template <typename StreamType, typename FileType>
+bool MsfReaderImpl<T>::ReadStreams(FileType* file,
+                                   uint32_t file_size,
+                                   MsfFileImpl<T>* msf_file,
+                                   MsfHeader* header_out,
+                                   std::vector<uint32_t>* directory_out) {
+  DCHECK(file != NULL);
+  DCHECK(msf_file != NULL);
+
   MsfHeader header = {0};
 
   // Read the header from the first page in the file. The page size we use here
   // is irrelevant as after reading the header we get the actual page size in
   // use by the MSF and from then on use that.
   uint32_t header_page = 0;
-  scoped_refptr<MsfFileStreamImpl<T>> header_stream(new MsfFileStreamImpl<T>(
-      file.get(), sizeof(header), &header_page, kMsfPageSize));
+  scoped_refptr<StreamType> header_stream(
+      new StreamType(file, sizeof(header), &header_page, kMsfPageSize));
   if (!header_stream->ReadBytesAt(0, sizeof(header), &header)) {
     LOG(ERROR) << "Failed to read MSF file header.";
     return false;
@@ -112,9 +144,9 @@ bool MsfReaderImpl<T>::Read(const base::FilePath& msf_path,
   // containing that many page pointers from the root pages array.
   int num_dir_pages =
       static_cast<int>(GetNumPages(header, header.directory_size));
-  scoped_refptr<MsfFileStreamImpl<T>> dir_page_stream(
-      new MsfFileStreamImpl<T>(file.get(), num_dir_pages * sizeof(uint32_t),
-                               header.root_pages, header.page_size));
+  scoped_refptr<StreamType> dir_page_stream(
+      new StreamType(file, num_dir_pages * sizeof(uint32_t),
+                     header.root_pages, header.page_size));
   std::unique_ptr<uint32_t[]> dir_pages(new uint32_t[num_dir_pages]);
   if (dir_pages.get() == NULL) {
     LOG(ERROR) << "Failed to allocate directory pages.";
@@ -129,8 +161,8 @@ bool MsfReaderImpl<T>::Read(const base::FilePath& msf_path,
   // Load the actual directory.
   size_t dir_size =
       static_cast<size_t>(header.directory_size / sizeof(uint32_t));
-  scoped_refptr<MsfFileStreamImpl<T>> dir_stream(new MsfFileStreamImpl<T>(
-      file.get(), header.directory_size, dir_pages.get(), header.page_size));
+  scoped_refptr<StreamType> dir_stream(new StreamType(
+      file, header.directory_size, dir_pages.get(), header.page_size));
   std::vector<uint32_t> directory(dir_size);
   if (!dir_stream->ReadBytesAt(0, dir_size * sizeof(uint32_t), &directory[0])) {
     LOG(ERROR) << "Failed to read directory stream.";
@@ -145,11 +177,16 @@ bool MsfReaderImpl<T>::Read(const base::FilePath& msf_path,
   uint32_t page_index = 0;
   for (uint32_t stream_index = 0; stream_index < num_streams; ++stream_index) {
     msf_file->AppendStream(
-        new MsfFileStreamImpl<T>(file.get(), stream_lengths[stream_index],
-                                 stream_pages + page_index, header.page_size));
+        new StreamType(file, stream_lengths[stream_index],
+                       stream_pages + page_index, header.page_size));
     page_index += GetNumPages(header, stream_lengths[stream_index]);
   }
 
+  if (header_out != NULL)
+    *header_out = header;
+  if (directory_out != NULL)
+    directory_out->swap(directory);
+
   return true;
 }
 
@@ -14,6 +14,8 @@
 
 #include "syzygy/msf/msf_reader.h"
 
+#include <vector>
+
 #include "base/path_service.h"
 #include "gtest/gtest.h"
 #include "syzygy/core/unittest_util.h"
@@ -32,4 +34,42 @@ TEST(MsfReaderTest, Read) {
   EXPECT_EQ(msf_file.StreamCount(), 168u);
 }
 
+TEST(MsfReaderTest, ReadMapped) {
+  base::FilePath test_dll_msf =
+      testing::GetSrcRelativePath(testing::kTestPdbFilePath);
+
+  MsfReader reader;
+  MsfFile msf_file;
+  MsfFile mapped_msf_file;
+  ASSERT_TRUE(reader.Read(test_dll_msf, &msf_file));
+  ASSERT_TRUE(reader.ReadMapped(test_dll_msf, &mapped_msf_file));
+  ASSERT_EQ(msf_file.StreamCount(), mapped_msf_file.StreamCount());
+
+  // The streams should have the same contents whichever way they are read.
+  for (size_t i = 0; i < msf_file.StreamCount(); ++i) {
+    scoped_refptr<MsfStream> stream = msf_file.GetStream(i);
+    scoped_refptr<MsfStream> mapped_stream = mapped_msf_file.GetStream(i);
+    ASSERT_EQ(stream.get() == NULL, mapped_stream.get() == NULL);
+    if (stream.get() == NULL)
+      continue;
+    ASSERT_EQ(stream->length(), mapped_stream->length());
+    if (stream->length() == 0)
+      continue;
+
+    std::vector<uint8_t> data(stream->length());
+    std::vector<uint8_t> mapped_data(mapped_stream->length());
+    ASSERT_TRUE(stream->ReadBytesAt(0, data.size(), data.data()));
+    ASSERT_TRUE(mapped_stream->ReadBytesAt(0, mapped_data.size(),
+                                           mapped_data.data()));
+    EXPECT_EQ(data, mapped_data);
+  }
+}
+
+TEST(MsfReaderTest, ReadMappedFailsOnMissingFile) {
+  MsfReader reader;
+  MsfFile msf_file;
+  EXPECT_FALSE(reader.ReadMapped(
+      base::FilePath(L"C:\\this\\file\\does\\not.pdb"), &msf_file));
+}
+
 }  // namespace msf
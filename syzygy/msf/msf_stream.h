@@ -15,6 +15,9 @@
 #ifndef SYZYGY_MSF_MSF_STREAM_H_
 #define SYZYGY_MSF_MSF_STREAM_H_
 
+#include <utility>
+#include <vector>
+
 #include "base/logging.h"
 #include "base/memory/ref_counted.h"
 #include "syzygy/common/buffer_writer.h"
@@ -32,6 +35,10 @@ class WritableMsfStreamImpl;
 template <MsfFileType T>
 class MsfStreamImpl : public base::RefCounted<MsfStreamImpl<T>> {
  public:
+  // A run of contiguous bytes of the stream in memory.
+  typedef std::pair<const uint8_t*, size_t> Span;
+  typedef std::vector<Span> Spans;
+
   explicit MsfStreamImpl(uint32_t length);
 
   // Reads @p count bytes of data starting at @p pos into the destination
@@ -68,6 +75,20 @@ class MsfStreamImpl : public base::RefCounted<MsfStreamImpl<T>> {
     return scoped_refptr<WritableMsfStreamImpl<T>>();
   }
 
+  // Gets the runs of contiguous memory that hold a range of the stream, if
+  // the underlying object has its data in memory. This allows the data to be
+  // consumed without being copied. The spans are only valid until the stream
+  // is modified.
+  //
+  // @param pos the position in the stream of the first byte of the range.
+  // @param count the number of bytes in the range.
+  // @param spans receives the spans, in stream order.
+  // @returns true on success, false if the range is invalid or if the stream
+  //     doesn't support this, in which case ReadBytesAt must be used.
+  virtual bool GetSpans(size_t pos, size_t count, Spans* spans) const {
+    return false;
+  }
+
   // Gets the stream's length.
   // @returns the total number of bytes in the stream.
   uint32_t length() const { return length_; }
@@ -15,6 +15,7 @@
 #ifndef SYZYGY_MSF_MSF_WRITER_IMPL_H_
 #define SYZYGY_MSF_MSF_WRITER_IMPL_H_
 
+#include <algorithm>
 #include <cstdio>
 #include <cstring>
 #include <vector>
@@ -64,6 +65,13 @@ class FreePageBitMap {
   void SetFree(uint32_t page_index) { SetBit(page_index, true); }
   void SetUsed(uint32_t page_index) { SetBit(page_index, false); }
 
+  bool IsFree(uint32_t page_index) const {
+    DCHECK_LT(page_index, page_count_);
+    return (data_[page_index / 8] & (1 << (page_index % 8))) != 0;
+  }
+
+  uint32_t page_count() const { return page_count_; }
+
   // TODO(chrisha): Make this an invariant of the class and move the logic
   //     to SetPageCount. This involves both clearing and setting bits in that
   //     case.
@@ -108,19 +116,29 @@ class ReadOnlyMsfStream : public MsfStreamImpl<T> {
   const void* data_;
 };
 
-// Appends a page to the provided file, adding the written page ID to the vector
-// of @p pages_written, and incrementing the total @P page_count. This will
-// occasionally cause more than one single page to be written to the output,
-// thus advancing @p page_count by more than one (when reserving pages for the
-// free page map). It is expected that @data be kMsfPageSize in length.
+// The number of pages that are read at once from a stream that doesn't have
+// its data in memory.
+const size_t kPagesPerChunk = 256;
+
+// The size of the buffer of the output file.
+const size_t kWriteBufferSize = 1024 * 1024;
+
+// Appends pages to the provided file, adding the written page IDs to the
+// vector of @p pages_written, and incrementing the total @p page_count. This
+// will occasionally cause more pages to be written to the output, thus
+// advancing @p page_count by more than @p num_pages (when reserving pages for
+// the free page map). Runs of pages between the free page map pages are
+// written with a single call. It is expected that @p data be
+// @p num_pages * kMsfPageSize in length.
 // @pre the file is expected to be positioned at @p *page_count * kMsfPageSize
 //     when entering this routine
-// @post the file will be positioned at @p *page_count * kMsfPageSiz when
+// @post the file will be positioned at @p *page_count * kMsfPageSize when
 //     exiting this routine.
-bool AppendPage(const void* data,
-                std::vector<uint32_t>* pages_written,
-                uint32_t* page_count,
-                FILE* file) {
+bool AppendPages(const void* data,
+                 size_t num_pages,
+                 std::vector<uint32_t>* pages_written,
+                 uint32_t* page_count,
+                 FILE* file) {
   DCHECK(data != NULL);
   DCHECK(pages_written != NULL);
   DCHECK(page_count != NULL);
@@ -133,23 +151,34 @@ bool AppendPage(const void* data,
   DCHECK_EQ(local_page_count * kMsfPageSize,
             static_cast<uint32_t>(::ftell(file)));
 
-  // If we're due to allocate pages for the free page map, then do so.
-  if (((*page_count) % kMsfPageSize) == 1) {
-    if (::fwrite(kZeroBuffer, 1, kMsfPageSize, file) != kMsfPageSize ||
-        ::fwrite(kZeroBuffer, 1, kMsfPageSize, file) != kMsfPageSize) {
-      LOG(ERROR) << "Failed to allocate free page map pages.";
+  const uint8_t* page_data = reinterpret_cast<const uint8_t*>(data);
+  while (num_pages > 0) {
+    // If we're due to allocate pages for the free page map, then do so.
+    if ((local_page_count % kMsfPageSize) == 1) {
+      if (::fwrite(kZeroBuffer, 1, kMsfPageSize, file) != kMsfPageSize ||
+          ::fwrite(kZeroBuffer, 1, kMsfPageSize, file) != kMsfPageSize) {
+        LOG(ERROR) << "Failed to allocate free page map pages.";
+        return false;
+      }
+      local_page_count += 2;
+    }
+
+    // Write as many pages as possible before the next free page map pages,
+    // which are due when the page count is next 1 modulo kMsfPageSize.
+    size_t pages_to_boundary =
+        (kMsfPageSize + 1 - local_page_count % kMsfPageSize) % kMsfPageSize;
+    DCHECK_NE(0u, pages_to_boundary);
+    size_t run = std::min(num_pages, pages_to_boundary);
+    if (::fwrite(page_data, kMsfPageSize, run, file) != run) {
+      LOG(ERROR) << "Failed to write page " << local_page_count << ".";
       return false;
     }
-    local_page_count += 2;
-  }
+    for (size_t i = 0; i < run; ++i)
+      pages_written->push_back(local_page_count++);
 
-  // Write the page itself.
-  if (::fwrite(data, 1, kMsfPageSize, file) != kMsfPageSize) {
-    LOG(ERROR) << "Failed to write page " << *page_count << ".";
-    return false;
+    page_data += run * kMsfPageSize;
+    num_pages -= run;
   }
-  pages_written->push_back(local_page_count);
-  ++local_page_count;
 
   DCHECK_EQ(local_page_count * kMsfPageSize,
             static_cast<uint32_t>(::ftell(file)));
@@ -158,12 +187,18 @@ bool AppendPage(const void* data,
   return true;
 }
 
-bool WriteFreePageBitMap(const FreePageBitMap& free, FILE* file) {
+// Writes the free page map to the copy that starts at @p first_page, which is
+// either 1 or 2. The map is spread over the pages at that offset in each
+// interval of kMsfPageSize pages.
+bool WriteFreePageBitMap(const FreePageBitMap& free,
+                         uint32_t first_page,
+                         FILE* file) {
+  DCHECK(first_page == 1 || first_page == 2);
   DCHECK(file != NULL);
 
   const uint8_t* data = free.data().data();
   size_t bytes_left = free.data().size();
-  size_t page_index = 1;
+  size_t page_index = first_page;
   size_t bytes_to_write = kMsfPageSize;
   while (true) {
     if (::fseek(file,
@@ -224,6 +259,13 @@ bool MsfWriterImpl<T>::Write(const base::FilePath& msf_path,
     return false;
   }
 
+  // Pages are written in runs, so a large buffer keeps the number of writes
+  // down without holding more than a small part of any stream in memory.
+  if (::setvbuf(file_.get(), NULL, _IOFBF, kWriteBufferSize) != 0) {
+    LOG(ERROR) << "Failed to set the buffer of '" << msf_path.value() << "'.";
+    return false;
+  }
+
   // Initialize the directory with stream count and lengths.
   std::vector<uint32_t> directory;
   directory.push_back(static_cast<uint32_t>(msf_file.StreamCount()));
@@ -313,7 +355,7 @@ bool MsfWriterImpl<T>::Write(const base::FilePath& msf_path,
     free_page.SetFree(directory[i]);
   free_page.Finalize();
 
-  if (!WriteFreePageBitMap(free_page, file_.get())) {
+  if (!WriteFreePageBitMap(free_page, 1, file_.get())) {
     LOG(ERROR) << "Failed to write free page bitmap.";
     return false;
   }
@@ -336,41 +378,84 @@ bool MsfWriterImpl<T>::AppendStream(MsfStreamImpl<T>* stream,
   size_t old_pages_written_count = pages_written->size();
 #endif
 
-  // Write the stream page by page.
-  uint8_t buffer[kMsfPageSize] = {0};
-  size_t bytes_left = stream->length();
-  size_t bytes_read = 0;
-  while (bytes_left) {
-    size_t bytes_to_read = sizeof(buffer);
-    if (bytes_to_read > bytes_left) {
-      bytes_to_read = bytes_left;
-
-      // If we're only reading a partial buffer then pad the end of it with
-      // zeros.
-      ::memset(buffer + bytes_to_read, 0, sizeof(buffer) - bytes_to_read);
+  // Streams that have their data in memory, such as those of a mapped MSF
+  // and those that have been rebuilt in memory, are written straight from it.
+  typename MsfStreamImpl<T>::Spans spans;
+  if (stream->GetSpans(0, stream->length(), &spans)) {
+    // Pages that straddle two spans are assembled in this buffer.
+    uint8_t page[kMsfPageSize] = {0};
+    size_t page_used = 0;
+    for (size_t i = 0; i < spans.size(); ++i) {
+      const uint8_t* data = spans[i].first;
+      size_t size = spans[i].second;
+
+      // Complete a partially assembled page.
+      if (page_used != 0) {
+        size_t bytes = std::min(size, kMsfPageSize - page_used);
+        ::memcpy(page + page_used, data, bytes);
+        page_used += bytes;
+        data += bytes;
+        size -= bytes;
+        if (page_used < kMsfPageSize)
+          continue;
+        if (!AppendPages(page, 1, pages_written, page_count, file_.get()))
+          return false;
+        page_used = 0;
+      }
+
+      // Write the whole pages, then keep the remainder.
+      size_t num_pages = size / kMsfPageSize;
+      if (num_pages != 0 &&
+          !AppendPages(data, num_pages, pages_written, page_count,
+                       file_.get())) {
+        return false;
+      }
+      page_used = size - num_pages * kMsfPageSize;
+      ::memcpy(page, data + num_pages * kMsfPageSize, page_used);
     }
 
-    // Read the buffer from the stream.
-    if (!stream->ReadBytesAt(bytes_read, bytes_to_read, buffer)) {
-      size_t offset = stream->length() - bytes_left;
-      LOG(ERROR) << "Failed to read " << bytes_to_read << " bytes at offset "
-                 << offset << " of MSF stream.";
-      return false;
+    // Pad the last page with zeros.
+    if (page_used != 0) {
+      ::memset(page + page_used, 0, kMsfPageSize - page_used);
+      if (!AppendPages(page, 1, pages_written, page_count, file_.get()))
+        return false;
     }
-    if (!AppendPage(buffer, pages_written, page_count, file_.get()))
-      return false;
-
-    bytes_read += bytes_to_read;
-    bytes_left -= bytes_to_read;
+  } else {
+    // Otherwise, write the stream a chunk at a time.
+    std::vector<uint8_t> buffer(kPagesPerChunk * kMsfPageSize);
+    size_t bytes_left = stream->length();
+    size_t bytes_read = 0;
+    while (bytes_left) {
+      size_t bytes_to_read = std::min(bytes_left, buffer.size());
+
+      // Read the buffer from the stream.
+      if (!stream->ReadBytesAt(bytes_read, bytes_to_read, buffer.data())) {
+        LOG(ERROR) << "Failed to read " << bytes_to_read << " bytes at offset "
+                   << bytes_read << " of MSF stream.";
+        return false;
+      }
+
+      // If we've only read a partial page then pad the end of it with zeros.
+      size_t num_pages = (bytes_to_read + kMsfPageSize - 1) / kMsfPageSize;
+      ::memset(buffer.data() + bytes_to_read, 0,
+               num_pages * kMsfPageSize - bytes_to_read);
+      if (!AppendPages(buffer.data(), num_pages, pages_written, page_count,
+                       file_.get())) {
+        return false;
+      }
+
+      bytes_read += bytes_to_read;
+      bytes_left -= bytes_to_read;
+    }
+    DCHECK_EQ(0u, bytes_left);
   }
-  DCHECK_EQ(0u, bytes_left);
 
 #ifndef NDEBUG
   size_t expected_pages_written =
       (stream->length() + kMsfPageSize - 1) / kMsfPageSize;
   DCHECK_EQ(old_pages_written_count + expected_pages_written,
             pages_written->size());
-// We can't say anything about |page_count| as AppendPage occasionally snags
+// We can't say anything about |page_count| as AppendPages occasionally snags
 // extra pages for the free page map.
 #endif
 
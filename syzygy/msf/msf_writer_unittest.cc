@@ -15,11 +15,13 @@
 #include "syzygy/msf/msf_writer.h"
 
 #include <algorithm>
+#include <string>
 #include <vector>
 
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "syzygy/core/unittest_util.h"
+#include "syzygy/msf/msf_byte_stream.h"
 #include "syzygy/msf/msf_constants.h"
 #include "syzygy/msf/msf_data.h"
 #include "syzygy/msf/msf_reader.h"
@@ -157,6 +159,47 @@ TEST(MsfWriterTest, AppendStream) {
   EXPECT_THAT(contents, ::testing::ContainerEq(expected_contents));
 }
 
+TEST(MsfWriterTest, AppendStreamFromMemory) {
+  TestMsfWriter writer;
+
+  testing::ScopedTempFile temp_file;
+  writer.file().reset(base::OpenFile(temp_file.path(), "wb"));
+  ASSERT_TRUE(writer.file().get() != NULL);
+
+  // A stream whose data is in memory is written straight from it. Its last
+  // page is partial and needs to be padded.
+  const size_t kLength = 4 * kMsfPageSize + 100;
+  scoped_refptr<MsfStream> source(new TestMsfStream(kLength, 0));
+  std::vector<uint8_t> data(kLength);
+  ASSERT_TRUE(source->ReadBytesAt(0, kLength, data.data()));
+  scoped_refptr<MsfByteStream> stream(new MsfByteStream());
+  ASSERT_TRUE(stream->Init(data.data(), kLength));
+
+  std::vector<uint32_t> pages_written;
+  uint32_t page_count = 0;
+  EXPECT_TRUE(writer.AppendStream(stream.get(), &pages_written, &page_count));
+  writer.file().reset();
+
+  // The free page map pages are reserved after the first page.
+  uint32_t expected_pages_written[] = {0, 3, 4, 5, 6};
+  EXPECT_THAT(pages_written,
+              ::testing::ElementsAreArray(expected_pages_written));
+  EXPECT_EQ(page_count, 7);
+
+  std::vector<uint8_t> expected_contents(7 * kMsfPageSize);
+  ::memcpy(expected_contents.data(), data.data(), kMsfPageSize);
+  ::memcpy(expected_contents.data() + 3 * kMsfPageSize,
+           data.data() + kMsfPageSize, kLength - kMsfPageSize);
+
+  std::vector<uint8_t> contents(7 * kMsfPageSize);
+  ASSERT_EQ(
+      contents.size(),
+      base::ReadFile(temp_file.path(), reinterpret_cast<char*>(contents.data()),
+                     contents.size()));
+
+  EXPECT_THAT(contents, ::testing::ContainerEq(expected_contents));
+}
+
 TEST(MsfWriterTest, WriteHeader) {
   TestMsfWriter writer;
 
@@ -216,4 +259,34 @@ TEST(MsfWriterTest, WriteMsfFile) {
       testing::EnsureMsfContentsAreIdentical(msf_file, msf_file_read));
 }
 
+TEST(MsfWriterTest, WriteMappedMsfFile) {
+  base::FilePath test_msf =
+      testing::GetSrcRelativePath(testing::kTestPdbFilePath);
+
+  // Rewriting an MSF gives the same file whether its streams are read from a
+  // mapping or from the file.
+  MsfReader reader;
+  MsfFile msf_file;
+  MsfFile mapped_msf_file;
+  ASSERT_TRUE(reader.Read(test_msf, &msf_file));
+  ASSERT_TRUE(reader.ReadMapped(test_msf, &mapped_msf_file));
+
+  testing::ScopedTempFile file;
+  testing::ScopedTempFile mapped_file;
+  MsfWriter writer;
+  ASSERT_TRUE(writer.Write(file.path(), msf_file));
+  ASSERT_TRUE(writer.Write(mapped_file.path(), mapped_msf_file));
+
+  std::string contents;
+  std::string mapped_contents;
+  ASSERT_TRUE(base::ReadFileToString(file.path(), &contents));
+  ASSERT_TRUE(base::ReadFileToString(mapped_file.path(), &mapped_contents));
+  EXPECT_TRUE(contents == mapped_contents);
+
+  MsfFile msf_file_read;
+  EXPECT_TRUE(reader.Read(mapped_file.path(), &msf_file_read));
+  ASSERT_NO_FATAL_FAILURE(
+      testing::EnsureMsfContentsAreIdentical(msf_file, msf_file_read));
+}
+
 }  // namespace msf
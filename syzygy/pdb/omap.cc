@@ -118,7 +118,7 @@ bool ReadOmapsFromPdbFile(const base::FilePath& pdb_path,
                           std::vector<OMAP>* omap_from) {
   PdbReader pdb_reader;
   PdbFile pdb_file;
-  if (!pdb_reader.Read(pdb_path, &pdb_file))
+  if (!pdb_reader.ReadMapped(pdb_path, &pdb_file))
     return false;
   return ReadOmapsFromPdbFile(pdb_file, omap_to, omap_from);
 }
@@ -40,6 +40,7 @@
         'pdb_file_stream.h',
         'pdb_mutator.cc',
         'pdb_mutator.h',
+        'pdb_patcher.h',
         'pdb_reader.h',
         'pdb_stream.h',
         'pdb_stream_reader.cc',
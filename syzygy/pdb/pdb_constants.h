@@ -78,8 +78,22 @@ const uint32_t kSyzygyHistoryStreamVersion = 0;
 extern const char kSyzygyBlockGraphStreamName[];
 
 // The version of the Syzygy BlockGraph data stream. This needs to be
-// incremented whenever the format of the stream has changed.
-const uint32_t kSyzygyBlockGraphStreamVersion = 1;
+// incremented whenever the format of the stream has changed. Version 2 streams
+// may also be stored in a chunked compression container.
+const uint32_t kSyzygyBlockGraphStreamVersion = 2;
+
+// The oldest version of the Syzygy BlockGraph data stream that can still be
+// read. Streams of this version are either uncompressed or a single zlib
+// stream.
+const uint32_t kSyzygyBlockGraphStreamMinimumVersion = 1;
+
+// The possible values of the compression byte that follows the version of the
+// Syzygy BlockGraph data stream. The chunked compression container (see
+// core/chunked_compression.h) allows the stream to be decompressed in
+// parallel.
+const uint8_t kSyzygyBlockGraphStreamUncompressed = 0;
+const uint8_t kSyzygyBlockGraphStreamZlibCompressed = 1;
+const uint8_t kSyzygyBlockGraphStreamChunkCompressed = 2;
 
 }  // namespace pdb
 
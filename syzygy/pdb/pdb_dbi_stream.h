@@ -124,6 +124,9 @@ class DbiStream {
   const DbiDbgHeader& dbg_header() const { return dbg_header_; }
   const DbiHeader& header() const { return header_; }
   const DbiModuleVector& modules() const { return modules_; }
+  const DbiSectionContribVector& section_contribs() const {
+    return section_contribs_;
+  }
   const DbiSectionMap& section_map() const { return section_map_; }
   // @}
 
@@ -402,7 +402,7 @@ bool ReadPdbHeader(const base::FilePath& pdb_path,
 
   PdbReader pdb_reader;
   PdbFile pdb_file;
-  if (!pdb_reader.Read(pdb_path, &pdb_file)) {
+  if (!pdb_reader.ReadMapped(pdb_path, &pdb_file)) {
     LOG(ERROR) << "Unable to process PDB file: " << pdb_path.value();
     return false;
   }
@@ -0,0 +1,150 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Compares the std::map and sorted vector backends of core::AddressSpace on
+// workloads derived from the block layout of a decomposed image. The layout of
+// test_dll is replicated a number of times in order to get an address space
+// whose size is closer to that of a real-world image.
+
+#include <algorithm>
+#include <vector>
+
+#include "base/time/time.h"
+#include "gtest/gtest.h"
+#include "syzygy/core/address_space.h"
+#include "syzygy/core/random_number_generator.h"
+#include "syzygy/pe/decomposer.h"
+#include "syzygy/pe/unittest_util.h"
+#include "testing/perf/perf_test.h"
+
+namespace pe {
+
+namespace {
+
+using block_graph::BlockGraph;
+using core::RelativeAddress;
+
+typedef core::AddressRange<RelativeAddress, size_t> Range;
+typedef std::vector<Range> Ranges;
+
+// The number of times the test_dll layout is replicated.
+const size_t kReplicas = 64;
+
+// The number of times each benchmark is repeated.
+const size_t kIterations = 10;
+
+class AddressSpacePerfTest : public testing::PELibUnitTest {
+ public:
+  void SetUp() override {
+    testing::PELibUnitTest::SetUp();
+
+    PEFile pe_file;
+    BlockGraph block_graph;
+    ImageLayout image_layout(&block_graph);
+    ASSERT_NO_FATAL_FAILURE(DecomposeTestDll(&pe_file, &image_layout));
+
+    // Gather the non-empty block ranges of the image, in address order.
+    Ranges image_ranges;
+    BlockGraph::AddressSpace::RangeMapConstIter it =
+        image_layout.blocks.begin();
+    for (; it != image_layout.blocks.end(); ++it)
+      image_ranges.push_back(Range(it->first.start(), it->first.size()));
+    ASSERT_FALSE(image_ranges.empty());
+    size_t image_size = image_ranges.back().end().value();
+
+    // Replicate them to get a bigger address space.
+    for (size_t i = 0; i < kReplicas; ++i) {
+      for (size_t j = 0; j < image_ranges.size(); ++j) {
+        ranges_.push_back(Range(image_ranges[j].start() + i * image_size,
+                                image_ranges[j].size()));
+      }
+    }
+
+    // Build a set of lookups hitting the middle of every range, in random
+    // order.
+    core::RandomNumberGenerator random(42);
+    lookups_ = ranges_;
+    for (size_t i = 0; i < lookups_.size(); ++i) {
+      lookups_[i] = Range(lookups_[i].start() + lookups_[i].size() / 2, 1);
+    }
+    std::random_shuffle(lookups_.begin(), lookups_.end(), random);
+  }
+
+  template <typename AddressSpaceType>
+  void RunBenchmarks(const char* backend_name);
+
+  Ranges ranges_;
+  Ranges lookups_;
+};
+
+template <typename AddressSpaceType>
+void AddressSpacePerfTest::RunBenchmarks(const char* backend_name) {
+  base::TimeDelta push_time;
+  base::TimeDelta lookup_time;
+  base::TimeDelta iterate_time;
+  size_t checksum = 0;
+
+  for (size_t iteration = 0; iteration < kIterations; ++iteration) {
+    AddressSpaceType address_space;
+
+    base::TimeTicks start = base::TimeTicks::Now();
+    for (size_t i = 0; i < ranges_.size(); ++i)
+      ASSERT_TRUE(address_space.Push(ranges_[i], i));
+    push_time += base::TimeTicks::Now() - start;
+
+    start = base::TimeTicks::Now();
+    for (size_t i = 0; i < lookups_.size(); ++i) {
+      typename AddressSpaceType::RangeMapConstIter it =
+          address_space.FindContaining(lookups_[i]);
+      ASSERT_TRUE(it != address_space.end());
+      checksum += it->second;
+    }
+    lookup_time += base::TimeTicks::Now() - start;
+
+    start = base::TimeTicks::Now();
+    typename AddressSpaceType::RangeMapConstIter it = address_space.begin();
+    for (; it != address_space.end(); ++it)
+      checksum += it->first.size();
+    iterate_time += base::TimeTicks::Now() - start;
+  }
+
+  // Make sure the work can't be optimized away.
+  EXPECT_NE(0u, checksum);
+
+  perf_test::PrintResult("AddressSpacePush", "", backend_name,
+                         push_time.InMillisecondsF() / kIterations, "ms", true);
+  perf_test::PrintResult("AddressSpaceLookup", "", backend_name,
+                         lookup_time.InMillisecondsF() / kIterations, "ms",
+                         true);
+  perf_test::PrintResult("AddressSpaceIterate", "", backend_name,
+                         iterate_time.InMillisecondsF() / kIterations, "ms",
+                         true);
+}
+
+}  // namespace
+
+TEST_F(AddressSpacePerfTest, MapBackend) {
+  typedef core::AddressSpace<RelativeAddress, size_t, size_t,
+                             core::MapRangeMapPolicy> MapAddressSpace;
+  ASSERT_NO_FATAL_FAILURE(RunBenchmarks<MapAddressSpace>("map"));
+}
+
+TEST_F(AddressSpacePerfTest, SortedVectorBackend) {
+  typedef core::AddressSpace<RelativeAddress, size_t, size_t,
+                             core::SortedVectorRangeMapPolicy>
+      VectorAddressSpace;
+  ASSERT_NO_FATAL_FAILURE(RunBenchmarks<VectorAddressSpace>("sorted_vector"));
+}
+
+}  // namespace pe
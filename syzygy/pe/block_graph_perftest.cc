@@ -0,0 +1,181 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Measures the cost of decomposing test_dll into, and destroying, a BlockGraph
+// using each of the BlockGraph allocation modes, as well as the heap usage of
+// the string table that holds its names.
+
+#include <malloc.h>
+#include <windows.h>
+
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "base/time/time.h"
+#include "gtest/gtest.h"
+#include "syzygy/block_graph/block_graph.h"
+#include "syzygy/core/string_table.h"
+#include "syzygy/pe/decomposer.h"
+#include "syzygy/pe/unittest_util.h"
+#include "testing/perf/perf_test.h"
+
+namespace pe {
+
+namespace {
+
+using block_graph::BlockGraph;
+
+// The number of times each benchmark is repeated.
+const size_t kIterations = 5;
+
+// @returns the number of busy allocations in the CRT heap.
+size_t CountHeapAllocations() {
+  HANDLE heap = reinterpret_cast<HANDLE>(::_get_heap_handle());
+  size_t count = 0;
+  CHECK(::HeapLock(heap));
+  PROCESS_HEAP_ENTRY entry = {};
+  while (::HeapWalk(heap, &entry)) {
+    if ((entry.wFlags & PROCESS_HEAP_ENTRY_BUSY) != 0)
+      ++count;
+  }
+  CHECK(::HeapUnlock(heap));
+  return count;
+}
+
+// @returns the number of bytes in busy allocations in the CRT heap.
+size_t CountHeapBytes() {
+  HANDLE heap = reinterpret_cast<HANDLE>(::_get_heap_handle());
+  size_t bytes = 0;
+  CHECK(::HeapLock(heap));
+  PROCESS_HEAP_ENTRY entry = {};
+  while (::HeapWalk(heap, &entry)) {
+    if ((entry.wFlags & PROCESS_HEAP_ENTRY_BUSY) != 0)
+      bytes += entry.cbData;
+  }
+  CHECK(::HeapUnlock(heap));
+  return bytes;
+}
+
+class BlockGraphPerfTest : public testing::PELibUnitTest {
+ public:
+  void RunBenchmark(BlockGraph::AllocationMode allocation_mode,
+                    const char* mode_name);
+};
+
+void BlockGraphPerfTest::RunBenchmark(
+    BlockGraph::AllocationMode allocation_mode, const char* mode_name) {
+  base::TimeDelta decompose_time;
+  base::TimeDelta destroy_time;
+  size_t node_count = 0;
+  size_t heap_allocation_count = 0;
+
+  for (size_t iteration = 0; iteration < kIterations; ++iteration) {
+    PEFile pe_file;
+    std::unique_ptr<BlockGraph> block_graph(new BlockGraph(allocation_mode));
+    std::unique_ptr<ImageLayout> image_layout(
+        new ImageLayout(block_graph.get()));
+
+    base::TimeTicks start = base::TimeTicks::Now();
+    ASSERT_NO_FATAL_FAILURE(DecomposeTestDll(&pe_file, image_layout.get()));
+    decompose_time += base::TimeTicks::Now() - start;
+
+    // Count the container nodes that make up the graph.
+    node_count = block_graph->blocks().size();
+    BlockGraph::BlockMap::const_iterator it = block_graph->blocks().begin();
+    for (; it != block_graph->blocks().end(); ++it) {
+      node_count += it->second.references().size() +
+                    it->second.referrers().size() +
+                    it->second.labels().size();
+    }
+
+    // Measure the heap allocations that are released along with the graph.
+    heap_allocation_count = CountHeapAllocations();
+
+    start = base::TimeTicks::Now();
+    image_layout.reset();
+    block_graph.reset();
+    destroy_time += base::TimeTicks::Now() - start;
+    heap_allocation_count -= CountHeapAllocations();
+  }
+
+  perf_test::PrintResult("BlockGraphDecompose", "", mode_name,
+                         decompose_time.InMillisecondsF() / kIterations, "ms",
+                         true);
+  perf_test::PrintResult("BlockGraphDestroy", "", mode_name,
+                         destroy_time.InMillisecondsF() / kIterations, "ms",
+                         true);
+  perf_test::PrintResult("BlockGraphNodes", "", mode_name, node_count,
+                         "nodes", true);
+  perf_test::PrintResult("BlockGraphHeapAllocations", "", mode_name,
+                         heap_allocation_count, "allocations", true);
+}
+
+}  // namespace
+
+TEST_F(BlockGraphPerfTest, HeapAllocation) {
+  ASSERT_NO_FATAL_FAILURE(RunBenchmark(BlockGraph::kHeapAllocation, "heap"));
+}
+
+TEST_F(BlockGraphPerfTest, ArenaAllocation) {
+  ASSERT_NO_FATAL_FAILURE(RunBenchmark(BlockGraph::kArenaAllocation, "arena"));
+}
+
+TEST_F(BlockGraphPerfTest, StringTableHeapUsage) {
+  // Gather the names of the blocks and labels of test_dll, with duplicates.
+  std::vector<std::string> names;
+  {
+    PEFile pe_file;
+    BlockGraph block_graph;
+    ImageLayout image_layout(&block_graph);
+    ASSERT_NO_FATAL_FAILURE(DecomposeTestDll(&pe_file, &image_layout));
+    BlockGraph::BlockMap::const_iterator it = block_graph.blocks().begin();
+    for (; it != block_graph.blocks().end(); ++it) {
+      names.push_back(it->second.name());
+      names.push_back(it->second.compiland_name());
+      BlockGraph::Block::LabelMap::const_iterator label_it =
+          it->second.labels().begin();
+      for (; label_it != it->second.labels().end(); ++label_it)
+        names.push_back(label_it->second.name());
+    }
+  }
+
+  // Intern the names in a StringTable, and in the std::set that it replaced.
+  size_t baseline_bytes = CountHeapBytes();
+  std::unique_ptr<core::StringTable> string_table(new core::StringTable());
+  for (const std::string& name : names)
+    string_table->InternString(name);
+  size_t string_table_bytes = CountHeapBytes() - baseline_bytes;
+  size_t distinct_count = string_table->size();
+  string_table.reset();
+
+  baseline_bytes = CountHeapBytes();
+  std::unique_ptr<std::set<std::string>> string_set(
+      new std::set<std::string>());
+  for (const std::string& name : names)
+    string_set->insert(name);
+  size_t string_set_bytes = CountHeapBytes() - baseline_bytes;
+  EXPECT_EQ(distinct_count, string_set->size());
+  string_set.reset();
+
+  perf_test::PrintResult("StringTableStrings", "", "distinct", distinct_count,
+                         "strings", true);
+  perf_test::PrintResult("StringTableHeapUsage", "", "string_table",
+                         string_table_bytes, "bytes", true);
+  perf_test::PrintResult("StringTableHeapUsage", "", "std_set",
+                         string_set_bytes, "bytes", true);
+}
+
+}  // namespace pe
@@ -0,0 +1,213 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Measures the size of the serialized decomposition of test_dll, and the time
+// it takes to load it back, using each of the ways in which the block-graph
+// PDB stream may be compressed.
+
+#include <iterator>
+#include <vector>
+
+#include "base/sys_info.h"
+#include "base/time/time.h"
+#include "gtest/gtest.h"
+#include "syzygy/core/chunked_compression.h"
+#include "syzygy/core/serialization.h"
+#include "syzygy/core/zstream.h"
+#include "syzygy/pe/decomposer.h"
+#include "syzygy/pe/serialization.h"
+#include "syzygy/pe/unittest_util.h"
+#include "testing/perf/perf_test.h"
+
+namespace pe {
+
+namespace {
+
+using block_graph::BlockGraph;
+using block_graph::BlockGraphSerializer;
+
+// The number of times each benchmark is repeated.
+const size_t kIterations = 10;
+
+class BlockGraphStreamPerfTest : public testing::PELibUnitTest {
+ public:
+  BlockGraphStreamPerfTest() : image_layout_(&block_graph_) {}
+
+  void SetUp() override {
+    testing::PELibUnitTest::SetUp();
+    ASSERT_NO_FATAL_FAILURE(DecomposeTestDll(&pe_file_, &image_layout_));
+    core::ScopedOutStreamPtr out_stream(
+        core::CreateByteOutStream(std::back_inserter(serialized_)));
+    core::NativeBinaryOutArchive out_archive(out_stream.get());
+    ASSERT_TRUE(SaveBlockGraphAndImageLayout(
+        pe_file_, BlockGraphSerializer::DEFAULT_ATTRIBUTES, image_layout_,
+        &out_archive));
+  }
+
+  // Loads the decomposition from its serialized form, as the decomposer does
+  // with the contents of the block-graph stream.
+  void Load(const std::vector<uint8_t>& serialized) {
+    BlockGraph block_graph;
+    ImageLayout image_layout(&block_graph);
+    core::ScopedInStreamPtr in_stream(
+        core::CreateByteInStream(serialized.begin(), serialized.end()));
+    core::NativeBinaryInArchive in_archive(in_stream.get());
+    BlockGraphSerializer::Attributes attributes = 0;
+    ASSERT_TRUE(LoadBlockGraphAndImageLayout(pe_file_, &attributes,
+                                             &image_layout, &in_archive));
+    ASSERT_EQ(block_graph_.blocks().size(), block_graph.blocks().size());
+  }
+
+  // Reports the results of a benchmark.
+  void PrintResults(const char* name,
+                    size_t size,
+                    base::TimeDelta decompress_time,
+                    base::TimeDelta load_time) {
+    perf_test::PrintResult("BlockGraphStreamSize", "", name, size, "bytes",
+                           true);
+    perf_test::PrintResult("BlockGraphStreamDecompress", "", name,
+                           decompress_time.InMillisecondsF() / kIterations,
+                           "ms", true);
+    perf_test::PrintResult("BlockGraphStreamLoad", "", name,
+                           load_time.InMillisecondsF() / kIterations, "ms",
+                           true);
+  }
+
+  void RunChunkedBenchmark(core::ChunkCodec codec,
+                           size_t thread_count,
+                           const char* name);
+
+  PEFile pe_file_;
+  BlockGraph block_graph_;
+  ImageLayout image_layout_;
+  std::vector<uint8_t> serialized_;
+};
+
+void BlockGraphStreamPerfTest::RunChunkedBenchmark(core::ChunkCodec codec,
+                                                   size_t thread_count,
+                                                   const char* name) {
+  std::vector<uint8_t> container;
+  ASSERT_TRUE(core::CompressChunked(serialized_.data(), serialized_.size(),
+                                    codec, core::kDefaultChunkSize,
+                                    thread_count, &container));
+
+  base::TimeDelta decompress_time;
+  base::TimeDelta load_time;
+  for (size_t iteration = 0; iteration < kIterations; ++iteration) {
+    base::TimeTicks start = base::TimeTicks::Now();
+    core::ChunkedDecompressor decompressor;
+    std::vector<uint8_t> serialized;
+    ASSERT_TRUE(decompressor.Init(container.data(), container.size()));
+    ASSERT_TRUE(decompressor.DecompressAll(thread_count, &serialized));
+    decompress_time += base::TimeTicks::Now() - start;
+
+    ASSERT_NO_FATAL_FAILURE(Load(serialized));
+    load_time += base::TimeTicks::Now() - start;
+  }
+
+  PrintResults(name, container.size(), decompress_time, load_time);
+}
+
+}  // namespace
+
+TEST_F(BlockGraphStreamPerfTest, Uncompressed) {
+  base::TimeDelta load_time;
+  for (size_t iteration = 0; iteration < kIterations; ++iteration) {
+    base::TimeTicks start = base::TimeTicks::Now();
+    ASSERT_NO_FATAL_FAILURE(Load(serialized_));
+    load_time += base::TimeTicks::Now() - start;
+  }
+
+  PrintResults("uncompressed", serialized_.size(), base::TimeDelta(),
+               load_time);
+}
+
+TEST_F(BlockGraphStreamPerfTest, IndexedUncompressed) {
+  // The indexed serialization, loaded in full.
+  std::vector<uint8_t> indexed;
+  ASSERT_TRUE(SaveIndexedBlockGraphAndImageLayout(
+      pe_file_, BlockGraphSerializer::DEFAULT_ATTRIBUTES, image_layout_,
+      &indexed));
+
+  base::TimeDelta load_time;
+  for (size_t iteration = 0; iteration < kIterations; ++iteration) {
+    base::TimeTicks start = base::TimeTicks::Now();
+    BlockGraph block_graph;
+    ImageLayout image_layout(&block_graph);
+    LazyImageLayoutLoader loader;
+    ASSERT_TRUE(loader.Init(pe_file_, indexed.data(), indexed.size(),
+                            &image_layout));
+    ASSERT_TRUE(loader.LoadAll());
+    load_time += base::TimeTicks::Now() - start;
+    ASSERT_EQ(block_graph_.blocks().size(), block_graph.blocks().size());
+  }
+
+  PrintResults("indexed_uncompressed", indexed.size(), base::TimeDelta(),
+               load_time);
+}
+
+TEST_F(BlockGraphStreamPerfTest, ZlibStream) {
+  // This is how the stream used to be compressed.
+  std::vector<uint8_t> compressed;
+  core::ScopedOutStreamPtr out_stream(
+      core::CreateByteOutStream(std::back_inserter(compressed)));
+  core::ZOutStream zip_out_stream(out_stream.get());
+  ASSERT_TRUE(zip_out_stream.Init(core::ZOutStream::kZBestCompression));
+  ASSERT_TRUE(zip_out_stream.Write(serialized_.size(), serialized_.data()));
+  ASSERT_TRUE(zip_out_stream.Flush());
+
+  base::TimeDelta decompress_time;
+  base::TimeDelta load_time;
+  for (size_t iteration = 0; iteration < kIterations; ++iteration) {
+    base::TimeTicks start = base::TimeTicks::Now();
+    core::ScopedInStreamPtr in_stream(
+        core::CreateByteInStream(compressed.begin(), compressed.end()));
+    core::ZInStream zip_in_stream(in_stream.get());
+    ASSERT_TRUE(zip_in_stream.Init());
+    std::vector<uint8_t> serialized(serialized_.size());
+    ASSERT_TRUE(zip_in_stream.Read(serialized.size(), serialized.data()));
+    decompress_time += base::TimeTicks::Now() - start;
+
+    ASSERT_NO_FATAL_FAILURE(Load(serialized));
+    load_time += base::TimeTicks::Now() - start;
+  }
+
+  PrintResults("zlib_stream", compressed.size(), decompress_time, load_time);
+}
+
+TEST_F(BlockGraphStreamPerfTest, ChunkedZlib) {
+  ASSERT_NO_FATAL_FAILURE(
+      RunChunkedBenchmark(core::kChunkCodecZlib, 1, "chunked_zlib"));
+}
+
+TEST_F(BlockGraphStreamPerfTest, ChunkedZlibParallel) {
+  ASSERT_NO_FATAL_FAILURE(
+      RunChunkedBenchmark(core::kChunkCodecZlib,
+                          base::SysInfo::NumberOfProcessors(),
+                          "chunked_zlib_parallel"));
+}
+
+TEST_F(BlockGraphStreamPerfTest, ChunkedLz) {
+  ASSERT_NO_FATAL_FAILURE(
+      RunChunkedBenchmark(core::kChunkCodecLz, 1, "chunked_lz"));
+}
+
+TEST_F(BlockGraphStreamPerfTest, ChunkedLzParallel) {
+  ASSERT_NO_FATAL_FAILURE(
+      RunChunkedBenchmark(core::kChunkCodecLz,
+                          base::SysInfo::NumberOfProcessors(),
+                          "chunked_lz_parallel"));
+}
+
+}  // namespace pe
@@ -53,6 +53,8 @@ const uint16_t S_LOCAL_VS2013 = 0x113E;  // Defines a local symbol in optimized
 // values should be used instead.
 const uint16_t S_LPROC32_VS2013 = 0x1146;
 const uint16_t S_GPROC32_VS2013 = 0x1147;
+// Terminates the scope of a S_LPROC32_VS2013 or S_GPROC32_VS2013 symbol.
+const uint16_t S_PROC_ID_END = 0x114F;
 
 }  // namespace Microsoft_Cci_Pdb
 
@@ -16,10 +16,14 @@
 
 #include "syzygy/pe/decompose_app.h"
 
+#include <vector>
+
 #include "base/at_exit.h"
 #include "base/command_line.h"
 #include "base/files/file_path.h"
 #include "base/files/file_util.h"
+#include "base/files/memory_mapped_file.h"
+#include "base/strings/string_number_conversions.h"
 #include "base/strings/string_util.h"
 #include "base/time/time.h"
 #include "syzygy/block_graph/block_graph.h"
@@ -54,9 +58,25 @@ const char kUsageFormatStr[] =
     "    all data inlined. The PE file (and pe_lib) will not be needed to\n"
     "    deserialize the resulting file. Useful for producing canned unittest\n"
     "    data.\n"
+    "  --indexed\n"
+    "    Causes the output to be serialized in the indexed format, whose\n"
+    "    blocks can be loaded on demand. With --benchmark-load, the output\n"
+    "    is then memory-mapped and loaded lazily. Incompatible with\n"
+    "    --graph-only.\n"
+    "  --jobs=<count>\n"
+    "    The number of threads used to resolve the fixups of the image.\n"
+    "    Defaults to 1.\n"
+    "  --no-dia\n"
+    "    Reads the symbols directly from the streams of the PDB file rather\n"
+    "    than through DIA. PDB files containing OMAP information are not\n"
+    "    supported.\n"
     "  --output=<output file>\n"
     "    The location of output file. If not specified, will append\n"
     "    '.bg' to the image file.\n"
+    "  --previous=<decomposition file>\n"
+    "    The decomposition of a previous build of the image, as produced\n"
+    "    with --graph-only. Blocks that are unchanged since then reuse their\n"
+    "    symbol information, rather than it being parsed again.\n"
     "  --strip-strings\n"
     "    If specified then the serialized decomposition will not contain any\n"
     "    strings.\n";
@@ -94,10 +114,28 @@ bool DecomposeApp::ParseCommandLine(const base::CommandLine* cmd_line) {
     LOG(INFO) << "Inferring output path from image path.";
   }
 
+  previous_path_ = cmd_line->GetSwitchValuePath("previous");
+
+  if (cmd_line->HasSwitch("jobs")) {
+    std::string jobs = cmd_line->GetSwitchValueASCII("jobs");
+    if (!base::StringToSizeT(jobs, &jobs_) || jobs_ == 0) {
+      PrintUsage(cmd_line->GetProgram(), "Invalid number of jobs.");
+      return false;
+    }
+  }
+
   benchmark_load_ = cmd_line->HasSwitch("benchmark-load");
   graph_only_ = cmd_line->HasSwitch("graph-only");
+  indexed_ = cmd_line->HasSwitch("indexed");
+  no_dia_ = cmd_line->HasSwitch("no-dia");
   strip_strings_ = cmd_line->HasSwitch("strip-strings");
 
+  if (graph_only_ && indexed_) {
+    PrintUsage(cmd_line->GetProgram(),
+               "Can't specify both '--graph-only' and '--indexed'.");
+    return false;
+  }
+
   return true;
 }
 
@@ -112,10 +150,23 @@ int DecomposeApp::Run() {
       return 1;
   }
 
+  // Load the previous decomposition, if any.
+  BlockGraph previous_block_graph(BlockGraph::kArenaAllocation);
+  if (!previous_path_.empty()) {
+    ScopedTimeLogger scoped_time_logger("Loading previous decomposition");
+    if (!LoadBlockGraphWithData(previous_path_, &previous_block_graph))
+      return 1;
+  }
+
   // Decompose the image.
-  BlockGraph block_graph;
+  BlockGraph block_graph(BlockGraph::kArenaAllocation);
   pe::ImageLayout image_layout(&block_graph);
   pe::Decomposer decomposer(pe_file);
+  if (!previous_path_.empty())
+    decomposer.set_previous_block_graph(&previous_block_graph);
+  decomposer.set_thread_count(jobs_);
+  if (no_dia_)
+    decomposer.set_symbol_backend(pe::Decomposer::kPdbSymbolBackend);
   {
     ScopedTimeLogger scoped_time_logger("Decomposing image");
     if (!decomposer.Decompose(&image_layout))
@@ -142,14 +193,30 @@ int DecomposeApp::Run() {
 bool DecomposeApp::SaveDecomposedImage(
     const pe::PEFile& pe_file, const pe::ImageLayout& image_layout,
     const base::FilePath& output_path) const {
-  base::ScopedFILE out_file(base::OpenFile(output_path, "wb"));
-  core::FileOutStream out_stream(out_file.get());
-  core::NativeBinaryOutArchive out_archive(&out_stream);
-
   BlockGraphSerializer::Attributes attributes = 0;
   if (strip_strings_)
     attributes |= BlockGraphSerializer::OMIT_STRINGS;
 
+  if (indexed_) {
+    std::vector<uint8_t> buffer;
+    if (!SaveIndexedBlockGraphAndImageLayout(pe_file, attributes,
+                                             image_layout, &buffer)) {
+      LOG(ERROR) << "Unable to save indexed image decomposition.";
+      return false;
+    }
+    int size = static_cast<int>(buffer.size());
+    if (base::WriteFile(output_path, reinterpret_cast<const char*>(
+                            buffer.data()), size) != size) {
+      LOG(ERROR) << "Unable to write \"" << output_path.value() << "\".";
+      return false;
+    }
+    return true;
+  }
+
+  base::ScopedFILE out_file(base::OpenFile(output_path, "wb"));
+  core::FileOutStream out_stream(out_file.get());
+  core::NativeBinaryOutArchive out_archive(&out_stream);
+
   if (graph_only_) {
     BlockGraphSerializer bgs;
     bgs.set_attributes(attributes);
@@ -173,8 +240,11 @@ bool DecomposeApp::SaveDecomposedImage(
 }
 
 bool DecomposeApp::LoadDecomposedImage(const base::FilePath& file_path) const {
+  if (indexed_)
+    return LoadIndexedDecomposedImage(file_path);
+
   pe::PEFile pe_file;
-  BlockGraph block_graph;
+  BlockGraph block_graph(BlockGraph::kArenaAllocation);
 
   base::ScopedFILE in_file(base::OpenFile(file_path, "rb"));
   core::FileInStream in_stream(in_file.get());
@@ -200,4 +270,43 @@ bool DecomposeApp::LoadDecomposedImage(const base::FilePath& file_path) const {
   return true;
 }
 
+bool DecomposeApp::LoadIndexedDecomposedImage(
+    const base::FilePath& file_path) const {
+  base::MemoryMappedFile mapped_file;
+  if (!mapped_file.Initialize(file_path)) {
+    LOG(ERROR) << "Unable to map \"" << file_path.value() << "\".";
+    return false;
+  }
+
+  // The loader reads the image data from the original PE file.
+  pe::PEFile pe_file;
+  if (!pe_file.Init(image_path_))
+    return false;
+
+  BlockGraph block_graph(BlockGraph::kArenaAllocation);
+  pe::ImageLayout image_layout(&block_graph);
+  LazyImageLayoutLoader loader;
+  {
+    ScopedTimeLogger scoped_time_logger("Initializing lazy loader");
+    if (!loader.Init(pe_file, mapped_file.data(), mapped_file.length(),
+                     &image_layout)) {
+      LOG(ERROR) << "Unable to initialize lazy image decomposition loader.";
+      return false;
+    }
+  }
+  LOG(INFO) << "Loaded " << block_graph.blocks().size() << " block(s) "
+            << "on initialization.";
+
+  {
+    ScopedTimeLogger scoped_time_logger("Loading remaining blocks");
+    if (!loader.LoadAll()) {
+      LOG(ERROR) << "Unable to load image decomposition.";
+      return false;
+    }
+  }
+
+  LOG(INFO) << "Successfully loaded image decomposition.";
+  return true;
+}
+
 }  // namespace pe
@@ -50,7 +50,10 @@ class DecomposeApp : public application::AppImplBase {
     : application::AppImplBase("Decomposer"),
       benchmark_load_(false),
       graph_only_(false),
-      strip_strings_(false) {
+      indexed_(false),
+      no_dia_(false),
+      strip_strings_(false),
+      jobs_(1) {
   }
 
   bool ParseCommandLine(const base::CommandLine* command_line);
@@ -69,15 +72,23 @@ class DecomposeApp : public application::AppImplBase {
                            const base::FilePath& output_path) const;
 
   bool LoadDecomposedImage(const base::FilePath& file_path) const;
+
+  // Loads a decomposition that was saved in the indexed format, using a
+  // memory mapping of @p file_path and a LazyImageLayoutLoader.
+  bool LoadIndexedDecomposedImage(const base::FilePath& file_path) const;
   // @}
 
   // @name Command-line options.
   // @{
   base::FilePath image_path_;
   base::FilePath output_path_;
+  base::FilePath previous_path_;
   bool benchmark_load_;
   bool graph_only_;
+  bool indexed_;
+  bool no_dia_;
   bool strip_strings_;
+  size_t jobs_;
   // @}
 
  private:
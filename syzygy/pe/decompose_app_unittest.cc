@@ -36,8 +36,13 @@ class TestDecomposeApp : public DecomposeApp {
   // Member variables.
   using DecomposeApp::image_path_;
   using DecomposeApp::output_path_;
+  using DecomposeApp::previous_path_;
   using DecomposeApp::benchmark_load_;
+  using DecomposeApp::graph_only_;
+  using DecomposeApp::indexed_;
   using DecomposeApp::strip_strings_;
+  using DecomposeApp::no_dia_;
+  using DecomposeApp::jobs_;
 };
 
 class DecomposeAppTest : public testing::PELibUnitTest {
@@ -121,6 +126,9 @@ TEST_F(DecomposeAppTest, ParseCommandLineMinimal) {
   ASSERT_EQ(image_path_.value() + L".bg", impl_.output_path_.value());
   ASSERT_FALSE(impl_.benchmark_load_);
   ASSERT_FALSE(impl_.strip_strings_);
+  ASSERT_TRUE(impl_.previous_path_.empty());
+  ASSERT_FALSE(impl_.no_dia_);
+  ASSERT_EQ(1u, impl_.jobs_);
 }
 
 TEST_F(DecomposeAppTest, ParseCommandLineFull) {
@@ -130,14 +138,42 @@ TEST_F(DecomposeAppTest, ParseCommandLineFull) {
 
   cmd_line_.AppendSwitchPath("image", image_path_);
   cmd_line_.AppendSwitchPath("output", output_path_);
+  cmd_line_.AppendSwitchPath("previous", output_path_);
   cmd_line_.AppendSwitch("benchmark-load");
   cmd_line_.AppendSwitch("strip-strings");
+  cmd_line_.AppendSwitch("no-dia");
+  cmd_line_.AppendSwitchASCII("jobs", "4");
 
   ASSERT_TRUE(impl_.ParseCommandLine(&cmd_line_));
   ASSERT_EQ(image_path_, impl_.image_path_);
   ASSERT_EQ(output_path_, impl_.output_path_);
+  ASSERT_EQ(output_path_, impl_.previous_path_);
   ASSERT_TRUE(impl_.benchmark_load_);
   ASSERT_TRUE(impl_.strip_strings_);
+  ASSERT_TRUE(impl_.no_dia_);
+  ASSERT_EQ(4u, impl_.jobs_);
+}
+
+TEST_F(DecomposeAppTest, ParseCommandLineIndexed) {
+  cmd_line_.AppendSwitchPath("image", image_path_);
+  cmd_line_.AppendSwitch("indexed");
+
+  ASSERT_TRUE(impl_.ParseCommandLine(&cmd_line_));
+  ASSERT_TRUE(impl_.indexed_);
+  ASSERT_FALSE(impl_.graph_only_);
+}
+
+TEST_F(DecomposeAppTest, ParseCommandLineIndexedGraphOnlyFails) {
+  cmd_line_.AppendSwitchPath("image", image_path_);
+  cmd_line_.AppendSwitch("indexed");
+  cmd_line_.AppendSwitch("graph-only");
+  ASSERT_FALSE(impl_.ParseCommandLine(&cmd_line_));
+}
+
+TEST_F(DecomposeAppTest, ParseCommandLineInvalidJobs) {
+  cmd_line_.AppendSwitchPath("image", image_path_);
+  cmd_line_.AppendSwitchASCII("jobs", "0");
+  ASSERT_FALSE(impl_.ParseCommandLine(&cmd_line_));
 }
 
 TEST_F(DecomposeAppTest, RunOnTestDll) {
@@ -151,6 +187,17 @@ TEST_F(DecomposeAppTest, RunOnTestDll) {
   ASSERT_EQ(0, app_.Run());
 }
 
+TEST_F(DecomposeAppTest, RunOnTestDllNoDia) {
+  ScopedLogLevelSaver log_level_saver;
+  logging::SetMinLogLevel(logging::LOG_FATAL);
+
+  cmd_line_.AppendSwitchPath("image", image_path_);
+  cmd_line_.AppendSwitchPath("output", output_path_);
+  cmd_line_.AppendSwitch("no-dia");
+
+  ASSERT_EQ(0, app_.Run());
+}
+
 TEST_F(DecomposeAppTest, RunOnTestDllBlockGraphOnlyNoStrings) {
   ScopedLogLevelSaver log_level_saver;
   logging::SetMinLogLevel(logging::LOG_FATAL);
@@ -164,4 +211,39 @@ TEST_F(DecomposeAppTest, RunOnTestDllBlockGraphOnlyNoStrings) {
   ASSERT_EQ(0, app_.Run());
 }
 
+TEST_F(DecomposeAppTest, RunOnTestDllIndexed) {
+  ScopedLogLevelSaver log_level_saver;
+  logging::SetMinLogLevel(logging::LOG_FATAL);
+
+  cmd_line_.AppendSwitchPath("image", image_path_);
+  cmd_line_.AppendSwitchPath("output", output_path_);
+  cmd_line_.AppendSwitch("benchmark-load");
+  cmd_line_.AppendSwitch("indexed");
+
+  ASSERT_EQ(0, app_.Run());
+}
+
+TEST_F(DecomposeAppTest, RunOnTestDllIncremental) {
+  ScopedLogLevelSaver log_level_saver;
+  logging::SetMinLogLevel(logging::LOG_FATAL);
+
+  // Produce a decomposition to be reused.
+  base::FilePath previous_path = temp_dir_.Append(L"previous.bg");
+  cmd_line_.AppendSwitchPath("image", image_path_);
+  cmd_line_.AppendSwitchPath("output", previous_path);
+  cmd_line_.AppendSwitch("graph-only");
+  ASSERT_EQ(0, app_.Run());
+
+  base::CommandLine cmd_line(base::FilePath(L"decompose.exe"));
+  cmd_line.AppendSwitchPath("image", image_path_);
+  cmd_line.AppendSwitchPath("output", output_path_);
+  cmd_line.AppendSwitchPath("previous", previous_path);
+  TestApplication app;
+  app.set_command_line(&cmd_line);
+  app.set_in(in());
+  app.set_out(out());
+  app.set_err(err());
+  ASSERT_EQ(0, app.Run());
+}
+
 }  // namespace pe
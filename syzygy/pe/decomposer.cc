@@ -14,13 +14,20 @@
 
 #include "syzygy/pe/decomposer.h"
 
+#include <algorithm>
+#include <memory>
+
 #include "pcrecpp.h"  // NOLINT
 #include "base/bind.h"
 #include "base/strings/string_split.h"
 #include "base/strings/stringprintf.h"
 #include "base/strings/utf_string_conversions.h"
+#include "base/sys_info.h"
+#include "base/threading/simple_thread.h"
 #include "base/win/scoped_bstr.h"
 #include "base/win/scoped_comptr.h"
+#include "syzygy/block_graph/block_hash.h"
+#include "syzygy/core/chunked_compression.h"
 #include "syzygy/core/zstream.h"
 #include "syzygy/pdb/omap.h"
 #include "syzygy/pdb/pdb_byte_stream.h"
@@ -174,17 +181,30 @@ bool GetCompilandDetailsForCompiland(IDiaSymbol* compiland,
 
 // Stores information regarding known compilers.
 struct KnownCompilerInfo {
-  wchar_t* compiler_name;
+  const char* compiler_name;
   bool supported;
 };
 
 // A list of known compilers, and their status as being supported or not.
-KnownCompilerInfo kKnownCompilerInfos[] = {
-  { L"Microsoft (R) Macro Assembler", false },
-  { L"Microsoft (R) Optimizing Compiler", true },
-  { L"Microsoft (R) LINK", false }
+const KnownCompilerInfo kKnownCompilerInfos[] = {
+  { "Microsoft (R) Macro Assembler", false },
+  { "Microsoft (R) Optimizing Compiler", true },
+  { "Microsoft (R) LINK", false }
 };
 
+// Determines whether the compiler with the given name is one of those that we
+// whitelist.
+bool IsSupportedCompiler(const std::string& compiler_name) {
+  for (size_t i = 0; i < arraysize(kKnownCompilerInfos); ++i) {
+    if (compiler_name == kKnownCompilerInfos[i].compiler_name)
+      return kKnownCompilerInfos[i].supported;
+  }
+
+  // Anything we don't explicitly know about is not supported.
+  VLOG(1) << "Encountered unknown compiler: " << compiler_name;
+  return false;
+}
+
 // Given a compiland, determines whether the compiler used is one of those that
 // we whitelist.
 bool IsBuiltBySupportedCompiler(IDiaSymbol* compiland) {
@@ -211,15 +231,7 @@ bool IsBuiltBySupportedCompiler(IDiaSymbol* compiland) {
   DCHECK_EQ(S_OK, hr);
 
   // Check the compiler name against the list of known compilers.
-  for (size_t i = 0; i < arraysize(kKnownCompilerInfos); ++i) {
-    if (::wcscmp(kKnownCompilerInfos[i].compiler_name, compiler_name) == 0) {
-      return kKnownCompilerInfos[i].supported;
-    }
-  }
-
-  // Anything we don't explicitly know about is not supported.
-  VLOG(1) << "Encountered unknown compiler: " << compiler_name;
-  return false;
+  return IsSupportedCompiler(base::WideToUTF8(common::ToString(compiler_name)));
 }
 
 // Adds an intermediate reference to the provided vector. The vector is
@@ -236,64 +248,98 @@ bool AddIntermediateReference(IntermediateReferences* references,
   return true;
 }
 
-// Create a reference as specified. Ignores existing references if they are of
-// the exact same type.
-bool CreateReference(RelativeAddress src_addr,
-                     BlockGraph::Size ref_size,
-                     ReferenceType ref_type,
-                     RelativeAddress base_addr,
-                     RelativeAddress dst_addr,
-                     BlockGraph::AddressSpace* image) {
-  DCHECK_NE(reinterpret_cast<BlockGraph::AddressSpace*>(NULL), image);
+// Resolves a reference as specified to its source block and offset, and to
+// the reference itself. This only reads from @p image.
+bool ResolveReference(RelativeAddress src_addr,
+                      BlockGraph::Size ref_size,
+                      ReferenceType ref_type,
+                      RelativeAddress base_addr,
+                      RelativeAddress dst_addr,
+                      const BlockGraph::AddressSpace& image,
+                      Block** src_block,
+                      Offset* src_offset,
+                      Reference* ref) {
+  DCHECK_NE(reinterpret_cast<Block**>(NULL), src_block);
+  DCHECK_NE(reinterpret_cast<Offset*>(NULL), src_offset);
+  DCHECK_NE(reinterpret_cast<Reference*>(NULL), ref);
 
   // Get the source block and offset, and ensure that the reference fits
   // within it.
-  Block* src_block = image->GetBlockByAddress(src_addr);
-  if (src_block == NULL) {
+  *src_block = image.GetBlockByAddress(src_addr);
+  if (*src_block == NULL) {
     LOG(ERROR) << "Unable to find block for reference originating at "
                << src_addr << ".";
     return false;
   }
   RelativeAddress src_block_addr;
-  CHECK(image->GetAddressOf(src_block, &src_block_addr));
-  Offset src_block_offset = src_addr - src_block_addr;
-  if (src_block_offset + ref_size > src_block->size()) {
+  CHECK(image.GetAddressOf(*src_block, &src_block_addr));
+  *src_offset = src_addr - src_block_addr;
+  if (*src_offset + ref_size > (*src_block)->size()) {
     LOG(ERROR) << "Reference originating at " << src_addr
-               << " extends beyond block \"" << src_block->name() << "\".";
+               << " extends beyond block \"" << (*src_block)->name() << "\".";
     return false;
   }
 
   // Get the destination block and offset.
-  Block* dst_block = image->GetBlockByAddress(base_addr);
+  Block* dst_block = image.GetBlockByAddress(base_addr);
   if (dst_block == NULL) {
     LOG(ERROR) << "Unable to find block for reference pointing at "
                << base_addr << ".";
     return false;
   }
   RelativeAddress dst_block_addr;
-  CHECK(image->GetAddressOf(dst_block, &dst_block_addr));
+  CHECK(image.GetAddressOf(dst_block, &dst_block_addr));
   Offset base = base_addr - dst_block_addr;
   Offset offset = dst_addr - dst_block_addr;
 
-  Reference ref(ref_type, ref_size, dst_block, offset, base);
+  *ref = Reference(ref_type, ref_size, dst_block, offset, base);
+
+  return true;
+}
+
+// Adds a resolved reference to its source block. Ignores existing references
+// if they are of the exact same type.
+bool AddReference(Block* src_block, Offset src_offset, const Reference& ref) {
+  DCHECK_NE(reinterpret_cast<Block*>(NULL), src_block);
 
   // Check if a reference already exists at this offset.
   Block::ReferenceMap::const_iterator ref_it =
-      src_block->references().find(src_block_offset);
+      src_block->references().find(src_offset);
   if (ref_it != src_block->references().end()) {
     // If an identical reference already exists then we're done.
     if (ref == ref_it->second)
       return true;
     LOG(ERROR) << "Block \"" << src_block->name() << "\" has a conflicting "
-               << "reference at offset " << src_block_offset << ".";
+               << "reference at offset " << src_offset << ".";
     return false;
   }
 
-  CHECK(src_block->SetReference(src_block_offset, ref));
+  CHECK(src_block->SetReference(src_offset, ref));
 
   return true;
 }
 
+// Create a reference as specified. Ignores existing references if they are of
+// the exact same type.
+bool CreateReference(RelativeAddress src_addr,
+                     BlockGraph::Size ref_size,
+                     ReferenceType ref_type,
+                     RelativeAddress base_addr,
+                     RelativeAddress dst_addr,
+                     BlockGraph::AddressSpace* image) {
+  DCHECK_NE(reinterpret_cast<BlockGraph::AddressSpace*>(NULL), image);
+
+  Block* src_block = NULL;
+  Offset src_offset = 0;
+  Reference ref;
+  if (!ResolveReference(src_addr, ref_size, ref_type, base_addr, dst_addr,
+                        *image, &src_block, &src_offset, &ref)) {
+    return false;
+  }
+
+  return AddReference(src_block, src_offset, ref);
+}
+
 // Loads FIXUP and OMAP_FROM debug streams.
 bool LoadDebugStreams(IDiaSession* dia_session,
                       PdbFixups* pdb_fixups,
@@ -372,29 +418,69 @@ bool GetFixupDestinationAndType(const PEFile& image_file,
   return true;
 }
 
-// Creates references from the @p pdb_fixups (translating them via the
-// provided @p omap_from information if it is not empty), all while removing the
-// corresponding entries from @p reloc_set. If @p reloc_set is not empty after
-// this then the PDB fixups are out of sync with the image and we are unable to
-// safely decompose.
-//
-// @note This function deliberately ignores fixup information for the resource
-//     section. This is because chrome.dll gets modified by a manifest tool
-//     which doesn't update the FIXUPs in the corresponding PDB. They are thus
-//     out of sync. Even if they were in sync this doesn't harm us as we have no
-//     need to reach in and modify resource data.
-bool CreateReferencesFromFixupsImpl(
-    const PEFile& image_file,
-    const PdbFixups& pdb_fixups,
-    const OMAPs& omap_from,
-    PEFile::RelocSet* reloc_set,
-    BlockGraph::AddressSpace* image) {
-  DCHECK_NE(reinterpret_cast<PEFile::RelocSet*>(NULL), reloc_set);
-  DCHECK_NE(reinterpret_cast<BlockGraph::AddressSpace*>(NULL), image);
+// A fixup that has been resolved to the reference it describes.
+struct ResolvedFixup {
+  RelativeAddress src_addr;
+  Block* src_block;
+  Offset src_offset;
+  Reference ref;
+};
+typedef std::vector<ResolvedFixup> ResolvedFixups;
+
+// Resolves a contiguous range of PDB fixups to references, translating them
+// via the provided OMAP information if it is not empty. This only reads from
+// the image file and the address space, neither of which is modified while
+// the fixups are being resolved, so batches can be run concurrently. The
+// resolved references are buffered, and are later added to the block-graph
+// in fixup order.
+class FixupBatch : public base::DelegateSimpleThread::Delegate {
+ public:
+  FixupBatch(const PEFile& image_file,
+             const PdbFixups& pdb_fixups,
+             const OMAPs& omap_from,
+             const BlockGraph::AddressSpace& image,
+             size_t begin,
+             size_t end)
+      : image_file_(image_file), pdb_fixups_(pdb_fixups),
+        omap_from_(omap_from), image_(image), begin_(begin), end_(end),
+        succeeded_(false) {
+    DCHECK_LE(begin, end);
+    DCHECK_LE(end, pdb_fixups.size());
+  }
+
+  // Resolves the fixups of this batch. Stops at the first invalid fixup.
+  void Run() override;
+
+  // @name Accessors.
+  // @{
+  bool succeeded() const { return succeeded_; }
+  const ResolvedFixups& resolved() const { return resolved_; }
+  // @}
 
-  bool have_omap = !omap_from.empty();
-  size_t fixups_used = 0;
+ private:
+  // Resolves the fixup at index @p i, adding it to resolved_ unless it is
+  // to be ignored.
+  // @returns true on success, false on error.
+  bool ResolveFixup(size_t i);
+
+  const PEFile& image_file_;
+  const PdbFixups& pdb_fixups_;
+  const OMAPs& omap_from_;
+  const BlockGraph::AddressSpace& image_;
+  size_t begin_;
+  size_t end_;
+
+  // The extent of the resource section.
+  RelativeAddress rsrc_start_;
+  RelativeAddress rsrc_end_;
+
+  bool succeeded_;
+  ResolvedFixups resolved_;
+
+  DISALLOW_COPY_AND_ASSIGN(FixupBatch);
+};
 
+void FixupBatch::Run() {
   // The resource section in Chrome is modified post-link by a tool that adds a
   // manifest to it. This causes all of the fixups in the resource section (and
   // anything beyond it) to be invalid. As long as the resource section is the
@@ -402,79 +488,158 @@ bool CreateReferencesFromFixupsImpl(
   // .rsrc fixups, which we know how to parse without them). However, if there
   // is a section after the resource section, things will have been shifted
   // and potentially crucial fixups will be invalid.
-  const IMAGE_SECTION_HEADER* rsrc_header = image_file.GetSectionHeader(
+  const IMAGE_SECTION_HEADER* rsrc_header = image_file_.GetSectionHeader(
       kResourceSectionName);
-  RelativeAddress rsrc_start(0xffffffff);
-  RelativeAddress rsrc_end(0xffffffff);
+  rsrc_start_ = RelativeAddress(0xffffffff);
+  rsrc_end_ = RelativeAddress(0xffffffff);
   if (rsrc_header != NULL) {
-    rsrc_start = RelativeAddress(rsrc_header->VirtualAddress);
-    rsrc_end = rsrc_start + rsrc_header->Misc.VirtualSize;
+    rsrc_start_ = RelativeAddress(rsrc_header->VirtualAddress);
+    rsrc_end_ = rsrc_start_ + rsrc_header->Misc.VirtualSize;
   }
 
-  // Ensure the fixups are all valid.
-  for (size_t i = 0; i < pdb_fixups.size(); ++i) {
-    if (!pdb_fixups[i].ValidHeader()) {
-      LOG(ERROR) << "Unknown fixup header: "
-                 << base::StringPrintf("0x%08X.", pdb_fixups[i].header);
-      return false;
-    }
+  resolved_.reserve(end_ - begin_);
+  for (size_t i = begin_; i < end_; ++i) {
+    if (!ResolveFixup(i))
+      return;
+  }
+  succeeded_ = true;
+}
 
-    // For now, we skip any offset fixups. We've only seen this in the context
-    // of TLS data access, and we don't mess with TLS structures.
-    if (pdb_fixups[i].is_offset())
-      continue;
+bool FixupBatch::ResolveFixup(size_t i) {
+  const pdb::PdbFixup& fixup = pdb_fixups_[i];
+  if (!fixup.ValidHeader()) {
+    LOG(ERROR) << "Unknown fixup header: "
+               << base::StringPrintf("0x%08X.", fixup.header);
+    return false;
+  }
 
-    // All fixups we handle should be full size pointers.
-    DCHECK_EQ(Reference::kMaximumSize, pdb_fixups[i].size());
-
-    // Get the original addresses, and map them through OMAP information.
-    // Normally DIA takes care of this for us, but there is no API for
-    // getting DIA to give us FIXUP information, so we have to do it manually.
-    RelativeAddress src_addr(pdb_fixups[i].rva_location);
-    RelativeAddress base_addr(pdb_fixups[i].rva_base);
-    if (have_omap) {
-      src_addr = pdb::TranslateAddressViaOmap(omap_from, src_addr);
-      base_addr = pdb::TranslateAddressViaOmap(omap_from, base_addr);
-    }
+  // For now, we skip any offset fixups. We've only seen this in the context
+  // of TLS data access, and we don't mess with TLS structures.
+  if (fixup.is_offset())
+    return true;
 
-    // If the reference originates beyond the .rsrc section then we can't
-    // trust it.
-    if (src_addr >= rsrc_end) {
-      LOG(ERROR) << "Found fixup originating beyond .rsrc section.";
-      return false;
-    }
+  // All fixups we handle should be full size pointers.
+  DCHECK_EQ(Reference::kMaximumSize, fixup.size());
 
-    // If the reference originates from a part of the .rsrc section, ignore it.
-    if (src_addr >= rsrc_start)
-      continue;
+  // Get the original addresses, and map them through OMAP information.
+  // Normally DIA takes care of this for us, but there is no API for
+  // getting DIA to give us FIXUP information, so we have to do it manually.
+  RelativeAddress src_addr(fixup.rva_location);
+  RelativeAddress base_addr(fixup.rva_base);
+  if (!omap_from_.empty()) {
+    src_addr = pdb::TranslateAddressViaOmap(omap_from_, src_addr);
+    base_addr = pdb::TranslateAddressViaOmap(omap_from_, base_addr);
+  }
 
-    // Get the relative address/displacement of the fixup. This logs on failure.
-    RelativeAddress dst_addr;
-    ReferenceType type = BlockGraph::RELATIVE_REF;
-    if (!GetFixupDestinationAndType(image_file, pdb_fixups[i], &dst_addr,
-                                    &type)) {
-      return false;
-    }
+  // If the reference originates beyond the .rsrc section then we can't
+  // trust it.
+  if (src_addr >= rsrc_end_) {
+    LOG(ERROR) << "Found fixup originating beyond .rsrc section.";
+    return false;
+  }
+
+  // If the reference originates from a part of the .rsrc section, ignore it.
+  if (src_addr >= rsrc_start_)
+    return true;
+
+  // Get the relative address/displacement of the fixup. This logs on failure.
+  RelativeAddress dst_addr;
+  ReferenceType type = BlockGraph::RELATIVE_REF;
+  if (!GetFixupDestinationAndType(image_file_, fixup, &dst_addr, &type))
+    return false;
+
+  // Resolve the reference. This logs verbosely for us on failure.
+  ResolvedFixup resolved = { src_addr, NULL, 0, Reference() };
+  if (!ResolveReference(src_addr, Reference::kMaximumSize, type, base_addr,
+                        dst_addr, image_, &resolved.src_block,
+                        &resolved.src_offset, &resolved.ref)) {
+    return false;
+  }
+  resolved_.push_back(resolved);
+
+  return true;
+}
+
+// Creates references from the @p pdb_fixups (translating them via the
+// provided @p omap_from information if it is not empty), all while removing the
+// corresponding entries from @p reloc_set. If @p reloc_set is not empty after
+// this then the PDB fixups are out of sync with the image and we are unable to
+// safely decompose. The fixups are resolved using up to @p thread_count
+// threads, but the references are created in fixup order on the calling
+// thread, so the result doesn't depend on the number of threads.
+//
+// @note This function deliberately ignores fixup information for the resource
+//     section. This is because chrome.dll gets modified by a manifest tool
+//     which doesn't update the FIXUPs in the corresponding PDB. They are thus
+//     out of sync. Even if they were in sync this doesn't harm us as we have no
+//     need to reach in and modify resource data.
+bool CreateReferencesFromFixupsImpl(
+    const PEFile& image_file,
+    const PdbFixups& pdb_fixups,
+    const OMAPs& omap_from,
+    size_t thread_count,
+    size_t min_fixups_per_batch,
+    PEFile::RelocSet* reloc_set,
+    BlockGraph::AddressSpace* image) {
+  DCHECK_NE(reinterpret_cast<PEFile::RelocSet*>(NULL), reloc_set);
+  DCHECK_NE(reinterpret_cast<BlockGraph::AddressSpace*>(NULL), image);
 
-    // Finally, create the reference. This logs verbosely for us on failure.
-    if (!CreateReference(src_addr, Reference::kMaximumSize, type, base_addr,
-                         dst_addr, image)) {
+  // Split the fixups into batches. A few batches per thread balance the load
+  // between the threads, but batches are kept large enough for the overhead
+  // of scheduling them to be negligible.
+  size_t batch_count = 1;
+  if (thread_count > 1) {
+    batch_count = std::min(4 * thread_count,
+                           pdb_fixups.size() / min_fixups_per_batch);
+    batch_count = std::max<size_t>(batch_count, 1);
+  }
+  size_t batch_size = (pdb_fixups.size() + batch_count - 1) / batch_count;
+  std::vector<std::unique_ptr<FixupBatch>> batches;
+  for (size_t begin = 0; begin < pdb_fixups.size(); begin += batch_size) {
+    size_t end = std::min(begin + batch_size, pdb_fixups.size());
+    batches.push_back(std::unique_ptr<FixupBatch>(new FixupBatch(
+        image_file, pdb_fixups, omap_from, *image, begin, end)));
+  }
+
+  if (batches.size() <= 1) {
+    for (size_t i = 0; i < batches.size(); ++i)
+      batches[i]->Run();
+  } else {
+    base::DelegateSimpleThreadPool pool(
+        "DecomposerFixups",
+        static_cast<int>(std::min(thread_count, batches.size())));
+    pool.Start();
+    for (size_t i = 0; i < batches.size(); ++i)
+      pool.AddWork(batches[i].get());
+    pool.JoinAll();
+  }
+
+  for (size_t i = 0; i < batches.size(); ++i) {
+    // The batch has already logged the error.
+    if (!batches[i]->succeeded())
       return false;
-    }
 
-    // Remove this reference from the relocs.
-    PEFile::RelocSet::iterator reloc_it = reloc_set->find(src_addr);
-    if (reloc_it != reloc_set->end()) {
-      // We should only find a reloc if the fixup was of absolute type.
-      if (type != BlockGraph::ABSOLUTE_REF) {
-        LOG(ERROR) << "Found a reloc corresponding to a non-absolute fixup.";
+    const ResolvedFixups& resolved = batches[i]->resolved();
+    for (size_t j = 0; j < resolved.size(); ++j) {
+      // Finally, create the reference. This logs verbosely for us on failure.
+      if (!AddReference(resolved[j].src_block, resolved[j].src_offset,
+                        resolved[j].ref)) {
         return false;
       }
 
-      reloc_set->erase(reloc_it);
-    }
+      // Remove this reference from the relocs.
+      PEFile::RelocSet::iterator reloc_it =
+          reloc_set->find(resolved[j].src_addr);
+      if (reloc_it != reloc_set->end()) {
+        // We should only find a reloc if the fixup was of absolute type.
+        if (resolved[j].ref.type() != BlockGraph::ABSOLUTE_REF) {
+          LOG(ERROR) << "Found a reloc corresponding to a non-absolute fixup.";
+          return false;
+        }
 
-    ++fixups_used;
+        reloc_set->erase(reloc_it);
+      }
+    }
   }
 
   return true;
@@ -777,6 +942,85 @@ void GuessDataBlockAlignments(const PEFile& pe_file,
   }
 }
 
+// The block attributes that are derived from symbols, and that are copied
+// along with the labels of reused blocks in incremental mode.
+const BlockGraph::BlockAttributes kSymbolBlockAttributes =
+    BlockGraph::NON_RETURN_FUNCTION | BlockGraph::HAS_INLINE_ASSEMBLY |
+    BlockGraph::HAS_EXCEPTION_HANDLING | BlockGraph::THUNK;
+
+// Identifies a block across decompositions of different builds of an image.
+// The hash accounts for the block type, size, data and the layout of its
+// references, but not for its address nor for the targets of its
+// references.
+typedef std::pair<block_graph::BlockHash, base::StringPiece> BlockKey;
+typedef std::map<BlockKey, const Block*> BlockKeyMap;
+
+// @returns true if @p block is a candidate for reuse in incremental mode.
+//     Only plain section contributions are reused; blocks that were parsed
+//     from the PE headers or that were built from COFF groups are named and
+//     labeled by other means.
+bool IsReusableBlock(const Block& block) {
+  if ((block.attributes() & BlockGraph::SECTION_CONTRIB) == 0)
+    return false;
+  if (block.attributes() & (BlockGraph::PE_PARSED | BlockGraph::COFF_GROUP))
+    return false;
+  return true;
+}
+
+// Adds a block to a key map. Blocks whose keys collide are ambiguous, and
+// are marked as such with a NULL entry.
+void AddBlockKey(const Block& block, BlockKeyMap* key_map) {
+  DCHECK_NE(static_cast<BlockKeyMap*>(NULL), key_map);
+  BlockKey key(block_graph::BlockHash(&block), block.compiland_name());
+  std::pair<BlockKeyMap::iterator, bool> result =
+      key_map->insert(std::make_pair(key, &block));
+  if (!result.second)
+    result.first->second = NULL;
+}
+
+// @returns true if @p label_name, which holds one or more symbol names
+//     separated by Decomposer::kLabelNameSep, contains @p name.
+bool LabelNameContains(const std::string& label_name, const std::string& name) {
+  std::vector<std::string> names;
+  base::SplitStringUsingSubstr(label_name, Decomposer::kLabelNameSep, &names);
+  return std::find(names.begin(), names.end(), name) != names.end();
+}
+
+// A DiaBrowser callback that records the address and name of a function or
+// thunk symbol, without visiting its children.
+DiaBrowser::BrowserDirective CollectFunctionName(
+    Decomposer::FunctionNameMap* function_names,
+    const DiaBrowser& dia_browser,
+    const DiaBrowser::SymTagVector& sym_tags,
+    const DiaBrowser::SymbolPtrVector& symbols) {
+  DCHECK_NE(static_cast<Decomposer::FunctionNameMap*>(NULL), function_names);
+  DCHECK(!symbols.empty());
+  DiaBrowser::SymbolPtr symbol = symbols.back();
+
+  HRESULT hr = E_FAIL;
+  DWORD location_type = LocIsNull;
+  DWORD rva = 0;
+  ScopedBstr name_bstr;
+  if (FAILED(hr = symbol->get_locationType(&location_type)) ||
+      FAILED(hr = symbol->get_relativeVirtualAddress(&rva)) ||
+      FAILED(hr = symbol->get_name(name_bstr.Receive()))) {
+    LOG(ERROR) << "Failed to get function/thunk properties: "
+               << common::LogHr(hr) << ".";
+    return DiaBrowser::kBrowserAbort;
+  }
+  if (location_type != LocIsStatic)
+    return DiaBrowser::kBrowserTerminatePath;
+
+  std::string name;
+  if (!base::WideToUTF8(name_bstr, name_bstr.Length(), &name)) {
+    LOG(ERROR) << "Failed to convert function/thunk name to UTF8.";
+    return DiaBrowser::kBrowserAbort;
+  }
+  function_names->insert(std::make_pair(RelativeAddress(rva), name));
+
+  return DiaBrowser::kBrowserTerminatePath;
+}
+
 }  // namespace
 
 // We use ", " as a separator between symbol names. We sometimes see commas
@@ -784,6 +1028,8 @@ void GuessDataBlockAlignments(const PEFile& pe_file,
 // separator that is also human friendly to read.
 const char Decomposer::kLabelNameSep[] = ", ";
 
+const size_t Decomposer::kDefaultMinFixupsPerBatch = 4096;
+
 // This is by CreateBlocksFromCoffGroups to communicate shared state to
 // VisitLinkerSymbol via the VisitSymbols helper function.
 struct Decomposer::VisitLinkerSymbolContext {
@@ -812,7 +1058,9 @@ struct Decomposer::VisitLinkerSymbolContext {
 };
 
 Decomposer::Decomposer(const PEFile& image_file)
-    : image_file_(image_file), image_layout_(NULL), image_(NULL),
+    : image_file_(image_file), previous_block_graph_(NULL), thread_count_(1),
+      min_fixups_per_batch_(kDefaultMinFixupsPerBatch),
+      symbol_backend_(kDiaSymbolBackend), image_layout_(NULL), image_(NULL),
       current_block_(NULL), current_scope_count_(0) {
 }
 
@@ -844,6 +1092,7 @@ bool Decomposer::Decompose(ImageLayout* image_layout) {
   }
 
   // At this point a full decomposition needs to be performed.
+  reused_blocks_.clear();
   image_layout_ = image_layout;
   image_ = &(image_layout->blocks);
   bool success = DecomposeImpl();
@@ -887,15 +1136,25 @@ bool Decomposer::LoadBlockGraphFromPdbStream(
   DCHECK_NE(reinterpret_cast<ImageLayout*>(NULL), image_layout);
   LOG(INFO) << "Reading block-graph and image layout from the PDB.";
 
-  // Initialize an input archive pointing to the stream.
-  scoped_refptr<pdb::PdbByteStream> byte_stream = new pdb::PdbByteStream();
-  if (!byte_stream->Init(block_graph_stream))
-    return false;
-  DCHECK_NE(reinterpret_cast<pdb::PdbByteStream*>(NULL), byte_stream.get());
+  // A stream whose pages are contiguous in a mapped PDB is read in place.
+  // Otherwise its contents are gathered in a byte stream.
+  const uint8_t* stream_data = NULL;
+  size_t stream_size = block_graph_stream->length();
+  pdb::PdbStream::Spans spans;
+  scoped_refptr<pdb::PdbByteStream> byte_stream;
+  if (block_graph_stream->GetSpans(0, stream_size, &spans) &&
+      spans.size() == 1) {
+    stream_data = spans[0].first;
+  } else {
+    byte_stream = new pdb::PdbByteStream();
+    if (!byte_stream->Init(block_graph_stream))
+      return false;
+    stream_data = byte_stream->data();
+  }
 
   core::ScopedInStreamPtr pdb_in_stream;
-  pdb_in_stream.reset(core::CreateByteInStream(
-      byte_stream->data(), byte_stream->data() + byte_stream->length()));
+  pdb_in_stream.reset(
+      core::CreateByteInStream(stream_data, stream_data + stream_size));
 
   // Read the header.
   uint32_t stream_version = 0;
@@ -909,26 +1168,48 @@ bool Decomposer::LoadBlockGraphFromPdbStream(
   }
 
   // Check the stream version.
-  if (stream_version != pdb::kSyzygyBlockGraphStreamVersion) {
+  if (stream_version < pdb::kSyzygyBlockGraphStreamMinimumVersion ||
+      stream_version > pdb::kSyzygyBlockGraphStreamVersion) {
     LOG(ERROR) << "PDB contains an unsupported Syzygy block-graph stream"
                << " version (got " << stream_version << ", expected "
                << pdb::kSyzygyBlockGraphStreamVersion << ").";
     return false;
   }
 
-  // If the stream is compressed insert the decompression filter.
+  // Insert the decompression filter if the stream is zlib compressed. The
+  // chunks of a chunked compression container are decompressed up front, in
+  // parallel.
   core::InStream* in_stream = pdb_in_stream.get();
   std::unique_ptr<core::ZInStream> zip_in_stream;
-  if (compressed != 0) {
+  std::vector<uint8_t> decompressed;
+  core::ScopedInStreamPtr decompressed_in_stream;
+  if (compressed == pdb::kSyzygyBlockGraphStreamZlibCompressed) {
     zip_in_stream.reset(new core::ZInStream(in_stream));
     if (!zip_in_stream->Init()) {
       LOG(ERROR) << "Unable to initialize ZInStream.";
       return false;
     }
     in_stream = zip_in_stream.get();
+  } else if (compressed == pdb::kSyzygyBlockGraphStreamChunkCompressed &&
+             stream_version > pdb::kSyzygyBlockGraphStreamMinimumVersion) {
+    const size_t kHeaderSize = sizeof(stream_version) + sizeof(compressed);
+    core::ChunkedDecompressor decompressor;
+    if (!decompressor.Init(stream_data + kHeaderSize,
+                           stream_size - kHeaderSize) ||
+        !decompressor.DecompressAll(base::SysInfo::NumberOfProcessors(),
+                                    &decompressed)) {
+      LOG(ERROR) << "Failed to decompress Syzygy block-graph stream.";
+      return false;
+    }
+    decompressed_in_stream.reset(core::CreateByteInStream(
+        decompressed.data(), decompressed.data() + decompressed.size()));
+    in_stream = decompressed_in_stream.get();
+  } else if (compressed != pdb::kSyzygyBlockGraphStreamUncompressed) {
+    LOG(ERROR) << "Unknown Syzygy block-graph stream compression "
+               << static_cast<int>(compressed) << ".";
+    return false;
   }
 
-  // Deserialize the image-layout.
   core::NativeBinaryInArchive in_archive(in_stream);
   block_graph::BlockGraphSerializer::Attributes attributes = 0;
   if (!LoadBlockGraphAndImageLayout(
@@ -949,7 +1230,7 @@ bool Decomposer::LoadBlockGraphFromPdb(const base::FilePath& pdb_path,
 
   pdb::PdbFile pdb_file;
   pdb::PdbReader pdb_reader;
-  if (!pdb_reader.Read(pdb_path, &pdb_file)) {
+  if (!pdb_reader.ReadMapped(pdb_path, &pdb_file)) {
     LOG(ERROR) << "Unable to read the PDB named \"" << pdb_path.value()
                << "\".";
     return NULL;
@@ -982,14 +1263,22 @@ bool Decomposer::LoadBlockGraphFromPdb(const base::FilePath& pdb_path,
 }
 
 bool Decomposer::DecomposeImpl() {
-  // Instantiate and initialize our Debug Interface Access session. This logs
-  // verbosely for us.
+  // Instantiate and initialize our Debug Interface Access session, or read
+  // the symbols directly from the PDB streams. This logs verbosely for us.
+  bool use_dia = symbol_backend_ == kDiaSymbolBackend;
   ScopedComPtr<IDiaDataSource> dia_source;
   ScopedComPtr<IDiaSession> dia_session;
   ScopedComPtr<IDiaSymbol> global;
-  if (!InitializeDia(image_file_, pdb_path_, dia_source.Receive(),
-                     dia_session.Receive(), global.Receive())) {
-    return false;
+  PdbSymbolReader symbol_reader;
+  if (use_dia) {
+    if (!InitializeDia(image_file_, pdb_path_, dia_source.Receive(),
+                       dia_session.Receive(), global.Receive())) {
+      return false;
+    }
+  } else {
+    VLOG(1) << "Reading PDB symbols.";
+    if (!symbol_reader.Init(pdb_path_))
+      return false;
   }
 
   // Copy the image headers to the layout.
@@ -1023,12 +1312,16 @@ bool Decomposer::DecomposeImpl() {
     // existing PE parsed blocks, but when they do we expect them to be exact
     // collisions.
     VLOG(1) << "Parsing section contributions.";
-    if (!CreateBlocksFromSectionContribs(dia_session.get()))
+    if (use_dia ? !CreateBlocksFromSectionContribs(dia_session.get()) :
+                  !CreateBlocksFromSectionContribs(symbol_reader)) {
       return false;
+    }
 
     VLOG(1) << "Finding cold blocks.";
-    if (!FindColdBlocksFromCompilands(dia_session.get()))
+    if (use_dia ? !FindColdBlocksFromCompilands(dia_session.get()) :
+                  !FindColdBlocksFromCompilands(symbol_reader)) {
       return false;
+    }
 
     // Flesh out the rest of the image with gap blocks.
     VLOG(1) << "Creating gap blocks.";
@@ -1043,13 +1336,33 @@ bool Decomposer::DecomposeImpl() {
 
   // Parse the fixups and use them to create references.
   VLOG(1) << "Parsing fixups.";
-  if (!CreateReferencesFromFixups(dia_session.get()))
+  if (use_dia ? !CreateReferencesFromFixups(dia_session.get()) :
+                !CreateReferencesFromFixups(symbol_reader.fixups(),
+                                            std::vector<OMAP>())) {
     return false;
+  }
+
+  // In incremental mode, copy the symbol information of the blocks that are
+  // unchanged since the previous decomposition.
+  if (previous_block_graph_ != NULL) {
+    VLOG(1) << "Reusing unchanged blocks.";
+    FunctionNameMap function_names;
+    if (use_dia) {
+      if (!GetFunctionNames(global.get(), &function_names))
+        return false;
+    } else {
+      GetFunctionNames(symbol_reader, &function_names);
+    }
+    if (!ReuseUnchangedBlocks(function_names))
+      return false;
+  }
 
   // Annotate the block-graph with symbol information.
   VLOG(1) << "Parsing symbols.";
-  if (!ProcessSymbols(global.get()))
+  if (use_dia ? !ProcessSymbols(global.get()) :
+                !ProcessSymbols(symbol_reader)) {
     return false;
+  }
 
   // Now, find and label any padding blocks.
   VLOG(1) << "Labeling padding blocks.";
@@ -1091,7 +1404,7 @@ bool Decomposer::CreatePEImageBlocksAndReferences(
 bool Decomposer::CreateBlocksFromCoffGroups() {
   pdb::PdbFile pdb_file;
   pdb::PdbReader pdb_reader;
-  if (!pdb_reader.Read(pdb_path_, &pdb_file)) {
+  if (!pdb_reader.ReadMapped(pdb_path_, &pdb_file)) {
     LOG(ERROR) << "Failed to load PDB: " << pdb_path_.value();
     return false;
   }
@@ -1128,8 +1441,6 @@ bool Decomposer::CreateBlocksFromSectionContribs(IDiaSession* session) {
     return false;
   }
 
-  size_t rsrc_id = image_file_.GetSectionIndex(kResourceSectionName);
-
   LONG count = 0;
   if (section_contribs->get_Count(&count) != S_OK) {
     LOG(ERROR) << "Failed to get section contributions enumeration length.";
@@ -1180,10 +1491,6 @@ bool Decomposer::CreateBlocksFromSectionContribs(IDiaSession* session) {
     DCHECK_LT(0u, section_id);
     --section_id;
 
-    // We don't parse the resource section, as it is parsed by the PEFileParser.
-    if (section_id == rsrc_id)
-      continue;
-
     std::string compiland_name;
     if (!base::WideToUTF8(bstr_compiland_name, bstr_compiland_name.Length(),
                           &compiland_name)) {
@@ -1191,47 +1498,95 @@ bool Decomposer::CreateBlocksFromSectionContribs(IDiaSession* session) {
       return false;
     }
 
-    // Give a name to the block based on the basename of the object file. This
-    // will eventually be replaced by the full symbol name, if one exists for
-    // the block.
-    size_t last_component = compiland_name.find_last_of('\\');
-    size_t extension = compiland_name.find_last_of('.');
-    if (last_component == std::string::npos) {
-      last_component = 0;
+    if (!CreateSectionContribBlock(RelativeAddress(rva), length, section_id,
+                                   code == TRUE, compiland_name,
+                                   is_built_by_supported_compiler)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool Decomposer::CreateBlocksFromSectionContribs(
+    const PdbSymbolReader& reader) {
+  const PdbSymbolReader::SectionContribs& contribs = reader.section_contribs();
+  for (size_t i = 0; i < contribs.size(); ++i) {
+    const PdbSymbolReader::Module& module =
+        reader.modules()[contribs[i].module];
+
+    // Modules without compiler information are assumed to be built by an
+    // unsupported compiler.
+    bool is_built_by_supported_compiler = false;
+    if (module.compiler_name.empty()) {
+      VLOG(1) << "Compiland has no compiland details: " << module.name;
     } else {
-      // We don't want to include the last slash.
-      ++last_component;
+      is_built_by_supported_compiler =
+          IsSupportedCompiler(module.compiler_name);
     }
-    if (extension < last_component)
-      extension = compiland_name.size();
-    std::string name = compiland_name.substr(last_component,
-                                             extension - last_component);
-
-    // TODO(chrisha): We see special section contributions with the name
-    //     "* CIL *". These are concatenations of data symbols and can very
-    //     likely be chunked using symbols directly. A cursory visual inspection
-    //     of symbol names hints that these might be related to WPO.
-
-    // Create the block.
-    BlockType block_type =
-        code ? BlockGraph::CODE_BLOCK : BlockGraph::DATA_BLOCK;
-    Block* block = CreateBlockOrFindCoveringPeBlock(
-        block_type, RelativeAddress(rva), length, name);
-    if (block == NULL) {
-      LOG(ERROR) << "Unable to create block for compiland \""
-                 << compiland_name << "\".";
+
+    if (!CreateSectionContribBlock(contribs[i].addr, contribs[i].size,
+                                   contribs[i].section, contribs[i].code,
+                                   module.name,
+                                   is_built_by_supported_compiler)) {
       return false;
     }
+  }
+
+  return true;
+}
 
-    // Set the block compiland name.
-    block->set_compiland_name(compiland_name);
+bool Decomposer::CreateSectionContribBlock(
+    RelativeAddress addr,
+    BlockGraph::Size size,
+    size_t section,
+    bool code,
+    const std::string& compiland_name,
+    bool is_built_by_supported_compiler) {
+  // We don't parse the resource section, as it is parsed by the PEFileParser.
+  if (section == image_file_.GetSectionIndex(kResourceSectionName))
+    return true;
 
-    // Set the block attributes.
-    block->set_attribute(BlockGraph::SECTION_CONTRIB);
-    if (!is_built_by_supported_compiler)
-      block->set_attribute(BlockGraph::BUILT_BY_UNSUPPORTED_COMPILER);
+  // Give a name to the block based on the basename of the object file. This
+  // will eventually be replaced by the full symbol name, if one exists for
+  // the block.
+  size_t last_component = compiland_name.find_last_of('\\');
+  size_t extension = compiland_name.find_last_of('.');
+  if (last_component == std::string::npos) {
+    last_component = 0;
+  } else {
+    // We don't want to include the last slash.
+    ++last_component;
+  }
+  if (extension < last_component)
+    extension = compiland_name.size();
+  std::string name = compiland_name.substr(last_component,
+                                           extension - last_component);
+
+  // TODO(chrisha): We see special section contributions with the name
+  //     "* CIL *". These are concatenations of data symbols and can very
+  //     likely be chunked using symbols directly. A cursory visual
+  //     inspection of symbol names hints that these might be related to WPO.
+
+  // Create the block.
+  BlockType block_type =
+      code ? BlockGraph::CODE_BLOCK : BlockGraph::DATA_BLOCK;
+  Block* block = CreateBlockOrFindCoveringPeBlock(block_type, addr, size,
+                                                  name);
+  if (block == NULL) {
+    LOG(ERROR) << "Unable to create block for compiland \""
+               << compiland_name << "\".";
+    return false;
   }
 
+  // Set the block compiland name.
+  block->set_compiland_name(compiland_name);
+
+  // Set the block attributes.
+  block->set_attribute(BlockGraph::SECTION_CONTRIB);
+  if (!is_built_by_supported_compiler)
+    block->set_attribute(BlockGraph::BUILT_BY_UNSUPPORTED_COMPILER);
+
   return true;
 }
 
@@ -1320,39 +1675,72 @@ bool Decomposer::FindColdBlocksFromCompilands(IDiaSession* session) {
         return false;
       }
 
-      // Retrieve the function block.
-      Block* func_block = image_->GetBlockByAddress(RelativeAddress(func_rva));
-      if (func_block == NULL) {
-        LOG(ERROR) << "Cannot retrieve parent block.";
+      if (!AddColdBlock(RelativeAddress(func_rva),
+                        static_cast<size_t>(func_length),
+                        RelativeAddress(block_rva))) {
         return false;
       }
+    }
+  }
 
-      // Skip blocks within the range of its parent.
-      if (block_rva >= func_rva && block_rva <= func_rva + func_length)
-        continue;
+  return true;
+}
 
-      // A cold block is detected and needs special handling.
-      Block* cold_block = image_->GetBlockByAddress(RelativeAddress(block_rva));
-      if (cold_block == NULL) {
-        LOG(ERROR) << "Cannot retrieve parent block.";
-        return false;
+bool Decomposer::FindColdBlocksFromCompilands(const PdbSymbolReader& reader) {
+  // The lexical blocks of functions and the separated code blocks both
+  // indicate hot/cold code separation.
+  for (size_t i = 0; i < reader.modules().size(); ++i) {
+    const PdbSymbolReader::Symbols& symbols = reader.modules()[i].symbols;
+    for (size_t j = 0; j < symbols.size(); ++j) {
+      const PdbSymbolReader::Symbol& symbol = symbols[j];
+      if (symbol.kind != PdbSymbolReader::kScopeSymbol &&
+          symbol.kind != PdbSymbolReader::kSeparatedCodeSymbol) {
+        continue;
       }
-
-      RelativeAddress cold_block_addr;
-      if (!image_->GetAddressOf(cold_block, &cold_block_addr)) {
-        LOG(ERROR) << "Cannot retrieve cold block address.";
+      if ((symbol.flags & PdbSymbolReader::kFunctionParentFlag) == 0)
+        continue;
+      if (!AddColdBlock(symbol.parent_addr, symbol.parent_size, symbol.addr))
         return false;
-      }
+    }
+  }
 
-      // Add cold_block as a child of the function block.
-      cold_blocks_[func_block][cold_block_addr] = cold_block;
+  return true;
+}
 
-      // Set the parent relation for blocks belonging to the function block.
-      cold_blocks_parent_[func_block] = func_block;
-      cold_blocks_parent_[cold_block] = func_block;
-    }
+bool Decomposer::AddColdBlock(RelativeAddress func_addr,
+                              size_t func_length,
+                              RelativeAddress block_addr) {
+  // Retrieve the function block.
+  Block* func_block = image_->GetBlockByAddress(func_addr);
+  if (func_block == NULL) {
+    LOG(ERROR) << "Cannot retrieve parent block.";
+    return false;
   }
 
+  // Skip blocks within the range of its parent.
+  if (block_addr >= func_addr && block_addr <= func_addr + func_length)
+    return true;
+
+  // A cold block is detected and needs special handling.
+  Block* cold_block = image_->GetBlockByAddress(block_addr);
+  if (cold_block == NULL) {
+    LOG(ERROR) << "Cannot retrieve parent block.";
+    return false;
+  }
+
+  RelativeAddress cold_block_addr;
+  if (!image_->GetAddressOf(cold_block, &cold_block_addr)) {
+    LOG(ERROR) << "Cannot retrieve cold block address.";
+    return false;
+  }
+
+  // Add cold_block as a child of the function block.
+  cold_blocks_[func_block][cold_block_addr] = cold_block;
+
+  // Set the parent relation for blocks belonging to the function block.
+  cold_blocks_parent_[func_block] = func_block;
+  cold_blocks_parent_[cold_block] = func_block;
+
   return true;
 }
 
@@ -1410,19 +1798,26 @@ bool Decomposer::FinalizeIntermediateReferences(
 bool Decomposer::CreateReferencesFromFixups(IDiaSession* session) {
   DCHECK_NE(reinterpret_cast<IDiaSession*>(NULL), session);
 
-  PEFile::RelocSet reloc_set;
-  if (!image_file_.DecodeRelocs(&reloc_set))
-    return false;
-
   OMAPs omap_from;
   PdbFixups fixups;
   if (!LoadDebugStreams(session, &fixups, &omap_from))
     return false;
 
+  return CreateReferencesFromFixups(fixups, omap_from);
+}
+
+bool Decomposer::CreateReferencesFromFixups(
+    const PdbSymbolReader::PdbFixups& fixups,
+    const std::vector<OMAP>& omap_from) {
+  PEFile::RelocSet reloc_set;
+  if (!image_file_.DecodeRelocs(&reloc_set))
+    return false;
+
   // While creating references from the fixups this removes the
   // corresponding reference data from the relocs. We use this as a kind of
   // double-entry bookkeeping to ensure all is well and right in the world.
   if (!CreateReferencesFromFixupsImpl(image_file_, fixups, omap_from,
+                                      thread_count_, min_fixups_per_batch_,
                                       &reloc_set, image_)) {
     return false;
   }
@@ -1435,19 +1830,154 @@ bool Decomposer::CreateReferencesFromFixups(IDiaSession* session) {
   return true;
 }
 
-bool Decomposer::ProcessSymbols(IDiaSymbol* root) {
-  DCHECK_NE(reinterpret_cast<IDiaSymbol*>(NULL), root);
+bool Decomposer::GetFunctionNames(IDiaSymbol* root,
+                                  FunctionNameMap* function_names) {
+  DCHECK_NE(static_cast<IDiaSymbol*>(NULL), root);
+  DCHECK_NE(static_cast<FunctionNameMap*>(NULL), function_names);
 
-  DiaBrowser::MatchCallback on_push_function_or_thunk_symbol(
-      base::Bind(&Decomposer::OnPushFunctionOrThunkSymbol,
-                 base::Unretained(this)));
-  DiaBrowser::MatchCallback on_pop_function_or_thunk_symbol(
-      base::Bind(&Decomposer::OnPopFunctionOrThunkSymbol,
-                 base::Unretained(this)));
-  DiaBrowser::MatchCallback on_function_child_symbol(
-      base::Bind(&Decomposer::OnFunctionChildSymbol,
-                 base::Unretained(this)));
-  DiaBrowser::MatchCallback on_data_symbol(
+  DiaBrowser dia_browser;
+  dia_browser.AddPattern(
+      Seq(Opt(SymTagCompiland), Or(SymTagFunction, SymTagThunk)),
+      base::Bind(&CollectFunctionName, base::Unretained(function_names)));
+  return dia_browser.Browse(root);
+}
+
+void Decomposer::GetFunctionNames(const PdbSymbolReader& reader,
+                                  FunctionNameMap* function_names) {
+  DCHECK_NE(static_cast<FunctionNameMap*>(NULL), function_names);
+
+  for (size_t i = 0; i < reader.modules().size(); ++i) {
+    const PdbSymbolReader::Symbols& symbols = reader.modules()[i].symbols;
+    for (size_t j = 0; j < symbols.size(); ++j) {
+      if (symbols[j].kind != PdbSymbolReader::kFunctionSymbol &&
+          symbols[j].kind != PdbSymbolReader::kThunkSymbol) {
+        continue;
+      }
+      function_names->insert(std::make_pair(symbols[j].addr,
+                                            symbols[j].name));
+    }
+  }
+}
+
+bool Decomposer::ReuseUnchangedBlocks(const FunctionNameMap& function_names) {
+  DCHECK_NE(static_cast<const BlockGraph*>(NULL), previous_block_graph_);
+  DCHECK(reused_blocks_.empty());
+
+  // Index the blocks of both decompositions. Blocks are only matched if they
+  // are unambiguously identified in both.
+  BlockKeyMap previous_blocks;
+  bool previous_has_strings = false;
+  BlockGraph::BlockMap::const_iterator it =
+      previous_block_graph_->blocks().begin();
+  for (; it != previous_block_graph_->blocks().end(); ++it) {
+    if (!IsReusableBlock(it->second))
+      continue;
+    AddBlockKey(it->second, &previous_blocks);
+    if (!it->second.compiland_name().empty())
+      previous_has_strings = true;
+  }
+
+  // Blocks are matched by compiland, so a previous decomposition that was
+  // saved without its strings can't match anything. Its labels would be
+  // nameless anyway.
+  if (!previous_blocks.empty() && !previous_has_strings) {
+    LOG(WARNING) << "The previous decomposition has no strings, it was likely "
+                 << "saved with --strip-strings. Decomposing from scratch.";
+    return true;
+  }
+
+  BlockKeyMap blocks;
+  it = image_->graph()->blocks().begin();
+  for (; it != image_->graph()->blocks().end(); ++it) {
+    const Block& block = it->second;
+    if (!IsReusableBlock(block))
+      continue;
+
+    // The labels of hot/cold functions span several blocks, so these are
+    // always processed from scratch.
+    Block* mutable_block = const_cast<Block*>(&block);
+    if (cold_blocks_.find(mutable_block) != cold_blocks_.end() ||
+        cold_blocks_parent_.find(mutable_block) != cold_blocks_parent_.end()) {
+      continue;
+    }
+
+    AddBlockKey(block, &blocks);
+  }
+
+  BlockKeyMap::const_iterator key_it = blocks.begin();
+  for (; key_it != blocks.end(); ++key_it) {
+    if (key_it->second == NULL)
+      continue;
+    BlockKeyMap::const_iterator previous_it =
+        previous_blocks.find(key_it->first);
+    if (previous_it == previous_blocks.end() || previous_it->second == NULL)
+      continue;
+
+    const Block* previous_block = previous_it->second;
+    Block* block = const_cast<Block*>(key_it->second);
+    DCHECK_EQ(previous_block->size(), block->size());
+    DCHECK(block->labels().empty());
+
+    // Functions can be renamed without their code changing. Only reuse the
+    // block if each of its functions is labeled with its current name in the
+    // previous decomposition. The block name comes from the first label at
+    // offset 0, so it must also be the name of one of these functions.
+    RelativeAddress block_addr;
+    CHECK(image_->GetAddressOf(block, &block_addr));
+    FunctionNameMap::const_iterator name_it =
+        function_names.lower_bound(block_addr);
+    bool names_match = true;
+    bool has_function_at_start = false;
+    bool block_name_found = false;
+    for (; names_match && name_it != function_names.end() &&
+               name_it->first < block_addr + block->size();
+         ++name_it) {
+      Offset offset = name_it->first - block_addr;
+      BlockGraph::Label label;
+      names_match = previous_block->GetLabel(offset, &label) &&
+                    LabelNameContains(label.name(), name_it->second);
+      if (offset == 0) {
+        has_function_at_start = true;
+        if (name_it->second == previous_block->name())
+          block_name_found = true;
+      }
+    }
+    if (!names_match || (has_function_at_start && !block_name_found))
+      continue;
+
+    block->set_name(previous_block->name());
+    block->set_attribute(previous_block->attributes() & kSymbolBlockAttributes);
+    Block::LabelMap::const_iterator label_it = previous_block->labels().begin();
+    for (; label_it != previous_block->labels().end(); ++label_it) {
+      if (!block->SetLabel(label_it->first, label_it->second)) {
+        LOG(ERROR) << "Unable to copy label " << label_it->second.ToString()
+                   << " to block \"" << block->name() << "\".";
+        return false;
+      }
+    }
+
+    reused_blocks_.insert(block);
+  }
+
+  LOG(INFO) << "Reused " << reused_blocks_.size() << " of " << blocks.size()
+            << " section contributions from the previous decomposition.";
+
+  return true;
+}
+
+bool Decomposer::ProcessSymbols(IDiaSymbol* root) {
+  DCHECK_NE(reinterpret_cast<IDiaSymbol*>(NULL), root);
+
+  DiaBrowser::MatchCallback on_push_function_or_thunk_symbol(
+      base::Bind(&Decomposer::OnPushFunctionOrThunkSymbol,
+                 base::Unretained(this)));
+  DiaBrowser::MatchCallback on_pop_function_or_thunk_symbol(
+      base::Bind(&Decomposer::OnPopFunctionOrThunkSymbol,
+                 base::Unretained(this)));
+  DiaBrowser::MatchCallback on_function_child_symbol(
+      base::Bind(&Decomposer::OnFunctionChildSymbol,
+                 base::Unretained(this)));
+  DiaBrowser::MatchCallback on_data_symbol(
       base::Bind(&Decomposer::OnDataSymbol, base::Unretained(this)));
   DiaBrowser::MatchCallback on_public_symbol(
       base::Bind(&Decomposer::OnPublicSymbol, base::Unretained(this)));
@@ -1491,6 +2021,146 @@ bool Decomposer::ProcessSymbols(IDiaSymbol* root) {
   return dia_browser.Browse(root);
 }
 
+bool Decomposer::ProcessSymbols(const PdbSymbolReader& reader) {
+  // Process the symbols of the compilands, followed by the global data and
+  // the public symbols, in the same order as the DIA version.
+  for (size_t i = 0; i < reader.modules().size(); ++i) {
+    if (!ProcessModuleSymbols(reader.modules()[i].symbols))
+      return false;
+  }
+
+  const PdbSymbolReader::Symbols& symbols = reader.global_symbols();
+  for (size_t i = 0; i < symbols.size(); ++i) {
+    if (ProcessSymbol(symbols[i], true) == DiaBrowser::kBrowserAbort)
+      return false;
+  }
+
+  return true;
+}
+
+bool Decomposer::ProcessModuleSymbols(
+    const PdbSymbolReader::Symbols& symbols) {
+  // The kinds of the symbols whose scope is open, and the number of open
+  // scopes when the contents of a function started being ignored, or 0.
+  std::vector<PdbSymbolReader::SymbolKind> open_scopes;
+  size_t skipped_depth = 0;
+  size_t separated_code_count = 0;
+
+  for (size_t i = 0; i < symbols.size(); ++i) {
+    const PdbSymbolReader::Symbol& symbol = symbols[i];
+    switch (symbol.kind) {
+      case PdbSymbolReader::kFunctionSymbol:
+      case PdbSymbolReader::kThunkSymbol: {
+        open_scopes.push_back(symbol.kind);
+        if (skipped_depth != 0)
+          continue;
+
+        BlockGraph::BlockAttributes attributes = 0;
+        if (symbol.flags & PdbSymbolReader::kNoReturnFlag)
+          attributes |= BlockGraph::NON_RETURN_FUNCTION;
+        if (symbol.flags & PdbSymbolReader::kHasInlineAssemblyFlag)
+          attributes |= BlockGraph::HAS_INLINE_ASSEMBLY;
+        if (symbol.flags & PdbSymbolReader::kHasExceptionHandlingFlag)
+          attributes |= BlockGraph::HAS_EXCEPTION_HANDLING;
+        if (symbol.kind == PdbSymbolReader::kThunkSymbol)
+          attributes |= BlockGraph::THUNK;
+
+        DiaBrowser::BrowserDirective directive =
+            OnFunctionOrThunk(symbol.addr, symbol.size, symbol.name,
+                              attributes);
+        if (directive == DiaBrowser::kBrowserAbort)
+          return false;
+        if (directive == DiaBrowser::kBrowserTerminatePath)
+          skipped_depth = open_scopes.size();
+        continue;
+      }
+
+      case PdbSymbolReader::kSeparatedCodeSymbol: {
+        // The cold blocks have already been found. The symbols within them
+        // belong to the enclosing function.
+        open_scopes.push_back(symbol.kind);
+        ++separated_code_count;
+        continue;
+      }
+
+      case PdbSymbolReader::kEndSymbol: {
+        if (open_scopes.empty()) {
+          LOG(ERROR) << "Encountered an unmatched end of scope symbol.";
+          return false;
+        }
+        if (skipped_depth == open_scopes.size())
+          skipped_depth = 0;
+        PdbSymbolReader::SymbolKind kind = open_scopes.back();
+        open_scopes.pop_back();
+        if (kind == PdbSymbolReader::kSeparatedCodeSymbol)
+          --separated_code_count;
+        else
+          OnEndFunctionOrThunk();
+        continue;
+      }
+
+      case PdbSymbolReader::kScopeSymbol:
+      case PdbSymbolReader::kDebugStartSymbol:
+      case PdbSymbolReader::kDebugEndSymbol:
+      case PdbSymbolReader::kCallSiteSymbol: {
+        // These are relative to the block of the function, so they can't be
+        // placed in its cold blocks.
+        if (separated_code_count != 0)
+          continue;
+        break;
+      }
+
+      default:
+        break;
+    }
+
+    if (skipped_depth != 0)
+      continue;
+
+    if (ProcessSymbol(symbol, false) == DiaBrowser::kBrowserAbort)
+      return false;
+  }
+
+  if (!open_scopes.empty()) {
+    LOG(ERROR) << "Symbol stream ends within a scope.";
+    return false;
+  }
+
+  return true;
+}
+
+DiaBrowser::BrowserDirective Decomposer::ProcessSymbol(
+    const PdbSymbolReader::Symbol& symbol,
+    bool is_global_scope) {
+  switch (symbol.kind) {
+    case PdbSymbolReader::kScopeSymbol:
+      return OnScope(SymTagBlock, symbol.addr, symbol.size);
+
+    case PdbSymbolReader::kDebugStartSymbol:
+      return OnScope(SymTagFuncDebugStart, symbol.addr, 0);
+
+    case PdbSymbolReader::kDebugEndSymbol:
+      return OnScope(SymTagFuncDebugEnd, symbol.addr, 0);
+
+    case PdbSymbolReader::kDataSymbol:
+      return OnData(symbol.addr, symbol.size, symbol.name, is_global_scope);
+
+    case PdbSymbolReader::kLabelSymbol:
+      return OnLabel(symbol.addr, symbol.name);
+
+    case PdbSymbolReader::kCallSiteSymbol:
+      return OnCallSite(symbol.addr);
+
+    case PdbSymbolReader::kPublicSymbol:
+      return OnPublic(symbol.addr, symbol.name);
+
+    default:
+      break;
+  }
+
+  return DiaBrowser::kBrowserContinue;
+}
+
 bool Decomposer::VisitLinkerSymbol(VisitLinkerSymbolContext* context,
                                    uint16_t symbol_length,
                                    uint16_t symbol_type,
@@ -1581,10 +2251,6 @@ DiaBrowser::BrowserDirective Decomposer::OnPushFunctionOrThunkSymbol(
   DCHECK_EQ(sym_tags.size(), symbols.size());
   DiaBrowser::SymbolPtr symbol = symbols.back();
 
-  DCHECK_EQ(reinterpret_cast<Block*>(NULL), current_block_);
-  DCHECK_EQ(current_address_, RelativeAddress(0));
-  DCHECK_EQ(0u, current_scope_count_);
-
   HRESULT hr = E_FAIL;
   DWORD location_type = LocIsNull;
   DWORD rva = 0;
@@ -1604,38 +2270,12 @@ DiaBrowser::BrowserDirective Decomposer::OnPushFunctionOrThunkSymbol(
   if (location_type != LocIsStatic)
     return DiaBrowser::kBrowserTerminatePath;
 
-  RelativeAddress addr(rva);
-  Block* block = image_->GetBlockByAddress(addr);
-  CHECK(block != NULL);
-  RelativeAddress block_addr;
-  CHECK(image_->GetAddressOf(block, &block_addr));
-  DCHECK(InRange(addr, block_addr, block->size()));
-
   std::string name;
   if (!base::WideToUTF8(name_bstr, name_bstr.Length(), &name)) {
     LOG(ERROR) << "Failed to convert function/thunk name to UTF8.";
     return DiaBrowser::kBrowserAbort;
   }
 
-  // We know the function starts in this block but we need to make sure its
-  // end does not extend past the end of the block.
-  if (addr + length > block_addr + block->size()) {
-    LOG(ERROR) << "Got function/thunk \"" << name << "\" that is not contained "
-               << "by section contribution \"" << block->name() << "\".";
-    return DiaBrowser::kBrowserAbort;
-  }
-
-  Offset offset = addr - block_addr;
-  if (!AddLabelToBlock(offset, name, BlockGraph::CODE_LABEL, block))
-    return DiaBrowser::kBrowserAbort;
-
-  // Keep track of the generated block. We will use this when parsing symbols
-  // that belong to this function. This prevents us from having to do repeated
-  // lookups and also allows us to associate labels outside of the block to the
-  // correct block.
-  current_block_ = block;
-  current_address_ = block_addr;
-
   // Certain properties are not defined on all blocks, so the following calls
   // may return S_FALSE.
   BOOL no_return = FALSE;
@@ -1654,27 +2294,25 @@ DiaBrowser::BrowserDirective Decomposer::OnPushFunctionOrThunkSymbol(
   if (symbol->get_hasSEH(&has_seh) != S_OK)
     has_seh = FALSE;
 
-  // Set the block attributes.
+  BlockGraph::BlockAttributes attributes = 0;
   if (no_return == TRUE)
-    block->set_attribute(BlockGraph::NON_RETURN_FUNCTION);
+    attributes |= BlockGraph::NON_RETURN_FUNCTION;
   if (has_inl_asm == TRUE)
-    block->set_attribute(BlockGraph::HAS_INLINE_ASSEMBLY);
+    attributes |= BlockGraph::HAS_INLINE_ASSEMBLY;
   if (has_eh || has_seh)
-    block->set_attribute(BlockGraph::HAS_EXCEPTION_HANDLING);
+    attributes |= BlockGraph::HAS_EXCEPTION_HANDLING;
   if (IsSymTag(symbol.get(), SymTagThunk))
-    block->set_attribute(BlockGraph::THUNK);
+    attributes |= BlockGraph::THUNK;
 
-  return DiaBrowser::kBrowserContinue;
+  return OnFunctionOrThunk(RelativeAddress(rva),
+                           static_cast<size_t>(length), name, attributes);
 }
 
 DiaBrowser::BrowserDirective Decomposer::OnPopFunctionOrThunkSymbol(
     const DiaBrowser& dia_browser,
     const DiaBrowser::SymTagVector& sym_tags,
     const DiaBrowser::SymbolPtrVector& symbols) {
-  // Simply clean up the current function block and address.
-  current_block_ = NULL;
-  current_address_ = RelativeAddress(0);
-  current_scope_count_ = 0;
+  OnEndFunctionOrThunk();
   return DiaBrowser::kBrowserContinue;
 }
 
@@ -1714,6 +2352,13 @@ DiaBrowser::BrowserDirective Decomposer::OnFunctionChildSymbol(
   return DiaBrowser::kBrowserAbort;
 }
 
+bool Decomposer::IsReusedAddress(RelativeAddress addr) const {
+  if (reused_blocks_.empty())
+    return false;
+  const Block* block = image_->GetBlockByAddress(addr);
+  return block != NULL && IsReusedBlock(block);
+}
+
 DiaBrowser::BrowserDirective Decomposer::OnDataSymbol(
     const DiaBrowser& dia_browser,
     const DiaBrowser::SymTagVector& sym_tags,
@@ -1725,10 +2370,8 @@ DiaBrowser::BrowserDirective Decomposer::OnDataSymbol(
   HRESULT hr = E_FAIL;
   DWORD location_type = LocIsNull;
   DWORD rva = 0;
-  ScopedBstr name_bstr;
   if (FAILED(hr = symbol->get_locationType(&location_type)) ||
-      FAILED(hr = symbol->get_relativeVirtualAddress(&rva)) ||
-      FAILED(hr = symbol->get_name(name_bstr.Receive()))) {
+      FAILED(hr = symbol->get_relativeVirtualAddress(&rva))) {
     LOG(ERROR) << "Failed to get data properties: " << common::LogHr(hr) << ".";
     return DiaBrowser::kBrowserAbort;
   }
@@ -1743,14 +2386,189 @@ DiaBrowser::BrowserDirective Decomposer::OnDataSymbol(
   if (location_type != LocIsStatic)
     return DiaBrowser::kBrowserTerminatePath;
 
+  // Don't bother fetching the name and type of symbols that fall in reused
+  // blocks.
+  if (IsReusedAddress(RelativeAddress(rva)))
+    return DiaBrowser::kBrowserContinue;
+
+  ScopedBstr name_bstr;
+  if (FAILED(hr = symbol->get_name(name_bstr.Receive()))) {
+    LOG(ERROR) << "Failed to get data name: " << common::LogHr(hr) << ".";
+    return DiaBrowser::kBrowserAbort;
+  }
+
   // Get the size of this datum from its type info.
   size_t length = 0;
   if (!GetDataSymbolSize(symbol.get(), &length))
     return DiaBrowser::kBrowserAbort;
 
+  std::string name;
+  if (!base::WideToUTF8(name_bstr, name_bstr.Length(), &name)) {
+    LOG(ERROR) << "Failed to convert label name to UTF8.";
+    return DiaBrowser::kBrowserAbort;
+  }
+
+  return OnData(RelativeAddress(rva), length, name, sym_tags.size() == 1);
+}
+
+DiaBrowser::BrowserDirective Decomposer::OnPublicSymbol(
+    const DiaBrowser& dia_browser,
+    const DiaBrowser::SymTagVector& sym_tags,
+    const DiaBrowser::SymbolPtrVector& symbols) {
+  DCHECK(!symbols.empty());
+  DCHECK_EQ(sym_tags.size(), symbols.size());
+  DiaBrowser::SymbolPtr symbol = symbols.back();
+
+  HRESULT hr = E_FAIL;
+  DWORD rva = 0;
+  if (FAILED(hr = symbol->get_relativeVirtualAddress(&rva))) {
+    LOG(ERROR) << "Failed to get public symbol address: "
+               << common::LogHr(hr) << ".";
+    return DiaBrowser::kBrowserAbort;
+  }
+  if (IsReusedAddress(RelativeAddress(rva)))
+    return DiaBrowser::kBrowserContinue;
+
+  ScopedBstr name_bstr;
+  if (FAILED(hr = symbol->get_name(name_bstr.Receive()))) {
+    LOG(ERROR) << "Failed to get public symbol name: "
+               << common::LogHr(hr) << ".";
+    return DiaBrowser::kBrowserAbort;
+  }
+
+  std::string name;
+  base::WideToUTF8(name_bstr, name_bstr.Length(), &name);
+
+  return OnPublic(RelativeAddress(rva), name);
+}
+
+DiaBrowser::BrowserDirective Decomposer::OnLabelSymbol(
+    const DiaBrowser& dia_browser,
+    const DiaBrowser::SymTagVector& sym_tags,
+    const DiaBrowser::SymbolPtrVector& symbols) {
+  DCHECK(!symbols.empty());
+  DCHECK_EQ(sym_tags.size(), symbols.size());
+  DiaBrowser::SymbolPtr symbol = symbols.back();
+
+  HRESULT hr = E_FAIL;
+  DWORD rva = 0;
+  if (FAILED(hr = symbol->get_relativeVirtualAddress(&rva))) {
+    LOG(ERROR) << "Failed to get label symbol address: " << common::LogHr(hr)
+               << ".";
+    return DiaBrowser::kBrowserAbort;
+  }
+
+  // Labels below a function are only visited if the function's block isn't
+  // reused, so this only needs to account for compiland scope labels.
+  if (current_block_ == NULL && IsReusedAddress(RelativeAddress(rva)))
+    return DiaBrowser::kBrowserContinue;
+
+  ScopedBstr name_bstr;
+  if (FAILED(hr = symbol->get_name(name_bstr.Receive()))) {
+    LOG(ERROR) << "Failed to get label symbol name: " << common::LogHr(hr)
+               << ".";
+    return DiaBrowser::kBrowserAbort;
+  }
+
+  std::string name;
+  base::WideToUTF8(name_bstr, name_bstr.Length(), &name);
+
+  return OnLabel(RelativeAddress(rva), name);
+}
+
+DiaBrowser::BrowserDirective Decomposer::OnScopeSymbol(
+    enum SymTagEnum type, DiaBrowser::SymbolPtr symbol) {
+  HRESULT hr = E_FAIL;
+  DWORD rva = 0;
+  if (FAILED(hr = symbol->get_relativeVirtualAddress(&rva))) {
+    LOG(ERROR) << "Failed to get scope symbol properties: " << common::LogHr(hr)
+               << ".";
+    return DiaBrowser::kBrowserAbort;
+  }
+
+  // If this is a scope we extract the length, which is needed to add the
+  // corresponding end label.
+  ULONGLONG length = 0;
+  if (type == SymTagBlock && symbol->get_length(&length) != S_OK) {
+    LOG(ERROR) << "Failed to extract code scope length for block \""
+               << current_block_->name() << "\".";
+    return DiaBrowser::kBrowserAbort;
+  }
+
+  return OnScope(type, RelativeAddress(rva), static_cast<size_t>(length));
+}
+
+DiaBrowser::BrowserDirective Decomposer::OnCallSiteSymbol(
+    DiaBrowser::SymbolPtr symbol) {
+  HRESULT hr = E_FAIL;
+  DWORD rva = 0;
+  if (FAILED(hr = symbol->get_relativeVirtualAddress(&rva))) {
+    LOG(ERROR) << "Failed to get call site symbol properties: "
+               << common::LogHr(hr) << ".";
+    return DiaBrowser::kBrowserAbort;
+  }
+
+  return OnCallSite(RelativeAddress(rva));
+}
+
+DiaBrowser::BrowserDirective Decomposer::OnFunctionOrThunk(
+    RelativeAddress addr,
+    size_t length,
+    const std::string& name,
+    BlockGraph::BlockAttributes attributes) {
+  DCHECK_EQ(reinterpret_cast<Block*>(NULL), current_block_);
+  DCHECK_EQ(current_address_, RelativeAddress(0));
+  DCHECK_EQ(0u, current_scope_count_);
+
+  Block* block = image_->GetBlockByAddress(addr);
+  CHECK(block != NULL);
+  RelativeAddress block_addr;
+  CHECK(image_->GetAddressOf(block, &block_addr));
+  DCHECK(InRange(addr, block_addr, block->size()));
+
+  // The symbols of reused blocks have already been accounted for, so there's
+  // no need to look at this function nor at the symbols below it.
+  if (IsReusedBlock(block))
+    return DiaBrowser::kBrowserTerminatePath;
+
+  // We know the function starts in this block but we need to make sure its
+  // end does not extend past the end of the block.
+  if (addr + length > block_addr + block->size()) {
+    LOG(ERROR) << "Got function/thunk \"" << name << "\" that is not contained "
+               << "by section contribution \"" << block->name() << "\".";
+    return DiaBrowser::kBrowserAbort;
+  }
+
+  Offset offset = addr - block_addr;
+  if (!AddLabelToBlock(offset, name, BlockGraph::CODE_LABEL, block))
+    return DiaBrowser::kBrowserAbort;
+
+  // Keep track of the generated block. We will use this when parsing symbols
+  // that belong to this function. This prevents us from having to do repeated
+  // lookups and also allows us to associate labels outside of the block to the
+  // correct block.
+  current_block_ = block;
+  current_address_ = block_addr;
+
+  // Set the block attributes.
+  block->set_attribute(attributes);
+
+  return DiaBrowser::kBrowserContinue;
+}
+
+void Decomposer::OnEndFunctionOrThunk() {
+  // Simply clean up the current function block and address.
+  current_block_ = NULL;
+  current_address_ = RelativeAddress(0);
+  current_scope_count_ = 0;
+}
+
+DiaBrowser::BrowserDirective Decomposer::OnData(RelativeAddress addr,
+                                                size_t length,
+                                                const std::string& name,
+                                                bool is_global_scope) {
   // Reuse the parent function block if we can. This acts as small lookup
   // cache.
-  RelativeAddress addr(rva);
   Block* block = current_block_;
   RelativeAddress block_addr(current_address_);
   if (block == NULL || !InRange(addr, block_addr, block->size())) {
@@ -1759,15 +2577,12 @@ DiaBrowser::BrowserDirective Decomposer::OnDataSymbol(
     CHECK(image_->GetAddressOf(block, &block_addr));
     DCHECK(InRange(addr, block_addr, block->size()));
   }
-
-  std::string name;
-  if (!base::WideToUTF8(name_bstr, name_bstr.Length(), &name)) {
-    LOG(ERROR) << "Failed to convert label name to UTF8.";
-    return DiaBrowser::kBrowserAbort;
-  }
+  if (IsReusedBlock(block))
+    return DiaBrowser::kBrowserContinue;
 
   // Zero-length data symbols mark case/jump tables, or are forward declares.
   BlockGraph::LabelAttributes attr = BlockGraph::DATA_LABEL;
+  std::string label_name(name);
   Offset offset = addr - block_addr;
   if (length == 0) {
     // Jump and case tables come in as data symbols with no name. Jump tables
@@ -1776,10 +2591,10 @@ DiaBrowser::BrowserDirective Decomposer::OnDataSymbol(
     // indices into a jump table), thus do not coincide with a reference.
     if (name.empty() && block->type() == BlockGraph::CODE_BLOCK) {
       if (block->references().find(offset) != block->references().end()) {
-        name = kJumpTable;
+        label_name = kJumpTable;
         attr |= BlockGraph::JUMP_TABLE_LABEL;
       } else {
-        name = kCaseTable;
+        label_name = kCaseTable;
         attr |= BlockGraph::CASE_TABLE_LABEL;
       }
     } else {
@@ -1803,8 +2618,8 @@ DiaBrowser::BrowserDirective Decomposer::OnDataSymbol(
     // generated. This won't be part of the IAT, so we can't even filter based
     // on that. Instead, we simply ignore global data symbols that exceed the
     // block size.
-    bool is_imported_data_symbol = (sym_tags.size() == 1 &&
-                                    spname.starts_with("_imp_"));
+    bool is_imported_data_symbol = is_global_scope &&
+                                   spname.starts_with("_imp_");
     // In VS2017 we've noticed that the size returned by IDiaSymbol::get_length
     // function is invalid for the objects using RTTI in VS2017. This has been
     // reported here:
@@ -1828,73 +2643,42 @@ DiaBrowser::BrowserDirective Decomposer::OnDataSymbol(
     }
   }
 
-  if (!AddLabelToBlock(offset, name, attr, block))
+  if (!AddLabelToBlock(offset, label_name, attr, block))
     return DiaBrowser::kBrowserAbort;
 
   return DiaBrowser::kBrowserContinue;
 }
 
-DiaBrowser::BrowserDirective Decomposer::OnPublicSymbol(
-    const DiaBrowser& dia_browser,
-    const DiaBrowser::SymTagVector& sym_tags,
-    const DiaBrowser::SymbolPtrVector& symbols) {
-  DCHECK(!symbols.empty());
-  DCHECK_EQ(sym_tags.size(), symbols.size());
+DiaBrowser::BrowserDirective Decomposer::OnPublic(RelativeAddress addr,
+                                                  const std::string& name) {
   DCHECK_EQ(reinterpret_cast<Block*>(NULL), current_block_);
-  DiaBrowser::SymbolPtr symbol = symbols.back();
 
-  HRESULT hr = E_FAIL;
-  DWORD rva = 0;
-  ScopedBstr name_bstr;
-  if (FAILED(hr = symbol->get_relativeVirtualAddress(&rva)) ||
-      FAILED(hr = symbol->get_name(name_bstr.Receive()))) {
-    LOG(ERROR) << "Failed to get public symbol properties: "
-               << common::LogHr(hr) << ".";
-    return DiaBrowser::kBrowserAbort;
-  }
-
-  RelativeAddress addr(rva);
   Block* block = image_->GetBlockByAddress(addr);
   CHECK(block != NULL);
   RelativeAddress block_addr;
   CHECK(image_->GetAddressOf(block, &block_addr));
   DCHECK(InRange(addr, block_addr, block->size()));
-
-  std::string name;
-  base::WideToUTF8(name_bstr, name_bstr.Length(), &name);
+  if (IsReusedBlock(block))
+    return DiaBrowser::kBrowserContinue;
 
   // Public symbol names are mangled. Remove leading '_' as per
   // http://msdn.microsoft.com/en-us/library/00kh39zz(v=vs.80).aspx
-  if (name[0] == '_')
-    name = name.substr(1);
+  std::string label_name(name);
+  if (label_name[0] == '_')
+    label_name = label_name.substr(1);
 
   Offset offset = addr - block_addr;
-  if (!AddLabelToBlock(offset, name, BlockGraph::PUBLIC_SYMBOL_LABEL, block))
+  if (!AddLabelToBlock(offset, label_name, BlockGraph::PUBLIC_SYMBOL_LABEL,
+                       block)) {
     return DiaBrowser::kBrowserAbort;
+  }
 
   return DiaBrowser::kBrowserContinue;
 }
 
-DiaBrowser::BrowserDirective Decomposer::OnLabelSymbol(
-    const DiaBrowser& dia_browser,
-    const DiaBrowser::SymTagVector& sym_tags,
-    const DiaBrowser::SymbolPtrVector& symbols) {
-  DCHECK(!symbols.empty());
-  DCHECK_EQ(sym_tags.size(), symbols.size());
-  DiaBrowser::SymbolPtr symbol = symbols.back();
-
-  HRESULT hr = E_FAIL;
-  DWORD rva = 0;
-  ScopedBstr name_bstr;
-  if (FAILED(hr = symbol->get_relativeVirtualAddress(&rva)) ||
-      FAILED(hr = symbol->get_name(name_bstr.Receive()))) {
-    LOG(ERROR) << "Failed to get label symbol properties: " << common::LogHr(hr)
-               << ".";
-    return DiaBrowser::kBrowserAbort;
-  }
-
+DiaBrowser::BrowserDirective Decomposer::OnLabel(RelativeAddress addr,
+                                                 const std::string& name) {
   // If we have a current_block_ the label should lie within its scope.
-  RelativeAddress addr(rva);
   Block* block = current_block_;
   RelativeAddress block_addr(current_address_);
   if (block != NULL) {
@@ -1953,9 +2737,8 @@ DiaBrowser::BrowserDirective Decomposer::OnLabelSymbol(
     //     finding the block whose section contribution shares the same
     //     compiland.
   }
-
-  std::string name;
-  base::WideToUTF8(name_bstr, name_bstr.Length(), &name);
+  if (IsReusedBlock(block))
+    return DiaBrowser::kBrowserContinue;
 
   Offset offset = addr - block_addr;
   if (!AddLabelToBlock(offset, name, BlockGraph::CODE_LABEL, block))
@@ -1964,22 +2747,14 @@ DiaBrowser::BrowserDirective Decomposer::OnLabelSymbol(
   return DiaBrowser::kBrowserContinue;
 }
 
-DiaBrowser::BrowserDirective Decomposer::OnScopeSymbol(
-    enum SymTagEnum type, DiaBrowser::SymbolPtr symbol) {
+DiaBrowser::BrowserDirective Decomposer::OnScope(enum SymTagEnum type,
+                                                 RelativeAddress addr,
+                                                 size_t length) {
   // We should only get here via the successful exploration of a SymTagFunction,
   // so current_block_ should be set.
   DCHECK_NE(reinterpret_cast<Block*>(NULL), current_block_);
 
-  HRESULT hr = E_FAIL;
-  DWORD rva = 0;
-  if (FAILED(hr = symbol->get_relativeVirtualAddress(&rva))) {
-    LOG(ERROR) << "Failed to get scope symbol properties: " << common::LogHr(hr)
-               << ".";
-    return DiaBrowser::kBrowserAbort;
-  }
-
   // The label may potentially lay at the first byte past the function.
-  RelativeAddress addr(rva);
   DCHECK_LE(current_address_, addr);
   DCHECK_LE(addr, current_address_ + current_block_->size());
 
@@ -1993,15 +2768,8 @@ DiaBrowser::BrowserDirective Decomposer::OnScopeSymbol(
   if (!AddLabelToBlock(offset, name, attr, current_block_))
     return DiaBrowser::kBrowserAbort;
 
-  // If this is a scope we extract the length and explicitly add a corresponding
-  // end label.
+  // If this is a scope we explicitly add a corresponding end label.
   if (type == SymTagBlock) {
-    ULONGLONG length = 0;
-    if (symbol->get_length(&length) != S_OK) {
-      LOG(ERROR) << "Failed to extract code scope length for block \""
-                  << current_block_->name() << "\".";
-      return DiaBrowser::kBrowserAbort;
-    }
     DCHECK_LE(static_cast<size_t>(offset + length), current_block_->size());
     name = base::StringPrintf("<scope-end-%d>", current_scope_count_);
     ++current_scope_count_;
@@ -2014,21 +2782,11 @@ DiaBrowser::BrowserDirective Decomposer::OnScopeSymbol(
   return DiaBrowser::kBrowserContinue;
 }
 
-DiaBrowser::BrowserDirective Decomposer::OnCallSiteSymbol(
-    DiaBrowser::SymbolPtr symbol) {
+DiaBrowser::BrowserDirective Decomposer::OnCallSite(RelativeAddress addr) {
   // We should only get here via the successful exploration of a SymTagFunction,
   // so current_block_ should be set.
   DCHECK_NE(reinterpret_cast<Block*>(NULL), current_block_);
 
-  HRESULT hr = E_FAIL;
-  DWORD rva = 0;
-  if (FAILED(hr = symbol->get_relativeVirtualAddress(&rva))) {
-    LOG(ERROR) << "Failed to get call site symbol properties: "
-               << common::LogHr(hr) << ".";
-    return DiaBrowser::kBrowserAbort;
-  }
-
-  RelativeAddress addr(rva);
   if (!InRange(addr, current_address_, current_block_->size())) {
     // We see this happen under some build configurations (notably debug
     // component builds of Chrome). As long as the label falls entirely
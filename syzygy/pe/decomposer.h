@@ -20,13 +20,18 @@
 
 #include <windows.h>  // NOLINT
 #include <dia2.h>
+#include <map>
+#include <set>
+#include <string>
 #include <vector>
 
 #include "syzygy/common/binary_stream.h"
+#include "syzygy/pdb/omap.h"
 #include "syzygy/pdb/pdb_file.h"
 #include "syzygy/pdb/pdb_stream.h"
 #include "syzygy/pe/dia_browser.h"
 #include "syzygy/pe/image_layout.h"
+#include "syzygy/pe/pdb_symbol_reader.h"
 #include "syzygy/pe/pe_file.h"
 
 namespace pe {
@@ -39,11 +44,25 @@ class Decomposer {
  public:
   struct IntermediateReference;
   typedef std::vector<IntermediateReference> IntermediateReferences;
+  typedef std::multimap<core::RelativeAddress, std::string> FunctionNameMap;
 
   // The separator that is used between the multiple symbol names that can be
   // associated with a single label.
   static const char kLabelNameSep[];
 
+  // The default minimum number of fixups that are resolved by a single work
+  // item when they are resolved in parallel.
+  static const size_t kDefaultMinFixupsPerBatch;
+
+  // The ways in which the symbols of the image can be read.
+  enum SymbolBackend {
+    // The symbols are read through DIA.
+    kDiaSymbolBackend,
+    // The symbols are read directly from the streams of the PDB file. This
+    // doesn't support images whose PDB contains OMAP information.
+    kPdbSymbolBackend,
+  };
+
   // Initialize the decomposer for a given image file.
   // @param image_file the image file to decompose. This must outlive the
   //     instance of the decomposer.
@@ -64,6 +83,54 @@ class Decomposer {
   // @param pdb_path the path to the PDB file to be used in decomposing the
   //     image.
   void set_pdb_path(const base::FilePath& pdb_path) { pdb_path_ = pdb_path; }
+
+  // Sets the decomposition of a previous build of the image, enabling
+  // incremental decomposition. Blocks are still created from the section
+  // contributions and fixups of the image being decomposed, but blocks whose
+  // contents, references, compiland and function names are unchanged since
+  // the previous build take their labels and symbol-derived attributes from
+  // the previous decomposition. Block names always come from the current
+  // build. The symbols that fall in reused blocks are not parsed again: the
+  // children of their functions are not visited, and their data, label and
+  // public symbols are skipped before their names and types are fetched.
+  // This is all that is saved. The blocks and references are still built
+  // from scratch, as they are needed to match the blocks of both builds, and
+  // the names of all functions are fetched to detect renames. A previous
+  // decomposition that was saved without its strings can't be matched, and
+  // is ignored with a warning.
+  // @param previous_block_graph the block-graph of the previous
+  //     decomposition. This must contain the block data, and must outlive
+  //     the call to Decompose.
+  void set_previous_block_graph(
+      const block_graph::BlockGraph* previous_block_graph) {
+    previous_block_graph_ = previous_block_graph;
+  }
+
+  // Sets the number of threads used to resolve the fixups of the image. The
+  // decomposition doesn't depend on the number of threads. Defaults to 1.
+  // @param thread_count the number of threads, which must be at least 1.
+  void set_thread_count(size_t thread_count) {
+    DCHECK_LT(0u, thread_count);
+    thread_count_ = thread_count;
+  }
+
+  // Sets the minimum number of fixups that are resolved by a single work
+  // item when there are several threads. This is mostly useful for testing,
+  // as the fixups of a small image otherwise fit in a single batch. Defaults
+  // to kDefaultMinFixupsPerBatch.
+  // @param min_fixups_per_batch the minimum batch size, which must be at
+  //     least 1.
+  void set_min_fixups_per_batch(size_t min_fixups_per_batch) {
+    DCHECK_LT(0u, min_fixups_per_batch);
+    min_fixups_per_batch_ = min_fixups_per_batch;
+  }
+
+  // Sets the way in which the symbols of the image are read. Both backends
+  // produce the same decomposition. Defaults to kDiaSymbolBackend.
+  // @param symbol_backend the symbol backend to use.
+  void set_symbol_backend(SymbolBackend symbol_backend) {
+    symbol_backend_ = symbol_backend;
+  }
   // @}
 
   // @name Accessors
@@ -73,6 +140,19 @@ class Decomposer {
   // decomposition.
   // @returns the PDB path.
   const base::FilePath& pdb_path() const { return pdb_path_; }
+
+  // @returns the number of blocks whose symbol information was taken from
+  //     the previous decomposition by the last call to Decompose.
+  size_t reused_block_count() const { return reused_blocks_.size(); }
+
+  // @returns the number of threads used to resolve the fixups.
+  size_t thread_count() const { return thread_count_; }
+
+  // @returns the minimum number of fixups resolved by a single work item.
+  size_t min_fixups_per_batch() const { return min_fixups_per_batch_; }
+
+  // @returns the way in which the symbols of the image are read.
+  SymbolBackend symbol_backend() const { return symbol_backend_; }
   // @}
 
  protected:
@@ -95,7 +175,8 @@ class Decomposer {
                                     bool* stream_exists);
   // @}
 
-  // @name Decomposition steps, in order.
+  // @name Decomposition steps, in order. The steps that read symbols have a
+  //     DIA and a PDB stream version, depending on the symbol backend.
   // @{
   // Performs the actual decomposition.
   bool DecomposeImpl();
@@ -105,8 +186,10 @@ class Decomposer {
   bool CreateBlocksFromCoffGroups();
   // Processes the SectionContribution table, creating code/data blocks from it.
   bool CreateBlocksFromSectionContribs(IDiaSession* session);
+  bool CreateBlocksFromSectionContribs(const PdbSymbolReader& reader);
  // Processes the Compiland table and finds cold blocks.
   bool FindColdBlocksFromCompilands(IDiaSession* session);
+  bool FindColdBlocksFromCompilands(const PdbSymbolReader& reader);
   // Creates gap blocks to flesh out the image. After this has been run all
   // references should be resolvable.
   bool CreateGapBlocks();
@@ -114,11 +197,78 @@ class Decomposer {
   bool FinalizeIntermediateReferences(const IntermediateReferences& references);
   // Creates inter-block references from fixups.
   bool CreateReferencesFromFixups(IDiaSession* session);
+  bool CreateReferencesFromFixups(const PdbSymbolReader::PdbFixups& fixups,
+                                  const std::vector<OMAP>& omap_from);
+  // Gets the names of the functions and thunks of the image, by address.
+  // This only fetches the address and name of these symbols, and none of
+  // their children.
+  static bool GetFunctionNames(IDiaSymbol* root,
+                               FunctionNameMap* function_names);
+  static void GetFunctionNames(const PdbSymbolReader& reader,
+                               FunctionNameMap* function_names);
+  // Finds the blocks that are unchanged since the previous decomposition, and
+  // copies their labels and symbol-derived attributes from it. A block is
+  // only reused if each of its functions in @p function_names is already
+  // labeled with its name in the previous decomposition, so that renamed
+  // functions are labeled from scratch. This is only run in incremental mode.
+  bool ReuseUnchangedBlocks(const FunctionNameMap& function_names);
   // Processes symbols from the PDB, setting block names and labels. This
   // step is purely optional and only necessary to provide debug information.
   // This adds names to blocks, adds code labels and their names, and adds
   // more informative names to data labels.
   bool ProcessSymbols(IDiaSymbol* root);
+  bool ProcessSymbols(const PdbSymbolReader& reader);
+  // @}
+
+  // @name Helpers for the PDB stream version of ProcessSymbols.
+  // @{
+  bool ProcessModuleSymbols(const PdbSymbolReader::Symbols& symbols);
+  // @returns the directive for the given symbol, or kBrowserContinue if it
+  //     is not handled.
+  DiaBrowser::BrowserDirective ProcessSymbol(
+      const PdbSymbolReader::Symbol& symbol,
+      bool is_global_scope);
+  // @}
+
+  // @name Symbol handlers shared by both symbol backends. These return
+  //     kBrowserAbort on failure, and kBrowserTerminatePath when the symbols
+  //     contained in the handled symbol should be ignored.
+  // @{
+  // Creates the block of a section contribution.
+  // @param section the index of the section, starting at 0.
+  bool CreateSectionContribBlock(RelativeAddress addr,
+                                 BlockGraph::Size size,
+                                 size_t section,
+                                 bool code,
+                                 const std::string& compiland_name,
+                                 bool is_built_by_supported_compiler);
+  // Records the cold block containing @p block_addr if it lies outside of
+  // the function that contains it.
+  bool AddColdBlock(RelativeAddress func_addr,
+                    size_t func_length,
+                    RelativeAddress block_addr);
+  // @param attributes the attributes to set on the block of the function.
+  DiaBrowser::BrowserDirective OnFunctionOrThunk(
+      RelativeAddress addr,
+      size_t length,
+      const std::string& name,
+      BlockGraph::BlockAttributes attributes);
+  void OnEndFunctionOrThunk();
+  // @param is_global_scope true if the symbol is directly in the global
+  //     scope, as opposed to being in a compiland or a function.
+  DiaBrowser::BrowserDirective OnData(RelativeAddress addr,
+                                      size_t length,
+                                      const std::string& name,
+                                      bool is_global_scope);
+  DiaBrowser::BrowserDirective OnPublic(RelativeAddress addr,
+                                        const std::string& name);
+  DiaBrowser::BrowserDirective OnLabel(RelativeAddress addr,
+                                       const std::string& name);
+  // @param length the length of the scope. Only used for SymTagBlock.
+  DiaBrowser::BrowserDirective OnScope(enum SymTagEnum type,
+                                       RelativeAddress addr,
+                                       size_t length);
+  DiaBrowser::BrowserDirective OnCallSite(RelativeAddress addr);
   // @}
 
   // @{
@@ -168,6 +318,17 @@ class Decomposer {
   DiaBrowser::BrowserDirective OnCallSiteSymbol(DiaBrowser::SymbolPtr symbol);
   // @}
 
+  // @returns true if the symbols falling in @p block should be ignored, as
+  //     its symbol information was copied from the previous decomposition.
+  bool IsReusedBlock(const BlockGraph::Block* block) const {
+    return reused_blocks_.find(block) != reused_blocks_.end();
+  }
+
+  // @returns true if @p addr falls in a block whose symbol information was
+  //     copied from the previous decomposition. This is used to skip the
+  //     symbols of reused blocks before fetching their properties from DIA.
+  bool IsReusedAddress(RelativeAddress addr) const;
+
   // @name Block creation members.
   // @{
   // Creates a new block with the given properties, and attaches the
@@ -198,6 +359,19 @@ class Decomposer {
   const PEFile& image_file_;
   // The path to corresponding PDB file.
   base::FilePath pdb_path_;
+  // The previous decomposition, used in incremental mode. This is NULL
+  // otherwise.
+  const BlockGraph* previous_block_graph_;
+  // The number of threads used to resolve the fixups.
+  size_t thread_count_;
+  // The minimum number of fixups resolved by a single work item.
+  size_t min_fixups_per_batch_;
+  // The way in which the symbols of the image are read.
+  SymbolBackend symbol_backend_;
+
+  // The blocks whose symbol information was copied from the previous
+  // decomposition. Symbols falling in these blocks are ignored.
+  std::set<const BlockGraph::Block*> reused_blocks_;
 
   // @name Temporaries that are only valid while inside DecomposeImpl.
   //     Prevents us from having to pass these around everywhere.
@@ -218,7 +392,7 @@ class Decomposer {
   ColdBlocksParent cold_blocks_parent_;
   // @}
 
-  // @name Temporaries that are only valid while in DiaBrowser.
+  // @name Temporaries that are only valid while processing the symbols.
   // @{
   BlockGraph::Block* current_block_;
   RelativeAddress current_address_;
@@ -14,6 +14,10 @@
 
 #include "syzygy/pe/decomposer.h"
 
+#include <algorithm>
+#include <string>
+#include <vector>
+
 #include "base/strings/string_split.h"
 #include "base/strings/string_util.h"
 #include "gmock/gmock.h"
@@ -54,6 +58,14 @@ class TestDecomposer : public Decomposer {
   using Decomposer::LoadBlockGraphFromPdb;
 };
 
+// @returns the names that were merged into @p label, in sorted order.
+std::vector<std::string> GetSortedLabelNames(const BlockGraph::Label& label) {
+  std::vector<std::string> names;
+  base::SplitStringUsingSubstr(label.name(), kLabelNameSep, &names);
+  std::sort(names.begin(), names.end());
+  return names;
+}
+
 class DecomposerTest : public testing::PELibUnitTest {
   typedef testing::PELibUnitTest Super;
 
@@ -362,6 +374,251 @@ TEST_F(DecomposerTest, DecomposeFailsWithNonexistentPdb) {
   EXPECT_FALSE(decomposer.Decompose(&image_layout));
 }
 
+TEST_F(DecomposerTest, IncrementalDecompose) {
+  base::FilePath image_path(testing::GetExeRelativePath(testing::kTestDllName));
+  PEFile image_file;
+  ASSERT_TRUE(image_file.Init(image_path));
+
+  // Decompose the test image from scratch.
+  BlockGraph previous_block_graph;
+  ImageLayout previous_image_layout(&previous_block_graph);
+  Decomposer decomposer(image_file);
+  ASSERT_TRUE(decomposer.Decompose(&previous_image_layout));
+  EXPECT_EQ(0u, decomposer.reused_block_count());
+
+  // Decompose it again incrementally. As nothing has changed, the section
+  // contributions should be reused.
+  BlockGraph block_graph;
+  ImageLayout image_layout(&block_graph);
+  Decomposer incremental_decomposer(image_file);
+  incremental_decomposer.set_previous_block_graph(&previous_block_graph);
+  ASSERT_TRUE(incremental_decomposer.Decompose(&image_layout));
+  EXPECT_LT(0u, incremental_decomposer.reused_block_count());
+
+  // The result should be the same as that of a full decomposition.
+  ASSERT_EQ(previous_block_graph.blocks().size(), block_graph.blocks().size());
+  BlockGraph::AddressSpace::RangeMapConstIter previous_it =
+      previous_image_layout.blocks.begin();
+  BlockGraph::AddressSpace::RangeMapConstIter it = image_layout.blocks.begin();
+  for (; it != image_layout.blocks.end(); ++it, ++previous_it) {
+    ASSERT_TRUE(previous_it != previous_image_layout.blocks.end());
+    EXPECT_EQ(previous_it->first, it->first);
+    const BlockGraph::Block* previous_block = previous_it->second;
+    const BlockGraph::Block* block = it->second;
+    EXPECT_EQ(previous_block->name(), block->name());
+    EXPECT_EQ(previous_block->attributes(), block->attributes());
+    EXPECT_EQ(previous_block->alignment(), block->alignment());
+    EXPECT_THAT(block->labels(), ContainerEq(previous_block->labels()));
+  }
+}
+
+TEST_F(DecomposerTest, IncrementalDecomposeIgnoresStrippedPrevious) {
+  base::FilePath image_path(testing::GetExeRelativePath(testing::kTestDllName));
+  PEFile image_file;
+  ASSERT_TRUE(image_file.Init(image_path));
+
+  BlockGraph previous_block_graph;
+  ImageLayout previous_image_layout(&previous_block_graph);
+  Decomposer decomposer(image_file);
+  ASSERT_TRUE(decomposer.Decompose(&previous_image_layout));
+
+  // Mimic a decomposition that was saved with --strip-strings.
+  BlockGraph::BlockMap::iterator block_it =
+      previous_block_graph.blocks_mutable().begin();
+  for (; block_it != previous_block_graph.blocks_mutable().end(); ++block_it) {
+    block_it->second.set_name("");
+    block_it->second.set_compiland_name("");
+  }
+
+  // Nothing can be reused, but the image is still decomposed.
+  BlockGraph block_graph;
+  ImageLayout image_layout(&block_graph);
+  Decomposer incremental_decomposer(image_file);
+  incremental_decomposer.set_previous_block_graph(&previous_block_graph);
+  ASSERT_TRUE(incremental_decomposer.Decompose(&image_layout));
+  EXPECT_EQ(0u, incremental_decomposer.reused_block_count());
+  EXPECT_EQ(previous_block_graph.blocks().size(), block_graph.blocks().size());
+}
+
+TEST_F(DecomposerTest, IncrementalDecomposeRelabelsRenamedFunctions) {
+  base::FilePath image_path(testing::GetExeRelativePath(testing::kTestDllName));
+  PEFile image_file;
+  ASSERT_TRUE(image_file.Init(image_path));
+
+  BlockGraph previous_block_graph;
+  ImageLayout previous_image_layout(&previous_block_graph);
+  Decomposer decomposer(image_file);
+  ASSERT_TRUE(decomposer.Decompose(&previous_image_layout));
+
+  // Mimic a previous build where a function had another name, but the same
+  // code.
+  BlockGraph::Block* renamed_block = NULL;
+  BlockGraph::Label label;
+  BlockGraph::BlockMap::iterator block_it =
+      previous_block_graph.blocks_mutable().begin();
+  for (; block_it != previous_block_graph.blocks_mutable().end(); ++block_it) {
+    BlockGraph::Block* block = &block_it->second;
+    if (block->type() == BlockGraph::CODE_BLOCK &&
+        (block->attributes() & BlockGraph::SECTION_CONTRIB) != 0 &&
+        block->GetLabel(0, &label) && label.name() == block->name()) {
+      renamed_block = block;
+      break;
+    }
+  }
+  ASSERT_NE(static_cast<BlockGraph::Block*>(NULL), renamed_block);
+  const std::string function_name = renamed_block->name();
+  RelativeAddress renamed_addr;
+  ASSERT_TRUE(previous_image_layout.blocks.GetAddressOf(renamed_block,
+                                                        &renamed_addr));
+  ASSERT_TRUE(renamed_block->RemoveLabel(0));
+  ASSERT_TRUE(renamed_block->SetLabel(0, "RenamedFunction",
+                                      label.attributes()));
+  renamed_block->set_name("RenamedFunction");
+
+  BlockGraph block_graph;
+  ImageLayout image_layout(&block_graph);
+  Decomposer incremental_decomposer(image_file);
+  incremental_decomposer.set_previous_block_graph(&previous_block_graph);
+  ASSERT_TRUE(incremental_decomposer.Decompose(&image_layout));
+  EXPECT_LT(0u, incremental_decomposer.reused_block_count());
+
+  // The block is labeled from the current symbols rather than reused.
+  BlockGraph::Block* block =
+      image_layout.blocks.GetBlockByAddress(renamed_addr);
+  ASSERT_NE(static_cast<BlockGraph::Block*>(NULL), block);
+  EXPECT_EQ(function_name, block->name());
+  ASSERT_TRUE(block->GetLabel(0, &label));
+  EXPECT_EQ(std::string::npos, label.name().find("RenamedFunction"));
+}
+
+TEST_F(DecomposerTest, ParallelDecompose) {
+  base::FilePath image_path(testing::GetExeRelativePath(testing::kTestDllName));
+  PEFile image_file;
+  ASSERT_TRUE(image_file.Init(image_path));
+
+  BlockGraph serial_block_graph;
+  ImageLayout serial_image_layout(&serial_block_graph);
+  Decomposer serial_decomposer(image_file);
+  EXPECT_EQ(1u, serial_decomposer.thread_count());
+  ASSERT_TRUE(serial_decomposer.Decompose(&serial_image_layout));
+
+  BlockGraph block_graph;
+  ImageLayout image_layout(&block_graph);
+  Decomposer decomposer(image_file);
+  decomposer.set_thread_count(4);
+  EXPECT_EQ(4u, decomposer.thread_count());
+  // The fixups of the test DLL would otherwise fit in a single batch. Use
+  // small batches so that several of them are resolved concurrently and
+  // merged.
+  EXPECT_EQ(Decomposer::kDefaultMinFixupsPerBatch,
+            decomposer.min_fixups_per_batch());
+  decomposer.set_min_fixups_per_batch(16);
+  ASSERT_TRUE(decomposer.Decompose(&image_layout));
+
+  // The result shouldn't depend on the number of threads.
+  ASSERT_EQ(serial_block_graph.blocks().size(), block_graph.blocks().size());
+  BlockGraph::AddressSpace::RangeMapConstIter serial_it =
+      serial_image_layout.blocks.begin();
+  BlockGraph::AddressSpace::RangeMapConstIter it = image_layout.blocks.begin();
+  for (; it != image_layout.blocks.end(); ++it, ++serial_it) {
+    ASSERT_TRUE(serial_it != serial_image_layout.blocks.end());
+    EXPECT_EQ(serial_it->first, it->first);
+    const BlockGraph::Block* serial_block = serial_it->second;
+    const BlockGraph::Block* block = it->second;
+    EXPECT_EQ(serial_block->name(), block->name());
+    EXPECT_THAT(block->labels(), ContainerEq(serial_block->labels()));
+
+    // Compare the references by the address of their targets.
+    ASSERT_EQ(serial_block->references().size(), block->references().size());
+    BlockGraph::Block::ReferenceMap::const_iterator serial_ref_it =
+        serial_block->references().begin();
+    BlockGraph::Block::ReferenceMap::const_iterator ref_it =
+        block->references().begin();
+    for (; ref_it != block->references().end(); ++ref_it, ++serial_ref_it) {
+      EXPECT_EQ(serial_ref_it->first, ref_it->first);
+      EXPECT_EQ(serial_ref_it->second.type(), ref_it->second.type());
+      EXPECT_EQ(serial_ref_it->second.offset(), ref_it->second.offset());
+      EXPECT_EQ(serial_ref_it->second.base(), ref_it->second.base());
+      RelativeAddress serial_addr;
+      RelativeAddress addr;
+      ASSERT_TRUE(serial_image_layout.blocks.GetAddressOf(
+          serial_ref_it->second.referenced(), &serial_addr));
+      ASSERT_TRUE(image_layout.blocks.GetAddressOf(
+          ref_it->second.referenced(), &addr));
+      EXPECT_EQ(serial_addr, addr);
+    }
+  }
+}
+
+TEST_F(DecomposerTest, PdbSymbolBackendMatchesDia) {
+  base::FilePath image_path(testing::GetExeRelativePath(testing::kTestDllName));
+  PEFile image_file;
+  ASSERT_TRUE(image_file.Init(image_path));
+
+  BlockGraph dia_block_graph;
+  ImageLayout dia_image_layout(&dia_block_graph);
+  Decomposer dia_decomposer(image_file);
+  EXPECT_EQ(Decomposer::kDiaSymbolBackend, dia_decomposer.symbol_backend());
+  ASSERT_TRUE(dia_decomposer.Decompose(&dia_image_layout));
+
+  BlockGraph block_graph;
+  ImageLayout image_layout(&block_graph);
+  Decomposer decomposer(image_file);
+  decomposer.set_symbol_backend(Decomposer::kPdbSymbolBackend);
+  EXPECT_EQ(Decomposer::kPdbSymbolBackend, decomposer.symbol_backend());
+  ASSERT_TRUE(decomposer.Decompose(&image_layout));
+
+  // Both backends should produce the same blocks, labels and references. The
+  // names merged into a label may be listed in a different order, so they
+  // are compared as sorted lists.
+  ASSERT_EQ(dia_block_graph.blocks().size(), block_graph.blocks().size());
+  BlockGraph::AddressSpace::RangeMapConstIter dia_it =
+      dia_image_layout.blocks.begin();
+  BlockGraph::AddressSpace::RangeMapConstIter it = image_layout.blocks.begin();
+  for (; it != image_layout.blocks.end(); ++it, ++dia_it) {
+    ASSERT_TRUE(dia_it != dia_image_layout.blocks.end());
+    EXPECT_EQ(dia_it->first, it->first);
+    const BlockGraph::Block* dia_block = dia_it->second;
+    const BlockGraph::Block* block = it->second;
+    EXPECT_EQ(dia_block->type(), block->type());
+    EXPECT_EQ(dia_block->attributes(), block->attributes());
+    EXPECT_EQ(dia_block->alignment(), block->alignment());
+    EXPECT_EQ(dia_block->name(), block->name());
+    EXPECT_EQ(dia_block->compiland_name(), block->compiland_name());
+
+    ASSERT_EQ(dia_block->labels().size(), block->labels().size());
+    BlockGraph::Block::LabelMap::const_iterator dia_label_it =
+        dia_block->labels().begin();
+    BlockGraph::Block::LabelMap::const_iterator label_it =
+        block->labels().begin();
+    for (; label_it != block->labels().end(); ++label_it, ++dia_label_it) {
+      EXPECT_EQ(dia_label_it->first, label_it->first);
+      EXPECT_EQ(dia_label_it->second.attributes(),
+                label_it->second.attributes());
+      EXPECT_EQ(GetSortedLabelNames(dia_label_it->second),
+                GetSortedLabelNames(label_it->second));
+    }
+
+    ASSERT_EQ(dia_block->references().size(), block->references().size());
+    BlockGraph::Block::ReferenceMap::const_iterator dia_ref_it =
+        dia_block->references().begin();
+    BlockGraph::Block::ReferenceMap::const_iterator ref_it =
+        block->references().begin();
+    for (; ref_it != block->references().end(); ++ref_it, ++dia_ref_it) {
+      EXPECT_EQ(dia_ref_it->first, ref_it->first);
+      EXPECT_EQ(dia_ref_it->second.type(), ref_it->second.type());
+      EXPECT_EQ(dia_ref_it->second.offset(), ref_it->second.offset());
+      RelativeAddress dia_addr;
+      RelativeAddress addr;
+      ASSERT_TRUE(dia_image_layout.blocks.GetAddressOf(
+          dia_ref_it->second.referenced(), &dia_addr));
+      ASSERT_TRUE(image_layout.blocks.GetAddressOf(
+          ref_it->second.referenced(), &addr));
+      EXPECT_EQ(dia_addr, addr);
+    }
+  }
+}
+
 TEST_F(DecomposerTest, LabelsAndAttributes) {
   base::FilePath image_path(testing::GetExeRelativePath(testing::kTestDllName));
   PEFile image_file;
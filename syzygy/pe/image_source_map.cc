@@ -14,23 +14,28 @@
 
 #include "syzygy/pe/image_source_map.h"
 
+#include <algorithm>
+#include <memory>
+
+#include "base/threading/simple_thread.h"
+
 namespace pe {
 
 using block_graph::BlockGraph;
 using core::RelativeAddress;
 
-// When inverting, in order to have as much address space available for the
-// destination image as is available to the source image, we peg this constant
-// to the middle of the possible address space. Thus, we are able to build OMAPs
-// for images up to 2GB in size.
-const ULONG kInvalidOmapRvaTo = 0x80000000;
+namespace {
 
-void BuildImageSourceMap(const ImageLayout& image_layout,
-                         ImageSourceMap* new_to_old) {
-  // Walk through all blocks in the image.
-  BlockGraph::AddressSpace::RangeMapConstIter block_it =
-      image_layout.blocks.begin();
-  for (; block_it != image_layout.blocks.end(); ++block_it) {
+typedef BlockGraph::AddressSpace::RangeMapConstIter BlockIter;
+
+// Pushes the source ranges of a run of blocks to a source map, which may be
+// an ImageSourceMap or a ColumnarSourceMap.
+template <typename SourceMap>
+void PushSourceRanges(BlockIter begin, BlockIter end, SourceMap* new_to_old) {
+  DCHECK(new_to_old != NULL);
+
+  // Walk through all blocks in the run.
+  for (BlockIter block_it = begin; block_it != end; ++block_it) {
     const BlockGraph::Block* block = block_it->second;
     DCHECK(block != NULL);
 
@@ -53,9 +58,51 @@ void BuildImageSourceMap(const ImageLayout& image_layout,
   }
 }
 
-void BuildOmapVectorFromImageSourceMap(const RelativeAddressRange& range,
-                                       const ImageSourceMap& source_map,
-                                       std::vector<OMAP>* omaps) {
+// Maps the source ranges of the blocks of a section on a worker thread.
+class SourceMapBatch : public base::DelegateSimpleThread::Delegate {
+ public:
+  // @param begin the first block of the batch.
+  // @param end the block past the last block of the batch.
+  SourceMapBatch(BlockIter begin, BlockIter end) : begin_(begin), end_(end) {
+  }
+
+  // base::DelegateSimpleThread::Delegate implementation.
+  void Run() override { PushSourceRanges(begin_, end_, &source_map_); }
+
+  const ColumnarSourceMap& source_map() const { return source_map_; }
+
+ private:
+  BlockIter begin_;
+  BlockIter end_;
+  ColumnarSourceMap source_map_;
+
+  DISALLOW_COPY_AND_ASSIGN(SourceMapBatch);
+};
+
+// @name Accessors that let BuildOmapVector work on both kinds of source maps.
+// @{
+const RelativeAddressRange& GetSrcRange(const ImageSourceMap& source_map,
+                                        size_t index) {
+  return source_map.range_pairs()[index].first;
+}
+const RelativeAddressRange& GetDstRange(const ImageSourceMap& source_map,
+                                        size_t index) {
+  return source_map.range_pairs()[index].second;
+}
+RelativeAddressRange GetSrcRange(const ColumnarSourceMap& source_map,
+                                 size_t index) {
+  return source_map.src_range(index);
+}
+RelativeAddressRange GetDstRange(const ColumnarSourceMap& source_map,
+                                 size_t index) {
+  return source_map.dst_range(index);
+}
+// @}
+
+template <typename SourceMap>
+void BuildOmapVector(const RelativeAddressRange& range,
+                     const SourceMap& source_map,
+                     std::vector<OMAP>* omaps) {
   // The image size must be less than the constant we use as an indication of
   // invalid addresses.
   DCHECK_LE(range.end().value(), kInvalidOmapRvaTo);
@@ -66,20 +113,21 @@ void BuildOmapVectorFromImageSourceMap(const RelativeAddressRange& range,
   omaps->reserve(source_map.size());
 
   RelativeAddress address = range.start();
-  ImageSourceMap::RangePairs::const_iterator pair_it =
-      source_map.range_pairs().begin();
-  for (; pair_it != source_map.range_pairs().end(); ++pair_it) {
+  for (size_t i = 0; i < source_map.size(); ++i) {
+    RelativeAddressRange src_range = GetSrcRange(source_map, i);
+    RelativeAddressRange dst_range = GetDstRange(source_map, i);
+
     // Skip any source ranges that come before us.
-    if (pair_it->first.end() < range.start())
+    if (src_range.end() < range.start())
       continue;
 
     // Stop if this source range is beyond the end of the range we're concerned
     // with.
-    if (range.end() < pair_it->first.start())
+    if (range.end() < src_range.start())
       break;
 
     // Have a gap to fill?
-    if (address < pair_it->first.start()) {
+    if (address < src_range.start()) {
       OMAP omap = { address.value(), kInvalidOmapRvaTo };
       omaps->push_back(omap);
     }
@@ -92,19 +140,18 @@ void BuildOmapVectorFromImageSourceMap(const RelativeAddressRange& range,
     // We patch these by making several OMAP entries for them, each one covering
     // a portion of the source range and repeatedly mapping it to the same
     // destination range.
-    if (pair_it->first.size() > pair_it->second.size()) {
-      address = pair_it->first.start();
-      while (address < pair_it->first.end()) {
-        OMAP omap = { address.value(), pair_it->second.start().value() };
+    if (src_range.size() > dst_range.size()) {
+      address = src_range.start();
+      while (address < src_range.end()) {
+        OMAP omap = { address.value(), dst_range.start().value() };
         omaps->push_back(omap);
-        address += pair_it->second.size();
+        address += dst_range.size();
       }
     } else {
-      OMAP omap = { pair_it->first.start().value(),
-                    pair_it->second.start().value() };
+      OMAP omap = { src_range.start().value(), dst_range.start().value() };
       omaps->push_back(omap);
 
-      address = pair_it->first.end();
+      address = src_range.end();
     }
   }
 
@@ -120,4 +167,204 @@ void BuildOmapVectorFromImageSourceMap(const RelativeAddressRange& range,
   omaps->push_back(last_omap);
 }
 
+}  // namespace
+
+// When inverting, in order to have as much address space available for the
+// destination image as is available to the source image, we peg this constant
+// to the middle of the possible address space. Thus, we are able to build OMAPs
+// for images up to 2GB in size.
+const ULONG kInvalidOmapRvaTo = 0x80000000;
+
+void BuildImageSourceMap(const ImageLayout& image_layout,
+                         ImageSourceMap* new_to_old) {
+  PushSourceRanges(image_layout.blocks.begin(), image_layout.blocks.end(),
+                   new_to_old);
+}
+
+void BuildOmapVectorFromImageSourceMap(const RelativeAddressRange& range,
+                                       const ImageSourceMap& source_map,
+                                       std::vector<OMAP>* omaps) {
+  BuildOmapVector(range, source_map, omaps);
+}
+
+RelativeAddressRange ColumnarSourceMap::src_range(size_t index) const {
+  DCHECK_LT(index, size());
+  return RelativeAddressRange(RelativeAddress(src_starts_[index]),
+                              src_sizes_[index]);
+}
+
+RelativeAddressRange ColumnarSourceMap::dst_range(size_t index) const {
+  DCHECK_LT(index, size());
+  return RelativeAddressRange(RelativeAddress(dst_starts_[index]),
+                              dst_sizes_[index]);
+}
+
+void ColumnarSourceMap::clear() {
+  src_starts_.clear();
+  src_sizes_.clear();
+  dst_starts_.clear();
+  dst_sizes_.clear();
+}
+
+void ColumnarSourceMap::reserve(size_t count) {
+  src_starts_.reserve(count);
+  src_sizes_.reserve(count);
+  dst_starts_.reserve(count);
+  dst_sizes_.reserve(count);
+}
+
+bool ColumnarSourceMap::Push(const RelativeAddressRange& src_range,
+                             const RelativeAddressRange& dst_range) {
+  // We can't insert empty ranges.
+  if (src_range.IsEmpty() || dst_range.IsEmpty())
+    return false;
+
+  uint32_t src_start = src_range.start().value();
+  uint32_t src_size = static_cast<uint32_t>(src_range.size());
+  uint32_t dst_start = dst_range.start().value();
+  uint32_t dst_size = static_cast<uint32_t>(dst_range.size());
+
+  if (!empty()) {
+    size_t last = size() - 1;
+    uint32_t last_src_end = src_starts_[last] + src_sizes_[last];
+
+    // The source range must be beyond the last one.
+    if (src_start < last_src_end)
+      return false;
+
+    // Can we merge this new pair of ranges with the existing last pair of
+    // ranges?
+    if (src_sizes_[last] == dst_sizes_[last] && src_size == dst_size &&
+        last_src_end == src_start &&
+        dst_starts_[last] + dst_sizes_[last] == dst_start) {
+      src_sizes_[last] += src_size;
+      dst_sizes_[last] += dst_size;
+      return true;
+    }
+  }
+
+  src_starts_.push_back(src_start);
+  src_sizes_.push_back(src_size);
+  dst_starts_.push_back(dst_start);
+  dst_sizes_.push_back(dst_size);
+  return true;
+}
+
+bool ColumnarSourceMap::Append(const ColumnarSourceMap& other) {
+  DCHECK_NE(this, &other);
+
+  if (other.empty())
+    return true;
+
+  // Only the first pair can be merged with our last one. If it is, the merged
+  // pair can't be merged with the second pair, as the two would already have
+  // been merged in the other map.
+  if (!Push(other.src_range(0), other.dst_range(0)))
+    return false;
+
+  src_starts_.insert(src_starts_.end(), other.src_starts_.begin() + 1,
+                     other.src_starts_.end());
+  src_sizes_.insert(src_sizes_.end(), other.src_sizes_.begin() + 1,
+                    other.src_sizes_.end());
+  dst_starts_.insert(dst_starts_.end(), other.dst_starts_.begin() + 1,
+                     other.dst_starts_.end());
+  dst_sizes_.insert(dst_sizes_.end(), other.dst_sizes_.begin() + 1,
+                    other.dst_sizes_.end());
+  return true;
+}
+
+size_t ColumnarSourceMap::ComputeInverse(ColumnarSourceMap* inverted) const {
+  DCHECK(inverted != NULL);
+  DCHECK_NE(this, inverted);
+
+  // Sort the indices of the pairs by destination range then by source range,
+  // which is the same total ordering as that used by AddressRangeMap. Only the
+  // indices are moved around, rather than the pairs themselves.
+  std::vector<uint32_t> order(size());
+  for (size_t i = 0; i < order.size(); ++i)
+    order[i] = static_cast<uint32_t>(i);
+  std::sort(order.begin(), order.end(), [this](uint32_t i1, uint32_t i2) {
+    if (dst_starts_[i1] != dst_starts_[i2])
+      return dst_starts_[i1] < dst_starts_[i2];
+    if (dst_sizes_[i1] != dst_sizes_[i2])
+      return dst_sizes_[i1] < dst_sizes_[i2];
+    if (src_starts_[i1] != src_starts_[i2])
+      return src_starts_[i1] < src_starts_[i2];
+    return src_sizes_[i1] < src_sizes_[i2];
+  });
+
+  // Push the inverted pairs and count the conflicts.
+  size_t conflicts = 0;
+  inverted->clear();
+  inverted->reserve(order.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    if (!inverted->Push(dst_range(order[i]), src_range(order[i])))
+      ++conflicts;
+  }
+
+  return conflicts;
+}
+
+void BuildColumnarSourceMap(const ImageLayout& image_layout,
+                            size_t thread_count,
+                            ColumnarSourceMap* new_to_old) {
+  DCHECK(new_to_old != NULL);
+
+  // Split the blocks into one batch per section. Blocks that precede the
+  // first section, like the headers, form a batch of their own.
+  const BlockGraph::AddressSpace& blocks = image_layout.blocks;
+  const std::vector<ImageLayout::SectionInfo>& sections =
+      image_layout.sections;
+  std::vector<std::unique_ptr<SourceMapBatch>> batches;
+  BlockIter batch_begin = blocks.begin();
+  size_t section_index = 0;
+  for (BlockIter it = blocks.begin(); it != blocks.end(); ++it) {
+    bool starts_section = false;
+    while (section_index < sections.size() &&
+           sections[section_index].addr <= it->first.start()) {
+      ++section_index;
+      starts_section = true;
+    }
+    if (starts_section && it != batch_begin) {
+      batches.push_back(std::unique_ptr<SourceMapBatch>(
+          new SourceMapBatch(batch_begin, it)));
+      batch_begin = it;
+    }
+  }
+  if (batch_begin != blocks.end()) {
+    batches.push_back(std::unique_ptr<SourceMapBatch>(
+        new SourceMapBatch(batch_begin, blocks.end())));
+  }
+
+  if (batches.size() <= 1 || thread_count <= 1) {
+    for (size_t i = 0; i < batches.size(); ++i)
+      batches[i]->Run();
+  } else {
+    base::DelegateSimpleThreadPool pool(
+        "BuildColumnarSourceMap",
+        static_cast<int>(std::min(thread_count, batches.size())));
+    pool.Start();
+    for (size_t i = 0; i < batches.size(); ++i)
+      pool.AddWork(batches[i].get());
+    pool.JoinAll();
+  }
+
+  // Merge the batches, which are in address order.
+  size_t count = 0;
+  for (size_t i = 0; i < batches.size(); ++i)
+    count += batches[i]->source_map().size();
+  new_to_old->clear();
+  new_to_old->reserve(count);
+  for (size_t i = 0; i < batches.size(); ++i) {
+    bool appended = new_to_old->Append(batches[i]->source_map());
+    DCHECK(appended);
+  }
+}
+
+void BuildOmapVectorFromColumnarSourceMap(const RelativeAddressRange& range,
+                                          const ColumnarSourceMap& source_map,
+                                          std::vector<OMAP>* omaps) {
+  BuildOmapVector(range, source_map, omaps);
+}
+
 }  // namespace pe
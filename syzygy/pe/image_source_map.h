@@ -21,6 +21,8 @@
 #include <windows.h>  // NOLINT
 #include <dbghelp.h>
 
+#include <vector>
+
 #include "syzygy/pe/image_layout.h"
 
 namespace pe {
@@ -68,6 +70,84 @@ void BuildOmapVectorFromImageSourceMap(const RelativeAddressRange& range,
                                        const ImageSourceMap& source_map,
                                        std::vector<OMAP>* omaps);
 
+// A ColumnarSourceMap holds the same mapping as an ImageSourceMap, but stores
+// each field of its range pairs in its own sorted array of 32-bit values. This
+// halves the memory used per range pair on 64-bit hosts, allows maps built
+// independently to be merged by appending arrays, and lets the OMAP vectors be
+// emitted from it without building intermediate AddressRangeMaps.
+class ColumnarSourceMap {
+ public:
+  ColumnarSourceMap() { }
+
+  // @name Accessors.
+  // @{
+  size_t size() const { return src_starts_.size(); }
+  bool empty() const { return src_starts_.empty(); }
+  RelativeAddressRange src_range(size_t index) const;
+  RelativeAddressRange dst_range(size_t index) const;
+  // @}
+
+  // Removes all of the range pairs.
+  void clear();
+
+  // Reserves room for @p count range pairs.
+  void reserve(size_t count);
+
+  // Adds a range pair to the end of the map. This has the same semantics as
+  // AddressRangeMap::Push: the source range must lie beyond all existing
+  // source ranges, and the pair is merged with the last one if both are
+  // contiguous and map ranges of equal sizes.
+  // @param src_range the source range.
+  // @param dst_range the destination range.
+  // @returns true on success, false if either range is empty or if
+  //     @p src_range doesn't lie beyond all existing source ranges.
+  bool Push(const RelativeAddressRange& src_range,
+            const RelativeAddressRange& dst_range);
+
+  // Adds all of the range pairs of another map to the end of this one, as if
+  // they were pushed one at a time.
+  // @param other the map to append. Its source ranges must lie beyond those of
+  //     this map.
+  // @returns true on success, false otherwise.
+  bool Append(const ColumnarSourceMap& other);
+
+  // Computes the inverse of this map. This has the same semantics as
+  // AddressRangeMap::ComputeInverse.
+  // @param inverted receives the inverted map.
+  // @returns the number of conflicting destination ranges that could not be
+  //     inverted.
+  size_t ComputeInverse(ColumnarSourceMap* inverted) const;
+
+ private:
+  std::vector<uint32_t> src_starts_;
+  std::vector<uint32_t> src_sizes_;
+  std::vector<uint32_t> dst_starts_;
+  std::vector<uint32_t> dst_sizes_;
+
+  DISALLOW_COPY_AND_ASSIGN(ColumnarSourceMap);
+};
+
+// Equivalent to BuildImageSourceMap, but builds a ColumnarSourceMap. The
+// blocks of each section are mapped on their own thread and the results are
+// merged.
+//
+// @param image_layout the ImageLayout whose source information to extract.
+// @param thread_count the maximum number of threads to use.
+// @param new_to_old the ColumnarSourceMap mapping relative addresses in the
+//     new image to relative addresses in the source image.
+void BuildColumnarSourceMap(const ImageLayout& image_layout,
+                            size_t thread_count,
+                            ColumnarSourceMap* new_to_old);
+
+// Equivalent to BuildOmapVectorFromImageSourceMap, for a ColumnarSourceMap.
+//
+// @param range the range which the OMAP vector should cover.
+// @param source_map the source map to be translated to an OMAP vector.
+// @param omaps the OMAP vector be populated.
+void BuildOmapVectorFromColumnarSourceMap(const RelativeAddressRange& range,
+                                          const ColumnarSourceMap& source_map,
+                                          std::vector<OMAP>* omaps);
+
 }  // namespace pe
 
 #endif  // SYZYGY_PE_IMAGE_SOURCE_MAP_H_
@@ -55,6 +55,19 @@ bool IsValidOmapVector(const std::vector<OMAP>& omap) {
   return true;
 }
 
+// Expects a ColumnarSourceMap to hold the same range pairs as an
+// ImageSourceMap.
+void ExpectSameSourceMap(const ImageSourceMap& source_map,
+                         const ColumnarSourceMap& columnar_source_map) {
+  ASSERT_EQ(source_map.size(), columnar_source_map.size());
+  for (size_t i = 0; i < source_map.size(); ++i) {
+    EXPECT_EQ(source_map.range_pairs()[i].first,
+              columnar_source_map.src_range(i));
+    EXPECT_EQ(source_map.range_pairs()[i].second,
+              columnar_source_map.dst_range(i));
+  }
+}
+
 }  // namespace
 
 TEST_F(ImageSourceMapTest, FromUntransformedImageLayout) {
@@ -141,4 +154,140 @@ TEST_F(ImageSourceMapTest, OmapShrinkingRanges) {
   }
 }
 
+TEST_F(ImageSourceMapTest, ColumnarPushAndAppend) {
+  ColumnarSourceMap source_map;
+  EXPECT_TRUE(source_map.empty());
+
+  // Empty and overlapping ranges are rejected.
+  EXPECT_FALSE(source_map.Push(RelativeAddressRange(RelativeAddress(0), 0),
+                               RelativeAddressRange(RelativeAddress(0), 8)));
+  EXPECT_TRUE(source_map.Push(RelativeAddressRange(RelativeAddress(0), 8),
+                              RelativeAddressRange(RelativeAddress(100), 8)));
+  EXPECT_FALSE(source_map.Push(RelativeAddressRange(RelativeAddress(4), 8),
+                               RelativeAddressRange(RelativeAddress(200), 8)));
+
+  // Contiguous pairs of equal sizes are merged, others aren't.
+  EXPECT_TRUE(source_map.Push(RelativeAddressRange(RelativeAddress(8), 8),
+                              RelativeAddressRange(RelativeAddress(108), 8)));
+  EXPECT_EQ(1u, source_map.size());
+  EXPECT_TRUE(source_map.Push(RelativeAddressRange(RelativeAddress(16), 8),
+                              RelativeAddressRange(RelativeAddress(200), 4)));
+  EXPECT_EQ(2u, source_map.size());
+
+  ColumnarSourceMap other_source_map;
+  EXPECT_TRUE(other_source_map.Push(
+      RelativeAddressRange(RelativeAddress(32), 8),
+      RelativeAddressRange(RelativeAddress(300), 8)));
+  EXPECT_TRUE(other_source_map.Push(
+      RelativeAddressRange(RelativeAddress(40), 4),
+      RelativeAddressRange(RelativeAddress(400), 4)));
+
+  // Appending merges at the boundary like pushing does.
+  ColumnarSourceMap merged_source_map;
+  EXPECT_TRUE(merged_source_map.Push(
+      RelativeAddressRange(RelativeAddress(24), 8),
+      RelativeAddressRange(RelativeAddress(292), 8)));
+  EXPECT_TRUE(merged_source_map.Append(other_source_map));
+  EXPECT_EQ(2u, merged_source_map.size());
+  EXPECT_EQ(RelativeAddressRange(RelativeAddress(24), 16),
+            merged_source_map.src_range(0));
+  EXPECT_EQ(RelativeAddressRange(RelativeAddress(292), 16),
+            merged_source_map.dst_range(0));
+
+  EXPECT_TRUE(source_map.Append(merged_source_map));
+  EXPECT_EQ(4u, source_map.size());
+  EXPECT_FALSE(source_map.Append(other_source_map));
+}
+
+TEST_F(ImageSourceMapTest, ColumnarMatchesImageSourceMap) {
+  base::FilePath image_path(testing::GetExeRelativePath(testing::kTestDllName));
+  PEFile image_file;
+
+  ASSERT_TRUE(image_file.Init(image_path));
+
+  Decomposer decomposer(image_file);
+  BlockGraph block_graph;
+  ImageLayout image_layout(&block_graph);
+  ASSERT_TRUE(decomposer.Decompose(&image_layout));
+
+  ImageSourceMap source_map;
+  BuildImageSourceMap(image_layout, &source_map);
+
+  // The result doesn't depend on the number of threads.
+  ColumnarSourceMap columnar_source_map;
+  BuildColumnarSourceMap(image_layout, 1, &columnar_source_map);
+  ASSERT_NO_FATAL_FAILURE(
+      ExpectSameSourceMap(source_map, columnar_source_map));
+  BuildColumnarSourceMap(image_layout, 4, &columnar_source_map);
+  ASSERT_NO_FATAL_FAILURE(
+      ExpectSameSourceMap(source_map, columnar_source_map));
+
+  ImageSourceMap inverted_source_map;
+  ColumnarSourceMap inverted_columnar_source_map;
+  EXPECT_EQ(source_map.ComputeInverse(&inverted_source_map),
+            columnar_source_map.ComputeInverse(&inverted_columnar_source_map));
+  ASSERT_NO_FATAL_FAILURE(ExpectSameSourceMap(inverted_source_map,
+                                              inverted_columnar_source_map));
+
+  ASSERT_FALSE(image_layout.sections.empty());
+  const ImageLayout::SectionInfo& last_section = image_layout.sections.back();
+  RelativeAddressRange range(RelativeAddress(0),
+                             last_section.addr.value() + last_section.size);
+  std::vector<OMAP> omap_to;
+  BuildOmapVectorFromImageSourceMap(range, source_map, &omap_to);
+  std::vector<OMAP> columnar_omap_to;
+  BuildOmapVectorFromColumnarSourceMap(range, columnar_source_map,
+                                       &columnar_omap_to);
+  EXPECT_THAT(omap_to, testing::ContainerEq(columnar_omap_to));
+}
+
+TEST_F(ImageSourceMapTest, ColumnarOmapConversion) {
+  // This is the same layout as in OmapConversion.
+  const RelativeAddressRange h_old(RelativeAddress(0), 512);
+  const RelativeAddressRange h_new(RelativeAddress(0), 512);
+  const RelativeAddressRange a_old(RelativeAddress(1024), 128);
+  const RelativeAddressRange a_new(RelativeAddress(1152), 128);
+  const RelativeAddressRange b_old(RelativeAddress(1536), 128);
+  const RelativeAddressRange b_new(RelativeAddress(1024), 128);
+  const size_t size_new = 1536;
+  const size_t size_old = 2048;
+
+  ColumnarSourceMap source_map;
+  ASSERT_TRUE(source_map.Push(h_new, h_old));
+  ASSERT_TRUE(source_map.Push(b_new, b_old));
+  ASSERT_TRUE(source_map.Push(a_new, a_old));
+
+  std::vector<OMAP> omap_to;
+  BuildOmapVectorFromColumnarSourceMap(
+      RelativeAddressRange(RelativeAddress(0), size_new), source_map, &omap_to);
+  EXPECT_TRUE(IsValidOmapVector(omap_to));
+
+  std::vector<OMAP> expected;
+  expected.push_back(BuildOmap(0, 0));
+  expected.push_back(BuildOmap(512, kInvalidOmapRvaTo));
+  expected.push_back(BuildOmap(1024, 1536));
+  expected.push_back(BuildOmap(1152, 1024));
+  expected.push_back(BuildOmap(1280, kInvalidOmapRvaTo));
+  expected.push_back(BuildOmap(1536, kInvalidOmapRvaTo));
+  EXPECT_THAT(expected, testing::ContainerEq(omap_to));
+
+  ColumnarSourceMap inverted_source_map;
+  EXPECT_EQ(0u, source_map.ComputeInverse(&inverted_source_map));
+  std::vector<OMAP> omap_from;
+  BuildOmapVectorFromColumnarSourceMap(
+      RelativeAddressRange(RelativeAddress(0), size_old), inverted_source_map,
+      &omap_from);
+  EXPECT_TRUE(IsValidOmapVector(omap_from));
+
+  expected.clear();
+  expected.push_back(BuildOmap(0, 0));
+  expected.push_back(BuildOmap(512, kInvalidOmapRvaTo));
+  expected.push_back(BuildOmap(1024, 1152));
+  expected.push_back(BuildOmap(1152, kInvalidOmapRvaTo));
+  expected.push_back(BuildOmap(1536, 1024));
+  expected.push_back(BuildOmap(1664, kInvalidOmapRvaTo));
+  expected.push_back(BuildOmap(2048, kInvalidOmapRvaTo));
+  EXPECT_THAT(expected, testing::ContainerEq(omap_from));
+}
+
 }  // namespace pe
@@ -0,0 +1,790 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/pe/pdb_symbol_reader.h"
+
+#include <algorithm>
+
+#include "base/bind.h"
+#include "base/logging.h"
+#include "syzygy/common/binary_stream.h"
+#include "syzygy/pdb/pdb_byte_stream.h"
+#include "syzygy/pdb/pdb_constants.h"
+#include "syzygy/pdb/pdb_dbi_stream.h"
+#include "syzygy/pdb/pdb_reader.h"
+#include "syzygy/pdb/pdb_symbol_record.h"
+#include "syzygy/pdb/pdb_type_info_stream_enum.h"
+#include "syzygy/pdb/gen/pdb_type_info_records.h"
+#include "syzygy/pe/cvinfo_ext.h"
+
+namespace pe {
+
+namespace {
+
+namespace cci = Microsoft_Cci_Pdb;
+
+// The symbol index of the scopes that are not reported.
+const size_t kNoSymbol = static_cast<size_t>(-1);
+
+// The maximum depth of the type records followed to size a type. This
+// protects against malformed, cyclic type information.
+const size_t kMaxTypeDepth = 32;
+
+// Reads the fixed-size part of a symbol and, if @p name is not NULL, the
+// zero-terminated name that follows it.
+// @param fixed_size the size of the fixed part of the symbol.
+// @param reader the reader positioned at the start of the symbol.
+// @param symbol receives the fixed part of the symbol.
+// @param name receives the name of the symbol. May be NULL.
+// @returns true on success, false otherwise.
+template <typename SymbolType>
+bool ReadSymbol(size_t fixed_size,
+                common::BinaryStreamReader* reader,
+                SymbolType* symbol,
+                std::string* name) {
+  DCHECK_NE(static_cast<common::BinaryStreamReader*>(nullptr), reader);
+  DCHECK_NE(static_cast<SymbolType*>(nullptr), symbol);
+  DCHECK_LE(fixed_size, sizeof(*symbol));
+
+  common::BinaryStreamParser parser(reader);
+  if (!parser.ReadBytes(fixed_size, symbol)) {
+    LOG(ERROR) << "Unable to read symbol.";
+    return false;
+  }
+  if (name != nullptr && !parser.ReadString(name)) {
+    LOG(ERROR) << "Unable to read symbol name.";
+    return false;
+  }
+  return true;
+}
+
+// @returns the size of the basic type @p type_id, or 0 if it is unknown.
+size_t BasicTypeSize(uint32_t type_id) {
+  switch (type_id) {
+#define SPECIAL_TYPE_NAME(record_type, type_name, size) \
+  case cci::record_type: return size;
+    SPECIAL_TYPE_NAME_CASE_TABLE(SPECIAL_TYPE_NAME)
+#undef SPECIAL_TYPE_NAME
+  }
+
+  // Pointers to basic types encode their size in their mode.
+  switch ((type_id & cci::CV_PRIMITIVE_TYPE::CV_MMASK) >>
+          cci::CV_PRIMITIVE_TYPE::CV_MSHIFT) {
+    case cci::CV_TM_NPTR32: return 4;
+    case cci::CV_TM_NPTR64: return 8;
+    case cci::CV_TM_NPTR128: return 16;
+  }
+  return 0;
+}
+
+// @returns the name under which a user-defined type is looked up when
+//     resolving forward references.
+template <typename LeafType>
+const base::string16& UniqueTypeName(const LeafType& leaf) {
+  if (leaf.has_decorated_name())
+    return leaf.decorated_name();
+  return leaf.name();
+}
+
+}  // namespace
+
+PdbSymbolReader::Symbol::Symbol()
+    : kind(kEndSymbol), size(0), parent_size(0), flags(0) {
+}
+
+PdbSymbolReader::PdbSymbolReader() : type_definitions_built_(false) {
+}
+
+bool PdbSymbolReader::Init(const base::FilePath& pdb_path) {
+  pdb::PdbFile pdb_file;
+  pdb::PdbReader pdb_reader;
+  if (!pdb_reader.ReadMapped(pdb_path, &pdb_file)) {
+    LOG(ERROR) << "Failed to load PDB: " << pdb_path.value();
+    return false;
+  }
+
+  // Read the entire DBI stream into memory before parsing it.
+  scoped_refptr<pdb::PdbStream> stream = pdb_file.GetStream(pdb::kDbiStream);
+  if (stream.get() == NULL) {
+    LOG(ERROR) << "PDB does not contain a DBI stream.";
+    return false;
+  }
+  scoped_refptr<pdb::PdbByteStream> dbi_stream(new pdb::PdbByteStream());
+  pdb::DbiStream dbi;
+  if (!dbi_stream->Init(stream.get()) || !dbi.Read(dbi_stream.get())) {
+    LOG(ERROR) << "Unable to parse DBI stream.";
+    return false;
+  }
+
+  // The addresses of the symbols of an image that has been relinked would
+  // need to be translated through the OMAP tables, which DIA does for us
+  // but which is not supported here.
+  int32_t omap_from = dbi.dbg_header().omap_from_src;
+  if (omap_from != -1 && pdb_file.GetStream(omap_from).get() != NULL &&
+      pdb_file.GetStream(omap_from)->length() != 0) {
+    LOG(ERROR) << "PDB contains OMAP information, which is not supported "
+               << "without DIA.";
+    return false;
+  }
+
+  if (!ReadSectionHeaders(pdb_file, dbi.dbg_header().section_header) ||
+      !ReadFixups(pdb_file, dbi.dbg_header().fixup)) {
+    return false;
+  }
+
+  type_stream_ = pdb_file.GetStream(pdb::kTpiStream);
+  if (type_stream_.get() == NULL) {
+    LOG(ERROR) << "PDB does not contain a TPI stream.";
+    return false;
+  }
+  type_enumerator_.reset(new pdb::TypeInfoEnumerator(type_stream_.get()));
+  if (!type_enumerator_->Init()) {
+    LOG(ERROR) << "Unable to initialize type info stream enumerator.";
+    return false;
+  }
+
+  // Read the symbols of the modules.
+  modules_.resize(dbi.modules().size());
+  for (size_t i = 0; i < dbi.modules().size(); ++i) {
+    const pdb::DbiModuleInfo& module_info = dbi.modules()[i];
+    Module* module = &modules_[i];
+    module->name = module_info.module_name();
+
+    int16_t stream_index = module_info.module_info_base().stream;
+    if (stream_index == -1)
+      continue;
+    stream = pdb_file.GetStream(stream_index);
+    if (stream.get() == NULL) {
+      LOG(ERROR) << "Unable to open symbol stream of module \""
+                 << module->name << "\".";
+      return false;
+    }
+    if (!ReadModuleSymbols(stream.get(),
+                           module_info.module_info_base().symbol_bytes,
+                           module)) {
+      LOG(ERROR) << "Unable to read symbols of module \"" << module->name
+                 << "\".";
+      return false;
+    }
+  }
+
+  // Read the global symbols.
+  int32_t symbol_record_stream = dbi.header().symbol_record_stream;
+  if (symbol_record_stream != -1) {
+    stream = pdb_file.GetStream(symbol_record_stream);
+    if (stream.get() == NULL || !ReadGlobalSymbols(stream.get())) {
+      LOG(ERROR) << "Unable to read the symbol record stream.";
+      return false;
+    }
+  }
+
+  // Convert the section contributions.
+  const pdb::DbiStream::DbiSectionContribVector& contribs =
+      dbi.section_contribs();
+  section_contribs_.reserve(contribs.size());
+  for (size_t i = 0; i < contribs.size(); ++i) {
+    SectionContrib contrib = {};
+    if (!ToRelativeAddress(static_cast<uint16_t>(contribs[i].section),
+                           contribs[i].offset, &contrib.addr)) {
+      LOG(ERROR) << "Section contribution has an invalid section.";
+      return false;
+    }
+    if (contribs[i].module < 0 ||
+        static_cast<size_t>(contribs[i].module) >= modules_.size()) {
+      LOG(ERROR) << "Section contribution has an invalid module.";
+      return false;
+    }
+    contrib.size = contribs[i].size;
+    contrib.section = contribs[i].section - 1;
+    contrib.code = (contribs[i].flags & IMAGE_SCN_CNT_CODE) != 0;
+    contrib.module = contribs[i].module;
+    section_contribs_.push_back(contrib);
+  }
+
+  // The type information is no longer needed.
+  type_enumerator_.reset();
+  type_stream_ = NULL;
+  type_sizes_.clear();
+  type_definitions_.clear();
+
+  return true;
+}
+
+bool PdbSymbolReader::ReadSectionHeaders(const pdb::PdbFile& pdb_file,
+                                         int32_t stream_index) {
+  scoped_refptr<pdb::PdbStream> stream;
+  if (stream_index != -1)
+    stream = pdb_file.GetStream(stream_index);
+  if (stream.get() == NULL) {
+    LOG(ERROR) << "PDB does not contain a section header stream.";
+    return false;
+  }
+
+  size_t count = stream->length() / sizeof(IMAGE_SECTION_HEADER);
+  section_headers_.resize(count);
+  if (count != 0 &&
+      !stream->ReadBytesAt(0, count * sizeof(IMAGE_SECTION_HEADER),
+                           section_headers_.data())) {
+    LOG(ERROR) << "Failed to read the section header stream.";
+    return false;
+  }
+
+  return true;
+}
+
+bool PdbSymbolReader::ReadFixups(const pdb::PdbFile& pdb_file,
+                                 int32_t stream_index) {
+  scoped_refptr<pdb::PdbStream> stream;
+  if (stream_index != -1)
+    stream = pdb_file.GetStream(stream_index);
+  if (stream.get() == NULL) {
+    LOG(ERROR) << "PDB file does not contain a FIXUP stream. Module must be "
+                  "linked with '/PROFILE' or '/DEBUGINFO:FIXUP' flag.";
+    return false;
+  }
+
+  if (stream->length() % sizeof(pdb::PdbFixup) != 0) {
+    LOG(ERROR) << "FIXUP stream has an invalid length.";
+    return false;
+  }
+
+  fixups_.resize(stream->length() / sizeof(pdb::PdbFixup));
+  if (!fixups_.empty() &&
+      !stream->ReadBytesAt(0, stream->length(), fixups_.data())) {
+    LOG(ERROR) << "Failed to read the FIXUP stream.";
+    return false;
+  }
+
+  return true;
+}
+
+bool PdbSymbolReader::ReadModuleSymbols(pdb::PdbStream* stream,
+                                        size_t symbol_bytes,
+                                        Module* module) {
+  DCHECK_NE(static_cast<pdb::PdbStream*>(nullptr), stream);
+  DCHECK_NE(static_cast<Module*>(nullptr), module);
+
+  // Read the entire stream into memory for faster parsing.
+  scoped_refptr<pdb::PdbByteStream> symbols(new pdb::PdbByteStream());
+  if (!symbols->Init(stream))
+    return false;
+
+  open_scopes_.clear();
+  pdb::VisitSymbolsCallback callback = base::Bind(
+      &PdbSymbolReader::OnModuleSymbol, base::Unretained(this),
+      base::Unretained(module));
+  if (!pdb::VisitSymbols(callback, 0, symbol_bytes, true, symbols.get()))
+    return false;
+
+  if (!open_scopes_.empty()) {
+    LOG(ERROR) << "Symbol stream ends within a scope.";
+    return false;
+  }
+
+  return true;
+}
+
+bool PdbSymbolReader::ReadGlobalSymbols(pdb::PdbStream* stream) {
+  DCHECK_NE(static_cast<pdb::PdbStream*>(nullptr), stream);
+
+  scoped_refptr<pdb::PdbByteStream> symbols(new pdb::PdbByteStream());
+  if (!symbols->Init(stream))
+    return false;
+
+  pdb::VisitSymbolsCallback callback = base::Bind(
+      &PdbSymbolReader::OnGlobalSymbol, base::Unretained(this));
+  if (!pdb::VisitSymbols(callback, 0, symbols->length(), false,
+                         symbols.get())) {
+    return false;
+  }
+
+  // Report the public symbols after the global data, like DIA does.
+  std::stable_partition(global_symbols_.begin(), global_symbols_.end(),
+                        [](const Symbol& symbol) {
+                          return symbol.kind != kPublicSymbol;
+                        });
+
+  return true;
+}
+
+bool PdbSymbolReader::OnModuleSymbol(Module* module,
+                                     uint16_t symbol_length,
+                                     uint16_t symbol_type,
+                                     common::BinaryStreamReader* reader) {
+  DCHECK_NE(static_cast<Module*>(nullptr), module);
+  DCHECK_NE(static_cast<common::BinaryStreamReader*>(nullptr), reader);
+
+  Symbols* symbols = &module->symbols;
+  RelativeAddress addr;
+
+  switch (symbol_type) {
+    case cci::S_COMPILE2: {
+      cci::CompileSym symbol = {};
+      std::string name;
+      if (!ReadSymbol(offsetof(cci::CompileSym, verSt), reader, &symbol,
+                      &name)) {
+        return false;
+      }
+      if (module->compiler_name.empty())
+        module->compiler_name = name;
+      return true;
+    }
+
+    case cci::S_COMPILE3: {
+      cci::CompileSym2 symbol = {};
+      std::string name;
+      if (!ReadSymbol(offsetof(cci::CompileSym2, verSt), reader, &symbol,
+                      &name)) {
+        return false;
+      }
+      if (module->compiler_name.empty())
+        module->compiler_name = name;
+      return true;
+    }
+
+    case cci::S_GPROC32:
+    case cci::S_LPROC32:
+    case cci::S_GPROC32_VS2013:
+    case cci::S_LPROC32_VS2013: {
+      cci::ProcSym32 symbol = {};
+      std::string name;
+      if (!ReadSymbol(offsetof(cci::ProcSym32, name), reader, &symbol, &name))
+        return false;
+
+      // Functions without a static location and their contents are dropped.
+      if (InSkippedScope() ||
+          !ToRelativeAddress(symbol.seg, symbol.off, &addr)) {
+        PushScope(kNoSymbol, true, true);
+        return true;
+      }
+
+      size_t index = AddSymbol(kFunctionSymbol, addr, symbol.len, name,
+                               symbols);
+      if ((symbol.flags & cci::CV_PFLAG_NEVER) != 0)
+        (*symbols)[index].flags |= kNoReturnFlag;
+      PushScope(index, true, false);
+
+      // The debug start and end are implicit children of the function.
+      AddSymbol(kDebugStartSymbol, addr + symbol.dbgStart, 0, "", symbols);
+      AddSymbol(kDebugEndSymbol, addr + symbol.dbgEnd, 0, "", symbols);
+      return true;
+    }
+
+    case cci::S_THUNK32: {
+      cci::ThunkSym32 symbol = {};
+      std::string name;
+      if (!ReadSymbol(offsetof(cci::ThunkSym32, name), reader, &symbol, &name))
+        return false;
+
+      if (InSkippedScope() ||
+          !ToRelativeAddress(symbol.seg, symbol.off, &addr)) {
+        PushScope(kNoSymbol, true, true);
+        return true;
+      }
+
+      size_t index = AddSymbol(kThunkSymbol, addr, symbol.len, name, symbols);
+      PushScope(index, true, false);
+      return true;
+    }
+
+    case cci::S_SEPCODE: {
+      cci::SepCodSym symbol = {};
+      if (!ReadSymbol(sizeof(symbol), reader, &symbol, nullptr))
+        return false;
+
+      RelativeAddress parent_addr;
+      if (InSkippedScope() ||
+          !ToRelativeAddress(symbol.sec, symbol.off, &addr) ||
+          !ToRelativeAddress(symbol.secParent, symbol.offParent,
+                             &parent_addr)) {
+        PushScope(kNoSymbol, false, true);
+        return true;
+      }
+
+      size_t index = AddSymbol(kSeparatedCodeSymbol, addr, symbol.length, "",
+                               symbols);
+      Symbol& sepcode = (*symbols)[index];
+      sepcode.flags |= kFunctionParentFlag;
+      sepcode.parent_addr = parent_addr;
+      Symbol* function = CurrentFunction(module);
+      if (function != nullptr && function->addr == parent_addr)
+        sepcode.parent_size = function->size;
+      PushScope(index, false, false);
+      return true;
+    }
+
+    case cci::S_BLOCK32: {
+      cci::BlockSym32 symbol = {};
+      if (!ReadSymbol(offsetof(cci::BlockSym32, name), reader, &symbol,
+                      nullptr)) {
+        return false;
+      }
+
+      if (InSkippedScope() || CurrentFunction(module) == nullptr ||
+          !ToRelativeAddress(symbol.seg, symbol.off, &addr)) {
+        PushScope(kNoSymbol, false, InSkippedScope());
+        return true;
+      }
+
+      // Remember whether the scope is directly contained in the function, as
+      // opposed to being nested in another scope.
+      const OpenScope& parent = open_scopes_.back();
+      size_t index = AddSymbol(kScopeSymbol, addr, symbol.len, "", symbols);
+      if (parent.is_function && parent.symbol_index != kNoSymbol) {
+        const Symbol& function = (*symbols)[parent.symbol_index];
+        Symbol& scope = (*symbols)[index];
+        scope.flags |= kFunctionParentFlag;
+        scope.parent_addr = function.addr;
+        scope.parent_size = function.size;
+      }
+      PushScope(kNoSymbol, false, false);
+      return true;
+    }
+
+    case cci::S_WITH32: {
+      PushScope(kNoSymbol, false, InSkippedScope());
+      return true;
+    }
+
+    case cci::S_INLINESITE: {
+      // The symbols of inlined functions are not associated with the image.
+      PushScope(kNoSymbol, false, true);
+      return true;
+    }
+
+    case cci::S_END:
+    case cci::S_PROC_ID_END:
+    case cci::S_INLINESITE_END: {
+      if (open_scopes_.empty()) {
+        LOG(ERROR) << "Unmatched end of scope symbol.";
+        return false;
+      }
+      OpenScope scope = open_scopes_.back();
+      open_scopes_.pop_back();
+      if (scope.symbol_index != kNoSymbol) {
+        const Symbol& opening = (*symbols)[scope.symbol_index];
+        AddSymbol(kEndSymbol, opening.addr + opening.size, 0, "", symbols);
+      }
+      return true;
+    }
+
+    case cci::S_FRAMEPROC: {
+      cci::FrameProcSym symbol = {};
+      if (!ReadSymbol(sizeof(symbol), reader, &symbol, nullptr))
+        return false;
+
+      Symbol* function = CurrentFunction(module);
+      if (InSkippedScope() || function == nullptr)
+        return true;
+      FrameProcSymFlags flags = {static_cast<uint16_t>(symbol.flags)};
+      if (flags.fHasInlAsm)
+        function->flags |= kHasInlineAssemblyFlag;
+      if (flags.fHasEH || flags.fHasSEH)
+        function->flags |= kHasExceptionHandlingFlag;
+      return true;
+    }
+
+    case cci::S_GDATA32:
+    case cci::S_LDATA32: {
+      cci::DatasSym32 symbol = {};
+      std::string name;
+      if (!ReadSymbol(offsetof(cci::DatasSym32, name), reader, &symbol, &name))
+        return false;
+
+      if (InSkippedScope() ||
+          !ToRelativeAddress(symbol.seg, symbol.off, &addr)) {
+        return true;
+      }
+      AddSymbol(kDataSymbol, addr, GetTypeSize(symbol.typind), name, symbols);
+      return true;
+    }
+
+    case cci::S_LABEL32: {
+      cci::LabelSym32 symbol = {};
+      std::string name;
+      if (!ReadSymbol(offsetof(cci::LabelSym32, name), reader, &symbol, &name))
+        return false;
+
+      if (InSkippedScope() ||
+          !ToRelativeAddress(symbol.seg, symbol.off, &addr)) {
+        return true;
+      }
+      AddSymbol(kLabelSymbol, addr, 0, name, symbols);
+      return true;
+    }
+
+    case cci::S_CALLSITEINFO: {
+      cci::CallsiteInfo symbol = {};
+      if (!ReadSymbol(sizeof(symbol), reader, &symbol, nullptr))
+        return false;
+
+      if (InSkippedScope() || CurrentFunction(module) == nullptr ||
+          !ToRelativeAddress(symbol.ect, symbol.off, &addr)) {
+        return true;
+      }
+      AddSymbol(kCallSiteSymbol, addr, 0, "", symbols);
+      return true;
+    }
+
+    default:
+      break;
+  }
+
+  return true;
+}
+
+bool PdbSymbolReader::OnGlobalSymbol(uint16_t symbol_length,
+                                     uint16_t symbol_type,
+                                     common::BinaryStreamReader* reader) {
+  DCHECK_NE(static_cast<common::BinaryStreamReader*>(nullptr), reader);
+
+  RelativeAddress addr;
+  switch (symbol_type) {
+    case cci::S_GDATA32:
+    case cci::S_LDATA32: {
+      cci::DatasSym32 symbol = {};
+      std::string name;
+      if (!ReadSymbol(offsetof(cci::DatasSym32, name), reader, &symbol, &name))
+        return false;
+      if (ToRelativeAddress(symbol.seg, symbol.off, &addr)) {
+        AddSymbol(kDataSymbol, addr, GetTypeSize(symbol.typind), name,
+                  &global_symbols_);
+      }
+      return true;
+    }
+
+    case cci::S_PUB32: {
+      cci::PubSym32 symbol = {};
+      std::string name;
+      if (!ReadSymbol(offsetof(cci::PubSym32, name), reader, &symbol, &name))
+        return false;
+      if (ToRelativeAddress(symbol.seg, symbol.off, &addr))
+        AddSymbol(kPublicSymbol, addr, 0, name, &global_symbols_);
+      return true;
+    }
+
+    default:
+      break;
+  }
+
+  return true;
+}
+
+bool PdbSymbolReader::ToRelativeAddress(uint16_t segment,
+                                        uint32_t offset,
+                                        RelativeAddress* addr) const {
+  DCHECK_NE(static_cast<RelativeAddress*>(nullptr), addr);
+
+  // Segments are numbered starting at 1. Symbols that were optimized away
+  // have no segment.
+  if (segment == 0 || segment > section_headers_.size())
+    return false;
+
+  *addr = RelativeAddress(section_headers_[segment - 1].VirtualAddress +
+                          offset);
+  return true;
+}
+
+size_t PdbSymbolReader::GetTypeSize(uint32_t type_id) {
+  return GetTypeSizeImpl(type_id, 0);
+}
+
+size_t PdbSymbolReader::GetTypeSizeImpl(uint32_t type_id, size_t depth) {
+  if (type_id < cci::CV_PRIMITIVE_TYPE::CV_FIRST_NONPRIM)
+    return BasicTypeSize(type_id);
+
+  std::map<uint32_t, size_t>::const_iterator it = type_sizes_.find(type_id);
+  if (it != type_sizes_.end())
+    return it->second;
+
+  if (depth >= kMaxTypeDepth || !type_enumerator_->SeekRecord(type_id)) {
+    VLOG(1) << "Unable to size type " << type_id << ".";
+    return 0;
+  }
+
+  // Parse the record. Following references to other types moves the
+  // enumerator, so these are only followed once the record is parsed.
+  uint16_t leaf_type = type_enumerator_->type();
+  pdb::TypeInfoEnumerator::BinaryTypeRecordReader reader(
+      type_enumerator_->CreateRecordReader());
+  common::BinaryStreamParser parser(&reader);
+  size_t size = 0;
+  bool parsed = true;
+  switch (leaf_type) {
+    case cci::LF_POINTER: {
+      pdb::LeafPointer leaf;
+      parsed = leaf.Initialize(&parser);
+      if (parsed)
+        size = leaf.attr().ptrtype == cci::CV_PTR_64 ? 8 : 4;
+      break;
+    }
+
+    case cci::LF_MODIFIER: {
+      pdb::LeafModifier leaf;
+      parsed = leaf.Initialize(&parser);
+      if (parsed)
+        size = GetTypeSizeImpl(leaf.body().type, depth + 1);
+      break;
+    }
+
+    case cci::LF_BITFIELD: {
+      pdb::LeafBitfield leaf;
+      parsed = leaf.Initialize(&parser);
+      if (parsed)
+        size = GetTypeSizeImpl(leaf.body().type, depth + 1);
+      break;
+    }
+
+    case cci::LF_ARRAY: {
+      pdb::LeafArray leaf;
+      parsed = leaf.Initialize(&parser);
+      if (parsed)
+        size = static_cast<size_t>(leaf.size());
+      break;
+    }
+
+    case cci::LF_CLASS:
+    case cci::LF_STRUCTURE: {
+      pdb::LeafClass leaf;
+      parsed = leaf.Initialize(&parser);
+      if (!parsed)
+        break;
+      size = static_cast<size_t>(leaf.size());
+      if (leaf.property().fwdref) {
+        uint32_t definition = FindTypeDefinition(UniqueTypeName(leaf));
+        size = definition != 0 ? GetTypeSizeImpl(definition, depth + 1) : 0;
+      }
+      break;
+    }
+
+    case cci::LF_UNION: {
+      pdb::LeafUnion leaf;
+      parsed = leaf.Initialize(&parser);
+      if (!parsed)
+        break;
+      size = static_cast<size_t>(leaf.size());
+      if (leaf.property().fwdref) {
+        uint32_t definition = FindTypeDefinition(UniqueTypeName(leaf));
+        size = definition != 0 ? GetTypeSizeImpl(definition, depth + 1) : 0;
+      }
+      break;
+    }
+
+    case cci::LF_ENUM: {
+      pdb::LeafEnum leaf;
+      parsed = leaf.Initialize(&parser);
+      if (parsed)
+        size = GetTypeSizeImpl(leaf.body().utype, depth + 1);
+      break;
+    }
+
+    default:
+      // Procedures and the like have no size of their own.
+      break;
+  }
+
+  if (!parsed) {
+    VLOG(1) << "Unable to parse type record " << type_id << ".";
+    size = 0;
+  }
+
+  type_sizes_[type_id] = size;
+  return size;
+}
+
+uint32_t PdbSymbolReader::FindTypeDefinition(
+    const base::string16& unique_name) {
+  if (!type_definitions_built_) {
+    type_definitions_built_ = true;
+    if (!type_enumerator_->ResetStream())
+      return 0;
+
+    while (!type_enumerator_->EndOfStream()) {
+      if (!type_enumerator_->NextTypeInfoRecord())
+        break;
+
+      uint16_t leaf_type = type_enumerator_->type();
+      if (leaf_type != cci::LF_CLASS && leaf_type != cci::LF_STRUCTURE &&
+          leaf_type != cci::LF_UNION) {
+        continue;
+      }
+
+      pdb::TypeInfoEnumerator::BinaryTypeRecordReader reader(
+          type_enumerator_->CreateRecordReader());
+      common::BinaryStreamParser parser(&reader);
+      if (leaf_type == cci::LF_UNION) {
+        pdb::LeafUnion leaf;
+        if (leaf.Initialize(&parser) && !leaf.property().fwdref) {
+          type_definitions_[UniqueTypeName(leaf)] =
+              type_enumerator_->type_id();
+        }
+      } else {
+        pdb::LeafClass leaf;
+        if (leaf.Initialize(&parser) && !leaf.property().fwdref) {
+          type_definitions_[UniqueTypeName(leaf)] =
+              type_enumerator_->type_id();
+        }
+      }
+    }
+  }
+
+  std::map<base::string16, uint32_t>::const_iterator it =
+      type_definitions_.find(unique_name);
+  if (it == type_definitions_.end())
+    return 0;
+  return it->second;
+}
+
+void PdbSymbolReader::PushScope(size_t symbol_index,
+                                bool is_function,
+                                bool skip) {
+  OpenScope scope = { symbol_index, is_function, skip };
+  open_scopes_.push_back(scope);
+}
+
+bool PdbSymbolReader::InSkippedScope() const {
+  return !open_scopes_.empty() && open_scopes_.back().skip;
+}
+
+PdbSymbolReader::Symbol* PdbSymbolReader::CurrentFunction(Module* module) {
+  DCHECK_NE(static_cast<Module*>(nullptr), module);
+
+  std::vector<OpenScope>::const_reverse_iterator it = open_scopes_.rbegin();
+  for (; it != open_scopes_.rend(); ++it) {
+    if (it->is_function) {
+      if (it->symbol_index == kNoSymbol)
+        return nullptr;
+      return &module->symbols[it->symbol_index];
+    }
+  }
+  return nullptr;
+}
+
+size_t PdbSymbolReader::AddSymbol(SymbolKind kind,
+                                  RelativeAddress addr,
+                                  size_t size,
+                                  const std::string& name,
+                                  Symbols* symbols) {
+  DCHECK_NE(static_cast<Symbols*>(nullptr), symbols);
+
+  symbols->push_back(Symbol());
+  Symbol& symbol = symbols->back();
+  symbol.kind = kind;
+  symbol.addr = addr;
+  symbol.size = size;
+  symbol.name = name;
+  return symbols->size() - 1;
+}
+
+}  // namespace pe
@@ -0,0 +1,250 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares a reader that extracts the information needed to decompose an
+// image directly from the streams of its PDB file, without going through DIA.
+// The section contributions, module names and compilers are read from the DBI
+// stream, the symbols from the module symbol streams and the global symbol
+// record stream, and the sizes of data symbols from the TPI stream.
+//
+// The symbols are presented in the order in which they appear in their
+// stream, with addresses already converted to relative addresses. Functions,
+// thunks and separated code blocks are followed by the symbols they contain,
+// and are closed by a kEndSymbol. The symbols of inlined call sites and the
+// symbols that have no static location are dropped, as they can't be
+// associated with the image.
+
+#ifndef SYZYGY_PE_PDB_SYMBOL_READER_H_
+#define SYZYGY_PE_PDB_SYMBOL_READER_H_
+
+#include <windows.h>
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "base/files/file_path.h"
+#include "base/memory/ref_counted.h"
+#include "base/strings/string16.h"
+#include "syzygy/core/address.h"
+#include "syzygy/pdb/pdb_data.h"
+#include "syzygy/pdb/pdb_file.h"
+#include "syzygy/pdb/pdb_stream.h"
+
+namespace common {
+class BinaryStreamReader;
+}  // namespace common
+
+namespace pdb {
+class TypeInfoEnumerator;
+}  // namespace pdb
+
+namespace pe {
+
+class PdbSymbolReader {
+ public:
+  typedef core::RelativeAddress RelativeAddress;
+
+  // The kinds of symbols that are reported.
+  enum SymbolKind {
+    kFunctionSymbol,
+    kThunkSymbol,
+    kSeparatedCodeSymbol,
+    kEndSymbol,
+    kScopeSymbol,
+    kDebugStartSymbol,
+    kDebugEndSymbol,
+    kDataSymbol,
+    kLabelSymbol,
+    kCallSiteSymbol,
+    kPublicSymbol,
+  };
+
+  // The flags of a symbol.
+  enum SymbolFlags {
+    // The function doesn't return.
+    kNoReturnFlag = 1 << 0,
+    // The function contains inline assembly.
+    kHasInlineAssemblyFlag = 1 << 1,
+    // The function has C++ or structured exception handling.
+    kHasExceptionHandlingFlag = 1 << 2,
+    // The scope is directly contained in a function. This is also set for
+    // separated code blocks.
+    kFunctionParentFlag = 1 << 3,
+  };
+
+  struct Symbol {
+    Symbol();
+
+    SymbolKind kind;
+    // The address of the symbol. This is the address of the end of the
+    // enclosing symbol for kEndSymbol.
+    RelativeAddress addr;
+    // The size of the symbol. For data symbols this is the size of its type,
+    // and it is 0 if the symbol has no type information.
+    size_t size;
+    // The address and size of the function that contains a scope or a
+    // separated code block, if kFunctionParentFlag is set.
+    RelativeAddress parent_addr;
+    size_t parent_size;
+    // A combination of SymbolFlags.
+    uint32_t flags;
+    // The name of the symbol. This is empty for the symbols that have none.
+    std::string name;
+  };
+  typedef std::vector<Symbol> Symbols;
+
+  // A module of the image, which is what DIA calls a compiland.
+  struct Module {
+    // The name of the module, usually the path of an object file.
+    std::string name;
+    // The name of the compiler that produced the module, or an empty string
+    // if the module has no compiler information.
+    std::string compiler_name;
+    // The symbols of the module.
+    Symbols symbols;
+  };
+  typedef std::vector<Module> Modules;
+
+  // A section contribution.
+  struct SectionContrib {
+    RelativeAddress addr;
+    size_t size;
+    // The index of the section, starting at 0.
+    size_t section;
+    // True if the contribution contains code.
+    bool code;
+    // The index of the module that produced the contribution.
+    size_t module;
+  };
+  typedef std::vector<SectionContrib> SectionContribs;
+
+  typedef std::vector<pdb::PdbFixup> PdbFixups;
+
+  PdbSymbolReader();
+
+  // Reads the symbols of a PDB file.
+  // @param pdb_path the path of the PDB file to read.
+  // @returns true on success, false otherwise.
+  bool Init(const base::FilePath& pdb_path);
+
+  // @name Accessors. These are only valid after a successful call to Init.
+  // @{
+  const Modules& modules() const { return modules_; }
+  const SectionContribs& section_contribs() const { return section_contribs_; }
+  // @returns the global data and the public symbols, in that order.
+  const Symbols& global_symbols() const { return global_symbols_; }
+  const PdbFixups& fixups() const { return fixups_; }
+  // @}
+
+ protected:
+  // An entry of the stack of nested scopes that are open while parsing a
+  // symbol stream.
+  struct OpenScope {
+    // The index of the symbol reported for the scope, or -1 if it was not
+    // reported.
+    size_t symbol_index;
+    // True if the scope is a function or a thunk.
+    bool is_function;
+    // True if the symbols within the scope are dropped.
+    bool skip;
+  };
+
+  // @name Helpers for Init.
+  // @{
+  bool ReadSectionHeaders(const pdb::PdbFile& pdb_file, int32_t stream_index);
+  bool ReadFixups(const pdb::PdbFile& pdb_file, int32_t stream_index);
+  bool ReadModuleSymbols(pdb::PdbStream* stream,
+                         size_t symbol_bytes,
+                         Module* module);
+  bool ReadGlobalSymbols(pdb::PdbStream* stream);
+  // @}
+
+  // @name VisitSymbols callbacks.
+  // @{
+  bool OnModuleSymbol(Module* module,
+                      uint16_t symbol_length,
+                      uint16_t symbol_type,
+                      common::BinaryStreamReader* reader);
+  bool OnGlobalSymbol(uint16_t symbol_length,
+                      uint16_t symbol_type,
+                      common::BinaryStreamReader* reader);
+  // @}
+
+  // Converts a section-relative address to a relative address.
+  // @param segment the index of the section, starting at 1.
+  // @param offset the offset in the section.
+  // @param addr receives the relative address.
+  // @returns true on success, false if @p segment is invalid.
+  bool ToRelativeAddress(uint16_t segment,
+                         uint32_t offset,
+                         RelativeAddress* addr) const;
+
+  // Computes the size of a type from the TPI stream.
+  // @param type_id the index of the type.
+  // @returns the size of the type, or 0 if it is unknown.
+  size_t GetTypeSize(uint32_t type_id);
+  size_t GetTypeSizeImpl(uint32_t type_id, size_t depth);
+
+  // Looks up the definition of a forward-declared class, struct or union.
+  // @param unique_name the decorated name of the type, or its name if it
+  //     has none.
+  // @returns the index of the definition, or 0 if there is none.
+  uint32_t FindTypeDefinition(const base::string16& unique_name);
+
+  // Pushes a new scope on the stack.
+  void PushScope(size_t symbol_index, bool is_function, bool skip);
+  // @returns true if the symbols in the innermost scope are dropped.
+  bool InSkippedScope() const;
+  // @returns the innermost function or thunk being parsed, or NULL.
+  Symbol* CurrentFunction(Module* module);
+
+  // Adds a symbol to @p symbols.
+  // @returns the index of the new symbol.
+  size_t AddSymbol(SymbolKind kind,
+                   RelativeAddress addr,
+                   size_t size,
+                   const std::string& name,
+                   Symbols* symbols);
+
+  // The results.
+  Modules modules_;
+  SectionContribs section_contribs_;
+  Symbols global_symbols_;
+  PdbFixups fixups_;
+
+  // The section headers of the image, used to convert addresses.
+  std::vector<IMAGE_SECTION_HEADER> section_headers_;
+
+  // The TPI stream and its enumerator, used to size data symbols.
+  scoped_refptr<pdb::PdbStream> type_stream_;
+  std::unique_ptr<pdb::TypeInfoEnumerator> type_enumerator_;
+  // Caches the sizes of the types.
+  std::map<uint32_t, size_t> type_sizes_;
+  // Maps the unique names of the complete class, struct and union types to
+  // their index. Built the first time a forward reference is resolved.
+  std::map<base::string16, uint32_t> type_definitions_;
+  bool type_definitions_built_;
+
+  // The scopes that are open in the module being parsed.
+  std::vector<OpenScope> open_scopes_;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(PdbSymbolReader);
+};
+
+}  // namespace pe
+
+#endif  // SYZYGY_PE_PDB_SYMBOL_READER_H_
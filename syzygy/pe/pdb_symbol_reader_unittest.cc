@@ -0,0 +1,99 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/pe/pdb_symbol_reader.h"
+
+#include "gtest/gtest.h"
+#include "syzygy/core/unittest_util.h"
+#include "syzygy/pe/unittest_util.h"
+
+namespace pe {
+
+namespace {
+
+typedef PdbSymbolReader::Symbol Symbol;
+typedef PdbSymbolReader::Symbols Symbols;
+
+class PdbSymbolReaderTest : public testing::PELibUnitTest {
+};
+
+}  // namespace
+
+TEST_F(PdbSymbolReaderTest, InitFailsOnMissingFile) {
+  PdbSymbolReader reader;
+  EXPECT_FALSE(reader.Init(base::FilePath(L"C:\\this\\file\\does\\not.pdb")));
+}
+
+TEST_F(PdbSymbolReaderTest, ReadTestDllPdb) {
+  PdbSymbolReader reader;
+  ASSERT_TRUE(reader.Init(
+      testing::GetExeRelativePath(testing::kTestDllPdbName)));
+
+  EXPECT_FALSE(reader.section_contribs().empty());
+  EXPECT_FALSE(reader.fixups().empty());
+  ASSERT_FALSE(reader.modules().empty());
+
+  // Every section contribution should belong to a known module.
+  for (const auto& contrib : reader.section_contribs())
+    EXPECT_LT(contrib.module, reader.modules().size());
+
+  size_t compiler_count = 0;
+  size_t function_count = 0;
+  for (const auto& module : reader.modules()) {
+    if (!module.compiler_name.empty())
+      ++compiler_count;
+
+    // The functions, thunks and separated code blocks must be closed by an
+    // end symbol.
+    size_t depth = 0;
+    for (const Symbol& symbol : module.symbols) {
+      switch (symbol.kind) {
+        case PdbSymbolReader::kFunctionSymbol:
+          ++function_count;
+          // Fall through.
+        case PdbSymbolReader::kThunkSymbol:
+        case PdbSymbolReader::kSeparatedCodeSymbol:
+          ++depth;
+          break;
+        case PdbSymbolReader::kEndSymbol:
+          ASSERT_LT(0u, depth);
+          --depth;
+          break;
+        case PdbSymbolReader::kPublicSymbol:
+          ADD_FAILURE() << "Unexpected public symbol in a module.";
+          break;
+        default:
+          break;
+      }
+    }
+    EXPECT_EQ(0u, depth);
+  }
+  EXPECT_LT(0u, compiler_count);
+  EXPECT_LT(0u, function_count);
+
+  // The global data symbols are followed by the public symbols.
+  size_t public_count = 0;
+  for (const Symbol& symbol : reader.global_symbols()) {
+    if (symbol.kind == PdbSymbolReader::kPublicSymbol) {
+      ++public_count;
+      EXPECT_FALSE(symbol.name.empty());
+    } else {
+      EXPECT_EQ(PdbSymbolReader::kDataSymbol, symbol.kind);
+      EXPECT_EQ(0u, public_count);
+    }
+  }
+  EXPECT_LT(0u, public_count);
+}
+
+}  // namespace pe
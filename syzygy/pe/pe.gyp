@@ -120,6 +120,8 @@
         'metadata.h',
         'pdb_info.cc',
         'pdb_info.h',
+        'pdb_symbol_reader.cc',
+        'pdb_symbol_reader.h',
         'pe_coff_file.h',
         'pe_coff_file_impl.h',
         'pe_coff_image_layout_builder.cc',
@@ -250,6 +252,7 @@
         'hot_patching_writer_unittest.cc',
         'metadata_unittest.cc',
         'pdb_info_unittest.cc',
+        'pdb_symbol_reader_unittest.cc',
         'pe_coff_file_unittest.cc',
         'pe_coff_image_layout_builder_unittest.cc',
         'pe_coff_relinker_unittest.cc',
@@ -290,6 +293,29 @@
         '<(src)/testing/gtest.gyp:gtest',
       ],
     },
+    {
+      'target_name': 'pe_perftests',
+      'type': 'executable',
+      'sources': [
+        'address_space_perftest.cc',
+        'block_graph_perftest.cc',
+        'block_graph_stream_perftest.cc',
+        '<(src)/syzygy/testing/run_all_unittests.cc',
+        '<(src)/testing/perf/perf_test.cc',
+        '<(src)/testing/perf/perf_test.h',
+      ],
+      'dependencies': [
+        'pe_lib',
+        'pe_unittest_utils',
+        'test_dll',
+        '<(src)/base/base.gyp:base',
+        '<(src)/base/base.gyp:test_support_base',
+        '<(src)/syzygy/core/core.gyp:core_lib',
+        '<(src)/syzygy/test_data/test_data.gyp:copy_test_dll',
+        '<(src)/syzygy/testing/testing.gyp:testing_lib',
+        '<(src)/testing/gtest.gyp:gtest',
+      ],
+    },
     {
       'target_name': 'test_dll_no_private_symbols',
       'type': 'static_library',
@@ -236,7 +236,11 @@ class PECoffFile {
     common::BinaryBufferParser parser;
   };
 
-  typedef core::AddressSpace<AddressType, SizeType, SectionInfo>
+  // The ranges are all inserted while the file is read, and the address space
+  // is then only queried, once per address translation. A sorted vector makes
+  // these lookups binary searches over contiguous memory.
+  typedef core::AddressSpace<AddressType, SizeType, SectionInfo,
+                             core::SortedVectorRangeMapPolicy>
       ImageAddressSpace;
 
   // Protected constructor, for derived classes only.
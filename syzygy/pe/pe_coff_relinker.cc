@@ -35,6 +35,7 @@ PECoffRelinker::PECoffRelinker(const TransformPolicyInterface* transform_policy)
       allow_overwrite_(false),
       inited_(false),
       input_image_layout_(&block_graph_),
+      block_graph_(BlockGraph::kArenaAllocation),
       headers_block_(NULL) {
   DCHECK(transform_policy != NULL);
 }
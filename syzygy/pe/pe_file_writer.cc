@@ -18,8 +18,12 @@
 #include <winnt.h>
 #include <imagehlp.h>  // NOLINT
 
+#include <algorithm>
+#include <memory>
+
 #include "base/logging.h"
 #include "base/files/file_util.h"
+#include "base/threading/simple_thread.h"
 #include "base/win/scoped_handle.h"
 #include "syzygy/common/buffer_parser.h"
 #include "syzygy/common/com_utils.h"
@@ -36,9 +40,12 @@ using pe::ImageLayout;
 
 namespace {
 
+// The minimum number of blocks written by a batch in kMappedWriteMode.
+const size_t kMinBlocksPerBatch = 256;
+
 template <class Type>
-bool UpdateReference(size_t start, Type new_value, std::vector<uint8_t>* data) {
-  BinaryBufferParser parser(&data->at(0), data->size());
+bool UpdateReference(size_t start, Type new_value, uint8_t* data, size_t size) {
+  BinaryBufferParser parser(data, size);
 
   Type* ref_ptr = NULL;
   if (!parser.GetAtIgnoreAlignment(start,
@@ -107,13 +114,190 @@ size_t GetSectionOffset(const ImageLayout& image_layout,
   return rel_addr - section_info.addr;
 }
 
+// Returns the sum of the 16-bit little-endian words of @p image that lie in
+// [@p start, @p end), as used by the PE checksum, without folding the carries.
+// The words are aligned on even file offsets, so a byte at an odd offset is
+// the high byte of its word. This allows the sums of adjacent ranges to be
+// added together regardless of where the ranges are split.
+uint64_t SumImageWords(const uint8_t* image, size_t start, size_t end) {
+  DCHECK(image != NULL);
+  DCHECK_LE(start, end);
+
+  uint64_t sum = 0;
+  if (start < end && (start & 1) != 0) {
+    sum += static_cast<uint64_t>(image[start]) << 8;
+    ++start;
+  }
+  const uint16_t* words = reinterpret_cast<const uint16_t*>(image + start);
+  size_t word_count = (end - start) / 2;
+  for (size_t i = 0; i < word_count; ++i)
+    sum += words[i];
+  start += 2 * word_count;
+  if (start < end)
+    sum += image[start];
+
+  return sum;
+}
+
+// Folds the carries of a sum of 16-bit words, as returned by SumImageWords.
+uint16_t FoldImageWords(uint64_t sum) {
+  while ((sum >> 16) != 0)
+    sum = (sum & 0xFFFF) + (sum >> 16);
+  return static_cast<uint16_t>(sum);
+}
+
+// The file offset at which a range of padding ends, and the byte with which
+// it is filled. A range of padding starts where the previous one ends.
+typedef std::pair<size_t, uint8_t> PaddingRange;
+typedef std::vector<PaddingRange> PaddingRanges;
+
 }  // namespace
 
+class PEFileWriter::WriteBatch : public base::DelegateSimpleThread::Delegate {
+ public:
+  // A block and the index of the section containing it.
+  typedef std::pair<const BlockGraph::Block*, size_t> PlacedBlock;
+  typedef std::vector<PlacedBlock> PlacedBlocks;
+
+  // @param writer the writer to which this batch belongs.
+  // @param image_base the preferred load address of the image.
+  // @param blocks the blocks of the image, in order.
+  // @param begin the index of the first block of this batch.
+  // @param end the index past the last block of this batch.
+  // @param file_start the file offset at which this batch starts.
+  // @param file_end the file offset at which this batch ends.
+  // @param padding the padding ranges of the image.
+  // @param image the mapping of the image.
+  // @param image_size the size of the image.
+  WriteBatch(const PEFileWriter* writer,
+             AbsoluteAddress image_base,
+             const PlacedBlocks& blocks,
+             size_t begin,
+             size_t end,
+             size_t file_start,
+             size_t file_end,
+             const PaddingRanges& padding,
+             uint8_t* image,
+             size_t image_size)
+      : writer_(writer), image_base_(image_base), blocks_(blocks),
+        begin_(begin), end_(end), file_start_(file_start),
+        file_end_(file_end), padding_(padding), image_(image),
+        image_size_(image_size), succeeded_(false), sum_(0) {
+    DCHECK(writer != NULL);
+    DCHECK_LE(begin, end);
+    DCHECK_LE(end, blocks.size());
+    DCHECK_LE(file_start, file_end);
+    DCHECK_LE(file_end, image_size);
+  }
+
+  // Writes the blocks of this batch along with the padding around them, then
+  // sums the words of the range of the file they occupy. Stops at the first
+  // error.
+  void Run() override;
+
+  // @name Accessors.
+  // @{
+  bool succeeded() const { return succeeded_; }
+  // @returns the sum of the words of this batch, as per SumImageWords.
+  uint64_t sum() const { return sum_; }
+  // @}
+
+ private:
+  // Fills [@p start, @p end) with the appropriate padding bytes.
+  void FillPadding(size_t start, size_t end);
+
+  const PEFileWriter* writer_;
+  AbsoluteAddress image_base_;
+  const PlacedBlocks& blocks_;
+  size_t begin_;
+  size_t end_;
+  size_t file_start_;
+  size_t file_end_;
+  const PaddingRanges& padding_;
+  uint8_t* image_;
+  size_t image_size_;
+
+  bool succeeded_;
+  uint64_t sum_;
+
+  DISALLOW_COPY_AND_ASSIGN(WriteBatch);
+};
+
+void PEFileWriter::WriteBatch::Run() {
+  size_t cursor = file_start_;
+  for (size_t i = begin_; i < end_; ++i) {
+    const BlockGraph::Block* block = blocks_[i].first;
+    RelativeAddress addr;
+    FileOffsetAddress file_offs;
+    size_t file_size = 0;
+    if (!writer_->LocateBlock(blocks_[i].second, block, &addr, &file_offs,
+                              &file_size)) {
+      LOG(ERROR) << "Failed to write block \"" << block->name() << "\".";
+      return;
+    }
+
+    // Blocks in the virtual portion of a section aren't written.
+    if (file_size == 0)
+      continue;
+
+    // The blocks are disjoint and sorted, and the range of the file of this
+    // batch was chosen to contain them.
+    DCHECK_LE(cursor, file_offs.value());
+    DCHECK_LE(file_offs.value() + file_size, file_end_);
+    FillPadding(cursor, file_offs.value());
+
+    // Copy the block data followed by its implicit trailing zeros, then patch
+    // the references in place.
+    uint8_t* data = image_ + file_offs.value();
+    if (block->data_size() != 0)
+      ::memcpy(data, block->data(), block->data_size());
+    ::memset(data + block->data_size(), 0, file_size - block->data_size());
+    if (!writer_->FinalizeReferences(image_base_, addr, file_offs, block,
+                                     image_, image_size_)) {
+      LOG(ERROR) << "Failed to write block \"" << block->name() << "\".";
+      return;
+    }
+
+    cursor = file_offs.value() + file_size;
+  }
+  FillPadding(cursor, file_end_);
+
+  // The range is still hot in the cache, so this is cheap.
+  sum_ = SumImageWords(image_, file_start_, file_end_);
+  succeeded_ = true;
+}
+
+void PEFileWriter::WriteBatch::FillPadding(size_t start, size_t end) {
+  PaddingRanges::const_iterator it = padding_.begin();
+  for (; it != padding_.end() && start < end; ++it) {
+    if (start >= it->first)
+      continue;
+    size_t fill_end = std::min(end, it->first);
+    ::memset(image_ + start, it->second, fill_end - start);
+    start = fill_end;
+  }
+  DCHECK_GE(start, end);
+}
+
 PEFileWriter::PEFileWriter(const ImageLayout& image_layout)
-    : image_layout_(image_layout), nt_headers_(NULL) {
+    : image_layout_(image_layout), nt_headers_(NULL),
+      write_mode_(kBufferedWriteMode), thread_count_(1) {
 }
 
 bool PEFileWriter::WriteImage(const base::FilePath& path) {
+  if (write_mode_ == kMappedWriteMode) {
+    if (!ValidateHeaders())
+      return false;
+    DCHECK(nt_headers_ != NULL);
+
+    bool success = CalculateSectionRanges();
+    if (success)
+      success = WriteBlocksMapped(path);
+    nt_headers_ = NULL;
+
+    return success;
+  }
+
   // Start by attempting to open the destination file.
   base::ScopedFILE file(base::OpenFile(path, "wb"));
   if (file.get() == NULL) {
@@ -380,6 +564,159 @@ bool PEFileWriter::WriteBlocks(FILE* file) {
   return true;
 }
 
+bool PEFileWriter::WriteBlocksMapped(const base::FilePath& path) {
+  AbsoluteAddress image_base(nt_headers_->OptionalHeader.ImageBase);
+
+  DCHECK(!image_layout_.sections.empty());
+  size_t last_section_index = image_layout_.sections.size() - 1;
+  size_t image_size = GetSectionFileRange(last_section_index).end().value();
+
+  // Collect the padding ranges in file order. The header comes first. The
+  // gap between a section and the previous one gets the padding byte of the
+  // section, as it does in the buffered mode.
+  PaddingRanges padding;
+  padding.push_back(std::make_pair(
+      GetSectionFileRange(BlockGraph::kInvalidSectionId).end().value(),
+      GetSectionPaddingByte(image_layout_, BlockGraph::kInvalidSectionId)));
+  for (size_t i = 0; i < image_layout_.sections.size(); ++i) {
+    padding.push_back(std::make_pair(GetSectionFileRange(i).end().value(),
+                                     GetSectionPaddingByte(image_layout_, i)));
+  }
+
+  // Determine the section index of each block. See WriteBlocks for why the
+  // section index isn't the section ID of the block.
+  WriteBatch::PlacedBlocks blocks;
+  blocks.reserve(image_layout_.blocks.size());
+  BlockGraph::AddressSpace::RangeMap::const_iterator block_it(
+      image_layout_.blocks.address_space_impl().ranges().begin());
+  BlockGraph::AddressSpace::RangeMap::const_iterator block_end(
+      image_layout_.blocks.address_space_impl().ranges().end());
+  BlockGraph::SectionId section_id = BlockGraph::kInvalidSectionId;
+  size_t section_index = BlockGraph::kInvalidSectionId;
+  for (; block_it != block_end; ++block_it) {
+    const BlockGraph::Block* block = block_it->second;
+    if (block->section() != section_id) {
+      section_id = block->section();
+      section_index++;
+      DCHECK_GT(image_layout_.sections.size(), section_index);
+    }
+    blocks.push_back(std::make_pair(block, section_index));
+  }
+
+  // Split the blocks into batches, like the decomposer does for fixups. Each
+  // batch owns the range of the file from its first block up to the first
+  // block of the next batch, so that the batches write disjoint ranges.
+  size_t batch_count = 1;
+  if (thread_count_ > 1) {
+    batch_count = std::min(4 * thread_count_,
+                           blocks.size() / kMinBlocksPerBatch);
+    batch_count = std::max<size_t>(batch_count, 1);
+  }
+  size_t batch_size = (blocks.size() + batch_count - 1) / batch_count;
+  std::vector<size_t> batch_file_starts;
+  for (size_t begin = 0; begin < blocks.size(); begin += batch_size) {
+    if (begin == 0) {
+      batch_file_starts.push_back(0);
+      continue;
+    }
+
+    // Blocks in the virtual portion of a section are clamped to the end of
+    // the section's data on disk.
+    RelativeAddress addr;
+    FileOffsetAddress file_offs;
+    size_t file_size = 0;
+    if (!LocateBlock(blocks[begin].second, blocks[begin].first, &addr,
+                     &file_offs, &file_size)) {
+      LOG(ERROR) << "Failed to write block \""
+                 << blocks[begin].first->name() << "\".";
+      return false;
+    }
+    FileOffsetAddress section_file_end =
+        GetSectionFileRange(blocks[begin].second).end();
+    size_t file_start = std::min(file_offs, section_file_end).value();
+    DCHECK_LE(batch_file_starts.back(), file_start);
+    batch_file_starts.push_back(file_start);
+  }
+
+  // Create the output file and map it, at its final size.
+  base::win::ScopedHandle file_handle(
+      ::CreateFile(path.value().c_str(), GENERIC_READ | GENERIC_WRITE, 0,
+                   NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL));
+  if (!file_handle.IsValid()) {
+    LOG(ERROR) << "Unable to open " << path.value();
+    return false;
+  }
+  base::win::ScopedHandle file_mapping(
+      ::CreateFileMapping(file_handle.Get(), NULL, PAGE_READWRITE, 0,
+                          static_cast<DWORD>(image_size), NULL));
+  uint8_t* image = NULL;
+  if (file_mapping.IsValid()) {
+    image = reinterpret_cast<uint8_t*>(
+        ::MapViewOfFile(file_mapping.Get(), FILE_MAP_WRITE, 0, 0, image_size));
+  }
+  if (image == NULL) {
+    DWORD error = ::GetLastError();
+    LOG(ERROR) << "Failed to map " << path.value() << ": "
+               << common::LogWe(error);
+    return false;
+  }
+
+  std::vector<std::unique_ptr<WriteBatch>> batches;
+  for (size_t i = 0; i < batch_file_starts.size(); ++i) {
+    size_t begin = i * batch_size;
+    size_t end = std::min(begin + batch_size, blocks.size());
+    size_t file_end = i + 1 < batch_file_starts.size() ?
+        batch_file_starts[i + 1] : image_size;
+    batches.push_back(std::unique_ptr<WriteBatch>(new WriteBatch(
+        this, image_base, blocks, begin, end, batch_file_starts[i], file_end,
+        padding, image, image_size)));
+  }
+
+  if (batches.size() <= 1) {
+    for (size_t i = 0; i < batches.size(); ++i)
+      batches[i]->Run();
+  } else {
+    base::DelegateSimpleThreadPool pool(
+        "PEFileWriter",
+        static_cast<int>(std::min(thread_count_, batches.size())));
+    pool.Start();
+    for (size_t i = 0; i < batches.size(); ++i)
+      pool.AddWork(batches[i].get());
+    pool.JoinAll();
+  }
+
+  bool success = true;
+  uint64_t sum = 0;
+  for (size_t i = 0; i < batches.size(); ++i) {
+    // The batch has already logged the error.
+    if (!batches[i]->succeeded()) {
+      success = false;
+      break;
+    }
+    sum += batches[i]->sum();
+  }
+
+  // The checksum field itself is excluded from the checksum. The headers were
+  // validated, so they can be found in the mapping.
+  if (success) {
+    const IMAGE_DOS_HEADER* dos_header =
+        reinterpret_cast<const IMAGE_DOS_HEADER*>(image);
+    IMAGE_NT_HEADERS* nt_headers =
+        reinterpret_cast<IMAGE_NT_HEADERS*>(image + dos_header->e_lfanew);
+    size_t checksum_offset =
+        reinterpret_cast<uint8_t*>(&nt_headers->OptionalHeader.CheckSum) -
+        image;
+    sum -= SumImageWords(image, checksum_offset,
+                         checksum_offset + sizeof(DWORD));
+    nt_headers->OptionalHeader.CheckSum =
+        FoldImageWords(sum) + static_cast<DWORD>(image_size);
+  }
+
+  CHECK(::UnmapViewOfFile(image));
+
+  return success;
+}
+
 void PEFileWriter::FlushSection(size_t section_index,
                                 std::vector<uint8_t>* buffer) {
   DCHECK(buffer != NULL);
@@ -410,16 +747,59 @@ bool PEFileWriter::WriteOneBlock(AbsoluteAddress image_base,
   DCHECK(buffer != NULL);
 
   RelativeAddress addr;
-  if (!image_layout_.blocks.GetAddressOf(block, &addr)) {
+  FileOffsetAddress file_offs;
+  size_t file_size = 0;
+  if (!LocateBlock(section_index, block, &addr, &file_offs, &file_size))
+    return false;
+
+  // We shouldn't have written anything to the spot where the block belongs.
+  // This is only a DCHECK because the address space of the image layout and
+  // the consistency of the sections guarantees this for us.
+  DCHECK_LE(buffer->size(), file_offs.value());
+
+  // If this block is entirely in the virtual portion of the section, skip it.
+  if (file_size == 0)
+    return true;
+
+  // Add any necessary padding to get us to the block offset.
+  uint8_t padding_byte = GetSectionPaddingByte(image_layout_, section_index);
+  if (buffer->size() < file_offs.value())
+    buffer->resize(file_offs.value(), padding_byte);
+
+  // Copy the block data into the buffer.
+  buffer->insert(buffer->end(),
+                 block->data(),
+                 block->data() + block->data_size());
+
+  // We now want to append zeros for the implicit portion of the block data
+  // that lies within the explicit portion of the section. Since padding
+  // between blocks can be non-zero we explicitly write out these zeros.
+  DCHECK_LE(block->data_size(), file_size);
+  buffer->insert(buffer->end(), file_size - block->data_size(), 0);
+
+  // Patch up all the references.
+  return FinalizeReferences(image_base, addr, file_offs, block, &buffer->at(0),
+                            buffer->size());
+}
+
+bool PEFileWriter::LocateBlock(size_t section_index,
+                               const BlockGraph::Block* block,
+                               RelativeAddress* addr,
+                               FileOffsetAddress* file_offs,
+                               size_t* file_size) const {
+  DCHECK(block != NULL);
+  DCHECK(addr != NULL);
+  DCHECK(file_offs != NULL);
+  DCHECK(file_size != NULL);
+
+  if (!image_layout_.blocks.GetAddressOf(block, addr)) {
     LOG(ERROR) << "All blocks must have an address.";
     return false;
   }
 
-  // Get the start address of the section containing this block as well as the
-  // padding byte we need to use.
+  // Get the start address of the section containing this block.
   RelativeAddress section_start(0);
   RelativeAddress section_end(image_layout_.sections[0].addr);
-  uint8_t padding_byte = GetSectionPaddingByte(image_layout_, section_index);
   if (section_index != BlockGraph::kInvalidSectionId) {
     const ImageLayout::SectionInfo& section_info =
         image_layout_.sections[section_index];
@@ -427,75 +807,60 @@ bool PEFileWriter::WriteOneBlock(AbsoluteAddress image_base,
     section_end = section_start + section_info.size;
   }
 
-  const FileRange& section_file_range = section_file_range_map_[section_index];
+  const FileRange& section_file_range = GetSectionFileRange(section_index);
 
   // The block should lie entirely within the section.
-  if (addr < section_start || addr + block->size() > section_end) {
+  if (*addr < section_start || *addr + block->size() > section_end) {
     LOG(ERROR) << "Block lies outside of section.";
     return false;
   }
 
   // Calculate the offset from the start of the section to
   // the start of the block, and the block's file offset.
-  BlockGraph::Offset section_offs = addr - section_start;
-  FileOffsetAddress file_offs = section_file_range.start() + section_offs;
-
-  // We shouldn't have written anything to the spot where the block belongs.
-  // This is only a DCHECK because the address space of the image layout and
-  // the consistency of the sections guarantees this for us.
-  DCHECK_LE(buffer->size(), file_offs.value());
+  BlockGraph::Offset section_offs = *addr - section_start;
+  *file_offs = section_file_range.start() + section_offs;
 
   size_t inited_data_size = GetBlockInitializedDataSize(block);
 
-  // If this block is entirely in the virtual portion of the section, skip it.
-  if (file_offs >= section_file_range.end()) {
+  // If this block is entirely in the virtual portion of the section, nothing
+  // of it is stored in the file.
+  if (*file_offs >= section_file_range.end()) {
     if (inited_data_size != 0) {
       LOG(ERROR) << "Block contains explicit data or references but is in "
                  << "virtual portion of section.";
       return false;
     }
 
+    *file_size = 0;
     return true;
   }
 
   // The initialized portion of data for this block must lie entirely within the
   // initialized data for this section (this includes references to be filled in
   // and the explicit block data).
-  if (file_offs + inited_data_size > section_file_range.end()) {
+  if (*file_offs + inited_data_size > section_file_range.end()) {
     LOG(ERROR) << "Initialized portion of block data lies outside of section.";
     return false;
   }
 
-  // Add any necessary padding to get us to the block offset.
-  if (buffer->size() < file_offs.value())
-    buffer->resize(file_offs.value(), padding_byte);
-
-  // Copy the block data into the buffer.
-  buffer->insert(buffer->end(),
-                 block->data(),
-                 block->data() + block->data_size());
+  // It is possible for a block to be laid out at the end of a section such
+  // that part of its implicit data lies within the virtual portion of the
+  // section. That part isn't stored in the file.
+  *file_size = std::min<size_t>(block->size(),
+                                section_file_range.end() - *file_offs);
 
-  // We now want to append zeros for the implicit portion of the block data.
-  size_t trailing_zeros = block->size() - block->data_size();
-  if (trailing_zeros > 0) {
-    // It is possible for a block to be laid out at the end of a section such
-    // that part of its data lies within the virtual portion of the section.
-    // Since padding between blocks can be non-zero we explicitly write out any
-    // trailing zeros here. So use the section size to determine how much we are
-    // supposed to write.
-    FileOffsetAddress block_file_end = file_offs + block->size();
-    if (block_file_end > section_file_range.end()) {
-      size_t implicit_trailing_zeros =
-          block_file_end - section_file_range.end();
-      DCHECK_LE(implicit_trailing_zeros, trailing_zeros);
-      trailing_zeros -= implicit_trailing_zeros;
-    }
+  return true;
+}
 
-    // Write the implicit trailing zeros.
-    buffer->insert(buffer->end(), trailing_zeros, 0);
-  }
+bool PEFileWriter::FinalizeReferences(AbsoluteAddress image_base,
+                                      RelativeAddress addr,
+                                      FileOffsetAddress file_offs,
+                                      const BlockGraph::Block* block,
+                                      uint8_t* image,
+                                      size_t image_size) const {
+  DCHECK(block != NULL);
+  DCHECK(image != NULL);
 
-  // Patch up all the references.
   BlockGraph::Block::ReferenceMap::const_iterator ref_it(
       block->references().begin());
   BlockGraph::Block::ReferenceMap::const_iterator ref_end(
@@ -539,8 +904,7 @@ bool PEFileWriter::WriteOneBlock(AbsoluteAddress image_base,
         // Get the offset of the block in its section, as well as the range of
         // the section on disk. Validate that the referred location is
         // actually directly represented on disk (not in implicit virtual data).
-        const FileRange& file_range =
-            section_file_range_map_[dst_section_index];
+        const FileRange& file_range = GetSectionFileRange(dst_section_index);
         size_t section_offset = GetSectionOffset(image_layout_,
                                                  dst_addr,
                                                  dst_section_index);
@@ -564,18 +928,24 @@ bool PEFileWriter::WriteOneBlock(AbsoluteAddress image_base,
     BlockGraph::Offset ref_offset = file_offs.value() + start;
     switch (ref.size()) {
       case sizeof(uint8_t):
-        if (!UpdateReference(ref_offset, static_cast<uint8_t>(value), buffer))
+        if (!UpdateReference(ref_offset, static_cast<uint8_t>(value), image,
+                             image_size)) {
           return false;
+        }
         break;
 
       case sizeof(uint16_t):
-        if (!UpdateReference(ref_offset, static_cast<uint16_t>(value), buffer))
+        if (!UpdateReference(ref_offset, static_cast<uint16_t>(value), image,
+                             image_size)) {
           return false;
+        }
         break;
 
       case sizeof(uint32_t):
-        if (!UpdateReference(ref_offset, static_cast<uint32_t>(value), buffer))
+        if (!UpdateReference(ref_offset, static_cast<uint32_t>(value), image,
+                             image_size)) {
           return false;
+        }
         break;
 
       default:
@@ -587,4 +957,12 @@ bool PEFileWriter::WriteOneBlock(AbsoluteAddress image_base,
   return true;
 }
 
+const PEFileWriter::FileRange& PEFileWriter::GetSectionFileRange(
+    size_t section_index) const {
+  SectionIndexFileRangeMap::const_iterator it =
+      section_file_range_map_.find(section_index);
+  DCHECK(it != section_file_range_map_.end());
+  return it->second;
+}
+
 }  // namespace pe
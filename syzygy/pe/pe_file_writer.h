@@ -15,6 +15,10 @@
 #ifndef SYZYGY_PE_PE_FILE_WRITER_H_
 #define SYZYGY_PE_PE_FILE_WRITER_H_
 
+#include <map>
+#include <utility>
+#include <vector>
+
 #include "base/files/file_path.h"
 #include "syzygy/block_graph/block_graph.h"
 #include "syzygy/core/address_space.h"
@@ -33,12 +37,42 @@ class PEFileWriter {
   typedef core::FileOffsetAddress FileOffsetAddress;
   typedef core::RelativeAddress RelativeAddress;
 
+  // The ways in which the image can be written.
+  enum WriteMode {
+    // The image is assembled in a buffer, written to the file, and the file
+    // is then read back to compute its checksum.
+    kBufferedWriteMode,
+    // The output file is sized and mapped up front. The blocks are copied and
+    // their references finalized straight into the mapping, and the checksum
+    // is accumulated as each range of the file is completed. This can use
+    // several threads.
+    kMappedWriteMode,
+  };
+
   // @param image_layout the image layout to write.
   explicit PEFileWriter(const ImageLayout& image_layout);
 
   // Writes the image to path.
   bool WriteImage(const base::FilePath& path);
 
+  // @name Mutators.
+  // @{
+  void set_write_mode(WriteMode write_mode) { write_mode_ = write_mode; }
+  // Sets the number of threads used to write the image in kMappedWriteMode.
+  // The output doesn't depend on the number of threads. Defaults to 1.
+  // @param thread_count the number of threads, which must be at least 1.
+  void set_thread_count(size_t thread_count) {
+    DCHECK_LT(0u, thread_count);
+    thread_count_ = thread_count;
+  }
+  // @}
+
+  // @name Accessors.
+  // @{
+  WriteMode write_mode() const { return write_mode_; }
+  size_t thread_count() const { return thread_count_; }
+  // @}
+
   // Updates the checksum for the image @p path.
   static bool UpdateFileChecksum(const base::FilePath& path);
 
@@ -55,6 +89,10 @@ class PEFileWriter {
   // WriteOneBlock.
   bool WriteBlocks(FILE* file);
 
+  // Writes the entire image to a mapping of the file at @p path, and sets
+  // its checksum. Delegates the blocks to WriteBatch.
+  bool WriteBlocksMapped(const base::FilePath& path);
+
   // Closes off the writing of a section by adding any necessary padding to the
   // output buffer.
   void FlushSection(size_t section_index, std::vector<uint8_t>* buffer);
@@ -67,6 +105,38 @@ class PEFileWriter {
                      const BlockGraph::Block* block,
                      std::vector<uint8_t>* buffer);
 
+  // Locates a block in the output file, and validates that its initialized
+  // data lies within the initialized data of its section.
+  // @param section_index the index of the section containing @p block.
+  // @param block the block to locate.
+  // @param addr receives the address of @p block.
+  // @param file_offs receives the file offset of @p block. This may lie past
+  //     the end of the section if the block is in its virtual portion.
+  // @param file_size receives the number of bytes of @p block that are
+  //     stored in the file. This is 0 for blocks in the virtual portion of
+  //     their section.
+  // @returns true on success, false otherwise.
+  bool LocateBlock(size_t section_index,
+                   const BlockGraph::Block* block,
+                   RelativeAddress* addr,
+                   FileOffsetAddress* file_offs,
+                   size_t* file_size) const;
+
+  // Finalizes the references of a block that has been copied to an image.
+  // @param image_base the preferred load address of the image.
+  // @param addr the address of @p block.
+  // @param file_offs the file offset of @p block.
+  // @param block the block whose references are finalized.
+  // @param image the image being written.
+  // @param image_size the number of bytes of @p image that have been written.
+  // @returns true on success, false otherwise.
+  bool FinalizeReferences(AbsoluteAddress image_base,
+                          RelativeAddress addr,
+                          FileOffsetAddress file_offs,
+                          const BlockGraph::Block* block,
+                          uint8_t* image,
+                          size_t image_size) const;
+
   // The file ranges of each section. This is populated by
   // CalculateSectionRanges and is a map from section index (as ordered in
   // the image layout) to section ranges on disk.
@@ -74,6 +144,11 @@ class PEFileWriter {
   typedef std::map<size_t, FileRange> SectionIndexFileRangeMap;
   SectionIndexFileRangeMap section_file_range_map_;
 
+  // @returns the file range of section @p section_index, which must be in
+  //     section_file_range_map_. Unlike operator[] this is safe to call from
+  //     several threads.
+  const FileRange& GetSectionFileRange(size_t section_index) const;
+
   // This stores an address-space from RVAs to section indices and is populated
   // by CalculateSectionRanges. This can be used to map from a block's
   // address to the index of its section. This is needed for finalizing
@@ -88,7 +163,16 @@ class PEFileWriter {
   // Refers to the nt headers from the image during WriteImage.
   const IMAGE_NT_HEADERS* nt_headers_;
 
+  // The write mode. Defaults to kBufferedWriteMode.
+  WriteMode write_mode_;
+  // The number of threads used in kMappedWriteMode.
+  size_t thread_count_;
+
  private:
+  // A contiguous range of blocks, and of the output file, written by a
+  // single thread in kMappedWriteMode.
+  class WriteBatch;
+
   DISALLOW_COPY_AND_ASSIGN(PEFileWriter);
 };
 
@@ -66,6 +66,45 @@ TEST_F(PEFileWriterTest, RewriteAndLoadImage) {
   ASSERT_NO_FATAL_FAILURE(CheckTestDll(temp_file));
 }
 
+TEST_F(PEFileWriterTest, MappedWriteMatchesBufferedWrite) {
+  base::FilePath temp_dir;
+  ASSERT_NO_FATAL_FAILURE(CreateTemporaryDir(&temp_dir));
+  base::FilePath buffered_file = temp_dir.Append(L"buffered.dll");
+  base::FilePath mapped_file = temp_dir.Append(L"mapped.dll");
+
+  PEFile image_file;
+  base::FilePath image_path(testing::GetExeRelativePath(testing::kTestDllName));
+  ASSERT_TRUE(image_file.Init(image_path));
+
+  Decomposer decomposer(image_file);
+  block_graph::BlockGraph block_graph;
+  pe::ImageLayout image_layout(&block_graph);
+  ASSERT_TRUE(decomposer.Decompose(&image_layout));
+
+  PEFileWriter buffered_writer(image_layout);
+  EXPECT_EQ(PEFileWriter::kBufferedWriteMode, buffered_writer.write_mode());
+  ASSERT_TRUE(buffered_writer.WriteImage(buffered_file));
+
+  std::string buffered_contents;
+  ASSERT_TRUE(base::ReadFileToString(buffered_file, &buffered_contents));
+
+  // The output, including its checksum, must not depend on the number of
+  // threads.
+  const size_t kThreadCounts[] = { 1, 4 };
+  for (size_t thread_count : kThreadCounts) {
+    PEFileWriter mapped_writer(image_layout);
+    mapped_writer.set_write_mode(PEFileWriter::kMappedWriteMode);
+    mapped_writer.set_thread_count(thread_count);
+    EXPECT_EQ(thread_count, mapped_writer.thread_count());
+    ASSERT_TRUE(mapped_writer.WriteImage(mapped_file));
+
+    std::string mapped_contents;
+    ASSERT_TRUE(base::ReadFileToString(mapped_file, &mapped_contents));
+    EXPECT_TRUE(buffered_contents == mapped_contents);
+    ASSERT_NO_FATAL_FAILURE(CheckTestDll(mapped_file));
+  }
+}
+
 TEST_F(PEFileWriterTest, UpdateFileChecksum) {
   base::FilePath temp_dir;
   ASSERT_NO_FATAL_FAILURE(CreateTemporaryDir(&temp_dir));
@@ -49,11 +49,23 @@ using pdb::WritablePdbStream;
 // Decomposes the module enclosed by the given PE file.
 bool Decompose(const PEFile& pe_file,
                const base::FilePath& pdb_path,
+               const base::FilePath& previous_decomposition_path,
                ImageLayout* image_layout,
                BlockGraph::Block** dos_header_block) {
   DCHECK(image_layout != NULL);
   DCHECK(dos_header_block != NULL);
 
+  // Load the previous decomposition, if there's one.
+  BlockGraph previous_block_graph;
+  if (!previous_decomposition_path.empty()) {
+    LOG(INFO) << "Loading previous decomposition: "
+              << previous_decomposition_path.value();
+    if (!LoadBlockGraphWithData(previous_decomposition_path,
+                                &previous_block_graph)) {
+      return false;
+    }
+  }
+
   LOG(INFO) << "Decomposing module: " << pe_file.path().value();
 
   BlockGraph* block_graph = image_layout->blocks.graph();
@@ -62,6 +74,8 @@ bool Decompose(const PEFile& pe_file,
   // Decompose the input image.
   Decomposer decomposer(pe_file);
   decomposer.set_pdb_path(pdb_path);
+  if (!previous_decomposition_path.empty())
+    decomposer.set_previous_block_graph(&previous_block_graph);
   if (!decomposer.Decompose(&orig_image_layout)) {
     LOG(ERROR) << "Unable to decompose module: " << pe_file.path().value();
     return false;
@@ -89,8 +103,13 @@ bool Decompose(const PEFile& pe_file,
 
 // Writes the image.
 bool WriteImage(const ImageLayout& image_layout,
+                size_t write_thread_count,
                 const base::FilePath& output_path) {
   PEFileWriter writer(image_layout);
+  if (write_thread_count != 0) {
+    writer.set_write_mode(PEFileWriter::kMappedWriteMode);
+    writer.set_thread_count(write_thread_count);
+  }
 
   LOG(INFO) << "Writing image: " << output_path.value();
   if (!writer.WriteImage(output_path)) {
@@ -107,8 +126,10 @@ PERelinker::PERelinker(const PETransformPolicy* pe_transform_policy)
     : PECoffRelinker(pe_transform_policy),
       pe_transform_policy_(pe_transform_policy),
       add_metadata_(true), augment_pdb_(true),
-      compress_pdb_(false), strip_strings_(false),
-      padding_(0), code_alignment_(1), output_guid_(GUID_NULL) {
+      compress_pdb_(false), compress_pdb_codec_(core::kChunkCodecZlib),
+      strip_strings_(false),
+      padding_(0), code_alignment_(1), write_thread_count_(0),
+      output_guid_(GUID_NULL) {
   DCHECK(pe_transform_policy != NULL);
 }
 
@@ -153,7 +174,8 @@ bool PERelinker::Init() {
   }
 
   // Decompose the image.
-  if (!Decompose(input_pe_file_, input_pdb_path_, &input_image_layout_,
+  if (!Decompose(input_pe_file_, input_pdb_path_,
+                 previous_decomposition_path_, &input_image_layout_,
                  &headers_block_)) {
     return false;
   }
@@ -201,16 +223,18 @@ bool PERelinker::Relink() {
     return false;
 
   // Write the image.
-  if (!WriteImage(output_image_layout, output_path_))
+  if (!WriteImage(output_image_layout, write_thread_count_, output_path_))
     return false;
 
   // From here on down we are processing the PDB file.
 
-  // Read the PDB file.
+  // Read the PDB file. It is mapped, so that the streams that aren't modified
+  // are copied straight from it when the output PDB is written. The paths
+  // were validated to ensure that the output doesn't overwrite it.
   LOG(INFO) << "Reading PDB file: " << input_pdb_path_.value();
   pdb::PdbReader pdb_reader;
   PdbFile pdb_file;
-  if (!pdb_reader.Read(input_pdb_path_, &pdb_file)) {
+  if (!pdb_reader.ReadMapped(input_pdb_path_, &pdb_file)) {
     LOG(ERROR) << "Unable to read PDB file: " << input_pdb_path_.value();
     return false;
   }
@@ -224,7 +248,10 @@ bool PERelinker::Relink() {
   GetOmapRange(input_image_layout_.sections, &input_range);
   if (!FinalizePdbFile(input_path_, output_path_, input_range,
                        output_image_layout, output_guid_, augment_pdb_,
-                       strip_strings_, compress_pdb_, &pdb_file)) {
+                       strip_strings_,
+                       compress_pdb_ ? compress_pdb_codec_
+                                     : core::kChunkCodecNone,
+                       &pdb_file)) {
     return false;
   }
 
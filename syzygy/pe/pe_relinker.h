@@ -64,6 +64,7 @@
 #include "base/files/file_path.h"
 #include "syzygy/block_graph/orderer.h"
 #include "syzygy/block_graph/transform.h"
+#include "syzygy/core/chunked_compression.h"
 #include "syzygy/pdb/pdb_mutator.h"
 #include "syzygy/pe/image_layout.h"
 #include "syzygy/pe/pe_coff_relinker.h"
@@ -115,12 +116,17 @@ class PERelinker : public PECoffRelinker {
   // @{
   const base::FilePath& input_pdb_path() const { return input_pdb_path_; }
   const base::FilePath& output_pdb_path() const { return output_pdb_path_; }
+  const base::FilePath& previous_decomposition_path() const {
+    return previous_decomposition_path_;
+  }
   bool add_metadata() const { return add_metadata_; }
   bool augment_pdb() const { return augment_pdb_; }
   bool compress_pdb() const { return compress_pdb_; }
+  core::ChunkCodec compress_pdb_codec() const { return compress_pdb_codec_; }
   bool strip_strings() const { return strip_strings_; }
   size_t padding() const { return padding_; }
   size_t code_alignment() const { return code_alignment_; }
+  size_t write_thread_count() const { return write_thread_count_; }
   // @}
 
   // @name Mutators for controlling relinker behaviour.
@@ -131,6 +137,10 @@ class PERelinker : public PECoffRelinker {
   void set_output_pdb_path(const base::FilePath& output_pdb_path) {
     output_pdb_path_ = output_pdb_path;
   }
+  void set_previous_decomposition_path(
+      const base::FilePath& previous_decomposition_path) {
+    previous_decomposition_path_ = previous_decomposition_path;
+  }
   void set_add_metadata(bool add_metadata) {
     add_metadata_ = add_metadata;
   }
@@ -140,6 +150,9 @@ class PERelinker : public PECoffRelinker {
   void set_compress_pdb(bool compress_pdb) {
     compress_pdb_ = compress_pdb;
   }
+  void set_compress_pdb_codec(core::ChunkCodec compress_pdb_codec) {
+    compress_pdb_codec_ = compress_pdb_codec;
+  }
   void set_strip_strings(bool strip_strings) {
     strip_strings_ = strip_strings;
   }
@@ -149,6 +162,9 @@ class PERelinker : public PECoffRelinker {
   void set_code_alignment(size_t alignment) {
     code_alignment_ = alignment;
   }
+  void set_write_thread_count(size_t write_thread_count) {
+    write_thread_count_ = write_thread_count;
+  }
   // @}
 
   // @see RelinkerInterface::AppendPdbMutator()
@@ -197,6 +213,10 @@ class PERelinker : public PECoffRelinker {
 
   base::FilePath input_pdb_path_;
   base::FilePath output_pdb_path_;
+  // The decomposition of a previous build of the input image, as saved by
+  // "decompose --graph-only". If specified the input image is decomposed
+  // incrementally. Defaults to empty.
+  base::FilePath previous_decomposition_path_;
 
   // If true, metadata will be added to the output image. Defaults to true.
   bool add_metadata_;
@@ -206,6 +226,8 @@ class PERelinker : public PECoffRelinker {
   // If true, then the augmented PDB stream will be compressed as it is written.
   // Defaults to false.
   bool compress_pdb_;
+  // The codec used to compress the augmented PDB stream. Defaults to zlib.
+  core::ChunkCodec compress_pdb_codec_;
   // If true, strings associated with a block-graph will not be serialized into
   // the PDB. Defaults to false.
   bool strip_strings_;
@@ -214,6 +236,10 @@ class PERelinker : public PECoffRelinker {
   size_t padding_;
   // Minimal code block alignment.
   size_t code_alignment_;
+  // The number of threads used to write the output image through a mapping
+  // of the file. Zero is the default value and indicates that the image is
+  // buffered in memory and written serially.
+  size_t write_thread_count_;
 
   // The vectors of user supplied transforms, orderers and mutators to be
   // applied.
@@ -162,6 +162,12 @@ TEST_F(PERelinkerTest, Properties) {
   EXPECT_EQ(10u, relinker.code_alignment());
   relinker.set_code_alignment(1);
   EXPECT_EQ(1u, relinker.code_alignment());
+
+  EXPECT_EQ(0u, relinker.write_thread_count());
+  relinker.set_write_thread_count(4);
+  EXPECT_EQ(4u, relinker.write_thread_count());
+  relinker.set_write_thread_count(0);
+  EXPECT_EQ(0u, relinker.write_thread_count());
 }
 
 TEST_F(PERelinkerTest, AppendPdbMutators) {
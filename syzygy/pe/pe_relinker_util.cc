@@ -14,10 +14,13 @@
 
 #include "syzygy/pe/pe_relinker_util.h"
 
+#include <iterator>
+#include <vector>
+
 #include "base/files/file_util.h"
+#include "base/sys_info.h"
 #include "syzygy/block_graph/transform.h"
 #include "syzygy/core/file_util.h"
-#include "syzygy/core/zstream.h"
 #include "syzygy/pdb/pdb_byte_stream.h"
 #include "syzygy/pdb/pdb_util.h"
 #include "syzygy/pe/find.h"
@@ -83,17 +86,20 @@ void BuildOmapVectors(const RelativeAddressRange& input_range,
   RelativeAddressRange output_range;
   GetOmapRange(output_image_layout.sections, &output_range);
 
-  ImageSourceMap reverse_map;
-  BuildImageSourceMap(output_image_layout, &reverse_map);
+  // The source maps of the sections are built in parallel.
+  ColumnarSourceMap reverse_map;
+  BuildColumnarSourceMap(output_image_layout,
+                         base::SysInfo::NumberOfProcessors(),
+                         &reverse_map);
 
-  ImageSourceMap forward_map;
+  ColumnarSourceMap forward_map;
   if (reverse_map.ComputeInverse(&forward_map) != 0) {
     LOG(WARNING) << "OMAPFROM not unique (there exist repeated source ranges).";
   }
 
   // Build the two OMAP vectors.
-  BuildOmapVectorFromImageSourceMap(output_range, reverse_map, omap_to);
-  BuildOmapVectorFromImageSourceMap(input_range, forward_map, omap_from);
+  BuildOmapVectorFromColumnarSourceMap(output_range, reverse_map, omap_to);
+  BuildOmapVectorFromColumnarSourceMap(input_range, forward_map, omap_from);
 }
 
 // Get a specific named stream if it already exists, otherwise create one.
@@ -240,11 +246,12 @@ bool WriteSyzygyHistoryStream(const base::FilePath& input_path,
 // documentation and pdb::kSyzygyBlockGraphStreamVersion (in pdb_constants.h).
 // The block graph stream will not include the data from the blocks of the
 // block-graph. If the strip-strings flag is set to true the strings contained
-// in the block-graph won't be saved.
+// in the block-graph won't be saved. Unless the codec is kChunkCodecNone the
+// serialized block-graph is stored in a chunked compression container.
 bool WriteSyzygyBlockGraphStream(const PEFile& pe_file,
                                  const ImageLayout& image_layout,
                                  bool strip_strings,
-                                 bool compress,
+                                 core::ChunkCodec codec,
                                  NameStreamMap* name_stream_map,
                                  PdbFile* pdb_file) {
   // Get the redecomposition data stream.
@@ -264,45 +271,59 @@ bool WriteSyzygyBlockGraphStream(const PEFile& pe_file,
       block_graph_reader->GetWritableStream();
   DCHECK(block_graph_writer.get() != NULL);
 
-  // Write the version of the BlockGraph stream, and whether or not its
-  // contents are compressed.
+  // Write the version of the BlockGraph stream, and how its contents are
+  // compressed.
+  bool compress = codec != core::kChunkCodecNone;
+  uint8_t compression = compress ? pdb::kSyzygyBlockGraphStreamChunkCompressed
+                                 : pdb::kSyzygyBlockGraphStreamUncompressed;
   if (!block_graph_writer->Write(pdb::kSyzygyBlockGraphStreamVersion) ||
-      !block_graph_writer->Write(static_cast<unsigned char>(compress))) {
+      !block_graph_writer->Write(compression)) {
     LOG(ERROR) << "Failed to write Syzygy BlockGraph stream header.";
     return false;
   }
 
-  // Set up the output stream.
-  PdbOutStream pdb_out_stream(block_graph_writer.get());
-  core::OutStream* out_stream = &pdb_out_stream;
-
-  // If requested, compress the output.
-  std::unique_ptr<core::ZOutStream> zip_stream;
-  if (compress) {
-    zip_stream.reset(new core::ZOutStream(&pdb_out_stream));
-    out_stream = zip_stream.get();
-    if (!zip_stream->Init(core::ZOutStream::kZBestCompression)) {
-      LOG(ERROR) << "Failed to initialize zlib compressor.";
-      return false;
-    }
-  }
-
-  core::OutArchive out_archive(out_stream);
-
   // Set up the serialization properties.
   block_graph::BlockGraphSerializer::Attributes attributes = 0;
   if (strip_strings)
     attributes |= block_graph::BlockGraphSerializer::OMIT_STRINGS;
 
-  // And finally, perform the serialization.
+  // Serialize straight into the stream, unless the output is to be
+  // compressed. The chunks of a chunked compression container are compressed
+  // independently, so we may as well use all of the processors to do so.
+  PdbOutStream pdb_out_stream(block_graph_writer.get());
+  if (!compress) {
+    core::OutArchive out_archive(&pdb_out_stream);
+    if (!SaveBlockGraphAndImageLayout(pe_file, attributes, image_layout,
+                                      &out_archive)) {
+      LOG(ERROR) << "SaveBlockGraphAndImageLayout failed.";
+      return false;
+    }
+    return true;
+  }
+
+  std::vector<uint8_t> buffer;
+  core::ScopedOutStreamPtr out_stream(
+      core::CreateByteOutStream(std::back_inserter(buffer)));
+  core::OutArchive out_archive(out_stream.get());
   if (!SaveBlockGraphAndImageLayout(pe_file, attributes, image_layout,
                                     &out_archive)) {
     LOG(ERROR) << "SaveBlockGraphAndImageLayout failed.";
     return false;
   }
 
-  // We have to flush the stream in case it's a zstream.
-  out_stream->Flush();
+  std::vector<uint8_t> container;
+  if (!core::CompressChunked(buffer.data(), buffer.size(), codec,
+                             core::kDefaultChunkSize,
+                             base::SysInfo::NumberOfProcessors(),
+                             &container)) {
+    LOG(ERROR) << "Failed to compress Syzygy BlockGraph stream.";
+    return false;
+  }
+
+  if (!pdb_out_stream.Write(container.size(), container.data())) {
+    LOG(ERROR) << "Failed to write Syzygy BlockGraph stream.";
+    return false;
+  }
 
   return true;
 }
@@ -504,7 +525,7 @@ bool FinalizePdbFile(const base::FilePath input_module,
                      const GUID& guid,
                      bool augment_pdb,
                      bool strip_strings,
-                     bool compress_pdb,
+                     core::ChunkCodec compress_pdb_codec,
                      pdb::PdbFile* pdb_file) {
   DCHECK(pdb_file != NULL);
 
@@ -553,7 +574,7 @@ bool FinalizePdbFile(const base::FilePath input_module,
     if (!WriteSyzygyBlockGraphStream(new_pe_file,
                                      image_layout,
                                      strip_strings,
-                                     compress_pdb,
+                                     compress_pdb_codec,
                                      &name_stream_map,
                                      pdb_file)) {
       return false;
@@ -21,6 +21,7 @@
 
 #include "base/files/file_path.h"
 #include "syzygy/block_graph/ordered_block_graph.h"
+#include "syzygy/core/chunked_compression.h"
 #include "syzygy/pdb/pdb_file.h"
 #include "syzygy/pe/image_layout.h"
 #include "syzygy/pe/image_source_map.h"
@@ -123,7 +124,8 @@ void GetOmapRange(const std::vector<ImageLayout::SectionInfo>& sections,
 // @param strip_strings If true then all strings will be stripped from the
 //     serialized block-graph, to save on space. Has no effect unless
 //     @p augment_pdb is true.
-// @param compress_pdb If true then the serialized block-graph will be
+// @param compress_pdb_codec The codec used to compress the serialized
+//     block-graph. If this is core::kChunkCodecNone the block-graph is not
 //     compressed. Has no effect unless @p augment_pdb is true.
 // @param pdb_file The decomposed original PDB file to be updated.
 // @returns true on success, false otherwise.
@@ -136,7 +138,7 @@ bool FinalizePdbFile(const base::FilePath input_module,
                      const GUID& guid,
                      bool augment_pdb,
                      bool strip_strings,
-                     bool compress_pdb,
+                     core::ChunkCodec compress_pdb_codec,
                      pdb::PdbFile* pdb_file);
 
 }  // namespace pe
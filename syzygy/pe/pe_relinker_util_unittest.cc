@@ -310,7 +310,7 @@ TEST_F(PERelinkerUtilTest, GetOmapRangeAndFinalizePdb) {
                               guid,
                               true,   // augment_pdb.
                               false,  // strip_strings.
-                              true,   // compress_pdb.
+                              core::kChunkCodecZlib,  // compress_pdb_codec.
                               &pdb_file));
 
   pdb::PdbInfoHeader70 pdb_header;
@@ -112,8 +112,7 @@ class PETransformPolicyTest : public testing::PELibUnitTest {
     }
 
     // Set up a data label in the destination block, which splits it in half.
-    ASSERT_TRUE(dst->SetLabel(20, BlockGraph::Label(
-        "data", BlockGraph::DATA_LABEL)));
+    ASSERT_TRUE(dst->SetLabel(20, "data", BlockGraph::DATA_LABEL));
 
     // We need the data label to be self-referenced otherwise the referrers test
     // will always fail. This is from a different offset than what we would
@@ -469,7 +468,7 @@ TEST_F(PETransformPolicyTest,
   BlockGraph::Block* code = image_.AddBlock(BlockGraph::CODE_BLOCK, 40, "c");
   const BlockGraph::Offset kDataLabelOffset = 0x10;
   code->SetLabel(kDataLabelOffset,
-                 BlockGraph::Label("data", BlockGraph::DATA_LABEL));
+                 "data", BlockGraph::DATA_LABEL);
 
   // We have a single unreferenced data label.
   TestPETransformPolicy policy;
@@ -497,8 +496,7 @@ TEST_F(PETransformPolicyTest,
 TEST_F(PETransformPolicyTest,
        CodeBlockReferrersAreClConsistentUnreferencedData) {
   BlockGraph::Block* code = image_.AddBlock(BlockGraph::CODE_BLOCK, 40, "c");
-  ASSERT_TRUE(code->SetLabel(20, BlockGraph::Label(
-      "data", BlockGraph::DATA_LABEL)));
+  ASSERT_TRUE(code->SetLabel(20, "data", BlockGraph::DATA_LABEL));
   TestPETransformPolicy policy;
   ASSERT_FALSE(policy.CodeBlockReferrersAreClConsistent(code));
 }
@@ -519,8 +517,7 @@ TEST_F(PETransformPolicyTest,
   ASSERT_TRUE(policy.CodeBlockIsSafeToBasicBlockDecompose(code));
 
   // Even if this block has unreferenced data, it should be fine.
-  ASSERT_TRUE(code->SetLabel(20, BlockGraph::Label(
-      "data", BlockGraph::DATA_LABEL)));
+  ASSERT_TRUE(code->SetLabel(20, "data", BlockGraph::DATA_LABEL));
   ASSERT_TRUE(policy.CodeBlockIsSafeToBasicBlockDecompose(code));
 }
 
@@ -548,8 +545,7 @@ TEST_F(PETransformPolicyTest, CodeBlockIsSafeToBasicBlockDecomposeCache) {
 
   // Add an unreferenced data label. This should make the analysis fail.
   // However, it should be looked up in the cache and return true.
-  ASSERT_TRUE(code->SetLabel(1, BlockGraph::Label(
-      "data", BlockGraph::DATA_LABEL)));
+  ASSERT_TRUE(code->SetLabel(1, "data", BlockGraph::DATA_LABEL));
   ASSERT_FALSE(policy.CodeBlockIsSafeToBasicBlockDecompose(code));
   ASSERT_TRUE(policy.BlockIsSafeToBasicBlockDecompose(code));
   EXPECT_EQ(1u, policy.block_result_cache_->size());
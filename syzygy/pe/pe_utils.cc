@@ -305,9 +305,8 @@ bool AddLabelToBlock(BlockGraph::Offset offset,
   }
 
   // Update the label.
-  label = BlockGraph::Label(new_name, new_label_attr);
   CHECK(block->RemoveLabel(offset));
-  CHECK(block->SetLabel(offset, label));
+  CHECK(block->SetLabel(offset, new_name, new_label_attr));
 
   return true;
 }
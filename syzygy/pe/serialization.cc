@@ -14,6 +14,10 @@
 
 #include "syzygy/pe/serialization.h"
 
+#include <string.h>
+
+#include <iterator>
+
 #include "base/bind.h"
 #include "base/files/file_util.h"
 #include "syzygy/block_graph/typed_block.h"
@@ -33,6 +37,9 @@ using block_graph::BlockGraphSerializer;
 // non-backwards compatible changes are made to the stream layout.
 static const uint32_t kSerializedBlockGraphAndImageLayoutVersion = 0;
 
+// Used for versioning the prefix of the indexed serialization.
+static const uint32_t kIndexedBlockGraphAndImageLayoutVersion = 0;
+
 bool MetadataMatchesPEFile(const Metadata& metadata, const PEFile& pe_file) {
   PEFile::Signature pe_signature;
   pe_file.GetSignature(&pe_signature);
@@ -160,6 +167,22 @@ bool FindPEFile(const Metadata& metadata, PEFile* pe_file) {
   return true;
 }
 
+bool InitMetadata(const PEFile& pe_file, Metadata* metadata) {
+  DCHECK(metadata != NULL);
+
+  // Get the metadata for this module and the toolchain. This will
+  // allow us to validate input files in other pieces of the toolchain.
+  PEFile::Signature pe_file_signature;
+  pe_file.GetSignature(&pe_file_signature);
+  if (!metadata->Init(pe_file_signature)) {
+    LOG(ERROR) << "Unable to initialize metadata for PE file \""
+               << pe_file.path().value() << "\".";
+    return false;
+  }
+
+  return true;
+}
+
 // This callback is used to save the data in a block by simply savings its
 // address in the image-layout.
 bool SaveBlockData(const ImageLayout* image_layout,
@@ -190,6 +213,37 @@ bool SaveBlockData(const ImageLayout* image_layout,
   return true;
 }
 
+// Populates the sections of an image-layout from the headers of the image.
+// The references of @p dos_header_block must already be loaded.
+bool CopyDosHeaderToImageLayout(const BlockGraph::Block* dos_header_block,
+                                ImageLayout* image_layout) {
+  DCHECK(dos_header_block != NULL);
+  DCHECK(image_layout != NULL);
+
+  // Cast this as an IMAGE_DOS_HEADER.
+  block_graph::ConstTypedBlock<IMAGE_DOS_HEADER> dos_header;
+  if (!dos_header.Init(0, dos_header_block)) {
+    LOG(ERROR) << "Unable to cast DOS header block to IMAGE_DOS_HEADER.";
+    return false;
+  }
+
+  // Get the NT headers.
+  block_graph::ConstTypedBlock<IMAGE_NT_HEADERS> nt_headers;
+  if (!dos_header.Dereference(dos_header->e_lfanew, &nt_headers)) {
+    LOG(ERROR) << "Unable to dereference NT headers from DOS header.";
+    return false;
+  }
+
+  // Finally, use these headers to populate the section info vector of the
+  // image-layout.
+  if (!CopyHeaderToImageLayout(nt_headers.block(), image_layout)) {
+    LOG(ERROR) << "Unable to copy NT headers to image-layout.";
+    return false;
+  }
+
+  return true;
+}
+
 // This callback is used to load the data in a block. It also simultaneously
 // constructs the image-layout.
 bool LoadBlockData(const PEFile* pe_file,
@@ -314,28 +368,7 @@ bool LoadBlockGraphAndImageLayout(
     return false;
   }
 
-  // Cast this as an IMAGE_DOS_HEADER.
-  block_graph::ConstTypedBlock<IMAGE_DOS_HEADER> dos_header;
-  if (!dos_header.Init(0, dos_header_block)) {
-    LOG(ERROR) << "Unable to cast DOS header block to IMAGE_DOS_HEADER.";
-    return false;
-  }
-
-  // Get the NT headers.
-  block_graph::ConstTypedBlock<IMAGE_NT_HEADERS> nt_headers;
-  if (!dos_header.Dereference(dos_header->e_lfanew, &nt_headers)) {
-    LOG(ERROR) << "Unable to dereference NT headers from DOS header.";
-    return false;
-  }
-
-  // Finally, use these headers to populate the section info vector of the
-  // image-layout.
-  if (!CopyHeaderToImageLayout(nt_headers.block(), image_layout)) {
-    LOG(ERROR) << "Unable to copy NT headers to image-layout.";
-    return false;
-  }
-
-  return true;
+  return CopyDosHeaderToImageLayout(dos_header_block, image_layout);
 }
 
 }  // namespace
@@ -354,16 +387,9 @@ bool SaveBlockGraphAndImageLayout(
     return false;
   }
 
-  // Get the metadata for this module and the toolchain. This will
-  // allow us to validate input files in other pieces of the toolchain.
   Metadata metadata;
-  PEFile::Signature pe_file_signature;
-  pe_file.GetSignature(&pe_file_signature);
-  if (!metadata.Init(pe_file_signature)) {
-    LOG(ERROR) << "Unable to initialize metadata for PE file \""
-               << pe_file.path().value() << "\".";
+  if (!InitMetadata(pe_file, &metadata))
     return false;
-  }
 
   // Save the metadata.
   if (!out_archive->Save(metadata)) {
@@ -421,4 +447,175 @@ bool LoadBlockGraphAndImageLayout(
   return true;
 }
 
+bool SaveIndexedBlockGraphAndImageLayout(
+    const PEFile& pe_file,
+    block_graph::BlockGraphSerializer::Attributes attributes,
+    const ImageLayout& image_layout,
+    std::vector<uint8_t>* buffer) {
+  DCHECK(buffer != NULL);
+
+  const BlockGraph& block_graph = *image_layout.blocks.graph();
+
+  BlockGraph::Block* dos_header_block =
+      image_layout.blocks.GetBlockByAddress(core::RelativeAddress());
+  if (dos_header_block == NULL) {
+    LOG(ERROR) << "Unable to find DOS header in image-layout address-space.";
+    return false;
+  }
+
+  Metadata metadata;
+  if (!InitMetadata(pe_file, &metadata))
+    return false;
+
+  // The indexed serialization is preceded by a prefix containing the version,
+  // the metadata and the id of the DOS header block. The prefix is itself
+  // preceded by its size, so that the indexed serialization can be located
+  // without parsing it.
+  std::vector<uint8_t> prefix;
+  core::ScopedOutStreamPtr out_stream(
+      core::CreateByteOutStream(std::back_inserter(prefix)));
+  core::NativeBinaryOutArchive out_archive(out_stream.get());
+  if (!out_archive.Save(kIndexedBlockGraphAndImageLayoutVersion) ||
+      !out_archive.Save(metadata) ||
+      !out_archive.Save(dos_header_block->id())) {
+    LOG(ERROR) << "Unable to save indexed block-graph prefix.";
+    return false;
+  }
+
+  uint32_t prefix_size = static_cast<uint32_t>(prefix.size());
+  const uint8_t* prefix_size_bytes =
+      reinterpret_cast<const uint8_t*>(&prefix_size);
+  buffer->insert(buffer->end(), prefix_size_bytes,
+                 prefix_size_bytes + sizeof(prefix_size));
+  buffer->insert(buffer->end(), prefix.begin(), prefix.end());
+
+  // Serialize the block-graph, without the data as it can all be retrieved
+  // from the PE file.
+  BlockGraphSerializer bgs;
+  bgs.set_data_mode(BlockGraphSerializer::OUTPUT_NO_DATA);
+  bgs.set_attributes(attributes);
+  bgs.set_save_block_data_callback(base::Bind(
+      &SaveBlockData,
+      base::Unretained(&image_layout)));
+  if (!bgs.SaveIndexed(block_graph, buffer)) {
+    LOG(ERROR) << "Unable to save indexed block-graph.";
+    return false;
+  }
+
+  return true;
+}
+
+bool LoadBlockGraphWithData(const base::FilePath& path,
+                            BlockGraph* block_graph) {
+  DCHECK(block_graph != NULL);
+
+  base::ScopedFILE in_file(base::OpenFile(path, "rb"));
+  if (in_file.get() == NULL) {
+    LOG(ERROR) << "Unable to open \"" << path.value() << "\".";
+    return false;
+  }
+  core::FileInStream in_stream(in_file.get());
+  core::NativeBinaryInArchive in_archive(&in_stream);
+
+  BlockGraphSerializer bgs;
+  if (!bgs.Load(block_graph, &in_archive)) {
+    LOG(ERROR) << "Unable to load block-graph from \"" << path.value()
+               << "\".";
+    return false;
+  }
+
+  if (bgs.data_mode() != BlockGraphSerializer::OUTPUT_ALL_DATA) {
+    LOG(ERROR) << "The block-graph in \"" << path.value() << "\" does not "
+               << "contain its data.";
+    return false;
+  }
+
+  if (bgs.has_attributes(BlockGraphSerializer::OMIT_STRINGS)) {
+    LOG(ERROR) << "The block-graph in \"" << path.value() << "\" does not "
+               << "contain its strings.";
+    return false;
+  }
+
+  return true;
+}
+
+LazyImageLayoutLoader::LazyImageLayoutLoader() : dos_header_block_(NULL) {
+}
+
+bool LazyImageLayoutLoader::Init(const PEFile& pe_file,
+                                 const uint8_t* data,
+                                 size_t size,
+                                 ImageLayout* image_layout) {
+  DCHECK(data != NULL);
+  DCHECK(image_layout != NULL);
+  DCHECK(dos_header_block_ == NULL);
+
+  // Read and parse the prefix.
+  uint32_t prefix_size = 0;
+  if (size < sizeof(prefix_size)) {
+    LOG(ERROR) << "Indexed block-graph stream is too small.";
+    return false;
+  }
+  ::memcpy(&prefix_size, data, sizeof(prefix_size));
+  if (prefix_size > size - sizeof(prefix_size)) {
+    LOG(ERROR) << "Invalid indexed block-graph prefix size.";
+    return false;
+  }
+  const uint8_t* prefix = data + sizeof(prefix_size);
+
+  core::ScopedInStreamPtr in_stream(
+      core::CreateByteInStream(prefix, prefix + prefix_size));
+  core::NativeBinaryInArchive in_archive(in_stream.get());
+  uint32_t version = 0;
+  Metadata metadata;
+  BlockGraph::BlockId dos_header_id = 0;
+  if (!in_archive.Load(&version)) {
+    LOG(ERROR) << "Unable to load indexed block-graph prefix.";
+    return false;
+  }
+  if (version != kIndexedBlockGraphAndImageLayoutVersion) {
+    LOG(ERROR) << "Invalid indexed stream version " << version
+               << ", expected " << kIndexedBlockGraphAndImageLayoutVersion
+               << ".";
+    return false;
+  }
+  if (!in_archive.Load(&metadata) || !in_archive.Load(&dos_header_id)) {
+    LOG(ERROR) << "Unable to load indexed block-graph prefix.";
+    return false;
+  }
+
+  if (!MetadataMatchesPEFile(metadata, pe_file)) {
+    LOG(ERROR) << "Provided PE file does not match signature in serialized "
+               << "stream.";
+    return false;
+  }
+
+  // Initialize the block-graph loader. Blocks are inserted in the
+  // image-layout as they are loaded.
+  loader_.set_load_block_data_callback(
+      base::Bind(&LoadBlockData,
+                 base::Unretained(&pe_file),
+                 base::Unretained(image_layout)));
+  const uint8_t* indexed = prefix + prefix_size;
+  if (!loader_.Init(indexed, data + size - indexed,
+                    image_layout->blocks.graph())) {
+    LOG(ERROR) << "Unable to initialize lazy block-graph loader.";
+    return false;
+  }
+
+  // Load the image headers, which are needed to populate the sections of the
+  // image-layout.
+  BlockGraph::Block* dos_header_block = loader_.GetBlock(dos_header_id);
+  if (dos_header_block == NULL || !loader_.LoadReferences(dos_header_block)) {
+    LOG(ERROR) << "Unable to load DOS header block.";
+    return false;
+  }
+  if (!CopyDosHeaderToImageLayout(dos_header_block, image_layout))
+    return false;
+
+  dos_header_block_ = dos_header_block;
+
+  return true;
+}
+
 }  // namespace pe
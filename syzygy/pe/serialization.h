@@ -15,8 +15,11 @@
 #ifndef SYZYGY_PE_SERIALIZATION_H_
 #define SYZYGY_PE_SERIALIZATION_H_
 
+#include <vector>
+
 #include "base/files/file_path.h"
 #include "syzygy/block_graph/block_graph_serializer.h"
+#include "syzygy/block_graph/lazy_block_graph_loader.h"
 #include "syzygy/core/serialization.h"
 #include "syzygy/pe/pe_file.h"
 
@@ -70,6 +73,91 @@ bool LoadBlockGraphAndImageLayout(
     ImageLayout* image_layout,
     core::InArchive* in_archive);
 
+// Serializes the decomposition of a PE file in the indexed format, which
+// can be loaded lazily by a LazyImageLayoutLoader. The serialization is
+// appended to @p buffer.
+// @param pe_file the PE file that the decomposition represents.
+// @param attributes the attributes to be used in serializing @p block_graph.
+// @param image_layout the layout of @p block_graph in @p pe_file.
+// @param buffer the buffer to receive the serialized decomposition.
+// @returns true on success, false otherwise.
+bool SaveIndexedBlockGraphAndImageLayout(
+    const PEFile& pe_file,
+    block_graph::BlockGraphSerializer::Attributes attributes,
+    const ImageLayout& image_layout,
+    std::vector<uint8_t>* buffer);
+
+// Loads a block-graph that was serialized on its own, with all of its data
+// and strings, as is done by "decompose --graph-only". No PE file is needed to
+// load it.
+// @param path the path of the serialized block-graph.
+// @param block_graph the block-graph to be populated. This must be empty.
+// @returns true on success, false otherwise.
+bool LoadBlockGraphWithData(const base::FilePath& path,
+                            block_graph::BlockGraph* block_graph);
+
+// Deserializes the decomposition of a PE file that was serialized by
+// SaveIndexedBlockGraphAndImageLayout. Initialization only loads the image
+// headers, which is enough to populate the sections of the image-layout.
+// Other blocks are loaded on demand, at which point they are also inserted in
+// the address-space of the image-layout.
+class LazyImageLayoutLoader {
+ public:
+  LazyImageLayoutLoader();
+
+  // Initializes the loader.
+  // @param pe_file the PE file that the decomposition represents. This must
+  //     match the metadata in the serialized stream, and must outlive the
+  //     loader.
+  // @param data the serialized decomposition. This must outlive the loader.
+  // @param size the size of @p data, in bytes.
+  // @param image_layout the image-layout to be populated. This and its
+  //     block-graph must be empty.
+  // @returns true on success, false otherwise.
+  bool Init(const PEFile& pe_file,
+            const uint8_t* data,
+            size_t size,
+            ImageLayout* image_layout);
+
+  // Gets a block, loading it if necessary.
+  // @param id the id of the block.
+  // @returns the block, or NULL if it doesn't exist or could not be loaded.
+  block_graph::BlockGraph::Block* GetBlock(
+      block_graph::BlockGraph::BlockId id) {
+    return loader_.GetBlock(id);
+  }
+
+  // Loads the references of a block, loading the referenced blocks as
+  // necessary.
+  // @param block a block that was returned by GetBlock.
+  // @returns true on success, false otherwise.
+  bool LoadReferences(block_graph::BlockGraph::Block* block) {
+    return loader_.LoadReferences(block);
+  }
+
+  // Loads the entire decomposition. After this the block-graph and
+  // image-layout are identical to those produced by
+  // LoadBlockGraphAndImageLayout.
+  // @returns true on success, false otherwise.
+  bool LoadAll() { return loader_.LoadAll(); }
+
+  // @returns the attributes used in serializing the block-graph.
+  block_graph::BlockGraphSerializer::Attributes attributes() const {
+    return loader_.attributes();
+  }
+
+  // @returns the header block of the image.
+  block_graph::BlockGraph::Block* dos_header_block() const {
+    return dos_header_block_;
+  }
+
+ private:
+  block_graph::LazyBlockGraphLoader loader_;
+  block_graph::BlockGraph::Block* dos_header_block_;
+
+  DISALLOW_COPY_AND_ASSIGN(LazyImageLayoutLoader);
+};
+
 }  // namespace pe
 
 #endif  // SYZYGY_PE_SERIALIZATION_H_
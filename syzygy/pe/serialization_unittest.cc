@@ -161,6 +161,47 @@ TEST_F(SerializationTest, FailsForInvalidVersion) {
       &pe_file, NULL, &image_layout, ia_.get()));
 }
 
+TEST_F(SerializationTest, TestDllIndexedRoundTrip) {
+  ASSERT_NO_FATAL_FAILURE(InitDecomposition());
+  ASSERT_TRUE(SaveIndexedBlockGraphAndImageLayout(
+      pe_file_, BlockGraphSerializer::DEFAULT_ATTRIBUTES, image_layout_, &v_));
+
+  BlockGraph block_graph;
+  ImageLayout image_layout(&block_graph);
+  LazyImageLayoutLoader loader;
+  ASSERT_TRUE(loader.Init(pe_file_, v_.data(), v_.size(), &image_layout));
+
+  // Only the headers should have been loaded, but that is enough to populate
+  // the sections.
+  EXPECT_EQ(image_layout_.sections, image_layout.sections);
+  EXPECT_LT(block_graph.blocks().size(), block_graph_.blocks().size());
+  ASSERT_TRUE(loader.dos_header_block() != NULL);
+  EXPECT_EQ(image_layout.blocks.GetBlockByAddress(core::RelativeAddress()),
+            loader.dos_header_block());
+
+  ASSERT_TRUE(loader.LoadAll());
+  EXPECT_EQ(BlockGraphSerializer::DEFAULT_ATTRIBUTES, loader.attributes());
+
+  BlockGraphSerializer bgs;
+  bgs.set_data_mode(BlockGraphSerializer::OUTPUT_NO_DATA);
+  ASSERT_TRUE(testing::BlockGraphsEqual(block_graph_, block_graph, bgs));
+  ASSERT_TRUE(ImageLayoutsEqual(image_layout_, image_layout));
+}
+
+TEST_F(SerializationTest, IndexedFailsForInvalidVersion) {
+  ASSERT_NO_FATAL_FAILURE(InitDecomposition());
+  ASSERT_TRUE(SaveIndexedBlockGraphAndImageLayout(
+      pe_file_, BlockGraphSerializer::DEFAULT_ATTRIBUTES, image_layout_, &v_));
+
+  // Change the version, which follows the size of the prefix.
+  v_[sizeof(uint32_t)] += 1;
+
+  BlockGraph block_graph;
+  ImageLayout image_layout(&block_graph);
+  LazyImageLayoutLoader loader;
+  ASSERT_FALSE(loader.Init(pe_file_, v_.data(), v_.size(), &image_layout));
+}
+
 // TODO(chrisha): Check in a serialized stream, and ensure that it can still be
 //     deserialized. As we evolve stream versions, keep doing this. This will be
 //     done once decompose.exe has been updated to use the new serialization
@@ -550,7 +550,7 @@ bool PEHackerApp::WriteImages() {
     pdb::PdbFile pdb_file;
     pdb::PdbReader pdb_reader;
     VLOG(1) << "Reading original PDB.";
-    if (!pdb_reader.Read(image_info->input_pdb, &pdb_file))
+    if (!pdb_reader.ReadMapped(image_info->input_pdb, &pdb_file))
       return false;
 
     // Finalize the PDB to reflect the transformed image.
@@ -562,7 +562,7 @@ bool PEHackerApp::WriteImages() {
                              pdb_guid,
                              false,
                              false,
-                             false,
+                             core::kChunkCodecNone,
                              &pdb_file)) {
       return false;
     }
@@ -1422,7 +1422,7 @@ bool PdbCrawler::InitializeForFile(const base::FilePath& path) {
   pdb::PdbReader reader;
   pdb::PdbFile pdb_file;
 
-  if (!reader.Read(path, &pdb_file)) {
+  if (!reader.ReadMapped(path, &pdb_file)) {
     LOG(ERROR) << "Failed to read PDB file " << path.value() << ".";
     return false;
   }
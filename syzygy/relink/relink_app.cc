@@ -38,8 +38,12 @@ const char kUsageFormatStr[] =
     "    --code-alignment=<integer>\n"
     "                          Force a minimal alignment for code blocks.\n"
     "                          Default value is 1.\n"
-    "    --compress-pdb        If --no-augment-pdb is specified, causes the\n"
-    "                          augmented PDB stream to be compressed.\n"
+    "    --compress-pdb[=<codec>]\n"
+    "                          Unless --no-augment-pdb is specified, causes the\n"
+    "                          augmented PDB stream to be compressed. The codec\n"
+    "                          may be one of 'zlib' (default), 'lz' or 'none'.\n"
+    "                          'lz' compresses less but loads faster, and\n"
+    "                          'none' leaves the stream uncompressed.\n"
     "    --exclude-bb-padding  When randomly reordering basic blocks, exclude\n"
     "                          padding and unreachable code from the relinked\n"
     "                          output binary.\n"
@@ -57,7 +61,16 @@ const char kUsageFormatStr[] =
     "                          Default is inferred from output-image.\n"
     "    --overwrite           Allow output files to be overwritten.\n"
     "    --padding=<integer>   Add bytes of padding between blocks.\n"
+    "    --previous-decomposition=<path>\n"
+    "                          The decomposition of a previous build of the\n"
+    "                          input image, as output by decompose with\n"
+    "                          --graph-only. The symbols of blocks that are\n"
+    "                          unchanged since then are not parsed again.\n"
     "    --verbose             Log verbosely.\n"
+    "    --write-jobs=<integer>\n"
+    "                          Write the output image through a mapping of\n"
+    "                          the file, using this many threads. The checksum\n"
+    "                          is computed as the image is written.\n"
     "\n"
     "  Testing Options:\n"
     "    --fuzz                Fuzz the binary.\n"
@@ -122,8 +135,13 @@ bool RelinkApp::ParseCommandLine(const base::CommandLine* cmd_line) {
 
   output_pdb_path_ = cmd_line->GetSwitchValuePath("output-pdb");
   order_file_path_ = AbsolutePath(cmd_line->GetSwitchValuePath("order-file"));
+  previous_decomposition_path_ =
+      AbsolutePath(cmd_line->GetSwitchValuePath("previous-decomposition"));
   no_augment_pdb_ = cmd_line->HasSwitch("no-augment-pdb");
   compress_pdb_ = cmd_line->HasSwitch("compress-pdb");
+  std::string codec = cmd_line->GetSwitchValueASCII("compress-pdb");
+  if (!codec.empty() && !core::ParseChunkCodec(codec, &compress_pdb_codec_))
+    return Usage(cmd_line, "Invalid --compress-pdb codec.");
   no_strip_strings_ = cmd_line->HasSwitch("no-strip-strings");
   output_metadata_ = !cmd_line->HasSwitch("no-metadata");
   overwrite_ = cmd_line->HasSwitch("overwrite");
@@ -172,6 +190,15 @@ bool RelinkApp::ParseCommandLine(const base::CommandLine* cmd_line) {
       return Usage(cmd_line, "Code-alignment value cannot be zero.");
   }
 
+  // Parse the write jobs argument.
+  if (cmd_line->HasSwitch("write-jobs")) {
+    std::wstring jobs_str(cmd_line->GetSwitchValueNative("write-jobs"));
+    if (!ParseUInt32(jobs_str, &write_jobs_))
+      return Usage(cmd_line, "Invalid write-jobs value.");
+    if (write_jobs_ == 0)
+      return Usage(cmd_line, "Write-jobs value cannot be zero.");
+  }
+
   return true;
 }
 
@@ -202,12 +229,15 @@ int RelinkApp::Run() {
   relinker.set_input_pdb_path(input_pdb_path_);
   relinker.set_output_path(output_image_path_);
   relinker.set_output_pdb_path(output_pdb_path_);
+  relinker.set_previous_decomposition_path(previous_decomposition_path_);
   relinker.set_padding(padding_);
   relinker.set_code_alignment(code_alignment_);
+  relinker.set_write_thread_count(write_jobs_);
   relinker.set_add_metadata(output_metadata_);
   relinker.set_allow_overwrite(overwrite_);
   relinker.set_augment_pdb(!no_augment_pdb_);
   relinker.set_compress_pdb(compress_pdb_);
+  relinker.set_compress_pdb_codec(compress_pdb_codec_);
   relinker.set_strip_strings(!no_strip_strings_);
 
   // Initialize the relinker. This does the decomposition, etc.
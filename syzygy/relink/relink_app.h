@@ -22,6 +22,7 @@
 #include "base/strings/string_piece.h"
 #include "base/time/time.h"
 #include "syzygy/application/application.h"
+#include "syzygy/core/chunked_compression.h"
 
 namespace relink {
 
@@ -33,8 +34,10 @@ class RelinkApp : public application::AppImplBase {
         seed_(0),
         padding_(0),
         code_alignment_(1),
+        write_jobs_(0),
         no_augment_pdb_(false),
         compress_pdb_(false),
+        compress_pdb_codec_(core::kChunkCodecZlib),
         no_strip_strings_(false),
         output_metadata_(false),
         overwrite_(false),
@@ -64,11 +67,14 @@ class RelinkApp : public application::AppImplBase {
   base::FilePath output_image_path_;
   base::FilePath output_pdb_path_;
   base::FilePath order_file_path_;
+  base::FilePath previous_decomposition_path_;
   uint32_t seed_;
   size_t padding_;
   size_t code_alignment_;
+  size_t write_jobs_;
   bool no_augment_pdb_;
   bool compress_pdb_;
+  core::ChunkCodec compress_pdb_codec_;
   bool no_strip_strings_;
   bool output_metadata_;
   bool overwrite_;
@@ -43,11 +43,14 @@ class TestRelinkApp : public RelinkApp {
   using RelinkApp::output_image_path_;
   using RelinkApp::output_pdb_path_;
   using RelinkApp::order_file_path_;
+  using RelinkApp::previous_decomposition_path_;
   using RelinkApp::seed_;
   using RelinkApp::padding_;
   using RelinkApp::code_alignment_;
+  using RelinkApp::write_jobs_;
   using RelinkApp::no_augment_pdb_;
   using RelinkApp::compress_pdb_;
+  using RelinkApp::compress_pdb_codec_;
   using RelinkApp::no_strip_strings_;
   using RelinkApp::output_metadata_;
   using RelinkApp::overwrite_;
@@ -97,6 +100,7 @@ class RelinkAppTest : public testing::PELibUnitTest {
     output_image_path_ = temp_dir_.Append(input_image_path_.BaseName());
     output_pdb_path_ = temp_dir_.Append(input_pdb_path_.BaseName());
     order_file_path_ = temp_dir_.Append(L"order.json");
+    previous_decomposition_path_ = temp_dir_.Append(L"previous.bg");
 
     // Point the application at the test's command-line and IO streams.
     test_app_.set_command_line(&cmd_line_);
@@ -146,6 +150,7 @@ class RelinkAppTest : public testing::PELibUnitTest {
   base::FilePath output_image_path_;
   base::FilePath output_pdb_path_;
   base::FilePath order_file_path_;
+  base::FilePath previous_decomposition_path_;
   uint32_t seed_;
   size_t padding_;
   size_t code_alignment_;
@@ -252,6 +257,8 @@ TEST_F(RelinkAppTest, ParseFullCommandLineWithOrderFile) {
   cmd_line_.AppendSwitchPath("output-image", output_image_path_);
   cmd_line_.AppendSwitchPath("output-pdb", output_pdb_path_);
   cmd_line_.AppendSwitchPath("order-file", order_file_path_);
+  cmd_line_.AppendSwitchPath("previous-decomposition",
+                             previous_decomposition_path_);
   cmd_line_.AppendSwitch("no-augment-pdb");
   cmd_line_.AppendSwitch("compress-pdb");
   cmd_line_.AppendSwitch("no-strip-strings");
@@ -265,6 +272,8 @@ TEST_F(RelinkAppTest, ParseFullCommandLineWithOrderFile) {
   EXPECT_EQ(output_image_path_, test_impl_.output_image_path_);
   EXPECT_EQ(output_pdb_path_, test_impl_.output_pdb_path_);
   EXPECT_EQ(order_file_path_, test_impl_.order_file_path_);
+  EXPECT_EQ(previous_decomposition_path_,
+            test_impl_.previous_decomposition_path_);
   EXPECT_EQ(0, test_impl_.seed_);
   EXPECT_EQ(0, test_impl_.padding_);
   EXPECT_EQ(1, test_impl_.code_alignment_);
@@ -317,6 +326,41 @@ TEST_F(RelinkAppTest, ParseFullCommandLineWithInputSeedAndMetadata) {
   EXPECT_TRUE(test_impl_.SetUp());
 }
 
+TEST_F(RelinkAppTest, ParseCompressPdbCodec) {
+  cmd_line_.AppendSwitchPath("input-image", input_image_path_);
+  cmd_line_.AppendSwitchPath("output-image", output_image_path_);
+  cmd_line_.AppendSwitchASCII("compress-pdb", "lz");
+
+  EXPECT_TRUE(test_impl_.ParseCommandLine(&cmd_line_));
+  EXPECT_TRUE(test_impl_.compress_pdb_);
+  EXPECT_EQ(core::kChunkCodecLz, test_impl_.compress_pdb_codec_);
+}
+
+TEST_F(RelinkAppTest, ParseWriteJobs) {
+  cmd_line_.AppendSwitchPath("input-image", input_image_path_);
+  cmd_line_.AppendSwitchPath("output-image", output_image_path_);
+  cmd_line_.AppendSwitchASCII("write-jobs", "4");
+
+  EXPECT_TRUE(test_impl_.ParseCommandLine(&cmd_line_));
+  EXPECT_EQ(4u, test_impl_.write_jobs_);
+}
+
+TEST_F(RelinkAppTest, ParseWithZeroWriteJobsFails) {
+  cmd_line_.AppendSwitchPath("input-image", input_image_path_);
+  cmd_line_.AppendSwitchPath("output-image", output_image_path_);
+  cmd_line_.AppendSwitchASCII("write-jobs", "0");
+
+  EXPECT_FALSE(test_impl_.ParseCommandLine(&cmd_line_));
+}
+
+TEST_F(RelinkAppTest, ParseInvalidCompressPdbCodecFails) {
+  cmd_line_.AppendSwitchPath("input-image", input_image_path_);
+  cmd_line_.AppendSwitchPath("output-image", output_image_path_);
+  cmd_line_.AppendSwitchASCII("compress-pdb", "foo");
+
+  EXPECT_FALSE(test_impl_.ParseCommandLine(&cmd_line_));
+}
+
 TEST_F(RelinkAppTest, DeprecatedFlagsSucceeds) {
   cmd_line_.AppendSwitchPath("input-dll", input_image_path_);
   cmd_line_.AppendSwitchPath("output-dll", output_image_path_);
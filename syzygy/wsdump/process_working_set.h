@@ -24,7 +24,11 @@
 #include <vector>
 
 namespace core {
-  template <typename AddressType, typename SizeType, typename ItemType>
+  struct MapRangeMapPolicy;
+  template <typename AddressType,
+            typename SizeType,
+            typename ItemType,
+            typename RangeMapPolicy>
   class AddressSpace;
 };
 struct _PSAPI_WORKING_SET_INFORMATION;
@@ -75,7 +79,8 @@ class ProcessWorkingSet {
   typedef std::unique_ptr<PSAPI_WORKING_SET_INFORMATION> ScopedWsPtr;
   static bool CaptureWorkingSet(HANDLE process, ScopedWsPtr* working_set);
 
-  typedef core::AddressSpace<size_t, size_t, std::wstring> ModuleAddressSpace;
+  typedef core::AddressSpace<size_t, size_t, std::wstring,
+                             core::MapRangeMapPolicy> ModuleAddressSpace;
   static bool CaptureModules(DWORD process_id, ModuleAddressSpace* modules);
 
   // Storage for stats.
@@ -494,7 +494,8 @@ ZapTimestamp::ZapTimestamp()
       dos_header_block_(NULL),
       write_image_(true),
       write_pdb_(true),
-      overwrite_(false) {
+      overwrite_(false),
+      patch_pdb_(false) {
   // The timestamp can't just be set to zero as that represents a special
   // value in the PE file. We set it to some arbitrary fixed date in the past.
   // This is Jan 1, 2010, 0:00:00 GMT. This date shouldn't be too much in
@@ -842,10 +843,21 @@ bool ZapTimestamp::LoadAndUpdatePdbFile() {
   DCHECK(pdb_file_.get() == NULL);
 
   pdb_file_.reset(new PdbFile());
-  PdbReader pdb_reader;
-  if (!pdb_reader.Read(input_pdb_, pdb_file_.get())) {
-    LOG(ERROR) << "Failed to read PDB file: " << input_pdb_.value();
-    return false;
+  if (patch_pdb_ && write_pdb_ &&
+      core::CompareFilePaths(input_pdb_, output_pdb_) ==
+          core::kEquivalentFilePaths) {
+    pdb_patcher_.reset(new pdb::PdbPatcher());
+    if (!pdb_patcher_->Open(input_pdb_, pdb_file_.get())) {
+      LOG(ERROR) << "Failed to open PDB file for patching: "
+                 << input_pdb_.value();
+      return false;
+    }
+  } else {
+    PdbReader pdb_reader;
+    if (!pdb_reader.Read(input_pdb_, pdb_file_.get())) {
+      LOG(ERROR) << "Failed to read PDB file: " << input_pdb_.value();
+      return false;
+    }
   }
 
   // We turf the old directory stream as a fresh PDB does not have one. It's
@@ -933,6 +945,18 @@ bool ZapTimestamp::WritePeFile() {
 bool ZapTimestamp::WritePdbFile() {
   DCHECK(!input_pdb_.empty());
 
+  // When patching, only the streams that were replaced are written.
+  if (pdb_patcher_.get() != NULL) {
+    LOG(INFO) << "Patching PDB file in place: " << output_pdb_.value();
+    if (!pdb_patcher_->Commit(*pdb_file_.get())) {
+      LOG(ERROR) << "Failed to patch PDB: " << output_pdb_.value();
+      return false;
+    }
+    pdb_file_.reset(NULL);
+    pdb_patcher_.reset(NULL);
+    return true;
+  }
+
   // We actually completely rewrite the PDB file to a temporary location, and
   // then move it over top of the existing one. This is because pdb_file_
   // actually has an open file handle to the original PDB.
@@ -49,6 +49,7 @@
         '<(src)/base/base.gyp:test_support_base',
         '<(src)/syzygy/common/common.gyp:common_unittest_utils',
         '<(src)/syzygy/core/core.gyp:core_unittest_utils',
+        '<(src)/syzygy/msf/msf.gyp:msf_unittest_utils',
         '<(src)/syzygy/pe/pe.gyp:pe_unittest_utils',
         '<(src)/testing/gtest.gyp:gtest',
       ],
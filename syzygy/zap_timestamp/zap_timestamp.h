@@ -23,6 +23,7 @@
 #include "syzygy/block_graph/block_graph.h"
 #include "syzygy/core/address_space.h"
 #include "syzygy/pdb/pdb_file.h"
+#include "syzygy/pdb/pdb_patcher.h"
 #include "syzygy/pe/image_layout.h"
 #include "syzygy/pe/pe_file.h"
 
@@ -57,6 +58,9 @@ class ZapTimestamp {
   void set_overwrite(bool overwrite) {
     overwrite_ = overwrite;
   }
+  void set_patch_pdb(bool patch_pdb) {
+    patch_pdb_ = patch_pdb;
+  }
   void set_timestamp_value(size_t timestamp_value) {
     timestamp_data_ = static_cast<size_t>(timestamp_value);
   }
@@ -71,6 +75,7 @@ class ZapTimestamp {
   bool write_image() const { return write_image_; }
   bool write_pdb() const { return write_pdb_; }
   bool overwrite() const { return overwrite_; }
+  bool patch_pdb() const { return patch_pdb_; }
   size_t timestamp_value() const {
     return static_cast<size_t>(timestamp_data_);
   }
@@ -136,6 +141,10 @@ class ZapTimestamp {
   // Populated by LoadPdbFile and modified by UpdatePdbFile.
   std::unique_ptr<pdb::PdbFile> pdb_file_;
 
+  // Set by LoadAndUpdatePdbFile when the PDB file is patched in place, in
+  // which case pdb_file_ reads from it.
+  std::unique_ptr<pdb::PdbPatcher> pdb_patcher_;
+
   // These house the new values to be written when the image is zapped.
   DWORD timestamp_data_;
   DWORD pdb_age_data_;
@@ -149,6 +158,10 @@ class ZapTimestamp {
   bool write_image_;
   bool write_pdb_;
   bool overwrite_;
+  // If true, a PDB file that is zapped in place is patched rather than
+  // rewritten. Only the streams that are normalized get written, but the
+  // layout of the output then depends on that of the input.
+  bool patch_pdb_;
 
   DISALLOW_COPY_AND_ASSIGN(ZapTimestamp);
 };
@@ -47,6 +47,10 @@ const char kUsageFormatStr[] =
     "  --overwrite\n"
     "    If specified will allow overwriting of existing output files. Must\n"
     "    be specified for in place processing.\n"
+    "  --patch-pdb\n"
+    "    If specified, a PDB file that is processed in place is patched\n"
+    "    instead of being rewritten. This is faster for large PDB files, but\n"
+    "    the layout of the output then depends on that of the input.\n"
     "  --timestamp-value=<seconds since Jan 1, 1970>\n"
     "    The timestamp value to use in the binaries, if not specified an\n"
     "    arbitrary date in the past will be used (default to Jan 1, 2010).\n";
@@ -86,6 +90,7 @@ bool ZapTimestampApp::ParseCommandLine(const base::CommandLine* command_line) {
   zap_.set_write_image(!command_line->HasSwitch("no-write-image"));
   zap_.set_write_pdb(!command_line->HasSwitch("no-write-pdb"));
   zap_.set_overwrite(command_line->HasSwitch("overwrite"));
+  zap_.set_patch_pdb(command_line->HasSwitch("patch-pdb"));
 
   if (command_line->HasSwitch("timestamp-value")) {
     size_t timestamp_value = 0;
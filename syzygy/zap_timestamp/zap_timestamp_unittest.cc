@@ -18,6 +18,8 @@
 #include "base/files/scoped_temp_dir.h"
 #include "gtest/gtest.h"
 #include "syzygy/core/unittest_util.h"
+#include "syzygy/msf/unittest_util.h"
+#include "syzygy/pdb/pdb_reader.h"
 #include "syzygy/pe/unittest_util.h"
 
 namespace zap_timestamp {
@@ -334,4 +336,35 @@ TEST_F(ZapTimestampTest, IsIdempotentNoPdb) {
   EXPECT_TRUE(base::ContentsEqual(temp_pe_path_, pe_path_0));
 }
 
+TEST_F(ZapTimestampTest, PatchedPdbMatchesRewrittenPdb) {
+  ASSERT_NO_FATAL_FAILURE(CopyTestData(0));
+  base::FilePath pe_path = temp_dir_.path().Append(L"test_dll.new.dll");
+  base::FilePath pdb_path = temp_dir_.path().Append(L"test_dll.new.dll.pdb");
+
+  // Rewrite a zapped copy of the PDB.
+  ZapTimestamp zap0;
+  zap0.set_input_image(temp_pe_path_);
+  zap0.set_output_image(pe_path);
+  EXPECT_TRUE(zap0.Init());
+  EXPECT_TRUE(zap0.Zap());
+
+  // Patch the original in place.
+  ZapTimestamp zap1;
+  zap1.set_input_image(temp_pe_path_);
+  zap1.set_overwrite(true);
+  zap1.set_patch_pdb(true);
+  EXPECT_TRUE(zap1.Init());
+  EXPECT_TRUE(zap1.Zap());
+
+  // The images should match, and so should the streams of the PDB files.
+  EXPECT_TRUE(base::ContentsEqual(temp_pe_path_, pe_path));
+  pdb::PdbReader reader;
+  pdb::PdbFile rewritten_pdb;
+  pdb::PdbFile patched_pdb;
+  ASSERT_TRUE(reader.Read(pdb_path, &rewritten_pdb));
+  ASSERT_TRUE(reader.Read(temp_pdb_path_, &patched_pdb));
+  ASSERT_EQ(rewritten_pdb.StreamCount(), patched_pdb.StreamCount());
+  testing::EnsureMsfContentsAreIdentical(rewritten_pdb, patched_pdb);
+}
+
 }  // namespace zap_timestamp